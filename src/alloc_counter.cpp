@@ -0,0 +1,64 @@
+#include "alloc_counter.h"
+#include <atomic>
+#include <cstddef>
+
+#if defined(UKF_COUNT_ALLOCATIONS) && defined(__GLIBC__)
+
+namespace {
+std::atomic<unsigned long long> g_allocations(0);
+std::atomic<unsigned long long> g_forbidden(0);
+//a plain flag in the executable's static TLS, so reading it never allocates
+thread_local bool t_forbid = false;
+
+inline void CountAllocation() {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (t_forbid) {
+    g_forbidden.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+}
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  CountAllocation();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  CountAllocation();
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  CountAllocation();
+  return __libc_realloc(ptr, size);
+}
+}
+
+bool AllocCounter::Enabled() { return true; }
+
+unsigned long long AllocCounter::Count() {
+  return g_allocations.load(std::memory_order_relaxed);
+}
+
+void AllocCounter::Forbid(bool forbid) { t_forbid = forbid; }
+
+unsigned long long AllocCounter::ForbiddenCount() {
+  return g_forbidden.load(std::memory_order_relaxed);
+}
+
+#else
+
+bool AllocCounter::Enabled() { return false; }
+
+unsigned long long AllocCounter::Count() { return 0; }
+
+void AllocCounter::Forbid(bool) {}
+
+unsigned long long AllocCounter::ForbiddenCount() { return 0; }
+
+#endif
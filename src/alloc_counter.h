@@ -0,0 +1,52 @@
+#ifndef ALLOC_COUNTER_H_
+#define ALLOC_COUNTER_H_
+
+/**
+ * Debug hook that counts heap allocations made by the process.
+ *
+ * Counting is only active when the program is built with
+ * UKF_COUNT_ALLOCATIONS defined; malloc/calloc/realloc are then interposed
+ * so that allocations made by Eigen, the standard library and operator new
+ * are all seen. In normal builds the counter always reports zero.
+ */
+class AllocCounter {
+public:
+  /**
+   * True if allocation counting was compiled in.
+   */
+  static bool Enabled();
+
+  /**
+   * Total number of heap allocations since program start.
+   */
+  static unsigned long long Count();
+
+  /**
+   * Marks the calling thread's allocations as forbidden from now on, or
+   * allowed again; forbidden ones are counted by ForbiddenCount as well
+   */
+  static void Forbid(bool forbid);
+
+  /**
+   * Allocations made by threads while forbidden, since program start
+   */
+  static unsigned long long ForbiddenCount();
+};
+
+/**
+ * Counts the allocations performed between construction and a call to
+ * Allocations(), e.g. around a steady-state ProcessMeasurement call.
+ */
+class AllocScope {
+public:
+  AllocScope() : start_(AllocCounter::Count()) {}
+
+  unsigned long long Allocations() const {
+    return AllocCounter::Count() - start_;
+  }
+
+private:
+  unsigned long long start_;
+};
+
+#endif /* ALLOC_COUNTER_H_ */
@@ -0,0 +1,86 @@
+#ifndef ANGLE_H_
+#define ANGLE_H_
+
+#include <cmath>
+#include "Eigen/Core"
+#include "fast_math.h"
+
+/**
+ * Wraps an angle into [-pi, pi] in constant time, however far out it is.
+ * rint compiles to a couple of instructions with no branch or library
+ * call, so loops over NormalizeAngle vectorise.
+ * @param angle Angle in rad
+ */
+inline double NormalizeAngle(double angle) {
+  const double kTwoPi = 2. * M_PI;
+  const double kInvTwoPi = 1. / kTwoPi;
+  return angle - kTwoPi * std::rint(angle * kInvTwoPi);
+}
+
+/**
+ * Single-precision NormalizeAngle, so float builds stay in float
+ * @param angle Angle in rad
+ */
+inline float NormalizeAngle(float angle) {
+  const float kTwoPi = static_cast<float>(2. * M_PI);
+  const float kInvTwoPi = static_cast<float>(1. / (2. * M_PI));
+  return angle - kTwoPi * std::rint(angle * kInvTwoPi);
+}
+
+/**
+ * Wraps every coefficient of an Eigen expression in place, e.g. one row of
+ * sigma-point deviations: NormalizeAngles(Xd.row(3))
+ * @param angles Writable vector or block of angles in rad
+ */
+template <typename Derived>
+inline void NormalizeAngles(const Eigen::MatrixBase<Derived> &angles) {
+  Eigen::MatrixBase<Derived> &out =
+      const_cast<Eigen::MatrixBase<Derived> &>(angles);
+  for (int i = 0; i < out.size(); i++) {
+    out(i) = NormalizeAngle(out(i));
+  }
+}
+
+/**
+ * sin and cos of a row of sigma-point angles. Most sigma points share the
+ * mean's angle exactly: only the columns whose factor column reaches the
+ * angle's row differ from column 0 (8 of 15 for yaw, 10 for yaw + yawd dt,
+ * since L is lower triangular). Those repeats reuse column 0's result, and
+ * each remaining angle takes one KernelMath::SinCos. The values are the
+ * same as calling sin and cos on every coefficient.
+ * @param angles Angles in rad
+ * @param sin_out sin of each angle
+ * @param cos_out cos of each angle
+ */
+template <int N>
+inline void SinCosShared(const Eigen::Array<double, 1, N> &angles,
+                         Eigen::Array<double, 1, N> *sin_out,
+                         Eigen::Array<double, 1, N> *cos_out) {
+  const double first = angles(0);
+  double sin_first, cos_first;
+  KernelMath::SinCos(first, &sin_first, &cos_first);
+  for (int i = 0; i < N; i++) {
+    const double a = angles(i);
+    if (a == first) {
+      (*sin_out)(i) = sin_first;
+      (*cos_out)(i) = cos_first;
+    }
+    else {
+      KernelMath::SinCos(a, &(*sin_out)(i), &(*cos_out)(i));
+    }
+  }
+}
+
+/**
+ * Single-precision SinCosShared: Eigen evaluates float sin and cos with SIMD
+ * packets, which beats skipping repeats lane by lane
+ */
+template <int N>
+inline void SinCosShared(const Eigen::Array<float, 1, N> &angles,
+                         Eigen::Array<float, 1, N> *sin_out,
+                         Eigen::Array<float, 1, N> *cos_out) {
+  *sin_out = angles.sin();
+  *cos_out = angles.cos();
+}
+
+#endif /* ANGLE_H_ */
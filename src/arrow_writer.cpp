@@ -0,0 +1,524 @@
+#include "arrow_writer.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "packed_symmetric.h"
+#include "ukf_bank.h"
+
+const size_t ArrowEstimateLog::kBatchRows;
+const int ArrowEstimateLog::kDoubleColumns;
+
+namespace {
+
+// "ARROW1" padded to 8 bytes opens the file; unpadded, it closes it
+const char kMagic[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+const uint32_t kContinuation = 0xFFFFFFFFu;
+
+// MetadataVersion V5, and the union members and enums of the format used
+const int16_t kMetadataV5 = 4;
+const uint8_t kHeaderSchema = 1;
+const uint8_t kHeaderRecordBatch = 3;
+const uint8_t kTypeInt = 2;
+const uint8_t kTypeFloatingPoint = 3;
+const int16_t kPrecisionDouble = 2;
+
+bool HostIsLittleEndian() {
+  const uint16_t probe = 1;
+  unsigned char first;
+  memcpy(&first, &probe, 1);
+  return first == 1;
+}
+
+/**
+ * One flatbuffer, laid out front to back: each table's vtable just before
+ * it and what its fields point to after it, so every uoffset points
+ * forwards as the format requires. Scalars sit at offsets aligned to their
+ * size, and the buffer is padded to 8 bytes, so it can be written right
+ * after an 8-byte aligned prefix.
+ */
+class FlatBuilder {
+public:
+  // a table field: its id in the schema, its size, and a scalar's value
+  // (offsets are set later with Point)
+  struct Slot {
+    int id;
+    int size;
+    uint64_t value;
+  };
+
+  FlatBuilder() : buffer_(4, 0) {}
+
+  /**
+   * Adds a table
+   * @param slots Fields in any order
+   * @param count Number of fields
+   * @param positions Filled with each slot's position in the buffer
+   * @return Position of the table
+   */
+  size_t Table(const Slot *slots, int count, size_t *positions) {
+    //the widest fields first, from an 8-byte boundary after the soffset
+    int order[16];
+    int max_id = -1;
+    for (int i = 0; i < count; i++) {
+      order[i] = i;
+      max_id = std::max(max_id, slots[i].id);
+    }
+    std::stable_sort(order, order + count, [slots](int a, int b) {
+      return slots[a].size > slots[b].size;
+    });
+
+    Align(2, 0);
+    const size_t vtable = buffer_.size();
+    const int vtable_size = 4 + 2 * (max_id + 1);
+    buffer_.resize(vtable + vtable_size, 0);
+    Align(8, 4);
+    const size_t table = buffer_.size();
+    int inline_size = 4;
+    for (int k = 0; k < count; k++) {
+      const Slot &slot = slots[order[k]];
+      positions[order[k]] = table + inline_size;
+      Put<uint16_t>(vtable + 4 + 2 * slot.id,
+                    static_cast<uint16_t>(inline_size));
+      inline_size += slot.size;
+    }
+    Put<uint16_t>(vtable, static_cast<uint16_t>(vtable_size));
+    Put<uint16_t>(vtable + 2, static_cast<uint16_t>(inline_size));
+    buffer_.resize(table + inline_size, 0);
+    Put<int32_t>(table, static_cast<int32_t>(table - vtable));
+    for (int i = 0; i < count; i++) {
+      if (slots[i].size < 8) {
+        //the low bytes, little endian
+        memcpy(&buffer_[positions[i]], &slots[i].value, slots[i].size);
+      }
+      else {
+        Put<uint64_t>(positions[i], slots[i].value);
+      }
+    }
+    return table;
+  }
+
+  /**
+   * Adds a vector's length and room for its elements
+   * @param count Number of elements
+   * @param element_size Bytes per element
+   * @param alignment Alignment of the elements
+   * @return Position of the length; the elements follow it
+   */
+  size_t Vector(size_t count, size_t element_size, size_t alignment) {
+    const size_t boundary = std::max<size_t>(alignment, 4);
+    Align(boundary, boundary - 4);
+    const size_t at = buffer_.size();
+    buffer_.resize(at + 4 + count * element_size, 0);
+    Put<uint32_t>(at, static_cast<uint32_t>(count));
+    return at;
+  }
+
+  // the length leaves out the terminating NUL
+  size_t String(const std::string &text) {
+    const size_t at = Vector(text.size(), 1, 1);
+    memcpy(&buffer_[at + 4], text.data(), text.size());
+    buffer_.push_back(0);
+    return at;
+  }
+
+  /**
+   * Sets the uoffset at a position to point to a later one
+   */
+  void Point(size_t at, size_t target) {
+    Put<uint32_t>(at, static_cast<uint32_t>(target - at));
+  }
+
+  template <typename T>
+  void Put(size_t at, T value) {
+    memcpy(&buffer_[at], &value, sizeof(value));
+  }
+
+  /**
+   * Points the root at a table and pads the buffer to 8 bytes
+   */
+  const std::vector<uint8_t> &Finish(size_t root) {
+    Point(0, root);
+    Align(8, 0);
+    return buffer_;
+  }
+
+private:
+  // pads until the size is remainder modulo alignment
+  void Align(size_t alignment, size_t remainder) {
+    while (buffer_.size() % alignment != remainder) {
+      buffer_.push_back(0);
+    }
+  }
+
+  std::vector<uint8_t> buffer_;
+};
+
+// its fields' names and types, with no children
+size_t AddSchema(FlatBuilder *fb,
+                 const std::vector<ArrowWriter::Field> &fields) {
+  size_t at[2];
+  const FlatBuilder::Slot schema[] = {{0, 2, 0}, {1, 4, 0}};
+  const size_t table = fb->Table(schema, 2, at);
+  const size_t list = fb->Vector(fields.size(), 4, 4);
+  fb->Point(at[1], list);
+
+  for (size_t i = 0; i < fields.size(); i++) {
+    const bool is_int = fields[i].type == ArrowWriter::INT64;
+    size_t f[5];
+    const FlatBuilder::Slot field[] = {
+      {0, 4, 0},
+      {1, 1, 0},
+      {2, 1, is_int ? kTypeInt : kTypeFloatingPoint},
+      {3, 4, 0},
+      {5, 4, 0}
+    };
+    fb->Point(list + 4 + 4 * i, fb->Table(field, 5, f));
+    fb->Point(f[0], fb->String(fields[i].name));
+
+    size_t t[2];
+    if (is_int) {
+      const FlatBuilder::Slot type[] = {{0, 4, 64}, {1, 1, 1}};
+      fb->Point(f[3], fb->Table(type, 2, t));
+    }
+    else {
+      const FlatBuilder::Slot type[] = {{0, 2, kPrecisionDouble}};
+      fb->Point(f[3], fb->Table(type, 1, t));
+    }
+    fb->Point(f[4], fb->Vector(0, 4, 4));
+  }
+  return table;
+}
+
+// a Message table with the given header union member and body length;
+// returns the position of the header's offset
+size_t AddMessage(FlatBuilder *fb, uint8_t header, int64_t body_length,
+                  size_t *table) {
+  size_t at[4];
+  const FlatBuilder::Slot message[] = {
+    {0, 2, static_cast<uint64_t>(kMetadataV5)},
+    {1, 1, header},
+    {2, 4, 0},
+    {3, 8, static_cast<uint64_t>(body_length)}
+  };
+  *table = fb->Table(message, 4, at);
+  return at[2];
+}
+
+// writes every byte of the buffers, however write splits them
+bool WriteAll(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    const ssize_t n = writev(fd, iov, std::min(count, IOV_MAX));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    size_t left = static_cast<size_t>(n);
+    while (count > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+ArrowWriter::ArrowWriter() : fd_(-1), offset_(0), failed_(false) {}
+
+ArrowWriter::~ArrowWriter() {
+  Close();
+}
+
+bool ArrowWriter::Open(const char *path, const std::vector<Field> &fields,
+                       std::string *error) {
+  Close();
+  if (!HostIsLittleEndian()) {
+    *error = "Arrow files are only written on little-endian hosts";
+    return false;
+  }
+  fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    *error = std::string(path) + ": " + strerror(errno);
+    return false;
+  }
+  fields_ = fields;
+  blocks_.clear();
+  offset_ = 0;
+  failed_ = false;
+
+  struct iovec magic = {const_cast<char *>(kMagic), sizeof(kMagic)};
+  failed_ = !WriteAll(fd_, &magic, 1);
+  offset_ = sizeof(kMagic);
+
+  FlatBuilder fb;
+  size_t message;
+  const size_t header = AddMessage(&fb, kHeaderSchema, 0, &message);
+  fb.Point(header, AddSchema(&fb, fields_));
+  if (!WriteMessage(fb.Finish(message), nullptr, 0, 0, 0) || failed_) {
+    *error = std::string(path) + ": " + strerror(errno);
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool ArrowWriter::WriteBatch(const void *const *columns, int64_t rows) {
+  if (fd_ < 0) {
+    return false;
+  }
+  const size_t n = fields_.size();
+  const int64_t column_length = rows * 8;
+
+  //RecordBatch: one FieldNode per column, and an empty validity buffer and
+  //the values per column, at their offsets in the body
+  FlatBuilder fb;
+  size_t message;
+  const size_t header = AddMessage(&fb, kHeaderRecordBatch,
+                                   column_length * n, &message);
+  size_t at[3];
+  const FlatBuilder::Slot batch[] = {
+    {0, 8, static_cast<uint64_t>(rows)}, {1, 4, 0}, {2, 4, 0}
+  };
+  fb.Point(header, fb.Table(batch, 3, at));
+  const size_t nodes = fb.Vector(n, 16, 8);
+  fb.Point(at[1], nodes);
+  for (size_t c = 0; c < n; c++) {
+    fb.Put<int64_t>(nodes + 4 + 16 * c, rows);
+    fb.Put<int64_t>(nodes + 12 + 16 * c, 0);
+  }
+  const size_t buffers = fb.Vector(2 * n, 16, 8);
+  fb.Point(at[2], buffers);
+  for (size_t c = 0; c < n; c++) {
+    const size_t validity = buffers + 4 + 32 * c;
+    fb.Put<int64_t>(validity, column_length * c);
+    fb.Put<int64_t>(validity + 8, 0);
+    fb.Put<int64_t>(validity + 16, column_length * c);
+    fb.Put<int64_t>(validity + 24, column_length);
+  }
+
+  return WriteMessage(fb.Finish(message), columns, n, column_length,
+                      column_length * n);
+}
+
+bool ArrowWriter::WriteMessage(const std::vector<uint8_t> &metadata,
+                               const void *const *body, size_t body_count,
+                               size_t body_size, int64_t body_length) {
+  //the continuation marker and the metadata length, then the flatbuffer,
+  //whose padding keeps the body 8-byte aligned
+  uint32_t prefix[2] = {kContinuation,
+                        static_cast<uint32_t>(metadata.size())};
+  std::vector<struct iovec> iov(2 + body_count);
+  iov[0].iov_base = prefix;
+  iov[0].iov_len = sizeof(prefix);
+  iov[1].iov_base = const_cast<uint8_t *>(metadata.data());
+  iov[1].iov_len = metadata.size();
+  for (size_t c = 0; c < body_count; c++) {
+    iov[2 + c].iov_base = const_cast<void *>(body[c]);
+    iov[2 + c].iov_len = body_size;
+  }
+  if (!WriteAll(fd_, iov.data(), static_cast<int>(iov.size()))) {
+    failed_ = true;
+    return false;
+  }
+
+  if (body_count > 0) {
+    Block block = {offset_,
+                   static_cast<int32_t>(sizeof(prefix) + metadata.size()),
+                   body_length};
+    blocks_.push_back(block);
+  }
+  offset_ += sizeof(prefix) + metadata.size() + body_length;
+  return true;
+}
+
+bool ArrowWriter::Close() {
+  if (fd_ < 0) {
+    return !failed_;
+  }
+
+  //the end-of-stream marker, then the footer: the schema again and where
+  //each record batch starts
+  FlatBuilder fb;
+  size_t at[4];
+  const FlatBuilder::Slot footer[] = {
+    {0, 2, static_cast<uint64_t>(kMetadataV5)}, {1, 4, 0}, {2, 4, 0},
+    {3, 4, 0}
+  };
+  const size_t table = fb.Table(footer, 4, at);
+  fb.Point(at[1], AddSchema(&fb, fields_));
+  fb.Point(at[2], fb.Vector(0, 24, 8));
+  const size_t list = fb.Vector(blocks_.size(), 24, 8);
+  fb.Point(at[3], list);
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    const size_t block = list + 4 + 24 * i;
+    fb.Put<int64_t>(block, blocks_[i].offset);
+    fb.Put<int32_t>(block + 8, blocks_[i].metadata_length);
+    fb.Put<int64_t>(block + 16, blocks_[i].body_length);
+  }
+  const std::vector<uint8_t> &metadata = fb.Finish(table);
+
+  uint32_t end[2] = {kContinuation, 0};
+  int32_t length = static_cast<int32_t>(metadata.size());
+  struct iovec iov[4] = {
+    {end, sizeof(end)},
+    {const_cast<uint8_t *>(metadata.data()), metadata.size()},
+    {&length, sizeof(length)},
+    {const_cast<char *>(kMagic), 6}
+  };
+  if (!failed_ && !WriteAll(fd_, iov, 4)) {
+    failed_ = true;
+  }
+  if (close(fd_) != 0) {
+    failed_ = true;
+  }
+  fd_ = -1;
+  return !failed_;
+}
+
+ArrowEstimateLog::ArrowEstimateLog(size_t batch_rows)
+    : batch_rows_(std::max<size_t>(batch_rows, 1)) {}
+
+ArrowEstimateLog::~ArrowEstimateLog() {
+  Close();
+}
+
+bool ArrowEstimateLog::Open(const char *path, std::string *error) {
+  static const char *const kNames[kDoubleColumns] = {
+    "px", "py", "v", "yaw", "yaw_rate",
+    "var_px", "var_py", "var_v", "var_yaw", "var_yaw_rate",
+    "vx", "vy", "nis"
+  };
+  std::vector<ArrowWriter::Field> fields;
+  ArrowWriter::Field timestamp = {"timestamp", ArrowWriter::INT64};
+  ArrowWriter::Field sensor = {"sensor", ArrowWriter::INT64};
+  fields.push_back(timestamp);
+  fields.push_back(sensor);
+  for (int k = 0; k < kDoubleColumns; k++) {
+    ArrowWriter::Field field = {kNames[k], ArrowWriter::FLOAT64};
+    fields.push_back(field);
+  }
+
+  timestamps_.clear();
+  sensors_.clear();
+  timestamps_.reserve(batch_rows_);
+  sensors_.reserve(batch_rows_);
+  for (int k = 0; k < kDoubleColumns; k++) {
+    values_[k].clear();
+    values_[k].reserve(batch_rows_);
+  }
+  return writer_.Open(path, fields, error);
+}
+
+bool ArrowEstimateLog::Add(TimeUs timestamp,
+                           MeasurementPackage::SensorType sensor,
+                           const UKF::StateVector &x,
+                           const UKF::StateMatrix &P, double nis) {
+  timestamps_.push_back(timestamp);
+  sensors_.push_back(sensor);
+  for (int k = 0; k < UKF::n_x_; k++) {
+    values_[k].push_back(x(k));
+    values_[UKF::n_x_ + k].push_back(P(k, k));
+  }
+  values_[2 * UKF::n_x_].push_back(cos(x(3)) * x(2));
+  values_[2 * UKF::n_x_ + 1].push_back(sin(x(3)) * x(2));
+  values_[2 * UKF::n_x_ + 2].push_back(nis);
+  return timestamps_.size() < batch_rows_ || Flush();
+}
+
+bool ArrowEstimateLog::Flush() {
+  if (timestamps_.empty()) {
+    return true;
+  }
+  const void *columns[2 + kDoubleColumns];
+  columns[0] = timestamps_.data();
+  columns[1] = sensors_.data();
+  for (int k = 0; k < kDoubleColumns; k++) {
+    columns[2 + k] = values_[k].data();
+  }
+  const bool ok = writer_.WriteBatch(
+      columns, static_cast<int64_t>(timestamps_.size()));
+  timestamps_.clear();
+  sensors_.clear();
+  for (int k = 0; k < kDoubleColumns; k++) {
+    values_[k].clear();
+  }
+  return ok;
+}
+
+bool ArrowEstimateLog::Close() {
+  if (!writer_.is_open()) {
+    return writer_.Close();
+  }
+  const bool flushed = Flush();
+  return writer_.Close() && flushed;
+}
+
+ArrowBankLog::ArrowBankLog() {}
+
+ArrowBankLog::~ArrowBankLog() {
+  Close();
+}
+
+bool ArrowBankLog::Open(const char *path, std::string *error) {
+  static const char *const kNames[UKF::n_x_] = {
+    "px", "py", "v", "yaw", "yaw_rate"
+  };
+  std::vector<ArrowWriter::Field> fields;
+  ArrowWriter::Field timestamp = {"timestamp", ArrowWriter::INT64};
+  ArrowWriter::Field track = {"track", ArrowWriter::INT64};
+  fields.push_back(timestamp);
+  fields.push_back(track);
+  for (int r = 0; r < UKF::n_x_; r++) {
+    ArrowWriter::Field field = {kNames[r], ArrowWriter::FLOAT64};
+    fields.push_back(field);
+  }
+  //in the bank's packed order, the upper triangle row by row
+  for (int r = 0; r < UKF::n_x_; r++) {
+    for (int c = r; c < UKF::n_x_; c++) {
+      ArrowWriter::Field field = {
+        "p_" + std::to_string(r) + "_" + std::to_string(c),
+        ArrowWriter::FLOAT64
+      };
+      fields.push_back(field);
+    }
+  }
+  columns_.resize(fields.size());
+  return writer_.Open(path, fields, error);
+}
+
+bool ArrowBankLog::Write(const UKFBank &bank, TimeUs timestamp) {
+  const int n = bank.size();
+  timestamps_.assign(n, timestamp);
+  tracks_.resize(n);
+  for (int i = 0; i < n; i++) {
+    tracks_[i] = bank.HandleOf(i).index;
+  }
+
+  //live tracks fill slots [0, size()), so each row's head is a column
+  const int capacity = bank.capacity();
+  columns_[0] = timestamps_.data();
+  columns_[1] = tracks_.data();
+  for (int r = 0; r < UKF::n_x_; r++) {
+    columns_[2 + r] = bank.states() + r * capacity;
+  }
+  for (int k = 0; k < UKFBank::n_p_; k++) {
+    columns_[2 + UKF::n_x_ + k] = bank.covariances() + k * capacity;
+  }
+  return writer_.WriteBatch(columns_.data(), n);
+}
+
+bool ArrowBankLog::Close() {
+  return writer_.Close();
+}
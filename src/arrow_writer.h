@@ -0,0 +1,192 @@
+#ifndef ARROW_WRITER_H_
+#define ARROW_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "time_base.h"
+#include "ukf.h"
+
+class UKFBank;
+
+/**
+ * Apache Arrow IPC files (the random-access "file" format, which is also
+ * Feather v2) of fixed-width columns, for pyarrow, pandas, polars or DuckDB
+ * to load without parsing text. Arrow itself is not linked: the schema,
+ * record batch and footer metadata are the flatbuffers of Arrow's
+ * Schema.fbs, Message.fbs and File.fbs (metadata version V5), encoded by
+ * hand.
+ *
+ * Every column is a non-nullable little-endian int64 or float64. A record
+ * batch's body is its columns back to back, so WriteBatch hands the
+ * caller's buffers straight to one writev() behind the metadata: a
+ * structure of arrays, such as UKFBank's state and covariance rows, is
+ * exported without a copy. Batches may be written as they fill; the footer
+ * that indexes them is written by Close, and a file is only readable after
+ * it.
+ *
+ * Little-endian hosts only, as for BinaryLog. Not thread safe; one writer
+ * per file.
+ */
+class ArrowWriter {
+public:
+  enum Type {
+    INT64,
+    FLOAT64
+  };
+
+  struct Field {
+    std::string name;
+    Type type;
+  };
+
+  ArrowWriter();
+
+  /**
+   * Destructor; closes the file (errors are lost, call Close to see them)
+   */
+  virtual ~ArrowWriter();
+
+  /**
+   * Creates or truncates a file and writes its schema
+   * @param path File to write
+   * @param fields Columns of every batch, in order
+   * @param error Reason for a failure
+   * @return false if the file cannot be opened or written
+   */
+  bool Open(const char *path, const std::vector<Field> &fields,
+            std::string *error);
+
+  /**
+   * Writes one record batch
+   * @param columns One pointer per field to rows 8-byte values, int64_t or
+   * double as the field's type says; read only during the call
+   * @param rows Rows in the batch
+   * @return false if any write since Open failed
+   */
+  bool WriteBatch(const void *const *columns, int64_t rows);
+
+  /**
+   * Writes the footer and closes the file
+   * @return false if any write since Open failed
+   */
+  bool Close();
+
+  bool is_open() const { return fd_ >= 0; }
+  size_t batches() const { return blocks_.size(); }
+  const std::vector<Field> &fields() const { return fields_; }
+
+private:
+  // a message's place in the file, for the footer
+  struct Block {
+    int64_t offset;
+    int32_t metadata_length;
+    int64_t body_length;
+  };
+
+  // writes a message's prefix and metadata, then the body buffers
+  bool WriteMessage(const std::vector<uint8_t> &metadata,
+                    const void *const *body, size_t body_count,
+                    size_t body_size, int64_t body_length);
+
+  std::vector<Field> fields_;
+  std::vector<Block> blocks_;
+  int fd_;
+  int64_t offset_;
+  ///* a write failed since Open
+  bool failed_;
+};
+
+/**
+ * Filter outputs as Arrow columns: per measurement its time and sensor,
+ * the state, its covariance diagonal, the velocity components and the NIS.
+ * Rows are kept as columns and written every batch_rows rows, so a long
+ * replay's memory stays bounded.
+ */
+class ArrowEstimateLog {
+public:
+  ///* default rows per record batch
+  static const size_t kBatchRows = 65536;
+
+  explicit ArrowEstimateLog(size_t batch_rows = kBatchRows);
+  virtual ~ArrowEstimateLog();
+
+  /**
+   * @param path File to write
+   * @param error Reason for a failure
+   * @return false if the file cannot be opened
+   */
+  bool Open(const char *path, std::string *error);
+
+  /**
+   * Adds a row
+   * @param timestamp Time of the measurement
+   * @param sensor Its sensor
+   * @param x State after it
+   * @param P Covariance after it
+   * @param nis NIS of its update
+   * @return false if a batch could not be written
+   */
+  bool Add(TimeUs timestamp, MeasurementPackage::SensorType sensor,
+           const UKF::StateVector &x, const UKF::StateMatrix &P, double nis);
+
+  /**
+   * Writes the rows still held and closes the file
+   * @return false if any write since Open failed
+   */
+  bool Close();
+
+private:
+  // the columns in schema order: timestamp and sensor, then the doubles
+  static const int kDoubleColumns = 2 * UKF::n_x_ + 3;
+
+  bool Flush();
+
+  const size_t batch_rows_;
+  ArrowWriter writer_;
+  std::vector<int64_t> timestamps_;
+  std::vector<int64_t> sensors_;
+  std::vector<double> values_[kDoubleColumns];
+};
+
+/**
+ * Snapshots of a UKFBank as Arrow record batches, one per Write: the
+ * snapshot time and each live track's handle index, then its state and its
+ * packed covariance (p_r_c for r <= c). The state and covariance columns
+ * are the bank's own rows, written without a copy.
+ */
+class ArrowBankLog {
+public:
+  ArrowBankLog();
+  virtual ~ArrowBankLog();
+
+  /**
+   * @param path File to write
+   * @param error Reason for a failure
+   * @return false if the file cannot be opened
+   */
+  bool Open(const char *path, std::string *error);
+
+  /**
+   * Writes the bank's live tracks as one batch
+   * @param bank Bank to export
+   * @param timestamp Time of the snapshot
+   * @return false if the batch could not be written
+   */
+  bool Write(const UKFBank &bank, TimeUs timestamp);
+
+  /**
+   * Writes the footer and closes the file
+   * @return false if any write since Open failed
+   */
+  bool Close();
+
+private:
+  ArrowWriter writer_;
+  std::vector<int64_t> timestamps_;
+  std::vector<int64_t> tracks_;
+  std::vector<const void *> columns_;
+};
+
+#endif /* ARROW_WRITER_H_ */
@@ -0,0 +1,181 @@
+#include "association.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+namespace {
+
+const double kInfinity = std::numeric_limits<double>::infinity();
+
+}  // namespace
+
+GnnAssociator::GnnAssociator(double miss_cost)
+    : miss_cost_(miss_cost), total_cost_(0.0), rows_(0), cols_(0) {}
+
+GnnAssociator::~GnnAssociator() {}
+
+void GnnAssociator::Solve(const GatedPair *pairs, size_t count, int tracks,
+                          int measurements) {
+  rows_ = tracks;
+  cols_ = measurements + tracks;
+
+  //bucket the pairs by track, with each track's miss column last
+  row_start_.assign(rows_ + 1, 0);
+  for (size_t k = 0; k < count; k++) {
+    ++row_start_[pairs[k].track + 1];
+  }
+  for (int i = 0; i < rows_; i++) {
+    row_start_[i + 1] += row_start_[i] + 1;
+  }
+  edge_col_.resize(row_start_[rows_]);
+  edge_cost_.resize(row_start_[rows_]);
+  std::vector<int> &fill = touched_;
+  fill.assign(row_start_.begin(), row_start_.end() - 1);
+  for (size_t k = 0; k < count; k++) {
+    int e = fill[pairs[k].track]++;
+    edge_col_[e] = pairs[k].measurement;
+    edge_cost_[e] = pairs[k].cost;
+  }
+  for (int i = 0; i < rows_; i++) {
+    int e = fill[i];
+    edge_col_[e] = measurements + i;
+    edge_cost_[e] = miss_cost_;
+  }
+
+  //feasible start: each row's cheapest edge is tight
+  u_.resize(rows_);
+  v_.assign(cols_, 0.0);
+  for (int i = 0; i < rows_; i++) {
+    double best = kInfinity;
+    for (int e = row_start_[i]; e < row_start_[i + 1]; e++) {
+      best = std::min(best, edge_cost_[e]);
+    }
+    u_[i] = best;
+  }
+
+  row_match_.assign(rows_, -1);
+  col_match_.assign(cols_, -1);
+  dist_.assign(cols_, kInfinity);
+  prev_row_.assign(cols_, -1);
+  done_.assign(cols_, 0);
+  touched_.clear();
+
+  for (int i = 0; i < rows_; i++) {
+    Augment(i);
+  }
+
+  //report misses as -1
+  measurement_match_.assign(measurements, -1);
+  total_cost_ = 0.0;
+  for (int i = 0; i < rows_; i++) {
+    int c = row_match_[i];
+    for (int e = row_start_[i]; e < row_start_[i + 1]; e++) {
+      if (edge_col_[e] == c) {
+        total_cost_ += edge_cost_[e];
+        break;
+      }
+    }
+    if (c >= measurements) {
+      row_match_[i] = -1;
+    }
+    else {
+      measurement_match_[c] = i;
+    }
+  }
+}
+
+void GnnAssociator::Augment(int source) {
+  //Dijkstra over columns in reduced costs; a row is reached through the
+  //column it is matched to, at the same distance
+  heap_.clear();
+  std::greater<std::pair<double, int> > later;
+  for (int e = row_start_[source]; e < row_start_[source + 1]; e++) {
+    int c = edge_col_[e];
+    double d = edge_cost_[e] - u_[source] - v_[c];
+    if (d < dist_[c]) {
+      if (dist_[c] == kInfinity) touched_.push_back(c);
+      dist_[c] = d;
+      prev_row_[c] = source;
+      heap_.push_back(std::make_pair(d, c));
+      std::push_heap(heap_.begin(), heap_.end(), later);
+    }
+  }
+
+  //the row's own miss column is always free, so a free column is found
+  int sink = -1;
+  double D = 0.0;
+  while (!heap_.empty()) {
+    std::pop_heap(heap_.begin(), heap_.end(), later);
+    std::pair<double, int> top = heap_.back();
+    heap_.pop_back();
+    int c = top.second;
+    if (done_[c] || top.first > dist_[c]) continue;
+    done_[c] = 1;
+    if (col_match_[c] < 0) {
+      sink = c;
+      D = top.first;
+      break;
+    }
+    int r = col_match_[c];
+    for (int e = row_start_[r]; e < row_start_[r + 1]; e++) {
+      int k = edge_col_[e];
+      if (done_[k]) continue;
+      double d = top.first + edge_cost_[e] - u_[r] - v_[k];
+      if (d < dist_[k]) {
+        if (dist_[k] == kInfinity) touched_.push_back(k);
+        dist_[k] = d;
+        prev_row_[k] = r;
+        heap_.push_back(std::make_pair(d, k));
+        std::push_heap(heap_.begin(), heap_.end(), later);
+      }
+    }
+  }
+
+  //keep reduced costs >= 0 and the matching tight: shift the potentials of
+  //the nodes settled closer than the sink (all others move by a constant,
+  //which cancels)
+  u_[source] += D;
+  for (size_t k = 0; k < touched_.size(); k++) {
+    int c = touched_[k];
+    if (done_[c] && c != sink) {
+      double shift = D - dist_[c];
+      v_[c] -= shift;
+      u_[col_match_[c]] += shift;
+    }
+  }
+
+  //flip the path
+  for (int c = sink; c >= 0; ) {
+    int r = prev_row_[c];
+    int next = row_match_[r];
+    row_match_[r] = c;
+    col_match_[c] = r;
+    c = r == source ? -1 : next;
+  }
+
+  for (size_t k = 0; k < touched_.size(); k++) {
+    int c = touched_[k];
+    dist_[c] = kInfinity;
+    prev_row_[c] = -1;
+    done_[c] = 0;
+  }
+  touched_.clear();
+}
+
+int GnnAssociator::Dispatch(UKF *const *tracks,
+                            const Measurement *measurements) const {
+  int updates = 0;
+  for (int i = 0; i < rows_; i++) {
+    int m = row_match_[i];
+    if (m < 0) continue;
+    const Measurement &meas = measurements[m];
+    if (meas.sensor_type_ == MeasurementPackage::RADAR) {
+      tracks[i]->UpdateRadar(meas);
+    }
+    else {
+      tracks[i]->UpdateLidar(meas);
+    }
+    ++updates;
+  }
+  return updates;
+}
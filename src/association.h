@@ -0,0 +1,110 @@
+#ifndef ASSOCIATION_H_
+#define ASSOCIATION_H_
+
+#include <cstddef>
+#include <vector>
+#include "measurement_package.h"
+#include "ukf.h"
+
+/**
+ * A track/measurement pair that passed the gate, with its assignment cost
+ * (typically the NIS, see UKF::MeasurementNis)
+ */
+struct GatedPair {
+  int track;
+  int measurement;
+  double cost;
+};
+
+/**
+ * Global nearest neighbour association: the one-to-one assignment of
+ * measurements to tracks with the least total cost, where a track may also
+ * stay unassigned at miss_cost.
+ *
+ * Solved exactly with successive shortest augmenting paths (the Hungarian
+ * method in its sparse form): each track adds a private "miss" column, and
+ * a Dijkstra search over reduced costs only walks the gated pairs, so the
+ * work grows with the number of pairs rather than tracks x measurements. All
+ * working storage is kept between frames.
+ */
+class GnnAssociator {
+public:
+  /**
+   * Constructor
+   * @param miss_cost Cost of leaving a track unassigned, e.g. the gate; a
+   * pair costing more than this is never chosen
+   */
+  explicit GnnAssociator(double miss_cost);
+
+  /**
+   * Destructor
+   */
+  virtual ~GnnAssociator();
+
+  /**
+   * Solves one frame
+   * @param pairs Gated pairs, in any order; costs must be >= 0
+   * @param count Number of pairs
+   * @param tracks Number of tracks; pairs use ids [0, tracks)
+   * @param measurements Number of measurements; pairs use ids
+   * [0, measurements)
+   */
+  void Solve(const GatedPair *pairs, size_t count, int tracks,
+             int measurements);
+
+  /**
+   * Fuses every assigned measurement into its track with UpdateLidar or
+   * UpdateRadar. The tracks must already be predicted to the measurement
+   * time, as for gating.
+   * @param tracks Filters indexed by track id
+   * @param measurements Measurements indexed by measurement id
+   * @return Number of updates made
+   */
+  int Dispatch(UKF *const *tracks, const Measurement *measurements) const;
+
+  ///* Per track, the assigned measurement or -1, after Solve
+  const std::vector<int> &measurement_of_track() const { return row_match_; }
+
+  ///* Per measurement, the assigned track or -1, after Solve
+  const std::vector<int> &track_of_measurement() const {
+    return measurement_match_;
+  }
+
+  ///* Sum of the costs of the solution, misses included
+  double total_cost() const { return total_cost_; }
+
+  double miss_cost() const { return miss_cost_; }
+
+private:
+  // one Dijkstra search from a free row, then the augmentation
+  void Augment(int source);
+
+  double miss_cost_;
+  double total_cost_;
+  int rows_;
+  int cols_;
+
+  // gated pairs as a row-major sparse matrix; column ids >= measurements
+  // are the miss columns
+  std::vector<int> row_start_;
+  std::vector<int> edge_col_;
+  std::vector<double> edge_cost_;
+
+  // dual potentials; reduced cost = cost - u[row] - v[col] >= 0
+  std::vector<double> u_;
+  std::vector<double> v_;
+
+  // matching
+  std::vector<int> row_match_;
+  std::vector<int> col_match_;
+  std::vector<int> measurement_match_;
+
+  // search state, reset only where touched
+  std::vector<double> dist_;
+  std::vector<int> prev_row_;
+  std::vector<char> done_;
+  std::vector<int> touched_;
+  std::vector<std::pair<double, int> > heap_;
+};
+
+#endif /* ASSOCIATION_H_ */
@@ -0,0 +1,138 @@
+#include "bank_batcher.h"
+#include <algorithm>
+#include "ukf_kernels.h"
+
+BankBatcher::BankBatcher(UKFBank *bank, const Options &options)
+    : bank_(bank),
+      options_(options),
+      lanes_(UkfKernels::Lanes(
+          UkfKernels::Source(UkfKernels::BATCHED_CHOLESKY))),
+      batch_(options.batch > 0 ? options.batch : lanes_),
+      stats_(),
+      mean_gap_ns_(0.0),
+      last_arrival_ns_(0),
+      arrived_(false),
+      deadline_ns_(0),
+      window_ns_(0),
+      times_(bank->capacity(), 0),
+      queued_in_(bank->capacity(), 0) {
+  if (options_.rate_weight <= 0.0 || options_.rate_weight > 1.0) {
+    options_.rate_weight = 1.0;
+  }
+  const int most = std::max(batch_, bank->capacity());
+  handles_.reserve(most);
+  measurements_.reserve(most);
+  tracks_.reserve(most);
+  sensors_.reserve(most);
+  z_.reserve(3 * most);
+  delta_t_.reserve(bank->capacity());
+}
+
+BankBatcher::~BankBatcher() {}
+
+void BankBatcher::Start(UKFBank::Handle track, TimeUs timestamp) {
+  times_[track.index] = timestamp;
+}
+
+long long BankBatcher::Window() const {
+  //until the rate is known a measurement does not wait
+  if (mean_gap_ns_ <= 0.0 ||
+      mean_gap_ns_ > static_cast<double>(options_.budget_ns)) {
+    return 0;
+  }
+  const double fill = (batch_ - 1) * mean_gap_ns_;
+  return std::min(options_.budget_ns, static_cast<long long>(fill));
+}
+
+int BankBatcher::Add(UKFBank::Handle track, const Measurement &meas,
+                     long long now_ns) {
+  if (bank_->Slot(track) < 0) {
+    ++stats_.dropped;
+    return 0;
+  }
+  if (arrived_) {
+    const double gap = static_cast<double>(
+        std::max(now_ns - last_arrival_ns_, 0LL));
+    mean_gap_ns_ = mean_gap_ns_ > 0.0
+        ? mean_gap_ns_ + options_.rate_weight * (gap - mean_gap_ns_)
+        : gap;
+  }
+  last_arrival_ns_ = now_ns;
+  arrived_ = true;
+
+  //one prediction per track per batch, so a repeat sends the batch first
+  int fused = 0;
+  if (queued_in_[track.index] == stats_.batches + 1 && !handles_.empty()) {
+    ++stats_.repeated;
+    fused = Flush();
+  }
+  if (handles_.empty()) {
+    if (options_.batch <= 0) {
+      const int tracks = std::max(bank_->size(), 1);
+      batch_ = (tracks + lanes_ - 1) / lanes_ * lanes_;
+    }
+    window_ns_ = Window();
+    deadline_ns_ = now_ns + window_ns_;
+  }
+  queued_in_[track.index] = stats_.batches + 1;
+  handles_.push_back(track);
+  measurements_.push_back(meas);
+
+  if (static_cast<int>(handles_.size()) >= batch_) {
+    ++stats_.full;
+    fused += Flush();
+  }
+  else if (window_ns_ == 0) {
+    fused += Flush();
+  }
+  return fused;
+}
+
+int BankBatcher::Poll(long long now_ns) {
+  //the last arrival of a full batch is expected at the deadline itself
+  if (handles_.empty() || now_ns <= deadline_ns_) {
+    return 0;
+  }
+  ++stats_.expired;
+  return Flush();
+}
+
+int BankBatcher::Flush() {
+  if (handles_.empty()) {
+    return 0;
+  }
+
+  //each measured track predicted to its measurement, the rest by 0 s
+  delta_t_.assign(bank_->size(), 0.0);
+  tracks_.clear();
+  sensors_.clear();
+  z_.clear();
+  for (size_t k = 0; k < handles_.size(); k++) {
+    const int slot = bank_->Slot(handles_[k]);
+    if (slot < 0) {
+      ++stats_.dropped;
+      continue;
+    }
+    const Measurement &meas = measurements_[k];
+    TimeUs &time = times_[handles_[k].index];
+    if (meas.timestamp_ > time) {
+      delta_t_[slot] = ToSeconds(meas.timestamp_ - time);
+      time = meas.timestamp_;
+    }
+    tracks_.push_back(slot);
+    sensors_.push_back(meas.sensor_type_);
+    z_.insert(z_.end(), meas.values_.begin(), meas.values_.end());
+  }
+  handles_.clear();
+  measurements_.clear();
+  ++stats_.batches;
+
+  const int count = static_cast<int>(tracks_.size());
+  if (count == 0) {
+    return 0;
+  }
+  bank_->Prediction(delta_t_.data());
+  bank_->Update(tracks_.data(), sensors_.data(), z_.data(), count);
+  stats_.fused += count;
+  return count;
+}
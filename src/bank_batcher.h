@@ -0,0 +1,151 @@
+#ifndef BANK_BATCHER_H_
+#define BANK_BATCHER_H_
+
+#include <vector>
+#include "measurement_package.h"
+#include "ukf_bank.h"
+
+/**
+ * The input stage of a UKFBank: measurements of its tracks are held for a
+ * short window and fused together, one Prediction sweep and one bucketed
+ * Update per batch, so the bank's kernels run over many tracks per call
+ * instead of a sweep per measurement.
+ *
+ * A batch goes out when it holds batch measurements, when its window ends,
+ * or when a track already in it is measured again. Every batch predicts
+ * the whole bank, so by default a full batch is one measurement per live
+ * track, rounded up to whole lanes of the bank's batched kernels (at least
+ * one lane): the prediction sweep is then paid once per track measured.
+ * The window follows the arrival rate, kept as a moving average of the
+ * gaps between Adds:
+ *
+ *   expected arrivals in budget_ns < 1    no window; each Add fuses at once
+ *   otherwise                             min(budget_ns, time the rest of a
+ *                                         full batch is expected to take)
+ *
+ * so at low load a measurement is fused as it arrives and at high load it
+ * waits at most budget_ns for the batch to fill. The caller drives expiry
+ * with Poll, e.g. from its event loop's timer or before blocking.
+ *
+ * Tracks are named by UKFBank handles, so they may move between slots; a
+ * measurement of a handle gone stale by the dispatch is dropped. Every
+ * track of the bank is predicted in a batch, those without a measurement
+ * by 0 s, which refreshes their sigma points and leaves them as they were.
+ * A measurement older than its track's last is fused without prediction.
+ */
+class BankBatcher {
+public:
+  struct Options {
+    ///* longest a measurement waits for its batch, in ns
+    long long budget_ns;
+    ///* measurements that make a full batch; 0 for the live tracks,
+    ///* rounded up to the lane width of the bank's batched kernels
+    int batch;
+    ///* weight of the newest gap in the arrival-rate average, in (0, 1]
+    double rate_weight;
+
+    Options() : budget_ns(200000), batch(0), rate_weight(0.1) {}
+  };
+
+  struct Stats {
+    ///* batches fused, and the measurements in them
+    unsigned long long batches;
+    unsigned long long fused;
+    ///* batches sent full, on a repeated track, and when the window ended
+    unsigned long long full;
+    unsigned long long repeated;
+    unsigned long long expired;
+    ///* measurements of tracks removed while they waited
+    unsigned long long dropped;
+  };
+
+  /**
+   * Constructor
+   * @param bank Bank to fuse into; must outlive the batcher
+   * @param options Window and batch size
+   */
+  BankBatcher(UKFBank *bank, const Options &options = Options());
+
+  virtual ~BankBatcher();
+
+  /**
+   * Sets the time a track's state is at, e.g. when it is added to the bank
+   * @param track Track
+   * @param timestamp Time of its state
+   */
+  void Start(UKFBank::Handle track, TimeUs timestamp);
+
+  /**
+   * Queues a measurement, fusing the batch if it is full, the track is
+   * already in it, or there is no window at this rate
+   * @param track Track
+   * @param meas Measurement; lidar uses the first two values
+   * @param now_ns Arrival time on a monotonic clock
+   * @return Measurements fused by this call
+   */
+  int Add(UKFBank::Handle track, const Measurement &meas, long long now_ns);
+
+  /**
+   * Fuses the batch if its window has ended
+   * @param now_ns Monotonic clock
+   * @return Measurements fused
+   */
+  int Poll(long long now_ns);
+
+  /**
+   * Fuses the batch now
+   * @return Measurements fused
+   */
+  int Flush();
+
+  ///* measurements waiting, and the time after which Poll sends them
+  int pending() const { return static_cast<int>(handles_.size()); }
+  long long deadline_ns() const { return deadline_ns_; }
+
+  ///* the window the last batch opened with, in ns
+  long long window_ns() const { return window_ns_; }
+
+  ///* the full size of the batch being filled (or the last one), and the
+  ///* average gap between arrivals, in ns
+  int batch() const { return batch_; }
+  double mean_gap_ns() const { return mean_gap_ns_; }
+
+  const Stats &stats() const { return stats_; }
+
+  const Options &options() const { return options_; }
+
+private:
+  // the window of a batch opened now
+  long long Window() const;
+
+  UKFBank *bank_;
+  Options options_;
+  const int lanes_;
+  int batch_;
+  Stats stats_;
+
+  ///* the arrival-rate average; 0 until two measurements have come
+  double mean_gap_ns_;
+  long long last_arrival_ns_;
+  bool arrived_;
+
+  long long deadline_ns_;
+  long long window_ns_;
+
+  ///* per handle index: time of the track's state, and the number of the
+  ///* batch it was last queued in
+  std::vector<TimeUs> times_;
+  std::vector<unsigned long long> queued_in_;
+
+  // the batch being filled
+  std::vector<UKFBank::Handle> handles_;
+  std::vector<Measurement> measurements_;
+
+  // dispatch workspace, kept with its capacity
+  std::vector<double> delta_t_;
+  std::vector<int> tracks_;
+  std::vector<MeasurementPackage::SensorType> sensors_;
+  std::vector<double> z_;
+};
+
+#endif /* BANK_BATCHER_H_ */
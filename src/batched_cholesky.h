@@ -0,0 +1,68 @@
+#ifndef BATCHED_CHOLESKY_H_
+#define BATCHED_CHOLESKY_H_
+
+#include <cmath>
+#include "packed_symmetric.h"
+
+/**
+ * Cholesky factorisation of many small symmetric matrices at once, in the
+ * batched layout of UKFBank: element (r, c) of matrix i is
+ * A[PackedSymmetric<N>::Index(r, c) * stride + i]. Every step runs over
+ * the matrices in its innermost loop, so the compiler puts 2, 4 or 8
+ * matrices into each SIMD instruction (SSE2, AVX2, AVX-512) where a per-matrix
+ * llt() on a 5x5 is scalar code full of short dependent loops. The
+ * factor L is written in the same layout, L(r, c) for r >= c at
+ * Index(c, r), and may not alias A.
+ *
+ * No lane may branch, so a non-positive pivot is taken as zero and its
+ * column of L is zeroed: the factor of the semi-definite part, where llt()
+ * would stop with an error.
+ * @param A Matrices, kSize rows of stride values
+ * @param L Factors, same layout
+ * @param stride Distance between the rows
+ * @param begin First matrix
+ * @param end One past the last matrix
+ */
+template <int N>
+#if defined(__GNUC__) || defined(__clang__)
+//always inlined, so each of UkfKernels' ISA wrappers compiles its own copy
+__attribute__((always_inline))
+#endif
+inline void BatchedCholesky(const double *A, double *L, int stride, int begin,
+                     int end) {
+  typedef PackedSymmetric<N> Packed;
+  for (int k = 0; k < Packed::kSize; k++) {
+    const double *a = A + k * stride;
+    double *l = L + k * stride;
+    for (int i = begin; i < end; i++) l[i] = a[i];
+  }
+
+  //right-looking: take column j, then subtract its outer product from the
+  //trailing block
+  for (int j = 0; j < N; j++) {
+    //selects rather than branches, so the loops stay vectorisable
+    double *ljj = L + Packed::Index(j, j) * stride;
+    for (int i = begin; i < end; i++) {
+      ljj[i] = std::sqrt(ljj[i] > 0.0 ? ljj[i] : 0.0);
+    }
+    for (int r = j + 1; r < N; r++) {
+      //divide, then zero the quotients of zero pivots in a second pass:
+      //a division under the select would be sunk into a branch
+      double *lrj = L + Packed::Index(r, j) * stride;
+      for (int i = begin; i < end; i++) lrj[i] /= ljj[i];
+      for (int i = begin; i < end; i++) {
+        lrj[i] = ljj[i] > 0.0 ? lrj[i] : 0.0;
+      }
+    }
+    for (int c = j + 1; c < N; c++) {
+      const double *lcj = L + Packed::Index(c, j) * stride;
+      for (int r = c; r < N; r++) {
+        const double *lrj = L + Packed::Index(r, j) * stride;
+        double *lrc = L + Packed::Index(r, c) * stride;
+        for (int i = begin; i < end; i++) lrc[i] -= lrj[i] * lcj[i];
+      }
+    }
+  }
+}
+
+#endif /* BATCHED_CHOLESKY_H_ */
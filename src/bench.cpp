@@ -0,0 +1,1252 @@
+// Micro-benchmarks for the UKF stages, in the spirit of Google Benchmark:
+// each case runs with a doubling iteration count until it has taken at least
+// --min-time seconds, then reports ns/op and heap allocations/op.
+//
+//   ukf_bench [--filter <substring>] [--min-time <seconds>] [--perf]
+//             [--repetitions <n>] [--json <path>]
+//   ukf_bench --compare <base.json> <new.json> [--threshold <fraction>]
+//             [--alpha <p>]
+//
+// Built with UKF_COUNT_ALLOCATIONS so the allocation column is live. With
+// --perf every case also reports hardware counters per op over its final
+// timed pass: cycles, instructions, IPC, L1 data and last level cache
+// misses and branch mispredicts (n/a where perf_event_open is refused).
+//
+// --repetitions times each case that many more times at the iteration
+// count it settled on, and --json writes every repetition as a BenchReport
+// (bench_report.h). --compare diffs two such reports, or two ukf_loadgen
+// reports, and exits with 1 if any metric is worse by more than the
+// threshold (default 0.05) at significance alpha (default 0.05): the gate
+// for performance changes.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "alloc_counter.h"
+#include "association.h"
+#include "bench_report.h"
+#include "buffered_writer.h"
+#include "ego_motion.h"
+#include "frame_arena.h"
+#include "huge_pages.h"
+#include "imm.h"
+#include "kernel_autotune.h"
+#include "jpda.h"
+#include "lidar_clustering.h"
+#include "measurement_models.h"
+#include "measurement_package.h"
+#include "mpsc_queue.h"
+#include "perf_counters.h"
+#include "sensor_merge.h"
+#include "shard_map.h"
+#include "spatial_grid.h"
+#include "state_delta.h"
+#include "timer_wheel.h"
+#include "tiered_bank.h"
+#include "tools.h"
+#include "track_fusion.h"
+#include "track_manager.h"
+#include "track_record.h"
+#include "track_view.h"
+#include "ukf.h"
+#include "ukf_bank.h"
+#include "ukf_kernels.h"
+
+namespace {
+
+double g_min_time = 0.2;
+const char *g_filter = nullptr;
+// with --perf
+PerfCounters *g_perf = nullptr;
+int g_repetitions = 1;
+// with --json
+BenchReport *g_report = nullptr;
+
+// keeps the compiler from discarding a result
+template <typename T>
+void DoNotOptimize(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+// one indented line of counts per op under a case's line
+void PrintCounters(const PerfCounters::Sample &sample, long long iterations) {
+  printf("%-40s", "");
+  for (int e = 0; e < PerfCounters::kEventCount; e++) {
+    const double count = sample.counts[e];
+    const char *name = PerfCounters::Name(PerfCounters::Event(e));
+    if (count < 0.0) {
+      printf(" %s n/a", name);
+    }
+    else {
+      printf(" %s %.1f", name, count / iterations);
+    }
+    if (e == PerfCounters::INSTRUCTIONS) {
+      const double cycles = sample.counts[PerfCounters::CYCLES];
+      if (count >= 0.0 && cycles > 0.0) {
+        printf(" ipc %.2f", count / cycles);
+      }
+      else {
+        printf(" ipc n/a");
+      }
+    }
+  }
+  printf("\n");
+}
+
+// ns per call of every ISA version of every kernel, and the one chosen
+void PrintCalibration() {
+  for (int k = 0; k < UkfKernels::KERNEL_COUNT; k++) {
+    const UkfKernels::Kernel kernel = UkfKernels::Kernel(k);
+    printf("autotune %-28s", UkfKernels::Name(kernel));
+    for (int i = 0; i < UkfKernels::ISA_COUNT; i++) {
+      const double ns = KernelAutotune::Timing(kernel, UkfKernels::Isa(i));
+      if (ns > 0.0) {
+        printf(" %s %.1f ns", UkfKernels::Name(UkfKernels::Isa(i)), ns);
+      }
+    }
+    printf(" -> %s\n", UkfKernels::Name(UkfKernels::Source(kernel)));
+  }
+}
+
+template <typename Op>
+void Run(const char *name, Op op) {
+  if (g_filter && !strstr(name, g_filter)) {
+    return;
+  }
+
+  //warm up caches and any lazily grown buffers
+  for (int i = 0; i < 16; i++) op();
+
+  typedef std::chrono::steady_clock Clock;
+  long long iterations = 1;
+  double elapsed;
+  unsigned long long allocations;
+  PerfCounters::Sample counters;
+  auto pass = [&]() {
+    AllocScope allocs;
+    if (g_perf) g_perf->Start();
+    Clock::time_point start = Clock::now();
+    for (long long i = 0; i < iterations; i++) op();
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if (g_perf) g_perf->Stop(&counters);
+    allocations = allocs.Allocations();
+  };
+  for (;;) {
+    pass();
+    if (elapsed >= g_min_time || iterations >= (1LL << 40)) {
+      break;
+    }
+    iterations *= 2;
+  }
+
+  //the calibrated pass is the first repetition
+  double total = 0.0;
+  for (int r = 0; r < g_repetitions; r++) {
+    if (r > 0) {
+      pass();
+    }
+    total += elapsed;
+    if (g_report) {
+      g_report->Add(name, "ns_per_op", 1e9 * elapsed / iterations);
+      if (AllocCounter::Enabled()) {
+        g_report->Add(name, "allocs_per_op",
+                      static_cast<double>(allocations) / iterations);
+      }
+      for (int e = 0; g_perf && e < PerfCounters::kEventCount; e++) {
+        if (counters.counts[e] >= 0.0) {
+          g_report->Add(name, std::string(PerfCounters::Name(
+                                  PerfCounters::Event(e))) + "_per_op",
+                        counters.counts[e] / iterations);
+        }
+      }
+    }
+  }
+
+  const double ns = 1e9 * total / g_repetitions / iterations;
+  if (AllocCounter::Enabled()) {
+    printf("%-40s %12lld %12.1f ns/op %10.2f allocs/op\n", name,
+           iterations, ns, static_cast<double>(allocations) / iterations);
+  }
+  else {
+    printf("%-40s %12lld %12.1f ns/op %10s allocs/op\n", name,
+           iterations, ns, "n/a");
+  }
+  if (g_perf) {
+    PrintCounters(counters, iterations);
+  }
+}
+
+// prints the changes between two reports; returns the process exit code
+int Compare(const char *base_path, const char *path, double threshold,
+            double alpha) {
+  BenchReport base, current;
+  std::string error;
+  if (!base.Load(base_path, &error) || !current.Load(path, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 2;
+  }
+  const std::vector<BenchReport::Change> changes =
+      current.Compare(base, threshold, alpha);
+  int regressions = 0;
+  for (size_t i = 0; i < changes.size(); i++) {
+    const BenchReport::Change &c = changes[i];
+    printf("%-40s %-22s %12.4g -> %-12.4g %+8.1f%% p %.3g%s\n",
+           c.result.c_str(), c.metric.c_str(), c.base_mean, c.mean,
+           100.0 * c.worse_by, c.p_value, c.regression ? "  REGRESSION" : "");
+    regressions += c.regression ? 1 : 0;
+  }
+  printf("%d of %zu metrics regressed beyond %.1f%% (alpha %g)\n",
+         regressions, changes.size(), 100.0 * threshold, alpha);
+  return regressions > 0 ? 1 : 0;
+}
+
+// a target on a circle, measured alternately by lidar and radar every 50 ms
+std::vector<Measurement> MakeMeasurements(size_t count) {
+  std::vector<Measurement> out(count);
+  srand(42);
+  for (size_t i = 0; i < count; i++) {
+    double t = 0.05 * i;
+    double px = 10.0 * cos(0.2 * t);
+    double py = 10.0 * sin(0.2 * t);
+    double vx = -2.0 * sin(0.2 * t);
+    double vy = 2.0 * cos(0.2 * t);
+    double noise = (rand() / static_cast<double>(RAND_MAX) - 0.5) * 0.1;
+
+    Measurement &m = out[i];
+    m.timestamp_ = 1477010443000000LL + 50000LL * static_cast<long long>(i);
+    if (i % 2 == 0) {
+      m.sensor_type_ = MeasurementPackage::LASER;
+      m.values_[0] = px + noise;
+      m.values_[1] = py - noise;
+      m.values_[2] = 0.0;
+    }
+    else {
+      double rho = sqrt(px * px + py * py);
+      m.sensor_type_ = MeasurementPackage::RADAR;
+      m.values_[0] = rho + noise;
+      m.values_[1] = atan2(py, px) + 0.1 * noise;
+      m.values_[2] = (px * vx + py * vy) / rho + noise;
+    }
+  }
+  return out;
+}
+
+// a filter that has already seen some of the stream
+UKF WarmFilter(const std::vector<Measurement> &stream, size_t steps) {
+  UKF ukf;
+  for (size_t i = 0; i < steps; i++) {
+    ukf.ProcessMeasurement(stream[i]);
+  }
+  return ukf;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  const char *json_path = nullptr;
+  const char *compare[2] = {nullptr, nullptr};
+  double threshold = 0.05;
+  double alpha = 0.05;
+  const char *huge_pages = "off";
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (strcmp(argv[i], "--filter") == 0) {
+      g_filter = argv[++i];
+    }
+    else if (strcmp(argv[i], "--min-time") == 0) {
+      g_min_time = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--repetitions") == 0) {
+      g_repetitions = std::max(1, atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--json") == 0) {
+      json_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--threshold") == 0) {
+      threshold = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--alpha") == 0) {
+      alpha = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--huge-pages") == 0) {
+      //backing of the track banks: off, thp or explicit
+      HugePages::Policy policy;
+      if (!HugePages::ParsePolicy(argv[++i], &policy)) {
+        fprintf(stderr, "unknown huge page policy %s\n", argv[i]);
+        return 2;
+      }
+      HugePages::SetPolicy(policy);
+      huge_pages = argv[i];
+    }
+    else if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+      compare[0] = argv[++i];
+      compare[1] = argv[++i];
+    }
+  }
+  if (compare[0]) {
+    return Compare(compare[0], compare[1], threshold, alpha);
+  }
+  BenchReport report("ukf_bench");
+  if (json_path) {
+    g_report = &report;
+    report.SetContext("isa", UkfKernels::Name(UkfKernels::Selected().isa));
+    report.SetContext("min_time", std::to_string(g_min_time));
+    report.SetContext("huge_pages", huge_pages);
+  }
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--perf") == 0) {
+      static PerfCounters perf;
+      g_perf = &perf;
+      if (!perf.available()) {
+        printf("perf counters unavailable (perf_event_paranoid or no PMU)\n");
+      }
+    }
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--autotune") == 0) {
+      //the bank benchmarks below run 1024 tracks at a time
+      std::string error;
+      if (!KernelAutotune::Run(std::vector<int>(1, 1024), nullptr, &error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+      }
+      PrintCalibration();
+      if (json_path) {
+        report.SetContext("autotune", "measured");
+      }
+    }
+  }
+
+  printf("kernel isa %s\n", UkfKernels::Name(UkfKernels::Selected().isa));
+
+  const size_t kStream = 1 << 16;
+  const std::vector<Measurement> stream = MakeMeasurements(kStream);
+  const UKF warm = WarmFilter(stream, 100);
+  const double dt = 0.05;
+
+  {
+    UKF ukf = warm;
+    Run("Reset (UKF copy, included below)", [&]() {
+      ukf = warm;
+      DoNotOptimize(ukf);
+    });
+  }
+
+  {
+    UKF ukf = warm;
+    UKF::AugSigmaMatrix Xsig_aug;
+    Run("GenerateSigmaPoints", [&]() {
+      ukf.GenerateSigmaPoints(&Xsig_aug);
+      DoNotOptimize(Xsig_aug);
+    });
+  }
+
+  {
+    UKF ukf = warm;
+    ukf.GenerateSigmaPoints(&ukf.Xsig_aug);
+    UKF::SigmaMatrix Xsig_pred;
+    ukf.kernels_ = UKF::SCALAR_KERNELS;
+    Run("PredictSigmaPoints/scalar", [&]() {
+      ukf.PredictSigmaPoints(&Xsig_pred, UKF::n_aug_, dt);
+      DoNotOptimize(Xsig_pred);
+    });
+    ukf.kernels_ = UKF::VECTOR_KERNELS;
+    Run("PredictSigmaPoints/vector", [&]() {
+      ukf.PredictSigmaPoints(&Xsig_pred, UKF::n_aug_, dt);
+      DoNotOptimize(Xsig_pred);
+    });
+    for (int isa = 0; isa < UkfKernels::ISA_COUNT; isa++) {
+      const UkfKernels *kernels = UkfKernels::Get(UkfKernels::Isa(isa));
+      if (!kernels) continue;
+      ukf.isa_kernels_ = kernels;
+      std::string name = std::string("PredictSigmaPoints/vector ") +
+                         UkfKernels::Name(kernels->isa);
+      Run(name.c_str(), [&]() {
+        ukf.PredictSigmaPoints(&Xsig_pred, UKF::n_aug_, dt);
+        DoNotOptimize(Xsig_pred);
+      });
+    }
+    ukf.isa_kernels_ = &UkfKernels::Selected();
+    ukf.motion_model_ = UKF::CV_MODEL;
+    Run("PredictSigmaPoints/cv", [&]() {
+      ukf.PredictSigmaPoints(&Xsig_pred, UKF::n_aug_, dt);
+      DoNotOptimize(Xsig_pred);
+    });
+  }
+
+  {
+    UKF ukf = warm;
+    ukf.Prediction(dt);
+    UKF::StateVector x;
+    UKF::StateMatrix P;
+    Run("PredictMeanAndCovariance", [&]() {
+      ukf.PredictMeanAndCovariance(&x, &P);
+      DoNotOptimize(P);
+    });
+    for (int isa = 0; isa < UkfKernels::ISA_COUNT; isa++) {
+      const UkfKernels *kernels = UkfKernels::Get(UkfKernels::Isa(isa));
+      if (!kernels) continue;
+      ukf.isa_kernels_ = kernels;
+      std::string name = std::string("PredictMeanAndCovariance/") +
+                         UkfKernels::Name(kernels->isa);
+      Run(name.c_str(), [&]() {
+        ukf.PredictMeanAndCovariance(&x, &P);
+        DoNotOptimize(P);
+      });
+    }
+  }
+
+  {
+    UKF ukf = warm;
+    Run("Prediction", [&]() {
+      ukf = warm;
+      ukf.Prediction(dt);
+      DoNotOptimize(ukf.P_pred_);
+    });
+  }
+
+  {
+    //the reduced sigma-point sets, predicted and radar-updated from the
+    //warm state
+    const char *const names[] = {"simplex", "cubature"};
+    const UKF::SigmaPoints sets[] = {UKF::SIMPLEX_POINTS,
+                                     UKF::CUBATURE_POINTS};
+    for (int k = 0; k < 2; k++) {
+      UKFConfig config = warm.Config();
+      config.sigma_points = sets[k];
+      UKF reduced = warm;
+      reduced.Configure(config);
+      UKF ukf = reduced;
+      Run((std::string("Prediction/") + names[k]).c_str(), [&]() {
+        ukf = reduced;
+        ukf.Prediction(dt);
+        DoNotOptimize(ukf.P_pred_);
+      });
+      ukf = reduced;
+      ukf.Prediction(dt);
+      const UKF predicted = ukf;
+      const Measurement &radar = stream[101];
+      Run((std::string("UpdateRadar/") + names[k]).c_str(), [&]() {
+        ukf = predicted;
+        ukf.UpdateRadar(radar);
+        DoNotOptimize(ukf.P_pred_);
+      });
+    }
+  }
+
+  {
+    //the EKF forms a near-linear track switches to, from the warm state
+    UKF ukf = warm;
+    Run("Prediction/ekf", [&]() {
+      ukf = warm;
+      ukf.PredictionEkf(dt);
+      DoNotOptimize(ukf.P_pred_);
+    });
+    ukf = warm;
+    ukf.PredictionEkf(dt);
+    const UKF predicted = ukf;
+    const Measurement &radar = stream[101];
+    Run("UpdateRadar/ekf", [&]() {
+      ukf = predicted;
+      ukf.UpdateRadarEkf(radar);
+      DoNotOptimize(ukf.P_pred_);
+    });
+  }
+
+  {
+    //what-if prediction of 8 horizons: copies of the filter against
+    //PredictAhead from one sigma set
+    const double horizons[8] = {0.1, 0.2, 0.3, 0.5, 0.75, 1.0, 1.5, 2.0};
+    UKF::StateVector x_ahead[8];
+    UKF::StateMatrix P_ahead[8];
+    UKF ukf = warm;
+    Run("Prediction/8 horizons on copies", [&]() {
+      for (int k = 0; k < 8; k++) {
+        ukf = warm;
+        ukf.Prediction(horizons[k]);
+        x_ahead[k] = ukf.x();
+        P_ahead[k] = ukf.P();
+      }
+      DoNotOptimize(P_ahead);
+    });
+    Run("PredictAhead/8 horizons", [&]() {
+      warm.PredictAhead(horizons, 8, x_ahead, P_ahead);
+      DoNotOptimize(P_ahead);
+    });
+  }
+
+  {
+    //a 3 s trajectory at 10 Hz, as for collision checking
+    long long timestamps[30];
+    for (int k = 0; k < 30; k++) {
+      timestamps[k] = warm.timestamp() + (k + 1) * 100000LL;
+    }
+    UKF::PredictedState trajectory[30];
+    Run("PredictTrajectory/30 steps", [&]() {
+      warm.PredictTrajectory(timestamps, 30, trajectory);
+      DoNotOptimize(trajectory);
+    });
+  }
+
+  {
+    UKF ukf = warm;
+    ukf.Prediction(dt);
+    const UKF predicted = ukf;
+    const Measurement &lidar = stream[100];
+    const Measurement &radar = stream[101];
+    Run("UpdateLidar", [&]() {
+      ukf = predicted;
+      ukf.UpdateLidar(lidar);
+      DoNotOptimize(ukf.P_pred_);
+    });
+    Run("UpdateLidar/joseph", [&]() {
+      ukf = predicted;
+      ukf.use_joseph_form_ = true;
+      ukf.UpdateLidar(lidar);
+      DoNotOptimize(ukf.P_pred_);
+    });
+    Run("UpdateRadar", [&]() {
+      ukf = predicted;
+      ukf.UpdateRadar(radar);
+      DoNotOptimize(ukf.P_pred_);
+    });
+    Run("UpdateRadar/fast atan2", [&]() {
+      ukf = predicted;
+      ukf.radar_fast_atan2_ = true;
+      ukf.UpdateRadar(radar);
+      DoNotOptimize(ukf.P_pred_);
+    });
+    {
+      //an outlier the gate rejects before Tc, K and the covariance update
+      UKF gated = predicted;
+      gated.gate_lidar_ = 13.8;
+      gated.gate_radar_ = 16.3;
+      gated.gate_warmup_ = 0;
+      const UKF gated_predicted = gated;
+      Measurement lidar_outlier = lidar;
+      lidar_outlier.values_[0] += 20.0;
+      Measurement radar_outlier = radar;
+      radar_outlier.values_[0] += 20.0;
+      Run("UpdateLidar/gated out", [&]() {
+        gated = gated_predicted;
+        gated.UpdateLidar(lidar_outlier);
+        DoNotOptimize(gated.P_pred_);
+      });
+      Run("UpdateRadar/gated out", [&]() {
+        gated = gated_predicted;
+        gated.UpdateRadar(radar_outlier);
+        DoNotOptimize(gated.P_pred_);
+      });
+    }
+    Run("UpdateRadar+UpdateLidar", [&]() {
+      ukf = predicted;
+      ukf.UpdateRadar(radar);
+      ukf.UpdateLidar(lidar);
+      DoNotOptimize(ukf.P_pred_);
+    });
+    Run("UpdateRadarLidar", [&]() {
+      ukf = predicted;
+      ukf.UpdateRadarLidar(radar, lidar);
+      DoNotOptimize(ukf.P_pred_);
+    });
+    Run("UpdateLidarSqrt", [&]() {
+      ukf = predicted;
+      ukf.L_pred_ = ukf.P_pred_.llt().matrixL();
+      ukf.UpdateLidarSqrt(lidar);
+      DoNotOptimize(ukf.L_pred_);
+    });
+    Run("UpdateRadarSqrt", [&]() {
+      ukf = predicted;
+      ukf.L_pred_ = ukf.P_pred_.llt().matrixL();
+      ukf.UpdateRadarSqrt(radar);
+      DoNotOptimize(ukf.L_pred_);
+    });
+  }
+
+  for (int mode = 0; mode < 2; mode++) {
+    UKF fresh;
+    fresh.use_sqrt_ukf_ = mode == 1;
+    UKF ukf = fresh;
+    size_t next = 0;
+    Run(mode == 0 ? "ProcessMeasurement" : "ProcessMeasurement/sqrt", [&]() {
+      if (next == kStream) {
+        ukf = fresh;
+        next = 0;
+      }
+      ukf.ProcessMeasurement(stream[next++]);
+      DoNotOptimize(ukf.x_pred_);
+    });
+  }
+
+  {
+    const UKF prototype;
+    IMM::Model models[3] = {{0.5, 0.3, UKF::CTRV_MODEL},
+                            {3.8, 0.3, UKF::CTRV_MODEL},
+                            {8.0, 0.3, UKF::CTRV_MODEL}};
+    IMM fresh(prototype, models, 3, 0.95);
+    IMM imm = fresh;
+    size_t next = 0;
+    Run("IMM::ProcessMeasurement/3 models", [&]() {
+      if (next == kStream) {
+        imm = fresh;
+        next = 0;
+      }
+      imm.ProcessMeasurement(stream[next++]);
+      DoNotOptimize(imm.x());
+    });
+  }
+
+  //sweeps over 4096 tracks held as UKF objects and as packed TrackRecords
+  {
+    const int kTracks = 4096;
+    UKFVector filters(kTracks, warm);
+    TrackRecords records(kTracks);
+    for (int i = 0; i < kTracks; i++) {
+      records[i].Capture(warm, i);
+    }
+    std::vector<double> positions(3 * kTracks);
+    Run("Export/4096 UKF objects", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        positions[3 * i] = filters[i].x()(0);
+        positions[3 * i + 1] = filters[i].x()(1);
+        positions[3 * i + 2] = filters[i].P()(0, 0);
+      }
+      DoNotOptimize(positions);
+    });
+    Run("Export/4096 TrackRecords", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        positions[3 * i] = records[i].x[0];
+        positions[3 * i + 1] = records[i].x[1];
+        positions[3 * i + 2] = records[i].p[0];
+      }
+      DoNotOptimize(positions);
+    });
+    long long t = warm.timestamp();
+    Run("PredictRecords/4096 tracks", [&]() {
+      //predict the same posterior again each time: restore the timestamps
+      t += 50000;
+      PredictRecords(warm, t, records.data(), kTracks);
+      for (int i = 0; i < kTracks; i++) {
+        records[i].Capture(warm, i);
+      }
+      DoNotOptimize(records[0].p[0]);
+    });
+  }
+
+  //the structure-of-arrays bank: 1024 tracks predicted by one shared step,
+  //and by the two rates of a 50 ms lidar and a 40 ms radar, in blocks as
+  //tracks updated by the same sensor are
+  {
+    const int kTracks = 1024;
+    UKFBank bank(warm, kTracks);
+    for (int i = 0; i < kTracks; i++) {
+      bank.Add(warm.x(), warm.P());
+    }
+    std::vector<double> dts(kTracks);
+    for (int i = 0; i < kTracks; i++) {
+      dts[i] = (i / 256) % 2 ? 0.04 : 0.05;
+    }
+    Run("UKFBank::Prediction/1024 tracks, one dt", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        bank.SetState(i, warm.x(), warm.P());
+      }
+      bank.Prediction(0.05);
+      DoNotOptimize(bank.Covariance(0));
+    });
+    Run("UKFBank::Prediction/1024 tracks, two dts", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        bank.SetState(i, warm.x(), warm.P());
+      }
+      bank.Prediction(dts.data());
+      DoNotOptimize(bank.Covariance(0));
+    });
+
+    //a lidar-only fleet: no sigma points kept and no radar scratch
+    UKFBank lidar_bank(warm, kTracks, UKFBank::LIDAR_ONLY);
+    for (int i = 0; i < kTracks; i++) {
+      lidar_bank.Add(warm.x(), warm.P());
+    }
+    Run("UKFBank::Prediction/1024 lidar-only tracks", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        lidar_bank.SetState(i, warm.x(), warm.P());
+      }
+      lidar_bank.Prediction(0.05);
+      DoNotOptimize(lidar_bank.Covariance(0));
+    });
+
+    //ego-motion compensation of the whole bank, against the same transform
+    //applied filter by filter; a small turn, so the states stay bounded
+    const RigidTransform ego(0.01, 0.5, -0.1);
+    Run("TransformBank/1024 tracks", [&]() {
+      TransformBank(ego, &bank);
+      DoNotOptimize(bank.Covariance(0));
+    });
+    std::vector<UKF> filters(16, warm);
+    Run("TransformFilter/1024 filters", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        TransformFilter(ego, &filters[i % filters.size()]);
+      }
+      DoNotOptimize(filters[0].P());
+    });
+
+    //a mixed batch, one measurement per track in a scrambled track order
+    //and alternating sensors, as it arrives: a kernel call per measurement
+    //against one sorted Update
+    std::vector<int> slots(kTracks);
+    std::vector<MeasurementPackage::SensorType> sensors(kTracks);
+    std::vector<double> z(3 * kTracks);
+    for (int j = 0; j < kTracks; j++) {
+      slots[j] = (j * 389) % kTracks;
+      sensors[j] = j % 2 ? MeasurementPackage::RADAR
+                         : MeasurementPackage::LASER;
+      z[3 * j] = 1.0;
+      z[3 * j + 1] = 0.5;
+      z[3 * j + 2] = 0.1;
+    }
+    bank.Prediction(0.05);
+    Run("UKFBank::Update/1024 mixed, in arrival order", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        bank.SetState(i, warm.x(), warm.P());
+      }
+      for (int j = 0; j < kTracks; j++) {
+        if (sensors[j] == MeasurementPackage::RADAR) {
+          bank.UpdateRadar(&slots[j], &z[3 * j], 1);
+        }
+        else {
+          bank.UpdateLidar(&slots[j], &z[3 * j], 1);
+        }
+      }
+      DoNotOptimize(bank.Covariance(0));
+    });
+    Run("UKFBank::Update/1024 mixed, bucketed and sorted", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        bank.SetState(i, warm.x(), warm.P());
+      }
+      bank.Update(slots.data(), sensors.data(), z.data(), kTracks);
+      DoNotOptimize(bank.Covariance(0));
+    });
+  }
+
+  //a 4096-track fleet with one track in ten measured: the coasting rest
+  //moved to the cold tier and back 64 at a time, and the prediction sweep
+  //over the hot tier left against the whole fleet in one bank
+  {
+    const int kTracks = 4096;
+    const TimeUs now = warm.timestamp() + 3000000;
+    UKFBank fleet(warm, kTracks);
+    UKFBank hot(warm, kTracks);
+    TieredBank tiers(&hot);
+    std::vector<TieredBank::Handle> handles(kTracks);
+    for (int i = 0; i < kTracks; i++) {
+      fleet.Add(warm.x(), warm.P());
+      tiers.Add(warm.x(), warm.P(), warm.timestamp(), &handles[i]);
+      if (i % 10 == 0) {
+        tiers.Touch(handles[i], now);
+      }
+    }
+    tiers.Demote(now);
+    std::vector<TieredBank::Handle> cold;
+    for (int i = 0; i < kTracks; i++) {
+      if (tiers.IsCold(handles[i])) {
+        cold.push_back(handles[i]);
+      }
+    }
+    size_t next = 0;
+    Run("TieredBank::Promote+Demote/64 of 4096", [&]() {
+      //promoted tracks keep their old time, so Demote sends them back
+      for (int k = 0; k < 64; k++) {
+        tiers.Promote(cold[next]);
+        next = (next + 1) % cold.size();
+      }
+      DoNotOptimize(tiers.Demote(now));
+    });
+    Run("UKFBank::Prediction/4096 tracks, one bank", [&]() {
+      for (int i = 0; i < kTracks; i++) {
+        fleet.SetState(i, warm.x(), warm.P());
+      }
+      fleet.Prediction(0.05);
+      DoNotOptimize(fleet.Covariance(0));
+    });
+    Run("UKFBank::Prediction/410 hot of 4096 tiered", [&]() {
+      for (int i = 0; i < hot.size(); i++) {
+        hot.SetState(i, warm.x(), warm.P());
+      }
+      hot.Prediction(0.05);
+      DoNotOptimize(hot.Covariance(0));
+    });
+  }
+
+  //cross-node fusion of 256 track pairs, with the closed-form weight and
+  //with the exact determinant minimum
+  {
+    const int kPairs = 256;
+    std::vector<TrackFusion::Track> a(kPairs), b(kPairs);
+    std::vector<TrackFusion::Fused> fused(kPairs);
+    for (int i = 0; i < kPairs; i++) {
+      a[i].x = warm.x();
+      a[i].P = warm.P();
+      b[i].x = warm.x();
+      b[i].P = warm.P();
+      b[i].P(0, 0) *= 1.0 + 0.01 * i;
+    }
+    TrackFusion fast;
+    Run("TrackFusion::FuseBatch/256 pairs, fast omega", [&]() {
+      fast.FuseBatch(a.data(), b.data(), kPairs, fused.data());
+      DoNotOptimize(fused[0].P);
+    });
+    TrackFusion::Options options;
+    options.omega = TrackFusion::kDeterminant;
+    TrackFusion exact(options);
+    Run("TrackFusion::FuseBatch/256 pairs, min det", [&]() {
+      exact.FuseBatch(a.data(), b.data(), kPairs, fused.data());
+      DoNotOptimize(fused[0].P);
+    });
+  }
+
+  //radar association for many tracks in a 1 km square: all pairs against
+  //the grid, both evaluating the radar model for every candidate
+  {
+    const int kTracks = 4096;
+    const int kReturns = 256;
+    const double kRadius = 5.0;
+    std::vector<UKF::StateVector> tracks(kTracks);
+    srand(7);
+    for (int i = 0; i < kTracks; i++) {
+      tracks[i] << 1000.0 * rand() / RAND_MAX - 500.0,
+                   1000.0 * rand() / RAND_MAX - 500.0, 5.0, 0.3 * i, 0.0;
+    }
+    std::vector<UKF::RadarVector> returns(kReturns);
+    for (int m = 0; m < kReturns; m++) {
+      const UKF::StateVector &x = tracks[(m * 97) % kTracks];
+      RadarModel::Measure(x.data(), returns[m].data());
+      returns[m](0) += 0.5;
+    }
+
+    int gated = 0;
+    Run("Associate/all pairs 4096x256", [&]() {
+      gated = 0;
+      for (int m = 0; m < kReturns; m++) {
+        for (int i = 0; i < kTracks; i++) {
+          UKF::RadarVector z;
+          RadarModel::Measure(tracks[i].data(), z.data());
+          if (fabs(z(0) - returns[m](0)) < kRadius &&
+              fabs(NormalizeAngle(z(1) - returns[m](1))) * z(0) < kRadius) {
+            ++gated;
+          }
+        }
+      }
+      DoNotOptimize(gated);
+    });
+
+    SpatialGrid grid(kRadius);
+    for (int i = 0; i < kTracks; i++) {
+      grid.Update(i, tracks[i](0), tracks[i](1));
+    }
+    std::vector<int> nearby;
+    nearby.reserve(kTracks);
+    Run("Associate/grid 4096x256", [&]() {
+      gated = 0;
+      //a frame's refresh: the tracks have moved, few of them across cells
+      for (int i = 0; i < kTracks; i++) {
+        grid.Update(i, tracks[i](0), tracks[i](1));
+      }
+      for (int m = 0; m < kReturns; m++) {
+        const double rho = returns[m](0);
+        const double phi = returns[m](1);
+        nearby.clear();
+        grid.Query(rho * cos(phi), rho * sin(phi), kRadius, &nearby);
+        for (size_t k = 0; k < nearby.size(); k++) {
+          UKF::RadarVector z;
+          RadarModel::Measure(tracks[nearby[k]].data(), z.data());
+          if (fabs(z(0) - rho) < kRadius &&
+              fabs(NormalizeAngle(z(1) - phi)) * z(0) < kRadius) {
+            ++gated;
+          }
+        }
+      }
+      DoNotOptimize(gated);
+    });
+  }
+
+  //one radar scan of 1024 tracks plus 25% clutter: gating through the grid
+  //and UKF::MeasurementNis, then the global nearest neighbour assignment
+  {
+    const int kTracks = 1024;
+    const double kGate = 16.3;
+    UKF predicted = warm;
+    predicted.Prediction(dt);
+    UKFVector filters(kTracks, predicted);
+    std::vector<UKF *> tracks(kTracks);
+    std::vector<Measurement> scan;
+    srand(11);
+    SpatialGrid grid(10.0);
+    for (int i = 0; i < kTracks; i++) {
+      //move the whole predicted cloud to a random spot in a 1 km square
+      double ox = 1000.0 * rand() / RAND_MAX - 500.0 - predicted.x_pred_(0);
+      double oy = 1000.0 * rand() / RAND_MAX - 500.0 - predicted.x_pred_(1);
+      filters[i].x_pred_(0) += ox;
+      filters[i].x_pred_(1) += oy;
+      filters[i].Xsig_pred_.row(0).array() += ox;
+      filters[i].Xsig_pred_.row(1).array() += oy;
+      tracks[i] = &filters[i];
+      grid.Update(i, filters[i].x_pred_(0), filters[i].x_pred_(1));
+
+      Measurement m = stream[101];
+      UKF::RadarVector z;
+      RadarModel::Measure(filters[i].x_pred_.data(), z.data());
+      for (int k = 0; k < UKF::n_z_radar_; k++) {
+        m.values_[k] = z(k);
+      }
+      m.values_[0] += 0.1;
+      scan.push_back(m);
+      if (i % 4 == 0) {
+        m.values_[1] += 0.01;
+        m.values_[0] += 3.0;
+        scan.push_back(m);
+      }
+    }
+
+    std::vector<GatedPair> pairs;
+    pairs.reserve(8 * scan.size());
+    std::vector<int> nearby;
+    Run("GNN/gate 1024 tracks", [&]() {
+      pairs.clear();
+      for (size_t m = 0; m < scan.size(); m++) {
+        const double rho = scan[m].values_[0];
+        const double phi = scan[m].values_[1];
+        nearby.clear();
+        grid.Query(rho * cos(phi), rho * sin(phi), 10.0, &nearby);
+        for (size_t k = 0; k < nearby.size(); k++) {
+          double nis = tracks[nearby[k]]->MeasurementNis(scan[m]);
+          if (nis < kGate) {
+            GatedPair pair = {nearby[k], static_cast<int>(m), nis};
+            pairs.push_back(pair);
+          }
+        }
+      }
+      DoNotOptimize(pairs);
+    });
+
+    GnnAssociator gnn(kGate);
+    Run("GNN/solve 1024 tracks", [&]() {
+      gnn.Solve(pairs.data(), pairs.size(), kTracks,
+                static_cast<int>(scan.size()));
+      DoNotOptimize(gnn.total_cost());
+    });
+
+    //the same pairs through JPDA: one prediction per track, every pair
+    //scored against it, then the clusters' probabilities
+    JpdaAssociator jpda;
+    Run("JPDA/solve 1024 tracks", [&]() {
+      jpda.Solve(tracks.data(), kTracks, scan.data(),
+                 static_cast<int>(scan.size()), pairs.data(), pairs.size());
+      DoNotOptimize(jpda.beta());
+    });
+
+    //a whole frame with its temporaries in a FrameArena: gating pairs, the
+    //solve, and the assigned tracks and measurements gathered as batches
+    FrameArena arena;
+    Run("GNN/frame 1024 tracks, arena", [&]() {
+      arena.Reset();
+      ArenaVector<GatedPair> frame_pairs((ArenaAllocator<GatedPair>(&arena)));
+      frame_pairs.reserve(8 * scan.size());
+      for (size_t m = 0; m < scan.size(); m++) {
+        const double rho = scan[m].values_[0];
+        const double phi = scan[m].values_[1];
+        nearby.clear();
+        grid.Query(rho * cos(phi), rho * sin(phi), 10.0, &nearby);
+        for (size_t k = 0; k < nearby.size(); k++) {
+          double nis = tracks[nearby[k]]->MeasurementNis(scan[m]);
+          if (nis < kGate) {
+            GatedPair pair = {nearby[k], static_cast<int>(m), nis};
+            frame_pairs.push_back(pair);
+          }
+        }
+      }
+      gnn.Solve(frame_pairs.data(), frame_pairs.size(), kTracks,
+                static_cast<int>(scan.size()));
+
+      int *batch_tracks = arena.AllocateArray<int>(kTracks);
+      double *batch_z = arena.AllocateArray<double>(UKF::n_z_radar_ * kTracks);
+      int batch = 0;
+      for (int i = 0; i < kTracks; i++) {
+        const int m = gnn.measurement_of_track()[i];
+        if (m < 0) continue;
+        batch_tracks[batch] = i;
+        for (int k = 0; k < UKF::n_z_radar_; k++) {
+          batch_z[UKF::n_z_radar_ * batch + k] = scan[m].values_[k];
+        }
+        ++batch;
+      }
+      DoNotOptimize(batch_z[0]);
+      DoNotOptimize(batch);
+    });
+  }
+
+  //track churn: a track is born on one measurement and dies again, from a
+  //pooled slab against a heap-allocated filter per track
+  {
+    const UKF prototype;
+    TrackManager manager(prototype, 1024);
+    Run("TrackManager::Create+Remove", [&]() {
+      int slot = manager.Create(stream[0]);
+      DoNotOptimize(manager[slot].ukf.x_pred_);
+      manager.Remove(slot);
+    });
+    Run("new UKF+delete", [&]() {
+      UKF *ukf = new UKF(prototype);
+      ukf->ProcessMeasurement(stream[0]);
+      DoNotOptimize(ukf->x_pred_);
+      delete ukf;
+    });
+  }
+
+  //one track's posterior published for other threads, and read back
+  {
+    UKF ukf;
+    for (int i = 0; i < 10; i++) {
+      ukf.ProcessMeasurement(stream[i]);
+    }
+    TrackView view(16);
+    const int slot = view.Add(1);
+    Run("TrackView::Publish", [&]() {
+      view.Publish(slot, 1, ukf);
+    });
+    TrackView::Track track;
+    Run("TrackView::Read", [&]() {
+      bool live = view.Read(slot, &track);
+      DoNotOptimize(live);
+    });
+  }
+
+  //one track's posterior as a delta from the one before, for export
+  {
+    UKF ukf = WarmFilter(stream, 100);
+    std::vector<FilterSnapshot::Record> records(64);
+    for (size_t i = 0; i < records.size(); i++) {
+      ukf.ProcessMeasurement(stream[100 + i]);
+      FilterSnapshot::Capture(ukf, 1, &records[i]);
+    }
+    StateDelta::Encoder encoder;
+    std::vector<char> encoded;
+    size_t i = 0;
+    Run("StateDelta::Encode", [&]() {
+      encoded.clear();
+      size_t n = encoder.Encode(records[i++ % records.size()], &encoded);
+      DoNotOptimize(n);
+    });
+  }
+
+  //the owning shard of a track id, on a ring of 8 shards
+  {
+    ShardMap shards;
+    for (int s = 0; s < 8; s++) {
+      shards.Add(s);
+    }
+    unsigned id = 0;
+    Run("ShardMap::Owner/8 shards", [&]() {
+      int owner = shards.Owner(id++);
+      DoNotOptimize(owner);
+    });
+  }
+
+  //handing measurements to a worker: 32 pushes, then one drain, through the
+  //lock-free ring and through a mutex-guarded deque
+  {
+    MpscQueue<Measurement> ring(1024);
+    Measurement drained[32];
+    Run("MpscQueue::TryPush+TryPopBatch/32", [&]() {
+      for (int i = 0; i < 32; i++) {
+        ring.TryPush(stream[i]);
+      }
+      size_t n = ring.TryPopBatch(drained, 32);
+      DoNotOptimize(n);
+    });
+    std::mutex mutex;
+    std::deque<Measurement> locked;
+    Run("mutex+deque push+pop/32", [&]() {
+      for (int i = 0; i < 32; i++) {
+        std::lock_guard<std::mutex> lock(mutex);
+        locked.push_back(stream[i]);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      size_t n = 0;
+      for (; n < 32 && !locked.empty(); n++) {
+        drained[n] = locked.front();
+        locked.pop_front();
+      }
+      DoNotOptimize(n);
+    });
+  }
+
+  //lidar and radar on separate streams, merged back into one timeline
+  {
+    SensorMerge merge(2, 1024, 50000);
+    size_t next = 0;
+    unsigned long long merged = 0;
+    const SensorMerge::Deliver count = [&merged](int, const Measurement &) {
+      ++merged;
+    };
+    Run("SensorMerge::Push+Poll/2 sensors", [&]() {
+      const Measurement &m = stream[next];
+      next = (next + 1) % stream.size();
+      merge.Push(m.sensor_type_ == MeasurementPackage::RADAR ? 1 : 0, m);
+      merge.Poll(m.timestamp_, count);
+      if (next == 0) {
+        merge.Flush(count);
+      }
+    });
+    DoNotOptimize(merged);
+  }
+
+  //timeouts of 4096 tracks, one updated per millisecond
+  {
+    const int kTimers = 4096;
+    TimerWheel wheel(kTimers, 1000);
+    std::vector<int> expired;
+    expired.reserve(kTimers);
+    TimeUs now = 1477010443000000LL;
+    wheel.Advance(now, &expired);
+    for (int i = 0; i < kTimers; i++) {
+      wheel.Schedule(i, now + 500000 + 1000 * (i % 1000));
+    }
+    int next = 0;
+    Run("TimerWheel::Schedule+Advance/4096 timers", [&]() {
+      now += 1000;
+      wheel.Schedule(next, now + 500000);
+      next = (next + 1) % kTimers;
+      expired.clear();
+      wheel.Advance(now, &expired);
+      for (size_t k = 0; k < expired.size(); k++) {
+        wheel.Schedule(expired[k], now + 500000);
+      }
+      DoNotOptimize(expired);
+    });
+  }
+
+  //every track to one frame time, 100 ms past their last update
+  {
+    const UKF prototype;
+    TrackManager manager(prototype, 256);
+    for (int i = 0; i < 256; i++) {
+      int slot = manager.Create(stream[i]);
+      manager[slot].ukf.ProcessMeasurement(stream[i + 1]);
+    }
+    TimeUs frame = 0;
+    for (int slot : manager.active()) {
+      frame = std::max(frame, manager[slot].ukf.timestamp());
+    }
+    frame += 100000;
+    std::vector<UKF::PredictedState> states(manager.size());
+    Run("TrackManager::PredictAll/256 tracks", [&]() {
+      manager.PredictAll(frame, nullptr, states.data());
+      DoNotOptimize(states[0].x);
+    });
+  }
+
+  //RMSE over the whole history, as the server used to do per message
+  const int kHistories[] = {10, 100, 1000, 10000};
+  for (int h = 0; h < 4; h++) {
+    int n = kHistories[h];
+    std::vector<VectorXd> estimations(n, VectorXd::Constant(4, 1.0));
+    std::vector<VectorXd> ground_truth(n, VectorXd::Constant(4, 1.1));
+    Tools tools;
+    char name[64];
+    snprintf(name, sizeof(name), "CalculateRMSE/%d", n);
+    Run(name, [&]() {
+      VectorXd rmse = tools.CalculateRMSE(estimations, ground_truth);
+      DoNotOptimize(rmse);
+    });
+  }
+
+  //the same over contiguous n x 4 buffers
+  for (int h = 0; h < 4; h++) {
+    int n = kHistories[h];
+    Tools::Rows4 estimations = Tools::Rows4::Constant(n, 4, 1.0);
+    Tools::Rows4 ground_truth = Tools::Rows4::Constant(n, 4, 1.1);
+    Tools tools;
+    char name[64];
+    snprintf(name, sizeof(name), "CalculateRMSE contiguous/%d", n);
+    Run(name, [&]() {
+      Eigen::Vector4d rmse = tools.CalculateRMSE(estimations, ground_truth);
+      DoNotOptimize(rmse);
+    });
+  }
+
+  //a scan of 64 objects of 300 points each plus clutter
+  {
+    std::vector<double> points;
+    srand(7);
+    for (int object = 0; object < 64; object++) {
+      const double cx = 4.0 * (object % 8) - 16.0;
+      const double cy = 4.0 * (object / 8) - 16.0;
+      for (int i = 0; i < 300; i++) {
+        points.push_back(cx + 0.8 * (rand() / static_cast<double>(RAND_MAX)));
+        points.push_back(cy + 0.8 * (rand() / static_cast<double>(RAND_MAX)));
+      }
+    }
+    for (int i = 0; i < 1000; i++) {
+      points.push_back(60.0 * (rand() / static_cast<double>(RAND_MAX)) - 30.0);
+      points.push_back(60.0 * (rand() / static_cast<double>(RAND_MAX)) - 30.0);
+    }
+    LidarClusterer clusterer;
+    std::vector<Measurement> centroids;
+    Run("LidarClusterer::Process/20200 points", [&]() {
+      centroids.clear();
+      clusterer.Process(points.data(), points.size() / 2, 0, &centroids);
+      DoNotOptimize(centroids);
+    });
+  }
+
+  {
+    RMSEAccumulator rmse;
+    Eigen::Vector4d estimate(1.0, 2.0, 3.0, 4.0);
+    Eigen::Vector4d truth(1.1, 2.1, 2.9, 4.2);
+    Run("RMSEAccumulator::Add+RMSE", [&]() {
+      rmse.Add(estimate, truth);
+      Eigen::Vector4d r = rmse.RMSE();
+      DoNotOptimize(r);
+    });
+  }
+
+  //one --estimates line, formatted as ukf_replay writes it; the writer has
+  //no file, so this is the formatting alone, and fprintf to /dev/null the
+  //per-line path it replaced
+  {
+    BufferedWriter writer;
+    double estimate[4] = {5.9214, 1.4233, 2.2049, 0.5367};
+    long long timestamp = 1477010443000000;
+    Run("BufferedWriter estimate line", [&]() {
+      writer.AppendInteger(timestamp++);
+      for (int k = 0; k < 4; k++) {
+        writer.Append(' ');
+        writer.AppendDouble(estimate[k]);
+      }
+      writer.Append('\n');
+    });
+    FILE *null = fopen("/dev/null", "w");
+    if (null) {
+      Run("fprintf estimate line", [&]() {
+        fprintf(null, "%lld %.17g %.17g %.17g %.17g\n", timestamp++,
+                estimate[0], estimate[1], estimate[2], estimate[3]);
+      });
+      fclose(null);
+    }
+  }
+
+  if (json_path) {
+    std::string error;
+    if (!report.Save(json_path, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,250 @@
+#include "bench_report.h"
+#include <cmath>
+#include <fstream>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+double Mean(const std::vector<double> &v) {
+  double sum = 0.0;
+  for (size_t i = 0; i < v.size(); i++) {
+    sum += v[i];
+  }
+  return v.empty() ? 0.0 : sum / v.size();
+}
+
+double Variance(const std::vector<double> &v, double mean) {
+  if (v.size() < 2) {
+    return 0.0;
+  }
+  double sum = 0.0;
+  for (size_t i = 0; i < v.size(); i++) {
+    sum += (v[i] - mean) * (v[i] - mean);
+  }
+  return sum / (v.size() - 1);
+}
+
+// continued fraction of the regularised incomplete beta function, by the
+// modified Lentz method
+double BetaFraction(double a, double b, double x) {
+  const double kTiny = 1e-300;
+  double c = 1.0;
+  double d = 1.0 - (a + b) * x / (a + 1.0);
+  d = 1.0 / (std::fabs(d) < kTiny ? kTiny : d);
+  double h = d;
+  for (int m = 1; m <= 200; m++) {
+    for (int odd = 0; odd < 2; odd++) {
+      const double num = odd == 0
+          ? m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m))
+          : -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+      d = 1.0 + num * d;
+      d = 1.0 / (std::fabs(d) < kTiny ? kTiny : d);
+      c = 1.0 + num / c;
+      c = std::fabs(c) < kTiny ? kTiny : c;
+      h *= d * c;
+      if (odd == 1 && std::fabs(d * c - 1.0) < 1e-12) {
+        return h;
+      }
+    }
+  }
+  return h;
+}
+
+// I_x(a, b)
+double IncompleteBeta(double a, double b, double x) {
+  if (x <= 0.0) return 0.0;
+  if (x >= 1.0) return 1.0;
+  const double front = std::exp(std::lgamma(a + b) - std::lgamma(a) -
+                                std::lgamma(b) + a * std::log(x) +
+                                b * std::log(1.0 - x));
+  //the fraction converges fast only below the mean of the distribution
+  if (x < (a + 1.0) / (a + b + 2.0)) {
+    return front * BetaFraction(a, b, x) / a;
+  }
+  return 1.0 - front * BetaFraction(b, a, 1.0 - x) / b;
+}
+
+}  // namespace
+
+BenchReport::BenchReport(const std::string &tool) : tool_(tool) {}
+
+void BenchReport::Add(const std::string &result, const std::string &metric,
+                      double value, bool lower_is_better) {
+  int index = Find(result);
+  if (index < 0) {
+    index = static_cast<int>(results_.size());
+    results_.push_back(Result());
+    results_.back().name = result;
+  }
+  Result *r = &results_[index];
+  for (size_t m = 0; m < r->metrics.size(); m++) {
+    if (r->metrics[m].name == metric) {
+      r->metrics[m].samples.push_back(value);
+      return;
+    }
+  }
+  Metric added;
+  added.name = metric;
+  added.lower_is_better = lower_is_better;
+  added.samples.push_back(value);
+  r->metrics.push_back(added);
+}
+
+void BenchReport::SetContext(const std::string &key,
+                             const std::string &value) {
+  context_.push_back(std::make_pair(key, value));
+}
+
+bool BenchReport::Save(const std::string &path, std::string *error) const {
+  json doc;
+  doc["tool"] = tool_;
+  doc["context"] = json::object();
+  for (size_t i = 0; i < context_.size(); i++) {
+    doc["context"][context_[i].first] = context_[i].second;
+  }
+  doc["results"] = json::array();
+  for (size_t i = 0; i < results_.size(); i++) {
+    json result;
+    result["name"] = results_[i].name;
+    result["metrics"] = json::array();
+    for (size_t m = 0; m < results_[i].metrics.size(); m++) {
+      const Metric &metric = results_[i].metrics[m];
+      json entry;
+      entry["name"] = metric.name;
+      entry["lower_is_better"] = metric.lower_is_better;
+      entry["samples"] = metric.samples;
+      result["metrics"].push_back(entry);
+    }
+    doc["results"].push_back(result);
+  }
+
+  std::ofstream out(path.c_str());
+  out << doc.dump(1) << "\n";
+  if (!out) {
+    *error = "cannot write " + path;
+    return false;
+  }
+  return true;
+}
+
+bool BenchReport::Load(const std::string &path, std::string *error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    *error = "cannot open " + path;
+    return false;
+  }
+
+  //any missing key or wrong type throws, and the file is rejected whole
+  std::string tool;
+  std::vector<std::pair<std::string, std::string> > context;
+  std::vector<Result> results;
+  try {
+    json doc = json::parse(in);
+    tool = doc.value("tool", std::string());
+    if (doc.count("context") && doc["context"].is_object()) {
+      const json &entries = doc["context"];
+      for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it.value().is_string()) {
+          context.push_back(
+              std::make_pair(it.key(), it.value().get<std::string>()));
+        }
+      }
+    }
+    for (const json &result : doc.at("results")) {
+      Result r;
+      r.name = result.at("name").get<std::string>();
+      for (const json &metric : result.at("metrics")) {
+        Metric m;
+        m.name = metric.at("name").get<std::string>();
+        m.lower_is_better = metric.value("lower_is_better", true);
+        m.samples = metric.at("samples").get<std::vector<double> >();
+        r.metrics.push_back(m);
+      }
+      results.push_back(r);
+    }
+  }
+  catch (const std::exception &e) {
+    *error = path + ": not a benchmark report (" + e.what() + ")";
+    return false;
+  }
+  tool_ = tool;
+  context_.swap(context);
+  results_.swap(results);
+  return true;
+}
+
+int BenchReport::Find(const std::string &name) const {
+  for (size_t i = 0; i < results_.size(); i++) {
+    if (results_[i].name == name) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+double BenchReport::WelchPValue(const std::vector<double> &a,
+                                const std::vector<double> &b) {
+  const double mean_a = Mean(a), mean_b = Mean(b);
+  const double va = a.empty() ? 0.0 : Variance(a, mean_a) / a.size();
+  const double vb = b.empty() ? 0.0 : Variance(b, mean_b) / b.size();
+  if (va + vb <= 0.0) {
+    return mean_a == mean_b ? 1.0 : 0.0;
+  }
+  const double t = (mean_a - mean_b) / std::sqrt(va + vb);
+  //Welch-Satterthwaite degrees of freedom
+  double dof = (va + vb) * (va + vb);
+  double denom = 0.0;
+  if (a.size() > 1) denom += va * va / (a.size() - 1);
+  if (b.size() > 1) denom += vb * vb / (b.size() - 1);
+  dof = denom > 0.0 ? dof / denom : 1.0;
+  //P(|T| > |t|) for Student's t with dof degrees of freedom
+  return IncompleteBeta(0.5 * dof, 0.5, dof / (dof + t * t));
+}
+
+std::vector<BenchReport::Change> BenchReport::Compare(
+    const BenchReport &base, double threshold, double alpha) const {
+  std::vector<Change> changes;
+  for (size_t i = 0; i < results_.size(); i++) {
+    const int found = base.Find(results_[i].name);
+    if (found < 0) {
+      continue;
+    }
+    const Result *other = &base.results_[found];
+    for (size_t m = 0; m < results_[i].metrics.size(); m++) {
+      const Metric &metric = results_[i].metrics[m];
+      const Metric *before = nullptr;
+      for (size_t k = 0; k < other->metrics.size(); k++) {
+        if (other->metrics[k].name == metric.name) {
+          before = &other->metrics[k];
+        }
+      }
+      if (!before || before->samples.empty() || metric.samples.empty()) {
+        continue;
+      }
+
+      Change change;
+      change.result = results_[i].name;
+      change.metric = metric.name;
+      change.base_mean = Mean(before->samples);
+      change.mean = Mean(metric.samples);
+      const double delta = change.mean - change.base_mean;
+      //a zero baseline (no allocations) regresses on any increase
+      change.worse_by = change.base_mean != 0.0
+          ? delta / std::fabs(change.base_mean)
+          : (delta > 0.0 ? HUGE_VAL : delta < 0.0 ? -HUGE_VAL : 0.0);
+      if (!metric.lower_is_better) {
+        change.worse_by = -change.worse_by;
+      }
+      const bool single = before->samples.size() < 2 ||
+                          metric.samples.size() < 2;
+      change.p_value = single ? 0.0
+                              : WelchPValue(before->samples, metric.samples);
+      change.regression = change.worse_by > threshold &&
+                          change.p_value < alpha;
+      changes.push_back(change);
+    }
+  }
+  return changes;
+}
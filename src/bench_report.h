@@ -0,0 +1,111 @@
+#ifndef BENCH_REPORT_H_
+#define BENCH_REPORT_H_
+
+#include <string>
+#include <vector>
+
+/**
+ * Machine-readable results of a ukf_bench or ukf_loadgen run, and the
+ * comparison of two runs that gates performance changes.
+ *
+ * A report is a JSON document,
+ *
+ *   {"tool": "ukf_bench", "context": {"isa": "avx2", ...},
+ *    "results": [{"name": "ProcessMeasurement", "metrics": [
+ *        {"name": "ns_per_op", "lower_is_better": true,
+ *         "samples": [181.2, 179.8, ...]}, ...]}, ...]}
+ *
+ * with one sample per repetition of a benchmark (ukf_bench --repetitions)
+ * or per second of a load test, so that Compare can tell a shift from
+ * noise rather than trusting one number.
+ */
+class BenchReport {
+public:
+  struct Metric {
+    std::string name;
+    bool lower_is_better;
+    std::vector<double> samples;
+  };
+
+  struct Result {
+    std::string name;
+    std::vector<Metric> metrics;
+  };
+
+  ///* What Compare found for one metric present in both runs
+  struct Change {
+    std::string result;
+    std::string metric;
+    double base_mean;
+    double mean;
+    ///* (mean - base_mean) / base_mean, signed so that positive is worse
+    double worse_by;
+    ///* two-sided p-value of Welch's t-test; 0 or 1 when neither run has
+    ///* any spread
+    double p_value;
+    bool regression;
+  };
+
+  explicit BenchReport(const std::string &tool = std::string());
+
+  /**
+   * Adds a sample of a metric, creating the result and metric as needed
+   * @param result Benchmark name
+   * @param metric Metric name, e.g. ns_per_op
+   * @param value Sample
+   * @param lower_is_better Direction of an improvement
+   */
+  void Add(const std::string &result, const std::string &metric,
+           double value, bool lower_is_better = true);
+
+  /**
+   * Records a key and value describing the run (ISA, host, settings)
+   */
+  void SetContext(const std::string &key, const std::string &value);
+
+  /**
+   * @param path File to write
+   * @param error Set to a description on failure
+   * @return false if the file could not be written
+   */
+  bool Save(const std::string &path, std::string *error) const;
+
+  /**
+   * @param path File to read
+   * @param error Set to a description on failure
+   * @return false if the file could not be read or is not a report
+   */
+  bool Load(const std::string &path, std::string *error);
+
+  /**
+   * Compares every metric of this run with the same metric of a baseline.
+   * A metric regresses when it is worse by more than threshold and the
+   * difference is significant at alpha; a metric with a single sample on
+   * either side is judged on the threshold alone.
+   * @param base Baseline run
+   * @param threshold Relative change tolerated, e.g. 0.05
+   * @param alpha Significance level, e.g. 0.05
+   * @return The changes, in this run's order
+   */
+  std::vector<Change> Compare(const BenchReport &base, double threshold,
+                              double alpha) const;
+
+  /**
+   * Two-sided p-value of Welch's t-test for a difference in means
+   */
+  static double WelchPValue(const std::vector<double> &a,
+                            const std::vector<double> &b);
+
+  const std::string &tool() const { return tool_; }
+  const std::vector<Result> &results() const { return results_; }
+
+private:
+  // index of a result by name, -1 if there is none
+  int Find(const std::string &name) const;
+
+  std::string tool_;
+  std::vector<std::pair<std::string, std::string> > context_;
+  std::vector<Result> results_;
+};
+
+#endif /* BENCH_REPORT_H_ */
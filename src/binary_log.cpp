@@ -0,0 +1,610 @@
+#include "binary_log.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <sys/types.h>
+#include "block_codec.h"
+
+const unsigned BinaryLog::kVersion;
+const unsigned BinaryLog::kCompressedVersion;
+const size_t BinaryLog::kGroupRecords;
+
+namespace {
+
+const char kMeasurementMagic[4] = {'U', 'K', 'F', 'M'};
+const char kOutputMagic[4] = {'U', 'K', 'F', 'O'};
+const char kIndexMagic[4] = {'U', 'K', 'F', 'T'};
+const uint32_t kIndexOrdered = 1;
+
+bool HostIsLittleEndian() {
+  const uint16_t probe = 1;
+  unsigned char first;
+  memcpy(&first, &probe, 1);
+  return first == 1;
+}
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+};
+
+// a row of a compressed measurement file
+struct MeasurementRow {
+  uint64_t sensor;
+  int64_t timestamp;
+  double values[3];
+  double ground_truth[4];
+};
+
+// the time index: an entry per group of records, then the trailer
+struct IndexEntry {
+  int64_t min_time;
+  int64_t max_time;
+  uint64_t first;
+  uint64_t count;
+  ///* offset of the group's block in a compressed file, else 0
+  uint64_t offset;
+};
+
+struct IndexTrailer {
+  uint64_t offset;
+  char magic[4];
+  uint32_t flags;
+};
+
+bool WriteHeader(FILE *f, const char *magic, size_t count,
+                 unsigned version = BinaryLog::kVersion) {
+  Header h;
+  memcpy(h.magic, magic, 4);
+  h.version = version;
+  h.count = count;
+  return fwrite(&h, sizeof(h), 1, f) == 1;
+}
+
+bool ReadHeader(FILE *f, const char *magic, size_t *count,
+                unsigned *version = nullptr) {
+  Header h;
+  if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, magic, 4) != 0 ||
+      (h.version != BinaryLog::kVersion &&
+       (!version || h.version != BinaryLog::kCompressedVersion))) {
+    return false;
+  }
+  *count = static_cast<size_t>(h.count);
+  if (version) {
+    *version = h.version;
+  }
+  return true;
+}
+
+// a column of n values picked out of an array of records
+template <typename T, typename Record, typename Get>
+bool WriteColumn(FILE *f, const std::vector<Record> &records, Get get,
+                 std::vector<T> *scratch) {
+  scratch->resize(records.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    (*scratch)[i] = get(records[i]);
+  }
+  return fwrite(scratch->data(), sizeof(T), records.size(), f) ==
+         records.size();
+}
+
+// entries first .. first + n - 1 of the column starting at offset
+template <typename T>
+bool ReadColumn(FILE *f, uint64_t offset, size_t first, size_t n,
+                std::vector<T> *column) {
+  column->resize(n);
+  return fseeko(f, static_cast<off_t>(offset + first * sizeof(T)),
+                SEEK_SET) == 0 &&
+         fread(column->data(), sizeof(T), n, f) == n;
+}
+
+size_t Padded(size_t n) {
+  return (n + 7) & ~static_cast<size_t>(7);
+}
+
+// one entry per kGroupRecords records
+template <typename Record, typename Get>
+void BuildIndex(const std::vector<Record> &records, Get time,
+                std::vector<IndexEntry> *index) {
+  for (size_t first = 0; first < records.size();
+       first += BinaryLog::kGroupRecords) {
+    const size_t n =
+        std::min(BinaryLog::kGroupRecords, records.size() - first);
+    IndexEntry entry = {time(records[first]), time(records[first]), first,
+                        n, 0};
+    for (size_t i = first + 1; i < first + n; i++) {
+      entry.min_time = std::min<int64_t>(entry.min_time, time(records[i]));
+      entry.max_time = std::max<int64_t>(entry.max_time, time(records[i]));
+    }
+    index->push_back(entry);
+  }
+}
+
+bool WriteIndex(FILE *f, const std::vector<IndexEntry> &index) {
+  const off_t offset = ftello(f);
+  IndexTrailer trailer = {static_cast<uint64_t>(offset), {0}, 0};
+  memcpy(trailer.magic, kIndexMagic, 4);
+  trailer.flags = kIndexOrdered;
+  for (size_t i = 1; i < index.size(); i++) {
+    if (index[i].min_time < index[i - 1].max_time) {
+      trailer.flags = 0;
+    }
+  }
+  return offset >= 0 &&
+         fwrite(index.data(), sizeof(IndexEntry), index.size(), f) ==
+             index.size() &&
+         fwrite(&trailer, sizeof(trailer), 1, f) == 1;
+}
+
+// the groups that may hold a time in [from, to); in a time-ordered file a
+// binary search over the entries finds the first, so only the entries of
+// the range are read. false if the file has no index.
+bool FindGroups(FILE *f, TimeUs from, TimeUs to,
+                std::vector<IndexEntry> *groups) {
+  IndexTrailer trailer;
+  if (fseeko(f, 0, SEEK_END) != 0) {
+    return false;
+  }
+  const off_t size = ftello(f);
+  if (size < static_cast<off_t>(sizeof(Header) + sizeof(trailer)) ||
+      fseeko(f, size - static_cast<off_t>(sizeof(trailer)), SEEK_SET) != 0 ||
+      fread(&trailer, sizeof(trailer), 1, f) != 1 ||
+      memcmp(trailer.magic, kIndexMagic, 4) != 0 ||
+      trailer.offset < sizeof(Header) ||
+      trailer.offset > static_cast<uint64_t>(size) - sizeof(trailer) ||
+      (size - sizeof(trailer) - trailer.offset) % sizeof(IndexEntry) != 0) {
+    return false;
+  }
+  const size_t count =
+      (size - sizeof(trailer) - trailer.offset) / sizeof(IndexEntry);
+  IndexEntry entry;
+  auto read = [&](size_t i) {
+    return fseeko(f, static_cast<off_t>(trailer.offset +
+                                        i * sizeof(IndexEntry)),
+                  SEEK_SET) == 0 &&
+           fread(&entry, sizeof(entry), 1, f) == 1;
+  };
+  size_t begin = 0;
+  if (trailer.flags & kIndexOrdered) {
+    //first group whose latest time is not before the range
+    size_t end = count;
+    while (begin < end) {
+      const size_t mid = begin + (end - begin) / 2;
+      if (!read(mid)) {
+        return false;
+      }
+      if (entry.max_time < from) {
+        begin = mid + 1;
+      }
+      else {
+        end = mid;
+      }
+    }
+  }
+  for (size_t i = begin; i < count; i++) {
+    if (!read(i)) {
+      return false;
+    }
+    if ((trailer.flags & kIndexOrdered) && entry.min_time >= to) {
+      break;
+    }
+    if (entry.max_time >= from && entry.min_time < to) {
+      groups->push_back(entry);
+    }
+  }
+  return true;
+}
+
+// drops the records from base on that are outside [from, to)
+template <typename Record, typename Get>
+void KeepRange(size_t base, TimeUs from, TimeUs to, Get time,
+               std::vector<Record> *records) {
+  records->erase(std::remove_if(records->begin() + base, records->end(),
+                                [&](const Record &r) {
+                                  return time(r) < from || time(r) >= to;
+                                }),
+                 records->end());
+}
+
+// reads the groups' rows of an uncompressed file of n, neighbouring
+// groups as one run
+template <typename ReadRows>
+bool ReadGroupRows(const std::vector<IndexEntry> &groups, size_t n,
+                   ReadRows read) {
+  for (size_t g = 0; g < groups.size();) {
+    size_t end = g + 1;
+    while (end < groups.size() &&
+           groups[end].first == groups[end - 1].first + groups[end - 1].count) {
+      ++end;
+    }
+    const uint64_t last = groups[end - 1].first + groups[end - 1].count;
+    if (last > n || !read(groups[g].first, last - groups[g].first)) {
+      return false;
+    }
+    g = end;
+  }
+  return true;
+}
+
+TimeUs MeasurementTime(const LogRecord &r) {
+  return r.meas.timestamp_;
+}
+
+TimeUs OutputTime(const OutputRecord &r) {
+  return r.timestamp;
+}
+
+// rows first .. first + count - 1 of an uncompressed file of n
+bool ReadMeasurementRows(FILE *f, size_t n, size_t first, size_t count,
+                         std::vector<LogRecord> *records) {
+  const uint64_t tags_at = sizeof(Header);
+  const uint64_t times_at = tags_at + Padded(n);
+  std::vector<uint8_t> tags;
+  std::vector<TimeUs> times;
+  std::vector<double> values[7];
+  bool ok = ReadColumn(f, tags_at, first, count, &tags) &&
+            ReadColumn(f, times_at, first, count, &times);
+  for (int k = 0; k < 7 && ok; k++) {
+    ok = ReadColumn(f, times_at + (k + 1) * n * sizeof(double), first, count,
+                    &values[k]);
+  }
+  if (!ok) {
+    return false;
+  }
+
+  size_t base = records->size();
+  records->resize(base + count);
+  for (size_t i = 0; i < count; i++) {
+    LogRecord &r = (*records)[base + i];
+    r.meas.sensor_type_ = tags[i] ? MeasurementPackage::RADAR
+                                  : MeasurementPackage::LASER;
+    r.meas.timestamp_ = times[i];
+    for (int k = 0; k < 3; k++) {
+      r.meas.values_[k] = values[k][i];
+    }
+    for (int k = 0; k < 4; k++) {
+      r.ground_truth[k] = values[3 + k][i];
+    }
+  }
+  return true;
+}
+
+bool ReadOutputRows(FILE *f, size_t n, size_t first, size_t count,
+                    std::vector<OutputRecord> *records) {
+  const uint64_t times_at = sizeof(Header);
+  std::vector<TimeUs> times;
+  std::vector<double> values[11];
+  bool ok = ReadColumn(f, times_at, first, count, &times);
+  for (int k = 0; k < 11 && ok; k++) {
+    ok = ReadColumn(f, times_at + (k + 1) * n * sizeof(double), first, count,
+                    &values[k]);
+  }
+  if (!ok) {
+    return false;
+  }
+
+  size_t base = records->size();
+  records->resize(base + count);
+  for (size_t i = 0; i < count; i++) {
+    OutputRecord &r = (*records)[base + i];
+    r.timestamp = times[i];
+    for (int k = 0; k < 5; k++) {
+      r.x[k] = values[k][i];
+      r.p_diag[k] = values[5 + k][i];
+    }
+    r.nis = values[10][i];
+  }
+  return true;
+}
+
+bool WriteCompressedMeasurements(FILE *f,
+                                 const std::vector<LogRecord> &records,
+                                 std::vector<IndexEntry> *index) {
+  bool ok = WriteHeader(f, kMeasurementMagic, records.size(),
+                        BinaryLog::kCompressedVersion);
+  std::vector<MeasurementRow> rows;
+  std::vector<char> block;
+  for (size_t g = 0; ok && g < index->size(); g++) {
+    IndexEntry &entry = (*index)[g];
+    const off_t offset = ftello(f);
+    ok = offset >= 0;
+    entry.offset = static_cast<uint64_t>(offset);
+    rows.resize(entry.count);
+    for (size_t i = 0; i < entry.count; i++) {
+      const LogRecord &r = records[entry.first + i];
+      MeasurementRow &row = rows[i];
+      row.sensor = r.meas.sensor_type_ == MeasurementPackage::RADAR;
+      row.timestamp = r.meas.timestamp_;
+      memcpy(row.values, r.meas.values_.data(), sizeof(row.values));
+      memcpy(row.ground_truth, r.ground_truth, sizeof(row.ground_truth));
+    }
+    block.clear();
+    BlockCodec::Encode(reinterpret_cast<const char *>(rows.data()),
+                       entry.count, sizeof(MeasurementRow), entry.first,
+                       &block);
+    ok = ok && fwrite(block.data(), 1, block.size(), f) == block.size();
+  }
+  return ok;
+}
+
+// decodes each block into records[base + block.first ...]
+bool DecodeMeasurementBlocks(FILE *f,
+                             const std::vector<BlockCodec::Block> &blocks,
+                             size_t base, std::vector<LogRecord> *records,
+                             ThreadPool *pool) {
+  LogRecord *out = records->data() + base;
+  return BlockCodec::ReadBlocks(
+      fileno(f), blocks, sizeof(MeasurementRow),
+      [out](const BlockCodec::Block &block, const char *raw) {
+        const MeasurementRow *rows =
+            reinterpret_cast<const MeasurementRow *>(raw);
+        for (size_t i = 0; i < block.items; i++) {
+          LogRecord &r = out[block.first + i];
+          r.meas.sensor_type_ = rows[i].sensor ? MeasurementPackage::RADAR
+                                               : MeasurementPackage::LASER;
+          r.meas.timestamp_ = rows[i].timestamp;
+          memcpy(r.meas.values_.data(), rows[i].values,
+                 sizeof(rows[i].values));
+          memcpy(r.ground_truth, rows[i].ground_truth,
+                 sizeof(rows[i].ground_truth));
+        }
+        return true;
+      },
+      pool);
+}
+
+bool ReadCompressedMeasurements(FILE *f, size_t n,
+                                std::vector<LogRecord> *records,
+                                ThreadPool *pool) {
+  std::vector<BlockCodec::Block> blocks;
+  uint64_t end;
+  if (!BlockCodec::Scan(fileno(f), sizeof(Header), &blocks, &end)) {
+    return false;
+  }
+  //a file cut short is an error here, not something to recover from
+  if (blocks.empty() ? n != 0
+                     : blocks.front().first != 0 ||
+                           blocks.back().first + blocks.back().items != n) {
+    return false;
+  }
+  const size_t base = records->size();
+  records->resize(base + n);
+  const bool ok = DecodeMeasurementBlocks(f, blocks, base, records, pool);
+  if (!ok) {
+    records->resize(base);
+  }
+  return ok;
+}
+
+}  // namespace
+
+bool BinaryLog::IsMeasurementFile(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  char magic[4];
+  bool ok = fread(magic, 1, 4, f) == 4 &&
+            memcmp(magic, kMeasurementMagic, 4) == 0;
+  fclose(f);
+  return ok;
+}
+
+bool BinaryLog::WriteMeasurements(const char *path,
+                                  const std::vector<LogRecord> &records,
+                                  bool compress) {
+  if (!HostIsLittleEndian()) {
+    return false;
+  }
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    return false;
+  }
+  std::vector<IndexEntry> index;
+  BuildIndex(records, MeasurementTime, &index);
+  if (compress) {
+    bool ok = WriteCompressedMeasurements(f, records, &index) &&
+              WriteIndex(f, index);
+    return fclose(f) == 0 && ok;
+  }
+  size_t n = records.size();
+  bool ok = WriteHeader(f, kMeasurementMagic, n);
+
+  std::vector<uint8_t> tags(Padded(n), 0);
+  for (size_t i = 0; i < n; i++) {
+    tags[i] = records[i].meas.sensor_type_ == MeasurementPackage::RADAR;
+  }
+  ok = ok && fwrite(tags.data(), 1, tags.size(), f) == tags.size();
+
+  std::vector<TimeUs> times;
+  ok = ok && WriteColumn(f, records, [](const LogRecord &r) {
+    return r.meas.timestamp_;
+  }, &times);
+
+  std::vector<double> column;
+  for (int k = 0; k < 3 && ok; k++) {
+    ok = WriteColumn(f, records, [k](const LogRecord &r) {
+      return r.meas.values_[k];
+    }, &column);
+  }
+  for (int k = 0; k < 4 && ok; k++) {
+    ok = WriteColumn(f, records, [k](const LogRecord &r) {
+      return r.ground_truth[k];
+    }, &column);
+  }
+  ok = ok && WriteIndex(f, index);
+
+  return fclose(f) == 0 && ok;
+}
+
+bool BinaryLog::ReadMeasurements(const char *path,
+                                 std::vector<LogRecord> *records,
+                                 ThreadPool *pool) {
+  if (!HostIsLittleEndian()) {
+    return false;
+  }
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  size_t n;
+  unsigned version;
+  bool ok = ReadHeader(f, kMeasurementMagic, &n, &version);
+  if (ok) {
+    ok = version == kCompressedVersion
+        ? ReadCompressedMeasurements(f, n, records, pool)
+        : ReadMeasurementRows(f, n, 0, n, records);
+  }
+  fclose(f);
+  return ok;
+}
+
+bool BinaryLog::ReadMeasurements(const char *path, TimeUs from, TimeUs to,
+                                 std::vector<LogRecord> *records,
+                                 ThreadPool *pool) {
+  if (!HostIsLittleEndian()) {
+    return false;
+  }
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  size_t n;
+  unsigned version;
+  std::vector<IndexEntry> groups;
+  if (!ReadHeader(f, kMeasurementMagic, &n, &version)) {
+    fclose(f);
+    return false;
+  }
+  const size_t base = records->size();
+  if (!FindGroups(f, from, to, &groups)) {
+    //no index: read it all and cut the range out
+    fclose(f);
+    if (!ReadMeasurements(path, records, pool)) {
+      return false;
+    }
+    KeepRange(base, from, to, MeasurementTime, records);
+    return true;
+  }
+
+  bool ok = true;
+  if (version == kCompressedVersion) {
+    std::vector<BlockCodec::Block> blocks(groups.size());
+    size_t count = 0;
+    for (size_t g = 0; ok && g < groups.size(); g++) {
+      ok = BlockCodec::ReadHeader(fileno(f), groups[g].offset, &blocks[g]) &&
+           blocks[g].first == groups[g].first &&
+           blocks[g].items == groups[g].count;
+      count += groups[g].count;
+    }
+    //the groups are decoded next to each other, whatever their place in
+    //the file
+    for (size_t g = 0, at = 0; ok && g < groups.size(); g++) {
+      blocks[g].first = at;
+      at += blocks[g].items;
+    }
+    if (ok) {
+      records->resize(base + count);
+      ok = DecodeMeasurementBlocks(f, blocks, base, records, pool);
+    }
+  }
+  else {
+    ok = ReadGroupRows(groups, n, [&](size_t first, size_t count) {
+      return ReadMeasurementRows(f, n, first, count, records);
+    });
+  }
+  fclose(f);
+  if (!ok) {
+    records->resize(base);
+    return false;
+  }
+  KeepRange(base, from, to, MeasurementTime, records);
+  return true;
+}
+
+bool BinaryLog::WriteOutputs(const char *path,
+                             const std::vector<OutputRecord> &records) {
+  if (!HostIsLittleEndian()) {
+    return false;
+  }
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = WriteHeader(f, kOutputMagic, records.size());
+
+  std::vector<TimeUs> times;
+  ok = ok && WriteColumn(f, records, [](const OutputRecord &r) {
+    return r.timestamp;
+  }, &times);
+
+  std::vector<double> column;
+  for (int k = 0; k < 5 && ok; k++) {
+    ok = WriteColumn(f, records, [k](const OutputRecord &r) {
+      return r.x[k];
+    }, &column);
+  }
+  for (int k = 0; k < 5 && ok; k++) {
+    ok = WriteColumn(f, records, [k](const OutputRecord &r) {
+      return r.p_diag[k];
+    }, &column);
+  }
+  ok = ok && WriteColumn(f, records, [](const OutputRecord &r) {
+    return r.nis;
+  }, &column);
+
+  std::vector<IndexEntry> index;
+  BuildIndex(records, OutputTime, &index);
+  ok = ok && WriteIndex(f, index);
+
+  return fclose(f) == 0 && ok;
+}
+
+bool BinaryLog::ReadOutputs(const char *path,
+                            std::vector<OutputRecord> *records) {
+  if (!HostIsLittleEndian()) {
+    return false;
+  }
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  size_t n;
+  bool ok = ReadHeader(f, kOutputMagic, &n) &&
+            ReadOutputRows(f, n, 0, n, records);
+  fclose(f);
+  return ok;
+}
+
+bool BinaryLog::ReadOutputs(const char *path, TimeUs from, TimeUs to,
+                            std::vector<OutputRecord> *records) {
+  if (!HostIsLittleEndian()) {
+    return false;
+  }
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  size_t n;
+  std::vector<IndexEntry> groups;
+  if (!ReadHeader(f, kOutputMagic, &n)) {
+    fclose(f);
+    return false;
+  }
+  const size_t base = records->size();
+  //without an index everything is read and the range cut out
+  const bool ok = FindGroups(f, from, to, &groups)
+      ? ReadGroupRows(groups, n, [&](size_t first, size_t count) {
+          return ReadOutputRows(f, n, first, count, records);
+        })
+      : ReadOutputRows(f, n, 0, n, records);
+  fclose(f);
+  if (!ok) {
+    records->resize(base);
+    return false;
+  }
+  KeepRange(base, from, to, OutputTime, records);
+  return true;
+}
@@ -0,0 +1,99 @@
+#ifndef BINARY_LOG_H_
+#define BINARY_LOG_H_
+
+#include <cstddef>
+#include <vector>
+#include "log_reader.h"
+
+class ThreadPool;
+
+/**
+ * One filter output: the state after a measurement, the diagonal of its
+ * covariance and the normalised innovation squared of the update
+ */
+struct OutputRecord {
+  TimeUs timestamp;
+  double x[5];
+  double p_diag[5];
+  double nis;
+};
+
+/**
+ * Columnar binary files for measurement streams and filter outputs, so a
+ * regression run can load its input with a few large reads instead of
+ * parsing text.
+ *
+ * Both files start with a 16-byte header, "UKFM" or "UKFO", a u32 version
+ * and a u64 record count n, followed by fixed-width columns of n entries
+ * each, in host (little-endian) byte order:
+ *
+ *   UKFM: u8 sensor (0 laser, 1 radar) padded to a multiple of 8 bytes,
+ *         i64 timestamp, f64 value[0..2], f64 ground_truth[0..3]
+ *   UKFO: i64 timestamp, f64 x[0..4], f64 p_diag[0..4], f64 nis
+ *
+ * A compressed measurement file (version 2) holds the same n records as
+ * BlockCodec blocks of up to kGroupRecords rows of u64 sensor, i64
+ * timestamp, f64 value[0..2], f64 ground_truth[0..3]; the codec's byte
+ * transpose turns each group back into columns before compressing it.
+ * Groups decode independently, on a ThreadPool when the reader has one.
+ *
+ * Every file written ends in a sparse time index: per kGroupRecords
+ * records their earliest and latest timestamp, the index of the first and
+ * the count (and in a compressed file the group's block offset), 40 bytes
+ * each, then a 16-byte trailer of the index's u64 offset, "UKFT" and u32
+ * flags (bit 0: the groups are in time order). The range reads use it to
+ * read only the groups that overlap the range, found by a binary search
+ * over the entries on disk when the groups are in time order; files
+ * without an index are read whole and filtered.
+ */
+class BinaryLog {
+public:
+  static const unsigned kVersion = 1;
+  static const unsigned kCompressedVersion = 2;
+  ///* records per block of a compressed measurement file
+  static const size_t kGroupRecords = 4096;
+
+  /**
+   * Whether a file starts with the measurement header
+   */
+  static bool IsMeasurementFile(const char *path);
+
+  /**
+   * Measurement files; either version is read
+   * @param path File to write or read
+   * @param records Records to write / appended to on read
+   * @param compress Write version 2
+   * @param pool Threads to decompress blocks on, or nullptr
+   * @return false on I/O errors, a bad header or a corrupt block
+   */
+  static bool WriteMeasurements(const char *path,
+                                const std::vector<LogRecord> &records,
+                                bool compress = false);
+  static bool ReadMeasurements(const char *path,
+                               std::vector<LogRecord> *records,
+                               ThreadPool *pool = nullptr);
+
+  /**
+   * The measurements with from <= timestamp < to, in file order
+   * @param from First time of the range
+   * @param to End of the range, exclusive
+   */
+  static bool ReadMeasurements(const char *path, TimeUs from, TimeUs to,
+                               std::vector<LogRecord> *records,
+                               ThreadPool *pool = nullptr);
+
+  /**
+   * Output files
+   * @param path File to write or read
+   * @param records Records to write / appended to on read
+   * @return false on I/O errors or a bad header
+   */
+  static bool WriteOutputs(const char *path,
+                           const std::vector<OutputRecord> &records);
+  static bool ReadOutputs(const char *path,
+                          std::vector<OutputRecord> *records);
+  static bool ReadOutputs(const char *path, TimeUs from, TimeUs to,
+                          std::vector<OutputRecord> *records);
+};
+
+#endif /* BINARY_LOG_H_ */
@@ -0,0 +1,141 @@
+#include "binary_protocol.h"
+#include <cstring>
+#include <stdint.h>
+
+const unsigned char BinaryProtocol::kMeasurementType;
+const unsigned char BinaryProtocol::kEstimateType;
+const unsigned char BinaryProtocol::kTrackType;
+const unsigned char BinaryProtocol::kHasGroundTruth;
+const size_t BinaryProtocol::kMeasurementRecordSize;
+const size_t BinaryProtocol::kEstimateRecordSize;
+const size_t BinaryProtocol::kTrackRecordSize;
+
+namespace {
+
+// byte-wise so the wire format does not depend on the host byte order
+
+void PutU32(uint32_t v, char *out) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+  }
+}
+
+uint32_t GetU32(const char *in) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+  }
+  return v;
+}
+
+void PutU64(uint64_t v, char *out) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+  }
+}
+
+uint64_t GetU64(const char *in) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+  }
+  return v;
+}
+
+void PutDouble(double d, char *out) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  PutU64(v, out);
+}
+
+double GetDouble(const char *in) {
+  uint64_t v = GetU64(in);
+  double d;
+  memcpy(&d, &v, sizeof(d));
+  return d;
+}
+
+}  // namespace
+
+bool BinaryProtocol::DecodeMeasurement(const char *data, size_t length,
+                                       unsigned *track_id, Measurement *meas,
+                                       Eigen::Vector4d *ground_truth) {
+  if (length < kMeasurementRecordSize ||
+      static_cast<unsigned char>(data[0]) != kMeasurementType) {
+    return false;
+  }
+
+  unsigned char sensor = static_cast<unsigned char>(data[1]);
+  unsigned char flags = static_cast<unsigned char>(data[2]);
+  if (sensor == 0) {
+    meas->sensor_type_ = MeasurementPackage::LASER;
+  }
+  else if (sensor == 1) {
+    meas->sensor_type_ = MeasurementPackage::RADAR;
+  }
+  else {
+    return false;
+  }
+
+  *track_id = GetU32(data + 4);
+  meas->timestamp_ = static_cast<long long>(GetU64(data + 8));
+  for (int i = 0; i < 3; i++) {
+    meas->values_[i] = GetDouble(data + 16 + 8 * i);
+  }
+
+  if (flags & kHasGroundTruth) {
+    for (int i = 0; i < 4; i++) {
+      (*ground_truth)(i) = GetDouble(data + 40 + 8 * i);
+    }
+  }
+  else {
+    ground_truth->setZero();
+  }
+  return true;
+}
+
+void BinaryProtocol::EncodeMeasurement(unsigned track_id,
+                                       const Measurement &meas,
+                                       const Eigen::Vector4d *ground_truth,
+                                       char *out) {
+  memset(out, 0, kMeasurementRecordSize);
+  out[0] = static_cast<char>(kMeasurementType);
+  out[1] = meas.sensor_type_ == MeasurementPackage::RADAR ? 1 : 0;
+  out[2] = ground_truth ? static_cast<char>(kHasGroundTruth) : 0;
+  PutU32(track_id, out + 4);
+  PutU64(static_cast<uint64_t>(meas.timestamp_), out + 8);
+  for (int i = 0; i < 3; i++) {
+    PutDouble(meas.values_[i], out + 16 + 8 * i);
+  }
+  if (ground_truth) {
+    for (int i = 0; i < 4; i++) {
+      PutDouble((*ground_truth)(i), out + 40 + 8 * i);
+    }
+  }
+}
+
+void BinaryProtocol::EncodeEstimate(unsigned track_id, long long timestamp,
+                                    const Eigen::Vector4d &estimate,
+                                    const Eigen::Vector4d &rmse, char *out) {
+  memset(out, 0, kEstimateRecordSize);
+  out[0] = static_cast<char>(kEstimateType);
+  PutU32(track_id, out + 4);
+  PutU64(static_cast<uint64_t>(timestamp), out + 8);
+  for (int i = 0; i < 4; i++) {
+    PutDouble(estimate(i), out + 16 + 8 * i);
+    PutDouble(rmse(i), out + 48 + 8 * i);
+  }
+}
+
+void BinaryProtocol::EncodeTrack(unsigned long long session,
+                                 unsigned track_id, long long timestamp,
+                                 const double *estimate, char *out) {
+  memset(out, 0, kTrackRecordSize);
+  out[0] = static_cast<char>(kTrackType);
+  PutU32(track_id, out + 4);
+  PutU64(static_cast<uint64_t>(timestamp), out + 8);
+  for (int i = 0; i < 4; i++) {
+    PutDouble(estimate[i], out + 16 + 8 * i);
+  }
+  PutU64(session, out + 48);
+}
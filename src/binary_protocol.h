@@ -0,0 +1,92 @@
+#ifndef BINARY_PROTOCOL_H_
+#define BINARY_PROTOCOL_H_
+
+#include <cstddef>
+#include "Eigen/Dense"
+#include "measurement_package.h"
+
+/**
+ * Fixed-size little-endian records exchanged in WebSocket BINARY frames, as
+ * an alternative to the Socket.IO text frames. A client opts in by sending
+ * binary frames; it is answered in the same format. A frame may carry any
+ * number of consecutive measurement records, for one or more tracks, and is
+ * answered with one frame holding an estimate record per measurement.
+ * UnixTransport carries the same records as a plain byte stream.
+ *
+ * Measurement record (client to server), 72 bytes:
+ *   offset  0  u8      type, kMeasurementType
+ *   offset  1  u8      sensor, 0 = laser, 1 = radar
+ *   offset  2  u8      flags, bit 0 set if ground truth follows
+ *   offset  3  u8      reserved, zero
+ *   offset  4  u32     track id
+ *   offset  8  i64     timestamp in us
+ *   offset 16  f64[3]  px, py, unused / rho, phi, rho_dot
+ *   offset 40  f64[4]  ground truth x, y, vx, vy
+ *
+ * Estimate record (server to client), 80 bytes:
+ *   offset  0  u8      type, kEstimateType
+ *   offset  1  u8[3]   reserved, zero
+ *   offset  4  u32     track id
+ *   offset  8  i64     timestamp of the measurement it answers, in us
+ *   offset 16  f64[4]  estimate x, y, vx, vy
+ *   offset 48  f64[4]  RMSE x, y, vx, vy
+ *
+ * Track record (server to HTTP client, GET /tracks), 56 bytes:
+ *   offset  0  u8      type, kTrackType
+ *   offset  1  u8[3]   reserved, zero
+ *   offset  4  u32     track id
+ *   offset  8  i64     timestamp of the estimate, in us
+ *   offset 16  f64[4]  estimate x, y, vx, vy
+ *   offset 48  u64     id of the session the track belongs to
+ */
+class BinaryProtocol {
+public:
+  static const unsigned char kMeasurementType = 1;
+  static const unsigned char kEstimateType = 2;
+  static const unsigned char kTrackType = 3;
+  static const unsigned char kHasGroundTruth = 1;
+
+  static const size_t kMeasurementRecordSize = 72;
+  static const size_t kEstimateRecordSize = 80;
+  static const size_t kTrackRecordSize = 56;
+
+  /**
+   * Decodes one measurement record
+   * @param data Record bytes
+   * @param length Number of bytes available
+   * @param track_id Track the measurement belongs to
+   * @param meas Decoded measurement
+   * @param ground_truth Decoded ground truth, zero if the record has none
+   * @return false if the record is short or malformed
+   */
+  static bool DecodeMeasurement(const char *data, size_t length,
+                                unsigned *track_id, Measurement *meas,
+                                Eigen::Vector4d *ground_truth);
+
+  /**
+   * Encodes one measurement record
+   * @param out kMeasurementRecordSize bytes
+   */
+  static void EncodeMeasurement(unsigned track_id, const Measurement &meas,
+                                const Eigen::Vector4d *ground_truth,
+                                char *out);
+
+  /**
+   * Encodes one estimate record
+   * @param out kEstimateRecordSize bytes
+   */
+  static void EncodeEstimate(unsigned track_id, long long timestamp,
+                             const Eigen::Vector4d &estimate,
+                             const Eigen::Vector4d &rmse, char *out);
+
+  /**
+   * Encodes one track record
+   * @param estimate x, y, vx, vy
+   * @param out kTrackRecordSize bytes
+   */
+  static void EncodeTrack(unsigned long long session, unsigned track_id,
+                          long long timestamp, const double *estimate,
+                          char *out);
+};
+
+#endif /* BINARY_PROTOCOL_H_ */
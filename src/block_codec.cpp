@@ -0,0 +1,357 @@
+#include "block_codec.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "thread_pool.h"
+
+namespace {
+
+const char kBlockMagic[4] = {'U', 'K', 'F', 'B'};
+const uint32_t kStored = 1;
+
+struct Header {
+  char magic[4];
+  uint32_t items;
+  uint32_t raw_bytes;
+  uint32_t stored_bytes;
+  uint64_t first;
+  uint32_t checksum;
+  uint32_t flags;
+};
+
+static_assert(sizeof(Header) == BlockCodec::kHeaderSize,
+              "block headers are written as raw bytes");
+
+// LZ4 block format limits: a match is at least 4 bytes and at most 64 KiB
+// back, the last 5 bytes are always literals and the last match starts at
+// least 12 bytes before the end
+const size_t kMinMatch = 4;
+const size_t kLastLiterals = 5;
+const size_t kMatchStartLimit = 12;
+const size_t kMaxOffset = 65535;
+const int kHashLog = 12;
+
+uint32_t Read32(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+uint32_t Hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashLog);
+}
+
+uint32_t Fnv1a(const char *data, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++) {
+    h = (h ^ static_cast<unsigned char>(data[i])) * 16777619u;
+  }
+  return h;
+}
+
+// a length above 15 continues in bytes of 255 and a final remainder
+char *PutLength(size_t length, char *op) {
+  for (; length >= 255; length -= 255) {
+    *op++ = char(255);
+  }
+  *op++ = char(length);
+  return op;
+}
+
+bool GetLength(const unsigned char *src, size_t stored, size_t *ip,
+               size_t *length) {
+  unsigned char b;
+  do {
+    if (*ip >= stored) {
+      return false;
+    }
+    b = src[(*ip)++];
+    *length += b;
+  } while (b == 255);
+  return true;
+}
+
+char *PutSequence(const char *literals, size_t literal_length, size_t offset,
+                  size_t match_length, char *op) {
+  char *token = op++;
+  const size_t ml = match_length - kMinMatch;
+  *token = char((std::min(literal_length, size_t(15)) << 4) |
+                (match_length ? std::min(ml, size_t(15)) : 0));
+  if (literal_length >= 15) {
+    op = PutLength(literal_length - 15, op);
+  }
+  memcpy(op, literals, literal_length);
+  op += literal_length;
+  if (!match_length) {
+    return op;
+  }
+  *op++ = char(offset & 0xff);
+  *op++ = char(offset >> 8);
+  if (ml >= 15) {
+    op = PutLength(ml - 15, op);
+  }
+  return op;
+}
+
+// byte k of every item together: out[k * items + i] = in[i * size + k]
+void Transpose(const char *in, size_t items, size_t size, char *out) {
+  for (size_t i = 0; i < items; i++) {
+    for (size_t k = 0; k < size; k++) {
+      out[k * items + i] = in[i * size + k];
+    }
+  }
+}
+
+void Untranspose(const char *in, size_t items, size_t size, char *out) {
+  for (size_t k = 0; k < size; k++) {
+    for (size_t i = 0; i < items; i++) {
+      out[i * size + k] = in[k * items + i];
+    }
+  }
+}
+
+bool PreadAll(int fd, char *buffer, size_t n, uint64_t offset) {
+  while (n > 0) {
+    ssize_t got = pread(fd, buffer, n, static_cast<off_t>(offset));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    buffer += got;
+    n -= static_cast<size_t>(got);
+    offset += static_cast<uint64_t>(got);
+  }
+  return true;
+}
+
+}  // namespace
+
+const size_t BlockCodec::kHeaderSize;
+
+size_t BlockCodec::Compress(const char *src, size_t n, char *dst) {
+  char *op = dst;
+  size_t anchor = 0;
+  if (n > kMatchStartLimit) {
+    uint32_t table[1 << kHashLog] = {0};
+    const size_t limit = n - kMatchStartLimit;
+    const size_t match_limit = n - kLastLiterals;
+    size_t ip = 1;
+    while (ip < limit) {
+      const uint32_t sequence = Read32(src + ip);
+      const uint32_t h = Hash(sequence);
+      size_t candidate = table[h];
+      table[h] = static_cast<uint32_t>(ip);
+      if (candidate >= ip || ip - candidate > kMaxOffset ||
+          Read32(src + candidate) != sequence) {
+        ++ip;
+        continue;
+      }
+      //extend backwards over the pending literals, then forwards
+      while (ip > anchor && candidate > 0 &&
+             src[ip - 1] == src[candidate - 1]) {
+        --ip;
+        --candidate;
+      }
+      size_t length = kMinMatch;
+      while (ip + length < match_limit &&
+             src[candidate + length] == src[ip + length]) {
+        ++length;
+      }
+      op = PutSequence(src + anchor, ip - anchor, ip - candidate, length, op);
+      ip += length;
+      anchor = ip;
+      if (ip - 2 < limit) {
+        table[Hash(Read32(src + ip - 2))] = static_cast<uint32_t>(ip - 2);
+      }
+    }
+  }
+  op = PutSequence(src + anchor, n - anchor, 0, 0, op);
+  return static_cast<size_t>(op - dst);
+}
+
+bool BlockCodec::Decompress(const char *data, size_t stored, char *dst,
+                            size_t n) {
+  const unsigned char *src = reinterpret_cast<const unsigned char *>(data);
+  size_t ip = 0;
+  size_t op = 0;
+  while (ip < stored) {
+    const unsigned char token = src[ip++];
+    size_t literals = token >> 4;
+    if (literals == 15 && !GetLength(src, stored, &ip, &literals)) {
+      return false;
+    }
+    if (literals > stored - ip || literals > n - op) {
+      return false;
+    }
+    memcpy(dst + op, src + ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == stored) {
+      break;
+    }
+    if (stored - ip < 2) {
+      return false;
+    }
+    const size_t offset = src[ip] | (size_t(src[ip + 1]) << 8);
+    ip += 2;
+    size_t length = token & 15;
+    if (length == 15 && !GetLength(src, stored, &ip, &length)) {
+      return false;
+    }
+    length += kMinMatch;
+    if (offset == 0 || offset > op || length > n - op) {
+      return false;
+    }
+    //byte by byte: a match may overlap the bytes it produces
+    const char *match = dst + op - offset;
+    for (size_t i = 0; i < length; i++) {
+      dst[op + i] = match[i];
+    }
+    op += length;
+  }
+  return op == n;
+}
+
+void BlockCodec::Encode(const char *data, size_t items, size_t item_size,
+                        uint64_t first, std::vector<char> *out) {
+  static thread_local std::vector<char> transposed;
+  const size_t raw = items * item_size;
+  transposed.resize(raw);
+  Transpose(data, items, item_size, transposed.data());
+
+  const size_t start = out->size();
+  out->resize(start + kHeaderSize + Bound(raw));
+  char *payload = out->data() + start + kHeaderSize;
+  Header h;
+  memcpy(h.magic, kBlockMagic, 4);
+  h.items = static_cast<uint32_t>(items);
+  h.raw_bytes = static_cast<uint32_t>(raw);
+  h.first = first;
+  h.flags = 0;
+  size_t stored = Compress(transposed.data(), raw, payload);
+  if (stored >= raw) {
+    memcpy(payload, data, raw);
+    stored = raw;
+    h.flags = kStored;
+  }
+  h.stored_bytes = static_cast<uint32_t>(stored);
+  h.checksum = Fnv1a(payload, stored);
+  memcpy(out->data() + start, &h, sizeof(h));
+  out->resize(start + kHeaderSize + stored);
+}
+
+bool BlockCodec::Decode(const char *stored, const Block &block,
+                        size_t item_size, char *out) {
+  if (block.raw_bytes != size_t(block.items) * item_size ||
+      Fnv1a(stored, block.stored_bytes) != block.checksum) {
+    return false;
+  }
+  if (block.flags & kStored) {
+    if (block.stored_bytes != block.raw_bytes) {
+      return false;
+    }
+    memcpy(out, stored, block.raw_bytes);
+    return true;
+  }
+  static thread_local std::vector<char> transposed;
+  transposed.resize(block.raw_bytes);
+  if (!Decompress(stored, block.stored_bytes, transposed.data(),
+                  block.raw_bytes)) {
+    return false;
+  }
+  Untranspose(transposed.data(), block.items, item_size, out);
+  return true;
+}
+
+bool BlockCodec::ReadHeader(int fd, uint64_t offset, Block *block) {
+  Header h;
+  if (!PreadAll(fd, reinterpret_cast<char *>(&h), sizeof(h), offset) ||
+      memcmp(h.magic, kBlockMagic, 4) != 0) {
+    return false;
+  }
+  Block b = {offset, h.first, h.items, h.raw_bytes, h.stored_bytes,
+             h.checksum, h.flags};
+  *block = b;
+  return true;
+}
+
+bool BlockCodec::Scan(int fd, uint64_t offset, std::vector<Block> *blocks,
+                      uint64_t *end) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return false;
+  }
+  const uint64_t size = static_cast<uint64_t>(st.st_size);
+  const size_t base = blocks->size();
+  const uint64_t start = offset;
+  while (offset + kHeaderSize <= size) {
+    Header h;
+    if (!PreadAll(fd, reinterpret_cast<char *>(&h), sizeof(h), offset)) {
+      return false;
+    }
+    const bool chained = blocks->size() == base ||
+        h.first == blocks->back().first + blocks->back().items;
+    if (memcmp(h.magic, kBlockMagic, 4) != 0 || !chained ||
+        offset + kHeaderSize + h.stored_bytes > size) {
+      break;
+    }
+    Block block = {offset, h.first, h.items, h.raw_bytes, h.stored_bytes,
+                   h.checksum, h.flags};
+    blocks->push_back(block);
+    offset += kHeaderSize + h.stored_bytes;
+  }
+  //a crash tears the blocks being appended, so those at the end are the
+  //ones whose payload is checked
+  std::vector<char> stored;
+  while (blocks->size() > base) {
+    const Block &last = blocks->back();
+    stored.resize(last.stored_bytes);
+    if (!PreadAll(fd, stored.data(), stored.size(),
+                  last.offset + kHeaderSize)) {
+      return false;
+    }
+    if (Fnv1a(stored.data(), stored.size()) == last.checksum) {
+      break;
+    }
+    blocks->pop_back();
+  }
+  *end = blocks->size() > base
+      ? blocks->back().offset + kHeaderSize + blocks->back().stored_bytes
+      : start;
+  return true;
+}
+
+bool BlockCodec::ReadBlocks(
+    int fd, const std::vector<Block> &blocks, size_t item_size,
+    const std::function<bool(const Block &, const char *)> &sink,
+    ThreadPool *pool) {
+  std::atomic<bool> ok(true);
+  auto body = [&](int begin, int end) {
+    static thread_local std::vector<char> stored;
+    static thread_local std::vector<char> raw;
+    for (int b = begin; b < end && ok.load(std::memory_order_relaxed); b++) {
+      const Block &block = blocks[b];
+      stored.resize(block.stored_bytes);
+      raw.resize(block.raw_bytes);
+      if (!PreadAll(fd, stored.data(), stored.size(),
+                    block.offset + kHeaderSize) ||
+          !Decode(stored.data(), block, item_size, raw.data()) ||
+          !sink(block, raw.data())) {
+        ok.store(false, std::memory_order_relaxed);
+      }
+    }
+  };
+  const int count = static_cast<int>(blocks.size());
+  if (pool) {
+    pool->ParallelFor(0, count, 1, body);
+  }
+  else {
+    body(0, count);
+  }
+  return ok.load();
+}
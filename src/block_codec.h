@@ -0,0 +1,112 @@
+#ifndef BLOCK_CODEC_H_
+#define BLOCK_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * Independently decodable compressed blocks, for the compressed versions
+ * of the measurement journal and the binary logs.
+ *
+ * A block holds a run of fixed-size items. Its payload is the items' bytes
+ * transposed by item_size (byte k of every item, then byte k + 1 ...), so
+ * that the slowly changing bytes of timestamps, ids and doubles line up,
+ * compressed in the LZ4 block format; a payload that would not shrink is
+ * stored as is. Each block starts with a 32-byte header in host
+ * (little-endian) byte order:
+ *
+ *   u32 magic "UKFB", u32 item count, u32 raw bytes, u32 stored bytes,
+ *   u64 index of its first item in the file, u32 FNV-1a of the stored
+ *   bytes, u32 flags (bit 0: stored uncompressed)
+ *
+ * The headers chain from one block to the next, so Scan builds the block
+ * index of a file from the headers alone, and a reader can seek to any
+ * item's block and decode blocks on separate threads. A block cut short or
+ * torn by a crash fails its length or checksum and ends the scan.
+ */
+class BlockCodec {
+public:
+  static const size_t kHeaderSize = 32;
+
+  struct Block {
+    ///* file offset of the header
+    uint64_t offset;
+    uint64_t first;
+    uint32_t items;
+    uint32_t raw_bytes;
+    uint32_t stored_bytes;
+    uint32_t checksum;
+    uint32_t flags;
+  };
+
+  /**
+   * Appends one block
+   * @param data items * item_size bytes
+   * @param item_size Bytes per item; also the transpose width
+   * @param first Index of the first item in the file
+   * @param out Header and payload are appended
+   */
+  static void Encode(const char *data, size_t items, size_t item_size,
+                     uint64_t first, std::vector<char> *out);
+
+  /**
+   * Decodes one block's payload
+   * @param stored block.stored_bytes bytes following the header
+   * @param block Its header
+   * @param item_size Bytes per item, as encoded
+   * @param out block.raw_bytes bytes
+   * @return false if the payload is corrupt
+   */
+  static bool Decode(const char *stored, const Block &block, size_t item_size,
+                     char *out);
+
+  /**
+   * Reads one block header, e.g. at an offset from another index
+   * @return false on I/O errors or if no block starts there
+   */
+  static bool ReadHeader(int fd, uint64_t offset, Block *block);
+
+  /**
+   * Reads the block headers from a file offset to the end
+   * @param fd File to scan
+   * @param offset Where the first block starts
+   * @param blocks Index, appended to
+   * @param end Offset after the last whole, intact block
+   * @return false on I/O errors
+   */
+  static bool Scan(int fd, uint64_t offset, std::vector<Block> *blocks,
+                   uint64_t *end);
+
+  /**
+   * Reads and decodes blocks, on the pool's threads when given one
+   * @param fd File the index was scanned from
+   * @param blocks Blocks to decode
+   * @param item_size Bytes per item, as encoded
+   * @param sink Called with each block and its raw bytes, from any thread
+   * and in any order; returns false to fail the read
+   * @param pool Threads to decode on, or nullptr for the calling thread
+   * @return false on I/O errors, corrupt blocks or a failed sink
+   */
+  static bool ReadBlocks(
+      int fd, const std::vector<Block> &blocks, size_t item_size,
+      const std::function<bool(const Block &, const char *)> &sink,
+      ThreadPool *pool);
+
+  /**
+   * LZ4 block format, without a frame; exposed for the benchmarks
+   * @return Compressed size, at most Bound(n)
+   */
+  static size_t Compress(const char *src, size_t n, char *dst);
+  static size_t Bound(size_t n) { return n + n / 255 + 16; }
+
+  /**
+   * @return false unless src decodes to exactly n bytes
+   */
+  static bool Decompress(const char *src, size_t stored, char *dst, size_t n);
+};
+
+#endif /* BLOCK_CODEC_H_ */
@@ -0,0 +1,103 @@
+#include "buffered_writer.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+const size_t BufferedWriter::kBufferSize;
+
+namespace {
+
+// longest field Reserve is asked for: a shortest round-trip double is at
+// most 24 characters
+const size_t kMaxField = 32;
+
+}  // namespace
+
+BufferedWriter::BufferedWriter(size_t capacity)
+    : capacity_(std::max(capacity, kMaxField)),
+      buffer_(new char[capacity_]),
+      used_(0),
+      fd_(-1),
+      failed_(false) {}
+
+BufferedWriter::~BufferedWriter() {
+  Close();
+}
+
+bool BufferedWriter::Open(const char *path, std::string *error) {
+  Close();
+  fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    *error = std::string(path) + ": " + strerror(errno);
+    return false;
+  }
+  used_ = 0;
+  failed_ = false;
+  return true;
+}
+
+bool BufferedWriter::Close() {
+  if (fd_ < 0) {
+    return !failed_;
+  }
+  Flush();
+  if (close(fd_) != 0) {
+    failed_ = true;
+  }
+  fd_ = -1;
+  return !failed_;
+}
+
+void BufferedWriter::Append(const char *s, size_t length) {
+  while (length > 0) {
+    if (used_ == capacity_) {
+      Flush();
+    }
+    const size_t n = std::min(length, capacity_ - used_);
+    memcpy(buffer_.get() + used_, s, n);
+    used_ += n;
+    s += n;
+    length -= n;
+  }
+}
+
+void BufferedWriter::AppendDouble(double value) {
+  char *out = Reserve(kMaxField);
+  used_ += std::to_chars(out, out + kMaxField, value).ptr - out;
+}
+
+void BufferedWriter::AppendInteger(long long value) {
+  char *out = Reserve(kMaxField);
+  used_ += std::to_chars(out, out + kMaxField, value).ptr - out;
+}
+
+void BufferedWriter::AppendHex(uint64_t value) {
+  static const char kDigits[] = "0123456789abcdef";
+  char *out = Reserve(16);
+  for (int i = 15; i >= 0; i--) {
+    out[i] = kDigits[value & 0xf];
+    value >>= 4;
+  }
+  used_ += 16;
+}
+
+bool BufferedWriter::Flush() {
+  //without a file the data is dropped, so the buffer cannot overflow
+  size_t written = 0;
+  while (fd_ >= 0 && !failed_ && written < used_) {
+    ssize_t n = write(fd_, buffer_.get() + written, used_ - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      failed_ = true;
+      break;
+    }
+    written += static_cast<size_t>(n);
+  }
+  used_ = 0;
+  return fd_ >= 0 && !failed_;
+}
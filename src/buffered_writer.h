@@ -0,0 +1,97 @@
+#ifndef BUFFERED_WRITER_H_
+#define BUFFERED_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * Text output for the offline tools: numbers are formatted straight into a
+ * large buffer (doubles with std::to_chars, as the shortest text that reads
+ * back to the same bits), and the buffer is written with one write() each
+ * time it fills. A replay of millions of steps then costs a few hundred
+ * syscalls and no locale or format-string parsing per field, where fprintf
+ * or ofstream << per line dominated the run.
+ *
+ * Not thread safe; one writer per file.
+ */
+class BufferedWriter {
+public:
+  ///* default buffer size
+  static const size_t kBufferSize = 1 << 20;
+
+  /**
+   * Constructor
+   * @param capacity Bytes buffered between writes
+   */
+  explicit BufferedWriter(size_t capacity = kBufferSize);
+
+  /**
+   * Destructor; flushes and closes the file (errors are lost, call Close
+   * to see them)
+   */
+  virtual ~BufferedWriter();
+
+  /**
+   * Creates or truncates a file for writing
+   * @param path File to write
+   * @param error Reason for a failure
+   * @return false if the file cannot be opened
+   */
+  bool Open(const char *path, std::string *error);
+
+  /**
+   * Writes what is buffered and closes the file
+   * @return false if any write since Open failed
+   */
+  bool Close();
+
+  bool is_open() const { return fd_ >= 0; }
+
+  void Append(char c) {
+    if (used_ == capacity_) {
+      Flush();
+    }
+    buffer_[used_++] = c;
+  }
+
+  void Append(const char *s, size_t length);
+
+  /**
+   * Appends a double as the shortest decimal text that reads back to the
+   * same value with strtod or scanf("%lf")
+   */
+  void AppendDouble(double value);
+
+  void AppendInteger(long long value);
+
+  /**
+   * Appends a value as 16 lower-case hex digits, like %016llx
+   */
+  void AppendHex(uint64_t value);
+
+  /**
+   * Writes what is buffered
+   * @return false if any write since Open failed
+   */
+  bool Flush();
+
+private:
+  // makes room for a field of at most length bytes
+  char *Reserve(size_t length) {
+    if (capacity_ - used_ < length) {
+      Flush();
+    }
+    return buffer_.get() + used_;
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<char[]> buffer_;
+  size_t used_;
+  int fd_;
+  ///* a write failed since Open
+  bool failed_;
+};
+
+#endif /* BUFFERED_WRITER_H_ */
@@ -0,0 +1,237 @@
+#include "checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unistd.h>
+#include <unordered_map>
+#include "binary_protocol.h"
+#include "logger.h"
+#include "measurement_journal.h"
+
+const unsigned Checkpoint::kVersion;
+
+namespace {
+
+const char kCheckpointMagic[4] = {'U', 'K', 'F', 'K'};
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t journal_position;
+};
+
+struct SessionHeader {
+  uint64_t id;
+  uint64_t count;
+};
+
+}  // namespace
+
+bool Checkpoint::Write(const char *path, const Image &image) {
+  const std::string tmp = std::string(path) + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  Header h;
+  memcpy(h.magic, kCheckpointMagic, 4);
+  h.version = kVersion;
+  h.journal_position = image.journal_position;
+  const uint64_t sessions = image.sessions.size();
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+            fwrite(&sessions, sizeof(sessions), 1, f) == 1;
+  for (size_t i = 0; ok && i < image.sessions.size(); i++) {
+    const Session &session = image.sessions[i];
+    SessionHeader sh = {session.id, session.records.size()};
+    ok = fwrite(&sh, sizeof(sh), 1, f) == 1 &&
+         fwrite(session.records.data(), sizeof(FilterSnapshot::Record),
+                session.records.size(), f) == session.records.size();
+  }
+  ok = fflush(f) == 0 && ok;
+  ok = fsync(fileno(f)) == 0 && ok;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Checkpoint::Read(const char *path, Image *image, std::string *error) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    *error = std::string("cannot open ") + path;
+    return false;
+  }
+  Header h;
+  uint64_t sessions = 0;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+            memcmp(h.magic, kCheckpointMagic, 4) == 0 &&
+            h.version == kVersion &&
+            fread(&sessions, sizeof(sessions), 1, f) == 1;
+  image->journal_position = ok ? h.journal_position : 0;
+  image->sessions.clear();
+  for (uint64_t i = 0; ok && i < sessions; i++) {
+    SessionHeader sh;
+    ok = fread(&sh, sizeof(sh), 1, f) == 1;
+    if (!ok) {
+      break;
+    }
+    image->sessions.push_back(Session());
+    Session &session = image->sessions.back();
+    session.id = sh.id;
+    session.records.resize(sh.count);
+    ok = fread(session.records.data(), sizeof(FilterSnapshot::Record),
+               sh.count, f) == sh.count;
+  }
+  fclose(f);
+  if (!ok) {
+    *error = std::string(path) + ": not a checkpoint or truncated";
+    image->sessions.clear();
+  }
+  return ok;
+}
+
+bool Checkpoint::Replay(const char *journal_path, const UKF &prototype,
+                        Image *image, size_t *replayed, std::string *error) {
+  *replayed = 0;
+  std::vector<MeasurementJournal::Entry> tail;
+  if (!MeasurementJournal::Read(journal_path, image->journal_position,
+                                &tail)) {
+    *error = std::string("cannot read journal ") + journal_path;
+    return false;
+  }
+
+  //each session's tracks as filters again, ordered by id as they are
+  //written back
+  typedef std::map<unsigned, std::unique_ptr<UKF> > Filters;
+  std::vector<Filters> filters(image->sessions.size());
+  std::unordered_map<uint64_t, size_t> index;
+  for (size_t s = 0; s < image->sessions.size(); s++) {
+    const Session &session = image->sessions[s];
+    index[session.id] = s;
+    for (size_t r = 0; r < session.records.size(); r++) {
+      std::unique_ptr<UKF> ukf(new UKF(prototype));
+      if (FilterSnapshot::Restore(session.records[r], ukf.get())) {
+        filters[s][unsigned(session.records[r].id)] = std::move(ukf);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < tail.size(); i++) {
+    auto found = index.find(tail[i].session);
+    unsigned track_id;
+    Measurement meas;
+    Eigen::Vector4d ground_truth;
+    if (found == index.end() ||
+        !BinaryProtocol::DecodeMeasurement(
+            tail[i].record, sizeof(tail[i].record), &track_id, &meas,
+            &ground_truth)) {
+      continue;
+    }
+    std::unique_ptr<UKF> &ukf = filters[found->second][track_id];
+    if (!ukf) {
+      ukf.reset(new UKF(prototype));
+    }
+    ukf->ProcessMeasurement(meas);
+    ++*replayed;
+  }
+
+  for (size_t s = 0; s < image->sessions.size(); s++) {
+    std::vector<FilterSnapshot::Record> &records = image->sessions[s].records;
+    records.clear();
+    for (auto it = filters[s].begin(); it != filters[s].end(); ++it) {
+      if (it->second && it->second->initialized()) {
+        records.push_back(FilterSnapshot::Record());
+        FilterSnapshot::Capture(*it->second, it->first, &records.back());
+      }
+    }
+  }
+  image->journal_position += tail.size();
+  return true;
+}
+
+Checkpoint::Writer::Writer(const std::string &path)
+    : path_(path),
+      stop_(false),
+      written_(0),
+      failed_(0),
+      skipped_(0) {
+  thread_ = std::thread(&Writer::Run, this);
+}
+
+Checkpoint::Writer::~Writer() {
+  Stop();
+}
+
+std::unique_ptr<Checkpoint::Image> Checkpoint::Writer::Acquire() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (spare_) {
+    return std::move(spare_);
+  }
+  return std::unique_ptr<Image>(new Image());
+}
+
+void Checkpoint::Writer::Submit(std::unique_ptr<Image> image) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (waiting_) {
+      ++skipped_;
+    }
+    waiting_ = std::move(image);
+  }
+  cv_.notify_one();
+}
+
+void Checkpoint::Writer::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      return;
+    }
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+unsigned long long Checkpoint::Writer::written() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return written_;
+}
+
+unsigned long long Checkpoint::Writer::failed() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_;
+}
+
+unsigned long long Checkpoint::Writer::skipped() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return skipped_;
+}
+
+void Checkpoint::Writer::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return stop_ || waiting_; });
+    if (!waiting_) {
+      break;
+    }
+    std::unique_ptr<Image> image = std::move(waiting_);
+    lock.unlock();
+    const bool ok = Write(path_.c_str(), *image);
+    lock.lock();
+    if (ok) {
+      ++written_;
+    }
+    else {
+      ++failed_;
+      UKF_LOG_ERROR("Cannot write checkpoint %s", path_.c_str());
+    }
+    //the captured vectors keep their capacity for the next round
+    for (size_t i = 0; i < image->sessions.size(); i++) {
+      image->sessions[i].records.clear();
+    }
+    spare_ = std::move(image);
+  }
+}
@@ -0,0 +1,126 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "filter_snapshot.h"
+#include "ukf.h"
+
+/**
+ * Periodic checkpoints of a hub's sessions, for fast recovery after a
+ * crash: the latest checkpoint is loaded and only the journal entries
+ * after it are replayed, instead of the whole MeasurementJournal.
+ *
+ * A checkpoint file has the 16-byte header of the BinaryLog files, "UKFK",
+ * a u32 version and the u64 journal position the states include (see
+ * MeasurementJournal::position), then a u64 session count and per session
+ * its u64 id, a u64 record count and that many FilterSnapshot records, in
+ * host (little-endian) byte order. Sessions are in the order the hub
+ * accepted them, which is the rank of their restore snapshot.
+ */
+class Checkpoint {
+public:
+  static const unsigned kVersion = 1;
+
+  struct Session {
+    ///* Session::id_, as the journal entries name it
+    uint64_t id;
+    std::vector<FilterSnapshot::Record> records;
+  };
+
+  struct Image {
+    ///* journal entries before this one are in the states
+    uint64_t journal_position;
+    std::vector<Session> sessions;
+  };
+
+  /**
+   * Writes an image to a temporary file, syncs it and renames it over path
+   * @return false on I/O errors, leaving the previous checkpoint intact
+   */
+  static bool Write(const char *path, const Image &image);
+
+  /**
+   * Reads a checkpoint file
+   * @return false if it cannot be read or is truncated
+   */
+  static bool Read(const char *path, Image *image, std::string *error);
+
+  /**
+   * Brings an image up to the end of a journal: every entry from the
+   * image's position on that belongs to one of its sessions is filtered
+   * into that session's states, tracks the checkpoint did not have
+   * starting from the prototype
+   * @param journal_path Journal the image's position refers to
+   * @param prototype Filter configuration of the restored tracks
+   * @param image Updated in place; its position moves to the journal's end
+   * @param replayed Measurements filtered
+   * @param error Reason for a failure
+   * @return false if the journal cannot be read
+   */
+  static bool Replay(const char *journal_path, const UKF &prototype,
+                     Image *image, size_t *replayed, std::string *error);
+
+  /**
+   * Double-buffered background writer of one checkpoint file. The hub
+   * captures into an image from Acquire on its own threads, which costs a
+   * copy per track, and Submit hands it to the writer thread, so the file
+   * I/O and fsync never hold up filtering. An image submitted while the
+   * previous one is still being written replaces any that is waiting.
+   */
+  class Writer {
+  public:
+    explicit Writer(const std::string &path);
+
+    /**
+     * Destructor; writes what is waiting
+     */
+    virtual ~Writer();
+
+    /**
+     * An image to capture into; a written one is reused, keeping its
+     * vectors' capacity
+     */
+    std::unique_ptr<Image> Acquire();
+
+    void Submit(std::unique_ptr<Image> image);
+
+    /**
+     * Writes what is waiting and stops the writer thread
+     */
+    void Stop();
+
+    ///* checkpoints written, failed and replaced before they were written
+    unsigned long long written();
+    unsigned long long failed();
+    unsigned long long skipped();
+
+    const std::string &path() const { return path_; }
+
+  private:
+    Writer(const Writer &);
+    Writer &operator=(const Writer &);
+
+    // writer thread loop
+    void Run();
+
+    const std::string path_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    ///* guarded by mutex_
+    std::unique_ptr<Image> waiting_;
+    std::unique_ptr<Image> spare_;
+    bool stop_;
+    unsigned long long written_;
+    unsigned long long failed_;
+    unsigned long long skipped_;
+  };
+};
+
+#endif /* CHECKPOINT_H_ */
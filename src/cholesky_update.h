@@ -0,0 +1,164 @@
+#ifndef CHOLESKY_UPDATE_H_
+#define CHOLESKY_UPDATE_H_
+
+#include "Eigen/Dense"
+#include <cmath>
+
+/**
+ * Helpers for the square-root UKF: keeping a lower-triangular factor L with
+ * P = L * L^T up to date without refactoring P on every step.
+ */
+
+/**
+ * Rank-1 update of a lower-triangular factor in place:
+ * L * L^T <- L * L^T + weight * v * v^T
+ * A negative weight is a downdate, which fails (and returns false) if the
+ * result would not be positive definite. L is left unspecified on failure.
+ * @param L Lower-triangular factor, updated in place
+ * @param v Update vector (taken by value, used as scratch)
+ * @param weight Scale of the rank-1 term
+ */
+template <typename Scalar, int N>
+bool CholUpdate(Eigen::Matrix<Scalar, N, N>* L, Eigen::Matrix<Scalar, N, 1> v,
+                Scalar weight) {
+  Eigen::Matrix<Scalar, N, N> &l = *L;
+  v *= std::sqrt(std::abs(weight));
+
+  if (weight >= 0) {
+    // Givens rotations of [L v], no division by the diagonal
+    for (int k = 0; k < N; k++) {
+      Scalar r = std::sqrt(l(k,k) * l(k,k) + v(k) * v(k));
+      if (r == 0) continue;
+      Scalar c = l(k,k) / r;
+      Scalar s = v(k) / r;
+      l(k,k) = r;
+      for (int i = k + 1; i < N; i++) {
+        Scalar t = l(i,k);
+        l(i,k) = c * t + s * v(i);
+        v(i) = c * v(i) - s * t;
+      }
+    }
+    return true;
+  }
+
+  // hyperbolic rotations
+  for (int k = 0; k < N; k++) {
+    Scalar r2 = l(k,k) * l(k,k) - v(k) * v(k);
+    if (!(r2 > 0)) return false;
+    Scalar r = std::sqrt(r2);
+    Scalar c = r / l(k,k);
+    Scalar s = v(k) / l(k,k);
+    l(k,k) = r;
+    for (int i = k + 1; i < N; i++) {
+      l(i,k) = (l(i,k) - s * v(i)) / c;
+      v(i) = c * v(i) - s * l(i,k);
+    }
+  }
+  return true;
+}
+
+/**
+ * Lower-triangular factor L of A^T * A from a QR decomposition of A, with a
+ * non-negative diagonal.
+ * @param A Tall M x N matrix
+ */
+template <typename Scalar, int M, int N>
+Eigen::Matrix<Scalar, N, N> LowerFactorFromQR(
+    const Eigen::Matrix<Scalar, M, N> &A) {
+  Eigen::HouseholderQR<Eigen::Matrix<Scalar, M, N> > qr(A);
+  Eigen::Matrix<Scalar, N, N> L =
+      qr.matrixQR().template topRows<N>().template triangularView<Eigen::Upper>()
+        .transpose();
+  for (int k = 0; k < N; k++) {
+    if (L(k,k) < 0) L.col(k) = -L.col(k);
+  }
+  return L;
+}
+
+/**
+ * Lower-triangular factor of a symmetric matrix that may have drifted away
+ * from positive definiteness. Uses LLT when it succeeds, otherwise clamps the
+ * negative eigenvalues to zero.
+ * @param P Symmetric (or nearly symmetric) N x N matrix
+ */
+template <typename Scalar, int N>
+Eigen::Matrix<Scalar, N, N> RobustLowerFactor(
+    const Eigen::Matrix<Scalar, N, N> &P) {
+  Eigen::Matrix<Scalar, N, N> sym = 0.5 * (P + P.transpose());
+  Eigen::LLT<Eigen::Matrix<Scalar, N, N> > llt(sym);
+  if (llt.info() == Eigen::Success) {
+    return llt.matrixL();
+  }
+
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix<Scalar, N, N> > eig(sym);
+  Eigen::Matrix<Scalar, N, 1> d =
+      eig.eigenvalues().cwiseMax(Scalar(0)).cwiseSqrt();
+  Eigen::Matrix<Scalar, N, N> A =
+      (eig.eigenvectors() * d.asDiagonal()).transpose();
+  return LowerFactorFromQR(A);
+}
+
+/**
+ * Kalman gain K = Tc * S^-1 from the lower factor of S = Sz * Sz^T, using two
+ * triangular solves instead of forming the inverse.
+ * @param Sz Lower-triangular factor of the innovation covariance
+ * @param Tc State/measurement cross covariance (P * H^T for linear models)
+ */
+template <typename Scalar, int N, int M>
+Eigen::Matrix<Scalar, N, M> GainFromFactor(
+    const Eigen::Matrix<Scalar, M, M> &Sz,
+    const Eigen::Matrix<Scalar, N, M> &Tc) {
+  Eigen::Matrix<Scalar, M, N> Kt =
+      Sz.template triangularView<Eigen::Lower>().solve(Tc.transpose());
+  Sz.transpose().template triangularView<Eigen::Upper>().solveInPlace(Kt);
+  return Kt.transpose();
+}
+
+/**
+ * Averages a square matrix with its transpose in place, removing the
+ * asymmetry rounding leaves after P -= K Tc^T; N (N - 1) / 2 additions
+ * @param P Matrix, made exactly symmetric
+ */
+template <typename Scalar, int N>
+void Symmetrize(Eigen::Matrix<Scalar, N, N> *P) {
+  Eigen::Matrix<Scalar, N, N> &A = *P;
+  for (int c = 0; c < N; c++) {
+    for (int r = c + 1; r < N; r++) {
+      Scalar mean = Scalar(0.5) * (A(r, c) + A(c, r));
+      A(r, c) = mean;
+      A(c, r) = mean;
+    }
+  }
+}
+
+/**
+ * Aw B^T for weighted sigma-point deviations Aw = A W, the reduction behind
+ * every unscented covariance. The sum runs in Accumulator and is rounded to
+ * the operands' scalar once, so float filters do not lose the small terms;
+ * when the types match the casts are no-ops.
+ * @param Aw Weighted deviations, one sigma point per column
+ * @param B Deviations, one sigma point per column
+ */
+template <typename Accumulator, typename DerivedA, typename DerivedB>
+Eigen::Matrix<typename DerivedA::Scalar, DerivedA::RowsAtCompileTime,
+              DerivedB::RowsAtCompileTime>
+WeightedProduct(const Eigen::MatrixBase<DerivedA> &Aw,
+                const Eigen::MatrixBase<DerivedB> &B) {
+  return Aw.template cast<Accumulator>()
+      .lazyProduct(B.transpose().template cast<Accumulator>())
+      .template cast<typename DerivedA::Scalar>();
+}
+
+/**
+ * Normalized innovation squared z^T S^-1 z from the lower factor of S, with
+ * one triangular solve
+ * @param Sz Lower-triangular factor of the innovation covariance
+ * @param z Innovation
+ */
+template <typename Scalar, int M>
+Scalar NisFromFactor(const Eigen::Matrix<Scalar, M, M> &Sz,
+                     const Eigen::Matrix<Scalar, M, 1> &z) {
+  return Sz.template triangularView<Eigen::Lower>().solve(z).squaredNorm();
+}
+
+#endif /* CHOLESKY_UPDATE_H_ */
@@ -0,0 +1,113 @@
+#include "config_reload.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <sys/stat.h>
+#include "logger.h"
+
+namespace {
+
+std::atomic<const ConfigReload::Published *> g_current(nullptr);
+std::atomic<unsigned long long> g_failures(0);
+
+// every generation ever published; readers may still hold old ones
+std::mutex g_published_mutex;
+std::deque<std::unique_ptr<ConfigReload::Published> > g_published;
+
+}  // namespace
+
+const ConfigReload::Published *ConfigReload::Current() {
+  return g_current.load(std::memory_order_acquire);
+}
+
+void ConfigReload::Publish(const UKFConfig &config) {
+  std::lock_guard<std::mutex> lock(g_published_mutex);
+  std::unique_ptr<Published> published(new Published());
+  published->config = config;
+  published->generation = g_published.size() + 1;
+  g_current.store(published.get(), std::memory_order_release);
+  g_published.push_back(std::move(published));
+}
+
+unsigned long long ConfigReload::Failures() {
+  return g_failures.load(std::memory_order_relaxed);
+}
+
+ConfigReload::ConfigReload(const std::string &path,
+                           const UKFConfig &defaults)
+    : path_(path),
+      defaults_(defaults),
+      mtime_(0),
+      mtime_ns_(0),
+      size_(-1),
+      stopping_(false) {
+  Stamp(&mtime_, &mtime_ns_, &size_);
+}
+
+void ConfigReload::Override(const std::string &key, double value) {
+  overrides_.push_back(std::make_pair(key, value));
+}
+
+bool ConfigReload::Reload(std::string *error) {
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+  //stamped first, so a write racing the read is seen by the next check
+  Stamp(&mtime_, &mtime_ns_, &size_);
+  UKFConfig config = defaults_;
+  if (!config.Load(path_, error)) {
+    g_failures.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  for (size_t i = 0; i < overrides_.size(); i++) {
+    config.Set(overrides_[i].first, overrides_[i].second);
+  }
+  Publish(config);
+  return true;
+}
+
+void ConfigReload::Watch(int interval_ms) {
+  std::unique_lock<std::mutex> lock(stop_mutex_);
+  while (!stop_cv_.wait_for(lock, std::chrono::milliseconds(interval_ms),
+                            [this]() { return stopping_; })) {
+    time_t mtime;
+    long mtime_ns;
+    off_t size;
+    if (!Stamp(&mtime, &mtime_ns, &size)) {
+      //an editor replacing the file may leave it missing for a moment
+      continue;
+    }
+    bool changed;
+    {
+      std::lock_guard<std::mutex> reload_lock(reload_mutex_);
+      changed = mtime != mtime_ || mtime_ns != mtime_ns_ || size != size_;
+    }
+    if (!changed) {
+      continue;
+    }
+    std::string error;
+    if (!Reload(&error)) {
+      UKF_LOG_WARN("Config not reloaded: %s", error.c_str());
+    }
+    else {
+      UKF_LOG_INFO("Config reloaded from %s, generation %lu", path_.c_str(),
+                   Current()->generation);
+    }
+  }
+}
+
+void ConfigReload::Stop() {
+  std::lock_guard<std::mutex> lock(stop_mutex_);
+  stopping_ = true;
+  stop_cv_.notify_all();
+}
+
+bool ConfigReload::Stamp(time_t *mtime, long *mtime_ns, off_t *size) const {
+  struct stat st;
+  if (stat(path_.c_str(), &st) != 0) {
+    return false;
+  }
+  *mtime = st.st_mtim.tv_sec;
+  *mtime_ns = st.st_mtim.tv_nsec;
+  *size = st.st_size;
+  return true;
+}
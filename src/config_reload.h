@@ -0,0 +1,93 @@
+#ifndef CONFIG_RELOAD_H_
+#define CONFIG_RELOAD_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+#include "ukf_config.h"
+
+/**
+ * Runtime retuning of the served filters. A reload reads the config file
+ * into a new UKFConfig and publishes it as an immutable, numbered
+ * generation; published generations are never changed or freed, so the
+ * filter threads read the current one with a single acquire load and no
+ * lock. Every TrackTable compares the generation with the one its tracks
+ * were tuned to when it hands a track out, and a stale track is retuned
+ * (keeping its state, see UKF::Configure) before its next measurement.
+ *
+ * A reload replaces the settings clients gave their own sessions with
+ * config events; those apply on top of it again when they are next sent.
+ */
+class ConfigReload {
+public:
+  struct Published {
+    UKFConfig config;
+    ///* 1 for the first reload, then counting up
+    unsigned long generation;
+  };
+
+  /**
+   * The generation published last, or nullptr if there was no reload
+   */
+  static const Published *Current();
+
+  /**
+   * Publishes a configuration to every track table
+   */
+  static void Publish(const UKFConfig &config);
+
+  ///* reloads that failed and were ignored, for /metrics
+  static unsigned long long Failures();
+
+  /**
+   * @param path Config file to reload
+   * @param defaults What the file is read over, as at startup
+   */
+  ConfigReload(const std::string &path, const UKFConfig &defaults);
+
+  /**
+   * Applies a setting after every read of the file, as command line flags
+   * override the file at startup
+   */
+  void Override(const std::string &key, double value);
+
+  /**
+   * Reads the file and publishes it. A file with a bad line is not
+   * published; the filters keep their tuning.
+   * @param error Set to a description of the problem on failure
+   * @return false if the file could not be read or has a bad line
+   */
+  bool Reload(std::string *error);
+
+  /**
+   * Reloads the file whenever its modification time or size changes, until
+   * Stop; this is the body of the watcher thread
+   * @param interval_ms How often the file is checked
+   */
+  void Watch(int interval_ms);
+  void Stop();
+
+private:
+  const std::string path_;
+  const UKFConfig defaults_;
+  std::vector<std::pair<std::string, double> > overrides_;
+
+  ///* serialises reloads from the watcher and from HTTP requests
+  std::mutex reload_mutex_;
+  ///* what the file looked like when it was last read
+  time_t mtime_;
+  long mtime_ns_;
+  off_t size_;
+
+  std::mutex stop_mutex_;
+  std::condition_variable stop_cv_;
+  bool stopping_;
+
+  // the file's modification time and size; false if it cannot be stat'ed
+  bool Stamp(time_t *mtime, long *mtime_ns, off_t *size) const;
+};
+
+#endif /* CONFIG_RELOAD_H_ */
@@ -0,0 +1,67 @@
+#include "cpu_affinity.h"
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+bool CpuAffinity::ParseList(const char *text, std::vector<int> *cpus) {
+  cpus->clear();
+  const char *p = text;
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if (end == p || first < 0) {
+      return false;
+    }
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1 || last < first) {
+        return false;
+      }
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(static_cast<int>(cpu));
+    }
+    if (*p == ',') {
+      ++p;
+    }
+    else if (*p) {
+      return false;
+    }
+  }
+  return !cpus->empty();
+}
+
+bool CpuAffinity::PinCurrentThread(int cpu) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int CpuAffinity::NodeOf(int cpu) {
+  //each CPU directory links to its node as a node<N> entry
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *dir = opendir(path);
+  if (!dir) {
+    return -1;
+  }
+  int node = -1;
+  while (struct dirent *entry = readdir(dir)) {
+    int n;
+    if (sscanf(entry->d_name, "node%d", &n) == 1) {
+      node = n;
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
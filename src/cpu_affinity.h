@@ -0,0 +1,39 @@
+#ifndef CPU_AFFINITY_H_
+#define CPU_AFFINITY_H_
+
+#include <vector>
+
+/**
+ * Thread placement for the server's event loops and pipeline workers.
+ *
+ * Memory is placed by first touch: Linux puts a page on the NUMA node of
+ * the CPU that first writes it. A thread pinned before it allocates its
+ * sessions therefore gets them on its own node, without libnuma. A hub and
+ * its workers are only local to each other if their CPUs share a node,
+ * which NodeOf can check.
+ */
+class CpuAffinity {
+public:
+  /**
+   * Parses a CPU list such as "0-3,8,10-11", the format of taskset -c and
+   * /sys/devices/system/node/node0/cpulist
+   * @param text List to parse
+   * @param cpus CPU numbers in the order given
+   * @return false if the list is empty or malformed
+   */
+  static bool ParseList(const char *text, std::vector<int> *cpus);
+
+  /**
+   * Pins the calling thread to one CPU
+   * @return false if the CPU does not exist or is not allowed
+   */
+  static bool PinCurrentThread(int cpu);
+
+  /**
+   * NUMA node of a CPU, from sysfs
+   * @return The node, or -1 if it cannot be determined
+   */
+  static int NodeOf(int cpu);
+};
+
+#endif /* CPU_AFFINITY_H_ */
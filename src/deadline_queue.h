@@ -0,0 +1,261 @@
+#ifndef DEADLINE_QUEUE_H_
+#define DEADLINE_QUEUE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Bounded earliest-deadline-first queue over lanes that each stay FIFO.
+ *
+ * Items are pushed into a lane, named by an (owner, id) pair such as a
+ * session and a track, and Pop returns the head of the lane whose head has
+ * the earliest deadline. Items of one lane therefore come out in the order
+ * they were pushed, whatever their deadlines, which is what a filter needs
+ * of its measurements, while different lanes overtake each other by
+ * deadline. Ties go to the item pushed first.
+ *
+ * Everything is allocated at construction: the items live in a slab linked
+ * per lane, the lanes in an open-addressing table, and the lane heads in a
+ * binary heap, so Push and Pop cost O(log lanes) and never allocate.
+ */
+template <typename T>
+class DeadlineQueue {
+public:
+  /**
+   * @param capacity Items the queue holds (at least 1)
+   */
+  explicit DeadlineQueue(size_t capacity)
+      : size_(0), sequence_(0) {
+    const size_t n = capacity > 0 ? capacity : 1;
+    nodes_.resize(n);
+    lanes_.resize(n);
+    free_nodes_.reserve(n);
+    free_lanes_.reserve(n);
+    for (size_t i = n; i-- > 0; ) {
+      free_nodes_.push_back(static_cast<int>(i));
+      free_lanes_.push_back(static_cast<int>(i));
+    }
+    size_t slots = 1;
+    while (slots < 2 * n) slots <<= 1;
+    table_.assign(slots, -1);
+    mask_ = slots - 1;
+    heap_.reserve(n);
+  }
+
+  /**
+   * Queues an item at the tail of its lane
+   * @param owner First half of the lane's name
+   * @param id Second half of the lane's name
+   * @param deadline Time the item is due, in any unit
+   * @param item Item
+   * @return false if the queue is full
+   */
+  bool Push(const void *owner, uint32_t id, long long deadline,
+            const T &item) {
+    if (free_nodes_.empty()) {
+      return false;
+    }
+    const int node = free_nodes_.back();
+    free_nodes_.pop_back();
+    nodes_[node].item = item;
+    nodes_[node].deadline = deadline;
+    nodes_[node].sequence = sequence_++;
+    nodes_[node].next = -1;
+
+    size_t slot = Slot(owner, id);
+    while (table_[slot] >= 0 && (lanes_[table_[slot]].owner != owner ||
+                                 lanes_[table_[slot]].id != id)) {
+      slot = (slot + 1) & mask_;
+    }
+    if (table_[slot] >= 0) {
+      Lane &lane = lanes_[table_[slot]];
+      nodes_[lane.tail].next = node;
+      lane.tail = node;
+    }
+    else {
+      const int l = free_lanes_.back();
+      free_lanes_.pop_back();
+      table_[slot] = l;
+      Lane &lane = lanes_[l];
+      lane.owner = owner;
+      lane.id = id;
+      lane.head = node;
+      lane.tail = node;
+      lane.heap_index = static_cast<int>(heap_.size());
+      heap_.push_back(l);
+      SiftUp(lane.heap_index);
+    }
+    ++size_;
+    return true;
+  }
+
+  /**
+   * Removes the head of the lane due first
+   * @param item The item
+   * @param deadline Its deadline, if not null
+   * @return false if the queue is empty
+   */
+  bool Pop(T *item, long long *deadline = nullptr) {
+    if (heap_.empty()) {
+      return false;
+    }
+    const int l = heap_[0];
+    Lane &lane = lanes_[l];
+    const int node = lane.head;
+    *item = nodes_[node].item;
+    if (deadline) {
+      *deadline = nodes_[node].deadline;
+    }
+    lane.head = nodes_[node].next;
+    free_nodes_.push_back(node);
+    --size_;
+
+    if (lane.head >= 0) {
+      //the lane's next item may be due earlier or later than the last
+      SiftDown(0);
+      return true;
+    }
+    EraseLane(l);
+    heap_[0] = heap_.back();
+    lanes_[heap_[0]].heap_index = 0;
+    heap_.pop_back();
+    if (!heap_.empty()) {
+      SiftDown(0);
+    }
+    free_lanes_.push_back(l);
+    return true;
+  }
+
+  /**
+   * Deadline of the item Pop would return
+   * @return false if the queue is empty
+   */
+  bool NextDeadline(long long *deadline) const {
+    if (heap_.empty()) {
+      return false;
+    }
+    *deadline = nodes_[lanes_[heap_[0]].head].deadline;
+    return true;
+  }
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return nodes_.size(); }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return free_nodes_.empty(); }
+
+  ///* heap bytes of the nodes, lanes and index, all sized up front
+  size_t MemoryBytes() const {
+    return nodes_.capacity() * sizeof(Node) +
+           lanes_.capacity() * sizeof(Lane) +
+           (free_nodes_.capacity() + free_lanes_.capacity() +
+            table_.capacity() + heap_.capacity()) * sizeof(int);
+  }
+
+  ///* Lanes with at least one item
+  size_t lanes() const { return heap_.size(); }
+
+private:
+  struct Node {
+    T item;
+    long long deadline;
+    unsigned long long sequence;
+    int next;
+  };
+
+  struct Lane {
+    const void *owner;
+    uint32_t id;
+    int head;
+    int tail;
+    int heap_index;
+  };
+
+  size_t Slot(const void *owner, uint32_t id) const {
+    uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(owner));
+    h = (h ^ (static_cast<uint64_t>(id) << 32) ^ id) *
+        0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(h >> 32) & mask_;
+  }
+
+  // removes a lane from the table, shifting later entries of its probe run
+  // back so no tombstone is needed
+  void EraseLane(int l) {
+    size_t slot = Slot(lanes_[l].owner, lanes_[l].id);
+    while (table_[slot] != l) {
+      slot = (slot + 1) & mask_;
+    }
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask_; table_[next] >= 0;
+         next = (next + 1) & mask_) {
+      const Lane &lane = lanes_[table_[next]];
+      const size_t home = Slot(lane.owner, lane.id);
+      //move it back if the hole lies on its probe path from home
+      if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+        table_[hole] = table_[next];
+        hole = next;
+      }
+    }
+    table_[hole] = -1;
+  }
+
+  // true if lane a is due before lane b
+  bool Before(int a, int b) const {
+    const Node &x = nodes_[lanes_[a].head];
+    const Node &y = nodes_[lanes_[b].head];
+    return x.deadline < y.deadline ||
+           (x.deadline == y.deadline && x.sequence < y.sequence);
+  }
+
+  void Place(int i, int l) {
+    heap_[i] = l;
+    lanes_[l].heap_index = i;
+  }
+
+  void SiftUp(int i) {
+    const int l = heap_[i];
+    while (i > 0) {
+      const int parent = (i - 1) / 2;
+      if (!Before(l, heap_[parent])) {
+        break;
+      }
+      Place(i, heap_[parent]);
+      i = parent;
+    }
+    Place(i, l);
+  }
+
+  void SiftDown(int i) {
+    const int n = static_cast<int>(heap_.size());
+    const int l = heap_[i];
+    for (;;) {
+      int child = 2 * i + 1;
+      if (child >= n) {
+        break;
+      }
+      if (child + 1 < n && Before(heap_[child + 1], heap_[child])) {
+        ++child;
+      }
+      if (!Before(heap_[child], l)) {
+        break;
+      }
+      Place(i, heap_[child]);
+      i = child;
+    }
+    Place(i, l);
+  }
+
+  std::vector<Node> nodes_;
+  std::vector<Lane> lanes_;
+  std::vector<int> free_nodes_;
+  std::vector<int> free_lanes_;
+  ///* lane index per slot, -1 for an empty slot
+  std::vector<int> table_;
+  size_t mask_;
+  ///* lanes by the deadline of their head
+  std::vector<int> heap_;
+  size_t size_;
+  unsigned long long sequence_;
+};
+
+#endif /* DEADLINE_QUEUE_H_ */
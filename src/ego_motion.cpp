@@ -0,0 +1,68 @@
+#include "ego_motion.h"
+#include "angle.h"
+#include "ukf.h"
+#include "ukf_bank.h"
+
+void TransformPoints(const RigidTransform &transform, double *xy, size_t n) {
+  const double c = transform.cos_theta, s = transform.sin_theta;
+  const double tx = transform.tx, ty = transform.ty;
+  for (size_t i = 0; i < n; i++) {
+    const double x = xy[2 * i];
+    const double y = xy[2 * i + 1];
+    xy[2 * i] = c * x - s * y + tx;
+    xy[2 * i + 1] = s * x + c * y + ty;
+  }
+}
+
+size_t TransformMeasurements(const RigidTransform &transform,
+                             Measurement *measurements, size_t n) {
+  const double c = transform.cos_theta, s = transform.sin_theta;
+  const double tx = transform.tx, ty = transform.ty;
+  const bool rotation_only = tx == 0.0 && ty == 0.0;
+  size_t transformed = 0;
+  for (size_t i = 0; i < n; i++) {
+    double *z = measurements[i].values_.data();
+    if (measurements[i].sensor_type_ == MeasurementPackage::LASER) {
+      const double x = z[0];
+      const double y = z[1];
+      z[0] = c * x - s * y + tx;
+      z[1] = s * x + c * y + ty;
+      ++transformed;
+    }
+    else if (rotation_only) {
+      //range and range rate do not change under a rotation about the sensor
+      z[1] = NormalizeAngle(z[1] + transform.theta);
+      ++transformed;
+    }
+  }
+  return transformed;
+}
+
+void TransformFilter(const RigidTransform &transform, UKF *ukf) {
+  if (!ukf->initialized()) {
+    return;
+  }
+  typedef UKF::Scalar Scalar;
+  const Scalar c = static_cast<Scalar>(transform.cos_theta);
+  const Scalar s = static_cast<Scalar>(transform.sin_theta);
+
+  UKF::StateVector x = ukf->x();
+  const Scalar px = x(0), py = x(1);
+  x(0) = c * px - s * py + static_cast<Scalar>(transform.tx);
+  x(1) = s * px + c * py + static_cast<Scalar>(transform.ty);
+  x(3) = NormalizeAngle(x(3) + static_cast<Scalar>(transform.theta));
+
+  //P' = J P J^T with J the identity but for the rotation in its top left
+  Eigen::Matrix<Scalar, UKF::n_x_, UKF::n_x_> J =
+      Eigen::Matrix<Scalar, UKF::n_x_, UKF::n_x_>::Identity();
+  J(0, 0) = c;
+  J(0, 1) = -s;
+  J(1, 0) = s;
+  J(1, 1) = c;
+  const UKF::StateMatrix P = J * ukf->P() * J.transpose();
+  ukf->SetState(x, P, ukf->timestamp());
+}
+
+void TransformBank(const RigidTransform &transform, UKFBank *bank) {
+  bank->Transform(transform);
+}
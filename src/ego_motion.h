@@ -0,0 +1,87 @@
+#ifndef EGO_MOTION_H_
+#define EGO_MOTION_H_
+
+#include <cmath>
+#include <cstddef>
+#include "measurement_package.h"
+
+class UKF;
+class UKFBank;
+
+/**
+ * A rigid 2D transform p' = R(theta) p + t, e.g. from the vehicle frame of
+ * one frame to that of the next (or to a fixed world frame), with the
+ * rotation's sine and cosine computed once for every point it is applied
+ * to.
+ */
+struct RigidTransform {
+  ///* rotation in rad, and its cosine and sine
+  double theta;
+  double cos_theta;
+  double sin_theta;
+  ///* translation in m
+  double tx;
+  double ty;
+
+  explicit RigidTransform(double theta = 0.0, double tx = 0.0,
+                          double ty = 0.0)
+      : theta(theta),
+        cos_theta(std::cos(theta)),
+        sin_theta(std::sin(theta)),
+        tx(tx),
+        ty(ty) {}
+};
+
+/**
+ * Ego-motion compensation: moves measurements and tracks into a common
+ * frame in batches, one flat loop per batch with no per-object call, so the
+ * glue code calls one function per frame instead of transforming each
+ * object itself.
+ *
+ * Positions are rotated and translated, the yaw of a track is rotated, and
+ * the position block of its covariance (and its cross terms) is rotated as
+ * R P R^T; speed and yaw rate are the same in both frames. The transform
+ * is a change of coordinates only: the ego vehicle's own velocity is not
+ * subtracted from the tracks' speeds.
+ */
+
+/**
+ * Transforms a point cloud in place, e.g. before LidarClusterer
+ * @param transform Transform to apply
+ * @param xy n (x, y) pairs, interleaved, in m
+ * @param n Number of points
+ */
+void TransformPoints(const RigidTransform &transform, double *xy, size_t n);
+
+/**
+ * Transforms a batch of measurements in place. LASER positions are rotated
+ * and translated. RADAR measurements are polar about the sensor, which the
+ * radar model places at the origin, so they can only be rotated: their
+ * bearing is turned by theta when the transform has no translation, and
+ * they are left as they are otherwise.
+ * @param transform Transform to apply
+ * @param measurements Measurements to transform
+ * @param n Number of measurements
+ * @return Number of measurements transformed
+ */
+size_t TransformMeasurements(const RigidTransform &transform,
+                             Measurement *measurements, size_t n);
+
+/**
+ * Transforms the posterior of one filter. A filter that has not been
+ * initialised is left alone. The out-of-sequence history still holds
+ * states in the old frame, so a late measurement older than the transform
+ * should not be replayed across it.
+ * @param transform Transform to apply
+ * @param ukf Filter to transform
+ */
+void TransformFilter(const RigidTransform &transform, UKF *ukf);
+
+/**
+ * Transforms every track of a bank, lane-wise across tracks
+ * @param transform Transform to apply
+ * @param bank Bank to transform
+ */
+void TransformBank(const RigidTransform &transform, UKFBank *bank);
+
+#endif /* EGO_MOTION_H_ */
@@ -0,0 +1,138 @@
+#include "filter_snapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "huge_pages.h"
+
+const unsigned FilterSnapshot::kVersion;
+
+namespace {
+
+const char kSnapshotMagic[4] = {'U', 'K', 'F', 'S'};
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+};
+
+static_assert(sizeof(FilterSnapshot::Record) == 184,
+              "snapshot records are written as raw bytes");
+
+}  // namespace
+
+void FilterSnapshot::Capture(const UKF &ukf, unsigned long long id,
+                             Record *record) {
+  record->id = id;
+  record->timestamp = ukf.timestamp();
+  record->config_hash = ukf.Config().ModelHash();
+  for (int i = 0; i < UKF::n_x_; i++) {
+    record->x[i] = ukf.x()(i);
+  }
+  PackedSymmetric<UKF::n_x_>::Pack(ukf.P(), record->p);
+}
+
+bool FilterSnapshot::Restore(const Record &record, UKF *ukf) {
+  if (record.config_hash != ukf->Config().ModelHash()) {
+    return false;
+  }
+  UKF::StateVector x;
+  UKF::StateMatrix P;
+  for (int i = 0; i < UKF::n_x_; i++) {
+    x(i) = static_cast<UKF::Scalar>(record.x[i]);
+  }
+  PackedSymmetric<UKF::n_x_>::Unpack(record.p, &P);
+  ukf->SetState(x, P, record.timestamp);
+  return true;
+}
+
+bool FilterSnapshot::Write(const char *path, const Record *records,
+                           size_t count) {
+  const std::string tmp = std::string(path) + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  Header h;
+  memcpy(h.magic, kSnapshotMagic, 4);
+  h.version = kVersion;
+  h.count = count;
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+            fwrite(records, sizeof(Record), count, f) == count;
+  ok = fflush(f) == 0 && ok;
+  ok = fsync(fileno(f)) == 0 && ok;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool FilterSnapshot::Write(const char *path,
+                           const std::vector<Record> &records) {
+  return Write(path, records.data(), records.size());
+}
+
+FilterSnapshot::File::File()
+    : map_(nullptr), length_(0), records_(nullptr), count_(0) {}
+
+FilterSnapshot::File::~File() {
+  Close();
+}
+
+bool FilterSnapshot::File::Open(const char *path) {
+  Close();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+
+  size_t length = static_cast<size_t>(st.st_size);
+  void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+
+  //the header must match and account for every byte after it
+  Header h;
+  memcpy(&h, map, sizeof(h));
+  if (memcmp(h.magic, kSnapshotMagic, 4) != 0 || h.version != kVersion ||
+      length - sizeof(h) != h.count * sizeof(Record)) {
+    munmap(map, length);
+    return false;
+  }
+  madvise(map, length, MADV_SEQUENTIAL);
+  //file-backed huge pages need a kernel with read-only THP for files;
+  //elsewhere the advice is ignored
+  HugePages::Advise(map, length);
+
+  map_ = map;
+  length_ = length;
+  records_ = reinterpret_cast<const Record *>(
+      static_cast<const char *>(map) + sizeof(h));
+  count_ = static_cast<size_t>(h.count);
+  return true;
+}
+
+void FilterSnapshot::File::Close() {
+  if (map_) {
+    munmap(map_, length_);
+  }
+  map_ = nullptr;
+  length_ = 0;
+  records_ = nullptr;
+  count_ = 0;
+}
@@ -0,0 +1,95 @@
+#ifndef FILTER_SNAPSHOT_H_
+#define FILTER_SNAPSHOT_H_
+
+#include <cstddef>
+#include <vector>
+#include "packed_symmetric.h"
+#include "ukf.h"
+
+/**
+ * Saved filter states for warm restarts: a restarted process restores each
+ * track's posterior instead of reconverging from its first measurement.
+ *
+ * A snapshot file has the 16-byte header of the BinaryLog files, "UKFS", a
+ * u32 version and a u64 record count, followed by the fixed-width records
+ * below in host (little-endian) byte order. The records are read in place
+ * through a read-only mapping, so loading many filters costs one mmap and a
+ * copy per filter.
+ */
+class FilterSnapshot {
+public:
+  static const unsigned kVersion = 1;
+
+  /**
+   * One filter: 184 bytes, all fields 8-byte aligned
+   */
+  struct Record {
+    ///* caller's key, e.g. the track id
+    unsigned long long id;
+    ///* timestamp of the posterior in us
+    long long timestamp;
+    ///* UKFConfig::ModelHash of the filter that produced it
+    unsigned long long config_hash;
+    double x[UKF::n_x_];
+    ///* upper triangle of P, row by row
+    double p[PackedSymmetric<UKF::n_x_>::kSize];
+  };
+
+  /**
+   * Copies a filter's posterior into a record
+   * @param ukf Initialised filter
+   * @param id Key stored with the record
+   * @param record Filled in
+   */
+  static void Capture(const UKF &ukf, unsigned long long id, Record *record);
+
+  /**
+   * Restores a posterior into a filter configured like the one captured
+   * @param record Saved state
+   * @param ukf Filter to restore; its settings are kept
+   * @return false, leaving ukf untouched, if the filter's model hash differs
+   */
+  static bool Restore(const Record &record, UKF *ukf);
+
+  /**
+   * Writes records to a temporary file and renames it over path, so a crash
+   * mid-write leaves the previous snapshot intact
+   * @param path File to replace
+   * @param records Records to write
+   * @param count Number of records
+   * @return false on I/O errors
+   */
+  static bool Write(const char *path, const Record *records, size_t count);
+  static bool Write(const char *path, const std::vector<Record> &records);
+
+  /**
+   * A snapshot file mapped read-only for the life of the object
+   */
+  class File {
+  public:
+    File();
+    virtual ~File();
+
+    /**
+     * Maps a snapshot file
+     * @return false if it cannot be read or has a bad header or length
+     */
+    bool Open(const char *path);
+
+    void Close();
+
+    const Record *records() const { return records_; }
+    size_t size() const { return count_; }
+
+  private:
+    File(const File &);
+    File &operator=(const File &);
+
+    void *map_;
+    size_t length_;
+    const Record *records_;
+    size_t count_;
+  };
+};
+
+#endif /* FILTER_SNAPSHOT_H_ */
@@ -0,0 +1,59 @@
+#include "frame_arena.h"
+#include <algorithm>
+#include <stdint.h>
+
+FrameArena::FrameArena(size_t initial_bytes)
+    : cursor_(nullptr), end_(nullptr), used_(0), high_water_(0) {
+  AddBlock(std::max<size_t>(initial_bytes, 64));
+}
+
+FrameArena::~FrameArena() {
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    delete[] blocks_[i].data;
+  }
+}
+
+void FrameArena::AddBlock(size_t bytes) {
+  Block block = {new char[bytes], bytes};
+  blocks_.push_back(block);
+  cursor_ = block.data;
+  end_ = block.data + bytes;
+}
+
+void *FrameArena::Allocate(size_t bytes, size_t align) {
+  uintptr_t p = reinterpret_cast<uintptr_t>(cursor_);
+  uintptr_t aligned = (p + align - 1) & ~static_cast<uintptr_t>(align - 1);
+  if (aligned + bytes > reinterpret_cast<uintptr_t>(end_)) {
+    //spill: a block at least double the last, big enough for this request
+    AddBlock(std::max(2 * blocks_.back().size, bytes + align));
+    p = reinterpret_cast<uintptr_t>(cursor_);
+    aligned = (p + align - 1) & ~static_cast<uintptr_t>(align - 1);
+  }
+  used_ += bytes + (aligned - p);
+  high_water_ = std::max(high_water_, used_);
+  cursor_ = reinterpret_cast<char *>(aligned + bytes);
+  return reinterpret_cast<void *>(aligned);
+}
+
+void FrameArena::Reset() {
+  if (blocks_.size() > 1) {
+    //fold the spill blocks into one that holds the largest frame so far
+    size_t total = capacity();
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      delete[] blocks_[i].data;
+    }
+    blocks_.clear();
+    AddBlock(std::max(total, high_water_));
+  }
+  cursor_ = blocks_.back().data;
+  end_ = cursor_ + blocks_.back().size;
+  used_ = 0;
+}
+
+size_t FrameArena::capacity() const {
+  size_t total = 0;
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    total += blocks_[i].size;
+  }
+  return total;
+}
@@ -0,0 +1,114 @@
+#ifndef FRAME_ARENA_H_
+#define FRAME_ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * Bump allocator for per-frame temporaries (gating candidates, batched
+ * measurement arrays, scratch ids): allocation is a pointer increment and
+ * Reset at the end of the frame frees everything at once.
+ *
+ * Memory comes from one block. A frame that outgrows it spills into extra
+ * blocks, and the next Reset replaces them all by one block of the frame's
+ * high-water size, so after the first large frame a steady-state process
+ * does not touch malloc again. Not thread-safe; use one arena per thread.
+ */
+class FrameArena {
+public:
+  /**
+   * Constructor
+   * @param initial_bytes Size of the first block
+   */
+  explicit FrameArena(size_t initial_bytes = 64 * 1024);
+
+  /**
+   * Destructor
+   */
+  virtual ~FrameArena();
+
+  /**
+   * Returns uninitialised memory valid until the next Reset
+   * @param bytes Size
+   * @param align Alignment, a power of two; the default suits Eigen's
+   * fixed-size vectorisable types
+   */
+  void *Allocate(size_t bytes, size_t align = 16);
+
+  /**
+   * An uninitialised array of n trivially destructible objects
+   */
+  template <typename T>
+  T *AllocateArray(size_t n) {
+    return static_cast<T *>(Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  /**
+   * Frees everything allocated since the last Reset
+   */
+  void Reset();
+
+  ///* Bytes handed out this frame, the most in any frame, and the bytes held
+  size_t used() const { return used_; }
+  size_t high_water() const { return high_water_; }
+  size_t capacity() const;
+
+private:
+  FrameArena(const FrameArena &);
+  FrameArena &operator=(const FrameArena &);
+
+  struct Block {
+    char *data;
+    size_t size;
+  };
+
+  void AddBlock(size_t bytes);
+
+  std::vector<Block> blocks_;
+  ///* next free byte and end of the current (last) block
+  char *cursor_;
+  char *end_;
+  size_t used_;
+  size_t high_water_;
+};
+
+/**
+ * Standard allocator over a FrameArena, for std::vector and friends holding
+ * per-frame data. deallocate is a no-op, so a container that grows leaves
+ * its old buffers in the arena until Reset; reserve up front where the size
+ * is known. Containers must not outlive the frame.
+ */
+template <typename T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(FrameArena *arena) : arena_(arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {}
+
+  T *allocate(size_t n) { return arena_->AllocateArray<T>(n); }
+  void deallocate(T *, size_t) {}
+
+  FrameArena *arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U> &other) const {
+    return arena_ == other.arena();
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U> &other) const {
+    return arena_ != other.arena();
+  }
+
+private:
+  FrameArena *arena_;
+};
+
+///* A vector whose storage lives in a FrameArena
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+#endif /* FRAME_ARENA_H_ */
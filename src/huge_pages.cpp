@@ -0,0 +1,159 @@
+#include "huge_pages.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <sys/mman.h>
+
+namespace {
+
+// the x86-64 and arm64 default; blocks are rounded up to it
+const size_t kHugePage = 2 << 20;
+
+std::atomic<int> g_policy(HugePages::OFF);
+std::atomic<unsigned long long> g_bytes[HugePages::kBackingCount];
+
+const char *const kBackingNames[HugePages::kBackingCount] = {
+  "small", "transparent", "explicit"
+};
+
+// live mapped blocks and how they are backed; blocks are few and large
+struct Block {
+  void *p;
+  HugePages::Backing backing;
+};
+std::mutex g_blocks_mutex;
+std::vector<Block> g_blocks;
+
+size_t RoundUp(size_t bytes) {
+  return (bytes + kHugePage - 1) / kHugePage * kHugePage;
+}
+
+// a plain mapping of length bytes starting on a huge page boundary
+void *MapAligned(size_t length) {
+  void *raw = mmap(nullptr, length + kHugePage, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return nullptr;
+  }
+  const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+  const uintptr_t aligned = (start + kHugePage - 1) & ~(kHugePage - 1);
+  if (aligned > start) {
+    munmap(raw, aligned - start);
+  }
+  const size_t tail = kHugePage - (aligned - start);
+  if (tail > 0) {
+    munmap(reinterpret_cast<void *>(aligned + length), tail);
+  }
+  return reinterpret_cast<void *>(aligned);
+}
+
+}  // namespace
+
+void HugePages::SetPolicy(Policy policy) {
+  g_policy.store(policy, std::memory_order_relaxed);
+}
+
+HugePages::Policy HugePages::policy() {
+  return static_cast<Policy>(g_policy.load(std::memory_order_relaxed));
+}
+
+bool HugePages::ParsePolicy(const char *name, Policy *policy) {
+  if (strcmp(name, "off") == 0) {
+    *policy = OFF;
+  }
+  else if (strcmp(name, "thp") == 0) {
+    *policy = TRANSPARENT;
+  }
+  else if (strcmp(name, "explicit") == 0) {
+    *policy = EXPLICIT;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+void *HugePages::Allocate(size_t bytes) {
+  if (bytes < kMinBytes) {
+    return malloc(bytes > 0 ? bytes : 1);
+  }
+  const size_t length = RoundUp(bytes);
+  const Policy wanted = policy();
+  void *p = nullptr;
+  Backing backing = BACKING_SMALL;
+#ifdef MAP_HUGETLB
+  if (wanted == EXPLICIT) {
+    p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+      p = nullptr;
+    }
+    else {
+      backing = BACKING_EXPLICIT;
+    }
+  }
+#endif
+  if (!p) {
+    p = MapAligned(length);
+    if (!p) {
+      return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    if (wanted != OFF && madvise(p, length, MADV_HUGEPAGE) == 0) {
+      backing = BACKING_TRANSPARENT;
+    }
+#endif
+  }
+
+  g_bytes[backing].fetch_add(length, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(g_blocks_mutex);
+  Block block = {p, backing};
+  g_blocks.push_back(block);
+  return p;
+}
+
+void HugePages::Free(void *p, size_t bytes) {
+  if (!p) {
+    return;
+  }
+  if (bytes < kMinBytes) {
+    free(p);
+    return;
+  }
+  const size_t length = RoundUp(bytes);
+  {
+    std::lock_guard<std::mutex> lock(g_blocks_mutex);
+    for (size_t i = 0; i < g_blocks.size(); i++) {
+      if (g_blocks[i].p == p) {
+        g_bytes[g_blocks[i].backing].fetch_sub(length,
+                                               std::memory_order_relaxed);
+        g_blocks[i] = g_blocks.back();
+        g_blocks.pop_back();
+        break;
+      }
+    }
+  }
+  munmap(p, length);
+}
+
+void HugePages::Advise(void *p, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+  if (policy() != OFF) {
+    madvise(p, bytes, MADV_HUGEPAGE);
+  }
+#else
+  (void)p;
+  (void)bytes;
+#endif
+}
+
+unsigned long long HugePages::Bytes(Backing backing) {
+  return g_bytes[backing].load(std::memory_order_relaxed);
+}
+
+const char *HugePages::Name(Backing backing) {
+  return kBackingNames[backing];
+}
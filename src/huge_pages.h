@@ -0,0 +1,104 @@
+#ifndef HUGE_PAGES_H_
+#define HUGE_PAGES_H_
+
+#include <cstddef>
+#include <new>
+
+/**
+ * Large buffers backed by huge pages, so that sweeps over a bank of
+ * hundreds of thousands of tracks touch a few dozen TLB entries rather
+ * than thousands.
+ *
+ * The policy is process-wide and set once at startup:
+ *
+ *   OFF          plain pages
+ *   TRANSPARENT  plain mappings aligned to a huge page and madvise'd
+ *                MADV_HUGEPAGE, for the kernel's transparent huge pages
+ *   EXPLICIT     MAP_HUGETLB pages from the reserved pool
+ *                (vm.nr_hugepages), falling back to TRANSPARENT when the
+ *                pool is empty or missing
+ *
+ * Only blocks of at least kMinBytes are mapped this way; smaller ones come
+ * from malloc, which already packs them onto shared pages. Bytes() tells
+ * which backing the mapped blocks really got, for the metrics; TRANSPARENT
+ * counts what was advised, which the kernel may still serve with small
+ * pages when it cannot find a free huge page.
+ */
+class HugePages {
+public:
+  enum Policy { OFF, TRANSPARENT, EXPLICIT };
+
+  enum Backing {
+    BACKING_SMALL,
+    BACKING_TRANSPARENT,
+    BACKING_EXPLICIT,
+    kBackingCount
+  };
+
+  ///* smallest block worth a mapping of its own
+  static const size_t kMinBytes = 1 << 20;
+
+  static void SetPolicy(Policy policy);
+  static Policy policy();
+
+  /**
+   * @param name "off", "thp" or "explicit"
+   * @param policy Set on success
+   * @return false for any other name
+   */
+  static bool ParsePolicy(const char *name, Policy *policy);
+
+  /**
+   * Allocates bytes under the current policy
+   * @return The block, or nullptr if no memory could be had at all
+   */
+  static void *Allocate(size_t bytes);
+
+  /**
+   * Frees a block of Allocate
+   * @param p Block, or nullptr
+   * @param bytes The size it was allocated with
+   */
+  static void Free(void *p, size_t bytes);
+
+  /**
+   * Asks for huge pages on an existing mapping, e.g. of a snapshot file;
+   * does nothing when the policy is OFF
+   */
+  static void Advise(void *p, size_t bytes);
+
+  ///* bytes of live blocks with each backing
+  static unsigned long long Bytes(Backing backing);
+  static const char *Name(Backing backing);
+};
+
+/**
+ * std::allocator for containers that may grow large, e.g.
+ * std::vector<double, HugePageAllocator<double> >
+ */
+template <typename T>
+class HugePageAllocator {
+public:
+  typedef T value_type;
+
+  HugePageAllocator() {}
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    void *p = HugePages::Allocate(n * sizeof(T));
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+  }
+
+  void deallocate(T *p, size_t n) { HugePages::Free(p, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const HugePageAllocator<U> &) const { return true; }
+  template <typename U>
+  bool operator!=(const HugePageAllocator<U> &) const { return false; }
+};
+
+#endif /* HUGE_PAGES_H_ */
@@ -0,0 +1,148 @@
+#ifndef ID_MAP_H_
+#define ID_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Flat open-addressing map from 32-bit external ids to 32-bit values, e.g.
+ * track ids to pool slots.
+ *
+ * Entries live in one power-of-two array probed linearly from a
+ * multiplicative hash of the id, kept at most half full, so a lookup
+ * touches one or two cache lines and nothing is allocated per entry, unlike
+ * the nodes of std::unordered_map. Erase shifts the rest of the probe run
+ * back instead of leaving tombstones, so lookups never slow down as ids
+ * come and go.
+ */
+class IdMap {
+public:
+  IdMap() : size_(0), mask_(0) {}
+
+  /**
+   * @return The value stored for id, or nullptr if there is none
+   */
+  const uint32_t *Find(uint32_t id) const {
+    if (size_ == 0) {
+      return nullptr;
+    }
+    for (size_t slot = Slot(id);; slot = (slot + 1) & mask_) {
+      const Entry &entry = entries_[slot];
+      if (entry.value == kEmpty) {
+        return nullptr;
+      }
+      if (entry.id == id) {
+        return &entry.value;
+      }
+    }
+  }
+
+  /**
+   * Stores a value for id, replacing any there was
+   * @param value Anything but 0xffffffff, which marks empty entries
+   */
+  void Insert(uint32_t id, uint32_t value) {
+    if (2 * (size_ + 1) > entries_.size()) {
+      Rehash(entries_.empty() ? 16 : 2 * entries_.size());
+    }
+    size_t slot = Slot(id);
+    while (entries_[slot].value != kEmpty && entries_[slot].id != id) {
+      slot = (slot + 1) & mask_;
+    }
+    if (entries_[slot].value == kEmpty) {
+      ++size_;
+    }
+    entries_[slot].id = id;
+    entries_[slot].value = value;
+  }
+
+  /**
+   * @return false if there was no entry for id
+   */
+  bool Erase(uint32_t id) {
+    if (size_ == 0) {
+      return false;
+    }
+    size_t hole = Slot(id);
+    for (;; hole = (hole + 1) & mask_) {
+      if (entries_[hole].value == kEmpty) {
+        return false;
+      }
+      if (entries_[hole].id == id) {
+        break;
+      }
+    }
+    for (size_t next = (hole + 1) & mask_; entries_[next].value != kEmpty;
+         next = (next + 1) & mask_) {
+      const size_t home = Slot(entries_[next].id);
+      //move it back if the hole lies on its probe path from home
+      if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+        entries_[hole] = entries_[next];
+        hole = next;
+      }
+    }
+    entries_[hole].value = kEmpty;
+    --size_;
+    return true;
+  }
+
+  /**
+   * Removes every entry, keeping the array
+   */
+  void Clear() {
+    for (size_t i = 0; i < entries_.size(); i++) {
+      entries_[i].value = kEmpty;
+    }
+    size_ = 0;
+  }
+
+  /**
+   * Sizes the array so that count entries fit without a rehash
+   */
+  void Reserve(size_t count) {
+    size_t slots = entries_.empty() ? 16 : entries_.size();
+    while (slots < 2 * count) {
+      slots <<= 1;
+    }
+    if (slots > entries_.size()) {
+      Rehash(slots);
+    }
+  }
+
+  size_t size() const { return size_; }
+
+  size_t MemoryBytes() const { return entries_.capacity() * sizeof(Entry); }
+
+private:
+  static const uint32_t kEmpty = 0xffffffffu;
+
+  struct Entry {
+    uint32_t id;
+    uint32_t value;
+  };
+
+  size_t Slot(uint32_t id) const {
+    return static_cast<size_t>((id * 0x9E3779B97F4A7C15ull) >> 32) & mask_;
+  }
+
+  void Rehash(size_t slots) {
+    std::vector<Entry> old;
+    old.swap(entries_);
+    Entry empty = {0, kEmpty};
+    entries_.assign(slots, empty);
+    mask_ = slots - 1;
+    size_ = 0;
+    for (size_t i = 0; i < old.size(); i++) {
+      if (old[i].value != kEmpty) {
+        Insert(old[i].id, old[i].value);
+      }
+    }
+  }
+
+  std::vector<Entry> entries_;
+  size_t size_;
+  size_t mask_;
+};
+
+#endif /* ID_MAP_H_ */
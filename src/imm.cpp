@@ -0,0 +1,167 @@
+#include "imm.h"
+#include <cmath>
+#include "angle.h"
+
+const int IMM::kMaxModels;
+
+IMM::IMM(const UKF &prototype, const Model *models, int count,
+         double stay_probability)
+    : engine_(prototype),
+      count_(count < 1 ? 1 : (count > kMaxModels ? kMaxModels : count)),
+      is_initialized_(false) {
+  //the models share one history-free, standard-form engine
+  engine_.use_sqrt_ukf_ = false;
+  engine_.SetHistoryDepth(0);
+  engine_.Reset();
+
+  transition_.setZero();
+  const double move = count_ > 1 ? (1.0 - stay_probability) / (count_ - 1)
+                                 : 0.0;
+  for (int i = 0; i < count_; i++) {
+    models_[i] = models[i];
+    for (int j = 0; j < count_; j++) {
+      transition_(i, j) = i == j ? (count_ > 1 ? stay_probability : 1.0)
+                                 : move;
+    }
+  }
+
+  mu_.setZero();
+  mu_.head(count_).setConstant(1.0 / count_);
+  c_ = mu_;
+  x_.setZero();
+  P_.setZero();
+  for (int i = 0; i < kMaxModels; i++) {
+    xs_[i].setZero();
+    Ps_[i].setZero();
+    x0_[i].setZero();
+    P0_[i].setZero();
+  }
+}
+
+IMM::~IMM() {}
+
+void IMM::SetTransition(int from, int to, double p) {
+  transition_(from, to) = p;
+}
+
+void IMM::ProcessMeasurement(const Measurement &meas) {
+  if (!is_initialized_) {
+    engine_.FuseMeasurement(meas);
+    for (int j = 0; j < count_; j++) {
+      xs_[j] = engine_.x();
+      Ps_[j] = engine_.P();
+    }
+    x_ = engine_.x();
+    P_ = engine_.P();
+    is_initialized_ = true;
+    return;
+  }
+
+  Mix();
+
+  //model-conditioned predict and update through the shared engine
+  const TimeUs previous = engine_.timestamp();
+  ModelVector log_l;
+  log_l.setZero();
+  double max_log_l = -INFINITY;
+  for (int j = 0; j < count_; j++) {
+    engine_.std_a_ = models_[j].std_a;
+    engine_.std_yawdd_ = models_[j].std_yawdd;
+    engine_.motion_model_ = models_[j].motion_model;
+    engine_.SetState(x0_[j], P0_[j], previous);
+    engine_.FuseMeasurement(meas);
+    xs_[j] = engine_.x();
+    Ps_[j] = engine_.P();
+    log_l(j) = LogLikelihood(meas);
+    if (log_l(j) > max_log_l) max_log_l = log_l(j);
+  }
+
+  //mu_j ~ L_j c_j, scaled by the best likelihood so nothing underflows
+  double total = 0.0;
+  for (int j = 0; j < count_; j++) {
+    mu_(j) = c_(j) * exp(log_l(j) - max_log_l);
+    total += mu_(j);
+  }
+  if (total > 0.0 && std::isfinite(total)) {
+    mu_.head(count_) /= total;
+  }
+  else {
+    mu_.head(count_) = c_.head(count_);
+  }
+
+  Combine();
+}
+
+void IMM::Mix() {
+  //c_j = sum_i p_ij mu_i, the model probabilities before the update
+  for (int j = 0; j < count_; j++) {
+    double c = 0.0;
+    for (int i = 0; i < count_; i++) {
+      c += transition_(i, j) * mu_(i);
+    }
+    c_(j) = c;
+  }
+
+  for (int j = 0; j < count_; j++) {
+    //mixing weights mu_{i|j} = p_ij mu_i / c_j
+    ModelVector w;
+    w.setZero();
+    for (int i = 0; i < count_; i++) {
+      w(i) = c_(j) > 0.0 ? transition_(i, j) * mu_(i) / c_(j) : 0.0;
+    }
+
+    //yaw is averaged as offsets from model j's own yaw, so the mean does not
+    //jump across the wrap
+    UKF::StateVector x = UKF::StateVector::Zero();
+    for (int i = 0; i < count_; i++) {
+      UKF::StateVector d = xs_[i] - xs_[j];
+      d(3) = NormalizeAngle(d(3));
+      x += w(i) * d;
+    }
+    x += xs_[j];
+    x(3) = NormalizeAngle(x(3));
+
+    UKF::StateMatrix P = UKF::StateMatrix::Zero();
+    for (int i = 0; i < count_; i++) {
+      UKF::StateVector d = xs_[i] - x;
+      d(3) = NormalizeAngle(d(3));
+      P += w(i) * (Ps_[i] + d * d.transpose());
+    }
+    x0_[j] = x;
+    P0_[j] = P;
+  }
+}
+
+void IMM::Combine() {
+  UKF::StateVector x = UKF::StateVector::Zero();
+  for (int j = 0; j < count_; j++) {
+    UKF::StateVector d = xs_[j] - xs_[0];
+    d(3) = NormalizeAngle(d(3));
+    x += mu_(j) * d;
+  }
+  x += xs_[0];
+  x(3) = NormalizeAngle(x(3));
+
+  UKF::StateMatrix P = UKF::StateMatrix::Zero();
+  for (int j = 0; j < count_; j++) {
+    UKF::StateVector d = xs_[j] - x;
+    d(3) = NormalizeAngle(d(3));
+    P += mu_(j) * (Ps_[j] + d * d.transpose());
+  }
+  x_ = x;
+  P_ = P;
+}
+
+double IMM::LogLikelihood(const Measurement &meas) const {
+  //-0.5 (NIS + log det S + n log 2 pi), from the NIS and S factor the
+  //update kept
+  const double kLog2Pi = log(2.0 * M_PI);
+  if (meas.sensor_type_ == MeasurementPackage::RADAR) {
+    const UKF::RadarMatrix &L = engine_.S_radar_factor_;
+    double log_det = 2.0 * L.diagonal().array().abs().log().sum();
+    return -0.5 * (engine_.nis_radar_ + log_det + UKF::n_z_radar_ * kLog2Pi);
+  }
+  const UKF::LidarMatrix &L = engine_.S_lidar_factor_;
+  double log_det = 2.0 * L.diagonal().array().abs().log().sum();
+  return -0.5 * (engine_.nis_lidar_ + log_det + UKF::n_z_lidar_ * kLog2Pi);
+}
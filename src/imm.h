@@ -0,0 +1,111 @@
+#ifndef IMM_H_
+#define IMM_H_
+
+#include "Eigen/Dense"
+#include "measurement_package.h"
+#include "ukf.h"
+
+/**
+ * Interacting Multiple Model filter over up to kMaxModels model-conditioned
+ * UKFs, e.g. the same CTRV filter with a low and a high std_a_ for a target
+ * that alternates between cruising and manoeuvring.
+ *
+ * Each step mixes the model posteriors by the Markov transition matrix,
+ * runs every model's predict and update, reweights the models by the
+ * likelihood of the innovation and combines them into one estimate. Only
+ * the per-model mean and covariance are stored: all models run in turn
+ * through one shared UKF, so its sigma-point and update workspace is
+ * allocated once per track rather than once per model.
+ */
+class IMM {
+public:
+  static const int kMaxModels = 4;
+
+  typedef Eigen::Matrix<double, kMaxModels, 1> ModelVector;
+  typedef Eigen::Matrix<double, kMaxModels, kMaxModels> ModelMatrix;
+
+  ///* What differs between the models; the measurement noise and sigma
+  ///* point scaling come from the prototype
+  struct Model {
+    double std_a;
+    double std_yawdd;
+    UKF::MotionModel motion_model;
+  };
+
+  /**
+   * Constructor
+   * @param prototype Filter whose configuration all models share
+   * @param models Model parameters
+   * @param count Number of models, 1 to kMaxModels
+   * @param stay_probability Probability of keeping the model from one
+   * measurement to the next; the rest is spread evenly over the others
+   */
+  IMM(const UKF &prototype, const Model *models, int count,
+      double stay_probability);
+
+  /**
+   * Destructor
+   */
+  virtual ~IMM();
+
+  /**
+   * Sets one transition probability. Rows must sum to 1.
+   * @param from Model before the step
+   * @param to Model after the step
+   * @param p Probability
+   */
+  void SetTransition(int from, int to, double p);
+
+  /**
+   * Mixes, predicts and updates every model with one measurement. The
+   * first measurement initialises all models alike.
+   * @param meas Measurement later than the previous one
+   */
+  void ProcessMeasurement(const Measurement &meas);
+
+  ///* Combined estimate and covariance
+  const UKF::StateVector &x() const { return x_; }
+  const UKF::StateMatrix &P() const { return P_; }
+
+  ///* Posterior probability of each model
+  const ModelVector &probabilities() const { return mu_; }
+
+  int count() const { return count_; }
+  bool is_initialized() const { return is_initialized_; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  // mixes the model posteriors into each model's prior; returns the
+  // predicted model probabilities in c_
+  void Mix();
+
+  // weighted sum of the model estimates into x_ and P_
+  void Combine();
+
+  // log likelihood of the innovation of the update engine_ just made
+  double LogLikelihood(const Measurement &meas) const;
+
+  UKF engine_;
+  int count_;
+  Model models_[kMaxModels];
+  ModelMatrix transition_;
+
+  bool is_initialized_;
+
+  // per-model posterior
+  UKF::StateVector xs_[kMaxModels];
+  UKF::StateMatrix Ps_[kMaxModels];
+
+  // mixed priors
+  UKF::StateVector x0_[kMaxModels];
+  UKF::StateMatrix P0_[kMaxModels];
+
+  ModelVector mu_;
+  ModelVector c_;
+
+  UKF::StateVector x_;
+  UKF::StateMatrix P_;
+};
+
+#endif /* IMM_H_ */
@@ -0,0 +1,363 @@
+#include "jpda.h"
+#include <algorithm>
+#include <cmath>
+#include "angle.h"
+#include "measurement_models.h"
+#include "thread_pool.h"
+
+namespace {
+
+// runs body over [0, n) on the pool, or on the calling thread without one
+template <typename Body>
+void ForRange(ThreadPool *pool, int n, int grain, const Body &body) {
+  if (!pool || n <= grain) {
+    body(0, n);
+    return;
+  }
+  pool->ParallelFor(0, n, grain, body);
+}
+
+}  // namespace
+
+JpdaAssociator::JpdaAssociator(const Options &options)
+    : options_(options),
+      pool_(nullptr),
+      sensor_(MeasurementPackage::LASER),
+      dim_(UKF::n_z_lidar_),
+      tracks_(0),
+      measurements_(0),
+      clusters_(0),
+      exact_clusters_(0),
+      total_(0.0) {
+  if (options_.max_events < 1) {
+    options_.max_events = 1;
+  }
+  if (options_.grain < 1) {
+    options_.grain = 1;
+  }
+}
+
+JpdaAssociator::~JpdaAssociator() {}
+
+int JpdaAssociator::Root(int v) {
+  while (parent_[v] != v) {
+    parent_[v] = parent_[parent_[v]];
+    v = parent_[v];
+  }
+  return v;
+}
+
+void JpdaAssociator::ScoreRange(UKF *const *tracks,
+                                const Measurement *measurements, int begin,
+                                int end) {
+  const double log_two_pi = std::log(2.0 * M_PI);
+  const double pd = options_.detection_probability;
+  for (int t = begin; t < end; t++) {
+    Prediction &prediction = predictions_[t];
+    prediction.valid = false;
+    if (track_start_[t] == track_start_[t + 1]) {
+      continue;
+    }
+    UKF &ukf = *tracks[t];
+    if (ukf.ekf_predicted_) {
+      ukf.RefreshSigmaPoints();
+    }
+    if (sensor_ == MeasurementPackage::RADAR) {
+      ukf.PredictMeasurement<RadarModel>(ukf.radar_noise_, &prediction.z,
+                                         &prediction.L, &prediction.K);
+    }
+    else {
+      ukf.PredictMeasurement<LidarModel>(ukf.lidar_noise_, &prediction.z,
+                                         &prediction.L, &prediction.K);
+    }
+    double log_det = 0.0;
+    bool valid = true;
+    for (int c = 0; c < dim_; c++) {
+      valid = valid && prediction.L(c, c) > 0.0;
+      log_det += std::log(prediction.L(c, c));
+    }
+    //a degenerate S scores nothing; the track keeps its prediction
+    prediction.valid = valid;
+    prediction.log_norm = -0.5 * dim_ * log_two_pi - log_det;
+
+    for (int e = track_start_[t]; e < track_start_[t + 1]; e++) {
+      const Measurement &meas = measurements[pairs_[e].measurement];
+      double *nu = &innovation_[3 * e];
+      Eigen::Vector3d y = Eigen::Vector3d::Zero();
+      nu[2] = 0.0;
+      for (int c = 0; c < dim_; c++) {
+        nu[c] = meas.values_[c] - prediction.z(c);
+      }
+      if (sensor_ == MeasurementPackage::RADAR) {
+        nu[1] = NormalizeAngle(nu[1]);
+      }
+      //forward substitution with the kept factor, for the NIS
+      double nis = 0.0;
+      for (int r = 0; r < dim_ && valid; r++) {
+        double s = nu[r];
+        for (int c = 0; c < r; c++) {
+          s -= prediction.L(r, c) * y(c);
+        }
+        y(r) = s / prediction.L(r, r);
+        nis += y(r) * y(r);
+      }
+      pairs_[e].cost = valid ? nis : -1.0;
+      ratio_[e] = valid ? pd * std::exp(prediction.log_norm - 0.5 * nis) /
+                              options_.clutter_density
+                        : 0.0;
+    }
+  }
+}
+
+size_t JpdaAssociator::Solve(UKF *const *tracks, int track_count,
+                             const Measurement *measurements,
+                             int measurement_count, const GatedPair *pairs,
+                             size_t count) {
+  tracks_ = track_count;
+  measurements_ = measurement_count;
+  clusters_ = 0;
+  exact_clusters_ = 0;
+  miss_.assign(tracks_, 1.0);
+  if (count > 0) {
+    sensor_ = measurements[pairs[0].measurement].sensor_type_;
+  }
+  dim_ = sensor_ == MeasurementPackage::RADAR ? UKF::n_z_radar_
+                                              : UKF::n_z_lidar_;
+
+  //bucket the pairs of the scan's sensor by track
+  track_start_.assign(tracks_ + 1, 0);
+  for (size_t k = 0; k < count; k++) {
+    if (measurements[pairs[k].measurement].sensor_type_ == sensor_) {
+      ++track_start_[pairs[k].track + 1];
+    }
+  }
+  for (int t = 0; t < tracks_; t++) {
+    track_start_[t + 1] += track_start_[t];
+  }
+  pairs_.resize(track_start_[tracks_]);
+  chosen_.assign(track_start_.begin(), track_start_.end() - 1);
+  for (size_t k = 0; k < count; k++) {
+    if (measurements[pairs[k].measurement].sensor_type_ == sensor_) {
+      pairs_[chosen_[pairs[k].track]++] = pairs[k];
+    }
+  }
+
+  //score every pair against its track's prediction
+  predictions_.resize(tracks_);
+  innovation_.resize(3 * pairs_.size());
+  ratio_.resize(pairs_.size());
+  ForRange(pool_, tracks_, options_.grain, [&](int begin, int end) {
+    ScoreRange(tracks, measurements, begin, end);
+  });
+
+  //drop the pairs outside the gate, or of a degenerate track, in place
+  size_t kept = 0;
+  int start = 0;
+  for (int t = 0; t < tracks_; t++) {
+    const int end = track_start_[t + 1];
+    for (int e = start; e < end; e++) {
+      const double nis = pairs_[e].cost;
+      if (nis < 0.0 || (options_.gate > 0.0 && nis > options_.gate)) {
+        continue;
+      }
+      pairs_[kept] = pairs_[e];
+      ratio_[kept] = ratio_[e];
+      std::copy(&innovation_[3 * e], &innovation_[3 * e] + 3,
+                &innovation_[3 * kept]);
+      ++kept;
+    }
+    start = end;
+    track_start_[t + 1] = static_cast<int>(kept);
+  }
+  pairs_.resize(kept);
+  ratio_.resize(kept);
+  innovation_.resize(3 * kept);
+  beta_.assign(kept, 0.0);
+
+  //clusters: components of the graph of tracks and measurements
+  parent_.resize(tracks_ + measurements_);
+  for (size_t v = 0; v < parent_.size(); v++) {
+    parent_[v] = static_cast<int>(v);
+  }
+  for (size_t e = 0; e < kept; e++) {
+    const int a = Root(pairs_[e].track);
+    const int b = Root(tracks_ + pairs_[e].measurement);
+    if (a != b) {
+      parent_[std::max(a, b)] = std::min(a, b);
+    }
+  }
+  cluster_of_.assign(tracks_, -1);
+  cluster_start_.assign(1, 0);
+  for (int t = 0; t < tracks_; t++) {
+    if (track_start_[t] == track_start_[t + 1]) {
+      continue;
+    }
+    const int root = Root(t);
+    if (root == t) {
+      cluster_of_[t] = clusters_++;
+      cluster_start_.push_back(0);
+    }
+    else {
+      cluster_of_[t] = cluster_of_[root];
+    }
+    ++cluster_start_[cluster_of_[t] + 1];
+  }
+  for (int c = 0; c < clusters_; c++) {
+    cluster_start_[c + 1] += cluster_start_[c];
+  }
+  cluster_tracks_.resize(cluster_start_[clusters_]);
+  chosen_.assign(cluster_start_.begin(), cluster_start_.end() - 1);
+  for (int t = 0; t < tracks_; t++) {
+    if (cluster_of_[t] >= 0) {
+      cluster_tracks_[chosen_[cluster_of_[t]]++] = t;
+    }
+  }
+
+  used_.assign(measurements_, 0);
+  sum_measurement_.assign(measurements_, 0.0);
+  for (int c = 0; c < clusters_; c++) {
+    SolveCluster(&cluster_tracks_[cluster_start_[c]],
+                 cluster_start_[c + 1] - cluster_start_[c]);
+  }
+  return kept;
+}
+
+void JpdaAssociator::Enumerate(const int *cluster_tracks, int size, int k,
+                               double weight) {
+  if (k == size) {
+    total_ += weight;
+    for (int i = 0; i < size; i++) {
+      const int e = chosen_[i];
+      if (e >= 0) {
+        beta_[e] += weight;
+      }
+      else {
+        miss_[cluster_tracks[i]] += weight;
+      }
+    }
+    return;
+  }
+  const int t = cluster_tracks[k];
+  const double miss = 1.0 - options_.detection_probability *
+                                options_.gate_probability;
+  chosen_[k] = -1;
+  Enumerate(cluster_tracks, size, k + 1, weight * miss);
+  for (int e = track_start_[t]; e < track_start_[t + 1]; e++) {
+    const int m = pairs_[e].measurement;
+    if (used_[m]) {
+      continue;
+    }
+    used_[m] = 1;
+    chosen_[k] = e;
+    Enumerate(cluster_tracks, size, k + 1, weight * ratio_[e]);
+    used_[m] = 0;
+  }
+}
+
+void JpdaAssociator::SolveCluster(const int *cluster_tracks, int size) {
+  const double miss = 1.0 - options_.detection_probability *
+                                options_.gate_probability;
+
+  //an upper bound on the joint events: every track misses or takes any
+  //of its pairs
+  double events = 1.0;
+  for (int i = 0; i < size && events <= options_.max_events; i++) {
+    const int t = cluster_tracks[i];
+    events *= 1.0 + (track_start_[t + 1] - track_start_[t]);
+  }
+
+  if (events <= options_.max_events) {
+    ++exact_clusters_;
+    total_ = 0.0;
+    chosen_.resize(size);
+    for (int i = 0; i < size; i++) {
+      miss_[cluster_tracks[i]] = 0.0;
+    }
+    Enumerate(cluster_tracks, size, 0, 1.0);
+    const double scale = total_ > 0.0 ? 1.0 / total_ : 0.0;
+    for (int i = 0; i < size; i++) {
+      const int t = cluster_tracks[i];
+      miss_[t] = total_ > 0.0 ? miss_[t] * scale : 1.0;
+      for (int e = track_start_[t]; e < track_start_[t + 1]; e++) {
+        beta_[e] *= scale;
+      }
+    }
+    return;
+  }
+
+  //cheap JPDA: each pair against the competition for its track and for
+  //its measurement
+  for (int i = 0; i < size; i++) {
+    const int t = cluster_tracks[i];
+    for (int e = track_start_[t]; e < track_start_[t + 1]; e++) {
+      sum_measurement_[pairs_[e].measurement] += ratio_[e];
+    }
+  }
+  for (int i = 0; i < size; i++) {
+    const int t = cluster_tracks[i];
+    double sum_track = 0.0;
+    for (int e = track_start_[t]; e < track_start_[t + 1]; e++) {
+      sum_track += ratio_[e];
+    }
+    double taken = 0.0;
+    for (int e = track_start_[t]; e < track_start_[t + 1]; e++) {
+      const double g = ratio_[e];
+      beta_[e] = g / (sum_track + sum_measurement_[pairs_[e].measurement] -
+                      g + miss);
+      taken += beta_[e];
+    }
+    miss_[t] = std::max(0.0, 1.0 - taken);
+  }
+  for (int i = 0; i < size; i++) {
+    const int t = cluster_tracks[i];
+    for (int e = track_start_[t]; e < track_start_[t + 1]; e++) {
+      sum_measurement_[pairs_[e].measurement] = 0.0;
+    }
+  }
+}
+
+void JpdaAssociator::UpdateRange(UKF *const *tracks, int begin, int end) {
+  typedef UKF::Scalar Scalar;
+  typedef Eigen::Matrix<double, UKF::n_x_, 1> Vector;
+  typedef Eigen::Matrix<double, UKF::n_x_, UKF::n_x_> Matrix;
+  for (int t = begin; t < end; t++) {
+    const Prediction &prediction = predictions_[t];
+    if (track_start_[t] == track_start_[t + 1] || !prediction.valid) {
+      continue;
+    }
+
+    //beta-weighted innovation, and the spread of the innovations about it
+    Eigen::Vector3d nu = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d spread = Eigen::Matrix3d::Zero();
+    for (int e = track_start_[t]; e < track_start_[t + 1]; e++) {
+      const Eigen::Map<const Eigen::Vector3d> nu_e(&innovation_[3 * e]);
+      nu += beta_[e] * nu_e;
+      spread += beta_[e] * nu_e * nu_e.transpose();
+    }
+    spread -= nu * nu.transpose();
+
+    //P - (1 - beta_0) K S K^T + K spread K^T; the unused rows of K are 0
+    const Eigen::Matrix<double, UKF::n_x_, 3> &K = prediction.K;
+    const Eigen::Matrix<double, UKF::n_x_, 3> KL = K * prediction.L;
+    UKF &ukf = *tracks[t];
+    Vector x = ukf.x().cast<double>() + K * nu;
+    x(3) = NormalizeAngle(x(3));
+    Matrix P = ukf.P().cast<double>() -
+               (1.0 - miss_[t]) * (KL * KL.transpose()) +
+               K * spread * K.transpose();
+    P = 0.5 * (P + P.transpose());
+    ukf.SetState(x.cast<Scalar>(), P.cast<Scalar>(), ukf.timestamp());
+  }
+}
+
+int JpdaAssociator::Dispatch(UKF *const *tracks) {
+  ForRange(pool_, tracks_, options_.grain, [&](int begin, int end) {
+    UpdateRange(tracks, begin, end);
+  });
+  int updated = 0;
+  for (int t = 0; t < tracks_; t++) {
+    updated += track_start_[t] < track_start_[t + 1] &&
+               predictions_[t].valid ? 1 : 0;
+  }
+  return updated;
+}
@@ -0,0 +1,179 @@
+#ifndef JPDA_H_
+#define JPDA_H_
+
+#include <cstddef>
+#include <vector>
+#include "association.h"
+#include "measurement_package.h"
+#include "ukf.h"
+
+class ThreadPool;
+
+/**
+ * Joint probabilistic data association, the alternative to GnnAssociator
+ * for dense clutter: instead of committing each track to one measurement,
+ * a track is updated once with every gated measurement, weighted by the
+ * probability that it is the track's, so a wrong pick in clutter drags the
+ * track instead of stealing it.
+ *
+ * Solve works in three passes. First, per track, the predicted measurement,
+ * the factor of its innovation covariance S and the gain are computed once
+ * (the front half of the unscented update), and every gated pair is then
+ * scored against them: its innovation, NIS and Gaussian likelihood, one
+ * triangular solve per pair. Second, tracks and measurements are split
+ * into clusters, the connected components of the gating graph, so the
+ * association probabilities of one cluster do not depend on any other.
+ * Third, per cluster, the probabilities come from enumerating its joint
+ * events (each measurement used by at most one track) when there are at
+ * most max_events of them, or from Fitzgerald's cheap JPDA approximation
+ * otherwise,
+ *
+ *   beta_ij = G_ij / (sum_j G_ij + sum_i G_ij - G_ij + (1 - PD PG)),
+ *
+ * which is exact for a track that shares no measurement. Either way the
+ * cost is linear in the gated pairs outside the few small clusters that
+ * are enumerated.
+ *
+ * Dispatch then makes one combined update per track: the innovation is the
+ * beta-weighted mean of its pairs', and the covariance adds the spread of
+ * the innovations to the usual reduction (the PDA update). The result is
+ * written with UKF::SetState, so it does not go through the filter's NIS
+ * bookkeeping or out-of-sequence history.
+ *
+ * One call handles one scan of one sensor: pairs with a measurement of
+ * another sensor than the first pair's are dropped. All working storage is
+ * kept between scans.
+ */
+class JpdaAssociator {
+public:
+  struct Options {
+    ///* probability that a track is detected in a scan
+    double detection_probability;
+    ///* probability that a detection falls inside the gate
+    double gate_probability;
+    ///* clutter measurements per unit measurement volume (m^2 for lidar,
+    ///* m rad m/s for radar)
+    double clutter_density;
+    ///* pairs with a larger NIS are dropped; 0 keeps every pair given
+    double gate;
+    ///* largest number of joint events a cluster is enumerated with
+    int max_events;
+    ///* tracks per parallel chunk of the per-track passes
+    int grain;
+
+    Options()
+        : detection_probability(0.9),
+          gate_probability(0.99),
+          clutter_density(1e-3),
+          gate(0.0),
+          max_events(4096),
+          grain(64) {}
+  };
+
+  explicit JpdaAssociator(const Options &options = Options());
+
+  virtual ~JpdaAssociator();
+
+  /**
+   * Runs the per-track passes on a pool
+   * @param pool Pool to use, or nullptr for the calling thread
+   */
+  void SetThreadPool(ThreadPool *pool) { pool_ = pool; }
+
+  /**
+   * Computes the association probabilities of one scan. The tracks must
+   * already be predicted to the measurement time, as for gating.
+   * @param tracks Filters indexed by track id
+   * @param track_count Number of tracks; pairs use ids [0, track_count)
+   * @param measurements Measurements indexed by measurement id
+   * @param measurement_count Number of measurements
+   * @param pairs Gated pairs, in any order; their costs are not used
+   * @param count Number of pairs
+   * @return Number of pairs kept
+   */
+  size_t Solve(UKF *const *tracks, int track_count,
+               const Measurement *measurements, int measurement_count,
+               const GatedPair *pairs, size_t count);
+
+  /**
+   * Makes the combined update of every track with a kept pair
+   * @param tracks The filters given to Solve
+   * @return Number of tracks updated
+   */
+  int Dispatch(UKF *const *tracks);
+
+  ///* Per kept pair, after Solve: its track, measurement, NIS and beta
+  const std::vector<GatedPair> &pairs() const { return pairs_; }
+  const std::vector<double> &beta() const { return beta_; }
+
+  ///* Per track, the probability that none of its pairs is its own
+  const std::vector<double> &miss_probability() const { return miss_; }
+
+  ///* Clusters of the last Solve, and how many were enumerated exactly
+  int clusters() const { return clusters_; }
+  int exact_clusters() const { return exact_clusters_; }
+
+  const Options &options() const { return options_; }
+
+private:
+  // the front half of the unscented update of one track, kept for scoring
+  // its pairs and for its combined update; the leading dim_ rows are used
+  struct Prediction {
+    Eigen::Vector3d z;
+    Eigen::Matrix3d L;
+    Eigen::Matrix<double, UKF::n_x_, 3> K;
+    ///* log of 1 / sqrt((2 pi)^dim det S)
+    double log_norm;
+    bool valid;
+  };
+
+  // predictions and pair scores of tracks [begin, end)
+  void ScoreRange(UKF *const *tracks, const Measurement *measurements,
+                  int begin, int end);
+
+  // the betas of one cluster, from its joint events or from cheap JPDA
+  void SolveCluster(const int *cluster_tracks, int size);
+
+  // enumerates the joint events of the tracks from position k on
+  void Enumerate(const int *cluster_tracks, int size, int k, double weight);
+
+  // combined updates of tracks [begin, end)
+  void UpdateRange(UKF *const *tracks, int begin, int end);
+
+  // union-find root over tracks and measurements
+  int Root(int v);
+
+  Options options_;
+  ThreadPool *pool_;
+  MeasurementPackage::SensorType sensor_;
+  int dim_;
+  int tracks_;
+  int measurements_;
+  int clusters_;
+  int exact_clusters_;
+
+  // kept pairs bucketed by track
+  std::vector<int> track_start_;
+  std::vector<GatedPair> pairs_;
+  ///* per pair: innovation (3 per pair), likelihood ratio and beta
+  std::vector<double> innovation_;
+  std::vector<double> ratio_;
+  std::vector<double> beta_;
+  std::vector<double> miss_;
+  std::vector<Prediction> predictions_;
+
+  // cluster decomposition
+  std::vector<int> parent_;
+  std::vector<int> cluster_start_;
+  std::vector<int> cluster_tracks_;
+  std::vector<int> cluster_of_;
+
+  // workspace of one cluster
+  std::vector<char> used_;
+  std::vector<int> chosen_;
+  std::vector<double> sum_track_;
+  std::vector<double> sum_measurement_;
+  double total_;
+};
+
+#endif /* JPDA_H_ */
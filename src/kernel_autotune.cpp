@@ -0,0 +1,244 @@
+#include "kernel_autotune.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include "packed_symmetric.h"
+
+namespace {
+
+KernelAutotune::Origin g_origin = KernelAutotune::ORIGIN_DEFAULT;
+double g_timings[UkfKernels::KERNEL_COUNT][UkfKernels::ISA_COUNT];
+
+const char *const kOriginNames[] = {"default", "measured", "cached"};
+
+const char kCacheHeader[] = "# ukf kernel calibration v1";
+
+// a round is repeated until it takes this long, then timed kRounds times
+const double kRoundNs = 200e3;
+const int kRounds = 5;
+
+double NowNs() {
+  return static_cast<double>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// fastest of kRounds rounds, in ns per call of f
+template <typename F>
+double TimeNs(F f) {
+  long calls = 1;
+  for (;;) {
+    const double start = NowNs();
+    for (long c = 0; c < calls; c++) f();
+    if (NowNs() - start >= kRoundNs || calls >= (1L << 24)) break;
+    calls *= 2;
+  }
+  double best = 0.0;
+  for (int r = 0; r < kRounds; r++) {
+    const double start = NowNs();
+    for (long c = 0; c < calls; c++) f();
+    const double ns = (NowNs() - start) / calls;
+    if (r == 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+// identifies the host and the ISA cap, so a cache made elsewhere is ignored
+std::string HostKey() {
+  std::string model = "unknown";
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      const size_t colon = line.find(':');
+      if (colon != std::string::npos && colon + 2 <= line.size()) {
+        model = line.substr(colon + 2);
+      }
+      break;
+    }
+  }
+  return model + " / " + UkfKernels::Name(UkfKernels::Selected().isa);
+}
+
+std::string BatchKey(const std::vector<int> &batch_sizes) {
+  std::ostringstream key;
+  for (size_t i = 0; i < batch_sizes.size(); i++) {
+    key << (i ? " " : "") << batch_sizes[i];
+  }
+  return key.str();
+}
+
+// the choice saved for this host and these batch sizes, if any
+bool LoadCache(const char *path, const std::string &host,
+               const std::string &batches,
+               UkfKernels::Isa choice[UkfKernels::KERNEL_COUNT]) {
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line) || line != kCacheHeader ||
+      !std::getline(in, line) || line != "host " + host ||
+      !std::getline(in, line) || line != "batches " + batches) {
+    return false;
+  }
+  bool found[UkfKernels::KERNEL_COUNT] = {false};
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string kernel, isa;
+    if (!(fields >> kernel >> isa)) {
+      continue;
+    }
+    for (int k = 0; k < UkfKernels::KERNEL_COUNT; k++) {
+      if (kernel != UkfKernels::Name(UkfKernels::Kernel(k))) continue;
+      for (int i = 0; i < UkfKernels::ISA_COUNT; i++) {
+        //only ISAs this process may use
+        if (isa == UkfKernels::Name(UkfKernels::Isa(i)) &&
+            i <= UkfKernels::Selected().isa &&
+            UkfKernels::Get(UkfKernels::Isa(i))) {
+          choice[k] = UkfKernels::Isa(i);
+          found[k] = true;
+        }
+      }
+    }
+  }
+  for (int k = 0; k < UkfKernels::KERNEL_COUNT; k++) {
+    if (!found[k]) return false;
+  }
+  return true;
+}
+
+bool SaveCache(const char *path, const std::string &host,
+               const std::string &batches,
+               const UkfKernels::Isa choice[UkfKernels::KERNEL_COUNT]) {
+  //written aside and renamed, so a reader never sees half a file
+  const std::string tmp = std::string(path) + ".tmp";
+  {
+    std::ofstream out(tmp.c_str());
+    out << kCacheHeader << "\nhost " << host << "\nbatches " << batches
+        << "\n";
+    for (int k = 0; k < UkfKernels::KERNEL_COUNT; k++) {
+      out << UkfKernels::Name(UkfKernels::Kernel(k)) << " "
+          << UkfKernels::Name(choice[k]) << "\n";
+    }
+    if (!out) {
+      return false;
+    }
+  }
+  return rename(tmp.c_str(), path) == 0;
+}
+
+// times every kernel of one ISA's table into g_timings
+void Measure(const UkfKernels &kernels, const std::vector<int> &batch_sizes) {
+  typedef UKF::Scalar Scalar;
+  const int isa = kernels.isa;
+
+  //sigma points spread around a moving target, as after augmentation
+  UKF::AugSigmaMatrix Xsig_aug;
+  const Scalar mean[UKF::n_aug_] = {1.0, 1.0, 5.0, 0.5, 0.1, 0.0, 0.0};
+  for (int c = 0; c < UKF::n_sig_; c++) {
+    for (int r = 0; r < UKF::n_aug_; r++) {
+      Scalar offset = 0.0;
+      if (c >= 1 && c <= UKF::n_aug_ && r == c - 1) offset = 0.3;
+      if (c > UKF::n_aug_ && r == c - 1 - UKF::n_aug_) offset = -0.3;
+      Xsig_aug(r, c) = mean[r] + offset;
+    }
+  }
+  const UKF prototype;
+  UKF::SigmaMatrix Xsig_pred;
+  UKF::StateVector x;
+  UKF::StateMatrix P;
+  kernels.predict_ctrv(Xsig_aug, 0.05, &Xsig_pred);
+
+  g_timings[UkfKernels::PREDICT_CTRV][isa] = TimeNs([&]() {
+    kernels.predict_ctrv(Xsig_aug, 0.05, &Xsig_pred);
+  });
+  g_timings[UkfKernels::MEAN_AND_COVARIANCE][isa] = TimeNs([&]() {
+    kernels.mean_and_covariance(Xsig_pred, prototype.weights(),
+                                prototype.weights_c(), &x, &P);
+  });
+  g_timings[UkfKernels::PREDICT_CTRV_SIMPLEX][isa] = TimeNs([&]() {
+    kernels.predict_ctrv_simplex(Xsig_aug, 0.05, &Xsig_pred);
+  });
+  g_timings[UkfKernels::MEAN_AND_COVARIANCE_SIMPLEX][isa] = TimeNs([&]() {
+    kernels.mean_and_covariance_simplex(Xsig_pred, prototype.weights(),
+                                        prototype.weights_c(), &x, &P);
+  });
+
+  //per track, summed over the batch sizes so each counts equally
+  double cholesky = 0.0;
+  for (size_t b = 0; b < batch_sizes.size(); b++) {
+    typedef PackedSymmetric<UKF::n_x_> Packed;
+    const int n = batch_sizes[b];
+    std::vector<double> A(Packed::kSize * n), L(Packed::kSize * n);
+    for (int r = 0; r < UKF::n_x_; r++) {
+      for (int c = r; c < UKF::n_x_; c++) {
+        for (int i = 0; i < n; i++) {
+          A[Packed::Index(r, c) * n + i] = r == c ? 1.0 + 0.01 * (i % 7)
+                                                  : 0.1;
+        }
+      }
+    }
+    cholesky += TimeNs([&]() {
+      kernels.batched_cholesky(A.data(), L.data(), n, 0, n);
+    }) / n;
+  }
+  g_timings[UkfKernels::BATCHED_CHOLESKY][isa] = cholesky;
+}
+
+}  // namespace
+
+bool KernelAutotune::Run(const std::vector<int> &batch_sizes,
+                         const char *cache_path, std::string *error) {
+  std::vector<int> batches = batch_sizes;
+  if (batches.empty()) {
+    batches.push_back(1024);
+  }
+  const std::string host = HostKey();
+  const std::string batch_key = BatchKey(batches);
+
+  UkfKernels::Isa choice[UkfKernels::KERNEL_COUNT];
+  if (cache_path && LoadCache(cache_path, host, batch_key, choice)) {
+    for (int k = 0; k < UkfKernels::KERNEL_COUNT; k++) {
+      UkfKernels::Use(UkfKernels::Kernel(k), choice[k]);
+    }
+    g_origin = ORIGIN_CACHED;
+    return true;
+  }
+
+  //candidates are the ISAs up to the cap Selected() was chosen under
+  for (int i = 0; i <= UkfKernels::Selected().isa; i++) {
+    const UkfKernels *kernels = UkfKernels::Get(UkfKernels::Isa(i));
+    if (kernels) {
+      Measure(*kernels, batches);
+    }
+  }
+  for (int k = 0; k < UkfKernels::KERNEL_COUNT; k++) {
+    choice[k] = UkfKernels::BASELINE;
+    for (int i = 1; i <= UkfKernels::Selected().isa; i++) {
+      const double ns = g_timings[k][i];
+      if (ns > 0.0 && ns < g_timings[k][choice[k]]) {
+        choice[k] = UkfKernels::Isa(i);
+      }
+    }
+    UkfKernels::Use(UkfKernels::Kernel(k), choice[k]);
+  }
+  g_origin = ORIGIN_MEASURED;
+
+  if (cache_path && !SaveCache(cache_path, host, batch_key, choice)) {
+    *error = std::string("cannot write ") + cache_path;
+    return false;
+  }
+  return true;
+}
+
+KernelAutotune::Origin KernelAutotune::origin() {
+  return g_origin;
+}
+
+const char *KernelAutotune::Name(Origin origin) {
+  return kOriginNames[origin];
+}
+
+double KernelAutotune::Timing(UkfKernels::Kernel kernel,
+                              UkfKernels::Isa isa) {
+  return g_timings[kernel][isa];
+}
@@ -0,0 +1,56 @@
+#ifndef KERNEL_AUTOTUNE_H_
+#define KERNEL_AUTOTUNE_H_
+
+#include <string>
+#include <vector>
+#include "ukf_kernels.h"
+
+/**
+ * Startup calibration of the ISA versions of UkfKernels. The widest ISA is
+ * not always the fastest: AVX-512 may lower the clock, and a 5x5 kernel can
+ * be too short to pay for the wider registers. Run times every version of
+ * every kernel the build and CPU have (up to the UKF_KERNEL_ISA cap) on
+ * synthetic sigma points and covariances, batched_cholesky at each of the
+ * given bank sizes, and makes the fastest of each the one Selected() uses.
+ *
+ * The choice can be cached in a small text file keyed by the CPU model and
+ * the batch sizes, so later starts on the same host skip the few tens of
+ * milliseconds the measurements take. All versions give the same results,
+ * so the choice only changes speed.
+ */
+class KernelAutotune {
+public:
+  enum Origin {
+    ///* no calibration ran; Selected() is the widest ISA
+    ORIGIN_DEFAULT,
+    ///* measured at this start
+    ORIGIN_MEASURED,
+    ///* read from the cache file
+    ORIGIN_CACHED
+  };
+
+  /**
+   * Calibrates and applies the choice
+   * @param batch_sizes Tracks per UKFBank call to time batched_cholesky at;
+   * empty for 1024
+   * @param cache_path File to read the choice from and write it to, or
+   * null to measure every time
+   * @param error Set when the cache could not be written; the choice is
+   * applied anyway
+   * @return false if the cache could not be written
+   */
+  static bool Run(const std::vector<int> &batch_sizes, const char *cache_path,
+                  std::string *error);
+
+  ///* how the kernels of Selected() were chosen
+  static Origin origin();
+  static const char *Name(Origin origin);
+
+  /**
+   * Nanoseconds per call of one version of a kernel in the last
+   * measurement (per track for batched_cholesky); 0 if it was not timed
+   */
+  static double Timing(UkfKernels::Kernel kernel, UkfKernels::Isa isa);
+};
+
+#endif /* KERNEL_AUTOTUNE_H_ */
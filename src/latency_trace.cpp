@@ -0,0 +1,199 @@
+#include "latency_trace.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include "seqlock.h"
+#include "thread_shards.h"
+
+const int LatencyTrace::kTraces;
+
+thread_local LatencyTrace::Stamps *LatencyTrace::current_ = nullptr;
+
+namespace {
+
+// recorded by every event loop that sends replies
+struct alignas(64) TraceShard {
+  LatencyHistogram receive_to_send;
+  LatencyHistogram sensor_age;
+};
+
+std::atomic<unsigned> g_sampling(0);
+std::atomic<unsigned> g_sample_counter(0);
+
+struct Trace {
+  LatencyTrace::Stamps stamps;
+  unsigned long long session;
+  ///* claim number of the slot's write, so readers skip stale slots
+  unsigned long long claim;
+};
+
+// a ring slot; busy keeps a second writer out of its seqlock after a wrap
+struct alignas(64) TraceSlot {
+  std::atomic<bool> busy;
+  Seqlock<Trace> trace;
+};
+
+TraceSlot g_traces[LatencyTrace::kTraces];
+// slots claimed so far, and the first claim after the last Reset
+std::atomic<unsigned long long> g_trace_next(0);
+std::atomic<unsigned long long> g_trace_base(0);
+std::atomic<unsigned long long> g_traces_dropped(0);
+
+const char *const kPointNames[LatencyTrace::kPointCount] = {
+  "received", "parse", "queue", "wait", "predict", "update", "serialize",
+  "send"
+};
+
+long long SystemNowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+long long LatencyTrace::NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyTrace::Begin(Stamps *stamps) {
+  for (int p = 0; p < kPointCount; p++) {
+    stamps->ns[p] = 0;
+  }
+  stamps->ns[RECEIVED] = NowNs();
+  stamps->timestamp = 0;
+  stamps->track_id = 0;
+  stamps->steps = 0;
+  stamps->sigma_points = 0;
+  stamps->repairs = 0;
+  const unsigned every = g_sampling.load(std::memory_order_relaxed);
+  stamps->sampled = every > 0 &&
+      g_sample_counter.fetch_add(1, std::memory_order_relaxed) % every == 0;
+}
+
+void LatencyTrace::End(const Stamps &stamps, unsigned long long session,
+                       long long now_ns) {
+  if (stamps.ns[RECEIVED] == 0) {
+    return;
+  }
+  if (now_ns == 0) {
+    now_ns = NowNs();
+  }
+  TraceShard *shard = ThreadShards<TraceShard>::Local();
+  if (shard && now_ns >= stamps.ns[RECEIVED]) {
+    shard->receive_to_send.RecordOwned(now_ns - stamps.ns[RECEIVED]);
+  }
+  //a sensor clock ahead of the host's gives no sample rather than a bogus one
+  const long long age_us = SystemNowUs() - stamps.timestamp;
+  if (shard && age_us >= 0) {
+    shard->sensor_age.RecordOwned(static_cast<unsigned long long>(age_us) *
+                                  1000);
+  }
+  if (!stamps.sampled) {
+    return;
+  }
+  const unsigned long long claim =
+      g_trace_next.fetch_add(1, std::memory_order_relaxed);
+  TraceSlot &slot = g_traces[claim % kTraces];
+  if (slot.busy.exchange(true, std::memory_order_acquire)) {
+    g_traces_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Trace trace;
+  trace.stamps = stamps;
+  trace.stamps.ns[SENT] = now_ns;
+  trace.session = session;
+  trace.claim = claim;
+  slot.trace.Store(trace);
+  slot.busy.store(false, std::memory_order_release);
+}
+
+void LatencyTrace::EndAll(std::vector<Stamps> *stamps,
+                          unsigned long long session) {
+  if (stamps->empty()) {
+    return;
+  }
+  const long long now_ns = NowNs();
+  for (size_t i = 0; i < stamps->size(); i++) {
+    End((*stamps)[i], session, now_ns);
+  }
+  stamps->clear();
+}
+
+void LatencyTrace::SetSampling(unsigned every) {
+  g_sampling.store(every, std::memory_order_relaxed);
+}
+
+void LatencyTrace::ReceiveToSend(LatencyHistogram *out) {
+  out->Reset();
+  ThreadShards<TraceShard>::ForEach([out](const TraceShard &shard) {
+    out->Merge(shard.receive_to_send);
+  });
+}
+
+void LatencyTrace::SensorAge(LatencyHistogram *out) {
+  out->Reset();
+  ThreadShards<TraceShard>::ForEach([out](const TraceShard &shard) {
+    out->Merge(shard.sensor_age);
+  });
+}
+
+std::string LatencyTrace::DumpTraces() {
+  std::string out;
+  char line[96];
+  out += "session track timestamp";
+  for (int p = PARSED; p < kPointCount; p++) {
+    out += ' ';
+    out += kPointNames[p];
+  }
+  out += " total (ns) steps sigma_points repairs\n";
+
+  //claims still being written, or overwritten since, are skipped
+  const unsigned long long next = g_trace_next.load(std::memory_order_acquire);
+  unsigned long long first = g_trace_base.load(std::memory_order_relaxed);
+  if (next - first > static_cast<unsigned long long>(kTraces)) {
+    first = next - kTraces;
+  }
+  Trace trace;
+  for (unsigned long long claim = first; claim < next; claim++) {
+    g_traces[claim % kTraces].trace.Load(&trace);
+    if (trace.claim != claim || trace.stamps.ns[RECEIVED] == 0) {
+      continue;
+    }
+    const long long *ns = trace.stamps.ns;
+    snprintf(line, sizeof(line), "%llu %u %lld", trace.session,
+             trace.stamps.track_id, trace.stamps.timestamp);
+    out += line;
+    //each stage is timed from the last point the measurement passed, so
+    //an inline measurement shows '-' for the queue and the wait
+    long long last = ns[RECEIVED];
+    for (int p = PARSED; p < kPointCount; p++) {
+      if (ns[p] == 0) {
+        out += " -";
+        continue;
+      }
+      snprintf(line, sizeof(line), " %lld", ns[p] - last);
+      out += line;
+      last = ns[p];
+    }
+    snprintf(line, sizeof(line), " %lld %u %u %u\n", ns[SENT] - ns[RECEIVED],
+             trace.stamps.steps, trace.stamps.sigma_points,
+             trace.stamps.repairs);
+    out += line;
+  }
+  return out;
+}
+
+void LatencyTrace::Reset() {
+  ThreadShards<TraceShard>::ForEachMutable([](TraceShard *shard) {
+    shard->receive_to_send.Reset();
+    shard->sensor_age.Reset();
+  });
+  g_trace_base.store(g_trace_next.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+  g_traces_dropped.store(0, std::memory_order_relaxed);
+}
+
+unsigned long long LatencyTrace::DroppedTraces() {
+  return g_traces_dropped.load(std::memory_order_relaxed);
+}
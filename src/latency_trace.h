@@ -0,0 +1,183 @@
+#ifndef LATENCY_TRACE_H_
+#define LATENCY_TRACE_H_
+
+#include <string>
+#include <vector>
+#include "stage_timing.h"
+#include "time_base.h"
+
+/**
+ * End-to-end latency of each measurement through the server. A measurement
+ * is stamped with the steady clock when its frame is received and carries
+ * the stamps through parsing, the pipeline and serialisation to the send
+ * of the frame with its reply, where two process-wide histograms get a
+ * sample:
+ *
+ *   receive-to-send  what the server adds, from the frame arriving to its
+ *                    reply being handed to the socket
+ *   sensor age       the reply's send time on the system clock minus the
+ *                    measurement's own timestamp; only meaningful when the
+ *                    sensor clock is the host's (epoch microseconds)
+ *
+ * Those two cost a clock read at each end and are always on. With
+ * SetSampling, one measurement in every n also has every stage boundary
+ * stamped, and is kept as a trace in a ring of the last kTraces. While its
+ * filter runs (Enter to Leave) the filter adds what it did: the end of its
+ * prediction, the prediction's sub-steps and sigma points, and the
+ * covariance repairs (Cholesky fallbacks) of the update. An unsampled
+ * measurement pays a thread-local test per filter step for that.
+ *
+ * The ring is lock-free: a finished trace claims the next slot with one
+ * atomic increment and is written under the slot's Seqlock, so the threads
+ * sending replies never wait for each other or for a reader, which copies
+ * each slot out consistently. A trace that finds its slot still being
+ * written, after the ring wrapped under it, is dropped.
+ *
+ * Unlike StageTimings, which times each stage on its own, this follows one
+ * measurement, so the time it spends queued between stages is counted.
+ */
+class LatencyTrace {
+public:
+  ///* stage boundaries, in the order a measurement passes them
+  enum Point {
+    RECEIVED,
+    PARSED,
+    ///* pipelined only: handed to, and taken up by, the worker
+    QUEUED,
+    STARTED,
+    ///* the filter's prediction done, and its update
+    PREDICTED,
+    FILTERED,
+    SERIALIZED,
+    SENT,
+    kPointCount
+  };
+
+  static const int kTraces = 1024;
+
+  ///* The stamps one measurement carries
+  struct Stamps {
+    ///* steady clock in ns at each point; only RECEIVED unless sampled
+    long long ns[kPointCount];
+    ///* the measurement's timestamp and track
+    TimeUs timestamp;
+    unsigned track_id;
+    ///* every point is stamped and the measurement is kept as a trace
+    bool sampled;
+    ///* the filter's work when sampled: prediction sub-steps, sigma points
+    ///* propagated in each (0 for EKF or mean-only steps), and covariance
+    ///* repairs, each saturating at 255
+    unsigned char steps;
+    unsigned char sigma_points;
+    unsigned char repairs;
+  };
+
+  static long long NowNs();
+
+  /**
+   * Starts the stamps of a frame received now, deciding whether it is
+   * sampled; every measurement of the frame gets a copy
+   * @param stamps Stamps to start
+   */
+  static void Begin(Stamps *stamps);
+
+  /**
+   * Stamps a point of a sampled measurement; nothing otherwise
+   */
+  static void Stamp(Stamps *stamps, Point point) {
+    if (stamps->sampled) {
+      stamps->ns[point] = NowNs();
+    }
+  }
+
+  /**
+   * Makes a sampled measurement's stamps the calling thread's current ones
+   * while its filter runs, for Predicted and Repaired; nothing for an
+   * unsampled one. Leave must follow before the stamps move.
+   */
+  static void Enter(Stamps *stamps) {
+    if (stamps->sampled) {
+      current_ = stamps;
+    }
+  }
+  static void Leave() { current_ = nullptr; }
+
+  ///* a sampled measurement is being filtered on this thread
+  static bool Tracing() { return current_ != nullptr; }
+
+  /**
+   * From the filter, for the current measurement: stamps PREDICTED and
+   * records the prediction's cost
+   * @param steps Sub-steps predicted
+   * @param sigma_points Sigma points propagated in each
+   */
+  static void Predicted(int steps, int sigma_points) {
+    if (current_) {
+      current_->ns[PREDICTED] = NowNs();
+      current_->steps = Saturate(steps);
+      current_->sigma_points = Saturate(sigma_points);
+    }
+  }
+
+  /**
+   * Adds covariance repairs to the current measurement's trace
+   */
+  static void Repaired(unsigned long long repairs) {
+    if (current_) {
+      current_->repairs = Saturate(current_->repairs + repairs);
+    }
+  }
+
+  /**
+   * Records a measurement whose reply was just sent
+   * @param stamps Its stamps; the timestamp must be set
+   * @param session Id of its session, for the trace
+   * @param now_ns Steady clock of the send, 0 to read it
+   */
+  static void End(const Stamps &stamps, unsigned long long session,
+                  long long now_ns = 0);
+
+  /**
+   * Records the measurements of a frame just sent, and clears them
+   * @param stamps Their stamps
+   * @param session Id of their session
+   */
+  static void EndAll(std::vector<Stamps> *stamps, unsigned long long session);
+
+  /**
+   * Keeps a trace of one measurement in every n
+   * @param every Sampling period; 0 for none
+   */
+  static void SetSampling(unsigned every);
+
+  /**
+   * Receive-to-send and sensor-age samples of every thread, merged from
+   * the threads' own histograms
+   * @param out Receives them, replacing what it held
+   */
+  static void ReceiveToSend(LatencyHistogram *out);
+  static void SensorAge(LatencyHistogram *out);
+
+  /**
+   * The kept traces, oldest first: one line each with the session, track
+   * and timestamp, the ns spent in each stage and the filter's work
+   */
+  static std::string DumpTraces();
+
+  ///* sampled traces dropped because their ring slot was busy
+  static unsigned long long DroppedTraces();
+
+  static void Reset();
+
+private:
+  // a count in a Stamps byte, held at 255 rather than wrapping
+  template <typename T>
+  static unsigned char Saturate(T count) {
+    return static_cast<unsigned char>(count < 255 ? count : 255);
+  }
+
+  ///* stamps of the sampled measurement being filtered on this thread
+  static thread_local Stamps *current_;
+};
+
+#endif /* LATENCY_TRACE_H_ */
@@ -0,0 +1,240 @@
+#include "lidar_clustering.h"
+#include <algorithm>
+#include <cmath>
+#include "thread_pool.h"
+
+namespace {
+
+// cells further out than this are treated as invalid points, so the cell
+// coordinates relative to the scan's lowest cell always fit in 32 bits
+const double kMaxCell = 1 << 30;
+
+// key of non-finite or far-off points, dropped before the sort
+const uint64_t kInvalidKey = ~uint64_t(0);
+
+// stable LSD radix sort of (key, index) pairs by key, one pass per byte of
+// the key that is not the same in every pair; the cells of one scan span a
+// small range, so that is typically 2 to 4 passes
+void RadixSort(std::vector<std::pair<uint64_t, uint32_t> > *items,
+               std::vector<std::pair<uint64_t, uint32_t> > *scratch) {
+  const size_t n = items->size();
+  if (n < 2) {
+    return;
+  }
+  uint64_t all_or = 0, all_and = ~uint64_t(0);
+  for (size_t i = 0; i < n; i++) {
+    all_or |= (*items)[i].first;
+    all_and &= (*items)[i].first;
+  }
+  const uint64_t varying = all_or ^ all_and;
+  scratch->resize(n);
+  for (int shift = 0; shift < 64; shift += 8) {
+    if (((varying >> shift) & 0xff) == 0) {
+      continue;
+    }
+    size_t offsets[256] = {0};
+    for (size_t i = 0; i < n; i++) {
+      ++offsets[((*items)[i].first >> shift) & 0xff];
+    }
+    size_t total = 0;
+    for (int d = 0; d < 256; d++) {
+      const size_t count = offsets[d];
+      offsets[d] = total;
+      total += count;
+    }
+    for (size_t i = 0; i < n; i++) {
+      (*scratch)[offsets[((*items)[i].first >> shift) & 0xff]++] =
+          (*items)[i];
+    }
+    items->swap(*scratch);
+  }
+}
+
+// runs body over [0, n) on the pool, or on the calling thread without one
+template <typename Body>
+void ForRange(ThreadPool *pool, size_t n, int grain, const Body &body) {
+  if (!pool || n <= static_cast<size_t>(grain)) {
+    body(0, static_cast<int>(n));
+    return;
+  }
+  pool->ParallelFor(0, static_cast<int>(n), grain, body);
+}
+
+}  // namespace
+
+LidarClusterer::LidarClusterer(const Options &options)
+    : options_(options), pool_(nullptr), origin_x_(0), origin_y_(0) {
+  if (!(options_.voxel_size > 0.0)) {
+    options_.voxel_size = Options().voxel_size;
+  }
+  if (options_.grain < 1) {
+    options_.grain = 1;
+  }
+}
+
+LidarClusterer::~LidarClusterer() {}
+
+uint64_t LidarClusterer::Key(int64_t cx, int64_t cy) const {
+  //cells below the origin wrap to keys no voxel has
+  return (static_cast<uint64_t>(cx - origin_x_) << 32) |
+         static_cast<uint64_t>(static_cast<uint32_t>(cy - origin_y_));
+}
+
+int LidarClusterer::Find(uint64_t key) const {
+  auto it = std::lower_bound(voxel_keys_.begin(), voxel_keys_.end(), key);
+  if (it == voxel_keys_.end() || *it != key) {
+    return -1;
+  }
+  return static_cast<int>(it - voxel_keys_.begin());
+}
+
+int LidarClusterer::Root(int v) {
+  while (parent_[v] != v) {
+    parent_[v] = parent_[parent_[v]];
+    v = parent_[v];
+  }
+  return v;
+}
+
+size_t LidarClusterer::Process(const double *points, size_t n,
+                               TimeUs timestamp,
+                               std::vector<Measurement> *measurements,
+                               std::vector<Cluster> *clusters) {
+  //keys count cells from the scan's lowest one, so only their low bytes
+  //vary and the radix sort makes few passes
+  const double inv = 1.0 / options_.voxel_size;
+  double low_x = kMaxCell, low_y = kMaxCell;
+  for (size_t i = 0; i < n; i++) {
+    const double cx = std::floor(points[2 * i] * inv);
+    const double cy = std::floor(points[2 * i + 1] * inv);
+    if (std::fabs(cx) < kMaxCell && std::fabs(cy) < kMaxCell) {
+      low_x = std::min(low_x, cx);
+      low_y = std::min(low_y, cy);
+    }
+  }
+  origin_x_ = static_cast<int64_t>(low_x);
+  origin_y_ = static_cast<int64_t>(low_y);
+
+  //cell keys, one flat loop per chunk of points
+  keyed_.resize(n);
+  ForRange(pool_, n, options_.grain, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const double cx = std::floor(points[2 * i] * inv);
+      const double cy = std::floor(points[2 * i + 1] * inv);
+      //false for NaN as well
+      const bool valid = std::fabs(cx) < kMaxCell && std::fabs(cy) < kMaxCell;
+      keyed_[i].first = valid ? Key(static_cast<int64_t>(cx),
+                                    static_cast<int64_t>(cy))
+                              : kInvalidKey;
+      keyed_[i].second = static_cast<uint32_t>(i);
+    }
+  });
+  keyed_.erase(std::remove_if(keyed_.begin(), keyed_.end(),
+                              [](const std::pair<uint64_t, uint32_t> &k) {
+                                return k.first == kInvalidKey;
+                              }),
+               keyed_.end());
+  RadixSort(&keyed_, &sorted_);
+
+  //one voxel per run of equal keys
+  voxels_.clear();
+  voxel_keys_.clear();
+  for (size_t i = 0; i < keyed_.size(); i++) {
+    const double x = points[2 * keyed_[i].second];
+    const double y = points[2 * keyed_[i].second + 1];
+    if (voxels_.empty() || voxels_.back().key != keyed_[i].first) {
+      Voxel voxel = {keyed_[i].first, 0.0, 0.0, x, y, x, y, 0};
+      voxels_.push_back(voxel);
+      voxel_keys_.push_back(keyed_[i].first);
+    }
+    Voxel &voxel = voxels_.back();
+    voxel.sum_x += x;
+    voxel.sum_y += y;
+    voxel.min_x = std::min(voxel.min_x, x);
+    voxel.min_y = std::min(voxel.min_y, y);
+    voxel.max_x = std::max(voxel.max_x, x);
+    voxel.max_y = std::max(voxel.max_y, y);
+    ++voxel.points;
+  }
+  const size_t m = voxels_.size();
+
+  //the 4 neighbours that sort before each voxel; the other 4 find it
+  links_.resize(4 * m);
+  ForRange(pool_, m, options_.grain, [&](int begin, int end) {
+    for (int v = begin; v < end; v++) {
+      const uint64_t key = voxel_keys_[v];
+      const int64_t cx = static_cast<int64_t>(key >> 32) + origin_x_;
+      const int64_t cy = static_cast<int64_t>(key & 0xffffffffu) + origin_y_;
+      links_[4 * v] = Find(Key(cx - 1, cy - 1));
+      links_[4 * v + 1] = Find(Key(cx - 1, cy));
+      links_[4 * v + 2] = Find(Key(cx - 1, cy + 1));
+      links_[4 * v + 3] = Find(Key(cx, cy - 1));
+    }
+  });
+
+  //connected components, each rooted at its lowest voxel
+  parent_.resize(m);
+  for (size_t v = 0; v < m; v++) {
+    parent_[v] = static_cast<int>(v);
+  }
+  for (size_t v = 0; v < m; v++) {
+    for (int k = 0; k < 4; k++) {
+      const int u = links_[4 * v + k];
+      if (u < 0) {
+        continue;
+      }
+      const int a = Root(static_cast<int>(v));
+      const int b = Root(u);
+      if (a != b) {
+        parent_[std::max(a, b)] = std::min(a, b);
+      }
+    }
+  }
+
+  //sum the voxels of each component, in voxel order
+  cluster_of_.resize(m);
+  found_.clear();
+  for (size_t v = 0; v < m; v++) {
+    const int root = Root(static_cast<int>(v));
+    const Voxel &voxel = voxels_[v];
+    if (root == static_cast<int>(v)) {
+      cluster_of_[v] = static_cast<int>(found_.size());
+      Cluster cluster = {0.0, 0.0, voxel.min_x, voxel.min_y,
+                         voxel.max_x, voxel.max_y, 0};
+      found_.push_back(cluster);
+    }
+    else {
+      cluster_of_[v] = cluster_of_[root];
+    }
+    Cluster &cluster = found_[cluster_of_[v]];
+    cluster.x += voxel.sum_x;
+    cluster.y += voxel.sum_y;
+    cluster.min_x = std::min(cluster.min_x, voxel.min_x);
+    cluster.min_y = std::min(cluster.min_y, voxel.min_y);
+    cluster.max_x = std::max(cluster.max_x, voxel.max_x);
+    cluster.max_y = std::max(cluster.max_y, voxel.max_y);
+    cluster.points += voxel.points;
+  }
+
+  size_t emitted = 0;
+  for (size_t c = 0; c < found_.size(); c++) {
+    Cluster &cluster = found_[c];
+    if (cluster.points < options_.min_points) {
+      continue;
+    }
+    cluster.x /= cluster.points;
+    cluster.y /= cluster.points;
+    Measurement meas;
+    meas.timestamp_ = timestamp;
+    meas.sensor_type_ = MeasurementPackage::LASER;
+    meas.values_[0] = cluster.x;
+    meas.values_[1] = cluster.y;
+    meas.values_[2] = 0.0;
+    measurements->push_back(meas);
+    if (clusters) {
+      clusters->push_back(cluster);
+    }
+    ++emitted;
+  }
+  return emitted;
+}
@@ -0,0 +1,120 @@
+#ifndef LIDAR_CLUSTERING_H_
+#define LIDAR_CLUSTERING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "measurement_package.h"
+
+class ThreadPool;
+
+/**
+ * Lidar front-end: turns a raw scan of (x, y) points into one LASER
+ * measurement per object, the centroid of a cluster of points, so the
+ * filter can be fed from a point cloud at sensor rate.
+ *
+ * Points are binned into square voxels, and voxels that touch (the 8
+ * neighbours of each) form one cluster. The voxels come from sorting the
+ * points by a 64-bit cell key (a radix sort) rather than from a hash map,
+ * so each stage is a flat loop over arrays: the keys and the neighbour
+ * lookups run in parallel on a pool if one is set, the sort and the
+ * union-find on the calling thread. The voxel size is the largest gap
+ * bridged inside an object, so it should be above the point spacing on the
+ * farthest targets and below the gap between objects.
+ *
+ * Each call reuses the workspace of the last one, so once it has seen a
+ * scan of the largest size it allocates nothing (beyond the pool's task
+ * hand-off when one is set). The clusters come out in the order of their
+ * lowest voxel, the same for any thread count.
+ */
+class LidarClusterer {
+public:
+  struct Options {
+    ///* voxel edge in m
+    double voxel_size;
+    ///* clusters with fewer points are dropped as clutter
+    int min_points;
+    ///* points, and voxels, per parallel chunk
+    int grain;
+
+    Options() : voxel_size(0.3), min_points(3), grain(8192) {}
+  };
+
+  struct Cluster {
+    ///* centroid in m
+    double x;
+    double y;
+    ///* bounding box in m
+    double min_x;
+    double min_y;
+    double max_x;
+    double max_y;
+    int points;
+  };
+
+  explicit LidarClusterer(const Options &options = Options());
+
+  virtual ~LidarClusterer();
+
+  /**
+   * Runs the parallel stages on a pool
+   * @param pool Pool to use, or nullptr for the calling thread
+   */
+  void SetThreadPool(ThreadPool *pool) { pool_ = pool; }
+
+  /**
+   * Clusters one scan
+   * @param points n (x, y) pairs, interleaved, in m
+   * @param n Number of points; non-finite ones are skipped
+   * @param timestamp Scan time in us, given to every measurement
+   * @param measurements One LASER measurement per cluster (appended)
+   * @param clusters If not null, the clusters behind them (appended)
+   * @return Number of clusters
+   */
+  size_t Process(const double *points, size_t n, TimeUs timestamp,
+                 std::vector<Measurement> *measurements,
+                 std::vector<Cluster> *clusters = nullptr);
+
+  const Options &options() const { return options_; }
+
+private:
+  // one occupied voxel: its key and the sums of its points
+  struct Voxel {
+    uint64_t key;
+    double sum_x;
+    double sum_y;
+    double min_x;
+    double min_y;
+    double max_x;
+    double max_y;
+    int points;
+  };
+
+  // key of the voxel at cell (cx, cy); sorts by cx, then cy
+  uint64_t Key(int64_t cx, int64_t cy) const;
+
+  // index of the voxel with a key, or -1
+  int Find(uint64_t key) const;
+
+  // union-find root of a voxel, with path halving
+  int Root(int v);
+
+  Options options_;
+  ThreadPool *pool_;
+  ///* lowest cell of the scan, key (0, 0)
+  int64_t origin_x_;
+  int64_t origin_y_;
+
+  // workspace, kept between scans; the sort swaps keyed_ and sorted_
+  std::vector<std::pair<uint64_t, uint32_t> > keyed_;
+  std::vector<std::pair<uint64_t, uint32_t> > sorted_;
+  std::vector<Voxel> voxels_;
+  std::vector<uint64_t> voxel_keys_;
+  ///* up to 4 earlier neighbours of each voxel, -1 for none
+  std::vector<int> links_;
+  std::vector<int> parent_;
+  std::vector<int> cluster_of_;
+  std::vector<Cluster> found_;
+};
+
+#endif /* LIDAR_CLUSTERING_H_ */
@@ -0,0 +1,546 @@
+// Load generator for the UKF server: opens many WebSocket connections,
+// streams synthetic Socket.IO telemetry frames on each and measures the
+// round trip to the matching estimate_marker reply.
+//
+//   ukf_loadgen [--url ws://localhost:4567] [--connections 16]
+//               [--rate <frames/s per connection>] [--duration 10]
+//               [--compression off|shared|sliding] [--json <path>]
+//               [--replay <log> [--speed 1] [--loop] [--progress <s>]]
+//
+// With --rate 0 (the default) every connection is closed loop: it sends the
+// next frame as soon as the previous reply arrives, which finds the maximum
+// sustainable rate. With a rate, frames are sent on a 1 ms timer whether or
+// not replies have come back, which shows the latency at that load.
+// Prints p50/p99/p999/max latency and the achieved replies per second.
+// --compression offers permessage-deflate to the server, to measure what
+// it costs on these small frames. --json also writes the run as a
+// BenchReport with one sample per second of p50/p99/p999 latency and
+// throughput, for ukf_bench --compare.
+//
+// --replay sends the measurements of a log (simulator text or .ukfm) on
+// every connection instead, paced by their timestamps: at --speed 1 a
+// measurement goes out when as much wall time has passed since the start
+// as sensor time since the log's first one, at --speed 10 ten times
+// sooner. The run ends with the log and its last replies, or after
+// --duration if given. --loop starts the log over when it ends, its
+// timestamps shifted on so the server sees time go on (each lap's target
+// jumps back to its start), for soak tests as long as --duration. For
+// those, --progress prints the latency and throughput of every interval of
+// that many seconds, which are then all that is kept of its latencies, so
+// memory stays flat however long the run; the summary and --json then give
+// the intervals.
+
+#include <uWS/uWS.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include "bench_report.h"
+#include "binary_log.h"
+#include "log_reader.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+  std::string url;
+  int connections;
+  double rate;
+  double duration;
+  // uWS extension options offered in the handshake
+  int extensions;
+  // BenchReport output, null for none
+  const char *json_path;
+  // log to replay, null for the synthetic feed
+  const char *replay_path;
+  double speed;
+  bool loop;
+  // interval of the progress lines in s, 0 for none
+  double progress;
+};
+
+// one simulated feed: a target on a circle, measured alternately by lidar
+// and radar every 50 ms of simulated time
+struct Client {
+  uWS::WebSocket<uWS::CLIENT> ws;
+  bool open;
+  long long index;
+  double phase;
+  // send times of frames still waiting for their reply, oldest first; the
+  // server answers each connection in order
+  std::deque<Clock::time_point> in_flight;
+  // frames owed under the open-loop rate
+  double credit;
+  // replay: next record and laps of the log completed
+  size_t next;
+  long long lap;
+  char frame[256];
+};
+
+// one --progress interval
+struct Interval {
+  double end_s;
+  double p50;
+  double p99;
+  double p999;
+  double max;
+  unsigned long long replies;
+  double replies_per_s;
+};
+
+struct Run {
+  Options options;
+  std::vector<Client *> clients;
+  std::vector<double> latencies_us;
+  // second of the run each latency was measured in
+  std::vector<int> latency_seconds;
+  unsigned long long sent;
+  unsigned long long received;
+  unsigned long long errors;
+  Clock::time_point start;
+  Clock::time_point last_tick;
+  bool done;
+  // --replay: the log, its first timestamp, and the shift of one lap
+  std::vector<LogRecord> log;
+  long long log_start;
+  long long lap_us;
+  // when the log ran out, for the grace time of the last replies
+  Clock::time_point log_done;
+  bool log_finished;
+  // --progress: the intervals so far; latencies_us only holds the open one
+  std::vector<Interval> intervals;
+  Clock::time_point interval_start;
+  unsigned long long interval_received;
+};
+
+// longest the run waits for the replies to the end of a log, in s
+const double kReplayGraceS = 2.0;
+
+// formats the next telemetry frame of a client into its buffer
+size_t NextFrame(Client *c) {
+  double t = 0.05 * c->index;
+  double w = 0.2;
+  double px = 10.0 * cos(w * t + c->phase);
+  double py = 10.0 * sin(w * t + c->phase);
+  double vx = -10.0 * w * sin(w * t + c->phase);
+  double vy = 10.0 * w * cos(w * t + c->phase);
+  long long ts = 1477010443000000LL + 50000LL * c->index;
+  int n;
+  if (c->index % 2 == 0) {
+    n = snprintf(c->frame, sizeof(c->frame),
+                 "42[\"telemetry\",{\"sensor_measurement\":"
+                 "\"L\\t%.6f\\t%.6f\\t%lld\\t%.6f\\t%.6f\\t%.6f\\t%.6f\"}]",
+                 px, py, ts, px, py, vx, vy);
+  }
+  else {
+    double rho = sqrt(px * px + py * py);
+    n = snprintf(c->frame, sizeof(c->frame),
+                 "42[\"telemetry\",{\"sensor_measurement\":"
+                 "\"R\\t%.6f\\t%.6f\\t%.6f\\t%lld\\t%.6f\\t%.6f\\t%.6f\\t%.6f\"}]",
+                 rho, atan2(py, px), (px * vx + py * vy) / rho, ts, px, py,
+                 vx, vy);
+  }
+  c->index++;
+  return static_cast<size_t>(n);
+}
+
+// formats a log record as a telemetry frame, at a shifted timestamp
+size_t ReplayFrame(const LogRecord &r, long long ts, char *frame,
+                   size_t size) {
+  const Measurement &m = r.meas;
+  const double *gt = r.ground_truth;
+  int n;
+  if (m.sensor_type_ == MeasurementPackage::LASER) {
+    n = snprintf(frame, size,
+                 "42[\"telemetry\",{\"sensor_measurement\":"
+                 "\"L\\t%.10g\\t%.10g\\t%lld\\t%.10g\\t%.10g\\t%.10g"
+                 "\\t%.10g\"}]",
+                 m.values_[0], m.values_[1], ts, gt[0], gt[1], gt[2], gt[3]);
+  }
+  else {
+    n = snprintf(frame, size,
+                 "42[\"telemetry\",{\"sensor_measurement\":"
+                 "\"R\\t%.10g\\t%.10g\\t%.10g\\t%lld\\t%.10g\\t%.10g"
+                 "\\t%.10g\\t%.10g\"}]",
+                 m.values_[0], m.values_[1], m.values_[2], ts, gt[0], gt[1],
+                 gt[2], gt[3]);
+  }
+  return static_cast<size_t>(n);
+}
+
+void SendFrame(Run *run, Client *c, size_t n) {
+  c->in_flight.push_back(Clock::now());
+  c->ws.send(c->frame, n, uWS::OpCode::TEXT);
+  run->sent++;
+}
+
+void Send(Run *run, Client *c) {
+  SendFrame(run, c, NextFrame(c));
+}
+
+// sends the records of the log due by sensor time offset_us into the
+// replay; false once a client without --loop has sent them all
+bool Replay(Run *run, Client *c, double offset_us) {
+  const std::vector<LogRecord> &log = run->log;
+  while (true) {
+    if (c->next == log.size()) {
+      if (!run->options.loop) {
+        return false;
+      }
+      c->next = 0;
+      c->lap++;
+    }
+    const LogRecord &r = log[c->next];
+    const long long shift = c->lap * run->lap_us;
+    if (static_cast<double>(r.meas.timestamp_ - run->log_start + shift) >
+        offset_us) {
+      return true;
+    }
+    SendFrame(run, c, ReplayFrame(r, r.meas.timestamp_ + shift, c->frame,
+                                  sizeof(c->frame)));
+    c->next++;
+  }
+}
+
+double Percentile(const std::vector<double> &sorted, double q) {
+  if (sorted.empty()) return 0.0;
+  size_t i = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+// ends a --progress interval: prints and keeps its statistics and drops
+// its latencies
+void CloseInterval(Run *run, Clock::time_point now) {
+  std::vector<double> &l = run->latencies_us;
+  std::sort(l.begin(), l.end());
+  Interval interval;
+  interval.end_s = std::chrono::duration<double>(now - run->start).count();
+  interval.p50 = Percentile(l, 0.5);
+  interval.p99 = Percentile(l, 0.99);
+  interval.p999 = Percentile(l, 0.999);
+  interval.max = l.empty() ? 0.0 : l.back();
+  interval.replies = run->received - run->interval_received;
+  const double seconds =
+      std::chrono::duration<double>(now - run->interval_start).count();
+  interval.replies_per_s = seconds > 0.0 ? interval.replies / seconds : 0.0;
+  run->intervals.push_back(interval);
+  printf("%.0f s: %.0f replies/s, latency us: p50 %.1f  p99 %.1f  "
+         "p999 %.1f  max %.1f\n",
+         interval.end_s, interval.replies_per_s, interval.p50, interval.p99,
+         interval.p999, interval.max);
+  fflush(stdout);
+  l.clear();
+  run->latency_seconds.clear();
+  run->interval_start = now;
+  run->interval_received = run->received;
+}
+
+// p50/p99/p999 and throughput of every whole second of the run, as
+// samples for a comparison; seconds with too few replies for a p999 are
+// left out. With --progress, of every interval instead.
+bool Export(const Run &run, double elapsed, std::string *error) {
+  const int kMinReplies = 1000;
+  char name[96];
+  snprintf(name, sizeof(name), "loadgen/connections %d/rate %g",
+           run.options.connections, run.options.rate);
+  BenchReport report("ukf_loadgen");
+  report.SetContext("url", run.options.url);
+  if (run.options.replay_path) {
+    report.SetContext("replay", run.options.replay_path);
+  }
+  for (size_t i = 0; i < run.intervals.size(); i++) {
+    const Interval &interval = run.intervals[i];
+    if (interval.replies < static_cast<unsigned long long>(kMinReplies)) {
+      continue;
+    }
+    report.Add(name, "p50_us", interval.p50);
+    report.Add(name, "p99_us", interval.p99);
+    report.Add(name, "p999_us", interval.p999);
+    report.Add(name, "replies_per_s", interval.replies_per_s, false);
+  }
+  if (!run.intervals.empty()) {
+    return report.Save(run.options.json_path, error);
+  }
+  std::vector<std::vector<double> > seconds(static_cast<size_t>(elapsed));
+  for (size_t i = 0; i < run.latencies_us.size(); i++) {
+    const size_t s = static_cast<size_t>(run.latency_seconds[i]);
+    if (s < seconds.size()) {
+      seconds[s].push_back(run.latencies_us[i]);
+    }
+  }
+  for (size_t s = 0; s < seconds.size(); s++) {
+    std::vector<double> &l = seconds[s];
+    if (l.size() < static_cast<size_t>(kMinReplies)) {
+      continue;
+    }
+    std::sort(l.begin(), l.end());
+    report.Add(name, "p50_us", Percentile(l, 0.5));
+    report.Add(name, "p99_us", Percentile(l, 0.99));
+    report.Add(name, "p999_us", Percentile(l, 0.999));
+    report.Add(name, "replies_per_s", static_cast<double>(l.size()), false);
+  }
+  return report.Save(run.options.json_path, error);
+}
+
+void Report(Run *run) {
+  double elapsed = std::chrono::duration<double>(Clock::now() - run->start)
+                       .count();
+  if (run->options.json_path) {
+    std::string error;
+    if (!Export(*run, elapsed, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+    }
+  }
+  printf("connections %d, %.1f s, sent %llu, received %llu, errors %llu\n",
+         static_cast<int>(run->clients.size()), elapsed, run->sent,
+         run->received, run->errors);
+  printf("throughput %.0f replies/s\n", run->received / elapsed);
+  if (!run->intervals.empty()) {
+    //drift shows as the later intervals' p99 against the first ones'
+    const std::vector<Interval> &in = run->intervals;
+    double worst = 0.0;
+    for (size_t i = 0; i < in.size(); i++) {
+      worst = std::max(worst, in[i].p99);
+    }
+    printf("p99 us over %zu intervals: first %.1f  last %.1f  max %.1f\n",
+           in.size(), in.front().p99, in.back().p99, worst);
+    return;
+  }
+  std::vector<double> &l = run->latencies_us;
+  std::sort(l.begin(), l.end());
+  printf("latency us: p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+         Percentile(l, 0.5), Percentile(l, 0.99), Percentile(l, 0.999),
+         l.empty() ? 0.0 : l.back());
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  Run run;
+  run.options.url = "ws://localhost:4567";
+  run.options.connections = 16;
+  run.options.rate = 0.0;
+  run.options.duration = 10.0;
+  run.options.extensions = uWS::NO_OPTIONS;
+  run.options.json_path = nullptr;
+  run.options.replay_path = nullptr;
+  run.options.speed = 1.0;
+  run.options.loop = false;
+  run.options.progress = 0.0;
+  bool duration_set = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--loop") == 0) {
+      run.options.loop = true;
+      continue;
+    }
+    if (i + 1 == argc) {
+      break;
+    }
+    if (strcmp(argv[i], "--url") == 0) {
+      run.options.url = argv[++i];
+    }
+    else if (strcmp(argv[i], "--connections") == 0) {
+      run.options.connections = std::max(1, atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--rate") == 0) {
+      run.options.rate = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--duration") == 0) {
+      run.options.duration = atof(argv[++i]);
+      duration_set = true;
+    }
+    else if (strcmp(argv[i], "--replay") == 0) {
+      run.options.replay_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--speed") == 0) {
+      run.options.speed = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--progress") == 0) {
+      run.options.progress = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--json") == 0) {
+      run.options.json_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--compression") == 0) {
+      const char *mode = argv[++i];
+      if (strcmp(mode, "shared") == 0) {
+        run.options.extensions = uWS::PERMESSAGE_DEFLATE;
+      }
+      else if (strcmp(mode, "sliding") == 0) {
+        run.options.extensions =
+            uWS::PERMESSAGE_DEFLATE | uWS::SLIDING_DEFLATE_WINDOW;
+      }
+    }
+  }
+  run.sent = run.received = run.errors = 0;
+  run.done = false;
+  run.latencies_us.reserve(1 << 20);
+  run.latency_seconds.reserve(1 << 20);
+  run.log_start = run.lap_us = 0;
+  run.log_finished = false;
+  run.interval_received = 0;
+
+  const char *replay = run.options.replay_path;
+  if (replay) {
+    const bool loaded = BinaryLog::IsMeasurementFile(replay)
+        ? BinaryLog::ReadMeasurements(replay, &run.log)
+        : LogReader::Load(replay, nullptr, &run.log, nullptr);
+    if (!loaded || run.log.empty()) {
+      fprintf(stderr, "Cannot replay %s\n", replay);
+      return 1;
+    }
+    if (run.options.speed <= 0.0) {
+      fprintf(stderr, "--speed must be positive\n");
+      return 1;
+    }
+    //a lap is the log's span plus its mean interval
+    const size_t n = run.log.size();
+    run.log_start = run.log.front().meas.timestamp_;
+    const long long span = run.log.back().meas.timestamp_ - run.log_start;
+    run.lap_us = span + (n > 1 ? span / static_cast<long long>(n - 1)
+                               : 50000LL);
+    if (!duration_set) {
+      run.options.duration = 0.0;
+    }
+  }
+
+  uWS::Hub h(run.options.extensions);
+  const bool closed_loop = !replay && run.options.rate <= 0.0;
+
+  h.onConnection([&run, closed_loop](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+    Client *c = static_cast<Client *>(ws.getUserData());
+    c->ws = ws;
+    c->open = true;
+    if (closed_loop) {
+      Send(&run, c);
+    }
+  });
+
+  h.onMessage([&run, closed_loop](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length, uWS::OpCode opCode) {
+    Client *c = static_cast<Client *>(ws.getUserData());
+    static const char kMarker[] = "42[\"estimate_marker\"";
+    if (length < sizeof(kMarker) - 1 ||
+        memcmp(data, kMarker, sizeof(kMarker) - 1) != 0 ||
+        c->in_flight.empty()) {
+      return;
+    }
+    Clock::time_point sent = c->in_flight.front();
+    c->in_flight.pop_front();
+    Clock::time_point now = Clock::now();
+    run.latencies_us.push_back(
+        std::chrono::duration<double, std::micro>(now - sent).count());
+    run.latency_seconds.push_back(static_cast<int>(
+        std::chrono::duration<double>(now - run.start).count()));
+    run.received++;
+    if (closed_loop && !run.done) {
+      Send(&run, c);
+    }
+  });
+
+  h.onDisconnection([](uWS::WebSocket<uWS::CLIENT> ws, int code, char *message, size_t length) {
+    Client *c = static_cast<Client *>(ws.getUserData());
+    if (c) c->open = false;
+  });
+
+  h.onError([&run](void *user) {
+    run.errors++;
+  });
+
+  for (int i = 0; i < run.options.connections; i++) {
+    Client *c = new Client();
+    c->open = false;
+    c->index = 0;
+    c->phase = 0.1 * i;
+    c->credit = 0.0;
+    c->next = 0;
+    c->lap = 0;
+    run.clients.push_back(c);
+    h.connect(run.options.url, c);
+  }
+
+  //1 ms tick: paces the open-loop senders and the replay, and ends the run
+  run.start = run.last_tick = run.interval_start = Clock::now();
+  uS::Timer *timer = new uS::Timer(h.getLoop());
+  timer->setData(&run);
+  timer->start([](uS::Timer *t) {
+    Run *run = static_cast<Run *>(t->getData());
+    Clock::time_point now = Clock::now();
+    double dt = std::chrono::duration<double>(now - run->last_tick).count();
+    run->last_tick = now;
+
+    const double elapsed =
+        std::chrono::duration<double>(now - run->start).count();
+    if (run->options.progress > 0.0 &&
+        std::chrono::duration<double>(now - run->interval_start).count() >=
+            run->options.progress) {
+      CloseInterval(run, now);
+    }
+
+    //the end of the log: once its replies are in, or the grace is up
+    bool replayed = false;
+    if (run->log_finished) {
+      bool drained = true;
+      for (size_t i = 0; i < run->clients.size(); i++) {
+        drained = drained && run->clients[i]->in_flight.empty();
+      }
+      replayed = drained ||
+          std::chrono::duration<double>(now - run->log_done).count() >=
+              kReplayGraceS;
+    }
+
+    if ((run->options.duration > 0.0 && elapsed >= run->options.duration) ||
+        replayed) {
+      run->done = true;
+      t->stop();
+      t->close();
+      for (size_t i = 0; i < run->clients.size(); i++) {
+        if (run->clients[i]->open) {
+          run->clients[i]->ws.close();
+        }
+      }
+      return;
+    }
+
+    if (!run->log.empty() && !run->log_finished) {
+      const double offset_us = elapsed * run->options.speed * 1e6;
+      bool pending = false;
+      bool connected = false;
+      for (size_t i = 0; i < run->clients.size(); i++) {
+        Client *c = run->clients[i];
+        if (!c->open) continue;
+        connected = true;
+        pending = Replay(run, c, offset_us) || pending;
+      }
+      if (connected && !pending) {
+        run->log_finished = true;
+        run->log_done = now;
+      }
+    }
+    else if (run->options.rate > 0.0) {
+      for (size_t i = 0; i < run->clients.size(); i++) {
+        Client *c = run->clients[i];
+        if (!c->open) continue;
+        c->credit += run->options.rate * dt;
+        while (c->credit >= 1.0) {
+          Send(run, c);
+          c->credit -= 1.0;
+        }
+      }
+    }
+  }, 1, 1);
+
+  h.run();
+  Report(&run);
+
+  for (size_t i = 0; i < run.clients.size(); i++) {
+    delete run.clients[i];
+  }
+  return 0;
+}
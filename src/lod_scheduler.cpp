@@ -0,0 +1,205 @@
+#include "lod_scheduler.h"
+#include <algorithm>
+#include <cmath>
+#include "ukf.h"
+
+LodScheduler::LodScheduler(int capacity, const Options &options)
+    : options_(options) {
+  const int n = capacity > 0 ? capacity : 0;
+  if (options_.deferred_interval < 1) {
+    options_.deferred_interval = 1;
+  }
+  if (!(options_.range_scale > 0.0)) {
+    options_.range_scale = Options().range_scale;
+  }
+  relevance_.assign(n, 1.0);
+  priority_.assign(n, 0.0);
+  level_.assign(n, FULL);
+  age_.assign(n, 0);
+  start_.resize(n + 1);
+  order_.reserve(n);
+  stats_.full = 0;
+  stats_.reduced = 0;
+  stats_.deferred = 0;
+  stats_.fused = 0;
+  stats_.dropped = 0;
+}
+
+LodScheduler::~LodScheduler() {}
+
+void LodScheduler::SetRelevance(int track, double relevance) {
+  relevance_[track] = relevance;
+}
+
+void LodScheduler::Submit(int track, const Measurement &meas) {
+  Pending pending = {track, meas};
+  pending_.push_back(pending);
+}
+
+void LodScheduler::Forget(int track) {
+  pending_.erase(std::remove_if(pending_.begin(), pending_.end(),
+                                [track](const Pending &p) {
+                                  return p.track == track;
+                                }),
+                 pending_.end());
+  relevance_[track] = 1.0;
+  age_[track] = 0;
+}
+
+size_t LodScheduler::Coalesced(UKF *ukf, size_t first, size_t last) {
+  //measurements arrive in time order, so the newest of a sensor is its last
+  size_t newest[2] = {last, last};
+  for (size_t k = first; k < last; k++) {
+    newest[sorted_[k].meas.sensor_type_ == MeasurementPackage::RADAR] = k;
+  }
+  const size_t a = std::min(newest[0], newest[1]);
+  const size_t b = std::max(newest[0], newest[1]);
+
+  const UKF::SigmaPoints points = ukf->sigma_points_;
+  const bool swap = options_.reduced_simplex &&
+                    points != UKF::SIMPLEX_POINTS;
+  if (swap) {
+    ukf->sigma_points_ = UKF::SIMPLEX_POINTS;
+    ukf->UpdateWeights();
+  }
+  size_t fused = 0;
+  if (a < last) {
+    ukf->ProcessMeasurement(sorted_[a].meas);
+    ++fused;
+  }
+  if (b < last && b != a) {
+    ukf->ProcessMeasurement(sorted_[b].meas);
+    ++fused;
+  }
+  if (swap) {
+    ukf->sigma_points_ = points;
+    ukf->UpdateWeights();
+  }
+  stats_.dropped += (last - first) - fused;
+  return fused;
+}
+
+int LodScheduler::Frame(UKF *const *tracks, int count, double ego_x,
+                        double ego_y) {
+  count = std::min(count, static_cast<int>(relevance_.size()));
+  stats_.full = 0;
+  stats_.reduced = 0;
+  stats_.deferred = 0;
+  stats_.fused = 0;
+  stats_.dropped = 0;
+
+  //priorities; a filter still waiting for its first measurement goes first
+  for (int t = 0; t < count; t++) {
+    const UKF &ukf = *tracks[t];
+    if (!ukf.initialized()) {
+      priority_[t] = HUGE_VAL;
+      continue;
+    }
+    const double dx = ukf.x()(0) - ego_x;
+    const double dy = ukf.x()(1) - ego_y;
+    const double range = std::sqrt(dx * dx + dy * dy);
+    const double spread = std::sqrt(std::max(0.0,
+                                             double(ukf.P()(0, 0) +
+                                                    ukf.P()(1, 1))));
+    priority_[t] = relevance_[t] *
+                   (1.0 + options_.covariance_weight * spread) /
+                   (1.0 + range / options_.range_scale);
+  }
+
+  //the first full_budget by priority are FULL, the next reduced_budget
+  //REDUCED; neither group needs to be sorted inside
+  order_.resize(count);
+  for (int t = 0; t < count; t++) {
+    order_[t] = t;
+  }
+  auto higher = [this](int a, int b) { return priority_[a] > priority_[b]; };
+  const int full = std::min(count, std::max(0, options_.full_budget));
+  const int reduced = std::min(count - full,
+                               std::max(0, options_.reduced_budget));
+  if (full < count) {
+    std::nth_element(order_.begin(), order_.begin() + full, order_.end(),
+                     higher);
+  }
+  if (full + reduced < count) {
+    std::nth_element(order_.begin() + full, order_.begin() + full + reduced,
+                     order_.end(), higher);
+  }
+  for (int k = 0; k < count; k++) {
+    const int t = order_[k];
+    level_[t] = priority_[t] == HUGE_VAL ? FULL
+                : k < full               ? FULL
+                : k < full + reduced     ? REDUCED
+                                         : DEFERRED;
+  }
+
+  //bucket the queue by track, keeping each track's time order
+  std::fill(start_.begin(), start_.begin() + count + 1, 0);
+  for (size_t k = 0; k < pending_.size(); k++) {
+    if (pending_[k].track < count) {
+      ++start_[pending_[k].track + 1];
+    }
+  }
+  for (int t = 0; t < count; t++) {
+    start_[t + 1] += start_[t];
+  }
+  sorted_.resize(start_[count]);
+  order_.assign(start_.begin(), start_.begin() + count);
+  for (size_t k = 0; k < pending_.size(); k++) {
+    if (pending_[k].track < count) {
+      sorted_[order_[pending_[k].track]++] = pending_[k];
+    }
+  }
+  pending_.clear();
+
+  int updated = 0;
+  for (int t = 0; t < count; t++) {
+    const size_t first = start_[t], last = start_[t + 1];
+    UKF *ukf = tracks[t];
+    size_t fused = 0;
+    switch (level_[t]) {
+    case FULL: {
+      ++stats_.full;
+      age_[t] = 0;
+      for (size_t k = first; k < last; k++) {
+        ukf->ProcessMeasurement(sorted_[k].meas);
+      }
+      fused = last - first;
+      break;
+    }
+    case REDUCED: {
+      ++stats_.reduced;
+      age_[t] = 0;
+      fused = Coalesced(ukf, first, last);
+      break;
+    }
+    default: {
+      ++stats_.deferred;
+      if (first == last) {
+        break;
+      }
+      if (++age_[t] >= options_.deferred_interval) {
+        age_[t] = 0;
+        fused = Coalesced(ukf, first, last);
+        break;
+      }
+      //hold the newest per sensor over to a later frame
+      size_t newest[2] = {last, last};
+      for (size_t k = first; k < last; k++) {
+        newest[sorted_[k].meas.sensor_type_ == MeasurementPackage::RADAR] = k;
+      }
+      for (size_t k = first; k < last; k++) {
+        if (k == newest[0] || k == newest[1]) {
+          pending_.push_back(sorted_[k]);
+        }
+        else {
+          ++stats_.dropped;
+        }
+      }
+      break;
+    }
+    }
+    stats_.fused += fused;
+    updated += fused > 0 ? 1 : 0;
+  }
+  return updated;
+}
@@ -0,0 +1,157 @@
+#ifndef LOD_SCHEDULER_H_
+#define LOD_SCHEDULER_H_
+
+#include <cstddef>
+#include <vector>
+#include "measurement_package.h"
+
+class UKF;
+
+/**
+ * Level-of-detail scheduling of track updates: under load, the filter
+ * steps of a frame go to the tracks that matter, and the others are
+ * updated less often and more cheaply instead of every track taking a full
+ * step per measurement.
+ *
+ * Measurements are queued per track with Submit; Frame then ranks the
+ * tracks by priority,
+ *
+ *   relevance * (1 + covariance_weight * position std) /
+ *   (1 + range / range_scale),
+ *
+ * so near, relevant and uncertain tracks come first, and gives the first
+ * full_budget of them FULL detail, the next reduced_budget REDUCED and the
+ * rest DEFERRED:
+ *
+ *   FULL      every queued measurement, with the filter as configured
+ *   REDUCED   the measurements are coalesced to the newest one per sensor,
+ *             fused with the cheaper simplex sigma set (n + 2 points
+ *             instead of 2n + 1) if reduced_simplex is set
+ *   DEFERRED  as REDUCED, but only every deferred_interval frames; until
+ *             then the newest measurement per sensor is held over
+ *
+ * Tracks whose filter is not initialised yet are always FULL. The ranking
+ * uses nth_element, so a frame costs O(tracks) on top of the updates it
+ * makes. A coalesced measurement is dropped, not fused late: its newer
+ * successor carries most of its information for a slow, distant target.
+ */
+class LodScheduler {
+public:
+  enum Level {
+    FULL,
+    REDUCED,
+    DEFERRED
+  };
+
+  struct Options {
+    ///* tracks updated at FULL detail per frame
+    int full_budget;
+    ///* tracks updated at REDUCED detail per frame, after the FULL ones
+    int reduced_budget;
+    ///* frames between the updates of a DEFERRED track
+    int deferred_interval;
+    ///* range in m at which the priority is halved
+    double range_scale;
+    ///* priority gained per m of position standard deviation
+    double covariance_weight;
+    ///* REDUCED and DEFERRED updates use the simplex sigma set
+    bool reduced_simplex;
+
+    Options()
+        : full_budget(256),
+          reduced_budget(1024),
+          deferred_interval(4),
+          range_scale(50.0),
+          covariance_weight(1.0),
+          reduced_simplex(true) {}
+  };
+
+  ///* What the last Frame did
+  struct Stats {
+    int full;
+    int reduced;
+    int deferred;
+    ///* measurements fused, and dropped by coalescing
+    size_t fused;
+    size_t dropped;
+  };
+
+  /**
+   * Constructor
+   * @param capacity Number of tracks; tracks use ids [0, capacity)
+   * @param options Budgets and priority weights
+   */
+  LodScheduler(int capacity, const Options &options = Options());
+
+  virtual ~LodScheduler();
+
+  /**
+   * Scales a track's priority, e.g. up for a track in the planned path
+   * @param track Track id
+   * @param relevance Positive weight; 1 by default
+   */
+  void SetRelevance(int track, double relevance);
+
+  /**
+   * Queues a measurement for the next Frame. A track's measurements must
+   * be submitted in time order.
+   * @param track Track id
+   * @param meas Measurement
+   */
+  void Submit(int track, const Measurement &meas);
+
+  /**
+   * Drops everything queued or held for a track, e.g. when it is deleted,
+   * and resets its relevance
+   * @param track Track id
+   */
+  void Forget(int track);
+
+  /**
+   * Ranks the tracks and makes this frame's updates
+   * @param tracks count filters, indexed by track id
+   * @param count Number of tracks, at most the capacity; measurements
+   * queued for tracks beyond it are dropped
+   * @param ego_x Position the range is measured from, in m
+   * @param ego_y Position the range is measured from, in m
+   * @return Number of tracks updated
+   */
+  int Frame(UKF *const *tracks, int count, double ego_x = 0.0,
+            double ego_y = 0.0);
+
+  ///* Level and priority a track had in the last Frame
+  Level level(int track) const { return static_cast<Level>(level_[track]); }
+  double priority(int track) const { return priority_[track]; }
+
+  const Stats &stats() const { return stats_; }
+
+  const Options &options() const { return options_; }
+
+private:
+  struct Pending {
+    int track;
+    Measurement meas;
+  };
+
+  // fuses a track's newest measurement per sensor from [first, last) of
+  // sorted_, in time order; returns the number fused
+  size_t Coalesced(UKF *ukf, size_t first, size_t last);
+
+  Options options_;
+  Stats stats_;
+
+  // per track
+  std::vector<double> relevance_;
+  std::vector<double> priority_;
+  std::vector<char> level_;
+  ///* frames since a DEFERRED track was last updated
+  std::vector<int> age_;
+
+  // queued measurements, and the same bucketed by track
+  std::vector<Pending> pending_;
+  std::vector<Pending> sorted_;
+  std::vector<int> start_;
+  std::vector<int> order_;
+};
+
+#endif /* LOD_SCHEDULER_H_ */
@@ -0,0 +1,43 @@
+// Converts a measurement log from the simulator's text format into the
+// columnar binary format read by ukf_replay.
+//
+//   ukf_log_convert [--compress] <input.txt> <output.ukfm>
+//
+// --compress writes the block-compressed version of the format.
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "binary_log.h"
+#include "log_reader.h"
+#include "thread_pool.h"
+
+int main(int argc, char *argv[])
+{
+  bool compress = false;
+  if (argc > 1 && strcmp(argv[1], "--compress") == 0) {
+    compress = true;
+    --argc;
+    ++argv;
+  }
+  if (argc != 3) {
+    std::cerr << "usage: ukf_log_convert [--compress] <input.txt> "
+              << "<output.ukfm>" << std::endl;
+    return 2;
+  }
+
+  ThreadPool pool(0);
+  std::vector<LogRecord> records;
+  size_t skipped = 0;
+  if (!LogReader::Load(argv[1], &pool, &records, &skipped)) {
+    std::cerr << "Cannot read " << argv[1] << std::endl;
+    return 1;
+  }
+  if (!BinaryLog::WriteMeasurements(argv[2], records, compress)) {
+    std::cerr << "Cannot write " << argv[2] << std::endl;
+    return 1;
+  }
+  std::cout << records.size() << " records written, " << skipped
+            << " lines skipped" << std::endl;
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include "log_reader.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "telemetry_parser.h"
+#include "thread_pool.h"
+
+namespace {
+
+// bytes per parse chunk; large enough to amortise the scheduling
+const size_t kChunkBytes = 1 << 20;
+
+struct Chunk {
+  const char *begin;
+  const char *end;
+  std::vector<LogRecord> records;
+  size_t skipped;
+};
+
+// parses the complete lines of [begin, end)
+void ParseChunk(Chunk *chunk) {
+  TelemetryParser parser;
+  const char *p = chunk->begin;
+  chunk->skipped = 0;
+  while (p < chunk->end) {
+    const char *eol = static_cast<const char *>(
+        memchr(p, '\n', chunk->end - p));
+    const char *line_end = eol ? eol : chunk->end;
+    if (line_end > p && line_end[-1] == '\r') {
+      --line_end;
+    }
+
+    if (line_end > p) {
+      if (parser.ParseMeasurement(p, line_end)) {
+        LogRecord record;
+        record.meas = Measurement::From(parser.measurement());
+        for (int i = 0; i < 4; i++) {
+          record.ground_truth[i] = parser.ground_truth()(i);
+        }
+        chunk->records.push_back(record);
+      }
+      else {
+        ++chunk->skipped;
+      }
+    }
+    p = eol ? eol + 1 : chunk->end;
+  }
+}
+
+}  // namespace
+
+size_t LogReader::Parse(const char *data, size_t length, ThreadPool *pool,
+                        std::vector<LogRecord> *records) {
+  //cut at the first newline after every kChunkBytes
+  std::vector<Chunk> chunks;
+  const char *end = data + length;
+  const char *p = data;
+  while (p < end) {
+    const char *cut = end;
+    if (static_cast<size_t>(end - p) > kChunkBytes) {
+      const char *eol = static_cast<const char *>(
+          memchr(p + kChunkBytes, '\n', end - p - kChunkBytes));
+      cut = eol ? eol + 1 : end;
+    }
+    Chunk chunk;
+    chunk.begin = p;
+    chunk.end = cut;
+    chunk.skipped = 0;
+    chunks.push_back(chunk);
+    p = cut;
+  }
+
+  //measurement lines are rarely shorter than 48 bytes
+  for (size_t i = 0; i < chunks.size(); i++) {
+    chunks[i].records.reserve((chunks[i].end - chunks[i].begin) / 48 + 1);
+  }
+
+  std::function<void(int, int)> body = [&chunks](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      ParseChunk(&chunks[i]);
+    }
+  };
+  if (pool) {
+    pool->ParallelFor(0, static_cast<int>(chunks.size()), 1, body);
+  }
+  else {
+    body(0, static_cast<int>(chunks.size()));
+  }
+
+  size_t total = records->size();
+  size_t skipped = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    total += chunks[i].records.size();
+    skipped += chunks[i].skipped;
+  }
+  records->reserve(total);
+  for (size_t i = 0; i < chunks.size(); i++) {
+    records->insert(records->end(), chunks[i].records.begin(),
+                    chunks[i].records.end());
+  }
+  return skipped;
+}
+
+bool LogReader::Load(const char *path, ThreadPool *pool,
+                     std::vector<LogRecord> *records, size_t *skipped) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  size_t length = static_cast<size_t>(st.st_size);
+  size_t bad = 0;
+  if (length > 0) {
+    void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(map, length, MADV_SEQUENTIAL);
+    bad = Parse(static_cast<const char *>(map), length, pool, records);
+    munmap(map, length);
+  }
+  close(fd);
+
+  if (skipped) {
+    *skipped = bad;
+  }
+  return true;
+}
@@ -0,0 +1,52 @@
+#ifndef LOG_READER_H_
+#define LOG_READER_H_
+
+#include <cstddef>
+#include <vector>
+#include "measurement_package.h"
+
+class ThreadPool;
+
+/**
+ * One parsed line of a measurement log: the measurement and its
+ * [x, y, vx, vy] ground truth (zero when the line has none)
+ */
+struct LogRecord {
+  Measurement meas;
+  double ground_truth[4];
+};
+
+/**
+ * Loads measurement logs in the simulator's text format into contiguous
+ * arrays of LogRecord.
+ *
+ * Files are memory mapped and cut into chunks at newline boundaries; the
+ * chunks are parsed in parallel, each into its own array, and concatenated
+ * in file order, so the result is the same for any thread count.
+ */
+class LogReader {
+public:
+  /**
+   * Loads a whole file
+   * @param path File to read
+   * @param pool Pool to parse on, or nullptr for the calling thread
+   * @param records Parsed lines, in file order (appended)
+   * @param skipped Number of lines that did not parse (may be nullptr)
+   * @return false if the file could not be opened or mapped
+   */
+  static bool Load(const char *path, ThreadPool *pool,
+                   std::vector<LogRecord> *records, size_t *skipped);
+
+  /**
+   * Parses a buffer of lines
+   * @param data First character
+   * @param length Number of characters
+   * @param pool Pool to parse on, or nullptr for the calling thread
+   * @param records Parsed lines, in order (appended)
+   * @return Number of non-empty lines that did not parse
+   */
+  static size_t Parse(const char *data, size_t length, ThreadPool *pool,
+                      std::vector<LogRecord> *records);
+};
+
+#endif /* LOG_READER_H_ */
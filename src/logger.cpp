@@ -0,0 +1,146 @@
+#include "logger.h"
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <thread>
+
+namespace {
+
+// slots in the ring; a power of two
+const size_t kCapacity = 1024;
+
+// writer poll interval while the ring is empty
+const int kIdleMilliseconds = 1;
+
+struct Entry {
+  // ready for the producer of position seq (seq == pos) or for the
+  // consumer (seq == pos + 1)
+  std::atomic<size_t> seq;
+  Logger::Level level;
+  int length;
+  char text[Logger::kMaxMessage + 1];
+};
+
+// Bounded multi-producer/single-consumer ring: producers claim a position
+// with a CAS on tail_, the writer thread is the only consumer.
+class LogRing {
+public:
+  LogRing() : tail_(0), head_(0), written_(0), dropped_(0), stop_(false) {
+    for (size_t i = 0; i < kCapacity; i++) {
+      entries_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    writer_ = std::thread(&LogRing::Run, this);
+  }
+
+  ~LogRing() {
+    stop_.store(true);
+    writer_.join();
+  }
+
+  void Push(Logger::Level level, const char *format, va_list args) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Entry *entry;
+    for (;;) {
+      entry = &entries_[pos & (kCapacity - 1)];
+      size_t seq = entry->seq.load(std::memory_order_acquire);
+      long long diff = static_cast<long long>(seq - pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        //full: drop rather than wait for the writer
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    entry->level = level;
+    int n = vsnprintf(entry->text, sizeof(entry->text), format, args);
+    if (n < 0) n = 0;
+    if (n > Logger::kMaxMessage) n = Logger::kMaxMessage;
+    entry->length = n;
+    entry->seq.store(pos + 1, std::memory_order_release);
+  }
+
+  void Flush() {
+    size_t target = tail_.load(std::memory_order_acquire);
+    while (written_.load(std::memory_order_acquire) < target) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(kIdleMilliseconds));
+    }
+  }
+
+  unsigned long long dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+private:
+  // writes one entry if the next one is ready
+  bool WriteOne() {
+    Entry &entry = entries_[head_ & (kCapacity - 1)];
+    if (entry.seq.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    FILE *out = entry.level >= Logger::LOG_WARN ? stderr : stdout;
+    fwrite(entry.text, 1, entry.length, out);
+    fputc('\n', out);
+    entry.seq.store(head_ + kCapacity, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  void Run() {
+    for (;;) {
+      bool wrote = false;
+      while (WriteOne()) wrote = true;
+      if (wrote) {
+        fflush(stdout);
+        fflush(stderr);
+        written_.store(head_, std::memory_order_release);
+        continue;
+      }
+      if (stop_.load()) {
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(kIdleMilliseconds));
+    }
+  }
+
+  Entry entries_[kCapacity];
+  std::atomic<size_t> tail_;
+  // only touched by the writer
+  size_t head_;
+  std::atomic<size_t> written_;
+  std::atomic<unsigned long long> dropped_;
+  std::atomic<bool> stop_;
+  std::thread writer_;
+};
+
+LogRing &Ring() {
+  // destroyed at exit, after the writer has drained what was queued
+  static LogRing ring;
+  return ring;
+}
+
+}  // namespace
+
+void Logger::Log(Level level, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  Ring().Push(level, format, args);
+  va_end(args);
+}
+
+void Logger::Flush() {
+  Ring().Flush();
+}
+
+unsigned long long Logger::Dropped() {
+  return Ring().dropped();
+}
@@ -0,0 +1,73 @@
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+/**
+ * Leveled, asynchronous logging.
+ *
+ * Log formats the message into a slot of a fixed-size lock-free ring and
+ * returns; a background thread writes the ring to stdout (INFO and below)
+ * or stderr (WARN and above) and flushes whenever it runs dry. Callers
+ * never wait for the terminal or a slow pipe: if the ring is full the
+ * message is dropped and counted instead.
+ *
+ * Levels below UKF_LOG_LEVEL are removed at compile time by the UKF_LOG_*
+ * macros, which take printf-style arguments.
+ */
+class Logger {
+public:
+  enum Level {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+  };
+
+  ///* longest message kept; longer ones are truncated
+  static const int kMaxMessage = 240;
+
+  /**
+   * Queues a message; starts the writer thread on first use
+   */
+  static void Log(Level level, const char *format, ...)
+      __attribute__((format(printf, 2, 3)));
+
+  /**
+   * Blocks until every message queued so far has been written
+   */
+  static void Flush();
+
+  /**
+   * Messages dropped because the ring was full
+   */
+  static unsigned long long Dropped();
+};
+
+#ifndef UKF_LOG_LEVEL
+#define UKF_LOG_LEVEL 1
+#endif
+
+#if UKF_LOG_LEVEL <= 0
+#define UKF_LOG_DEBUG(...) Logger::Log(Logger::LOG_DEBUG, __VA_ARGS__)
+#else
+#define UKF_LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if UKF_LOG_LEVEL <= 1
+#define UKF_LOG_INFO(...) Logger::Log(Logger::LOG_INFO, __VA_ARGS__)
+#else
+#define UKF_LOG_INFO(...) do {} while (0)
+#endif
+
+#if UKF_LOG_LEVEL <= 2
+#define UKF_LOG_WARN(...) Logger::Log(Logger::LOG_WARN, __VA_ARGS__)
+#else
+#define UKF_LOG_WARN(...) do {} while (0)
+#endif
+
+#if UKF_LOG_LEVEL <= 3
+#define UKF_LOG_ERROR(...) Logger::Log(Logger::LOG_ERROR, __VA_ARGS__)
+#else
+#define UKF_LOG_ERROR(...) do {} while (0)
+#endif
+
+#endif /* LOGGER_H_ */
@@ -1,275 +1,2156 @@
 #include <uWS/uWS.h>
-#include <iostream>
-#include "json.hpp"
 #include <math.h>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <signal.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "binary_protocol.h"
+#include "checkpoint.h"
+#include "config_reload.h"
+#include "cpu_affinity.h"
+#include "huge_pages.h"
+#include "kernel_autotune.h"
+#include "latency_trace.h"
+#include "logger.h"
+#include "measurement_journal.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "profiler_zones.h"
+#include "realtime.h"
+#include "region_index.h"
+#include "session.h"
+#ifdef UKF_COROUTINES
+#include "session_executor.h"
+#endif
+#include "shadow_runner.h"
+#include "stage_timing.h"
+#include "track_view.h"
 #include "ukf.h"
-#include "tools.h"
+#include "unix_transport.h"
 
 using namespace std;
 
-// for convenience
-using json = nlohmann::json;
+// slots in each of a pipeline's rings
+const size_t kPipelineCapacity = 4096;
+
+// WebSocket settings of every hub
+struct SocketOptions {
+  // uWS extension options: NO_OPTIONS, or PERMESSAGE_DEFLATE with a shared
+  // (default) or SLIDING_DEFLATE_WINDOW. Telemetry frames are around 150
+  // bytes and replies under 250, too small for deflate to win back its CPU
+  // time, so compression is off unless asked for.
+  int extensions;
+  // largest frame accepted from a client, in bytes; uWS closes connections
+  // that send more. 1 MiB holds a binary frame of over 20000 measurements.
+  unsigned int max_payload;
+
+  SocketOptions() : extensions(uWS::NO_OPTIONS), max_payload(1 << 20) {}
+};
+
+// Settings of every hub, from the command line
+struct HubOptions {
+  HubOptions()
+      : history_capacity(1000),
+        rmse_window(100),
+        rmse_window_us(0),
+        evaluate(true),
+        pipelined(false),
+        coroutines(false),
+        workers(1),
+        reply_behind(false),
+        coalesce_ms(0),
+        stream_ms(0),
+        port(4567),
+        pool_size(0),
+        snapshot_dir(nullptr),
+        shm_prefix(nullptr),
+        shm_tracks(1024),
+        region_cell(0.0),
+        region_ms(100),
+        checkpoint_dir(nullptr),
+        checkpoint_ms(10000),
+        journal(nullptr),
+        shadow(nullptr),
+        reload(nullptr) {}
+
+  // number of estimate/ground truth pairs kept per connection
+  size_t history_capacity;
+  // each track's replies also carry its RMSE over the last rmse_window
+  // estimates (--rmse-window <n>, 0 for none), within the last
+  // rmse_window_us (--rmse-window-s <s>, 0 for any age)
+  unsigned long rmse_window;
+  long long rmse_window_us;
+  // score estimates against the ground truth in each message (--no-eval:
+  // production feeds, which have none)
+  bool evaluate;
+  // filter on worker threads instead of in the callbacks, with this many
+  // workers per event loop (--workers)
+  bool pipelined;
+  // run the workers as a SessionExecutor of coroutines instead of one
+  // Pipeline each (--executor pipeline|coroutines; UKF_COROUTINES builds)
+  bool coroutines;
+  int workers;
+  // CPUs of the event loops and of the workers, dealt out in order
+  // (--loop-cpus, --worker-cpus "0-3,8"); empty to let them float
+  std::vector<int> loop_cpus;
+  std::vector<int> worker_cpus;
+  // what a pipelined hub does when measurements come in faster than it
+  // filters them (--overload block|drop-oldest|lidar-first|coalesce-lidar|
+  // deadline, --max-delay <ms>)
+  Pipeline::Overload overload;
+  // reply "behind" to the text measurements it drops
+  bool reply_behind;
+  // longest a text reply waits to be coalesced with others, in ms (0: sent
+  // immediately)
+  int coalesce_ms;
+  // period of the estimate stream to subscribers, in ms (0: no streaming)
+  int stream_ms;
+  // --compression off|shared|sliding, --max-payload <bytes>
+  SocketOptions socket;
+  int port;
+  // connections each hub preallocates
+  size_t pool_size;
+  // sessions are saved here on shutdown and restored on restart
+  // (--snapshot-dir <dir>); null for neither
+  const char *snapshot_dir;
+  // every session's tracks are published in the shared-memory region
+  // <shm_prefix>-hub<i>-<k>, for other processes on the host
+  // (--shm-export <prefix>, --shm-tracks <tracks per session>); null for
+  // none
+  const char *shm_prefix;
+  size_t shm_tracks;
+  // GET /tracks answers region queries over every session's tracks from a
+  // grid of region_cell m cells, rebuilt at most every region_ms
+  // (--region-cell <m>, --region-ms <ms>); 0 for no region queries. The
+  // cell edge also sizes the grid of filtered subscriptions.
+  double region_cell;
+  int region_ms;
+  // every checkpoint_ms each hub's sessions are checkpointed to
+  // <checkpoint_dir>/hub<i>.ckpt, for --recover after a crash
+  // (--checkpoint-dir <dir>, --checkpoint-s <s>); null for none
+  const char *checkpoint_dir;
+  int checkpoint_ms;
+  // every measurement received is journaled here before it is filtered
+  // (--journal <path>, --journal-sync never|batch|<ms>, --journal-compress);
+  // null for none
+  MeasurementJournal *journal;
+  // compares sampled updates with an alternative configuration
+  // (--shadow-config); null for none
+  ShadowRunner *shadow;
+  // rereads the --config file on GET /reload (--watch-config also rereads
+  // it when it changes); null without a config file
+  ConfigReload *reload;
+};
+
+// grid cell edge of filtered subscriptions without --region-cell, in m
+const double kStreamCellM = 50.0;
+
+// longest a hub waits for clients to complete the close handshake on
+// shutdown before dropping them, in ms
+const int kCloseTimeoutMs = 2000;
+
+// Shutdown on SIGINT and SIGTERM: the signals are blocked in every thread
+// and taken by sigwait on a thread of their own, so what runs on them is
+// not limited to async-signal-safe calls. Each hub registers a hook that
+// wakes its loop; a second signal exits at once.
+std::mutex g_shutdown_mutex;
+std::vector<std::function<void()> > g_shutdown_hooks;
+bool g_shutdown_requested = false;
+
+// Called from the main thread before any other thread starts, so all of
+// them inherit the blocked mask
+void BlockShutdownSignals(sigset_t *set)
+{
+  sigemptyset(set);
+  sigaddset(set, SIGINT);
+  sigaddset(set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, set, nullptr);
+}
 
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-std::string hasData(std::string s) {
-  auto found_null = s.find("null");
-  auto b1 = s.find_first_of("[");
-  auto b2 = s.find_first_of("]");
-  if (found_null != std::string::npos) {
-    return "";
+void RequestShutdown()
+{
+  std::vector<std::function<void()> > hooks;
+  {
+    std::lock_guard<std::mutex> lock(g_shutdown_mutex);
+    g_shutdown_requested = true;
+    hooks.swap(g_shutdown_hooks);
   }
-  else if (b1 != std::string::npos && b2 != std::string::npos) {
-    return s.substr(b1, b2 - b1 + 1);
+  for (size_t i = 0; i < hooks.size(); i++) {
+    hooks[i]();
   }
-  return "";
 }
 
-int main()
+// Runs hook on shutdown, at once if shutdown was already requested
+void OnShutdown(const std::function<void()> &hook)
 {
-  uWS::Hub h;
-
-  // Create a Kalman Filter instance
-  UKF ukf;
-
-  // used to compute the RMSE later
-  Tools tools;
-  vector<VectorXd> estimations;
-  vector<VectorXd> ground_truth;
-
-  h.onMessage([&ukf,&tools,&estimations,&ground_truth](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
-    // "42" at the start of the message means there's a websocket message event.
-    // The 4 signifies a websocket message
-    // The 2 signifies a websocket event
-
-    if (length && length > 2 && data[0] == '4' && data[1] == '2')
-    {
-
-      auto s = hasData(std::string(data));
-      if (s != "") {
-
-        auto j = json::parse(s);
-
-        std::string event = j[0].get<std::string>();
-        
-        if (event == "telemetry") {
-          // j[1] is the data JSON object
-          
-          string sensor_measurment = j[1]["sensor_measurement"];
-          
-          MeasurementPackage meas_package;
-          istringstream iss(sensor_measurment);
-          long long timestamp;
-
-          // reads first element from the current line
-          string sensor_type;
-          iss >> sensor_type;
-
-          if (sensor_type.compare("L") == 0) {
-                meas_package.sensor_type_ = MeasurementPackage::LASER;
-                meas_package.raw_measurements_ = VectorXd(2);
-                float px;
-                float py;
-                iss >> px;
-                iss >> py;
-                meas_package.raw_measurements_ << px, py;
-                iss >> timestamp;
-                meas_package.timestamp_ = timestamp;
-          } else if (sensor_type.compare("R") == 0) {
-
-                meas_package.sensor_type_ = MeasurementPackage::RADAR;
-                meas_package.raw_measurements_ = VectorXd(3);
-                float rho;
-                float theta;
-                float rho_dot;
-                iss >> rho;
-                iss >> theta;
-                iss >> rho_dot;
-                meas_package.raw_measurements_ << rho,theta, rho_dot;
-                iss >> timestamp;
-                meas_package.timestamp_ = timestamp;
-          }
-          float x_gt;
-          float y_gt;
-          float vx_gt;
-          float vy_gt;
-          iss >> x_gt;
-          iss >> y_gt;
-          iss >> vx_gt;
-          iss >> vy_gt;
-          VectorXd gt_values(4);
-          gt_values(0) = x_gt;
-          gt_values(1) = y_gt;
-          gt_values(2) = vx_gt;
-          gt_values(3) = vy_gt;
-          ground_truth.push_back(gt_values);
-          
-          //Call ProcessMeasurment(meas_package) for Kalman filter
-          ukf.ProcessMeasurement(meas_package);
-
-          //Push the current estimated x,y positon from the Kalman filter's state vector
-
-          VectorXd estimate(4);
-
-          double p_x = ukf.x_pred_(0);
-          double p_y = ukf.x_pred_(1);
-          double v  = ukf.x_pred_(2);
-          double yaw = ukf.x_pred_(3);
-
-          double v1 = cos(yaw)*v;
-          double v2 = sin(yaw)*v;
-
-          estimate(0) = p_x;
-          estimate(1) = p_y;
-          estimate(2) = v1;
-          estimate(3) = v2;
+  {
+    std::lock_guard<std::mutex> lock(g_shutdown_mutex);
+    if (!g_shutdown_requested) {
+      g_shutdown_hooks.push_back(hook);
+      return;
+    }
+  }
+  hook();
+}
 
-          estimations.push_back(estimate);
+void WatchShutdownSignals(sigset_t set)
+{
+  int signal;
+  if (sigwait(&set, &signal) != 0) {
+    return;
+  }
+  UKF_LOG_INFO("Signal %d, shutting down", signal);
+  RequestShutdown();
+  if (sigwait(&set, &signal) == 0) {
+    Logger::Flush();
+    _exit(1);
+  }
+}
 
-          VectorXd RMSE = tools.CalculateRMSE(estimations, ground_truth);
+// A client connection: its socket and its filter session
+struct Connection {
+  Connection(uWS::WebSocket<uWS::SERVER> ws, const UKF &prototype,
+             size_t history_capacity, bool evaluate)
+      : ws(ws), session(prototype, history_capacity, evaluate), open(true),
+        publishing(false), snapshot_rank(-1) {}
+
+  uWS::WebSocket<uWS::SERVER> ws;
+  Session session;
+  // the session's tracks in shared memory, with --shm-export
+  std::unique_ptr<TrackView> view;
+  // false once the socket is gone but pipelined jobs may still be in flight
+  bool open;
+  // a PUBLISH job for the session is in the pipeline
+  bool publishing;
+  // where the session is saved when it is deleted: its place among the
+  // hub's connections at shutdown, -1 to not save it
+  int snapshot_rank;
+
+  // readies a pooled connection for a new client
+  void Reset(uWS::WebSocket<uWS::SERVER> socket, const UKF &prototype) {
+    ws = socket;
+    session.Reset(prototype);
+    open = true;
+    publishing = false;
+    snapshot_rank = -1;
+  }
 
-          json msgJson;
-          msgJson["estimate_x"] = p_x;
-          msgJson["estimate_y"] = p_y;
-          msgJson["rmse_x"] =  RMSE(0);
-          msgJson["rmse_y"] =  RMSE(1);
-          msgJson["rmse_vx"] = RMSE(2);
-          msgJson["rmse_vy"] = RMSE(3);
-          auto msg = "42[\"estimate_marker\"," + msgJson.dump() + "]";
-          // std::cout << msg << std::endl;
-          ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+// Connections built ahead of time: a hub fills its pool before it listens
+// (--max-connections, split across the hubs), so accepting a client, even
+// in a reconnect storm, allocates nothing on the loop, and the filters,
+// history rings and reply buffers of a closed connection are reused by the
+// next one. Past the pool size connections are allocated and freed as
+// before.
+struct ConnectionPool {
+  // tracks each pooled session is prepared for, and estimate records its
+  // binary reply buffer holds before it grows
+  static const size_t kTracksPerSession = 4;
+  static const size_t kRepliesPerFrame = 64;
+
+  ConnectionPool(const UKF &prototype, const HubOptions &options,
+                 size_t capacity)
+      : prototype(prototype), options(options), capacity(capacity) {
+    free.reserve(capacity);
+    for (size_t i = 0; i < capacity; i++) {
+      Connection *conn = New(uWS::WebSocket<uWS::SERVER>());
+      conn->session.tracks_.Reserve(kTracksPerSession);
+      conn->session.reply_.reserve(kRepliesPerFrame *
+                                   BinaryProtocol::kEstimateRecordSize);
+      free.push_back(conn);
+    }
+  }
 
-        }
-      } else {
-        
-        std::string msg = "42[\"manual\",{}]";
-        ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-      }
+  ~ConnectionPool() {
+    for (size_t i = 0; i < free.size(); i++) {
+      delete free[i];
     }
+  }
 
-  });
+  Connection *Acquire(uWS::WebSocket<uWS::SERVER> ws) {
+    Metrics::SessionOpened();
+    if (free.empty()) {
+      return New(ws);
+    }
+    Connection *conn = free.back();
+    free.pop_back();
+    conn->Reset(ws, prototype);
+    conn->session.tracks_.SetRMSEWindow(options.rmse_window,
+                                        options.rmse_window_us);
+    return conn;
+  }
 
-  // We don't need this since we're not using HTTP but if it's removed the program
-  // doesn't compile :-(
-  h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data, size_t, size_t) {
-    const std::string s = "<h1>Hello world!</h1>";
-    if (req.getUrl().valueLength == 1)
-    {
-      res->end(s.data(), s.length());
+  void Release(Connection *conn) {
+    Metrics::SessionClosed();
+    if (free.size() < capacity) {
+      free.push_back(conn);
     }
-    else
-    {
-      // i guess this should be done more gracefully?
-      res->end(nullptr, 0);
+    else {
+      delete conn;
     }
-  });
-
-  h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
-    std::cout << "Connected!!!" << std::endl;
-  });
+  }
 
-  h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) {
-    ws.close();
-    std::cout << "Disconnected" << std::endl;
-  });
+  Connection *New(uWS::WebSocket<uWS::SERVER> ws) {
+    Connection *conn = new Connection(ws, prototype, options.history_capacity,
+                                      options.evaluate);
+    conn->session.tracks_.SetRMSEWindow(options.rmse_window,
+                                        options.rmse_window_us);
+    conn->session.tracks_.SetShadow(options.shadow);
+    return conn;
+  }
 
-  int port = 4567;
-  if (h.listen(port))
+  const UKF &prototype;
+  const HubOptions &options;
+  const size_t capacity;
+  std::vector<Connection *> free;
+};
+
+// Sends the Socket.IO estimate reply, formatted into the connection's
+// reusable response buffer, and records its latency if it has stamps
+void SendEstimate(Connection *conn, const double *estimate, const double *RMSE,
+                  double nis, double nis_exceeded, const double *window_rmse,
+                  LatencyTrace::Stamps *stamps)
+{
+  ResponseWriter &msg = conn->session.response_;
   {
-    std::cout << "Listening to port " << port << std::endl;
+    UKF_STAGE_TIMER(STAGE_SERIALIZE);
+    msg.EstimateMarker(estimate, RMSE, nis, nis_exceeded, window_rmse);
+  }
+  if (stamps) {
+    LatencyTrace::Stamp(stamps, LatencyTrace::SERIALIZED);
   }
-  else
+  // std::cout << std::string(msg.data(), msg.size()) << std::endl;
   {
-    std::cerr << "Failed to listen to port" << std::endl;
-    return -1;
+    UKF_STAGE_TIMER(STAGE_SEND);
+    UKF_ZONE("Send");
+    conn->ws.send(msg.data(), msg.size(), uWS::OpCode::TEXT);
+  }
+  if (stamps) {
+    LatencyTrace::End(*stamps, conn->session.id_);
   }
-  h.run();
 }
 
+// Coalesces text replies: each estimate is appended to its connection's
+// estimate_batch event, and every connection with a pending batch gets one
+// frame when the hub flushes (at the end of a pipeline drain, or from the
+// flush timer at most --coalesce ms later). A burst of measurements then
+// costs one write per connection instead of one per measurement.
+struct ReplyBatcher {
+  // replies after which a batch is sent without waiting for the flush
+  static const size_t kMaxBatch = 64;
+
+  void Add(Connection *conn, const double *estimate, const double *RMSE,
+           double nis, double nis_exceeded, const double *window_rmse,
+           LatencyTrace::Stamps *stamps) {
+    ResponseWriter &batch = conn->session.batch_;
+    if (batch.batched() == 0) {
+      pending.push_back(conn);
+    }
+    {
+      UKF_STAGE_TIMER(STAGE_SERIALIZE);
+      batch.BatchEstimate(estimate, RMSE, nis, nis_exceeded, window_rmse);
+    }
+    if (stamps) {
+      LatencyTrace::Stamp(stamps, LatencyTrace::SERIALIZED);
+      conn->session.batch_stamps_.push_back(*stamps);
+    }
+    if (batch.batched() >= kMaxBatch) {
+      Send(conn);
+    }
+  }
 
+  void Send(Connection *conn) {
+    ResponseWriter &batch = conn->session.batch_;
+    if (batch.batched() == 0) {
+      return;
+    }
+    batch.FinishBatch();
+    if (conn->open) {
+      {
+        UKF_STAGE_TIMER(STAGE_SEND);
+        UKF_ZONE("SendBatch");
+        conn->ws.send(batch.data(), batch.size(), uWS::OpCode::TEXT);
+      }
+      LatencyTrace::EndAll(&conn->session.batch_stamps_, conn->session.id_);
+    }
+    conn->session.batch_stamps_.clear();
+    Metrics::Increment(Metrics::REPLY_BATCHES);
+    Metrics::Add(Metrics::REPLIES_BATCHED, batch.batched());
+    batch.Clear();
+  }
 
+  void Flush() {
+    for (size_t i = 0; i < pending.size(); i++) {
+      Send(pending[i]);
+    }
+    pending.clear();
+  }
 
+  // drops a connection that is about to be deleted, unsent
+  void Remove(Connection *conn) {
+    pending.erase(std::remove(pending.begin(), pending.end(), conn),
+                  pending.end());
+  }
 
+  std::vector<Connection *> pending;
+};
 
+// Sends a text reply now, or queues it for the next batch; RMSE and
+// window_rmse are null to leave their keys out, stamps to not record the
+// reply's latency
+void ReplyEstimate(ReplyBatcher *batcher, Connection *conn,
+                   const double *estimate, const double *RMSE, double nis,
+                   double nis_exceeded, const double *window_rmse = nullptr,
+                   LatencyTrace::Stamps *stamps = nullptr)
+{
+  if (batcher) {
+    batcher->Add(conn, estimate, RMSE, nis, nis_exceeded, window_rmse,
+                 stamps);
+  }
+  else {
+    SendEstimate(conn, estimate, RMSE, nis, nis_exceeded, window_rmse,
+                 stamps);
+  }
+}
 
+// Applies a 42["config",{...}] event, as read by ParseEvent, to a session's
+// settings: every numeric or boolean member that names a UKFConfig field
+// overrides it
+UKFConfig SessionConfig(const Session &session, const TelemetryParser &event)
+{
+  UKFConfig config = session.tracks_.prototype().Config();
+  for (size_t i = 0; i < event.setting_count(); i++) {
+    const TelemetryParser::Setting &setting = event.setting(i);
+    if (!config.Set(setting.key, setting.value)) {
+      UKF_LOG_WARN("Unknown config key %s", setting.key.c_str());
+    }
+  }
+  return config;
+}
 
+// <dir>/hub<hub>-<rank>.snap, the restore snapshot of one connection
+std::string SnapshotPath(const char *dir, int hub, long long rank)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/hub%d-%lld.snap", hub, rank);
+  return std::string(dir) + name;
+}
 
+// <dir>/hub<hub>.ckpt, the latest checkpoint of one hub
+std::string CheckpointPath(const char *dir, int hub)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/hub%d.ckpt", hub);
+  return std::string(dir) + name;
+}
 
+// The connections of one hub, oldest first, and their snapshots: on
+// shutdown the k-th live connection of hub i is saved to
+// <snapshot_dir>/hub<i>-<k>.snap, and after a restart the k-th connection
+// the hub accepts restores it, so clients that reconnect in the order they
+// connected (a single simulator always does) continue with warm filters.
+// With a shared-memory prefix the k-th connection's tracks are exported as
+// <prefix>-hub<i>-<k> while it is open.
+struct ConnectionRegistry {
+  ConnectionRegistry(int hub, const HubOptions &options, ConnectionPool *pool)
+      : hub(hub), snapshot_dir(options.snapshot_dir),
+        shm_prefix(options.shm_prefix), shm_tracks(options.shm_tracks),
+        views(options.region_cell > 0.0), pool(pool), accepted(0),
+        restoring(snapshot_dir != nullptr), closing(false) {}
+
+  std::string SnapshotPath(long long rank) const {
+    return ::SnapshotPath(snapshot_dir, hub, rank);
+  }
 
+  void Add(Connection *conn) {
+    live.push_back(conn);
+    long long ordinal = accepted++;
+    if (shm_prefix) {
+      Export(conn, ordinal);
+    }
+    // region queries read the tracks through a view; an exported one does
+    if (views && !conn->view) {
+      conn->view.reset(new TrackView(shm_tracks));
+      conn->session.tracks_.SetView(conn->view.get());
+    }
+    // snapshots are numbered without gaps: the first one missing ends the
+    // restore, and later connections skip the file system
+    if (!restoring) {
+      return;
+    }
+    std::string path = SnapshotPath(ordinal);
+    size_t restored = 0;
+    if (!conn->session.tracks_.Load(path.c_str(), &restored)) {
+      restoring = false;
+      return;
+    }
+    unlink(path.c_str());
+    UKF_LOG_INFO("Restored %zu tracks from %s", restored, path.c_str());
+  }
 
+  // a failed export leaves the session unpublished, not the client refused
+  void Export(Connection *conn, long long ordinal) {
+    char name[256];
+    snprintf(name, sizeof(name), "%s-hub%d-%lld", shm_prefix, hub, ordinal);
+    std::string error;
+    conn->view = TrackView::CreateShared(name, shm_tracks, &error);
+    if (!conn->view) {
+      UKF_LOG_WARN("Cannot export tracks: %s", error.c_str());
+      return;
+    }
+    conn->session.tracks_.SetView(conn->view.get());
+  }
 
+  void Remove(Connection *conn) {
+    live.erase(std::remove(live.begin(), live.end(), conn), live.end());
+    if (closing && live.empty() && on_empty) {
+      on_empty();
+    }
+  }
 
+  // shutdown: every live connection is saved when it is deleted
+  void Close() {
+    closing = true;
+    if (snapshot_dir) {
+      for (size_t i = 0; i < live.size(); i++) {
+        live[i]->snapshot_rank = static_cast<int>(i);
+      }
+    }
+    if (live.empty() && on_empty) {
+      on_empty();
+    }
+  }
 
+  // returns a connection to the pool once nothing else can touch its
+  // session
+  void Delete(Connection *conn) {
+    if (conn->snapshot_rank >= 0) {
+      std::string path = SnapshotPath(conn->snapshot_rank);
+      if (!conn->session.tracks_.Save(path.c_str())) {
+        UKF_LOG_ERROR("Cannot write snapshot %s", path.c_str());
+      }
+    }
+    if (conn->view) {
+      conn->session.tracks_.SetView(nullptr);
+      conn->view.reset();
+    }
+    pool->Release(conn);
+  }
 
+  const int hub;
+  const char *const snapshot_dir;
+  const char *const shm_prefix;
+  const size_t shm_tracks;
+  // every session publishes its tracks to a view, in memory unless
+  // exported
+  const bool views;
+  ConnectionPool *const pool;
+  std::vector<Connection *> live;
+  long long accepted;
+  bool restoring;
+  bool closing;
+  // called once closing and the last live connection is gone
+  std::function<void()> on_empty;
+};
+
+struct PipelineSink;
+
+// Region queries of a hub (--region-cell): GET /tracks?box=x0,y0,x1,y1 or
+// /tracks?circle=x,y,r returns the live tracks of every session inside the
+// region as {"tracks":[[session,id,timestamp,x,y,vx,vy],...]}, or with
+// &format=binary as BinaryProtocol track records. The index is rebuilt from
+// the sessions' views when a query finds it older than period_ms, so a
+// burst of queries costs one walk over the tracks.
+struct HubRegions {
+  HubRegions(const ConnectionRegistry *registry, double cell_size,
+             int period_ms)
+      : registry(registry), index(cell_size),
+        period_ns(static_cast<long long>(period_ms) * 1000000LL),
+        built_ns(0), built(false) {}
+
+  // the query part of the URL, after '?'; false if it names no region or
+  // something else. The reply stays valid until the next query.
+  bool Answer(const std::string &query, const char **data, size_t *size);
+
+  const ConnectionRegistry *registry;
+  RegionIndex index;
+  const long long period_ns;
+  long long built_ns;
+  bool built;
+  std::vector<int> hits;
+  ResponseWriter json;
+  std::vector<char> records;
+};
+
+// Periodic checkpoints of a hub (--checkpoint-dir): every period each live
+// session's filters are captured, inline between messages or by a
+// CHECKPOINT job on the worker that owns them, and the complete image goes
+// to a background writer. The journal position is taken before the
+// captures; a session's jobs are filtered in order, so its states include
+// exactly its entries before that position and none after.
+struct HubCheckpoint {
+  HubCheckpoint(const ConnectionRegistry *registry,
+                MeasurementJournal *journal, const std::string &path)
+      : registry(registry), journal(journal), sink(nullptr), writer(path),
+        outstanding(0) {}
+
+  // one period; a round still waiting for its workers skips it
+  void Start();
+
+  // a CHECKPOINT job came back
+  void Captured() {
+    if (--outstanding == 0) {
+      writer.Submit(std::move(image));
+    }
+  }
 
+  const ConnectionRegistry *registry;
+  MeasurementJournal *journal;
+  PipelineSink *sink;
+  Checkpoint::Writer writer;
+  // the round being captured, and the CHECKPOINT jobs it waits for
+  std::unique_ptr<Checkpoint::Image> image;
+  size_t outstanding;
+};
+
+// The push side of a hub: connections that sent 42["subscribe",{}] get a
+// 42["tracks",{...}] event per session every period (see Session::Publish)
+// whatever they send themselves, until they send 42["unsubscribe",{}].
+// Consumers then need no request traffic of their own.
+// A subscription may be narrowed to the tracks inside "box":[x0,y0,x1,y1]
+// or "circle":[x,y,r] and/or those listed in "ids":[...]; such a
+// subscriber gets only the matching tracks, and no event for a session
+// without any. Each session's snapshot is put on a grid once per period
+// and every filter is a query against it.
+// Each payload is framed once, as a uWS prepared message (reference
+// counted, freed once every socket has sent it), and the same frame goes
+// to every subscriber it is for: the whole snapshot to all unfiltered
+// subscribers, and each distinct set of matching tracks to all filters
+// that select it. Prepared frames are not compressed, even on connections
+// that negotiated permessage-deflate; deflating per client is the cost the
+// shared frame is there to avoid.
+struct EstimateStream {
+  typedef uWS::WebSocket<uWS::SERVER> Socket;
+
+  // the grid's cell edge in m
+  EstimateStream(const ConnectionRegistry *registry, double cell_size)
+      : registry(registry), sink(nullptr), index(cell_size),
+        payload_count(0) {}
+
+  struct Subscription {
+    Connection *conn;
+    bool has_region;
+    RegionIndex::Region region;
+    // sorted
+    std::vector<unsigned> ids;
+
+    bool filtered() const { return has_region || !ids.empty(); }
+  };
+
+  // a filtered payload of the snapshot being sent: the tracks it holds, in
+  // the snapshot's order, and its frame
+  struct SharedPayload {
+    std::vector<int> hits;
+    Socket::PreparedMessage *message;
+  };
+
+  // subscribes, or replaces the filter of a subscriber; false, leaving the
+  // subscriptions as they were, for a region with the wrong number of
+  // values
+  bool Subscribe(Connection *conn, const TelemetryParser &event);
+
+  void Unsubscribe(Connection *conn) {
+    for (size_t i = 0; i < subscribers.size(); i++) {
+      if (subscribers[i].conn == conn) {
+        subscribers.erase(subscribers.begin() + i);
+        return;
+      }
+    }
+  }
 
+  // sends a session's last snapshot to every subscriber, or the part of it
+  // a filter lets through
+  void Send(const Session &session);
+
+  // one period: every session publishes inline, or on the pipeline worker
+  // that owns its tracks, which hands the snapshot back to Send
+  void Publish();
+
+  // the frame of the filtered payload with the tracks in hits, framed now
+  // if no earlier filter of this snapshot selected the same tracks
+  Socket::PreparedMessage *Filtered(const Session &session);
+
+  const ConnectionRegistry *registry;
+  std::vector<Subscription> subscribers;
+  PipelineSink *sink;
+  // the snapshot being sent, for the filtered subscriptions
+  RegionIndex index;
+  std::vector<int> hits;
+  ResponseWriter filtered;
+  // the first payload_count are this snapshot's; kept with their capacity
+  std::vector<SharedPayload> payloads;
+  size_t payload_count;
+};
+
+// The I/O side of a hub's pipelines: turns results back into replies.
+// Binary results are collected per connection and sent as one frame per
+// drain. Each session is filtered by one of the workers, chosen by a hash of
+// its id, so its jobs stay in order and its filters stay in that worker's
+// caches.
+struct PipelineSink {
+  std::vector<std::unique_ptr<Pipeline> > pipelines;
+#ifdef UKF_COROUTINES
+  // replaces the pipelines when set
+  std::unique_ptr<SessionExecutor> executor;
+#endif
+  std::vector<Connection *> pending;
+  std::function<void(const Pipeline::Result &)> deliver;
+  // coalesced text replies, flushed with the binary ones; null to send
+  // each reply as it comes out
+  ReplyBatcher *batcher;
+  // answer a text measurement the pipeline dropped with a "behind" event
+  // instead of no reply at all
+  bool reply_behind;
+  // receives published snapshots; null without streaming
+  EstimateStream *stream;
+  // deletes connections whose CLOSE came out
+  ConnectionRegistry *registry;
+  // takes captured checkpoints; null without checkpointing
+  HubCheckpoint *checkpoint;
+
+  PipelineSink()
+      : batcher(nullptr), reply_behind(false), stream(nullptr),
+        registry(nullptr), checkpoint(nullptr) {
+    deliver = [this](const Pipeline::Result &r) { Deliver(r); };
+  }
 
+  void Deliver(const Pipeline::Result &r) {
+    Connection *conn = static_cast<Connection *>(r.tag);
+    if (r.kind == Pipeline::CLOSE) {
+      // nothing else for this connection can be queued behind its CLOSE
+      Flush();
+      if (batcher) {
+        batcher->Remove(conn);
+      }
+      registry->Delete(conn);
+      return;
+    }
+    if (r.kind == Pipeline::CONFIGURE) {
+      return;
+    }
+    if (r.kind == Pipeline::CHECKPOINT) {
+      checkpoint->Captured();
+      return;
+    }
+    if (r.kind == Pipeline::PUBLISH) {
+      conn->publishing = false;
+      if (stream) {
+        stream->Send(conn->session);
+      }
+      return;
+    }
+    if (r.dropped) {
+      // binary clients see the gap in the track's estimates
+      if (r.kind == Pipeline::TEXT && reply_behind && conn->open) {
+        ResponseWriter &msg = conn->session.response_;
+        msg.Behind(r.timestamp);
+        conn->ws.send(msg.data(), msg.size(), uWS::OpCode::TEXT);
+      }
+      return;
+    }
+    if (r.kind == Pipeline::TEXT) {
+      if (conn->open) {
+        const bool evaluate = conn->session.evaluate_;
+        const bool window = conn->session.tracks_.rmse_window() > 0;
+        LatencyTrace::Stamps stamps = r.trace;
+        ReplyEstimate(batcher, conn, r.estimate, evaluate ? r.rmse : nullptr,
+                      r.nis, r.nis_exceeded,
+                      evaluate && window ? r.window_rmse : nullptr, &stamps);
+      }
+      return;
+    }
 
+    std::vector<char> &reply = conn->session.reply_;
+    if (reply.empty()) {
+      pending.push_back(conn);
+    }
+    size_t offset = reply.size();
+    reply.resize(offset + BinaryProtocol::kEstimateRecordSize);
+    BinaryProtocol::EncodeEstimate(
+        r.track_id, r.timestamp, Eigen::Vector4d(r.estimate),
+        Eigen::Vector4d(r.rmse), reply.data() + offset);
+    conn->session.reply_stamps_.push_back(r.trace);
+    LatencyTrace::Stamp(&conn->session.reply_stamps_.back(),
+                        LatencyTrace::SERIALIZED);
+  }
 
+  void Flush() {
+    for (size_t i = 0; i < pending.size(); i++) {
+      Connection *conn = pending[i];
+      std::vector<char> &reply = conn->session.reply_;
+      if (conn->open) {
+        UKF_ZONE("SendBinary");
+        conn->ws.send(reply.data(), reply.size(), uWS::OpCode::BINARY);
+        LatencyTrace::EndAll(&conn->session.reply_stamps_,
+                             conn->session.id_);
+      }
+      reply.clear();
+      conn->session.reply_stamps_.clear();
+    }
+    pending.clear();
+    if (batcher) {
+      batcher->Flush();
+    }
+  }
 
+  // the worker of a session (Fibonacci hashing spreads sequential ids)
+  Pipeline &For(const Session *session) {
+    unsigned long long h = session->id_ * 0x9E3779B97F4A7C15ULL;
+    return *pipelines[(h >> 32) % pipelines.size()];
+  }
 
+  void Drain() {
+#ifdef UKF_COROUTINES
+    if (executor) {
+      executor->Drain(deliver);
+    }
+#endif
+    for (size_t i = 0; i < pipelines.size(); i++) {
+      pipelines[i]->Drain(deliver);
+    }
+    Flush();
+  }
 
+  void Submit(const Pipeline::Job &job) {
+#ifdef UKF_COROUTINES
+    if (executor) {
+      executor->Submit(job);
+      return;
+    }
+#endif
+    For(job.session).Submit(job, deliver);
+  }
 
+  // whether every submitted job has come back
+  bool Idle() const {
+#ifdef UKF_COROUTINES
+    if (executor) {
+      Pipeline::Stats stats = executor->stats();
+      return stats.completed >= stats.submitted;
+    }
+#endif
+    for (size_t i = 0; i < pipelines.size(); i++) {
+      Pipeline::Stats stats = pipelines[i]->stats();
+      if (stats.completed < stats.submitted) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
 
+void HubCheckpoint::Start() {
+  if (image) {
+    return;
+  }
+  image = writer.Acquire();
+  image->journal_position = journal->position();
+  const std::vector<Connection *> &connections = registry->live;
+  image->sessions.resize(connections.size());
+  for (size_t i = 0; i < connections.size(); i++) {
+    Connection *conn = connections[i];
+    Checkpoint::Session &saved = image->sessions[i];
+    saved.id = conn->session.id_;
+    saved.records.clear();
+    if (!sink) {
+      conn->session.tracks_.Capture(&saved.records);
+      continue;
+    }
+    Pipeline::Job job;
+    job.kind = Pipeline::CHECKPOINT;
+    job.session = &conn->session;
+    job.tag = conn;
+    job.track_id = 0;
+    job.meas = Measurement();
+    job.records = &saved.records;
+    ++outstanding;
+    sink->Submit(job);
+  }
+  if (outstanding == 0) {
+    writer.Submit(std::move(image));
+  }
+}
 
+bool HubRegions::Answer(const std::string &query, const char **data,
+                        size_t *size) {
+  RegionIndex::Region region;
+  bool have_region = false;
+  bool binary = false;
+  size_t start = 0;
+  while (start < query.size()) {
+    size_t end = query.find('&', start);
+    if (end == std::string::npos) {
+      end = query.size();
+    }
+    const std::string param = query.substr(start, end - start);
+    start = end + 1;
+    if (param.empty() || param == "format=json") {
+      continue;
+    }
+    if (param == "format=binary") {
+      binary = true;
+    }
+    else if (RegionIndex::Region::Parse(param, &region)) {
+      have_region = true;
+    }
+    else {
+      return false;
+    }
+  }
+  if (!have_region) {
+    return false;
+  }
 
+  const long long now_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+  if (!built || now_ns - built_ns >= period_ns) {
+    index.Clear();
+    const std::vector<Connection *> &connections = registry->live;
+    for (size_t i = 0; i < connections.size(); i++) {
+      if (connections[i]->view) {
+        index.Add(connections[i]->session.id_, *connections[i]->view);
+      }
+    }
+    built_ns = now_ns;
+    built = true;
+  }
 
+  // grid order is cell order; entries are in session and slot order
+  hits.clear();
+  index.Query(region, &hits);
+  std::sort(hits.begin(), hits.end());
+  if (binary) {
+    records.resize(hits.size() * BinaryProtocol::kTrackRecordSize);
+    for (size_t i = 0; i < hits.size(); i++) {
+      const RegionIndex::Entry &e = index.entry(hits[i]);
+      BinaryProtocol::EncodeTrack(
+          e.session, e.id, e.timestamp, e.estimate,
+          records.data() + i * BinaryProtocol::kTrackRecordSize);
+    }
+    *data = records.data();
+    *size = records.size();
+    return true;
+  }
+  json.RegionBegin();
+  for (size_t i = 0; i < hits.size(); i++) {
+    const RegionIndex::Entry &e = index.entry(hits[i]);
+    json.RegionTrack(e.session, e.id, e.timestamp, e.estimate);
+  }
+  json.FinishRegion();
+  *data = json.data();
+  *size = json.size();
+  return true;
+}
 
+bool EstimateStream::Subscribe(Connection *conn,
+                               const TelemetryParser &event) {
+  Subscription subscription;
+  subscription.conn = conn;
+  subscription.has_region = false;
+  double box[4];
+  double circle[3];
+  size_t box_values = 0;
+  size_t circle_values = 0;
+  for (size_t i = 0; i < event.setting_count(); i++) {
+    const TelemetryParser::Setting &setting = event.setting(i);
+    if (setting.key == "box" && box_values < 4) {
+      box[box_values] = setting.value;
+      ++box_values;
+    }
+    else if (setting.key == "circle" && circle_values < 3) {
+      circle[circle_values] = setting.value;
+      ++circle_values;
+    }
+    else if (setting.key == "ids" && setting.value >= 0.0) {
+      subscription.ids.push_back(static_cast<unsigned>(setting.value));
+    }
+    else {
+      UKF_LOG_WARN("Unknown subscription key %s", setting.key.c_str());
+    }
+  }
+  if ((box_values != 0 && box_values != 4) ||
+      (circle_values != 0 && circle_values != 3) ||
+      (box_values && circle_values) ||
+      (circle_values && circle[2] < 0.0)) {
+    return false;
+  }
+  if (box_values) {
+    subscription.has_region = true;
+    subscription.region =
+        RegionIndex::Region::Box(box[0], box[1], box[2], box[3]);
+  }
+  else if (circle_values) {
+    subscription.has_region = true;
+    subscription.region =
+        RegionIndex::Region::Circle(circle[0], circle[1], circle[2]);
+  }
+  std::sort(subscription.ids.begin(), subscription.ids.end());
 
+  for (size_t i = 0; i < subscribers.size(); i++) {
+    if (subscribers[i].conn == conn) {
+      subscribers[i] = std::move(subscription);
+      return true;
+    }
+  }
+  subscribers.push_back(std::move(subscription));
+  return true;
+}
 
+void EstimateStream::Send(const Session &session) {
+  const ResponseWriter &msg = session.stream_;
+  if (msg.size() == 0) {
+    return;
+  }
+  UKF_STAGE_TIMER(STAGE_SEND);
+  UKF_ZONE("SendStream");
+  const std::vector<RegionIndex::Entry> &published = session.published_;
+
+  //the whole snapshot; a lone subscriber is sent it without the copy
+  size_t unfiltered = 0;
+  for (size_t s = 0; s < subscribers.size(); s++) {
+    unfiltered += subscribers[s].filtered() ? 0 : 1;
+  }
+  Socket::PreparedMessage *whole = nullptr;
+  if (unfiltered > 1) {
+    whole = Socket::prepareMessage(const_cast<char *>(msg.data()),
+                                   msg.size(), uWS::OpCode::TEXT, false);
+  }
 
+  bool indexed = false;
+  payload_count = 0;
+  for (size_t s = 0; s < subscribers.size(); s++) {
+    const Subscription &subscription = subscribers[s];
+    if (!subscription.filtered()) {
+      if (whole) {
+        subscription.conn->ws.sendPrepared(whole);
+      }
+      else {
+        subscription.conn->ws.send(msg.data(), msg.size(),
+                                   uWS::OpCode::TEXT);
+      }
+      continue;
+    }
+    if (!indexed) {
+      index.Clear();
+      for (size_t i = 0; i < published.size(); i++) {
+        index.Add(published[i]);
+      }
+      indexed = true;
+    }
+    hits.clear();
+    if (subscription.has_region) {
+      index.Query(subscription.region, &hits);
+    }
+    const std::vector<unsigned> &ids = subscription.ids;
+    for (size_t i = 0; !ids.empty() && i < published.size(); i++) {
+      if (std::binary_search(ids.begin(), ids.end(), published[i].id)) {
+        hits.push_back(static_cast<int>(i));
+      }
+    }
+    if (hits.empty()) {
+      continue;
+    }
+    // in the snapshot's order, each track once
+    std::sort(hits.begin(), hits.end());
+    hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+    subscription.conn->ws.sendPrepared(Filtered(session));
+  }
 
+  //the sockets hold their own references until the frames are out
+  if (whole) {
+    Socket::finalizeMessage(whole);
+  }
+  for (size_t p = 0; p < payload_count; p++) {
+    Socket::finalizeMessage(payloads[p].message);
+  }
+  payload_count = 0;
+}
 
+EstimateStream::Socket::PreparedMessage *EstimateStream::Filtered(
+    const Session &session) {
+  for (size_t p = 0; p < payload_count; p++) {
+    if (payloads[p].hits == hits) {
+      return payloads[p].message;
+    }
+  }
+  const std::vector<RegionIndex::Entry> &published = session.published_;
+  filtered.TracksBegin(session.id_, published[0].timestamp);
+  for (size_t i = 0; i < hits.size(); i++) {
+    const RegionIndex::Entry &entry = published[hits[i]];
+    filtered.TrackEstimate(entry.id, entry.estimate);
+  }
+  filtered.FinishTracks();
 
+  if (payload_count == payloads.size()) {
+    payloads.push_back(SharedPayload());
+  }
+  SharedPayload &payload = payloads[payload_count++];
+  payload.hits.assign(hits.begin(), hits.end());
+  payload.message = Socket::prepareMessage(
+      const_cast<char *>(filtered.data()), filtered.size(),
+      uWS::OpCode::TEXT, false);
+  return payload.message;
+}
 
+void EstimateStream::Publish() {
+  if (subscribers.empty()) {
+    return;
+  }
+  const long long now_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+  const std::vector<Connection *> &connections = registry->live;
+  for (size_t i = 0; i < connections.size(); i++) {
+    Connection *conn = connections[i];
+    if (!sink) {
+      if (conn->session.Publish(now_ns)) {
+        Send(conn->session);
+      }
+      continue;
+    }
+    // a session slower than the period skips a round
+    if (conn->publishing) {
+      continue;
+    }
+    conn->publishing = true;
+    Pipeline::Job job;
+    job.kind = Pipeline::PUBLISH;
+    job.session = &conn->session;
+    job.tag = conn;
+    job.track_id = 0;
+    job.meas = Measurement();
+    sink->Submit(job);
+  }
+}
 
+// Registers the message, HTTP and connection handlers on one hub. Every hub
+// owns the sessions of the connections it accepted.
+// With a sink, filtering runs on the sink's pipeline worker and replies are
+// sent when its results are drained; without one everything runs inline.
+// Connections come from the registry's pool. With a batcher, text replies
+// are coalesced; with a stream, connections may subscribe to published
+// estimates. With a journal, every measurement is journaled as it arrives.
+// With regions, GET /tracks answers region queries. All of them must
+// outlive the hub.
+void ConfigureHub(uWS::Hub &h, ConnectionRegistry *registry,
+                  PipelineSink *sink, ReplyBatcher *batcher,
+                  EstimateStream *stream, MeasurementJournal *journal,
+                  ConfigReload *reload, HubRegions *regions)
+{
+  // each connection gets its own Session (filters, bounded history, parser
+  // and reply buffer) through the socket's user data
+  h.onMessage([sink, batcher, stream, journal](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length, uWS::OpCode opCode) {
+    Connection *conn = static_cast<Connection *>(ws.getUserData());
+    if (!conn) {
+      return;
+    }
+    Session *session = &conn->session;
+    TrackTable &tracks = session->tracks_;
+    TelemetryParser &parser = session->parser_;
+    std::vector<char> &reply = session->reply_;
 
+    // every measurement of the frame carries these to its reply's send
+    LatencyTrace::Stamps received;
+    LatencyTrace::Begin(&received);
 
+    Metrics::Increment(opCode == uWS::OpCode::BINARY ? Metrics::MESSAGES_BINARY
+                                                     : Metrics::MESSAGES_TEXT);
 
+    if (opCode == uWS::OpCode::BINARY && journal) {
+      journal->Append(session->id_, MeasurementJournal::NowUs(), data,
+                      length / BinaryProtocol::kMeasurementRecordSize);
+    }
 
+    // clients that send binary records get binary records back: one frame of
+    // measurement records in, one frame of estimate records out
+    if (opCode == uWS::OpCode::BINARY && sink) {
+      size_t count = length / BinaryProtocol::kMeasurementRecordSize;
+      UKF_ZONE("DecodeBinary");
+      for (size_t i = 0; i < count; i++) {
+        Pipeline::Job job;
+        Eigen::Vector4d gt_values;
+        if (!BinaryProtocol::DecodeMeasurement(
+                data + i * BinaryProtocol::kMeasurementRecordSize,
+                BinaryProtocol::kMeasurementRecordSize, &job.track_id,
+                &job.meas, &gt_values)) {
+          continue;
+        }
+        job.kind = Pipeline::BINARY;
+        job.session = session;
+        job.tag = conn;
+        Eigen::Map<Eigen::Vector4d>(job.ground_truth) = gt_values;
+        job.trace = received;
+        job.trace.timestamp = job.meas.timestamp_;
+        job.trace.track_id = job.track_id;
+        LatencyTrace::Stamp(&job.trace, LatencyTrace::PARSED);
+        sink->Submit(job);
+      }
+      return;
+    }
+    if (opCode == uWS::OpCode::BINARY) {
+      size_t bytes = session->ProcessRecords(
+          data, length / BinaryProtocol::kMeasurementRecordSize, &received);
+      if (bytes) {
+        ws.send(reply.data(), bytes, uWS::OpCode::BINARY);
+      }
+      LatencyTrace::EndAll(&session->reply_stamps_, session->id_);
+      return;
+    }
 
+    // "42" at the start of the message means there's a websocket message event.
+    // The 4 signifies a websocket message
+    // The 2 signifies a websocket event
 
+    if (length && length > 2 && data[0] == '4' && data[1] == '2')
+    {
 
+      TelemetryParser::Result result;
+      {
+        UKF_STAGE_TIMER(STAGE_PARSE);
+        UKF_ZONE("Parse");
+        result = parser.Parse(data, length);
+      }
+      LatencyTrace::Stamp(&received, LatencyTrace::PARSED);
+
+      if (result == TelemetryParser::OTHER_EVENT) {
+        // per-session tuning: 42["config",{"std_a":2.5,...}]; a bad event
+        // is counted and dropped without unwinding through uWS
+        const bool readable =
+            parser.ParseEvent(data, length) == TelemetryParser::OTHER_EVENT;
+        if (!readable) {
+          Metrics::Increment(Metrics::MESSAGES_MALFORMED);
+        }
+        const std::string &event = parser.event();
+        if (readable && event == "config") {
+          UKFConfig config = SessionConfig(*session, parser);
+          if (sink) {
+            Pipeline::Job job;
+            job.kind = Pipeline::CONFIGURE;
+            job.session = session;
+            job.tag = conn;
+            job.track_id = 0;
+            job.meas = Measurement();
+            job.config = new UKFConfig(config);
+            sink->Submit(job);
+          }
+          else {
+            tracks.Configure(config);
+          }
+          UKF_LOG_INFO("Session reconfigured");
+        }
+        else if (readable && event == "subscribe" && stream) {
+          if (stream->Subscribe(conn, parser)) {
+            UKF_LOG_INFO("Subscribed to estimates");
+          }
+          else {
+            UKF_LOG_WARN("Subscription ignored: malformed region");
+          }
+        }
+        else if (readable && event == "unsubscribe" && stream) {
+          stream->Unsubscribe(conn);
+        }
+      }
 
+      if (result == TelemetryParser::MALFORMED) {
+        // the scanner only knows the simulator's own framing; anything else
+        // goes through the streaming JSON reader, which takes any valid
+        // JSON without building a tree
+        UKF_ZONE("ParseJson");
+        result = parser.ParseJson(data, length);
+        if (result == TelemetryParser::MALFORMED) {
+          Metrics::Increment(Metrics::MESSAGES_MALFORMED);
+        }
+      }
 
+      // text measurements are journaled as the record of track 0
+      if (result == TelemetryParser::TELEMETRY) {
+        received.timestamp = parser.measurement().timestamp_;
+      }
 
+      if (result == TelemetryParser::TELEMETRY && journal) {
+        char record[BinaryProtocol::kMeasurementRecordSize];
+        const Eigen::Vector4d &gt_values = parser.ground_truth();
+        BinaryProtocol::EncodeMeasurement(
+            0, Measurement::From(parser.measurement()),
+            session->evaluate_ ? &gt_values : nullptr, record);
+        journal->Append(session->id_, MeasurementJournal::NowUs(), record, 1);
+      }
 
+      if (result == TelemetryParser::TELEMETRY && sink) {
+          Pipeline::Job job;
+          job.kind = Pipeline::TEXT;
+          job.session = session;
+          job.tag = conn;
+          job.track_id = 0;
+          job.meas = Measurement::From(parser.measurement());
+          Eigen::Map<Eigen::Vector4d>(job.ground_truth) = parser.ground_truth();
+          job.trace = received;
+          sink->Submit(job);
+
+      } else if (result == TelemetryParser::TELEMETRY && !session->evaluate_) {
+          // production feeds: no ground truth, history or RMSE
+          TrackTable::Track &track = tracks.Get(0);
+          Eigen::Vector4d estimate;
+          LatencyTrace::Enter(&received);
+          track.Process(Measurement::From(parser.measurement()), &estimate);
+          LatencyTrace::Leave();
+          session->AccountMemory();
+          LatencyTrace::Stamp(&received, LatencyTrace::FILTERED);
+          ReplyEstimate(batcher, conn, estimate.data(), nullptr, track.nis(),
+                        track.nis_counter().ExceededFraction(), nullptr,
+                        &received);
+
+      } else if (result == TelemetryParser::TELEMETRY) {
+          TrackTable::Track &track = tracks.Get(0);
+          const Eigen::Vector4d &gt_values = parser.ground_truth();
+          Eigen::Vector4d estimate;
 
+          //Call ProcessMeasurment(meas_package) for Kalman filter
+          LatencyTrace::Enter(&received);
+          track.Process(Measurement::From(parser.measurement()), gt_values,
+                        &estimate);
+          LatencyTrace::Leave();
+
+          session->ground_truth_.push_back(gt_values);
+          session->estimations_.push_back(estimate);
+          session->AccountMemory();
+
+          // O(1) per message instead of re-summing the whole history
+          Eigen::Vector4d RMSE = track.rmse.RMSE();
+          Eigen::Vector4d window_rmse = track.window_rmse.RMSE();
+          LatencyTrace::Stamp(&received, LatencyTrace::FILTERED);
+          ReplyEstimate(batcher, conn, estimate.data(), RMSE.data(),
+                        track.nis(), track.nis_counter().ExceededFraction(),
+                        track.window_rmse.enabled() ? window_rmse.data()
+                                                    : nullptr,
+                        &received);
+
+      } else if (result == TelemetryParser::NO_DATA) {
+
+        static const char msg[] = "42[\"manual\",{}]";
+        ws.send(msg, sizeof(msg) - 1, uWS::OpCode::TEXT);
+      }
+    }
 
+  });
 
+  // GET /metrics is scraped by monitoring; /stages is the human-readable
+  // stage histogram dump and /traces the sampled latency traces
+  h.onHttpRequest([reload, regions](uWS::HttpResponse *res, uWS::HttpRequest req, char *data, size_t, size_t) {
+    const std::string s = "<h1>Hello world!</h1>";
+    uWS::Header url = req.getUrl();
+    if (url.valueLength == 1)
+    {
+      res->end(s.data(), s.length());
+    }
+    else if (url.toString() == "/metrics")
+    {
+      std::string text = Metrics::Render();
+      res->end(text.data(), text.length());
+    }
+    else if (url.toString() == "/stages")
+    {
+      // per-stage latency histograms; empty unless built with
+      // UKF_STAGE_TIMING
+      std::string dump = StageTimings::Dump();
+      res->end(dump.data(), dump.length());
+    }
+    else if (url.toString() == "/traces")
+    {
+      // empty unless started with --trace-sample or sampling was set
+      std::string dump = LatencyTrace::DumpTraces();
+      res->end(dump.data(), dump.length());
+    }
+    else if (url.toString().compare(0, 15, "/traces?sample=") == 0)
+    {
+      // trace one measurement in n from now on, 0 for none, without a
+      // restart
+      const unsigned long every =
+          strtoul(url.toString().c_str() + 15, nullptr, 10);
+      LatencyTrace::SetSampling(static_cast<unsigned>(every));
+      char reply[64];
+      const int length = snprintf(reply, sizeof(reply),
+                                  "tracing 1 in %lu\n", every);
+      res->end(reply, length);
+    }
+    else if (regions && url.toString().compare(0, 8, "/tracks?") == 0)
+    {
+      const char *reply;
+      size_t size;
+      if (!regions->Answer(url.toString().substr(8), &reply, &size)) {
+        static const char usage[] =
+            "expected box=x0,y0,x1,y1 or circle=x,y,r [&format=binary]\n";
+        res->end(usage, sizeof(usage) - 1);
+        return;
+      }
+      res->end(reply, size);
+    }
+    else if (url.toString() == "/reload" && reload)
+    {
+      // the tracks pick the new tuning up at their next measurement
+      std::string error;
+      std::string reply = "reloaded\n";
+      if (!reload->Reload(&error)) {
+        UKF_LOG_WARN("Config not reloaded: %s", error.c_str());
+        reply = error + "\n";
+      }
+      else {
+        UKF_LOG_INFO("Config reloaded, generation %lu",
+                     ConfigReload::Current()->generation);
+      }
+      res->end(reply.data(), reply.length());
+    }
+    else
+    {
+      // i guess this should be done more gracefully?
+      res->end(nullptr, 0);
+    }
+  });
 
+  h.onConnection([registry](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+    Connection *conn = registry->pool->Acquire(ws);
+    ws.setUserData(conn);
+    registry->Add(conn);
+    UKF_LOG_INFO("Connected!!!");
+  });
 
+  h.onDisconnection([registry, sink, batcher, stream](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) {
+    Connection *conn = static_cast<Connection *>(ws.getUserData());
+    ws.setUserData(nullptr);
+    if (conn) {
+      registry->Remove(conn);
+    }
+    if (conn && stream) {
+      stream->Unsubscribe(conn);
+    }
+    if (conn && sink) {
+      // deleted by the sink once the worker is done with it
+      conn->open = false;
+      Pipeline::Job job;
+      job.kind = Pipeline::CLOSE;
+      job.session = &conn->session;
+      job.tag = conn;
+      job.track_id = 0;
+      job.meas = Measurement();
+      sink->Submit(job);
+
+      Pipeline::Stats stats = sink->For(&conn->session).stats();
+      UKF_LOG_INFO("Pipeline: %llu submitted, %llu completed, "
+                   "%llu input stalls, %llu output stalls, "
+                   "%llu dropped, %llu coalesced",
+                   stats.submitted, stats.completed, stats.input_stalls,
+                   stats.output_stalls,
+                   stats.dropped_full + stats.dropped_late +
+                   stats.missed_deadline, stats.coalesced);
+    }
+    else if (conn) {
+      if (batcher) {
+        batcher->Remove(conn);
+      }
+      registry->Delete(conn);
+    }
+    ws.close();
+    UKF_LOG_INFO("Disconnected");
+  });
 
+}
 
+// Runs one event loop on the given port until shutdown; with reuse_port
+// several hubs in separate threads listen on the same port and the kernel
+// spreads connections across them. On shutdown the hub closes its
+// connections, drains its pipeline and saves its sessions before it
+// returns.
+// Crash recovery of one hub (--recover): its last checkpoint, brought up to
+// the end of the journal, is written out as the snapshots the hub's first
+// connections restore, as after a clean shutdown. Sessions that opened
+// after the checkpoint are not in it and start cold.
+bool RecoverHub(const UKF &prototype, const HubOptions &options,
+                const char *journal_path, int index)
+{
+  const std::string path = CheckpointPath(options.checkpoint_dir, index);
+  if (access(path.c_str(), F_OK) != 0) {
+    UKF_LOG_INFO("No checkpoint for hub %d", index);
+    return true;
+  }
+  Checkpoint::Image image;
+  std::string error;
+  size_t replayed = 0;
+  if (!Checkpoint::Read(path.c_str(), &image, &error) ||
+      !Checkpoint::Replay(journal_path, prototype, &image, &replayed,
+                          &error)) {
+    UKF_LOG_ERROR("%s", error.c_str());
+    return false;
+  }
+  for (size_t k = 0; k < image.sessions.size(); k++) {
+    const std::string snapshot =
+        SnapshotPath(options.snapshot_dir, index, static_cast<long long>(k));
+    if (!FilterSnapshot::Write(snapshot.c_str(), image.sessions[k].records)) {
+      UKF_LOG_ERROR("Cannot write snapshot %s", snapshot.c_str());
+      return false;
+    }
+  }
+  // the snapshots now hold the states; the new process checkpoints anew
+  unlink(path.c_str());
+  UKF_LOG_INFO("Recovered %zu sessions of hub %d, replaying %zu journaled "
+               "measurements", image.sessions.size(), index, replayed);
+  return true;
+}
 
+bool RunHub(const UKF &prototype, const HubOptions &options, int index,
+            bool reuse_port)
+{
+  // pinned before anything is allocated, so that the pool and the rings
+  // are first touched, and placed, on this CPU's NUMA node
+  const int loop_cpu = options.loop_cpus.empty()
+      ? -1 : options.loop_cpus[index % options.loop_cpus.size()];
+  if (loop_cpu >= 0 && !CpuAffinity::PinCurrentThread(loop_cpu)) {
+    UKF_LOG_WARN("Cannot pin hub %d to CPU %d", index, loop_cpu);
+  }
 
+  uWS::Hub h(options.socket.extensions, false, options.socket.max_payload);
+  ConnectionPool pool(prototype, options, options.pool_size);
+  ConnectionRegistry registry(index, options, &pool);
+
+  // text replies coalesced for up to coalesce_ms; a pipelined hub also
+  // flushes them after every drain
+  std::unique_ptr<ReplyBatcher> batcher;
+  uS::Timer *flush_timer = nullptr;
+  if (options.coalesce_ms > 0) {
+    batcher.reset(new ReplyBatcher());
+    flush_timer = new uS::Timer(h.getLoop());
+    flush_timer->setData(batcher.get());
+    flush_timer->start([](uS::Timer *t) {
+      static_cast<ReplyBatcher *>(t->getData())->Flush();
+    }, options.coalesce_ms, options.coalesce_ms);
+  }
 
+  // the worker wakes this loop through an async handle to drain results
+  PipelineSink sink;
+  sink.batcher = batcher.get();
+  sink.reply_behind = options.reply_behind;
+  sink.registry = &registry;
+
+  // every stream_ms the sessions' tracks go out to subscribers
+  std::unique_ptr<EstimateStream> stream;
+  uS::Timer *stream_timer = nullptr;
+  if (options.stream_ms > 0) {
+    stream.reset(new EstimateStream(
+        &registry, options.region_cell > 0.0 ? options.region_cell
+                                             : kStreamCellM));
+    stream->sink = options.pipelined ? &sink : nullptr;
+    sink.stream = stream.get();
+    stream_timer = new uS::Timer(h.getLoop());
+    stream_timer->setData(stream.get());
+    stream_timer->start([](uS::Timer *t) {
+      static_cast<EstimateStream *>(t->getData())->Publish();
+    }, options.stream_ms, options.stream_ms);
+  }
 
+  // every checkpoint_ms the sessions' filters are checkpointed
+  std::unique_ptr<HubCheckpoint> checkpoint;
+  uS::Timer *checkpoint_timer = nullptr;
+  if (options.checkpoint_dir) {
+    checkpoint.reset(new HubCheckpoint(
+        &registry, options.journal,
+        CheckpointPath(options.checkpoint_dir, index)));
+    checkpoint->sink = options.pipelined ? &sink : nullptr;
+    sink.checkpoint = checkpoint.get();
+    checkpoint_timer = new uS::Timer(h.getLoop());
+    checkpoint_timer->setData(checkpoint.get());
+    checkpoint_timer->start([](uS::Timer *t) {
+      static_cast<HubCheckpoint *>(t->getData())->Start();
+    }, options.checkpoint_ms, options.checkpoint_ms);
+  }
 
+  // the worker may still notify after the handle is closed on shutdown
+  uS::Async *wakeup = nullptr;
+  std::mutex wakeup_mutex;
+  if (options.pipelined) {
+    wakeup = new uS::Async(h.getLoop());
+    wakeup->setData(&sink);
+    wakeup->start([](uS::Async *a) {
+      static_cast<PipelineSink *>(a->getData())->Drain();
+    });
+#ifdef UKF_COROUTINES
+    if (options.coroutines) {
+      std::vector<int> cpus;
+      for (int i = 0; i < options.workers && !options.worker_cpus.empty();
+           i++) {
+        const std::vector<int> &all = options.worker_cpus;
+        cpus.push_back(all[(index * options.workers + i) % all.size()]);
+      }
+      sink.executor.reset(new SessionExecutor(options.workers,
+                                              [&wakeup, &wakeup_mutex]() {
+        std::lock_guard<std::mutex> lock(wakeup_mutex);
+        if (wakeup) {
+          wakeup->send();
+        }
+      }, cpus));
+    }
+#endif
+    for (int i = 0; i < options.workers && !options.coroutines; i++) {
+      const std::vector<int> &cpus = options.worker_cpus;
+      int cpu = cpus.empty()
+          ? -1 : cpus[(index * options.workers + i) % cpus.size()];
+      if (cpu >= 0 && loop_cpu >= 0 &&
+          CpuAffinity::NodeOf(cpu) != CpuAffinity::NodeOf(loop_cpu)) {
+        UKF_LOG_WARN("Hub %d on CPU %d and its worker on CPU %d are on "
+                     "different NUMA nodes", index, loop_cpu, cpu);
+      }
+      sink.pipelines.emplace_back(new Pipeline(kPipelineCapacity,
+                                               [&wakeup, &wakeup_mutex]() {
+        std::lock_guard<std::mutex> lock(wakeup_mutex);
+        if (wakeup) {
+          wakeup->send();
+        }
+      }, options.overload, cpu));
+      Metrics::AddPipeline(sink.pipelines.back().get());
+    }
+  }
+  std::unique_ptr<HubRegions> regions;
+  if (options.region_cell > 0.0) {
+    regions.reset(new HubRegions(&registry, options.region_cell,
+                                 options.region_ms));
+  }
+  ConfigureHub(h, &registry, options.pipelined ? &sink : nullptr,
+               batcher.get(), stream.get(), options.journal, options.reload,
+               regions.get());
+
+  // shutdown: stop the timers, close every connection gracefully, and once
+  // the last one is gone (or kCloseTimeoutMs later) close the remaining
+  // handles so h.run() returns
+  uS::Timer *close_timer = nullptr;
+  uS::Async *shutdown = new uS::Async(h.getLoop());
+  std::function<void()> finish = [&]() {
+    if (close_timer) {
+      close_timer->stop();
+      close_timer->close();
+      close_timer = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(wakeup_mutex);
+    if (wakeup) {
+      wakeup->close();
+      wakeup = nullptr;
+    }
+  };
+  std::function<void()> begin_shutdown = [&]() {
+    shutdown->close();
+    if (batcher) {
+      batcher->Flush();
+    }
+    if (flush_timer) {
+      flush_timer->stop();
+      flush_timer->close();
+      flush_timer = nullptr;
+    }
+    if (stream_timer) {
+      stream_timer->stop();
+      stream_timer->close();
+      stream_timer = nullptr;
+    }
+    if (checkpoint_timer) {
+      checkpoint_timer->stop();
+      checkpoint_timer->close();
+      checkpoint_timer = nullptr;
+    }
+    close_timer = new uS::Timer(h.getLoop());
+    close_timer->setData(&h);
+    close_timer->start([](uS::Timer *t) {
+      static_cast<uWS::Hub *>(t->getData())->
+          getDefaultGroup<uWS::SERVER>().terminate();
+    }, kCloseTimeoutMs, 0);
+    registry.on_empty = finish;
+    registry.Close();
+    h.getDefaultGroup<uWS::SERVER>().close(1001);
+  };
+  shutdown->setData(&begin_shutdown);
+  shutdown->start([](uS::Async *a) {
+    (*static_cast<std::function<void()> *>(a->getData()))();
+  });
 
+  int listen_options = reuse_port ? uS::ListenOptions::REUSE_PORT : 0;
+  if (!h.listen(options.port, nullptr, listen_options))
+  {
+    UKF_LOG_ERROR("Failed to listen to port");
+    return false;
+  }
+  UKF_LOG_INFO("Listening to port %d", options.port);
+  OnShutdown([shutdown]() { shutdown->send(); });
+  h.run();
 
+  // the CLOSE jobs of the last connections are still in the pipeline: their
+  // results delete (and save) the sessions
+  while (!sink.Idle()) {
+    sink.Drain();
+    std::this_thread::yield();
+  }
+  for (size_t i = 0; i < sink.pipelines.size(); i++) {
+    Metrics::RemovePipeline(sink.pipelines[i].get());
+  }
+  sink.pipelines.clear();
+#ifdef UKF_COROUTINES
+  sink.executor.reset();
+#endif
+  if (checkpoint) {
+    checkpoint->writer.Stop();
+    // the shutdown snapshots are newer; a stale checkpoint must not be
+    // recovered over them
+    if (options.snapshot_dir) {
+      unlink(checkpoint->writer.path().c_str());
+    }
+    UKF_LOG_INFO("Hub %d wrote %llu checkpoints", index,
+                 checkpoint->writer.written());
+  }
+  UKF_LOG_INFO("Hub %d stopped", index);
+  return true;
+}
 
+int main(int argc, char *argv[])
+{
+  // settings of every event loop
+  HubOptions options;
+  // number of event loops, each on its own thread
+  int threads = 1;
+  // also take binary records on this Unix domain socket (--unix <path>)
+  const char *unix_path = nullptr;
+  // clients expected at once, across all event loops; their connections
+  // are preallocated
+  size_t max_connections = 0;
+  // measurements kept per track to fuse late ones (negative: as configured)
+  int oosm_depth = -1;
+  // longest single prediction step in s (negative: as configured)
+  double max_step = -1.0;
+  // filter settings, from --config
+  UKFConfig config;
+  // write-ahead journal of every measurement (--journal <path>)
+  const char *journal_path = nullptr;
+  MeasurementJournal::Options journal_options;
+  // bounded worst-case latency (--realtime, --rt-priority <n>)
+  bool realtime = false;
+  Realtime::Options realtime_options;
+  // time the kernel versions at startup (--autotune), keeping the choice
+  // in a file (--autotune-cache <path>)
+  bool autotune = false;
+  const char *autotune_cache = nullptr;
+  // also run one measurement in shadow_sample through a filter configured
+  // from this file, comparing it with the served one (--shadow-config
+  // <file>, --shadow-sample <n>)
+  const char *shadow_config = nullptr;
+  unsigned long shadow_sample = 100;
+  // the file given with --config, reread at runtime (see ConfigReload)
+  const char *config_path = nullptr;
+  bool watch_config = false;
+  // rebuild the sessions from the checkpoints and the journal on startup
+  bool recover = false;
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--pipeline") == 0) {
+      options.pipelined = true;
+    }
+    else if (strcmp(argv[i], "--realtime") == 0) {
+      // the filters need a thread of their own that does no I/O
+      realtime = true;
+      options.pipelined = true;
+    }
+    else if (strcmp(argv[i], "--autotune") == 0) {
+      autotune = true;
+    }
+    else if (has_value && strcmp(argv[i], "--autotune-cache") == 0) {
+      autotune = true;
+      autotune_cache = argv[++i];
+    }
+    else if (has_value && strcmp(argv[i], "--shadow-config") == 0) {
+      shadow_config = argv[++i];
+    }
+    else if (has_value && strcmp(argv[i], "--shadow-sample") == 0) {
+      shadow_sample = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (has_value && strcmp(argv[i], "--huge-pages") == 0) {
+      // journal buffers and snapshot mappings: off, thp or explicit
+      HugePages::Policy policy;
+      if (!HugePages::ParsePolicy(argv[++i], &policy)) {
+        UKF_LOG_ERROR("Unknown huge page policy %s", argv[i]);
+        return -1;
+      }
+      HugePages::SetPolicy(policy);
+    }
+    else if (has_value && strcmp(argv[i], "--rt-priority") == 0) {
+      realtime_options.priority = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--no-eval") == 0) {
+      options.evaluate = false;
+    }
+    else if (strcmp(argv[i], "--reply-behind") == 0) {
+      options.reply_behind = true;
+    }
+    else if (has_value && strcmp(argv[i], "--overload") == 0) {
+      const char *mode = argv[++i];
+      if (strcmp(mode, "block") == 0) {
+        options.overload.mode = Pipeline::BLOCK;
+      }
+      else if (strcmp(mode, "drop-oldest") == 0) {
+        options.overload.mode = Pipeline::DROP_OLDEST;
+      }
+      else if (strcmp(mode, "lidar-first") == 0) {
+        options.overload.mode = Pipeline::DROP_LIDAR_FIRST;
+      }
+      else if (strcmp(mode, "coalesce-lidar") == 0) {
+        options.overload.mode = Pipeline::COALESCE_LIDAR;
+      }
+      else if (strcmp(mode, "deadline") == 0) {
+        options.overload.mode = Pipeline::DEADLINE;
+      }
+      else {
+        UKF_LOG_ERROR("Unknown overload policy %s", mode);
+        return -1;
+      }
+    }
+    else if (has_value && strcmp(argv[i], "--compression") == 0) {
+      const char *mode = argv[++i];
+      if (strcmp(mode, "off") == 0) {
+        options.socket.extensions = uWS::NO_OPTIONS;
+      }
+      else if (strcmp(mode, "shared") == 0) {
+        options.socket.extensions = uWS::PERMESSAGE_DEFLATE;
+      }
+      else if (strcmp(mode, "sliding") == 0) {
+        options.socket.extensions =
+            uWS::PERMESSAGE_DEFLATE | uWS::SLIDING_DEFLATE_WINDOW;
+      }
+      else {
+        UKF_LOG_ERROR("Unknown compression mode %s", mode);
+        return -1;
+      }
+    }
+    else if (has_value && strcmp(argv[i], "--executor") == 0) {
+      const char *executor = argv[++i];
+      options.pipelined = true;
+      if (strcmp(executor, "pipeline") == 0) {
+        options.coroutines = false;
+      }
+#ifdef UKF_COROUTINES
+      else if (strcmp(executor, "coroutines") == 0) {
+        options.coroutines = true;
+      }
+#endif
+      else {
+        UKF_LOG_ERROR("Unknown executor %s", executor);
+        return -1;
+      }
+    }
+    else if (has_value && strcmp(argv[i], "--workers") == 0) {
+      options.workers = std::max(1, atoi(argv[++i]));
+    }
+    else if (has_value && (strcmp(argv[i], "--loop-cpus") == 0 ||
+                           strcmp(argv[i], "--worker-cpus") == 0)) {
+      std::vector<int> &cpus = strcmp(argv[i], "--loop-cpus") == 0
+          ? options.loop_cpus : options.worker_cpus;
+      if (!CpuAffinity::ParseList(argv[++i], &cpus)) {
+        UKF_LOG_ERROR("Malformed CPU list %s", argv[i]);
+        return -1;
+      }
+    }
+    else if (has_value && strcmp(argv[i], "--max-connections") == 0) {
+      max_connections = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (has_value && strcmp(argv[i], "--snapshot-dir") == 0) {
+      options.snapshot_dir = argv[++i];
+    }
+    else if (has_value && strcmp(argv[i], "--checkpoint-dir") == 0) {
+      options.checkpoint_dir = argv[++i];
+    }
+    else if (has_value && strcmp(argv[i], "--checkpoint-s") == 0) {
+      options.checkpoint_ms = std::max(1, int(atof(argv[++i]) * 1000));
+    }
+    else if (strcmp(argv[i], "--recover") == 0) {
+      recover = true;
+    }
+    else if (has_value && strcmp(argv[i], "--shm-export") == 0) {
+      options.shm_prefix = argv[++i];
+    }
+    else if (has_value && strcmp(argv[i], "--shm-tracks") == 0) {
+      options.shm_tracks = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (has_value && strcmp(argv[i], "--region-cell") == 0) {
+      options.region_cell = atof(argv[++i]);
+    }
+    else if (has_value && strcmp(argv[i], "--region-ms") == 0) {
+      options.region_ms = std::max(0, atoi(argv[++i]));
+    }
+    else if (has_value && strcmp(argv[i], "--journal") == 0) {
+      journal_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--journal-compress") == 0) {
+      journal_options.compress = true;
+    }
+    else if (has_value && strcmp(argv[i], "--journal-sync") == 0) {
+      const char *policy = argv[++i];
+      if (strcmp(policy, "never") == 0) {
+        journal_options.sync = MeasurementJournal::SYNC_NEVER;
+      }
+      else if (strcmp(policy, "batch") == 0) {
+        journal_options.sync = MeasurementJournal::SYNC_BATCH;
+      }
+      else {
+        journal_options.sync = MeasurementJournal::SYNC_INTERVAL;
+        journal_options.sync_ms = std::max(1, atoi(policy));
+      }
+    }
+    else if (has_value && strcmp(argv[i], "--unix") == 0) {
+      unix_path = argv[++i];
+    }
+    else if (has_value && strcmp(argv[i], "--max-payload") == 0) {
+      options.socket.max_payload = static_cast<unsigned int>(
+          strtoul(argv[++i], nullptr, 10));
+    }
+    else if (has_value && strcmp(argv[i], "--max-delay") == 0) {
+      options.overload.max_delay_us =
+          static_cast<long long>(atof(argv[++i]) * 1000.0);
+    }
+    else if (has_value && strcmp(argv[i], "--stream") == 0) {
+      options.stream_ms = atoi(argv[++i]);
+    }
+    else if (has_value && strcmp(argv[i], "--coalesce") == 0) {
+      options.coalesce_ms = atoi(argv[++i]);
+    }
+    else if (has_value && strcmp(argv[i], "--trace-sample") == 0) {
+      // keep the per-stage latency trace of one measurement in n
+      LatencyTrace::SetSampling(strtoul(argv[++i], nullptr, 10));
+    }
+    else if (has_value && strcmp(argv[i], "--history") == 0) {
+      options.history_capacity = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (has_value && strcmp(argv[i], "--rmse-window") == 0) {
+      options.rmse_window = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (has_value && strcmp(argv[i], "--rmse-window-s") == 0) {
+      options.rmse_window_us =
+          static_cast<long long>(atof(argv[++i]) * 1e6);
+    }
+    else if (has_value && strcmp(argv[i], "--config") == 0) {
+      std::string error;
+      config_path = argv[++i];
+      if (!config.Load(config_path, &error)) {
+        UKF_LOG_ERROR("%s", error.c_str());
+        return -1;
+      }
+    }
+    else if (strcmp(argv[i], "--watch-config") == 0) {
+      watch_config = true;
+    }
+    else if (has_value && strcmp(argv[i], "--oosm") == 0) {
+      oosm_depth = atoi(argv[++i]);
+    }
+    else if (has_value && strcmp(argv[i], "--max-step") == 0) {
+      max_step = atof(argv[++i]);
+    }
+    else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      threads = atoi(argv[++i]);
+      if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+    }
+  }
 
+  // a checkpoint is only as good as the journal tail replayed over it, and
+  // is recovered into restore snapshots, kept with it unless given a place
+  if (options.checkpoint_dir && !journal_path) {
+    UKF_LOG_ERROR("--checkpoint-dir needs --journal");
+    return -1;
+  }
+  if (recover && !options.checkpoint_dir) {
+    UKF_LOG_ERROR("--recover needs --checkpoint-dir");
+    return -1;
+  }
+  if (options.checkpoint_dir && !options.snapshot_dir) {
+    options.snapshot_dir = options.checkpoint_dir;
+  }
 
+  // the kernel spreads connections evenly across the hubs
+  options.pool_size = (max_connections + threads - 1) / threads;
 
+  // command line flags override the config file
+  if (oosm_depth >= 0) {
+    config.history_depth = oosm_depth;
+  }
+  if (max_step >= 0.0) {
+    config.max_predict_step = max_step;
+  }
+  std::unique_ptr<ConfigReload> reload;
+  if (config_path) {
+    reload.reset(new ConfigReload(config_path, UKFConfig()));
+    if (oosm_depth >= 0) {
+      reload->Override("history_depth", oosm_depth);
+    }
+    if (max_step >= 0.0) {
+      reload->Override("max_predict_step", max_step);
+    }
+    options.reload = reload.get();
+  }
+  else if (watch_config) {
+    UKF_LOG_ERROR("--watch-config needs --config");
+    return -1;
+  }
 
+  // Kalman Filter configuration copied into every track of every
+  // connection; the simulator's single stream is track 0
+  const UKF prototype(config);
+
+  // the alternative starts from the served configuration, so its file
+  // only names what it changes
+  std::unique_ptr<ShadowRunner> shadow;
+  if (shadow_config) {
+    UKFConfig alternative = config;
+    std::string error;
+    if (!alternative.Load(shadow_config, &error)) {
+      UKF_LOG_ERROR("%s", error.c_str());
+      return -1;
+    }
+    shadow.reset(new ShadowRunner(alternative, shadow_sample));
+    options.shadow = shadow.get();
+    Metrics::SetShadow(shadow.get());
+    UKF_LOG_INFO("Shadowing 1 in %lu measurements with %s", shadow_sample,
+                 shadow_config);
+  }
 
+  // the executor's sessions wait for their turn instead
+  if (options.coroutines && options.overload.mode != Pipeline::BLOCK) {
+    UKF_LOG_WARN("--overload does not apply to --executor coroutines");
+  }
 
+  // zone markers, when built with UKF_PROFILER
+  StartProfiler();
 
+  // before any filter runs: they read the kernel table unsynchronised
+  if (autotune) {
+    std::string error;
+    if (!KernelAutotune::Run(std::vector<int>(), autotune_cache, &error)) {
+      UKF_LOG_WARN("%s", error.c_str());
+    }
+    UKF_LOG_INFO("Kernels %s: predict_ctrv %s, mean_and_covariance %s",
+                 KernelAutotune::Name(KernelAutotune::origin()),
+                 UkfKernels::Name(UkfKernels::Source(UkfKernels::PREDICT_CTRV)),
+                 UkfKernels::Name(
+                     UkfKernels::Source(UkfKernels::MEAN_AND_COVARIANCE)));
+  }
 
+  // before the pools and pipeline workers come up, so that they are
+  // locked and pre-faulted as they are built
+  if (realtime) {
+    std::string error;
+    if (!Realtime::Lock(realtime_options, &error)) {
+      UKF_LOG_ERROR("Cannot enter real-time mode: %s", error.c_str());
+      return -1;
+    }
+    UKF_LOG_INFO("Real-time mode: memory locked");
+  }
 
+  // before any thread starts, so that only the watcher takes the signals
+  sigset_t shutdown_signals;
+  BlockShutdownSignals(&shutdown_signals);
+  std::thread(WatchShutdownSignals, shutdown_signals).detach();
+
+  // before the journal is reopened, so the tail replayed is exactly what
+  // the crashed process journaled
+  if (recover) {
+    for (int i = 0; i < threads; i++) {
+      if (!RecoverHub(prototype, options, journal_path, i)) {
+        return -1;
+      }
+    }
+  }
 
+  // opened before any hub runs and closed, with everything journaled on
+  // disk, after they have all stopped
+  MeasurementJournal journal;
+  if (journal_path) {
+    std::string error;
+    if (!journal.Open(journal_path, journal_options, &error)) {
+      UKF_LOG_ERROR("%s", error.c_str());
+      return -1;
+    }
+    options.journal = &journal;
+    UKF_LOG_INFO("Journaling measurements to %s", journal_path);
+  }
 
+  // co-located producers skip TCP and WebSocket framing; their sessions
+  // are filtered on the transport's own thread
+  std::unique_ptr<UnixTransport> unix_transport;
+  std::thread unix_thread;
+  if (unix_path) {
+    unix_transport.reset(
+        new UnixTransport(prototype, options.history_capacity,
+                          options.evaluate, options.journal));
+    std::string error;
+    if (!unix_transport->Listen(unix_path, &error)) {
+      UKF_LOG_ERROR("%s", error.c_str());
+      return -1;
+    }
+    UKF_LOG_INFO("Listening on %s", unix_path);
+    unix_thread = std::thread([&unix_transport]() { unix_transport->Run(); });
+    UnixTransport *transport = unix_transport.get();
+    OnShutdown([transport]() { transport->Stop(); });
+  }
 
+  // polls the config file; edits reach the filters within a second or so
+  std::thread watch_thread;
+  if (watch_config) {
+    ConfigReload *watched = reload.get();
+    watch_thread = std::thread([watched]() { watched->Watch(1000); });
+    OnShutdown([watched]() { watched->Stop(); });
+    UKF_LOG_INFO("Watching %s for changes", config_path);
+  }
 
-
-
-
-
-
-
-
-
-
-
+  bool reuse_port = threads > 1;
+  std::vector<std::thread> loops;
+  for (int i = 1; i < threads; i++) {
+    loops.push_back(std::thread([&prototype, &options, i]() {
+      RunHub(prototype, options, i, true);
+    }));
+  }
+  bool ok = RunHub(prototype, options, 0, reuse_port);
+  // a hub that failed to listen must not leave the others running
+  RequestShutdown();
+  for (size_t i = 0; i < loops.size(); i++) {
+    loops[i].join();
+  }
+  if (unix_transport) {
+    unix_thread.join();
+  }
+  if (watch_thread.joinable()) {
+    watch_thread.join();
+  }
+  UKF_LOG_INFO("Shut down: %llu text and %llu binary messages, "
+               "%llu lidar and %llu radar updates",
+               Metrics::Value(Metrics::MESSAGES_TEXT),
+               Metrics::Value(Metrics::MESSAGES_BINARY),
+               Metrics::Value(Metrics::UPDATES_LIDAR),
+               Metrics::Value(Metrics::UPDATES_RADAR));
+  if (realtime && Realtime::Violations() > 0) {
+    UKF_LOG_WARN("Real-time violations: %llu heap allocations on filter "
+                 "threads", Realtime::Violations());
+  }
+  Metrics::SetShadow(nullptr);
+  Logger::Flush();
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,466 @@
+#include "measurement_journal.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "binary_protocol.h"
+#include "huge_pages.h"
+#include "logger.h"
+#include "thread_pool.h"
+
+const unsigned MeasurementJournal::kVersion;
+const unsigned MeasurementJournal::kCompressedVersion;
+
+namespace {
+
+const char kJournalMagic[4] = {'U', 'K', 'F', 'J'};
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t reserved;
+};
+
+static_assert(sizeof(MeasurementJournal::Entry) == 88,
+              "journal entries are written as raw bytes");
+static_assert(sizeof(MeasurementJournal::Entry::record) ==
+                  BinaryProtocol::kMeasurementRecordSize,
+              "journal entries hold one measurement record");
+
+// chunks allocated by Open, so the first bursts allocate nothing
+const size_t kInitialChunks = 4;
+
+#ifdef IOV_MAX
+const size_t kMaxIov = IOV_MAX;
+#else
+const size_t kMaxIov = 1024;
+#endif
+
+}  // namespace
+
+MeasurementJournal::MeasurementJournal()
+    : fd_(-1),
+      current_(nullptr),
+      buffers_(nullptr),
+      buffers_bytes_(0),
+      stop_(false),
+      base_(0),
+      next_entry_(0),
+      appended_(0),
+      dropped_(0),
+      batches_(0),
+      syncs_(0) {}
+
+MeasurementJournal::~MeasurementJournal() {
+  Close();
+}
+
+bool MeasurementJournal::Open(const char *path, const Options &options,
+                              std::string *error) {
+  Close();
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    *error = std::string(path) + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    *error = std::string(path) + ": " + strerror(errno);
+    close(fd);
+    return false;
+  }
+  unsigned long long base = 0;
+  const unsigned version = options.compress ? kCompressedVersion : kVersion;
+  if (st.st_size == 0) {
+    Header h;
+    memcpy(h.magic, kJournalMagic, 4);
+    h.version = version;
+    h.reserved = 0;
+    if (write(fd, &h, sizeof(h)) != static_cast<ssize_t>(sizeof(h))) {
+      *error = std::string(path) + ": " + strerror(errno);
+      close(fd);
+      return false;
+    }
+  }
+  else {
+    //appending to something that is not a journal would corrupt it, and
+    //entries and blocks cannot share a file
+    Header h;
+    int in = open(path, O_RDONLY);
+    bool ok = in >= 0 && read(in, &h, sizeof(h)) == sizeof(h) &&
+              memcmp(h.magic, kJournalMagic, 4) == 0 &&
+              (h.version == kVersion || h.version == kCompressedVersion);
+    if (ok && h.version != version) {
+      if (in >= 0) {
+        close(in);
+      }
+      *error = std::string(path) + (options.compress
+                                        ? ": journal is not compressed"
+                                        : ": journal is compressed");
+      close(fd);
+      return false;
+    }
+    std::vector<BlockCodec::Block> blocks;
+    uint64_t end = sizeof(Header);
+    if (ok && version == kCompressedVersion) {
+      ok = BlockCodec::Scan(in, sizeof(Header), &blocks, &end);
+    }
+    if (in >= 0) {
+      close(in);
+    }
+    if (!ok) {
+      *error = std::string(path) + ": not a measurement journal";
+      close(fd);
+      return false;
+    }
+    //a partial entry or block left by a crash would misalign everything
+    //after it
+    off_t whole;
+    if (version == kCompressedVersion) {
+      whole = static_cast<off_t>(end - sizeof(Header));
+      if (!blocks.empty()) {
+        base = blocks.back().first + blocks.back().items;
+      }
+    }
+    else {
+      const off_t body = st.st_size - static_cast<off_t>(sizeof(Header));
+      whole = body - body % static_cast<off_t>(sizeof(Entry));
+      base = static_cast<unsigned long long>(whole) / sizeof(Entry);
+    }
+    if (static_cast<off_t>(sizeof(Header)) + whole != st.st_size &&
+        ftruncate(fd, sizeof(Header) + whole) != 0) {
+      *error = std::string(path) + ": " + strerror(errno);
+      close(fd);
+      return false;
+    }
+  }
+
+  options_ = options;
+  //a chunk holds whole entries
+  const size_t entries = options_.chunk_size / sizeof(Entry);
+  options_.chunk_size = std::max(entries, size_t(1)) * sizeof(Entry);
+  buffers_bytes_ = options_.chunk_size * options_.max_chunks;
+  buffers_ = static_cast<char *>(HugePages::Allocate(buffers_bytes_));
+  if (!buffers_) {
+    *error = "cannot allocate journal buffers";
+    close(fd);
+    return false;
+  }
+  fd_ = fd;
+  stop_ = false;
+  base_ = base;
+  next_entry_ = base;
+  appended_ = dropped_ = batches_ = syncs_ = 0;
+  for (size_t i = 0; i < kInitialChunks && i < options_.max_chunks; i++) {
+    free_.push_back(NewChunk());
+  }
+  writer_ = std::thread(&MeasurementJournal::Run, this);
+  return true;
+}
+
+void MeasurementJournal::Close() {
+  if (fd_ < 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  ready_cv_.notify_one();
+  writer_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  close(fd_);
+  fd_ = -1;
+  current_ = nullptr;
+  ready_.clear();
+  free_.clear();
+  chunks_.clear();
+  HugePages::Free(buffers_, buffers_bytes_);
+  buffers_ = nullptr;
+  buffers_bytes_ = 0;
+}
+
+MeasurementJournal::Chunk *MeasurementJournal::NewChunk() {
+  if (chunks_.size() >= options_.max_chunks) {
+    return nullptr;
+  }
+  chunks_.push_back(std::unique_ptr<Chunk>(new Chunk()));
+  Chunk *chunk = chunks_.back().get();
+  chunk->data = buffers_ + (chunks_.size() - 1) * options_.chunk_size;
+  chunk->used = 0;
+  return chunk;
+}
+
+size_t MeasurementJournal::Append(uint64_t session, int64_t arrival_us,
+                                  const char *records, size_t count) {
+  const size_t size = BinaryProtocol::kMeasurementRecordSize;
+  Entry entry;
+  entry.arrival_us = arrival_us;
+  entry.session = session;
+  size_t n = 0;
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0 || stop_) {
+      return 0;
+    }
+    for (; n < count; n++) {
+      if (!current_ || current_->used == options_.chunk_size) {
+        if (current_) {
+          ready_.push_back(current_);
+          wake = true;
+        }
+        if (!free_.empty()) {
+          current_ = free_.back();
+          free_.pop_back();
+        }
+        else {
+          current_ = NewChunk();
+        }
+        if (!current_) {
+          break;
+        }
+      }
+      memcpy(entry.record, records + n * size, size);
+      memcpy(current_->data + current_->used, &entry, sizeof(entry));
+      current_->used += sizeof(entry);
+    }
+    appended_ += n;
+    dropped_ += count - n;
+  }
+  //the writer only needs waking for a full chunk; partial ones it picks
+  //up on its flush timer
+  if (wake) {
+    ready_cv_.notify_one();
+  }
+  return n;
+}
+
+void MeasurementJournal::Run() {
+  std::vector<Chunk *> batch;
+  std::chrono::steady_clock::time_point last_sync =
+      std::chrono::steady_clock::now();
+  bool unsynced = false;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    ready_cv_.wait_for(lock, std::chrono::milliseconds(options_.flush_ms),
+                       [this]() { return stop_ || !ready_.empty(); });
+    const bool stopping = stop_;
+    batch.swap(ready_);
+    if (current_ && current_->used > 0) {
+      batch.push_back(current_);
+      current_ = nullptr;
+    }
+    lock.unlock();
+
+    if (!batch.empty()) {
+      if (!Write(batch)) {
+        UKF_LOG_ERROR("Journal write failed: %s", strerror(errno));
+      }
+      unsynced = true;
+    }
+    const std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    bool sync = false;
+    if (unsynced) {
+      switch (options_.sync) {
+      case SYNC_NEVER:
+        break;
+      case SYNC_BATCH:
+        sync = true;
+        break;
+      case SYNC_INTERVAL:
+        sync = stopping || now - last_sync >=
+                               std::chrono::milliseconds(options_.sync_ms);
+        break;
+      }
+    }
+    if (sync) {
+      fdatasync(fd_);
+      last_sync = now;
+      unsynced = false;
+    }
+
+    lock.lock();
+    for (size_t i = 0; i < batch.size(); i++) {
+      batch[i]->used = 0;
+      free_.push_back(batch[i]);
+    }
+    if (!batch.empty()) {
+      ++batches_;
+    }
+    syncs_ += sync;
+    batch.clear();
+    if (stopping) {
+      break;
+    }
+  }
+}
+
+bool MeasurementJournal::Write(const std::vector<Chunk *> &chunks) {
+  if (options_.compress) {
+    //a block per chunk, so a torn write loses at most the batch
+    encoded_.clear();
+    for (size_t i = 0; i < chunks.size(); i++) {
+      const size_t items = chunks[i]->used / sizeof(Entry);
+      BlockCodec::Encode(chunks[i]->data, items, sizeof(Entry), next_entry_,
+                         &encoded_);
+      next_entry_ += items;
+    }
+    const char *data = encoded_.data();
+    size_t left = encoded_.size();
+    while (left > 0) {
+      ssize_t n = write(fd_, data, left);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      data += n;
+      left -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+  std::vector<iovec> iov;
+  iov.reserve(std::min(chunks.size(), kMaxIov));
+  for (size_t first = 0; first < chunks.size(); first += kMaxIov) {
+    iov.clear();
+    for (size_t i = first; i < chunks.size() && i < first + kMaxIov; i++) {
+      iovec v = {chunks[i]->data, chunks[i]->used};
+      iov.push_back(v);
+    }
+    //a short write leaves the rest of the vector to resend
+    size_t next = 0;
+    while (next < iov.size()) {
+      ssize_t n = writev(fd_, iov.data() + next,
+                         static_cast<int>(iov.size() - next));
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      size_t written = static_cast<size_t>(n);
+      while (next < iov.size() && written >= iov[next].iov_len) {
+        written -= iov[next].iov_len;
+        ++next;
+      }
+      if (next < iov.size()) {
+        iov[next].iov_base = static_cast<char *>(iov[next].iov_base) + written;
+        iov[next].iov_len -= written;
+      }
+    }
+  }
+  return true;
+}
+
+bool MeasurementJournal::Read(const char *path,
+                              std::vector<Entry> *entries) {
+  return Read(path, 0, entries);
+}
+
+bool MeasurementJournal::Read(const char *path, unsigned long long first,
+                              std::vector<Entry> *entries, ThreadPool *pool) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  Header h;
+  if (fread(&h, sizeof(h), 1, f) != 1 ||
+      memcmp(h.magic, kJournalMagic, 4) != 0 ||
+      (h.version != kVersion && h.version != kCompressedVersion)) {
+    fclose(f);
+    return false;
+  }
+  if (h.version == kCompressedVersion) {
+    const bool ok = ReadBlocks(fileno(f), first, entries, pool);
+    fclose(f);
+    return ok;
+  }
+  if (first > 0 &&
+      fseeko(f, static_cast<off_t>(sizeof(h) + first * sizeof(Entry)),
+             SEEK_SET) != 0) {
+    fclose(f);
+    return false;
+  }
+  Entry entry;
+  while (fread(&entry, sizeof(entry), 1, f) == 1) {
+    entries->push_back(entry);
+  }
+  const bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+bool MeasurementJournal::ReadBlocks(int fd, unsigned long long first,
+                                    std::vector<Entry> *entries,
+                                    ThreadPool *pool) {
+  std::vector<BlockCodec::Block> blocks;
+  uint64_t end;
+  if (!BlockCodec::Scan(fd, sizeof(Header), &blocks, &end)) {
+    return false;
+  }
+  //the index seeks to the block holding the first entry wanted
+  std::vector<BlockCodec::Block>::iterator from = std::upper_bound(
+      blocks.begin(), blocks.end(), first,
+      [](unsigned long long n, const BlockCodec::Block &block) {
+        return n < block.first + block.items;
+      });
+  blocks.erase(blocks.begin(), from);
+  if (blocks.empty()) {
+    return true;
+  }
+  const unsigned long long start =
+      std::max<unsigned long long>(first, blocks.front().first);
+  const size_t base = entries->size();
+  entries->resize(base + (blocks.back().first + blocks.back().items - start));
+  Entry *out = entries->data() + base;
+  return BlockCodec::ReadBlocks(
+      fd, blocks, sizeof(Entry),
+      [&](const BlockCodec::Block &block, const char *raw) {
+        const unsigned long long skip =
+            start > block.first ? start - block.first : 0;
+        memcpy(out + (block.first + skip - start), raw + skip * sizeof(Entry),
+               (block.items - skip) * sizeof(Entry));
+        return true;
+      },
+      pool);
+}
+
+int64_t MeasurementJournal::NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+unsigned long long MeasurementJournal::appended() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return appended_;
+}
+
+unsigned long long MeasurementJournal::dropped() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+unsigned long long MeasurementJournal::batches() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return batches_;
+}
+
+unsigned long long MeasurementJournal::syncs() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return syncs_;
+}
+
+unsigned long long MeasurementJournal::position() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return base_ + appended_;
+}
@@ -0,0 +1,198 @@
+#ifndef MEASUREMENT_JOURNAL_H_
+#define MEASUREMENT_JOURNAL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "block_codec.h"
+#include "time_base.h"
+
+class ThreadPool;
+
+/**
+ * Append-only write-ahead journal of every incoming measurement, for
+ * replay, failover and late-measurement handling.
+ *
+ * The file starts with the 16-byte header of the BinaryLog files, "UKFJ",
+ * a u32 version and a u64 reserved zero, followed by 88-byte entries in
+ * host (little-endian) byte order: i64 arrival time in us since the epoch,
+ * u64 session id and the 72-byte BinaryProtocol measurement record as it
+ * arrived. A crash may leave a partial entry at the end; Read ignores it,
+ * and Open cuts it off before appending, so entry n always starts at byte
+ * 16 + 88 n and a position (see position()) can be read from directly.
+ *
+ * A compressed journal (Options::compress, header version 2) holds the same
+ * entries in BlockCodec blocks instead, one per chunk, compressed on the
+ * writer thread: arrival times, session ids and record headers repeat from
+ * entry to entry and shrink several times over. Its block headers are its
+ * index, so Read still seeks to a position, and decodes the blocks on a
+ * ThreadPool when given one; Open drops a block torn by a crash.
+ *
+ * Append only copies the entries into an in-memory chunk under a short
+ * lock and never touches the file: a background thread takes the filled
+ * chunks in batches, writes each batch with one writev and syncs as the
+ * Sync policy says. Durability therefore never adds latency to the caller,
+ * and an entry is on disk at most flush_ms (plus the sync policy) after it
+ * was appended. When the writer falls max_chunks behind, Append drops
+ * entries and counts them instead of blocking.
+ */
+class MeasurementJournal {
+public:
+  static const unsigned kVersion = 1;
+  static const unsigned kCompressedVersion = 2;
+
+  enum Sync {
+    ///* leave write-back to the kernel; fastest, lost on power failure
+    SYNC_NEVER,
+    ///* fdatasync after every batch
+    SYNC_BATCH,
+    ///* fdatasync at most every sync_ms
+    SYNC_INTERVAL
+  };
+
+  struct Options {
+    Sync sync;
+    int sync_ms;
+    ///* longest a partly filled chunk waits before it is written
+    int flush_ms;
+    ///* bytes per chunk, and chunks buffered before entries are dropped
+    size_t chunk_size;
+    size_t max_chunks;
+    ///* write BlockCodec blocks; an existing journal must match
+    bool compress;
+
+    Options()
+        : sync(SYNC_INTERVAL),
+          sync_ms(100),
+          flush_ms(2),
+          chunk_size(64 * 1024),
+          max_chunks(256),
+          compress(false) {}
+  };
+
+  struct Entry {
+    int64_t arrival_us;
+    uint64_t session;
+    char record[72];
+  };
+
+  MeasurementJournal();
+
+  /**
+   * Destructor; writes and syncs what is buffered
+   */
+  virtual ~MeasurementJournal();
+
+  /**
+   * Opens or creates a journal for appending and starts the writer thread
+   * @param path Journal file; an existing one must have a journal header
+   * @param options Buffering and sync policy
+   * @param error Reason for a failure
+   * @return false if the file cannot be used
+   */
+  bool Open(const char *path, const Options &options, std::string *error);
+
+  /**
+   * Stops the writer after writing and syncing everything appended
+   */
+  void Close();
+
+  /**
+   * Any thread: journals consecutive measurement records
+   * @param session Id of the session they arrived on
+   * @param arrival_us Arrival time in us since the epoch
+   * @param records BinaryProtocol measurement records
+   * @param count Number of records
+   * @return Entries journaled; the rest were dropped
+   */
+  size_t Append(uint64_t session, int64_t arrival_us, const char *records,
+                size_t count);
+
+  /**
+   * Reads every complete entry of a journal file
+   * @param path Journal file
+   * @param entries Entries are appended
+   * @return false on I/O errors or a bad header
+   */
+  static bool Read(const char *path, std::vector<Entry> *entries);
+
+  /**
+   * Reads the complete entries from a position on, seeking past the rest
+   * @param path Journal file
+   * @param first Entries to skip
+   * @param entries Entries are appended
+   * @param pool Threads to decompress a compressed journal's blocks on, or
+   * nullptr for the calling thread
+   * @return false on I/O errors, a bad header or a corrupt block
+   */
+  static bool Read(const char *path, unsigned long long first,
+                   std::vector<Entry> *entries, ThreadPool *pool = nullptr);
+
+  ///* wall clock in us since the epoch, for arrival times
+  static int64_t NowUs();
+
+  ///* counters since Open; any thread
+  unsigned long long appended();
+  unsigned long long dropped();
+  unsigned long long batches();
+  unsigned long long syncs();
+
+  /**
+   * Entries in the file, including those from before Open and those still
+   * buffered; the next entry appended is entry position()
+   */
+  unsigned long long position();
+
+private:
+  struct Chunk {
+    ///* chunk_size bytes of buffers_
+    char *data;
+    size_t used;
+  };
+
+  // writer thread loop
+  void Run();
+  // writes chunks in as few writev calls as IOV_MAX allows, or as one
+  // block each when compressing
+  bool Write(const std::vector<Chunk *> &chunks);
+  // Read of a compressed journal
+  static bool ReadBlocks(int fd, unsigned long long first,
+                         std::vector<Entry> *entries, ThreadPool *pool);
+  // a chunk for the producers; nullptr if max_chunks are in use
+  Chunk *NewChunk();
+
+  Options options_;
+  int fd_;
+  std::thread writer_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_cv_;
+  ///* guarded by mutex_: the chunk being filled, the filled ones in order,
+  ///* and the empty ones to reuse
+  Chunk *current_;
+  std::vector<Chunk *> ready_;
+  std::vector<Chunk *> free_;
+  std::vector<std::unique_ptr<Chunk> > chunks_;
+  ///* storage of all max_chunks chunks, reserved at Open and faulted in as
+  ///* chunks are first used; from HugePages
+  char *buffers_;
+  size_t buffers_bytes_;
+  bool stop_;
+  ///* complete entries the file held at Open
+  unsigned long long base_;
+  ///* writer thread only: index of the next entry written, and the blocks
+  ///* of the batch being written when compressing
+  unsigned long long next_entry_;
+  std::vector<char> encoded_;
+  unsigned long long appended_;
+  unsigned long long dropped_;
+  unsigned long long batches_;
+  unsigned long long syncs_;
+};
+
+#endif /* MEASUREMENT_JOURNAL_H_ */
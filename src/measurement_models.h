@@ -0,0 +1,318 @@
+#ifndef MEASUREMENT_MODELS_H_
+#define MEASUREMENT_MODELS_H_
+
+#include <algorithm>
+#include <cmath>
+#include "Eigen/Dense"
+#include "angle.h"
+#include "cholesky_update.h"
+#include "measurement_package.h"
+#include "ukf.h"
+
+/**
+ * Measurement models for the unscented update, as policy classes. A model
+ * provides:
+ *   kDim                  measurement dimension (at most 3, the size of
+ *                         Measurement::values_)
+ *   Measure(x, z)         h(x) for one state sigma point, templated on
+ *                         the scalar type
+ *   MeasureSigmaPoints(X, Z, fast_atan2)
+ *                         h(x) for every column of X at once, row-wise so
+ *                         the arithmetic vectorises across sigma points
+ *   Normalize(residuals)  wraps any angle rows of a kDim-row block in place
+ * and, for the nonlinear ones, Jacobian(x, H), d h / d x row-major, for the
+ * EKF update UKF::UpdateRadarEkf.
+ * UKF::UpdateWithModel<Model> then runs the whole update with fixed-size
+ * matrices, so a new sensor only has to describe its h(x).
+ */
+
+/**
+ * Radar: range, bearing and range rate
+ */
+struct RadarModel {
+  static const int kDim = 3;
+
+  ///* smallest range the range rate is divided by, in m
+  static constexpr double kMinRange = 1e-9;
+
+  template <typename Scalar>
+  static inline void Measure(const Scalar *x, Scalar *z) {
+    const Scalar p_x = x[0];
+    const Scalar p_y = x[1];
+    const Scalar v = x[2];
+    const Scalar yaw = x[3];
+    const Scalar v1 = KernelMath::Cos(yaw) * v;
+    const Scalar v2 = KernelMath::Sin(yaw) * v;
+    const Scalar rho = KernelMath::Sqrt(p_x * p_x + p_y * p_y);
+    z[0] = rho;
+    z[1] = KernelMath::Atan2(p_y, p_x);
+    z[2] = (p_x * v1 + p_y * v2) / std::max(rho, Scalar(kMinRange));
+  }
+
+  /**
+   * @param x State
+   * @param H d h / d x, row-major 3x5
+   */
+  template <typename Scalar>
+  static inline void Jacobian(const Scalar *x, Scalar *H) {
+    const Scalar p_x = x[0];
+    const Scalar p_y = x[1];
+    const Scalar v = x[2];
+    Scalar sin_yaw, cos_yaw;
+    KernelMath::SinCos(x[3], &sin_yaw, &cos_yaw);
+    const Scalar v1 = cos_yaw * v;
+    const Scalar v2 = sin_yaw * v;
+    const Scalar rho = std::max(KernelMath::Sqrt(p_x * p_x + p_y * p_y),
+                                Scalar(kMinRange));
+    const Scalar rho_dot = (p_x * v1 + p_y * v2) / rho;
+
+    for (int i = 0; i < 15; i++) {
+      H[i] = Scalar(0);
+    }
+    H[0] = p_x / rho;
+    H[1] = p_y / rho;
+    H[5] = -p_y / (rho * rho);
+    H[6] = p_x / (rho * rho);
+    H[10] = (v1 - rho_dot * H[0]) / rho;
+    H[11] = (v2 - rho_dot * H[1]) / rho;
+    H[12] = (p_x * cos_yaw + p_y * sin_yaw) / rho;
+    H[13] = (p_y * v1 - p_x * v2) / rho;
+  }
+
+  /**
+   * Measure over all sigma points. sin/cos of yaw come from SinCosShared and
+   * one sqrt per column gives the range, which also divides the range rate;
+   * a sigma point at the sensor divides by kMinRange instead of 0. The
+   * results equal Measure's column by column.
+   * @param X State sigma points, one per column
+   * @param Z Measurement sigma points
+   * @param fast_atan2 If true, the bearing uses FastAtan2 (1.7e-6 rad error)
+   *        whatever KernelMath is
+   */
+  template <typename Scalar, int N>
+  static inline void MeasureSigmaPoints(
+      const Eigen::Matrix<Scalar, UKF::n_x_, N> &X,
+      Eigen::Matrix<Scalar, kDim, N> *Z, bool fast_atan2) {
+    typedef Eigen::Array<Scalar, 1, N> Row;
+    const Row p_x = X.row(0).array();
+    const Row p_y = X.row(1).array();
+    const Row v = X.row(2).array();
+    Row sin_yaw, cos_yaw;
+    SinCosShared(Row(X.row(3).array()), &sin_yaw, &cos_yaw);
+
+    const Row rho = (p_x * p_x + p_y * p_y).sqrt();
+    Z->row(0) = rho.matrix();
+    Z->row(2) = ((p_x * (cos_yaw * v) + p_y * (sin_yaw * v)) /
+                 rho.max(Scalar(kMinRange))).matrix();
+    if (fast_atan2) {
+      for (int i = 0; i < N; i++) {
+        (*Z)(1, i) = FastAtan2(p_y(i), p_x(i));
+      }
+    }
+    else {
+      for (int i = 0; i < N; i++) {
+        (*Z)(1, i) = KernelMath::Atan2(p_y(i), p_x(i));
+      }
+    }
+  }
+
+  template <typename Derived>
+  static inline void Normalize(const Eigen::MatrixBase<Derived> &residuals) {
+    Eigen::MatrixBase<Derived> &r =
+        const_cast<Eigen::MatrixBase<Derived> &>(residuals);
+    NormalizeAngles(r.row(1));
+  }
+};
+
+/**
+ * Lidar: position. Linear, so UKF::UpdateLidar is the cheaper exact update;
+ * the unscented form is here for completeness and for stacking.
+ */
+struct LidarModel {
+  static const int kDim = 2;
+
+  template <typename Scalar>
+  static inline void Measure(const Scalar *x, Scalar *z) {
+    z[0] = x[0];
+    z[1] = x[1];
+  }
+
+  template <typename Scalar, int N>
+  static inline void MeasureSigmaPoints(
+      const Eigen::Matrix<Scalar, UKF::n_x_, N> &X,
+      Eigen::Matrix<Scalar, kDim, N> *Z, bool) {
+    *Z = X.template topRows<kDim>();
+  }
+
+  template <typename Derived>
+  static inline void Normalize(const Eigen::MatrixBase<Derived> &) {}
+};
+
+template <typename Model>
+bool UKF::UpdateWithModel(
+    const Measurement &meas,
+    const Eigen::Matrix<Scalar, Model::kDim, 1> &noise,
+    double gate,
+    Eigen::Matrix<Scalar, Model::kDim, 1> *z_diff_out,
+    Eigen::Matrix<Scalar, Model::kDim, Model::kDim> *S_factor_out,
+    double *nis_out) {
+  if (sigma_count_ == n_sig_simplex_) {
+    return UpdateWithPoints<Model, n_sig_simplex_>(
+        meas, noise, gate, z_diff_out, S_factor_out, nis_out);
+  }
+  return UpdateWithPoints<Model, n_sig_>(meas, noise, gate, z_diff_out,
+                                         S_factor_out, nis_out);
+}
+
+template <typename Model, int N>
+bool UKF::UpdateWithPoints(
+    const Measurement &meas,
+    const Eigen::Matrix<Scalar, Model::kDim, 1> &noise,
+    double gate,
+    Eigen::Matrix<Scalar, Model::kDim, 1> *z_diff_out,
+    Eigen::Matrix<Scalar, Model::kDim, Model::kDim> *S_factor_out,
+    double *nis_out) {
+  typedef Eigen::Matrix<Scalar, Model::kDim, 1> ZVector;
+  typedef Eigen::Matrix<Scalar, Model::kDim, Model::kDim> ZMatrix;
+  typedef Eigen::Matrix<Scalar, Model::kDim, N> ZSigmaMatrix;
+  typedef Eigen::Matrix<Scalar, n_x_, N> Points;
+  typedef Eigen::Matrix<Scalar, N, 1> Weights;
+
+  //the sigma points in use and their weights
+  const Points X = Xsig_pred_.template leftCols<N>();
+  const Weights w = weights_.template head<N>();
+  const Weights w_c = weights_c_.template head<N>();
+
+  //sigma points in measurement space
+  ZSigmaMatrix Zsig;
+  Model::MeasureSigmaPoints(X, &Zsig, radar_fast_atan2_);
+
+  //mean predicted measurement
+  const ZVector z_pred = Zsig * w;
+
+  //centred residuals, each angle wrapped once
+  ZSigmaMatrix Zd = Zsig.colwise() - z_pred;
+  Model::Normalize(Zd);
+
+  //Zd * W, shared by S and Tc
+  const ZSigmaMatrix Zw = Zd * w_c.asDiagonal();
+
+  //S = Zd W Zd^T + R and its factor
+  ZMatrix S = WeightedProduct<Accumulator>(Zw, Zd);
+  S.diagonal() += noise;
+  *S_factor_out = RobustLowerFactor(S);
+
+  //residual and NIS; a gated outlier stops here, before any n_x_-sized work
+  ZVector z_diff = Eigen::Map<const Eigen::Matrix<double, Model::kDim, 1> >(
+                          meas.values_.data()).template cast<Scalar>() - z_pred;
+  Model::Normalize(z_diff);
+  *z_diff_out = z_diff;
+  *nis_out = NisFromFactor(*S_factor_out, z_diff);
+  if (GatedOut(*nis_out, gate)) {
+    return false;
+  }
+
+  //cross correlation Tc = Xd W Zd^T and the Kalman gain
+  Points Xd = X.colwise() - x_pred_;
+  NormalizeAngles(Xd.row(3));
+  const Eigen::Matrix<Scalar, n_x_, Model::kDim> Tc =
+      WeightedProduct<Accumulator>(Xd, Zw);
+  const Eigen::Matrix<Scalar, n_x_, Model::kDim> K =
+      GainFromFactor(*S_factor_out, Tc);
+
+  //update state mean and covariance matrix; K S K^T = K Tc^T
+  x_pred_ += K * z_diff;
+  P_pred_ -= K.lazyProduct(Tc.transpose());
+  Symmetrize(&P_pred_);
+  return true;
+}
+
+template <typename Model>
+double UKF::NisWithModel(
+    const Measurement &meas,
+    const Eigen::Matrix<Scalar, Model::kDim, 1> &noise) const {
+  if (sigma_count_ == n_sig_simplex_) {
+    return NisWithPoints<Model, n_sig_simplex_>(meas, noise);
+  }
+  return NisWithPoints<Model, n_sig_>(meas, noise);
+}
+
+template <typename Model, int N>
+double UKF::NisWithPoints(
+    const Measurement &meas,
+    const Eigen::Matrix<Scalar, Model::kDim, 1> &noise) const {
+  typedef Eigen::Matrix<Scalar, Model::kDim, 1> ZVector;
+  typedef Eigen::Matrix<Scalar, Model::kDim, Model::kDim> ZMatrix;
+  typedef Eigen::Matrix<Scalar, Model::kDim, N> ZSigmaMatrix;
+  typedef Eigen::Matrix<Scalar, N, 1> Weights;
+
+  //the front half of UpdateWithPoints: S and the innovation only
+  const Eigen::Matrix<Scalar, n_x_, N> X = Xsig_pred_.template leftCols<N>();
+  const Weights w = weights_.template head<N>();
+  const Weights w_c = weights_c_.template head<N>();
+  ZSigmaMatrix Zsig;
+  Model::MeasureSigmaPoints(X, &Zsig, radar_fast_atan2_);
+  const ZVector z_pred = Zsig * w;
+  ZSigmaMatrix Zd = Zsig.colwise() - z_pred;
+  Model::Normalize(Zd);
+  ZMatrix S = WeightedProduct<Accumulator>(
+      ZSigmaMatrix(Zd * w_c.asDiagonal()), Zd);
+  S.diagonal() += noise;
+
+  ZVector z_diff = Eigen::Map<const Eigen::Matrix<double, Model::kDim, 1> >(
+                          meas.values_.data()).template cast<Scalar>() - z_pred;
+  Model::Normalize(z_diff);
+  return NisFromFactor(ZMatrix(RobustLowerFactor(S)), z_diff);
+}
+
+template <typename Model>
+void UKF::PredictMeasurement(
+    const Eigen::Matrix<Scalar, Model::kDim, 1> &noise, Eigen::Vector3d *z,
+    Eigen::Matrix3d *L, Eigen::Matrix<double, n_x_, 3> *K) const {
+  if (sigma_count_ == n_sig_simplex_) {
+    PredictMeasurementWithPoints<Model, n_sig_simplex_>(noise, z, L, K);
+  }
+  else {
+    PredictMeasurementWithPoints<Model, n_sig_>(noise, z, L, K);
+  }
+}
+
+template <typename Model, int N>
+void UKF::PredictMeasurementWithPoints(
+    const Eigen::Matrix<Scalar, Model::kDim, 1> &noise, Eigen::Vector3d *z,
+    Eigen::Matrix3d *L, Eigen::Matrix<double, n_x_, 3> *K) const {
+  const int kDim = Model::kDim;
+  typedef Eigen::Matrix<Scalar, kDim, 1> ZVector;
+  typedef Eigen::Matrix<Scalar, kDim, kDim> ZMatrix;
+  typedef Eigen::Matrix<Scalar, kDim, N> ZSigmaMatrix;
+  typedef Eigen::Matrix<Scalar, n_x_, N> Points;
+  typedef Eigen::Matrix<Scalar, N, 1> Weights;
+
+  const Points X = Xsig_pred_.template leftCols<N>();
+  const Weights w = weights_.template head<N>();
+  const Weights w_c = weights_c_.template head<N>();
+  ZSigmaMatrix Zsig;
+  Model::MeasureSigmaPoints(X, &Zsig, radar_fast_atan2_);
+  const ZVector z_pred = Zsig * w;
+  ZSigmaMatrix Zd = Zsig.colwise() - z_pred;
+  Model::Normalize(Zd);
+  const ZSigmaMatrix Zw = Zd * w_c.asDiagonal();
+  ZMatrix S = WeightedProduct<Accumulator>(Zw, Zd);
+  S.diagonal() += noise;
+  const ZMatrix S_factor = RobustLowerFactor(S);
+
+  Points Xd = X.colwise() - x_pred_;
+  NormalizeAngles(Xd.row(3));
+  const Eigen::Matrix<Scalar, n_x_, kDim> Tc =
+      WeightedProduct<Accumulator>(Xd, Zw);
+
+  z->setZero();
+  L->setIdentity();
+  K->setZero();
+  z->template head<kDim>() = z_pred.template cast<double>();
+  L->template topLeftCorner<kDim, kDim>() = S_factor.template cast<double>();
+  K->template leftCols<kDim>() =
+      GainFromFactor(S_factor, Tc).template cast<double>();
+}
+
+#endif /* MEASUREMENT_MODELS_H_ */
@@ -2,10 +2,14 @@
 #define MEASUREMENT_PACKAGE_H_
 
 #include "Eigen/Dense"
+#include <array>
+#include <type_traits>
+#include "time_base.h"
 
 class MeasurementPackage {
 public:
-  long timestamp_;
+  // microseconds, see time_base.h
+  TimeUs timestamp_;
 
   enum SensorType{
     LASER,
@@ -16,4 +20,45 @@ public:
 
 };
 
+/**
+ * Fixed-size counterpart of MeasurementPackage. It is a POD without heap
+ * storage, so measurements can be queued contiguously and copied with
+ * memcpy. Lidar uses values_[0..1] (px, py), radar values_[0..2] (rho, phi,
+ * rho_dot).
+ */
+struct Measurement {
+  ///* microseconds
+  TimeUs timestamp_;
+
+  MeasurementPackage::SensorType sensor_type_;
+
+  std::array<double, 3> values_;
+
+  /**
+   * Number of used entries in values_
+   */
+  int size() const {
+    return sensor_type_ == MeasurementPackage::RADAR ? 3 : 2;
+  }
+
+  /**
+   * Copies a MeasurementPackage; entries beyond its size are zeroed
+   */
+  static Measurement From(const MeasurementPackage &meas_package) {
+    Measurement m;
+    m.timestamp_ = meas_package.timestamp_;
+    m.sensor_type_ = meas_package.sensor_type_;
+    for (int i = 0; i < 3; i++) {
+      m.values_[i] = i < meas_package.raw_measurements_.size()
+                     ? meas_package.raw_measurements_(i) : 0.0;
+    }
+    return m;
+  }
+};
+
+static_assert(std::is_pod<Measurement>::value,
+              "Measurement must stay a POD");
+static_assert(sizeof(Measurement) <= 48,
+              "Measurement must stay compact");
+
 #endif /* MEASUREMENT_PACKAGE_H_ */
@@ -0,0 +1,413 @@
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+#include "alloc_counter.h"
+#include "config_reload.h"
+#include "huge_pages.h"
+#include "kernel_autotune.h"
+#include "latency_trace.h"
+#include "logger.h"
+#include "pipeline.h"
+#include "shadow_runner.h"
+#include "stage_timing.h"
+#include "thread_shards.h"
+#include "ukf_kernels.h"
+
+namespace {
+
+// one thread's share of every counter and gauge; the gauges' shares may be
+// negative (a session opened on one loop may close on another). Aligned so
+// that no two threads' shards share a cache line.
+struct alignas(64) MetricsShard {
+  MetricsShard() : sessions(0), tracks(0) {
+    for (int c = 0; c < Metrics::kCounterCount; c++) {
+      counters[c].store(0, std::memory_order_relaxed);
+    }
+    for (int m = 0; m < Metrics::kMemoryComponentCount; m++) {
+      memory[m].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  std::atomic<unsigned long long> counters[Metrics::kCounterCount];
+  std::atomic<long long> sessions;
+  std::atomic<long long> memory[Metrics::kMemoryComponentCount];
+  std::atomic<long long> tracks;
+};
+
+// totals over every shard
+struct MetricsTotals {
+  MetricsTotals() : counters(), sessions(0), memory(), tracks(0) {}
+
+  unsigned long long counters[Metrics::kCounterCount];
+  long long sessions;
+  long long memory[Metrics::kMemoryComponentCount];
+  long long tracks;
+};
+
+MetricsTotals Sum() {
+  MetricsTotals totals;
+  ThreadShards<MetricsShard>::ForEach([&totals](const MetricsShard &shard) {
+    for (int c = 0; c < Metrics::kCounterCount; c++) {
+      totals.counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+    }
+    totals.sessions += shard.sessions.load(std::memory_order_relaxed);
+    for (int m = 0; m < Metrics::kMemoryComponentCount; m++) {
+      totals.memory[m] += shard.memory[m].load(std::memory_order_relaxed);
+    }
+    totals.tracks += shard.tracks.load(std::memory_order_relaxed);
+  });
+  return totals;
+}
+
+const char *const kMemoryComponents[Metrics::kMemoryComponentCount] = {
+  "tracks", "history", "buffers"
+};
+
+std::mutex g_pipelines_mutex;
+std::vector<const Pipeline *> g_pipelines;
+
+std::mutex g_shadow_mutex;
+const ShadowRunner *g_shadow = nullptr;
+
+struct CounterInfo {
+  const char *name;
+  const char *labels;
+  const char *help;
+};
+
+// counters sharing a name must be adjacent; HELP/TYPE is written once
+const CounterInfo kCounters[Metrics::kCounterCount] = {
+  {"ukf_messages_total", "{kind=\"text\"}", "Frames received"},
+  {"ukf_messages_total", "{kind=\"binary\"}", "Frames received"},
+  {"ukf_messages_total", "{kind=\"malformed\"}", "Frames received"},
+  {"ukf_updates_total", "{sensor=\"lidar\"}", "Filter updates by sensor"},
+  {"ukf_updates_total", "{sensor=\"radar\"}", "Filter updates by sensor"},
+  {"ukf_divergences_total", "",
+   "Updates that left a non-finite state or negative variance"},
+  {"ukf_covariance_repairs_total", "",
+   "Predictions that repaired a covariance that was not positive definite"},
+  {"ukf_reply_batches_total", "", "Coalesced estimate_batch frames sent"},
+  {"ukf_replies_batched_total", "",
+   "Estimates sent inside estimate_batch frames"},
+};
+
+void AppendHeader(std::string *out, const char *name, const char *type,
+                  const char *help) {
+  char line[256];
+  snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help,
+           name, type);
+  *out += line;
+}
+
+void AppendSample(std::string *out, const char *name, const char *labels,
+                  unsigned long long value) {
+  char line[256];
+  snprintf(line, sizeof(line), "%s%s %llu\n", name, labels, value);
+  *out += line;
+}
+
+void AppendSummary(std::string *out, const char *name, const char *help,
+                   const LatencyHistogram &h) {
+  char line[256];
+  AppendHeader(out, name, "summary", help);
+  const double kQuantiles[] = {0.5, 0.99, 0.999};
+  for (int q = 0; q < 3; q++) {
+    snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %llu\n", name,
+             kQuantiles[q], h.Percentile(kQuantiles[q]));
+    *out += line;
+  }
+  snprintf(line, sizeof(line), "%s_sum %.0f\n%s_count %llu\n", name,
+           h.mean() * h.count(), name, h.count());
+  *out += line;
+}
+
+// resident set size of the process from /proc, 0 where there is none
+unsigned long long ResidentBytes() {
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f) {
+    return 0;
+  }
+  unsigned long long size = 0;
+  unsigned long long resident = 0;
+  const bool read = fscanf(f, "%llu %llu", &size, &resident) == 2;
+  fclose(f);
+  return read ? resident * static_cast<unsigned long long>(
+                               sysconf(_SC_PAGESIZE))
+              : 0;
+}
+
+}  // namespace
+
+//a bump on a thread that is already being torn down is dropped
+void Metrics::Increment(Counter counter) {
+  Add(counter, 1);
+}
+
+void Metrics::Add(Counter counter, unsigned long long amount) {
+  MetricsShard *shard = ThreadShards<MetricsShard>::Local();
+  if (shard) {
+    AddOwned(&shard->counters[counter], amount);
+  }
+}
+
+unsigned long long Metrics::Value(Counter counter) {
+  return Sum().counters[counter];
+}
+
+void Metrics::AttachThread() {
+  ThreadShards<MetricsShard>::Local();
+  StageTimings::AttachThread();
+}
+
+void Metrics::SessionOpened() {
+  MetricsShard *shard = ThreadShards<MetricsShard>::Local();
+  if (shard) {
+    AddOwned(&shard->sessions, 1LL);
+  }
+}
+
+void Metrics::SessionClosed() {
+  MetricsShard *shard = ThreadShards<MetricsShard>::Local();
+  if (shard) {
+    AddOwned(&shard->sessions, -1LL);
+  }
+}
+
+void Metrics::AddMemory(MemoryComponent component, long long delta) {
+  MetricsShard *shard = ThreadShards<MetricsShard>::Local();
+  if (shard) {
+    AddOwned(&shard->memory[component], delta);
+  }
+}
+
+void Metrics::AddTracks(long long delta) {
+  MetricsShard *shard = ThreadShards<MetricsShard>::Local();
+  if (shard) {
+    AddOwned(&shard->tracks, delta);
+  }
+}
+
+void Metrics::AddPipeline(const Pipeline *pipeline) {
+  std::lock_guard<std::mutex> lock(g_pipelines_mutex);
+  g_pipelines.push_back(pipeline);
+}
+
+void Metrics::SetShadow(const ShadowRunner *shadow) {
+  std::lock_guard<std::mutex> lock(g_shadow_mutex);
+  g_shadow = shadow;
+}
+
+void Metrics::RemovePipeline(const Pipeline *pipeline) {
+  std::lock_guard<std::mutex> lock(g_pipelines_mutex);
+  g_pipelines.erase(
+      std::remove(g_pipelines.begin(), g_pipelines.end(), pipeline),
+      g_pipelines.end());
+}
+
+std::string Metrics::Render() {
+  std::string out;
+  out.reserve(4096);
+  char line[256];
+  const MetricsTotals totals = Sum();
+
+  for (int c = 0; c < kCounterCount; c++) {
+    const CounterInfo &info = kCounters[c];
+    if (c == 0 || strcmp(info.name, kCounters[c - 1].name) != 0) {
+      AppendHeader(&out, info.name, "counter", info.help);
+    }
+    AppendSample(&out, info.name, info.labels, totals.counters[c]);
+  }
+
+  AppendHeader(&out, "ukf_sessions", "gauge", "Open client sessions");
+  snprintf(line, sizeof(line), "ukf_sessions %lld\n", totals.sessions);
+  out += line;
+
+  AppendHeader(&out, "ukf_tracks", "gauge", "Tracks held by all sessions");
+  snprintf(line, sizeof(line), "ukf_tracks %lld\n", totals.tracks);
+  out += line;
+
+  //sessions report their growth every few hundred frames, so a history or
+  //buffer that keeps growing shows up here well before the process dies
+  AppendHeader(&out, "ukf_memory_bytes", "gauge",
+               "Bytes held by sessions and pipelines, by component");
+  for (int c = 0; c < kMemoryComponentCount; c++) {
+    snprintf(line, sizeof(line), "ukf_memory_bytes{component=\"%s\"} %lld\n",
+             kMemoryComponents[c], totals.memory[c]);
+    out += line;
+  }
+
+  //one series per event loop running a pipeline
+  {
+    std::lock_guard<std::mutex> lock(g_pipelines_mutex);
+    size_t pipeline_bytes = 0;
+    for (size_t i = 0; i < g_pipelines.size(); i++) {
+      pipeline_bytes += g_pipelines[i]->stats().memory_bytes;
+    }
+    snprintf(line, sizeof(line),
+             "ukf_memory_bytes{component=\"pipelines\"} %zu\n",
+             pipeline_bytes);
+    out += line;
+
+    AppendHeader(&out, "ukf_pipeline_queued", "gauge",
+                 "Jobs waiting for the pipeline worker");
+    for (size_t i = 0; i < g_pipelines.size(); i++) {
+      snprintf(line, sizeof(line), "ukf_pipeline_queued{loop=\"%zu\"} %zu\n",
+               i, g_pipelines[i]->stats().queued);
+      out += line;
+    }
+    AppendHeader(&out, "ukf_pipeline_stalls_total", "counter",
+                 "Times a pipeline ring was full");
+    for (size_t i = 0; i < g_pipelines.size(); i++) {
+      Pipeline::Stats stats = g_pipelines[i]->stats();
+      snprintf(line, sizeof(line),
+               "ukf_pipeline_stalls_total{loop=\"%zu\",ring=\"input\"} %llu\n"
+               "ukf_pipeline_stalls_total{loop=\"%zu\",ring=\"output\"} %llu\n",
+               i, stats.input_stalls, i, stats.output_stalls);
+      out += line;
+    }
+    AppendHeader(&out, "ukf_pipeline_dropped_total", "counter",
+                 "Measurements shed by the overload policy");
+    for (size_t i = 0; i < g_pipelines.size(); i++) {
+      Pipeline::Stats stats = g_pipelines[i]->stats();
+      const char *reasons[4] = {"full", "late", "coalesced", "deadline"};
+      unsigned long long counts[4] = {stats.dropped_full, stats.dropped_late,
+                                      stats.coalesced, stats.missed_deadline};
+      for (int r = 0; r < 4; r++) {
+        snprintf(line, sizeof(line),
+                 "ukf_pipeline_dropped_total{loop=\"%zu\",reason=\"%s\"} "
+                 "%llu\n", i, reasons[r], counts[r]);
+        out += line;
+      }
+    }
+  }
+
+  //stage histograms as summaries; all zero unless built with
+  //UKF_STAGE_TIMING
+  AppendHeader(&out, "ukf_stage_latency_ns", "summary",
+               "Hot-path stage latency in nanoseconds");
+  const double kQuantiles[] = {0.5, 0.99, 0.999};
+  LatencyHistogram h;
+  for (int s = 0; s < kStageCount; s++) {
+    StageTimings::Merged(Stage(s), &h);
+    const char *name = StageTimings::Name(Stage(s));
+    for (int q = 0; q < 3; q++) {
+      snprintf(line, sizeof(line),
+               "ukf_stage_latency_ns{stage=\"%s\",quantile=\"%g\"} %llu\n",
+               name, kQuantiles[q], h.Percentile(kQuantiles[q]));
+      out += line;
+    }
+    snprintf(line, sizeof(line),
+             "ukf_stage_latency_ns_sum{stage=\"%s\"} %.0f\n"
+             "ukf_stage_latency_ns_count{stage=\"%s\"} %llu\n",
+             name, h.mean() * h.count(), name, h.count());
+    out += line;
+  }
+
+  //per measurement, from the frame's receive to its reply's send
+  LatencyTrace::ReceiveToSend(&h);
+  AppendSummary(&out, "ukf_receive_to_send_ns",
+                "Receive-to-send latency of measurements in nanoseconds", h);
+  LatencyTrace::SensorAge(&h);
+  AppendSummary(&out, "ukf_sensor_age_ns",
+                "Sensor timestamp to reply send in nanoseconds", h);
+  AppendHeader(&out, "ukf_traces_dropped_total", "counter",
+               "Sampled traces dropped because their ring slot was busy");
+  AppendSample(&out, "ukf_traces_dropped_total", "",
+               LatencyTrace::DroppedTraces());
+
+  {
+    std::lock_guard<std::mutex> lock(g_shadow_mutex);
+    if (g_shadow) {
+      const ShadowRunner::Stats stats = g_shadow->stats();
+      AppendHeader(&out, "ukf_shadow_samples_total", "counter",
+                   "Updates also run through the shadow configuration");
+      AppendSample(&out, "ukf_shadow_samples_total", "", stats.samples);
+      AppendHeader(&out, "ukf_shadow_divergences_total", "counter",
+                   "Shadow updates that left a non-finite state or negative "
+                   "variance");
+      AppendSample(&out, "ukf_shadow_divergences_total", "",
+                   stats.divergences);
+      AppendHeader(&out, "ukf_shadow_position_diff_m", "gauge",
+                   "Distance between served and shadow positions in m");
+      snprintf(line, sizeof(line),
+               "ukf_shadow_position_diff_m{stat=\"mean\"} %g\n"
+               "ukf_shadow_position_diff_m{stat=\"max\"} %g\n",
+               stats.position_diff_mean, stats.position_diff_max);
+      out += line;
+      AppendHeader(&out, "ukf_shadow_velocity_diff_mps", "gauge",
+                   "Distance between served and shadow velocities in m/s");
+      snprintf(line, sizeof(line),
+               "ukf_shadow_velocity_diff_mps{stat=\"mean\"} %g\n"
+               "ukf_shadow_velocity_diff_mps{stat=\"max\"} %g\n",
+               stats.velocity_diff_mean, stats.velocity_diff_max);
+      out += line;
+      AppendSummary(&out, "ukf_shadow_primary_latency_ns",
+                    "Update latency of sampled served filters in "
+                    "nanoseconds", g_shadow->primary_latency());
+      AppendSummary(&out, "ukf_shadow_update_latency_ns",
+                    "Update latency of their shadows in nanoseconds",
+                    g_shadow->shadow_latency());
+    }
+  }
+
+  AppendHeader(&out, "ukf_log_dropped_total", "counter",
+               "Log messages dropped because the log ring was full");
+  AppendSample(&out, "ukf_log_dropped_total", "", Logger::Dropped());
+
+  AppendHeader(&out, "ukf_heap_allocations_total", "counter",
+               "Heap allocations since start; 0 unless built with "
+               "UKF_COUNT_ALLOCATIONS");
+  AppendSample(&out, "ukf_heap_allocations_total", "", AllocCounter::Count());
+
+  AppendHeader(&out, "ukf_resident_bytes", "gauge",
+               "Resident set size of the process");
+  AppendSample(&out, "ukf_resident_bytes", "", ResidentBytes());
+
+  AppendHeader(&out, "ukf_huge_page_bytes", "gauge",
+               "Bytes of large buffers by page backing (see --huge-pages)");
+  for (int b = 0; b < HugePages::kBackingCount; b++) {
+    snprintf(line, sizeof(line), "ukf_huge_page_bytes{backing=\"%s\"} %llu\n",
+             HugePages::Name(HugePages::Backing(b)),
+             HugePages::Bytes(HugePages::Backing(b)));
+    out += line;
+  }
+
+  AppendHeader(&out, "ukf_realtime_violations_total", "counter",
+               "Heap allocations on filter threads in real-time mode");
+  AppendSample(&out, "ukf_realtime_violations_total", "",
+               AllocCounter::ForbiddenCount());
+
+  const ConfigReload::Published *config = ConfigReload::Current();
+  AppendHeader(&out, "ukf_config_generation", "gauge",
+               "Configuration reloads applied since start");
+  AppendSample(&out, "ukf_config_generation", "",
+               config ? config->generation : 0);
+  AppendHeader(&out, "ukf_config_reload_failures_total", "counter",
+               "Reloads rejected for an unreadable or bad config file");
+  AppendSample(&out, "ukf_config_reload_failures_total", "",
+               ConfigReload::Failures());
+
+  AppendHeader(&out, "ukf_kernel_isa_info", "gauge",
+               "Instruction set of the filter kernels chosen at startup");
+  snprintf(line, sizeof(line), "{isa=\"%s\"}",
+           UkfKernels::Name(UkfKernels::Selected().isa));
+  AppendSample(&out, "ukf_kernel_isa_info", line, 1);
+
+  //which ISA's version of each kernel runs, and how that was decided
+  AppendHeader(&out, "ukf_kernel_choice_info", "gauge",
+               "ISA version of each kernel in use (see --autotune)");
+  for (int k = 0; k < UkfKernels::KERNEL_COUNT; k++) {
+    const UkfKernels::Kernel kernel = UkfKernels::Kernel(k);
+    snprintf(line, sizeof(line), "{kernel=\"%s\",isa=\"%s\",origin=\"%s\"}",
+             UkfKernels::Name(kernel),
+             UkfKernels::Name(UkfKernels::Source(kernel)),
+             KernelAutotune::Name(KernelAutotune::origin()));
+    AppendSample(&out, "ukf_kernel_choice_info", line, 1);
+  }
+  return out;
+}
@@ -0,0 +1,96 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <string>
+
+class Pipeline;
+class ShadowRunner;
+
+/**
+ * Process-wide server counters, rendered in the Prometheus text exposition
+ * format for the /metrics endpoint. Counters and gauges may be bumped from
+ * any event loop or pipeline worker: each thread adds to a shard of its own
+ * (see ThreadShards), a relaxed load and store on a cache line no other
+ * thread writes, and Value and Render sum the shards.
+ */
+class Metrics {
+public:
+  enum Counter {
+    ///* Socket.IO text frames received
+    MESSAGES_TEXT,
+    ///* binary measurement frames received
+    MESSAGES_BINARY,
+    ///* text frames neither parser could read
+    MESSAGES_MALFORMED,
+    ///* filter updates per sensor
+    UPDATES_LIDAR,
+    UPDATES_RADAR,
+    ///* updates that left a non-finite state or a negative variance
+    DIVERGENCES,
+    ///* predictions that found P not positive definite and repaired it
+    COVARIANCE_REPAIRS,
+    ///* estimate_batch frames sent, and the estimates they carried
+    REPLY_BATCHES,
+    REPLIES_BATCHED,
+    kCounterCount
+  };
+
+  static void Increment(Counter counter);
+  static void Add(Counter counter, unsigned long long amount);
+  static unsigned long long Value(Counter counter);
+
+  /**
+   * Creates the calling thread's shards of these and of the stage timings
+   * now rather than on first use, which allocates; for threads that must
+   * not allocate once running (see Realtime::EnterFilterThread)
+   */
+  static void AttachThread();
+
+  /**
+   * Active session gauge, kept by the transports as clients come and go
+   * (sessions may be pooled and outlive their clients)
+   */
+  static void SessionOpened();
+  static void SessionClosed();
+
+  enum MemoryComponent {
+    ///* filters, their out-of-sequence histories and RMSE windows, and the
+    ///* track maps
+    MEMORY_TRACKS,
+    ///* estimate/ground-truth history of the Socket.IO streams
+    MEMORY_HISTORY,
+    ///* parser, reply and latency stamp buffers
+    MEMORY_BUFFERS,
+    kMemoryComponentCount
+  };
+
+  /**
+   * Memory gauges, kept by each session for its own share (see
+   * Session::AccountMemory)
+   * @param component What holds the bytes
+   * @param delta Bytes allocated, negative for bytes released
+   */
+  static void AddMemory(MemoryComponent component, long long delta);
+  static void AddTracks(long long delta);
+
+  /**
+   * Adds a pipeline whose queue depth and stall counters are exported until
+   * it is removed again. The pipeline must outlive its registration.
+   */
+  static void AddPipeline(const Pipeline *pipeline);
+  static void RemovePipeline(const Pipeline *pipeline);
+
+  /**
+   * Sets the shadow run whose comparison is exported, null for none. The
+   * runner must outlive its registration.
+   */
+  static void SetShadow(const ShadowRunner *shadow);
+
+  /**
+   * All counters, gauges, stage latency summaries and allocation counts as
+   * Prometheus text
+   */
+  static std::string Render();
+};
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,266 @@
+#include "mht.h"
+#include <algorithm>
+#include <cmath>
+#include "angle.h"
+#include "measurement_models.h"
+
+namespace {
+
+// no track has this id before its slot is first used
+const unsigned long long kUnknown = ~0ULL;
+
+}  // namespace
+
+MhtAssociator::MhtAssociator(TrackManager *manager, const Options &options)
+    : manager_(manager),
+      options_(options),
+      sensor_(MeasurementPackage::LASER),
+      dim_(UKF::n_z_lidar_),
+      timestamp_(0),
+      miss_score_(std::log(1.0 - options.detection_probability)),
+      branched_(0),
+      pruned_(0),
+      family_(manager->capacity(), kUnknown),
+      known_id_(manager->capacity(), kUnknown) {
+  if (options_.max_branches < 1) {
+    options_.max_branches = 1;
+  }
+  if (options_.max_hypotheses < 1) {
+    options_.max_hypotheses = 1;
+  }
+  children_.reserve(options_.max_branches + 1);
+  parents_.reserve(manager->capacity());
+  entries_.reserve(manager->capacity());
+  best_.reserve(manager->capacity());
+}
+
+MhtAssociator::~MhtAssociator() {}
+
+void MhtAssociator::AdoptNewTracks() {
+  const std::vector<int> &active = manager_->active();
+  for (size_t i = 0; i < active.size(); i++) {
+    const int slot = active[i];
+    const unsigned long long id = (*manager_)[slot].id;
+    if (known_id_[slot] != id) {
+      known_id_[slot] = id;
+      family_[slot] = id;
+    }
+  }
+}
+
+int MhtAssociator::Scan(const Measurement *measurements,
+                        int measurement_count, const GatedPair *pairs,
+                        size_t count) {
+  branched_ = 0;
+  pruned_ = 0;
+  AdoptNewTracks();
+  if (measurement_count > 0) {
+    timestamp_ = measurements[0].timestamp_;
+    sensor_ = measurements[count > 0 ? pairs[0].measurement : 0].sensor_type_;
+  }
+  dim_ = sensor_ == MeasurementPackage::RADAR ? UKF::n_z_radar_
+                                              : UKF::n_z_lidar_;
+
+  //kept pairs grouped by slot
+  pairs_.clear();
+  for (size_t e = 0; e < count; e++) {
+    if (measurements[pairs[e].measurement].sensor_type_ == sensor_) {
+      pairs_.push_back(pairs[e]);
+    }
+  }
+  std::sort(pairs_.begin(), pairs_.end(),
+            [](const GatedPair &a, const GatedPair &b) {
+    return a.track < b.track;
+  });
+  innovation_.resize(3 * pairs_.size());
+  pair_score_.resize(pairs_.size());
+  gated_.assign(measurement_count, 0);
+
+  //children take slots of their own, so the parents are this scan's tracks
+  parents_.assign(manager_->active().begin(), manager_->active().end());
+  std::sort(parents_.begin(), parents_.end());
+  size_t e = 0;
+  for (size_t p = 0; p < parents_.size(); p++) {
+    const int slot = parents_[p];
+    while (e < pairs_.size() && pairs_[e].track < slot) {
+      ++e;
+    }
+    size_t end = e;
+    while (end < pairs_.size() && pairs_[end].track == slot) {
+      ++end;
+    }
+    BranchParent(slot, measurements, static_cast<int>(e),
+                 static_cast<int>(end));
+    e = end;
+  }
+  Prune();
+
+  int born = 0;
+  for (int m = 0; m < measurement_count; m++) {
+    if (gated_[m]) {
+      continue;
+    }
+    const int slot = manager_->Create(measurements[m]);
+    if (slot < 0) {
+      break;
+    }
+    known_id_[slot] = (*manager_)[slot].id;
+    family_[slot] = known_id_[slot];
+    best_.push_back(slot);
+    ++born;
+  }
+  return born;
+}
+
+void MhtAssociator::BranchParent(int slot, const Measurement *measurements,
+                                 int begin, int end) {
+  typedef UKF::Scalar Scalar;
+  typedef Eigen::Matrix<double, UKF::n_x_, 1> Vector;
+  typedef Eigen::Matrix<double, UKF::n_x_, UKF::n_x_> Matrix;
+  TrackManager::Track &parent = (*manager_)[slot];
+  UKF &ukf = parent.ukf;
+
+  //the front half of the update, once for every child
+  Eigen::Vector3d z;
+  Eigen::Matrix3d L;
+  Eigen::Matrix<double, UKF::n_x_, 3> K;
+  bool valid = begin < end;
+  if (valid) {
+    if (ukf.ekf_predicted_) {
+      ukf.RefreshSigmaPoints();
+    }
+    if (sensor_ == MeasurementPackage::RADAR) {
+      ukf.PredictMeasurement<RadarModel>(ukf.radar_noise_, &z, &L, &K);
+    }
+    else {
+      ukf.PredictMeasurement<LidarModel>(ukf.lidar_noise_, &z, &L, &K);
+    }
+  }
+  double log_det = 0.0;
+  for (int c = 0; c < dim_ && valid; c++) {
+    valid = L(c, c) > 0.0;
+    log_det += valid ? std::log(L(c, c)) : 0.0;
+  }
+
+  //the missed detection, and each gated pair by its likelihood ratio
+  children_.clear();
+  Child miss = {-1, parent.score + miss_score_};
+  children_.push_back(miss);
+  const double log_ratio = std::log(options_.detection_probability /
+                                    options_.clutter_density) -
+                           0.5 * dim_ * std::log(2.0 * M_PI) - log_det;
+  for (int k = begin; k < end && valid; k++) {
+    const Measurement &meas = measurements[pairs_[k].measurement];
+    double *nu = &innovation_[3 * k];
+    nu[2] = 0.0;
+    for (int c = 0; c < dim_; c++) {
+      nu[c] = meas.values_[c] - z(c);
+    }
+    if (sensor_ == MeasurementPackage::RADAR) {
+      nu[1] = NormalizeAngle(nu[1]);
+    }
+    //forward substitution with the shared factor, for the NIS
+    Eigen::Vector3d y = Eigen::Vector3d::Zero();
+    double nis = 0.0;
+    for (int r = 0; r < dim_; r++) {
+      double s = nu[r];
+      for (int c = 0; c < r; c++) {
+        s -= L(r, c) * y(c);
+      }
+      y(r) = s / L(r, r);
+      nis += y(r) * y(r);
+    }
+    pairs_[k].cost = nis;
+    if (options_.gate > 0.0 && nis > options_.gate) {
+      continue;
+    }
+    gated_[pairs_[k].measurement] = 1;
+    pair_score_[k] = log_ratio - 0.5 * nis;
+    Child child = {k, parent.score + pair_score_[k]};
+    children_.push_back(child);
+  }
+  const size_t kept = std::min(children_.size(),
+                               static_cast<size_t>(options_.max_branches));
+  std::partial_sort(children_.begin(), children_.begin() + kept,
+                    children_.end(), [](const Child &a, const Child &b) {
+    return a.score > b.score;
+  });
+  children_.resize(kept);
+
+  //every child has the same covariance, P - K S K^T
+  Matrix P = ukf.P().cast<double>();
+  if (valid) {
+    const Eigen::Matrix<double, UKF::n_x_, 3> KL = K * L;
+    P -= KL * KL.transpose();
+    P = 0.5 * (P + P.transpose());
+  }
+  const Vector x_pred = ukf.x().cast<double>();
+
+  //the copies are taken before the parent's own child changes its filter
+  const unsigned long long family = family_[slot];
+  for (size_t i = children_.size(); i-- > 0;) {
+    int target = slot;
+    if (i > 0) {
+      target = manager_->Branch(slot);
+      if (target < 0) {
+        continue;
+      }
+      known_id_[target] = (*manager_)[target].id;
+      family_[target] = family;
+      ++branched_;
+    }
+    TrackManager::Track &track = (*manager_)[target];
+    const Child &child = children_[i];
+    track.score = child.score;
+    track.peak_score = std::max(track.peak_score, track.score);
+    if (child.pair < 0) {
+      track.ukf.previous_timestamp_ = timestamp_;
+      manager_->Miss(target);
+      continue;
+    }
+    const Eigen::Map<const Eigen::Vector3d> nu(&innovation_[3 * child.pair]);
+    Vector x = x_pred + K * nu;
+    x(3) = NormalizeAngle(x(3));
+    track.ukf.SetState(x.cast<Scalar>(), P.cast<Scalar>(), timestamp_);
+    if (sensor_ == MeasurementPackage::RADAR) {
+      track.ukf.nis_radar_ = pairs_[child.pair].cost;
+    }
+    else {
+      track.ukf.nis_lidar_ = pairs_[child.pair].cost;
+    }
+    manager_->Hit(target);
+  }
+}
+
+void MhtAssociator::Prune() {
+  entries_.clear();
+  const std::vector<int> &active = manager_->active();
+  for (size_t i = 0; i < active.size(); i++) {
+    Entry entry = {family_[active[i]], (*manager_)[active[i]].score,
+                   active[i]};
+    entries_.push_back(entry);
+  }
+  std::sort(entries_.begin(), entries_.end(),
+            [](const Entry &a, const Entry &b) {
+    return a.family != b.family ? a.family < b.family : a.score > b.score;
+  });
+  best_.clear();
+  int kept = 0;
+  double top = 0.0;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const Entry &entry = entries_[i];
+    if (i == 0 || entry.family != entries_[i - 1].family) {
+      best_.push_back(entry.slot);
+      kept = 1;
+      top = entry.score;
+      continue;
+    }
+    if (kept < options_.max_hypotheses &&
+        entry.score >= top - options_.prune_drop) {
+      ++kept;
+      continue;
+    }
+    manager_->Remove(entry.slot);
+    ++pruned_;
+  }
+}
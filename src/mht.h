@@ -0,0 +1,153 @@
+#ifndef MHT_H_
+#define MHT_H_
+
+#include <cstddef>
+#include <vector>
+#include "association.h"
+#include "measurement_package.h"
+#include "track_manager.h"
+
+/**
+ * Limited track-oriented multiple hypothesis tracking, for scans where
+ * GnnAssociator would have to bet on one of several close measurements.
+ *
+ * The tracks of a TrackManager are grouped into families, one per target;
+ * each live track is one hypothesis of its family. In a scan every
+ * hypothesis is a parent: its one prediction (made by the caller, as for
+ * gating) is shared by all of its children. The front half of the update
+ * (predicted measurement, factor of S, gain and the updated covariance) is
+ * computed once per parent, so each gated measurement costs a triangular
+ * solve and x + K nu. The parent branches into at most max_branches
+ * children: its most likely gated measurements and the missed detection,
+ * scored as log-likelihood ratios, ln(P_D N(nu; 0, S) / clutter density)
+ * for a measurement and ln(1 - P_D) for the miss, onto the parent's
+ * TrackManager::Track::score. The most likely child keeps the parent's
+ * slot; the others are TrackManager::Branch copies from the pool, so
+ * branching does not allocate.
+ *
+ * After branching each family keeps its max_hypotheses best hypotheses
+ * and drops any more than prune_drop below its best. A measurement that no
+ * hypothesis gated starts a new family. Families do not compete for
+ * measurements (there is no global hypothesis), which keeps every step
+ * linear in the gated pairs; misses go through TrackManager::Miss and its
+ * deletion rules. The manager's own scoring (SetScoring) should be off,
+ * since Scan keeps the scores.
+ *
+ * One call handles one scan of one sensor: pairs with a measurement of
+ * another sensor than the first pair's are dropped. All working storage is
+ * kept between scans.
+ */
+class MhtAssociator {
+public:
+  struct Options {
+    ///* probability that a target is detected in a scan
+    double detection_probability;
+    ///* clutter measurements per unit measurement volume (m^2 for lidar,
+    ///* m rad m/s for radar)
+    double clutter_density;
+    ///* pairs with a larger NIS are dropped; 0 keeps every pair given
+    double gate;
+    ///* children of one parent per scan, the missed detection included
+    int max_branches;
+    ///* hypotheses a family keeps after a scan
+    int max_hypotheses;
+    ///* hypotheses scoring this far below their family's best are dropped
+    double prune_drop;
+
+    Options()
+        : detection_probability(0.9),
+          clutter_density(1e-3),
+          gate(0.0),
+          max_branches(3),
+          max_hypotheses(4),
+          prune_drop(10.0) {}
+  };
+
+  /**
+   * Constructor
+   * @param manager Tracks to branch; every live track starts as its own
+   * family
+   * @param options Scoring and pruning
+   */
+  MhtAssociator(TrackManager *manager, const Options &options = Options());
+
+  virtual ~MhtAssociator();
+
+  /**
+   * Branches, scores and prunes the hypotheses with one scan, and starts
+   * families on the measurements no hypothesis gated. The live tracks must
+   * already be predicted to the scan time, as for gating.
+   * @param measurements Measurements indexed by measurement id, all of the
+   * scan's time
+   * @param measurement_count Number of measurements
+   * @param pairs Gated pairs, track ids being manager slots, in any order;
+   * their costs are not used
+   * @param count Number of pairs
+   * @return Number of families started
+   */
+  int Scan(const Measurement *measurements, int measurement_count,
+           const GatedPair *pairs, size_t count);
+
+  ///* Family of a live slot: the id of the track it descends from
+  unsigned long long family(int slot) const { return family_[slot]; }
+
+  ///* After Scan: the most likely hypothesis of each family, one slot each
+  const std::vector<int> &best() const { return best_; }
+
+  ///* Children branched and hypotheses pruned by the last Scan
+  int branched() const { return branched_; }
+  int pruned() const { return pruned_; }
+
+  const Options &options() const { return options_; }
+
+private:
+  // a hypothesis of a parent: a kept pair, or -1 for the missed detection
+  struct Child {
+    int pair;
+    double score;
+  };
+
+  // a live hypothesis, for pruning by family
+  struct Entry {
+    unsigned long long family;
+    double score;
+    int slot;
+  };
+
+  // scores the pairs [begin, end) of one predicted parent and branches it
+  void BranchParent(int slot, const Measurement *measurements, int begin,
+                    int end);
+
+  // families of tracks the manager started or branched outside Scan
+  void AdoptNewTracks();
+
+  // keeps each family's best hypotheses
+  void Prune();
+
+  TrackManager *manager_;
+  Options options_;
+  MeasurementPackage::SensorType sensor_;
+  int dim_;
+  TimeUs timestamp_;
+  double miss_score_;
+  int branched_;
+  int pruned_;
+
+  ///* per slot: family, and whether Scan knows the track
+  std::vector<unsigned long long> family_;
+  std::vector<unsigned long long> known_id_;
+
+  // kept pairs sorted by slot, with their innovations (3 per pair)
+  std::vector<GatedPair> pairs_;
+  std::vector<double> innovation_;
+  std::vector<double> pair_score_;
+  ///* per measurement: whether some hypothesis gated it
+  std::vector<char> gated_;
+
+  std::vector<int> parents_;
+  std::vector<Child> children_;
+  std::vector<Entry> entries_;
+  std::vector<int> best_;
+};
+
+#endif /* MHT_H_ */
@@ -0,0 +1,245 @@
+// Monte Carlo consistency harness: takes the ground truth and sensor
+// schedule of a measurement file, draws independent noisy replicas of its
+// measurements (see Scenario::Measure) and runs one UKF per replica, in
+// parallel on all cores, then reports the RMSE, the mean NIS per sensor and
+// the ANEES over all replicas.
+//
+//   ukf_montecarlo [--config <file>] [--threads <n>] [--replicas <n>]
+//                  [--seed <n>] [--noise-scale <s>] [--per-step <file>]
+//                  [input]
+//
+// The measurement noise is the filter's own (std_laspx ... std_radrd from
+// the config) times --noise-scale, so 1 tests a filter whose noise model
+// is right and other values show what a wrong one does. Without an input,
+// the truth comes from a default single-target Scenario. The filters start
+// from initial_covariance 1 unless --config says otherwise, since a zero
+// initial covariance is inconsistent by construction.
+//
+// Every replica has its own random stream, seeded from --seed and its
+// index, and writes only its own slot of the results, so the runs share
+// nothing and the output does not depend on the thread count; the slots
+// are reduced once all have finished. --per-step writes, per measurement,
+// "ts anees lower upper": the NEES averaged over the replicas and the
+// two-sided 95% interval a consistent filter stays within.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "binary_log.h"
+#include "buffered_writer.h"
+#include "log_reader.h"
+#include "scenario.h"
+#include "thread_pool.h"
+#include "tools.h"
+#include "ukf.h"
+
+namespace {
+
+// what one replica leaves behind
+struct Replica {
+  RMSEAccumulator rmse;
+  NEESAccumulator nees;
+  UKF::NisCounter lidar;
+  UKF::NisCounter radar;
+};
+
+// chi-square quantile by the Wilson-Hilferty approximation, close for the
+// hundreds of degrees of freedom of a Monte Carlo mean
+double ChiSquareQuantile(double z, double dof) {
+  const double a = 2.0 / (9.0 * dof);
+  const double t = 1.0 - a + z * std::sqrt(a);
+  return dof * t * t * t;
+}
+
+// runs one replica; nees_row gets the NEES of each measurement, NaN where
+// the covariance was not positive definite
+void RunReplica(const UKFConfig &config, const Scenario::Options &noise,
+                const std::vector<LogRecord> &truth, uint64_t seed,
+                unsigned index, Replica *replica, double *nees_row) {
+  std::seed_seq seq = {static_cast<unsigned>(seed),
+                       static_cast<unsigned>(seed >> 32), index};
+  std::mt19937_64 rng(seq);
+  UKF ukf(config);
+  LogRecord record;
+  for (size_t i = 0; i < truth.size(); i++) {
+    Scenario::Measure(noise, truth[i].meas.sensor_type_,
+                      truth[i].meas.timestamp_, truth[i].ground_truth, &rng,
+                      &record);
+    ukf.ProcessMeasurement(record.meas);
+    const UKF::StateVector &x = ukf.x();
+    const Eigen::Vector4d gt(record.ground_truth);
+    replica->rmse.Add(Eigen::Vector4d(x(0), x(1), cos(x(3)) * x(2),
+                                      sin(x(3)) * x(2)), gt);
+    NEESAccumulator step;
+    step.AddCtrv(x, ukf.P(), gt);
+    nees_row[i] = step.count() ? step.Average() : NAN;
+    replica->nees.Merge(step);
+  }
+  replica->lidar = ukf.nis_counter_lidar_;
+  replica->radar = ukf.nis_counter_radar_;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  const char *input_path = nullptr;
+  const char *per_step_path = nullptr;
+  UKFConfig config;
+  config.initial_covariance = 1;
+  int threads = 0;
+  unsigned replicas = 100;
+  uint64_t seed = 1;
+  double noise_scale = 1.0;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      std::string error;
+      if (!config.Load(argv[++i], &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--replicas") == 0 && i + 1 < argc) {
+      replicas = static_cast<unsigned>(atol(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoull(argv[++i], nullptr, 10);
+    }
+    else if (strcmp(argv[i], "--noise-scale") == 0 && i + 1 < argc) {
+      noise_scale = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--per-step") == 0 && i + 1 < argc) {
+      per_step_path = argv[++i];
+    }
+    else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      std::cerr << "usage: ukf_montecarlo [--config <file>] [--threads <n>] "
+                << "[--replicas <n>] [--seed <n>] [--noise-scale <s>] "
+                << "[--per-step <file>] [input]" << std::endl;
+      return 2;
+    }
+    else {
+      input_path = argv[i];
+    }
+  }
+  if (replicas == 0) {
+    std::cerr << "--replicas must be at least 1" << std::endl;
+    return 2;
+  }
+
+  ThreadPool pool(threads);
+  std::vector<LogRecord> truth;
+  if (!input_path) {
+    std::vector<Scenario::Sample> samples;
+    Scenario::Generate(Scenario::Options(), &samples);
+    for (size_t i = 0; i < samples.size(); i++) {
+      truth.push_back(samples[i].record);
+    }
+  }
+  else if (BinaryLog::IsMeasurementFile(input_path)) {
+    if (!BinaryLog::ReadMeasurements(input_path, &truth)) {
+      std::cerr << "Cannot read " << input_path << std::endl;
+      return 1;
+    }
+  }
+  else if (!LogReader::Load(input_path, &pool, &truth, nullptr)) {
+    std::cerr << "Cannot open " << input_path << std::endl;
+    return 1;
+  }
+
+  Scenario::Options noise;
+  noise.std_laspx = config.std_laspx * noise_scale;
+  noise.std_laspy = config.std_laspy * noise_scale;
+  noise.std_radr = config.std_radr * noise_scale;
+  noise.std_radphi = config.std_radphi * noise_scale;
+  noise.std_radrd = config.std_radrd * noise_scale;
+
+  //one slot per replica, and one row of per-step NEES
+  std::vector<Replica> results(replicas);
+  std::vector<double> nees(static_cast<size_t>(replicas) * truth.size());
+  pool.ParallelFor(0, static_cast<int>(replicas), 1, [&](int begin, int end) {
+    for (int r = begin; r < end; r++) {
+      RunReplica(config, noise, truth, seed, static_cast<unsigned>(r),
+                 &results[r], nees.data() + r * truth.size());
+    }
+  });
+
+  RMSEAccumulator rmse;
+  NEESAccumulator total;
+  UKF::NisCounter lidar = UKF::NisCounter();
+  UKF::NisCounter radar = UKF::NisCounter();
+  for (unsigned r = 0; r < replicas; r++) {
+    rmse.Merge(results[r].rmse);
+    total.Merge(results[r].nees);
+    lidar.updates += results[r].lidar.updates;
+    lidar.exceeded += results[r].lidar.exceeded;
+    lidar.nis_sum += results[r].lidar.nis_sum;
+    radar.updates += results[r].radar.updates;
+    radar.exceeded += results[r].radar.exceeded;
+    radar.nis_sum += results[r].radar.nis_sum;
+  }
+
+  //a consistent filter's NEES averaged over n replicas is chi-square with
+  //4n dof, divided by n
+  const double z = 1.959964;
+  const double lower = ChiSquareQuantile(-z, 4.0 * replicas) / replicas;
+  const double upper = ChiSquareQuantile(z, 4.0 * replicas) / replicas;
+  size_t inside = 0, steps = 0;
+  BufferedWriter per_step;
+  std::string error;
+  if (per_step_path && !per_step.Open(per_step_path, &error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  for (size_t i = 0; i < truth.size(); i++) {
+    double sum = 0.0;
+    unsigned valid = 0;
+    for (unsigned r = 0; r < replicas; r++) {
+      const double value = nees[r * truth.size() + i];
+      if (!std::isnan(value)) {
+        sum += value;
+        ++valid;
+      }
+    }
+    if (valid < replicas) {
+      continue;
+    }
+    const double anees = sum / replicas;
+    ++steps;
+    inside += anees >= lower && anees <= upper;
+    if (per_step_path) {
+      per_step.AppendInteger(truth[i].meas.timestamp_);
+      per_step.Append(' ');
+      per_step.AppendDouble(anees);
+      per_step.Append(' ');
+      per_step.AppendDouble(lower);
+      per_step.Append(' ');
+      per_step.AppendDouble(upper);
+      per_step.Append('\n');
+    }
+  }
+  if (!per_step.Close()) {
+    std::cerr << "Cannot write " << per_step_path << std::endl;
+    return 1;
+  }
+
+  const Eigen::Vector4d RMSE = rmse.RMSE();
+  printf("replicas %u measurements %zu noise scale %.3f\n", replicas,
+         truth.size(), noise_scale);
+  printf("rmse %.10f %.10f %.10f %.10f\n", RMSE(0), RMSE(1), RMSE(2), RMSE(3));
+  printf("nis mean lidar %.3f radar %.3f above 95%% lidar %.3f radar %.3f\n",
+         lidar.Average(), radar.Average(), lidar.ExceededFraction(),
+         radar.ExceededFraction());
+  printf("anees %.3f above 95%% %.3f skipped %lu\n", total.Average(),
+         total.ExceededFraction(), total.skipped());
+  printf("steps within the 95%% anees interval [%.3f, %.3f] %zu/%zu\n", lower,
+         upper, inside, steps);
+  return 0;
+}
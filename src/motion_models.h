@@ -0,0 +1,211 @@
+#ifndef MOTION_MODELS_H_
+#define MOTION_MODELS_H_
+
+#include <cmath>
+#include "fast_math.h"
+
+/**
+ * Motion models for the UKF prediction, as policy classes: each one has a
+ * static, inline Propagate that moves one augmented sigma point
+ * [px, py, v, yaw, yawd, nu_a, nu_yawdd] forward by dt. The sigma-point
+ * kernel is a template over the model, so the model is inlined into the
+ * loop with no virtual call. All models share the 5-dimensional CTRV state.
+ *
+ * PropagateNoiseFree is the same step for a sigma point whose noise entries
+ * are zero, which is all but four of the 15 (see UKF::nu_a_col_): it skips
+ * the noise terms instead of adding zeros, with bit-identical results.
+ *
+ * Linearize gives the Jacobians of PropagateNoiseFree for the EKF step the
+ * filter switches to on near-linear tracks (see UKF::ekf_angle_): F with
+ * respect to the state and G with respect to (nu_a, nu_yawdd), both
+ * row-major. The noise enters both models the same way, through
+ * NoiseJacobian.
+ */
+
+/**
+ * d out / d (nu_a, nu_yawdd) at zero noise, row-major 5x2
+ */
+template <typename Scalar>
+inline void NoiseJacobian(Scalar cos_yaw, Scalar sin_yaw, Scalar dt,
+                          Scalar half_dt2, Scalar *G) {
+  for (int i = 0; i < 10; i++) {
+    G[i] = Scalar(0);
+  }
+  G[0] = half_dt2 * cos_yaw;
+  G[2] = half_dt2 * sin_yaw;
+  G[4] = dt;
+  G[7] = half_dt2;
+  G[9] = dt;
+}
+
+/**
+ * Constant turn rate and velocity
+ */
+struct CTRVModel {
+  /**
+   * @param in Augmented sigma point
+   * @param dt Time step in s
+   * @param half_dt2 0.5 * dt * dt
+   * @param out Predicted state
+   */
+  template <typename Scalar>
+  static inline void Propagate(const Scalar *in, Scalar dt, Scalar half_dt2,
+                               Scalar *out) {
+    const Scalar p_x = in[0];
+    const Scalar p_y = in[1];
+    const Scalar v = in[2];
+    const Scalar yaw = in[3];
+    const Scalar yawd = in[4];
+    const Scalar nu_a = in[5];
+    const Scalar nu_yawdd = in[6];
+
+    //avoid division by zero
+    Scalar px_p, py_p;
+    if (std::fabs(yawd) > 0.001) {
+      px_p = p_x + v / yawd * (KernelMath::Sin(yaw + yawd * dt) -
+                               KernelMath::Sin(yaw));
+      py_p = p_y + v / yawd * (KernelMath::Cos(yaw) -
+                               KernelMath::Cos(yaw + yawd * dt));
+    }
+    else {
+      px_p = p_x + (v * dt * KernelMath::Cos(yaw));
+      py_p = p_y + (v * dt * KernelMath::Sin(yaw));
+    }
+
+    //add noise
+    out[0] = px_p + (half_dt2 * nu_a * KernelMath::Cos(yaw));
+    out[1] = py_p + (half_dt2 * nu_a * KernelMath::Sin(yaw));
+    out[2] = v + nu_a * dt;
+    out[3] = yaw + yawd * dt + (half_dt2 * nu_yawdd);
+    out[4] = yawd + (nu_yawdd * dt);
+  }
+
+  template <typename Scalar>
+  static inline void PropagateNoiseFree(const Scalar *in, Scalar dt,
+                                        Scalar *out) {
+    const Scalar p_x = in[0];
+    const Scalar p_y = in[1];
+    const Scalar v = in[2];
+    const Scalar yaw = in[3];
+    const Scalar yawd = in[4];
+
+    if (std::fabs(yawd) > 0.001) {
+      out[0] = p_x + v / yawd * (KernelMath::Sin(yaw + yawd * dt) -
+                                 KernelMath::Sin(yaw));
+      out[1] = p_y + v / yawd * (KernelMath::Cos(yaw) -
+                                 KernelMath::Cos(yaw + yawd * dt));
+    }
+    else {
+      out[0] = p_x + (v * dt * KernelMath::Cos(yaw));
+      out[1] = p_y + (v * dt * KernelMath::Sin(yaw));
+    }
+    out[2] = v;
+    out[3] = yaw + yawd * dt;
+    out[4] = yawd;
+  }
+
+  /**
+   * @param x State
+   * @param dt Time step in s
+   * @param half_dt2 0.5 * dt * dt
+   * @param F d out / d x, row-major 5x5
+   * @param G d out / d noise, row-major 5x2
+   */
+  template <typename Scalar>
+  static inline void Linearize(const Scalar *x, Scalar dt, Scalar half_dt2,
+                               Scalar *F, Scalar *G) {
+    const Scalar v = x[2];
+    const Scalar yaw = x[3];
+    const Scalar yawd = x[4];
+    Scalar sin_yaw, cos_yaw;
+    KernelMath::SinCos(yaw, &sin_yaw, &cos_yaw);
+
+    for (int i = 0; i < 25; i++) {
+      F[i] = Scalar(i % 6 == 0);
+    }
+    if (std::fabs(yawd) > 0.001) {
+      Scalar sin_end, cos_end;
+      KernelMath::SinCos(yaw + yawd * dt, &sin_end, &cos_end);
+      const Scalar ds = sin_end - sin_yaw;
+      const Scalar dc = cos_yaw - cos_end;
+      const Scalar r = v / yawd;
+      F[2] = ds / yawd;
+      F[3] = -r * dc;
+      F[4] = r * (dt * cos_end - ds / yawd);
+      F[7] = dc / yawd;
+      F[8] = r * ds;
+      F[9] = r * (dt * sin_end - dc / yawd);
+    }
+    else {
+      //the straight branch, with the first-order turn of the exact model
+      //as the yaw rate term
+      F[2] = dt * cos_yaw;
+      F[3] = -v * dt * sin_yaw;
+      F[4] = -v * half_dt2 * sin_yaw;
+      F[7] = dt * sin_yaw;
+      F[8] = v * dt * cos_yaw;
+      F[9] = v * half_dt2 * cos_yaw;
+    }
+    F[19] = dt;
+    NoiseJacobian(cos_yaw, sin_yaw, dt, half_dt2, G);
+  }
+};
+
+/**
+ * Constant velocity: straight-line motion along the heading, which only
+ * changes through the yaw noise. Cheaper than CTRV (no turn branch, two
+ * fewer sines) and steadier for slow or static tracks. The turn rate is
+ * carried as a random walk but does not move the target.
+ */
+struct CVModel {
+  template <typename Scalar>
+  static inline void Propagate(const Scalar *in, Scalar dt, Scalar half_dt2,
+                               Scalar *out) {
+    const Scalar v = in[2];
+    const Scalar yaw = in[3];
+    const Scalar nu_a = in[5];
+    const Scalar nu_yawdd = in[6];
+
+    const Scalar cos_yaw = KernelMath::Cos(yaw);
+    const Scalar sin_yaw = KernelMath::Sin(yaw);
+    const Scalar s = v * dt + half_dt2 * nu_a;
+    out[0] = in[0] + s * cos_yaw;
+    out[1] = in[1] + s * sin_yaw;
+    out[2] = v + nu_a * dt;
+    out[3] = yaw + half_dt2 * nu_yawdd;
+    out[4] = in[4] + nu_yawdd * dt;
+  }
+
+  template <typename Scalar>
+  static inline void PropagateNoiseFree(const Scalar *in, Scalar dt,
+                                        Scalar *out) {
+    const Scalar v = in[2];
+    const Scalar yaw = in[3];
+
+    const Scalar s = v * dt;
+    out[0] = in[0] + s * KernelMath::Cos(yaw);
+    out[1] = in[1] + s * KernelMath::Sin(yaw);
+    out[2] = v;
+    out[3] = yaw;
+    out[4] = in[4];
+  }
+
+  template <typename Scalar>
+  static inline void Linearize(const Scalar *x, Scalar dt, Scalar half_dt2,
+                               Scalar *F, Scalar *G) {
+    const Scalar v = x[2];
+    Scalar sin_yaw, cos_yaw;
+    KernelMath::SinCos(x[3], &sin_yaw, &cos_yaw);
+
+    for (int i = 0; i < 25; i++) {
+      F[i] = Scalar(i % 6 == 0);
+    }
+    F[2] = dt * cos_yaw;
+    F[3] = -v * dt * sin_yaw;
+    F[7] = dt * sin_yaw;
+    F[8] = v * dt * cos_yaw;
+    NoiseJacobian(cos_yaw, sin_yaw, dt, half_dt2, G);
+  }
+};
+
+#endif /* MOTION_MODELS_H_ */
@@ -0,0 +1,140 @@
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Bounded lock-free multi-producer/single-consumer ring.
+ *
+ * Any number of threads may call TryPush; exactly one thread may call
+ * TryPop and TryPopBatch. Every slot carries a sequence number that says
+ * whether it is free for the push of a given round or holds that push's
+ * item: a producer claims the write index with one compare-and-swap, copies
+ * its item and publishes the slot with a release store, so producers only
+ * contend on the index and never wait for each other's copies. The
+ * consumer needs no atomic read-modify-write at all.
+ *
+ * Items come out in the order their slots were claimed. A producer that is
+ * preempted between claiming and publishing holds back the consumer at its
+ * slot until it resumes; later items wait behind it, none is lost. T should
+ * be cheap to copy, e.g. Measurement; slots are allocated once at
+ * construction.
+ */
+template <typename T>
+class MpscQueue {
+public:
+  /**
+   * Constructor
+   * @param capacity Minimum number of slots, rounded up to a power of two
+   */
+  explicit MpscQueue(size_t capacity)
+      : slots_(RoundUp(capacity)), mask_(slots_.size() - 1), head_(0),
+        tail_(0) {
+    for (size_t i = 0; i < slots_.size(); i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Producer side, any thread: appends an item
+   * @return false if the ring is full
+   */
+  bool TryPush(const T &item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[tail & mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      //equal: free for this round; behind: the consumer has not freed it
+      //since the last round; ahead: another producer took it
+      std::ptrdiff_t lag = static_cast<std::ptrdiff_t>(sequence - tail);
+      if (lag == 0) {
+        if (tail_.compare_exchange_weak(tail, tail + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (lag < 0) {
+        return false;
+      }
+      else {
+        tail = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->item = item;
+    slot->sequence.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side: removes the oldest item
+   * @return false if the ring is empty, or its oldest slot is still being
+   * written
+   */
+  bool TryPop(T *item) { return TryPopBatch(item, 1) == 1; }
+
+  /**
+   * Consumer side: removes up to max of the oldest items at once, stopping
+   * at the first slot that is not published yet
+   * @param items Filled with the items in order
+   * @param max Room in items
+   * @return Number of items removed
+   */
+  size_t TryPopBatch(T *items, size_t max) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t count = 0;
+    while (count < max) {
+      Slot &slot = slots_[head & mask_];
+      if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+        break;
+      }
+      items[count++] = slot.item;
+      //free for the push one round later
+      slot.sequence.store(head + mask_ + 1, std::memory_order_release);
+      ++head;
+    }
+    head_.store(head, std::memory_order_relaxed);
+    return count;
+  }
+
+  /**
+   * Number of claimed slots not yet popped; approximate while producers are
+   * running
+   */
+  size_t size() const {
+    return tail_.load(std::memory_order_relaxed) -
+           head_.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T item;
+
+    Slot() : sequence(0), item() {}
+  };
+
+  static size_t RoundUp(size_t capacity) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    return n;
+  }
+
+  std::vector<Slot> slots_;
+  size_t mask_;
+
+  // consumer-owned line: read index
+  char pad0_[64];
+  std::atomic<size_t> head_;
+
+  // producer-shared line: write index
+  char pad1_[64];
+  std::atomic<size_t> tail_;
+  char pad2_[64];
+};
+
+#endif /* MPSC_QUEUE_H_ */
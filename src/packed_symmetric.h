@@ -0,0 +1,62 @@
+#ifndef PACKED_SYMMETRIC_H_
+#define PACKED_SYMMETRIC_H_
+
+/**
+ * Packed storage of a symmetric N x N matrix: the upper triangle row by row,
+ * N (N + 1) / 2 values (15 instead of 25 for the 5-dimensional state).
+ * Used wherever many covariances are stored side by side: UKFBank rows,
+ * TrackRecord and the snapshot format. The same layout holds a lower
+ * triangular factor L as the upper triangle of L^T.
+ */
+template <int N>
+struct PackedSymmetric {
+  static const int kSize = N * (N + 1) / 2;
+
+  /**
+   * Position of element (i, j), either order
+   */
+  static int Index(int i, int j) {
+    if (i > j) {
+      int t = i;
+      i = j;
+      j = t;
+    }
+    return i * N - i * (i - 1) / 2 + (j - i);
+  }
+
+  /**
+   * Packs the upper triangle of a dense matrix
+   * @param m Symmetric matrix
+   * @param out kSize values
+   */
+  template <typename Matrix, typename T>
+  static void Pack(const Matrix &m, T *out) {
+    int k = 0;
+    for (int i = 0; i < N; i++) {
+      for (int j = i; j < N; j++) {
+        out[k++] = static_cast<T>(m(i, j));
+      }
+    }
+  }
+
+  /**
+   * Unpacks into both triangles of a dense matrix
+   * @param in kSize values
+   * @param m Filled in
+   */
+  template <typename T, typename Matrix>
+  static void Unpack(const T *in, Matrix *m) {
+    typedef typename Matrix::Scalar Scalar;
+    int k = 0;
+    for (int i = 0; i < N; i++) {
+      for (int j = i; j < N; j++) {
+        (*m)(i, j) = (*m)(j, i) = static_cast<Scalar>(in[k++]);
+      }
+    }
+  }
+};
+
+template <int N>
+const int PackedSymmetric<N>::kSize;
+
+#endif /* PACKED_SYMMETRIC_H_ */
@@ -0,0 +1,118 @@
+#include "perf_counters.h"
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char *const kEventNames[PerfCounters::kEventCount] = {
+  "cycles", "instructions", "l1d-misses", "llc-misses", "branch-misses"
+};
+
+#ifdef __linux__
+
+struct EventCode {
+  unsigned type;
+  unsigned long long config;
+};
+
+const EventCode kEvents[PerfCounters::kEventCount] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int OpenEvent(const EventCode &code, int group) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = code.type;
+  attr.config = code.config;
+  attr.disabled = group < 0 ? 1 : 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group,
+                                  0));
+}
+
+#endif
+
+}  // namespace
+
+PerfCounters::PerfCounters() : leader_(-1), open_(0) {
+  for (int e = 0; e < kEventCount; e++) {
+    fds_[e] = -1;
+    slot_[e] = -1;
+  }
+#ifdef __linux__
+  for (int e = 0; e < kEventCount; e++) {
+    fds_[e] = OpenEvent(kEvents[e], leader_);
+    if (fds_[e] < 0) {
+      continue;
+    }
+    if (leader_ < 0) {
+      leader_ = fds_[e];
+    }
+    slot_[e] = open_++;
+  }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  for (int e = 0; e < kEventCount; e++) {
+    if (fds_[e] >= 0) {
+      close(fds_[e]);
+    }
+  }
+#endif
+}
+
+void PerfCounters::Start() {
+#ifdef __linux__
+  if (leader_ >= 0) {
+    ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+#endif
+}
+
+void PerfCounters::Stop(Sample *sample) {
+  for (int e = 0; e < kEventCount; e++) {
+    sample->counts[e] = -1.0;
+  }
+#ifdef __linux__
+  if (leader_ < 0) {
+    return;
+  }
+  ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+  //nr, time enabled, time running, then one value per event
+  unsigned long long data[3 + kEventCount];
+  const ssize_t want = sizeof(unsigned long long) * (3 + open_);
+  if (read(leader_, data, sizeof(data)) < want || data[2] == 0) {
+    return;
+  }
+  const double scale = static_cast<double>(data[1]) / data[2];
+  for (int e = 0; e < kEventCount; e++) {
+    if (slot_[e] >= 0) {
+      sample->counts[e] = data[3 + slot_[e]] * scale;
+    }
+  }
+#endif
+}
+
+const char *PerfCounters::Name(Event event) {
+  return kEventNames[event];
+}
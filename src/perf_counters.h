@@ -0,0 +1,63 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+/**
+ * Hardware performance counters of the calling thread, through Linux's
+ * perf_event_open: cycles, instructions, L1 data cache read misses, last
+ * level cache misses and mispredicted branches, counted in user space only
+ * (which perf_event_paranoid 2, the usual default, allows).
+ *
+ * The events are opened as one group so they are scheduled onto the PMU
+ * together; when the kernel has to multiplex them with other users the
+ * counts are scaled by the time the group actually ran. Events the CPU or
+ * the kernel does not offer (a VM without a virtual PMU, say) are left out
+ * and read as -1.
+ */
+class PerfCounters {
+public:
+  enum Event {
+    CYCLES,
+    INSTRUCTIONS,
+    L1D_MISSES,
+    LLC_MISSES,
+    BRANCH_MISSES,
+    kEventCount
+  };
+
+  struct Sample {
+    ///* counts since Start, -1 for an event that is not available
+    double counts[kEventCount];
+  };
+
+  /**
+   * Opens the counters; available() says whether any could be
+   */
+  PerfCounters();
+
+  virtual ~PerfCounters();
+
+  bool available() const { return leader_ >= 0; }
+
+  /**
+   * Zeroes the counters and starts counting
+   */
+  void Start();
+
+  /**
+   * Stops counting and reads the counts since Start
+   * @param sample Counts
+   */
+  void Stop(Sample *sample);
+
+  static const char *Name(Event event);
+
+private:
+  // the first event opened; the others are read through it
+  int leader_;
+  int fds_[kEventCount];
+  ///* position of each open event in the group read, -1 if not open
+  int slot_[kEventCount];
+  int open_;
+};
+
+#endif /* PERF_COUNTERS_H_ */
@@ -0,0 +1,329 @@
+#include "pipeline.h"
+#include <chrono>
+#include <climits>
+#include "cpu_affinity.h"
+#include "logger.h"
+#include "metrics.h"
+#include "realtime.h"
+
+namespace {
+
+// results pushed before the I/O thread is woken up
+const int kBatch = 64;
+
+// idle worker: spin, then yield, then sleep for this long between polls
+const int kSpins = 64;
+const int kYields = 64;
+const int kSleepMicroseconds = 100;
+
+// a delay this far above a session's lowest is taken for a restart of its
+// sensor clock rather than a late measurement
+const long long kClockJumpNs = 1000000000LL;
+
+// real-time violations are logged at most this often
+const long long kViolationReportNs = 1000000000LL;
+
+long long NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool IsMeasurement(const Pipeline::Job &job) {
+  return job.kind == Pipeline::TEXT || job.kind == Pipeline::BINARY;
+}
+
+bool IsLidar(const Pipeline::Job &job) {
+  return IsMeasurement(job) &&
+         job.meas.sensor_type_ == MeasurementPackage::LASER;
+}
+
+}  // namespace
+
+Pipeline::Pipeline(size_t capacity, const std::function<void()> &notify,
+                   const Overload &overload, int cpu)
+    : jobs_(capacity),
+      results_(capacity),
+      notify_(notify),
+      overload_(overload),
+      cpu_(cpu),
+      stop_(false),
+      submitted_(0),
+      completed_(0),
+      input_stalls_(0),
+      output_stalls_(0),
+      dropped_full_(0),
+      dropped_late_(0),
+      coalesced_(0),
+      missed_deadline_(0),
+      deadlines_(overload.mode == DEADLINE ? capacity : 1),
+      holding_(false) {
+  worker_ = std::thread(&Pipeline::Run, this);
+}
+
+Pipeline::~Pipeline() {
+  stop_.store(true);
+  worker_.join();
+}
+
+void Pipeline::Submit(const Job &job,
+                      const std::function<void(const Result &)> &deliver) {
+  Job queued = job;
+  if (overload_.mode != BLOCK) {
+    queued.submitted_ns = NowNs();
+  }
+  if (IsMeasurement(job)) {
+    LatencyTrace::Stamp(&queued.trace, LatencyTrace::QUEUED);
+  }
+  if (!jobs_.TryPush(queued)) {
+    input_stalls_.fetch_add(1, std::memory_order_relaxed);
+
+    //refuse the measurement rather than add to the delay behind it
+    if (overload_.mode != BLOCK && IsMeasurement(job)) {
+      dropped_full_.fetch_add(1, std::memory_order_relaxed);
+      Result result;
+      Skip(job, &result);
+      deliver(result);
+      return;
+    }
+    do {
+      Drain(deliver);
+      std::this_thread::yield();
+    } while (!jobs_.TryPush(queued));
+  }
+  submitted_.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t Pipeline::Drain(const std::function<void(const Result &)> &deliver) {
+  size_t n = 0;
+  Result result;
+  while (results_.TryPop(&result)) {
+    deliver(result);
+    ++n;
+  }
+  completed_.fetch_add(n, std::memory_order_relaxed);
+  return n;
+}
+
+Pipeline::Stats Pipeline::stats() const {
+  Stats s;
+  s.submitted = submitted_.load(std::memory_order_relaxed);
+  s.completed = completed_.load(std::memory_order_relaxed);
+  s.input_stalls = input_stalls_.load(std::memory_order_relaxed);
+  s.output_stalls = output_stalls_.load(std::memory_order_relaxed);
+  s.dropped_full = dropped_full_.load(std::memory_order_relaxed);
+  s.dropped_late = dropped_late_.load(std::memory_order_relaxed);
+  s.coalesced = coalesced_.load(std::memory_order_relaxed);
+  s.missed_deadline = missed_deadline_.load(std::memory_order_relaxed);
+  s.queued = jobs_.size();
+  s.memory_bytes = jobs_.MemoryBytes() + results_.MemoryBytes() +
+                   deadlines_.MemoryBytes();
+  return s;
+}
+
+void Pipeline::Run() {
+  if (cpu_ >= 0 && !CpuAffinity::PinCurrentThread(cpu_)) {
+    UKF_LOG_WARN("Cannot pin pipeline worker to CPU %d", cpu_);
+  }
+  //in real-time mode nothing below may allocate; what does is reported
+  Metrics::AttachThread();
+  Realtime::EnterFilterThread();
+  unsigned long long violations = Realtime::Violations();
+  long long reported_ns = 0;
+  int idle = 0;
+  while (!stop_.load(std::memory_order_relaxed)) {
+    int batch = 0;
+    Job job;
+    while (batch < kBatch && Next(&job)) {
+      Result result;
+      if (IsMeasurement(job)) {
+        LatencyTrace::Stamp(&job.trace, LatencyTrace::STARTED);
+      }
+      if (overload_.mode != BLOCK && (Expired(job, NowNs()) ||
+                                      Superseded(job))) {
+        Skip(job, &result);
+      }
+      else {
+        Process(job, &result);
+      }
+
+      //the I/O thread has fallen behind; wake it and wait for room
+      if (!results_.TryPush(result)) {
+        output_stalls_.fetch_add(1, std::memory_order_relaxed);
+        do {
+          notify_();
+          if (stop_.load(std::memory_order_relaxed)) {
+            Realtime::LeaveFilterThread();
+            return;
+          }
+          std::this_thread::yield();
+        } while (!results_.TryPush(result));
+      }
+      ++batch;
+    }
+
+    if (batch > 0) {
+      notify_();
+      idle = 0;
+      if (Realtime::Violations() != violations &&
+          NowNs() - reported_ns >= kViolationReportNs) {
+        violations = Realtime::Violations();
+        reported_ns = NowNs();
+        UKF_LOG_WARN("Real-time violation: %llu heap allocations on filter "
+                     "threads", violations);
+      }
+    }
+    else if (++idle > kSpins + kYields) {
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(kSleepMicroseconds));
+    }
+    else if (idle > kSpins) {
+      std::this_thread::yield();
+    }
+  }
+  Realtime::LeaveFilterThread();
+}
+
+bool Pipeline::Next(Job *job) {
+  if (overload_.mode != DEADLINE) {
+    return jobs_.TryPop(job);
+  }
+  Job in;
+  while (!holding_ && !deadlines_.full() && jobs_.TryPop(&in)) {
+    if (!IsMeasurement(in)) {
+      held_ = in;
+      holding_ = true;
+      break;
+    }
+    in.deadline_ns = Deadline(in);
+    deadlines_.Push(in.session, in.track_id, in.deadline_ns, in);
+  }
+  if (deadlines_.Pop(job)) {
+    return true;
+  }
+  if (holding_) {
+    *job = held_;
+    holding_ = false;
+    return true;
+  }
+  return false;
+}
+
+long long Pipeline::Deadline(const Job &job) const {
+  //the session's sensor clock in steady-clock terms, from the least
+  //delayed measurement so far
+  long long &offset = job.session->clock_offset_ns_;
+  const long long sample = job.submitted_ns - job.meas.timestamp_ * 1000;
+  if (offset == LLONG_MIN || sample < offset ||
+      sample - offset > kClockJumpNs) {
+    offset = sample;
+  }
+  return job.meas.timestamp_ * 1000 + offset + overload_.max_delay_us * 1000;
+}
+
+bool Pipeline::Expired(const Job &job, long long now_ns) {
+  if (!IsMeasurement(job)) {
+    return false;
+  }
+  if (overload_.mode == DEADLINE) {
+    if (now_ns <= job.deadline_ns) {
+      return false;
+    }
+    missed_deadline_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  long long budget_ns = overload_.max_delay_us * 1000;
+  if (overload_.mode == DROP_LIDAR_FIRST && IsLidar(job)) {
+    budget_ns /= 2;
+  }
+  if (now_ns - job.submitted_ns <= budget_ns) {
+    return false;
+  }
+  dropped_late_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool Pipeline::Superseded(const Job &job) {
+  if (overload_.mode != COALESCE_LIDAR || !IsLidar(job)) {
+    return false;
+  }
+  //only the job right behind: anything else in between would be reordered
+  const Job *next = jobs_.Front();
+  if (!next || !IsLidar(*next) || next->session != job.session ||
+      next->track_id != job.track_id ||
+      next->meas.timestamp_ < job.meas.timestamp_) {
+    return false;
+  }
+  coalesced_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void Pipeline::Skip(const Job &job, Result *result) {
+  result->kind = job.kind;
+  result->session = job.session;
+  result->tag = job.tag;
+  result->track_id = job.track_id;
+  result->timestamp = job.meas.timestamp_;
+  for (int i = 0; i < 4; i++) {
+    result->estimate[i] = 0.0;
+    result->rmse[i] = 0.0;
+    result->window_rmse[i] = 0.0;
+  }
+  result->nis = 0.0;
+  result->nis_exceeded = 0.0;
+  result->dropped = IsMeasurement(job);
+  if (result->dropped) {
+    result->trace = job.trace;
+  }
+}
+
+void Pipeline::Process(const Job &job, Result *result) {
+  Skip(job, result);
+  result->dropped = false;
+  if (job.kind == CLOSE) {
+    return;
+  }
+  if (job.kind == CONFIGURE) {
+    job.session->tracks_.Configure(*job.config);
+    delete job.config;
+    return;
+  }
+  if (job.kind == PUBLISH) {
+    job.session->Publish(NowNs());
+    return;
+  }
+  if (job.kind == CHECKPOINT) {
+    job.session->tracks_.Capture(job.records);
+    return;
+  }
+
+  TrackTable::Track &track = job.session->tracks_.Get(job.track_id);
+  Eigen::Vector4d estimate;
+  LatencyTrace::Enter(&result->trace);
+  if (job.session->evaluate_) {
+    Eigen::Vector4d gt_values(job.ground_truth[0], job.ground_truth[1],
+                              job.ground_truth[2], job.ground_truth[3]);
+    track.Process(job.meas, gt_values, &estimate);
+    if (job.kind == TEXT) {
+      job.session->ground_truth_.push_back(gt_values);
+      job.session->estimations_.push_back(estimate);
+    }
+    Eigen::Vector4d rmse = track.rmse.RMSE();
+    Eigen::Vector4d window_rmse = track.window_rmse.RMSE();
+    for (int i = 0; i < 4; i++) {
+      result->rmse[i] = rmse(i);
+      result->window_rmse[i] = window_rmse(i);
+    }
+  }
+  else {
+    track.Process(job.meas, &estimate);
+  }
+  LatencyTrace::Leave();
+
+  for (int i = 0; i < 4; i++) {
+    result->estimate[i] = estimate(i);
+  }
+  result->nis = track.nis();
+  result->nis_exceeded = track.nis_counter().ExceededFraction();
+  LatencyTrace::Stamp(&result->trace, LatencyTrace::FILTERED);
+  job.session->AccountMemory();
+}
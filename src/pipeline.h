@@ -0,0 +1,238 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include "deadline_queue.h"
+#include "latency_trace.h"
+#include "measurement_package.h"
+#include "session.h"
+#include "spsc_queue.h"
+
+/**
+ * Runs the filters of one event loop on a worker thread, so that a slow
+ * filter step does not stall socket reads.
+ *
+ * The I/O thread submits fixed-size jobs into one SPSC ring; the worker
+ * filters them and pushes results into a second SPSC ring, then calls the
+ * notify function so the I/O thread can Drain them and send the replies.
+ * While a session is in the pipeline its tracks and history are only touched
+ * by the worker.
+ *
+ * A session must not be deleted while jobs for it are in flight: submit a
+ * CLOSE job instead and delete it when the matching CLOSE result comes out.
+ *
+ * Under the default BLOCK policy nothing is lost and a producer that
+ * outruns the worker sees the queueing delay grow without bound. The other
+ * policies keep it bounded by dropping measurement jobs (never CLOSE or
+ * CONFIGURE); every dropped job still comes out as a result with dropped
+ * set, so the I/O thread can tell the client it is behind.
+ */
+class Pipeline {
+public:
+  enum Kind {
+    ///* a measurement from a Socket.IO text frame (track 0)
+    TEXT,
+    ///* a measurement from a binary record
+    BINARY,
+    ///* end of a session; no measurement
+    CLOSE,
+    ///* new settings for the session's tracks; the worker deletes config
+    CONFIGURE,
+    ///* Session::Publish; the session's stream_ is the worker's until the
+    ///* result comes out
+    PUBLISH,
+    ///* TrackTable::Capture into records, which are the worker's until the
+    ///* result comes out
+    CHECKPOINT
+  };
+
+  enum OverloadMode {
+    ///* wait for room in a full job ring (the default)
+    BLOCK,
+    ///* reject a job when the ring is full, and drop queued measurements
+    ///* that waited longer than max_delay_us, oldest first
+    DROP_OLDEST,
+    ///* DROP_OLDEST, but lidar measurements already go at half of
+    ///* max_delay_us: radar carries the range rate and is kept longer
+    DROP_LIDAR_FIRST,
+    ///* DROP_OLDEST, and a lidar measurement is also dropped when the next
+    ///* queued job is a newer lidar measurement of the same track
+    COALESCE_LIDAR,
+    ///* earliest deadline first: the worker takes measurements off the ring
+    ///* into a DeadlineQueue and filters the one due first, each track's
+    ///* still in order. A measurement is due max_delay_us after its sensor
+    ///* timestamp, mapped to the steady clock through the session's lowest
+    ///* observed delay, so one that arrived late is due sooner; one whose
+    ///* deadline has passed is dropped as a miss rather than delaying the
+    ///* fresher ones behind it. Control jobs (CLOSE, CONFIGURE, PUBLISH,
+    ///* CHECKPOINT) wait until everything queued before them is out.
+    ///* Results of different tracks may come out in another order than
+    ///* submitted.
+    DEADLINE
+  };
+
+  struct Overload {
+    OverloadMode mode;
+    ///* longest a measurement may wait in the job ring, in microseconds;
+    ///* under DEADLINE its latency budget from the sensor timestamp
+    long long max_delay_us;
+
+    Overload() : mode(BLOCK), max_delay_us(50000) {}
+  };
+
+  struct Job {
+    Kind kind;
+    Session *session;
+    ///* opaque caller data returned with the result
+    void *tag;
+    unsigned track_id;
+    Measurement meas;
+    double ground_truth[4];
+    ///* CONFIGURE only, owned by the job
+    const UKFConfig *config;
+    ///* CHECKPOINT only, owned by the caller
+    std::vector<FilterSnapshot::Record> *records;
+    ///* steady clock at Submit, in ns; set by the pipeline, only under a
+    ///* dropping policy
+    long long submitted_ns;
+    ///* steady clock the measurement is due by, in ns; set by the worker,
+    ///* only under DEADLINE
+    long long deadline_ns;
+    ///* measurements only: latency stamps from the receive on; the
+    ///* pipeline stamps QUEUED, STARTED and FILTERED and passes them on
+    LatencyTrace::Stamps trace;
+  };
+
+  struct Result {
+    Kind kind;
+    Session *session;
+    void *tag;
+    unsigned track_id;
+    TimeUs timestamp;
+    double estimate[4];
+    ///* zero when the session does not evaluate
+    double rmse[4];
+    ///* RMSE over the track's sliding window; zero without one
+    double window_rmse[4];
+    ///* NIS of the track's update, and the fraction of that sensor's
+    ///* updates above the 95% bound
+    double nis;
+    double nis_exceeded;
+    ///* the measurement was dropped by the overload policy, unfiltered
+    bool dropped;
+    ///* the job's stamps, for the reply's send to record
+    LatencyTrace::Stamps trace;
+  };
+
+  /**
+   * Backpressure counters, readable from any thread
+   */
+  struct Stats {
+    ///* jobs submitted
+    unsigned long long submitted;
+    ///* results handed to the I/O thread
+    unsigned long long completed;
+    ///* times the I/O thread found the job ring full and had to wait
+    unsigned long long input_stalls;
+    ///* times the worker found the result ring full and had to wait
+    unsigned long long output_stalls;
+    ///* measurements dropped because the job ring was full
+    unsigned long long dropped_full;
+    ///* measurements dropped because they waited too long
+    unsigned long long dropped_late;
+    ///* lidar measurements dropped for a newer one of the same track
+    unsigned long long coalesced;
+    ///* measurements dropped under DEADLINE because they were past due
+    unsigned long long missed_deadline;
+    ///* jobs waiting at the time of the call
+    size_t queued;
+    ///* heap bytes of the rings and the deadline queue
+    size_t memory_bytes;
+  };
+
+  /**
+   * Constructor; starts the worker thread
+   * @param capacity Slots in each ring
+   * @param notify Called from the worker whenever results are ready; must
+   * be thread safe (e.g. waking the event loop)
+   * @param overload What to do when jobs come in faster than the worker
+   * filters them
+   * @param cpu CPU the worker pins itself to, or -1 to let it float
+   */
+  Pipeline(size_t capacity, const std::function<void()> &notify,
+           const Overload &overload = Overload(), int cpu = -1);
+
+  /**
+   * Destructor; stops and joins the worker. Jobs still queued are dropped.
+   */
+  virtual ~Pipeline();
+
+  /**
+   * I/O thread: queues a job. When the job ring is full this blocks, draining
+   * results into deliver meanwhile so the worker can make progress; under a
+   * dropping policy a measurement job is delivered as dropped instead.
+   * @param job Job to queue
+   * @param deliver Result handler, as for Drain
+   */
+  void Submit(const Job &job, const std::function<void(const Result &)> &deliver);
+
+  /**
+   * I/O thread: hands every available result to deliver
+   * @return Number of results delivered
+   */
+  size_t Drain(const std::function<void(const Result &)> &deliver);
+
+  Stats stats() const;
+
+  /**
+   * Filters one job on the thread that owns its session, for the worker
+   * and for SessionExecutor's coroutines
+   */
+  static void Process(const Job &job, Result *result);
+
+private:
+  // worker loop
+  void Run();
+
+  // the next job for the worker: the ring's head, or under DEADLINE the
+  // job due first
+  bool Next(Job *job);
+
+  // when a measurement is due under DEADLINE
+  long long Deadline(const Job &job) const;
+
+  // whether the worker should drop a job instead of filtering it
+  bool Expired(const Job &job, long long now_ns);
+  bool Superseded(const Job &job);
+
+  // a result for a job that is not filtered
+  static void Skip(const Job &job, Result *result);
+
+  SpscQueue<Job> jobs_;
+  SpscQueue<Result> results_;
+  std::function<void()> notify_;
+  const Overload overload_;
+  const int cpu_;
+
+  std::atomic<bool> stop_;
+  std::atomic<unsigned long long> submitted_;
+  std::atomic<unsigned long long> completed_;
+  std::atomic<unsigned long long> input_stalls_;
+  std::atomic<unsigned long long> output_stalls_;
+  std::atomic<unsigned long long> dropped_full_;
+  std::atomic<unsigned long long> dropped_late_;
+  std::atomic<unsigned long long> coalesced_;
+  std::atomic<unsigned long long> missed_deadline_;
+
+  // DEADLINE only, worker side: measurements taken off the ring, and a
+  // control job waiting for them to be done
+  DeadlineQueue<Job> deadlines_;
+  Job held_;
+  bool holding_;
+
+  std::thread worker_;
+};
+
+#endif /* PIPELINE_H_ */
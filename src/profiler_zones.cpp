@@ -0,0 +1,19 @@
+#include "profiler_zones.h"
+
+#if defined(UKF_PROFILER_PERFETTO)
+
+PERFETTO_TRACK_EVENT_STATIC_STORAGE();
+
+void StartProfiler() {
+  //traces are recorded by the system tracing service (traced)
+  perfetto::TracingInitArgs args;
+  args.backends = perfetto::kSystemBackend;
+  perfetto::Tracing::Initialize(args);
+  perfetto::TrackEvent::Register();
+}
+
+#else
+
+void StartProfiler() {}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef PROFILER_ZONES_H_
+#define PROFILER_ZONES_H_
+
+/**
+ * Timeline zone markers for an external profiler, chosen at configure time
+ * with UKF_PROFILER (see CMakeLists.txt):
+ *
+ *   UKF_PROFILER_TRACY     Tracy zones (ZoneScopedN); connect the Tracy
+ *                          profiler to the running process
+ *   UKF_PROFILER_ITT       Intel ITT tasks in the "ukf" domain, for VTune
+ *   UKF_PROFILER_PERFETTO  Perfetto track events in the "ukf" category,
+ *                          recorded by the system tracing service
+ *
+ * Without any of them UKF_ZONE compiles to nothing. A zone lasts from the
+ * marker to the end of the enclosing scope; its name must be a string
+ * literal. Unlike UKF_STAGE_TIMER, which folds durations into histograms,
+ * zones keep every occurrence on a per-thread timeline.
+ */
+
+#define UKF_ZONE_CAT2(a, b) a##b
+#define UKF_ZONE_CAT(a, b) UKF_ZONE_CAT2(a, b)
+
+#if defined(UKF_PROFILER_TRACY)
+
+#include <tracy/Tracy.hpp>
+#define UKF_ZONE(name) ZoneScopedN(name)
+
+#elif defined(UKF_PROFILER_ITT)
+
+#include <ittnotify.h>
+
+/**
+ * One ITT task, from construction to destruction
+ */
+class ProfilerZone {
+public:
+  explicit ProfilerZone(__itt_string_handle *name) {
+    __itt_task_begin(Domain(), __itt_null, __itt_null, name);
+  }
+  ~ProfilerZone() { __itt_task_end(Domain()); }
+
+  static __itt_domain *Domain() {
+    static __itt_domain *const domain = __itt_domain_create("ukf");
+    return domain;
+  }
+};
+
+#define UKF_ZONE(name)                                                    \
+  static __itt_string_handle *const UKF_ZONE_CAT(ukf_zone_name_,          \
+                                                 __LINE__) =              \
+      __itt_string_handle_create(name);                                   \
+  ProfilerZone UKF_ZONE_CAT(ukf_zone_, __LINE__)(                         \
+      UKF_ZONE_CAT(ukf_zone_name_, __LINE__))
+
+#elif defined(UKF_PROFILER_PERFETTO)
+
+#include <perfetto.h>
+
+PERFETTO_DEFINE_CATEGORIES(
+    perfetto::Category("ukf").SetDescription("Filter and server stages"));
+
+#define UKF_ZONE(name) TRACE_EVENT("ukf", name)
+
+#else
+
+#define UKF_ZONE(name) do {} while (0)
+
+#endif
+
+/**
+ * Connects to the profiler chosen at configure time; a no-op for Tracy,
+ * ITT and none, which need no set-up. Call once at startup, before any
+ * zone.
+ */
+void StartProfiler();
+
+#endif /* PROFILER_ZONES_H_ */
@@ -0,0 +1,362 @@
+// Python bindings (module pyukf, built with pybind11 when it is found):
+//
+//   import pyukf
+//   log = pyukf.load_log("data/obj_pose-laser-radar-synthetic-input.txt")
+//   run = pyukf.replay(log, {"std_a": 0.8})
+//   run["estimates"], run["rmse"], run["nis"]
+//   bank = pyukf.Bank(1000, {"std_yawdd": 0.5})
+//   bank.add(x, P); bank.predict(0.05); bank.update_lidar(slots, z)
+//   bank.states, bank.covariances
+//
+// Arrays handed to Python are NumPy views over the engine's own buffers,
+// not copies: a log's columns are strided views into its LogRecord array,
+// a replay's estimates into its UKF::Estimate array (both kept alive by the
+// views), and a bank's states and packed covariances are its SoA rows,
+// valid while the Bank lives and changed in place by its updates. Float64
+// and int32 arrays passed in are read where they are, C-contiguous ones
+// without a copy. Loading, replaying and the bank's batch kernels release
+// the GIL.
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "binary_log.h"
+#include "log_reader.h"
+#include "thread_pool.h"
+#include "tools.h"
+#include "ukf.h"
+#include "ukf_bank.h"
+
+namespace py = pybind11;
+
+namespace {
+
+typedef py::array_t<double, py::array::c_style | py::array::forcecast>
+    DoubleArray;
+typedef py::array_t<int, py::array::c_style | py::array::forcecast>
+    IntArray;
+
+// a loaded measurement log, owned by the views over it
+struct Log {
+  std::vector<LogRecord> records;
+  size_t skipped = 0;
+};
+
+// a replay's per-measurement results, owned by the views over it
+struct Run {
+  std::vector<UKF::Estimate> estimates;
+  RMSEAccumulator rmse;
+  UKF::NisCounter lidar = UKF::NisCounter();
+  UKF::NisCounter radar = UKF::NisCounter();
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+// settings from a {name: value} dict over UKFConfig's defaults
+UKFConfig MakeConfig(const std::map<std::string, double> &settings) {
+  UKFConfig config;
+  for (auto it = settings.begin(); it != settings.end(); ++it) {
+    if (!config.Set(it->first, it->second)) {
+      throw py::value_error("unknown UKFConfig setting " + it->first);
+    }
+  }
+  return config;
+}
+
+// a capsule that deletes its object when the last view goes away
+template <typename T>
+py::capsule Owner(T *object) {
+  return py::capsule(object, [](void *p) { delete static_cast<T *>(p); });
+}
+
+// n x columns view of doubles that start at first in each of n records
+// stride bytes apart
+py::array RecordView(const double *first, size_t n, size_t columns,
+                     size_t stride, py::handle base) {
+  if (columns == 1) {
+    return py::array(py::dtype::of<double>(),
+                     {static_cast<py::ssize_t>(n)},
+                     {static_cast<py::ssize_t>(stride)}, first, base);
+  }
+  return py::array(py::dtype::of<double>(),
+                   {static_cast<py::ssize_t>(n),
+                    static_cast<py::ssize_t>(columns)},
+                   {static_cast<py::ssize_t>(stride),
+                    static_cast<py::ssize_t>(sizeof(double))},
+                   first, base);
+}
+
+// read-only, so Python cannot write behind the engine's back
+py::array ReadOnly(py::array array) {
+  array.attr("flags").attr("writeable") = false;
+  return array;
+}
+
+py::dict LogArrays(const Log *log, py::handle base) {
+  const size_t n = log->records.size();
+  const LogRecord *r = log->records.data();
+  py::dict arrays;
+  arrays["timestamp"] = py::array(
+      py::dtype::of<long long>(), {static_cast<py::ssize_t>(n)},
+      {static_cast<py::ssize_t>(sizeof(LogRecord))},
+      n ? &r->meas.timestamp_ : nullptr, base);
+  arrays["sensor"] = py::array(
+      py::dtype::of<int>(), {static_cast<py::ssize_t>(n)},
+      {static_cast<py::ssize_t>(sizeof(LogRecord))},
+      n ? reinterpret_cast<const int *>(&r->meas.sensor_type_) : nullptr,
+      base);
+  arrays["values"] = RecordView(n ? r->meas.values_.data() : nullptr, n, 3,
+                                sizeof(LogRecord), base);
+  arrays["ground_truth"] = RecordView(n ? r->ground_truth : nullptr, n, 4,
+                                      sizeof(LogRecord), base);
+  arrays["skipped"] = log->skipped;
+  return arrays;
+}
+
+static_assert(sizeof(MeasurementPackage::SensorType) == sizeof(int),
+              "sensor views read the enum as int");
+static_assert(sizeof(TimeUs) == sizeof(long long),
+              "timestamp views read TimeUs as long long");
+
+// loads a text or binary log, or the part of it in [start_us, end_us);
+// the returned dict's arrays all share it
+py::dict LoadLog(const std::string &path, int threads, long long start_us,
+                 long long end_us) {
+  std::unique_ptr<Log> log(new Log());
+  bool loaded;
+  {
+    py::gil_scoped_release release;
+    if (BinaryLog::IsMeasurementFile(path.c_str())) {
+      loaded = BinaryLog::ReadMeasurements(path.c_str(), start_us, end_us,
+                                           &log->records);
+    }
+    else {
+      ThreadPool pool(threads);
+      loaded = LogReader::Load(path.c_str(), &pool, &log->records,
+                               &log->skipped);
+      std::vector<LogRecord> &records = log->records;
+      records.erase(std::remove_if(records.begin(), records.end(),
+                                   [&](const LogRecord &r) {
+                                     return r.meas.timestamp_ < start_us ||
+                                            r.meas.timestamp_ >= end_us;
+                                   }),
+                    records.end());
+    }
+  }
+  if (!loaded) {
+    throw py::value_error("cannot read " + path);
+  }
+  py::capsule owner = Owner(log.get());
+  Log *raw = log.release();
+  py::dict arrays = LogArrays(raw, owner);
+  arrays["_log"] = owner;
+  return arrays;
+}
+
+// the Log behind a dict from LoadLog
+const Log *LogOf(const py::dict &log) {
+  if (!log.contains("_log")) {
+    throw py::type_error("expected a log from pyukf.load_log");
+  }
+  return static_cast<const Log *>(
+      log["_log"].cast<py::capsule>().get_pointer());
+}
+
+// filters a whole log on one UKF, as ukf_replay does
+py::dict Replay(const py::dict &log_arrays,
+                const std::map<std::string, double> &settings) {
+  const Log *log = LogOf(log_arrays);
+  const UKFConfig config = MakeConfig(settings);
+  std::unique_ptr<Run> run(new Run());
+  {
+    py::gil_scoped_release release;
+    UKF ukf(config);
+    const size_t n = log->records.size();
+    run->estimates.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      const LogRecord &record = log->records[i];
+      UKF::Estimate &e = run->estimates[i];
+      ukf.ProcessMeasurement(record.meas, &e);
+      run->rmse.Add(Eigen::Vector4d(e.px, e.py, e.vx, e.vy),
+                    Eigen::Vector4d(record.ground_truth));
+    }
+    run->lidar = ukf.nis_counter_lidar_;
+    run->radar = ukf.nis_counter_radar_;
+  }
+
+  const Run *r = run.get();
+  py::capsule owner = Owner(run.release());
+  const size_t n = r->estimates.size();
+  const UKF::Estimate *first = n ? r->estimates.data() : nullptr;
+  py::dict result;
+  result["estimates"] = ReadOnly(RecordView(
+      first ? &first->px : nullptr, n, 4, sizeof(UKF::Estimate), owner));
+  result["variances"] = ReadOnly(RecordView(
+      first ? first->p_diag : nullptr, n, UKF::n_x_, sizeof(UKF::Estimate),
+      owner));
+  result["nis"] = ReadOnly(RecordView(first ? &first->nis : nullptr, n, 1,
+                                      sizeof(UKF::Estimate), owner));
+  const Eigen::Vector4d rmse = r->rmse.RMSE();
+  result["rmse"] = std::vector<double>(rmse.data(), rmse.data() + 4);
+  result["nis_mean_lidar"] = r->lidar.Average();
+  result["nis_mean_radar"] = r->radar.Average();
+  return result;
+}
+
+// a UKFBank with its prototype and, optionally, a pool for its kernels
+class Bank {
+public:
+  Bank(int capacity, const std::map<std::string, double> &settings,
+       int threads, int grain)
+      : prototype_(MakeConfig(settings)), bank_(prototype_, capacity) {
+    if (threads != 1) {
+      pool_.reset(new ThreadPool(threads));
+      bank_.SetThreadPool(pool_.get(), grain);
+    }
+  }
+
+  int Add(DoubleArray x, DoubleArray P) {
+    if (x.size() != UKF::n_x_ || P.size() != UKF::n_x_ * UKF::n_x_) {
+      throw py::value_error("expected a 5-vector and a 5 x 5 matrix");
+    }
+    //row-major P is the same matrix, being symmetric
+    return bank_.Add(
+        Eigen::Map<const Eigen::Matrix<double, UKF::n_x_, 1> >(x.data())
+            .cast<UKF::Scalar>(),
+        Eigen::Map<const Eigen::Matrix<double, UKF::n_x_, UKF::n_x_> >(
+            P.data()).cast<UKF::Scalar>());
+  }
+
+  void Predict(py::object delta_t) {
+    if (py::isinstance<py::float_>(delta_t) ||
+        py::isinstance<py::int_>(delta_t)) {
+      const double dt = delta_t.cast<double>();
+      py::gil_scoped_release release;
+      bank_.Prediction(dt);
+      return;
+    }
+    DoubleArray dt = delta_t.cast<DoubleArray>();
+    if (dt.size() != bank_.size()) {
+      throw py::value_error("expected one time step per track");
+    }
+    py::gil_scoped_release release;
+    bank_.Prediction(dt.data());
+  }
+
+  void UpdateLidar(IntArray tracks, DoubleArray z) {
+    const int count = CheckUpdate(tracks, z, UKF::n_z_lidar_);
+    py::gil_scoped_release release;
+    bank_.UpdateLidar(tracks.data(), z.data(), count);
+  }
+
+  void UpdateRadar(IntArray tracks, DoubleArray z) {
+    const int count = CheckUpdate(tracks, z, UKF::n_z_radar_);
+    py::gil_scoped_release release;
+    bank_.UpdateRadar(tracks.data(), z.data(), count);
+  }
+
+  // n_x x size() view of the state rows
+  static py::array States(py::object self) {
+    const Bank &b = self.cast<const Bank &>();
+    return ReadOnly(Rows(b.bank_.states(), UKF::n_x_, b.bank_, self));
+  }
+
+  // n_p x size() view of the packed covariance rows
+  static py::array Covariances(py::object self) {
+    const Bank &b = self.cast<const Bank &>();
+    return ReadOnly(Rows(b.bank_.covariances(), UKFBank::n_p_, b.bank_,
+                         self));
+  }
+
+  // the last track moves into the removed one's slot
+  void Remove(int slot) {
+    if (slot < 0 || slot >= bank_.size()) {
+      throw py::index_error("track slot out of range");
+    }
+    bank_.Remove(slot);
+  }
+
+  int size() const { return bank_.size(); }
+  int capacity() const { return bank_.capacity(); }
+  void Clear() { bank_.Clear(); }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  UKF prototype_;
+  std::unique_ptr<ThreadPool> pool_;
+  UKFBank bank_;
+
+  static py::array Rows(const double *data, int rows, const UKFBank &bank,
+                        py::handle base) {
+    return py::array(py::dtype::of<double>(),
+                     {static_cast<py::ssize_t>(rows),
+                      static_cast<py::ssize_t>(bank.size())},
+                     {static_cast<py::ssize_t>(bank.capacity() *
+                                               sizeof(double)),
+                      static_cast<py::ssize_t>(sizeof(double))},
+                     data, base);
+  }
+
+  // checks an update's slots and measurements, returns their count
+  int CheckUpdate(const IntArray &tracks, const DoubleArray &z,
+                  int n_z) const {
+    const py::ssize_t count = tracks.size();
+    if (z.size() != count * n_z) {
+      throw py::value_error("expected " + std::to_string(n_z) +
+                            " values per track");
+    }
+    for (py::ssize_t i = 0; i < count; i++) {
+      if (tracks.data()[i] < 0 || tracks.data()[i] >= bank_.size()) {
+        throw py::index_error("track slot out of range");
+      }
+    }
+    return static_cast<int>(count);
+  }
+};
+
+}  // namespace
+
+PYBIND11_MODULE(pyukf, m) {
+  m.doc() = "Unscented Kalman filter engine, with zero-copy NumPy views";
+
+  m.def("load_log", &LoadLog, py::arg("path"), py::arg("threads") = 0,
+        py::arg("start_us") = LLONG_MIN, py::arg("end_us") = LLONG_MAX,
+        "Loads a text or binary measurement log, or its measurements with "
+        "start_us <= timestamp < end_us: timestamp, sensor (0 lidar, 1 "
+        "radar), values (n x 3) and ground_truth (n x 4) views");
+  m.def("replay", &Replay, py::arg("log"),
+        py::arg("config") = std::map<std::string, double>(),
+        "Filters a loaded log: estimates (n x 4), variances (n x 5) and "
+        "nis views, the rmse and the mean NIS per sensor");
+
+  py::class_<Bank>(m, "Bank")
+      .def(py::init<int, const std::map<std::string, double> &, int, int>(),
+           py::arg("capacity"),
+           py::arg("config") = std::map<std::string, double>(),
+           py::arg("threads") = 1, py::arg("grain") = 256)
+      .def("add", &Bank::Add, py::arg("x"), py::arg("P"),
+           "Adds a track; returns its slot, or -1 if the bank is full")
+      .def("predict", &Bank::Predict, py::arg("delta_t"),
+           "Predicts every track by one time step, or by one each")
+      .def("update_lidar", &Bank::UpdateLidar, py::arg("tracks"),
+           py::arg("z"))
+      .def("update_radar", &Bank::UpdateRadar, py::arg("tracks"),
+           py::arg("z"))
+      .def("remove", &Bank::Remove, py::arg("slot"),
+           "Removes a track; the last track moves into its slot")
+      .def("clear", &Bank::Clear)
+      .def_property_readonly("states", &Bank::States,
+                             "n_x x size view of the state rows")
+      .def_property_readonly("covariances", &Bank::Covariances,
+                             "15 x size view of the packed covariances")
+      .def_property_readonly("size", &Bank::size)
+      .def_property_readonly("capacity", &Bank::capacity);
+}
@@ -0,0 +1,169 @@
+#include "radar_clustering.h"
+#include <algorithm>
+#include <cmath>
+#include "angle.h"
+#include "ukf.h"
+
+namespace {
+
+const int kUnvisited = -2;
+const int kNoise = -1;
+
+}  // namespace
+
+RadarClusterer::RadarClusterer(const Options &options)
+    : options_(options),
+      frame_(nullptr),
+      grid_(options.eps > 0.0 ? options.eps : Options().eps) {
+  if (!(options_.eps > 0.0)) {
+    options_.eps = Options().eps;
+  }
+  if (options_.min_points < 1) {
+    options_.min_points = 1;
+  }
+}
+
+RadarClusterer::~RadarClusterer() {}
+
+bool RadarClusterer::Near(size_t a, size_t b) const {
+  const double gap = frame_[radar_[a]].values_[2] -
+                     frame_[radar_[b]].values_[2];
+  return std::fabs(gap) <= options_.max_rate_gap;
+}
+
+void RadarClusterer::Neighbours(size_t i) {
+  neighbours_.clear();
+  grid_.Query(x_[i], y_[i], options_.eps, &neighbours_);
+  //the grid only knows positions; drop those moving differently
+  neighbours_.erase(std::remove_if(neighbours_.begin(), neighbours_.end(),
+                                   [this, i](int j) { return !Near(i, j); }),
+                    neighbours_.end());
+}
+
+void RadarClusterer::Fuse(std::vector<Cluster> *clusters) const {
+  const double n = static_cast<double>(members_.size());
+  double rho = 0.0, rho_dot = 0.0, sin_sum = 0.0, cos_sum = 0.0;
+  TimeUs timestamp = frame_[radar_[members_[0]]].timestamp_;
+  for (size_t k = 0; k < members_.size(); k++) {
+    const Measurement &d = frame_[radar_[members_[k]]];
+    rho += d.values_[0];
+    sin_sum += sin(d.values_[1]);
+    cos_sum += cos(d.values_[1]);
+    rho_dot += d.values_[2];
+    timestamp = std::max(timestamp, d.timestamp_);
+  }
+  rho /= n;
+  rho_dot /= n;
+  const double phi = atan2(sin_sum, cos_sum);
+
+  double spread[3] = {0.0, 0.0, 0.0};
+  for (size_t k = 0; k < members_.size(); k++) {
+    const Measurement &d = frame_[radar_[members_[k]]];
+    const double e[3] = {d.values_[0] - rho,
+                         NormalizeAngle(d.values_[1] - phi),
+                         d.values_[2] - rho_dot};
+    for (int c = 0; c < 3; c++) {
+      spread[c] += e[c] * e[c];
+    }
+  }
+  const double sensor[3] = {options_.std_radr * options_.std_radr,
+                            options_.std_radphi * options_.std_radphi,
+                            options_.std_radrd * options_.std_radrd};
+
+  Cluster cluster;
+  cluster.meas.timestamp_ = timestamp;
+  cluster.meas.sensor_type_ = MeasurementPackage::RADAR;
+  cluster.meas.values_[0] = rho;
+  cluster.meas.values_[1] = phi;
+  cluster.meas.values_[2] = rho_dot;
+  for (int c = 0; c < 3; c++) {
+    cluster.variance[c] = (sensor[c] + spread[c] / n) / n;
+  }
+  cluster.points = static_cast<int>(members_.size());
+  clusters->push_back(cluster);
+}
+
+size_t RadarClusterer::Process(const Measurement *detections, size_t n,
+                               std::vector<Cluster> *clusters) {
+  frame_ = detections;
+  grid_.Clear();
+  radar_.clear();
+  x_.clear();
+  y_.clear();
+  for (size_t i = 0; i < n; i++) {
+    if (detections[i].sensor_type_ != MeasurementPackage::RADAR) {
+      continue;
+    }
+    const double rho = detections[i].values_[0];
+    const double phi = detections[i].values_[1];
+    x_.push_back(rho * cos(phi));
+    y_.push_back(rho * sin(phi));
+    grid_.Update(static_cast<int>(radar_.size()), x_.back(), y_.back());
+    radar_.push_back(i);
+  }
+
+  const size_t m = radar_.size();
+  const size_t min_points = static_cast<size_t>(options_.min_points);
+  const size_t first = clusters->size();
+  label_.assign(m, kUnvisited);
+  int next = 0;
+  for (size_t i = 0; i < m; i++) {
+    if (label_[i] != kUnvisited) {
+      continue;
+    }
+    Neighbours(i);
+    if (neighbours_.size() < min_points) {
+      label_[i] = kNoise;
+      continue;
+    }
+
+    //grow the cluster through its core points; border points join the
+    //first cluster that reaches them
+    const int c = next++;
+    label_[i] = c;
+    members_.assign(1, static_cast<int>(i));
+    frontier_.assign(neighbours_.begin(), neighbours_.end());
+    while (!frontier_.empty()) {
+      const int k = frontier_.back();
+      frontier_.pop_back();
+      if (label_[k] == kNoise) {
+        label_[k] = c;
+        members_.push_back(k);
+        continue;
+      }
+      if (label_[k] != kUnvisited) {
+        continue;
+      }
+      label_[k] = c;
+      members_.push_back(k);
+      Neighbours(k);
+      if (neighbours_.size() >= min_points) {
+        frontier_.insert(frontier_.end(), neighbours_.begin(),
+                         neighbours_.end());
+      }
+    }
+    //sum in detection order, so the result does not depend on the walk
+    std::sort(members_.begin(), members_.end());
+    Fuse(clusters);
+  }
+
+  if (!options_.drop_noise) {
+    for (size_t i = 0; i < m; i++) {
+      if (label_[i] == kNoise) {
+        members_.assign(1, static_cast<int>(i));
+        Fuse(clusters);
+      }
+    }
+  }
+  frame_ = nullptr;
+  return clusters->size() - first;
+}
+
+void RadarClusterer::Update(const Cluster &cluster, UKF *ukf) {
+  const UKF::RadarVector noise = ukf->radar_noise_;
+  for (int c = 0; c < UKF::n_z_radar_; c++) {
+    ukf->radar_noise_(c) = static_cast<UKF::Scalar>(cluster.variance[c]);
+  }
+  ukf->ProcessMeasurement(cluster.meas);
+  ukf->radar_noise_ = noise;
+}
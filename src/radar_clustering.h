@@ -0,0 +1,120 @@
+#ifndef RADAR_CLUSTERING_H_
+#define RADAR_CLUSTERING_H_
+
+#include <cstddef>
+#include <vector>
+#include "measurement_package.h"
+#include "spatial_grid.h"
+
+class UKF;
+
+/**
+ * Radar front-end: groups the raw detections of one radar frame with
+ * DBSCAN and emits one RADAR measurement per object, so each object costs
+ * one UpdateRadar per frame instead of one per detection.
+ *
+ * Detections are neighbours when their Cartesian positions are within eps
+ * of each other and their range rates within max_rate_gap, which keeps
+ * apart objects that pass close to each other at different speeds. A
+ * detection with at least min_points neighbours (itself included) is a
+ * core point, and a cluster is everything reachable from a core point
+ * through core points. The neighbour queries go through a SpatialGrid of
+ * eps cells, so a frame of n detections costs O(n * nearby) rather than
+ * O(n^2).
+ *
+ * The fused measurement is the mean range, the circular mean bearing and
+ * the mean range rate of the cluster. Its variances are those of a mean
+ * of independent samples whose scatter is the sensor noise plus the
+ * spread of the cluster's detections: (sensor variance + sample variance)
+ * / n per component. Detections in no cluster are passed through on their
+ * own, with the sensor's variances, unless drop_noise is set.
+ */
+class RadarClusterer {
+public:
+  struct Options {
+    ///* neighbourhood radius in m
+    double eps;
+    ///* largest range rate difference between neighbours, in m/s
+    double max_rate_gap;
+    ///* neighbours, itself included, that make a detection a core point
+    int min_points;
+    ///* drop detections that are in no cluster instead of passing them on
+    bool drop_noise;
+    ///* sensor noise standard deviations, as in UKFConfig
+    double std_radr;
+    double std_radphi;
+    double std_radrd;
+
+    Options()
+        : eps(1.5),
+          max_rate_gap(1.0),
+          min_points(2),
+          drop_noise(false),
+          std_radr(0.3),
+          std_radphi(0.03),
+          std_radrd(0.3) {}
+  };
+
+  struct Cluster {
+    ///* the fused RADAR measurement
+    Measurement meas;
+    ///* its noise variances: rho, phi, rho_dot
+    double variance[3];
+    ///* detections fused
+    int points;
+  };
+
+  explicit RadarClusterer(const Options &options = Options());
+
+  virtual ~RadarClusterer();
+
+  /**
+   * Clusters one frame
+   * @param detections Raw detections; only RADAR ones are used
+   * @param n Number of detections
+   * @param clusters One fused measurement per object (appended): the
+   * clusters in the order of their first core detection, then the
+   * detections in no cluster, in input order
+   * @return Number of clusters appended
+   */
+  size_t Process(const Measurement *detections, size_t n,
+                 std::vector<Cluster> *clusters);
+
+  /**
+   * Filters a fused measurement with its own noise: the filter's radar
+   * noise is swapped for the cluster's for the one update (a later
+   * out-of-sequence replay of it uses the filter's own)
+   * @param cluster Cluster from Process
+   * @param ukf Filter to update
+   */
+  static void Update(const Cluster &cluster, UKF *ukf);
+
+  const Options &options() const { return options_; }
+
+private:
+  // true if detections a and b are neighbours
+  bool Near(size_t a, size_t b) const;
+
+  // neighbours of detection i, itself included, into neighbours_
+  void Neighbours(size_t i);
+
+  // appends the fused measurement of the detections in members_
+  void Fuse(std::vector<Cluster> *clusters) const;
+
+  Options options_;
+  ///* the frame being clustered
+  const Measurement *frame_;
+
+  // workspace, kept between frames
+  SpatialGrid grid_;
+  ///* index in the frame of each radar detection
+  std::vector<size_t> radar_;
+  std::vector<double> x_;
+  std::vector<double> y_;
+  std::vector<int> label_;
+  std::vector<int> neighbours_;
+  std::vector<int> frontier_;
+  std::vector<int> members_;
+};
+
+#endif /* RADAR_CLUSTERING_H_ */
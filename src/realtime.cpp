@@ -0,0 +1,82 @@
+#include "realtime.h"
+#include <alloca.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "alloc_counter.h"
+#include "logger.h"
+
+namespace {
+
+bool g_active = false;
+Realtime::Options g_options;
+
+// writes one byte per page so every page is faulted in now
+void Touch(volatile char *p, size_t bytes) {
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  for (size_t i = 0; i < bytes; i += page) {
+    p[i] = 0;
+  }
+}
+
+}  // namespace
+
+bool Realtime::Lock(const Options &options, std::string *error) {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    //usually RLIMIT_MEMLOCK; CAP_IPC_LOCK or a higher limit is needed
+    *error = std::string("mlockall: ") + strerror(errno);
+    return false;
+  }
+  //freed memory stays in the heap, and large blocks come from it rather
+  //than from mmap, so a free never costs a later page fault
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+  if (options.heap_reserve > 0) {
+    char *reserve = static_cast<char *>(malloc(options.heap_reserve));
+    if (reserve) {
+      Touch(reserve, options.heap_reserve);
+      free(reserve);
+    }
+  }
+  if (!AllocCounter::Enabled()) {
+    UKF_LOG_WARN("Real-time mode without UKF_COUNT_ALLOCATIONS: heap "
+                 "allocations on filter threads are not reported");
+  }
+  g_options = options;
+  g_active = true;
+  return true;
+}
+
+bool Realtime::active() { return g_active; }
+
+void Realtime::EnterFilterThread() {
+  if (!g_active) {
+    return;
+  }
+  Touch(static_cast<volatile char *>(alloca(g_options.stack_reserve)),
+        g_options.stack_reserve);
+  if (g_options.priority > 0) {
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = g_options.priority;
+    const int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (rc != 0) {
+      UKF_LOG_WARN("Cannot run filter thread at SCHED_FIFO %d: %s",
+                   g_options.priority, strerror(rc));
+    }
+  }
+  AllocCounter::Forbid(true);
+}
+
+void Realtime::LeaveFilterThread() {
+  AllocCounter::Forbid(false);
+}
+
+unsigned long long Realtime::Violations() {
+  return AllocCounter::ForbiddenCount();
+}
@@ -0,0 +1,67 @@
+#ifndef REALTIME_H_
+#define REALTIME_H_
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Real-time operating mode, for deployments that need a bounded worst-case
+ * latency rather than the best average.
+ *
+ * At startup Lock keeps every page the process has and will map resident
+ * (mlockall), stops glibc from handing freed memory back to the kernel or
+ * serving large blocks from fresh mappings, and pre-faults a heap reserve
+ * for the pools built during setup. Each filter thread then calls
+ * EnterFilterThread: its stack is pre-faulted, it may move to SCHED_FIFO,
+ * and from then on every heap allocation it makes is a violation. Throwing
+ * allocates the exception object on the heap, so exceptions are caught by
+ * the same check.
+ *
+ * Violations are only seen through the allocation hook, i.e. in builds
+ * with UKF_COUNT_ALLOCATIONS; otherwise Violations() stays 0 and Lock logs
+ * that nothing is checked.
+ */
+class Realtime {
+public:
+  struct Options {
+    Options()
+        : heap_reserve(64 << 20), stack_reserve(256 << 10), priority(0) {}
+
+    ///* heap bytes pre-faulted by Lock
+    size_t heap_reserve;
+    ///* stack bytes pre-faulted by each filter thread
+    size_t stack_reserve;
+    ///* SCHED_FIFO priority of the filter threads; 0 keeps the default
+    ///* scheduler
+    int priority;
+  };
+
+  /**
+   * Enters real-time mode for the whole process; call once, before the
+   * filter threads start
+   * @param options Reserves and priority
+   * @param error Set to a description on failure
+   * @return false if memory could not be locked
+   */
+  static bool Lock(const Options &options, std::string *error);
+
+  ///* whether Lock succeeded
+  static bool active();
+
+  /**
+   * Filter thread, once its setup is done: pre-faults its stack, applies
+   * the priority, and counts its heap allocations as violations from now
+   * on. Does nothing unless active().
+   */
+  static void EnterFilterThread();
+
+  /**
+   * Filter thread, on its way out: allocations are allowed again
+   */
+  static void LeaveFilterThread();
+
+  ///* heap allocations made by filter threads since they entered
+  static unsigned long long Violations();
+};
+
+#endif /* REALTIME_H_ */
@@ -0,0 +1,86 @@
+#include "region_index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+RegionIndex::Region RegionIndex::Region::Box(double x0, double y0,
+                                             double x1, double y1) {
+  Region box = Region();
+  box.circle = false;
+  box.x0 = std::min(x0, x1);
+  box.y0 = std::min(y0, y1);
+  box.x1 = std::max(x0, x1);
+  box.y1 = std::max(y0, y1);
+  return box;
+}
+
+RegionIndex::Region RegionIndex::Region::Circle(double x, double y,
+                                                double r) {
+  Region circle = Region();
+  circle.circle = true;
+  circle.x0 = circle.x1 = x;
+  circle.y0 = circle.y1 = y;
+  circle.r = r;
+  return circle;
+}
+
+bool RegionIndex::Region::Parse(const std::string &spec, Region *region) {
+  double a, b, c, d;
+  char end;
+  if (sscanf(spec.c_str(), "box=%lf,%lf,%lf,%lf%c", &a, &b, &c, &d,
+             &end) == 4) {
+    *region = Box(a, b, c, d);
+    return true;
+  }
+  if (sscanf(spec.c_str(), "circle=%lf,%lf,%lf%c", &a, &b, &c, &end) == 3 &&
+      c >= 0.0) {
+    *region = Circle(a, b, c);
+    return true;
+  }
+  return false;
+}
+
+RegionIndex::RegionIndex(double cell_size) : grid_(cell_size) {}
+
+void RegionIndex::Clear() {
+  grid_.Clear();
+  entries_.clear();
+}
+
+void RegionIndex::Add(uint64_t session, const TrackView &view) {
+  view.ForEach([this, session](const TrackView::Track &track) {
+    //the CTRV state as position and velocity
+    const double v = track.x[2];
+    const double yaw = track.x[3];
+    Entry entry = {session, track.id, track.timestamp,
+                   {track.x[0], track.x[1], v * std::cos(yaw),
+                    v * std::sin(yaw)}};
+    Add(entry);
+  });
+}
+
+void RegionIndex::Add(const Entry &entry) {
+  const int i = static_cast<int>(entries_.size());
+  entries_.push_back(entry);
+  grid_.Update(i, entry.estimate[0], entry.estimate[1]);
+}
+
+void RegionIndex::Query(const Region &region, std::vector<int> *hits) const {
+  //the grid answers discs; a box is searched by its circumscribed one
+  double x = region.x0;
+  double y = region.y0;
+  double radius = region.r;
+  if (!region.circle) {
+    x = 0.5 * (region.x0 + region.x1);
+    y = 0.5 * (region.y0 + region.y1);
+    radius = 0.5 * std::hypot(region.x1 - region.x0, region.y1 - region.y0);
+  }
+  candidates_.clear();
+  grid_.Query(x, y, radius, &candidates_);
+  for (size_t k = 0; k < candidates_.size(); k++) {
+    const Entry &entry = entries_[candidates_[k]];
+    if (region.Contains(entry.estimate[0], entry.estimate[1])) {
+      hits->push_back(candidates_[k]);
+    }
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef REGION_INDEX_H_
+#define REGION_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "spatial_grid.h"
+#include "time_base.h"
+#include "track_view.h"
+
+/**
+ * Every live track of a hub's sessions on a SpatialGrid, for region
+ * queries that return only the tracks in a box or disc instead of the
+ * whole table.
+ *
+ * The index is a copy: Add reads a session's TrackView, which any thread
+ * may do while the filter threads keep publishing, so a hub rebuilds it on
+ * its own thread (Clear, then Add per session) and answers any number of
+ * queries from the copy until the next rebuild. The grid keeps its cells
+ * across rebuilds, so rebuilding allocates nothing once it has seen the
+ * largest table.
+ */
+class RegionIndex {
+public:
+  /**
+   * A box (x0, y0)-(x1, y1), or a disc of radius r around (x0, y0)
+   */
+  struct Region {
+    bool circle;
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+    double r;
+
+    bool Contains(double x, double y) const {
+      if (circle) {
+        return (x - x0) * (x - x0) + (y - y0) * (y - y0) <= r * r;
+      }
+      return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+    }
+
+    /**
+     * @param x0 One corner, in either order with the other
+     */
+    static Region Box(double x0, double y0, double x1, double y1);
+    static Region Circle(double x, double y, double r);
+
+    /**
+     * Parses "box=x0,y0,x1,y1" (corners in either order) or
+     * "circle=x,y,r"
+     * @return false for anything else
+     */
+    static bool Parse(const std::string &spec, Region *region);
+  };
+
+  ///* one track as indexed; estimate is x, y, vx, vy at timestamp
+  struct Entry {
+    uint64_t session;
+    unsigned id;
+    TimeUs timestamp;
+    double estimate[4];
+  };
+
+  /**
+   * @param cell_size Grid cell edge in m, near the usual query size
+   */
+  explicit RegionIndex(double cell_size);
+
+  /**
+   * Empties the index for a rebuild
+   */
+  void Clear();
+
+  /**
+   * Indexes the live tracks of one session
+   * @param session Session id the entries are labelled with
+   * @param view The session's published tracks
+   */
+  void Add(uint64_t session, const TrackView &view);
+
+  /**
+   * Indexes one track, e.g. of an estimate already predicted to a publish
+   * time
+   */
+  void Add(const Entry &entry);
+
+  /**
+   * Appends the entries of the tracks inside a region
+   * @param region Region
+   * @param hits Indices for entry(), appended to
+   */
+  void Query(const Region &region, std::vector<int> *hits) const;
+
+  const Entry &entry(int i) const { return entries_[i]; }
+  size_t size() const { return entries_.size(); }
+
+private:
+  SpatialGrid grid_;
+  std::vector<Entry> entries_;
+  ///* grid candidates of the last query
+  mutable std::vector<int> candidates_;
+};
+
+#endif /* REGION_INDEX_H_ */
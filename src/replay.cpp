@@ -0,0 +1,813 @@
+// Offline driver: runs the UKF over a file of measurement lines, in the
+// same "L px py ts gt..." / "R rho phi rho_dot ts gt..." format the
+// simulator sends, as fast as possible and without a GUI in the loop.
+//
+//   ukf_replay [--config <file>] [--sqrt] [--threads <n>] [--estimates <file>]
+//              [--steps <file>] [--outputs <file>] [--stages] [--oosm <depth>]
+//              [--max-step <s>] [--fused] [--imm <std_a,std_a,...>]
+//              [--compare <estimates>] [--digest <file>]
+//              [--max-rmse <px,py,vx,vy>|rubric] [--tolerance <t>]
+//              [--expect-digest <hex>] [--range <from_us,to_us>]
+//              [--arrow <file>] [input...]
+//
+// Filter settings come from --config (see UKFConfig); the other flags
+// override it. Reads stdin when no input file is given. Text input files are memory
+// mapped and parsed on --threads threads (default: one per core) into one
+// array, which then feeds the filter in order; binary measurement files
+// (see BinaryLog, and ukf_log_convert) are loaded directly. Prints the final
+// RMSE, how often the NIS exceeded its 95% bound, the mean NIS per sensor
+// and the NEES of the estimates against the ground truth (see
+// NEESAccumulator). With --estimates, writes "ts px py vx vy" per
+// measurement to the given file; --steps adds the RMSE so far and the NIS
+// to each line. Text outputs go through BufferedWriter,
+// so writing them costs little of the run. With --outputs, writes state,
+// covariance diagonal and NIS as a binary output file; --arrow writes the
+// same per measurement, with its sensor and velocity components, as an
+// Apache Arrow IPC file (see ArrowEstimateLog) for pandas or polars to
+// load instead of parsing --estimates text. With --stages, also
+// prints the per-stage latency histograms (only filled in builds with
+// UKF_STAGE_TIMING). With --oosm,
+// measurements that arrive out of order are fused by rolling back over the
+// last <depth> measurements (see UKF::SetHistoryDepth). With --max-step,
+// gaps longer than <s> seconds are predicted in sub-steps. With --fused,
+// radar and lidar measurements with the same timestamp are fused in one
+// stacked update (see UKF::ProcessMeasurementGroup). With --imm, an IMM
+// over one CTRV model per listed std_a replaces the single filter (see
+// IMM); --oosm and --fused do not apply to it, and the final model
+// probabilities are printed. With --compare, the estimates are checked
+// against an --estimates file from another run, e.g. ukf_replay_float (the
+// UKF_SINGLE_PRECISION build) against ukf_replay, and the RMS and largest
+// differences are printed. With --digest, writes "ts digest" per measurement,
+// an FNV-1a hash of the bits of the state and covariance after it, and
+// prints a digest of the whole run: bit-exact regression output for telling
+// which changes (SIMD, threading, float builds) move the numbers. Build with
+// UKF_DETERMINISTIC so the compiler does not contract a*b+c differently.
+// With --save-snapshot, the final posterior is written as a FilterSnapshot;
+// --load-snapshot restores one and resumes after the measurements it covers,
+// a warm restart that should continue the cold run's estimates. With
+// --smooth, the run is also smoothed with RtsSmoother, the smoothed
+// estimates written to the file and their RMSE printed; --smooth-lag <n>
+// limits each estimate to n steps of later measurements. With --range, only
+// the measurements with from_us <= timestamp < to_us are replayed; a binary
+// input is read through its time index, so only the part of the file
+// around the range is read.
+//
+// The last three flags turn a run into a regression check that exits with
+// status 3 if it fails: --max-rmse bounds the final RMSE ("rubric" is the
+// project's 0.09, 0.10, 0.40, 0.30), --tolerance bounds the largest
+// --compare difference from a golden estimates file, and --expect-digest
+// requires a bit-exact run.
+//
+// Several inputs are replayed in parallel instead, one filter per file and
+// the files spread over --threads threads, each file parsed on the thread
+// that filters it. A line per file gives its RMSE and NIS counts, then the
+// merged statistics of all files follow (the RMSE over every measurement);
+// --max-rmse applies to the merged RMSE. Only filter settings and --fused
+// apply in this mode.
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include "arrow_writer.h"
+#include "binary_log.h"
+#include "buffered_writer.h"
+#include "filter_snapshot.h"
+#include "frame_arena.h"
+#include "imm.h"
+#include "log_reader.h"
+#include "profiler_zones.h"
+#include "rts_smoother.h"
+#include "stage_timing.h"
+#include "thread_pool.h"
+#include "tools.h"
+#include "ukf.h"
+
+namespace {
+
+// one line of an --estimates file
+struct Estimate {
+  long long timestamp;
+  double values[4];
+};
+
+bool LoadEstimates(const char *path, std::vector<Estimate> *out) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return false;
+  }
+  Estimate e;
+  while (fscanf(f, "%lld %lf %lf %lf %lf", &e.timestamp, &e.values[0],
+                &e.values[1], &e.values[2], &e.values[3]) == 5) {
+    out->push_back(e);
+  }
+  fclose(f);
+  return true;
+}
+
+// writes one line of an --estimates file
+void WriteEstimate(long long timestamp, const Eigen::Vector4d &estimate,
+                   BufferedWriter *out) {
+  out->AppendInteger(timestamp);
+  for (int k = 0; k < 4; k++) {
+    out->Append(' ');
+    out->AppendDouble(estimate(k));
+  }
+  out->Append('\n');
+}
+
+// appends the comma separated numbers in text to out
+void ParseList(const char *text, std::vector<double> *out) {
+  for (const char *p = text; *p; ) {
+    char *end;
+    out->push_back(strtod(p, &end));
+    if (end == p) break;
+    p = *end == ',' ? end + 1 : end;
+  }
+}
+
+// prints the RMS and largest differences of px, py, vx, vy; false if any
+// estimate is unmatched or differs by more than tolerance (when >= 0)
+bool CompareEstimates(const std::vector<Estimate> &run,
+                      const std::vector<Estimate> &reference,
+                      double tolerance) {
+  size_t n = std::min(run.size(), reference.size());
+  double sum[4] = {0.0, 0.0, 0.0, 0.0};
+  double max[4] = {0.0, 0.0, 0.0, 0.0};
+  size_t mismatched = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (run[i].timestamp != reference[i].timestamp) {
+      ++mismatched;
+      continue;
+    }
+    for (int k = 0; k < 4; k++) {
+      double d = fabs(run[i].values[k] - reference[i].values[k]);
+      sum[k] += d * d;
+      max[k] = std::max(max[k], d);
+    }
+  }
+  size_t compared = n - mismatched;
+  size_t unmatched = mismatched + std::max(run.size(), reference.size()) - n;
+  printf("compared %zu estimates, %zu unmatched\n", compared, unmatched);
+  for (int k = 0; k < 4; k++) {
+    sum[k] = compared ? sqrt(sum[k] / compared) : 0.0;
+  }
+  printf("difference rms %.3g %.3g %.3g %.3g max %.3g %.3g %.3g %.3g\n",
+         sum[0], sum[1], sum[2], sum[3], max[0], max[1], max[2], max[3]);
+  if (tolerance < 0.0) {
+    return true;
+  }
+  double worst = *std::max_element(max, max + 4);
+  if (unmatched > 0 || worst > tolerance) {
+    printf("FAIL estimates differ by up to %.3g (tolerance %.3g), "
+           "%zu unmatched\n", worst, tolerance, unmatched);
+    return false;
+  }
+  return true;
+}
+
+// prints a FAIL line per component above its bound; false if any is
+bool WithinRmse(const Eigen::Vector4d &RMSE,
+                const std::vector<double> &max_rmse) {
+  bool passed = true;
+  for (int k = 0; k < 4; k++) {
+    if (!(RMSE(k) <= max_rmse[k])) {
+      printf("FAIL rmse[%d] %.4f above %.4f\n", k, RMSE(k), max_rmse[k]);
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+// prints the mean NIS per sensor and the NEES against the ground truth
+void PrintConsistency(const UKF::NisCounter &lidar,
+                      const UKF::NisCounter &radar,
+                      const NEESAccumulator &nees) {
+  printf("nis mean lidar %.3f radar %.3f\n", lidar.Average(),
+         radar.Average());
+  printf("nees mean %.3f above 95%% %lu/%lu skipped %lu\n", nees.Average(),
+         nees.exceeded(), nees.count(), nees.skipped());
+}
+
+// what one file of a multi-file run leaves behind
+struct FileResult {
+  bool loaded;
+  size_t measurements;
+  size_t skipped;
+  RMSEAccumulator rmse;
+  NEESAccumulator nees;
+  UKF::NisCounter lidar;
+  UKF::NisCounter radar;
+  unsigned long long covariance_repairs;
+};
+
+// runs one filter over one file; the parse stays on the calling thread,
+// which is already one of many
+void ReplayFile(const char *path, const UKFConfig &config, bool fused,
+                FileResult *result) {
+  std::vector<LogRecord> records;
+  result->skipped = 0;
+  result->loaded = BinaryLog::IsMeasurementFile(path)
+      ? BinaryLog::ReadMeasurements(path, &records)
+      : LogReader::Load(path, nullptr, &records, &result->skipped);
+  result->measurements = records.size();
+
+  UKF ukf(config);
+  FrameArena arena;
+  for (size_t i = 0; i < records.size(); ) {
+    size_t count = 1;
+    while (fused && i + count < records.size() &&
+           records[i + count].meas.timestamp_ == records[i].meas.timestamp_) {
+      ++count;
+    }
+    if (count == 1) {
+      ukf.ProcessMeasurement(records[i].meas);
+    }
+    else {
+      arena.Reset();
+      Measurement *group = arena.AllocateArray<Measurement>(count);
+      for (size_t j = 0; j < count; j++) {
+        group[j] = records[i + j].meas;
+      }
+      ukf.ProcessMeasurementGroup(group, count);
+    }
+    const UKF::StateVector &x = ukf.x();
+    Eigen::Vector4d estimate(x(0), x(1), cos(x(3)) * x(2), sin(x(3)) * x(2));
+    for (size_t j = i; j < i + count; j++) {
+      const Eigen::Vector4d truth(records[j].ground_truth);
+      result->rmse.Add(estimate, truth);
+      result->nees.AddCtrv(x, ukf.P(), truth);
+    }
+    i += count;
+  }
+  result->lidar = ukf.nis_counter_lidar_;
+  result->radar = ukf.nis_counter_radar_;
+  result->covariance_repairs = ukf.covariance_repairs_;
+}
+
+// replays each file with its own filter, the files spread over the pool,
+// and prints a line per file and the merged statistics; returns the exit
+// status
+int ReplayFiles(const std::vector<const char *> &paths,
+                const UKFConfig &config, bool fused, ThreadPool *pool,
+                const std::vector<double> &max_rmse) {
+  std::vector<FileResult> results(paths.size());
+  pool->ParallelFor(0, static_cast<int>(paths.size()), 1,
+                    [&](int begin, int end) {
+    for (int f = begin; f < end; f++) {
+      ReplayFile(paths[f], config, fused, &results[f]);
+    }
+  });
+
+  RMSEAccumulator rmse;
+  NEESAccumulator nees;
+  UKF::NisCounter lidar = UKF::NisCounter();
+  UKF::NisCounter radar = UKF::NisCounter();
+  size_t measurements = 0, skipped = 0, failed = 0;
+  unsigned long long repairs = 0;
+  for (size_t f = 0; f < paths.size(); f++) {
+    const FileResult &result = results[f];
+    if (!result.loaded) {
+      printf("%s: cannot read\n", paths[f]);
+      ++failed;
+      continue;
+    }
+    const Eigen::Vector4d r = result.rmse.RMSE();
+    printf("%s: measurements %zu rmse %.10f %.10f %.10f %.10f "
+           "nis above 95%% lidar %llu/%llu radar %llu/%llu\n", paths[f],
+           result.measurements, r(0), r(1), r(2), r(3), result.lidar.exceeded,
+           result.lidar.updates, result.radar.exceeded, result.radar.updates);
+    rmse.Merge(result.rmse);
+    nees.Merge(result.nees);
+    lidar.updates += result.lidar.updates;
+    lidar.exceeded += result.lidar.exceeded;
+    lidar.rejected += result.lidar.rejected;
+    lidar.nis_sum += result.lidar.nis_sum;
+    radar.updates += result.radar.updates;
+    radar.exceeded += result.radar.exceeded;
+    radar.rejected += result.radar.rejected;
+    radar.nis_sum += result.radar.nis_sum;
+    measurements += result.measurements;
+    skipped += result.skipped;
+    repairs += result.covariance_repairs;
+  }
+
+  const Eigen::Vector4d RMSE = rmse.RMSE();
+  printf("files %zu unreadable %zu measurements %zu skipped %zu\n",
+         paths.size(), failed, measurements, skipped);
+  if (repairs > 0) {
+    printf("covariance repairs %llu\n", repairs);
+  }
+  printf("nis above 95%% lidar %llu/%llu radar %llu/%llu\n", lidar.exceeded,
+         lidar.updates, radar.exceeded, radar.updates);
+  if (config.gate_lidar > 0.0 || config.gate_radar > 0.0) {
+    printf("gated out lidar %llu radar %llu\n", lidar.rejected,
+           radar.rejected);
+  }
+  PrintConsistency(lidar, radar, nees);
+  printf("rmse %.10f %.10f %.10f %.10f\n", RMSE(0), RMSE(1), RMSE(2), RMSE(3));
+  if (failed > 0) {
+    return 1;
+  }
+  return max_rmse.empty() || WithinRmse(RMSE, max_rmse) ? 0 : 3;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  const char *input_path = nullptr;
+  std::vector<const char *> input_paths;
+  const char *estimates_path = nullptr;
+  const char *outputs_path = nullptr;
+  const char *arrow_path = nullptr;
+  const char *compare_path = nullptr;
+  const char *digest_path = nullptr;
+  const char *save_snapshot = nullptr;
+  const char *load_snapshot = nullptr;
+  const char *smooth_path = nullptr;
+  const char *steps_path = nullptr;
+  int smooth_lag = 0;
+  std::vector<double> range;
+  std::vector<double> max_rmse;
+  double tolerance = -1.0;
+  const char *expect_digest = nullptr;
+  UKFConfig config;
+  bool print_stages = false;
+  bool fused = false;
+  int threads = 0;
+  std::vector<double> imm_std_a;
+  // zone markers, when built with UKF_PROFILER
+  StartProfiler();
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--sqrt") == 0) {
+      config.sqrt = true;
+    }
+    else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      std::string error;
+      if (!config.Load(argv[++i], &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--fused") == 0) {
+      fused = true;
+    }
+    else if (strcmp(argv[i], "--stages") == 0) {
+      print_stages = true;
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--oosm") == 0 && i + 1 < argc) {
+      config.history_depth = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--max-step") == 0 && i + 1 < argc) {
+      config.max_predict_step = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--imm") == 0 && i + 1 < argc) {
+      ParseList(argv[++i], &imm_std_a);
+    }
+    else if (strcmp(argv[i], "--max-rmse") == 0 && i + 1 < argc) {
+      ParseList(strcmp(argv[++i], "rubric") == 0 ? "0.09,0.10,0.40,0.30"
+                                                 : argv[i],
+                &max_rmse);
+    }
+    else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--expect-digest") == 0 && i + 1 < argc) {
+      expect_digest = argv[++i];
+    }
+    else if (strcmp(argv[i], "--estimates") == 0 && i + 1 < argc) {
+      estimates_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+      steps_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--outputs") == 0 && i + 1 < argc) {
+      outputs_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--arrow") == 0 && i + 1 < argc) {
+      arrow_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      compare_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--digest") == 0 && i + 1 < argc) {
+      digest_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+      save_snapshot = argv[++i];
+    }
+    else if (strcmp(argv[i], "--load-snapshot") == 0 && i + 1 < argc) {
+      load_snapshot = argv[++i];
+    }
+    else if (strcmp(argv[i], "--smooth") == 0 && i + 1 < argc) {
+      smooth_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--smooth-lag") == 0 && i + 1 < argc) {
+      smooth_lag = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc) {
+      ParseList(argv[++i], &range);
+    }
+    else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      std::cerr << "usage: ukf_replay [--config <file>] [--sqrt] "
+                << "[--threads <n>] [--estimates <file>] [--steps <file>] "
+                << "[--outputs <file>] [--arrow <file>] "
+                << "[--stages] [--oosm <depth>] [--max-step <s>] [--fused] "
+                << "[--imm <std_a,std_a,...>] [--compare <estimates>] "
+                << "[--digest <file>] [--max-rmse <px,py,vx,vy>|rubric] "
+                << "[--tolerance <t>] [--expect-digest <hex>] "
+                << "[--save-snapshot <file>] [--load-snapshot <file>] "
+                << "[--smooth <file>] [--smooth-lag <n>] "
+                << "[--range <from_us,to_us>] [input...]"
+                << std::endl;
+      return 2;
+    }
+    else {
+      input_paths.push_back(argv[i]);
+    }
+  }
+  if (!input_paths.empty()) {
+    input_path = input_paths[0];
+  }
+  if (!max_rmse.empty() && max_rmse.size() != 4) {
+    std::cerr << "--max-rmse needs four values" << std::endl;
+    return 2;
+  }
+  if (!range.empty() && range.size() != 2) {
+    std::cerr << "--range needs two values" << std::endl;
+    return 2;
+  }
+  const TimeUs range_from = range.empty() ? LLONG_MIN : TimeUs(range[0]);
+  const TimeUs range_to = range.empty() ? LLONG_MAX : TimeUs(range[1]);
+
+  ThreadPool pool(threads);
+  if (input_paths.size() > 1) {
+    if (estimates_path || steps_path || outputs_path || arrow_path ||
+        compare_path ||
+        digest_path || save_snapshot || load_snapshot || smooth_path ||
+        expect_digest || !imm_std_a.empty() || !range.empty()) {
+      std::cerr << "several inputs take only filter settings, --fused, "
+                << "--threads and --max-rmse" << std::endl;
+      return 2;
+    }
+    return ReplayFiles(input_paths, config, fused, &pool, max_rmse);
+  }
+
+  //parse everything up front, in parallel
+  std::vector<LogRecord> records;
+  size_t skipped = 0;
+  const bool binary_input =
+      input_path && BinaryLog::IsMeasurementFile(input_path);
+  if (binary_input) {
+    const bool read = range.empty()
+        ? BinaryLog::ReadMeasurements(input_path, &records, &pool)
+        : BinaryLog::ReadMeasurements(input_path, range_from, range_to,
+                                      &records, &pool);
+    if (!read) {
+      std::cerr << "Cannot read " << input_path << std::endl;
+      return 1;
+    }
+  }
+  else if (input_path) {
+    if (!LogReader::Load(input_path, &pool, &records, &skipped)) {
+      std::cerr << "Cannot open " << input_path << std::endl;
+      return 1;
+    }
+  }
+  else {
+    std::string text((std::istreambuf_iterator<char>(std::cin)),
+                     std::istreambuf_iterator<char>());
+    skipped = LogReader::Parse(text.data(), text.size(), &pool, &records);
+  }
+  //text has no index; the range is cut out after parsing
+  if (!range.empty() && !binary_input) {
+    records.erase(std::remove_if(records.begin(), records.end(),
+                                 [&](const LogRecord &r) {
+                                   return r.meas.timestamp_ < range_from ||
+                                          r.meas.timestamp_ >= range_to;
+                                 }),
+                  records.end());
+  }
+
+  std::vector<Estimate> reference;
+  if (compare_path && !LoadEstimates(compare_path, &reference)) {
+    std::cerr << "Cannot open " << compare_path << std::endl;
+    return 1;
+  }
+  std::vector<Estimate> run_estimates;
+
+  std::string error;
+  BufferedWriter digests;
+  if (digest_path && !digests.Open(digest_path, &error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  StateDigest run_digest;
+
+  BufferedWriter estimates;
+  if (estimates_path && !estimates.Open(estimates_path, &error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+
+  BufferedWriter steps;
+  if (steps_path && !steps.Open(steps_path, &error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+
+  ArrowEstimateLog arrow;
+  if (arrow_path && !arrow.Open(arrow_path, &error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+
+  UKF ukf(config);
+  std::unique_ptr<IMM> imm;
+  if (!imm_std_a.empty()) {
+    IMM::Model models[IMM::kMaxModels];
+    int count = std::min(static_cast<int>(imm_std_a.size()), IMM::kMaxModels);
+    for (int k = 0; k < count; k++) {
+      models[k].std_a = imm_std_a[k];
+      models[k].std_yawdd = ukf.std_yawdd_;
+      models[k].motion_model = ukf.motion_model_;
+    }
+    imm.reset(new IMM(ukf, models, count, 0.95));
+  }
+  if ((save_snapshot || load_snapshot || smooth_path) && imm) {
+    std::cerr << "snapshots and smoothing need a single filter, not --imm"
+              << std::endl;
+    return 2;
+  }
+
+  //a warm restart resumes from the saved posterior and skips the
+  //measurements it already covers
+  size_t first = 0;
+  if (load_snapshot) {
+    FilterSnapshot::File snapshot;
+    if (!snapshot.Open(load_snapshot)) {
+      std::cerr << "Cannot read " << load_snapshot << std::endl;
+      return 1;
+    }
+    if (snapshot.size() != 1 ||
+        !FilterSnapshot::Restore(snapshot.records()[0], &ukf)) {
+      std::cerr << load_snapshot << " does not hold one filter of this model"
+                << std::endl;
+      return 1;
+    }
+    while (first < records.size() &&
+           records[first].meas.timestamp_ <= ukf.timestamp()) {
+      ++first;
+    }
+    printf("restored state at %lld, resuming after %zu measurements\n",
+           ukf.timestamp(), first);
+  }
+
+  //the smoother records one step per filter step; step_starts maps each
+  //back to its first measurement
+  RtsSmoother smoother;
+  std::vector<size_t> step_starts;
+  if (smooth_path) {
+    smoother.Reserve(records.size());
+    step_starts.reserve(records.size() + 1);
+  }
+
+  RMSEAccumulator rmse;
+  NEESAccumulator nees;
+  std::vector<OutputRecord> outputs;
+  if (outputs_path) {
+    outputs.reserve(records.size());
+  }
+
+  //the filter itself is sequential; with --fused, runs of measurements
+  //sharing a timestamp go to the filter as one group
+  FrameArena arena;
+  for (size_t i = first; i < records.size(); ) {
+    size_t count = 1;
+    while (fused && i + count < records.size() &&
+           records[i + count].meas.timestamp_ == records[i].meas.timestamp_) {
+      ++count;
+    }
+    if (imm) {
+      for (size_t j = i; j < i + count; j++) {
+        imm->ProcessMeasurement(records[j].meas);
+      }
+    }
+    else if (count == 1) {
+      ukf.ProcessMeasurement(records[i].meas);
+    }
+    else {
+      arena.Reset();
+      Measurement *group = arena.AllocateArray<Measurement>(count);
+      for (size_t j = 0; j < count; j++) {
+        group[j] = records[i + j].meas;
+      }
+      ukf.ProcessMeasurementGroup(group, count);
+    }
+
+    if (smooth_path && ukf.initialized()) {
+      smoother.Add(ukf);
+      step_starts.push_back(i);
+    }
+
+    const UKF::StateVector &x = imm ? imm->x() : ukf.x();
+    const UKF::StateMatrix &P = imm ? imm->P() : ukf.P();
+    double v = x(2);
+    double yaw = x(3);
+    Eigen::Vector4d estimate(x(0), x(1), cos(yaw) * v, sin(yaw) * v);
+
+    if (digest_path) {
+      StateDigest step;
+      step.Add(x);
+      step.Add(P);
+      run_digest.Add(x);
+      run_digest.Add(P);
+      digests.AppendInteger(records[i].meas.timestamp_);
+      digests.Append(' ');
+      digests.AppendHex(step.value());
+      digests.Append('\n');
+    }
+
+    for (size_t j = i; j < i + count; j++) {
+      const LogRecord &record = records[j];
+      {
+        UKF_STAGE_TIMER(STAGE_RMSE);
+        rmse.Add(estimate, Eigen::Vector4d(record.ground_truth));
+        nees.AddCtrv(x, P, Eigen::Vector4d(record.ground_truth));
+      }
+
+      if (estimates_path) {
+        WriteEstimate(record.meas.timestamp_, estimate, &estimates);
+      }
+
+      const double nis = j == 0 || imm ? 0.0
+          : record.meas.sensor_type_ == MeasurementPackage::RADAR
+              ? ukf.nis_radar_ : ukf.nis_lidar_;
+      if (steps_path) {
+        const Eigen::Vector4d so_far = rmse.RMSE();
+        steps.AppendInteger(record.meas.timestamp_);
+        for (int k = 0; k < 4; k++) {
+          steps.Append(' ');
+          steps.AppendDouble(estimate(k));
+        }
+        for (int k = 0; k < 4; k++) {
+          steps.Append(' ');
+          steps.AppendDouble(so_far(k));
+        }
+        steps.Append(' ');
+        steps.AppendDouble(nis);
+        steps.Append('\n');
+      }
+
+      if (compare_path) {
+        Estimate e;
+        e.timestamp = record.meas.timestamp_;
+        for (int k = 0; k < 4; k++) {
+          e.values[k] = estimate(k);
+        }
+        run_estimates.push_back(e);
+      }
+
+      if (outputs_path) {
+        OutputRecord out;
+        out.timestamp = record.meas.timestamp_;
+        for (int k = 0; k < UKF::n_x_; k++) {
+          out.x[k] = x(k);
+          out.p_diag[k] = P(k,k);
+        }
+        out.nis = nis;
+        outputs.push_back(out);
+      }
+
+      if (arrow_path && !arrow.Add(record.meas.timestamp_,
+                                   record.meas.sensor_type_, x, P, nis)) {
+        std::cerr << "Cannot write " << arrow_path << std::endl;
+        return 1;
+      }
+    }
+    i += count;
+  }
+  BufferedWriter *written[] = {&estimates, &digests, &steps};
+  for (BufferedWriter *writer : written) {
+    if (!writer->Close()) {
+      std::cerr << "Write failed" << std::endl;
+      return 1;
+    }
+  }
+
+  if (smooth_path) {
+    BufferedWriter smoothed_file;
+    if (!smoothed_file.Open(smooth_path, &error)) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    std::vector<RtsSmoother::Smoothed> smoothed;
+    smoother.Smooth(smooth_lag, &smoothed);
+    step_starts.push_back(records.size());
+    RMSEAccumulator smoothed_rmse;
+    for (size_t k = 0; k < smoothed.size(); k++) {
+      const UKF::StateVector &xs = smoothed[k].x;
+      Eigen::Vector4d estimate(xs(0), xs(1), cos(xs(3)) * xs(2),
+                               sin(xs(3)) * xs(2));
+      for (size_t j = step_starts[k]; j < step_starts[k + 1]; j++) {
+        smoothed_rmse.Add(estimate, Eigen::Vector4d(records[j].ground_truth));
+        WriteEstimate(records[j].meas.timestamp_, estimate, &smoothed_file);
+      }
+    }
+    if (!smoothed_file.Close()) {
+      std::cerr << "Cannot write " << smooth_path << std::endl;
+      return 1;
+    }
+    const Eigen::Vector4d s = smoothed_rmse.RMSE();
+    printf("smoothed rmse %.10f %.10f %.10f %.10f\n", s(0), s(1), s(2), s(3));
+  }
+
+  if (save_snapshot && ukf.initialized()) {
+    FilterSnapshot::Record record;
+    FilterSnapshot::Capture(ukf, 0, &record);
+    if (!FilterSnapshot::Write(save_snapshot, &record, 1)) {
+      std::cerr << "Cannot write " << save_snapshot << std::endl;
+      return 1;
+    }
+  }
+
+  if (outputs_path && !BinaryLog::WriteOutputs(outputs_path, outputs)) {
+    std::cerr << "Cannot write " << outputs_path << std::endl;
+    return 1;
+  }
+  if (arrow_path && !arrow.Close()) {
+    std::cerr << "Cannot write " << arrow_path << std::endl;
+    return 1;
+  }
+
+  Eigen::Vector4d RMSE = rmse.RMSE();
+  printf("measurements %zu skipped %zu\n", records.size(), skipped);
+  if (ukf.covariance_repairs_ > 0) {
+    printf("covariance repairs %llu\n", ukf.covariance_repairs_);
+  }
+  if (config.history_depth > 0) {
+    printf("out of sequence fused %llu dropped %llu\n", ukf.oosm_fused_,
+           ukf.oosm_dropped_);
+  }
+  if (!imm) {
+    printf("nis above 95%% lidar %llu/%llu radar %llu/%llu\n",
+           ukf.nis_counter_lidar_.exceeded, ukf.nis_counter_lidar_.updates,
+           ukf.nis_counter_radar_.exceeded, ukf.nis_counter_radar_.updates);
+    if (config.gate_lidar > 0.0 || config.gate_radar > 0.0) {
+      printf("gated out lidar %llu radar %llu\n",
+             ukf.nis_counter_lidar_.rejected, ukf.nis_counter_radar_.rejected);
+    }
+    PrintConsistency(ukf.nis_counter_lidar_, ukf.nis_counter_radar_, nees);
+    if (config.adaptive_noise > 0.0) {
+      printf("process noise scale %.4f\n", ukf.noise_scale_);
+    }
+    if (config.ekf_angle > 0.0) {
+      printf("ekf predictions %llu radar updates %llu\n",
+             ukf.ekf_predictions_, ukf.ekf_radar_updates_);
+    }
+  }
+  printf("rmse %.10f %.10f %.10f %.10f\n", RMSE(0), RMSE(1), RMSE(2), RMSE(3));
+  if (imm) {
+    printf("model probabilities");
+    for (int k = 0; k < imm->count(); k++) {
+      printf(" %.4f", imm->probabilities()(k));
+    }
+    printf("\n");
+  }
+  bool passed = true;
+  if (compare_path) {
+    passed &= CompareEstimates(run_estimates, reference, tolerance);
+  }
+  if (digest_path) {
+    printf("digest %016llx\n", run_digest.value());
+  }
+  if (expect_digest) {
+    if (!digest_path) {
+      std::cerr << "--expect-digest needs --digest" << std::endl;
+      return 2;
+    }
+    if (strtoull(expect_digest, nullptr, 16) != run_digest.value()) {
+      printf("FAIL digest %016llx, expected %s\n", run_digest.value(),
+             expect_digest);
+      passed = false;
+    }
+  }
+  if (!max_rmse.empty()) {
+    passed &= WithinRmse(RMSE, max_rmse);
+  }
+  if (print_stages) {
+    printf("%s", StageTimings::Dump().c_str());
+  }
+  return passed ? 0 : 3;
+}
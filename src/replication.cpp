@@ -0,0 +1,211 @@
+#include "replication.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "track_table.h"
+
+namespace {
+
+static_assert(sizeof(ReplicationHeader) == 16,
+              "replication headers are sent as raw bytes");
+
+// a larger body means the stream lost its framing
+const size_t kMaxBody = 4096;
+
+}  // namespace
+
+ReplicationLeader::ReplicationLeader(size_t max_pending,
+                                     const StateDelta::Options *compact)
+    : max_pending_(max_pending),
+      sequence_(0),
+      encoder_(compact ? new StateDelta::Encoder(*compact) : nullptr),
+      overflowed_(false),
+      sent_(0) {}
+
+ReplicationLeader::~ReplicationLeader() {}
+
+void ReplicationLeader::Update(unsigned long long id, const UKF &ukf) {
+  FilterSnapshot::Record record;
+  FilterSnapshot::Capture(ukf, id, &record);
+  if (!encoder_) {
+    Append(ReplicationHeader::UPDATE, &record, sizeof(record));
+    return;
+  }
+  encoded_.clear();
+  if (encoder_->Encode(record, &encoded_) > 0) {
+    Append(ReplicationHeader::DELTA, encoded_.data(), encoded_.size());
+  }
+}
+
+void ReplicationLeader::Remove(unsigned long long id) {
+  if (encoder_) {
+    encoder_->Forget(id);
+  }
+  const uint64_t body = id;
+  Append(ReplicationHeader::REMOVE, &body, sizeof(body));
+}
+
+void ReplicationLeader::Clear() {
+  if (encoder_) {
+    encoder_->Reset();
+  }
+  Append(ReplicationHeader::SYNC, nullptr, 0);
+}
+
+void ReplicationLeader::Sync(const TrackTable &tracks) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    //what is still queued is superseded by the copy
+    pending_.clear();
+    overflowed_ = false;
+  }
+  Clear();
+  tracks.ForEach([this](unsigned id, const TrackTable::Track &track) {
+    if (track.ukf.initialized()) {
+      Update(id, track.ukf);
+    }
+  });
+}
+
+void ReplicationLeader::Append(uint32_t type, const void *body,
+                               size_t size) {
+  ReplicationHeader header;
+  header.type = type;
+  header.size = static_cast<uint32_t>(size);
+  header.sequence = ++sequence_;
+  const char *bytes = reinterpret_cast<const char *>(&header);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_.size() + sizeof(header) + size > max_pending_) {
+    overflowed_ = true;
+    return;
+  }
+  pending_.insert(pending_.end(), bytes, bytes + sizeof(header));
+  const char *data = static_cast<const char *>(body);
+  pending_.insert(pending_.end(), data, data + size);
+}
+bool ReplicationLeader::Send(int fd) {
+  if (sent_ == sending_.size()) {
+    sending_.clear();
+    sent_ = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    //both keep their capacity, so steady replication allocates nothing
+    sending_.swap(pending_);
+  }
+  while (sent_ < sending_.size()) {
+    ssize_t n = write(fd, sending_.data() + sent_, sending_.size() - sent_);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    sent_ += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool ReplicationLeader::Overflowed() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return overflowed_;
+}
+
+ReplicationFollower::ReplicationFollower(TrackTable *tracks,
+                                         const StateDelta::Options &compact)
+    : tracks_(tracks),
+      decoder_(compact),
+      sequence_(0),
+      started_(false),
+      synced_(false),
+      gaps_(0),
+      gaps_at_sync_(0),
+      malformed_(0) {}
+
+ReplicationFollower::~ReplicationFollower() {}
+
+size_t ReplicationFollower::Feed(const char *data, size_t length) {
+  //a message split across reads is completed in partial_ first
+  const char *p = data;
+  size_t n = length;
+  if (!partial_.empty()) {
+    partial_.insert(partial_.end(), data, data + length);
+    p = partial_.data();
+    n = partial_.size();
+  }
+  size_t applied = 0;
+  size_t used = 0;
+  ReplicationHeader header;
+  while (n - used >= sizeof(header)) {
+    memcpy(&header, p + used, sizeof(header));
+    if (header.size > kMaxBody) {
+      //nothing after this can be trusted; the owner has to reconnect
+      ++malformed_;
+      ++gaps_;
+      used = n;
+      break;
+    }
+    if (n - used < sizeof(header) + header.size) {
+      break;
+    }
+    if (Apply(header, p + used + sizeof(header))) {
+      ++applied;
+    }
+    else {
+      ++malformed_;
+      ++gaps_;
+    }
+    used += sizeof(header) + header.size;
+  }
+  if (!partial_.empty()) {
+    partial_.erase(partial_.begin(), partial_.begin() + used);
+  }
+  else {
+    partial_.insert(partial_.end(), data + used, data + length);
+  }
+  return applied;
+}
+
+bool ReplicationFollower::Apply(const ReplicationHeader &header,
+                                const char *body) {
+  if (started_ && header.sequence != sequence_ + 1) {
+    ++gaps_;
+  }
+  started_ = true;
+  sequence_ = header.sequence;
+  switch (header.type) {
+  case ReplicationHeader::UPDATE: {
+    FilterSnapshot::Record record;
+    if (header.size != sizeof(record)) {
+      return false;
+    }
+    memcpy(&record, body, sizeof(record));
+    tracks_->Insert(&record, 1);
+    return true;
+  }
+  case ReplicationHeader::DELTA: {
+    FilterSnapshot::Record record;
+    if (decoder_.Decode(body, header.size, &record) != header.size) {
+      return false;
+    }
+    tracks_->Insert(&record, 1);
+    return true;
+  }
+  case ReplicationHeader::REMOVE: {
+    uint64_t id;
+    if (header.size != sizeof(id)) {
+      return false;
+    }
+    memcpy(&id, body, sizeof(id));
+    decoder_.Forget(id);
+    tracks_->Remove(unsigned(id));
+    return true;
+  }
+  case ReplicationHeader::SYNC:
+    decoder_.Reset();
+    tracks_->Clear();
+    synced_ = true;
+    gaps_at_sync_ = gaps_;
+    return true;
+  }
+  return false;
+}
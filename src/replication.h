@@ -0,0 +1,176 @@
+#ifndef REPLICATION_H_
+#define REPLICATION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "filter_snapshot.h"
+#include "state_delta.h"
+#include "ukf.h"
+
+class TrackTable;
+
+/**
+ * Replication of a TrackTable to a hot standby: the leader ships every
+ * track's posterior after each update, and a follower process applies them
+ * to its own table, so on failover the standby continues with warm
+ * filters instead of reinitialising every track.
+ *
+ * The stream is a sequence of messages in host (little-endian) byte
+ * order, each a 16-byte header and a body of the size it gives. UPDATE
+ * carries a posterior as a FilterSnapshot::Record, DELTA the same as a
+ * StateDelta encoding (a compact leader; leader and follower must agree on
+ * the StateDelta::Options), REMOVE the u64 id of a track that is gone, and
+ * SYNC, with no body, tells the follower to drop every track because a
+ * full copy follows. A follower that joins late, or sees a gap in the
+ * sequence, is brought back in step by the leader's Sync.
+ */
+struct ReplicationHeader {
+  enum Type { UPDATE = 1, REMOVE = 2, SYNC = 3, DELTA = 4 };
+
+  uint32_t type;
+  ///* bytes of the body that follows
+  uint32_t size;
+  ///* counts every message the leader produced
+  uint64_t sequence;
+};
+
+/**
+ * Producing side. The filter thread adds messages; one sender thread
+ * writes them to the follower's socket, so the filter never blocks on the
+ * network. Messages beyond max_pending bytes are dropped, leaving a gap the
+ * follower detects, and the owner should Sync once Overflowed.
+ */
+class ReplicationLeader {
+public:
+  /**
+   * Constructor
+   * @param max_pending Most unsent bytes kept before messages are dropped
+   * @param compact If not null, posteriors are sent as StateDelta
+   * encodings with these options, and only once they have moved enough
+   */
+  explicit ReplicationLeader(size_t max_pending,
+                             const StateDelta::Options *compact = nullptr);
+
+  virtual ~ReplicationLeader();
+
+  /**
+   * Filter thread: ships a track's posterior
+   * @param id Track id
+   * @param ukf Initialised filter
+   */
+  void Update(unsigned long long id, const UKF &ukf);
+
+  /**
+   * Filter thread: ships the removal of a track
+   */
+  void Remove(unsigned long long id);
+
+  /**
+   * Filter thread: tells the follower to drop every track
+   */
+  void Clear();
+
+  /**
+   * Filter thread: replaces the follower's tracks with a full copy of a
+   * table, e.g. for a new follower or after an overflow
+   */
+  void Sync(const TrackTable &tracks);
+
+  /**
+   * Sender thread: writes pending messages to a non-blocking descriptor,
+   * as many as it takes; a message cut short by a full socket is finished
+   * by the next call
+   * @param fd Socket or pipe to the follower
+   * @return false on a write error other than a full socket
+   */
+  bool Send(int fd);
+
+  /**
+   * Any thread: whether messages were dropped since the last Sync
+   */
+  bool Overflowed();
+
+  ///* messages produced, including dropped ones; filter thread
+  uint64_t sequence() const { return sequence_; }
+
+private:
+  // counts and queues one message
+  void Append(uint32_t type, const void *body, size_t size);
+
+  const size_t max_pending_;
+  uint64_t sequence_;
+
+  ///* with a compact stream: the filter thread's encoder and its output
+  std::unique_ptr<StateDelta::Encoder> encoder_;
+  std::vector<char> encoded_;
+
+  std::mutex mutex_;
+  ///* messages not yet taken by Send; guarded by mutex_
+  std::vector<char> pending_;
+  bool overflowed_;
+
+  ///* sender thread: bytes taken from pending_, written from sent_ on
+  std::vector<char> sending_;
+  size_t sent_;
+};
+
+/**
+ * Consuming side, on the standby: applies a leader's stream to a table.
+ * Messages may be split across reads.
+ */
+class ReplicationFollower {
+public:
+  /**
+   * Constructor
+   * @param tracks Table to keep in step with the leader's; must outlive
+   * the follower
+   * @param compact The leader's StateDelta::Options, for DELTA messages
+   */
+  explicit ReplicationFollower(
+      TrackTable *tracks,
+      const StateDelta::Options &compact = StateDelta::Options());
+
+  virtual ~ReplicationFollower();
+
+  /**
+   * Applies every complete message in data, keeping a partial one for the
+   * next call
+   * @param data Bytes from the stream
+   * @param length Number of bytes
+   * @return Messages applied
+   */
+  size_t Feed(const char *data, size_t length);
+
+  ///* whether a SYNC has been applied and no message missed since
+  bool in_step() const { return synced_ && gaps_ == gaps_at_sync_; }
+
+  ///* times the sequence skipped messages
+  uint64_t gaps() const { return gaps_; }
+
+  ///* messages whose body could not be decoded; counted as gaps too
+  uint64_t malformed() const { return malformed_; }
+
+  ///* sequence number of the last message applied
+  uint64_t sequence() const { return sequence_; }
+
+private:
+  // applies one message; false if its body is malformed
+  bool Apply(const ReplicationHeader &header, const char *body);
+
+  TrackTable *const tracks_;
+  StateDelta::Decoder decoder_;
+  ///* the start of a message split across reads
+  std::vector<char> partial_;
+  uint64_t sequence_;
+  bool started_;
+  bool synced_;
+  uint64_t gaps_;
+  uint64_t gaps_at_sync_;
+  ///* messages whose body could not be applied
+  uint64_t malformed_;
+};
+
+#endif /* REPLICATION_H_ */
@@ -0,0 +1,202 @@
+#include "response_writer.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// magnitude below which the fixed-point path is used
+const double kFixedLimit = 1e9;
+
+// decimals of the fixed-point path
+const int kDecimals = 9;
+const unsigned long long kScale = 1000000000ULL;
+
+// writes v in decimal at the end of out, returns the number of characters
+int FormatUnsigned(unsigned long long v, char *out) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = static_cast<char>('0' + v % 10);
+    v /= 10;
+  } while (v);
+  for (int i = 0; i < n; i++) {
+    out[i] = digits[n - 1 - i];
+  }
+  return n;
+}
+
+}  // namespace
+
+ResponseWriter::ResponseWriter(size_t reserve) : batched_(0) {
+  buffer_.reserve(reserve);
+}
+
+ResponseWriter::~ResponseWriter() {}
+
+void ResponseWriter::Append(const char *s, size_t length) {
+  buffer_.insert(buffer_.end(), s, s + length);
+}
+
+void ResponseWriter::Append(const char *s) {
+  Append(s, strlen(s));
+}
+
+void ResponseWriter::AppendDouble(double value) {
+  char text[32];
+  int n = 0;
+
+  if (!std::isfinite(value)) {
+    Append("null", 4);
+    return;
+  }
+
+  if (std::fabs(value) < kFixedLimit) {
+    unsigned long long scaled = static_cast<unsigned long long>(
+        std::fabs(value) * static_cast<double>(kScale) + 0.5);
+    if (scaled != 0 && value < 0) {
+      text[n++] = '-';
+    }
+    n += FormatUnsigned(scaled / kScale, text + n);
+
+    unsigned long long fraction = scaled % kScale;
+    if (fraction != 0) {
+      //fixed width, then drop trailing zeros
+      text[n++] = '.';
+      int start = n;
+      for (int i = kDecimals - 1; i >= 0; i--) {
+        text[start + i] = static_cast<char>('0' + fraction % 10);
+        fraction /= 10;
+      }
+      n += kDecimals;
+      while (text[n - 1] == '0') --n;
+    }
+  }
+  else {
+    n = snprintf(text, sizeof(text), "%.15g", value);
+  }
+  Append(text, n);
+}
+
+void ResponseWriter::EstimateMarker(const double *estimate,
+                                    const double *rmse, double nis,
+                                    double nis_exceeded,
+                                    const double *window_rmse) {
+  Restart("42[\"estimate_marker\",");
+  EstimateObject(estimate, rmse, nis, nis_exceeded, window_rmse);
+  Append("]", 1);
+}
+
+void ResponseWriter::AppendInteger(long long value) {
+  char text[24];
+  int n = 0;
+  if (value < 0) {
+    text[n++] = '-';
+  }
+  //negate in unsigned arithmetic so LLONG_MIN does not overflow
+  unsigned long long magnitude = static_cast<unsigned long long>(value);
+  if (value < 0) {
+    magnitude = 0ULL - magnitude;
+  }
+  n += FormatUnsigned(magnitude, text + n);
+  Append(text, n);
+}
+
+void ResponseWriter::Behind(long long timestamp) {
+  Restart("42[\"behind\",{\"timestamp\":");
+  AppendInteger(timestamp);
+  Append("}]", 2);
+}
+
+void ResponseWriter::TracksBegin(unsigned long long source,
+                                 long long timestamp) {
+  Restart("42[\"tracks\",{\"source\":");
+  AppendInteger(static_cast<long long>(source));
+  Append(",\"timestamp\":");
+  AppendInteger(timestamp);
+  Append(",\"tracks\":[");
+}
+
+void ResponseWriter::TrackEstimate(unsigned track_id,
+                                   const double *estimate) {
+  Append(batched_ ? ",{\"id\":" : "{\"id\":");
+  AppendInteger(track_id);
+  Append(",\"estimate_x\":");
+  AppendDouble(estimate[0]);
+  Append(",\"estimate_y\":");
+  AppendDouble(estimate[1]);
+  Append(",\"estimate_vx\":");
+  AppendDouble(estimate[2]);
+  Append(",\"estimate_vy\":");
+  AppendDouble(estimate[3]);
+  Append("}", 1);
+  ++batched_;
+}
+
+void ResponseWriter::RegionBegin() {
+  Restart("{\"tracks\":[");
+}
+
+void ResponseWriter::RegionTrack(unsigned long long session,
+                                 unsigned track_id, long long timestamp,
+                                 const double *estimate) {
+  Append(batched_ ? ",[" : "[", batched_ ? 2 : 1);
+  AppendInteger(static_cast<long long>(session));
+  Append(",", 1);
+  AppendInteger(track_id);
+  Append(",", 1);
+  AppendInteger(timestamp);
+  for (int i = 0; i < 4; i++) {
+    Append(",", 1);
+    AppendDouble(estimate[i]);
+  }
+  Append("]", 1);
+  ++batched_;
+}
+
+void ResponseWriter::BatchEstimate(const double *estimate, const double *rmse,
+                                   double nis, double nis_exceeded,
+                                   const double *window_rmse) {
+  if (buffer_.empty()) {
+    Append("42[\"estimate_batch\",[");
+  }
+  else {
+    Append(",", 1);
+  }
+  EstimateObject(estimate, rmse, nis, nis_exceeded, window_rmse);
+  ++batched_;
+}
+
+void ResponseWriter::EstimateObject(const double *estimate, const double *rmse,
+                                    double nis, double nis_exceeded,
+                                    const double *window_rmse) {
+  Append("{\"estimate_x\":");
+  AppendDouble(estimate[0]);
+  Append(",\"estimate_y\":");
+  AppendDouble(estimate[1]);
+  if (rmse) {
+    Append(",\"rmse_vx\":");
+    AppendDouble(rmse[2]);
+    Append(",\"rmse_vy\":");
+    AppendDouble(rmse[3]);
+    Append(",\"rmse_x\":");
+    AppendDouble(rmse[0]);
+    Append(",\"rmse_y\":");
+    AppendDouble(rmse[1]);
+  }
+  Append(",\"nis\":");
+  AppendDouble(nis);
+  Append(",\"nis_exceeded\":");
+  AppendDouble(nis_exceeded);
+  if (window_rmse) {
+    Append(",\"rmse_window_x\":");
+    AppendDouble(window_rmse[0]);
+    Append(",\"rmse_window_y\":");
+    AppendDouble(window_rmse[1]);
+    Append(",\"rmse_window_vx\":");
+    AppendDouble(window_rmse[2]);
+    Append(",\"rmse_window_vy\":");
+    AppendDouble(window_rmse[3]);
+  }
+  Append("}", 1);
+}
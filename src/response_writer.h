@@ -0,0 +1,125 @@
+#ifndef RESPONSE_WRITER_H_
+#define RESPONSE_WRITER_H_
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Formats Socket.IO replies into a buffer that is reused from reply to
+ * reply, so once the buffer has grown to the reply size no further
+ * allocations happen. Replaces building a json object and dumping it.
+ */
+class ResponseWriter {
+public:
+  /**
+   * Constructor
+   * @param reserve Initial buffer capacity in bytes
+   */
+  explicit ResponseWriter(size_t reserve = 256);
+
+  /**
+   * Destructor
+   */
+  virtual ~ResponseWriter();
+
+  void Clear() {
+    buffer_.clear();
+    batched_ = 0;
+  }
+
+  void Append(const char *s, size_t length);
+  void Append(const char *s);
+
+  /**
+   * Appends a number as JSON text. Values below 1e9 in magnitude are
+   * written in fixed point with up to 9 decimals through integer
+   * arithmetic; larger ones use %.15g like json::dump. Non-finite values are
+   * written as null.
+   */
+  void AppendDouble(double value);
+
+  /**
+   * Appends an integer as JSON text, exactly (AppendDouble would round
+   * microsecond timestamps to 15 digits)
+   */
+  void AppendInteger(long long value);
+
+  /**
+   * Formats 42["estimate_marker",{...}] with the same keys, in the same
+   * order, as the json::dump reply it replaces, followed by "nis" and
+   * "nis_exceeded"
+   * @param estimate [x, y, ...] estimate
+   * @param rmse [x, y, vx, vy] RMSE, or null to leave the rmse keys out
+   * @param nis NIS of the update behind the estimate
+   * @param nis_exceeded Fraction of that sensor's updates so far whose NIS
+   * exceeded the 95% chi-square bound
+   * @param window_rmse [x, y, vx, vy] RMSE over the track's sliding
+   * window, appended as "rmse_window_x" ... "rmse_window_vy"; null to leave
+   * those keys out
+   */
+  void EstimateMarker(const double *estimate, const double *rmse, double nis,
+                      double nis_exceeded,
+                      const double *window_rmse = nullptr);
+
+  /**
+   * Formats 42["behind",{"timestamp":...}], the reply to a measurement the
+   * server dropped unfiltered because it could not keep up
+   * @param timestamp Timestamp of the dropped measurement in us
+   */
+  void Behind(long long timestamp);
+
+  /**
+   * Starts 42["tracks",{"source":...,"timestamp":...,"tracks":[...]}], a
+   * published snapshot of one session's tracks; TrackEstimate adds a track
+   * and FinishTracks closes the event
+   * @param source Id of the session the tracks belong to
+   * @param timestamp Time the estimates are predicted to, in us
+   */
+  void TracksBegin(unsigned long long source, long long timestamp);
+  void TrackEstimate(unsigned track_id, const double *estimate);
+  void FinishTracks() { Append("]}]", 3); }
+
+  /**
+   * Starts {"tracks":[...]}, the reply to a region query (GET /tracks);
+   * RegionTrack adds a track as [session,id,timestamp,x,y,vx,vy] and
+   * FinishRegion closes the object
+   */
+  void RegionBegin();
+  void RegionTrack(unsigned long long session, unsigned track_id,
+                   long long timestamp, const double *estimate);
+  void FinishRegion() { Append("]}", 2); }
+
+  /**
+   * Appends one estimate, with EstimateMarker's keys, to a
+   * 42["estimate_batch",[{...},...]] event that carries several replies in
+   * one frame; the first call on an empty buffer starts the event and
+   * FinishBatch closes it
+   */
+  void BatchEstimate(const double *estimate, const double *rmse, double nis,
+                     double nis_exceeded, const double *window_rmse = nullptr);
+  void FinishBatch() { Append("]]", 2); }
+
+  ///* estimates in the open batch
+  size_t batched() const { return batched_; }
+
+  const char *data() const { return buffer_.data(); }
+  size_t size() const { return buffer_.size(); }
+  size_t MemoryBytes() const { return buffer_.capacity(); }
+
+private:
+  // Clear, then a literal prefix; assign copies it in one step, where
+  // clear and insert trip GCC's bounds warnings at -O3
+  template <size_t N>
+  void Restart(const char (&prefix)[N]) {
+    buffer_.assign(prefix, prefix + N - 1);
+    batched_ = 0;
+  }
+
+  void EstimateObject(const double *estimate, const double *rmse, double nis,
+                      double nis_exceeded, const double *window_rmse);
+
+  std::vector<char> buffer_;
+  size_t batched_;
+};
+
+#endif /* RESPONSE_WRITER_H_ */
@@ -0,0 +1,100 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <vector>
+#include "Eigen/Core"
+#include "Eigen/StdVector"
+
+/**
+ * The value a RingBuffer's slots start with: T(), or zero for fixed-size
+ * Eigen matrices, whose default constructor leaves them uninitialised
+ */
+template <typename T>
+struct RingBufferFill {
+  static T Value() { return T(); }
+};
+
+template <typename Scalar, int Rows, int Cols, int Options, int MaxRows,
+          int MaxCols>
+struct RingBufferFill<
+    Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> > {
+  typedef Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> Type;
+  static Type Value() {
+    if (Rows == Eigen::Dynamic || Cols == Eigen::Dynamic) {
+      return Type();
+    }
+    return Type::Zero();
+  }
+};
+
+/**
+ * Fixed-capacity ring buffer in one contiguous block. Once full, each
+ * push_back overwrites the oldest element, so memory stays constant no
+ * matter how many elements pass through. Storage uses Eigen's aligned
+ * allocator so fixed-size vectorisable Eigen types can be stored directly.
+ */
+template <typename T>
+class RingBuffer {
+public:
+  /**
+   * @param capacity Maximum number of elements kept (at least 1)
+   */
+  explicit RingBuffer(size_t capacity)
+      : data_(capacity > 0 ? capacity : 1, RingBufferFill<T>::Value()),
+        head_(0),
+        size_(0) {}
+
+  /**
+   * Appends an element, evicting the oldest one when full
+   */
+  void push_back(const T &value) {
+    data_[head_] = value;
+    head_ = (head_ + 1 == data_.size()) ? 0 : head_ + 1;
+    if (size_ < data_.size()) {
+      ++size_;
+    }
+  }
+
+  /**
+   * Element i in insertion order: 0 is the oldest, size() - 1 the newest
+   */
+  const T &operator[](size_t i) const { return data_[Index(i)]; }
+  T &operator[](size_t i) { return data_[Index(i)]; }
+
+  const T &front() const { return (*this)[0]; }
+  const T &back() const { return (*this)[size_ - 1]; }
+
+  /**
+   * Removes the newest element
+   */
+  void pop_back() {
+    head_ = (head_ == 0) ? data_.size() - 1 : head_ - 1;
+    --size_;
+  }
+
+  void clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return data_.size(); }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == data_.size(); }
+
+  ///* heap bytes of the storage
+  size_t MemoryBytes() const { return data_.capacity() * sizeof(T); }
+
+private:
+  size_t Index(size_t i) const {
+    size_t start = (head_ + data_.size() - size_) % data_.size();
+    size_t k = start + i;
+    return k >= data_.size() ? k - data_.size() : k;
+  }
+
+  std::vector<T, Eigen::aligned_allocator<T> > data_;
+  size_t head_;
+  size_t size_;
+};
+
+#endif /* RING_BUFFER_H_ */
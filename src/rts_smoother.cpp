@@ -0,0 +1,83 @@
+#include "rts_smoother.h"
+#include <algorithm>
+#include "angle.h"
+
+RtsSmoother::RtsSmoother() {}
+
+RtsSmoother::~RtsSmoother() {}
+
+void RtsSmoother::Reserve(size_t steps) {
+  steps_.reserve(steps);
+}
+
+void RtsSmoother::Add(const UKF &ukf) {
+  if (!steps_.empty()) {
+    Step &previous = steps_.back();
+    const double delta_t = ToSeconds(ukf.timestamp() - previous.timestamp);
+    ukf.PredictFrom(previous.x, previous.P, delta_t, &previous.x_next,
+                    &previous.P_next, &previous.C);
+  }
+
+  Step step;
+  step.timestamp = ukf.timestamp();
+  step.x = ukf.x();
+  step.P = ukf.P();
+  step.x_next = step.x;
+  step.P_next = step.P;
+  step.C = step.P;
+  steps_.push_back(step);
+}
+
+void RtsSmoother::BackwardStep(const Step &step,
+                               const UKF::StateVector &x_next_s,
+                               const UKF::StateMatrix &P_next_s,
+                               UKF::StateVector *x_s, UKF::StateMatrix *P_s) {
+  //gain G = C P_next^-1, from a solve against the symmetric P_next
+  const UKF::StateMatrix G =
+      step.P_next.ldlt().solve(step.C.transpose()).transpose();
+
+  UKF::StateVector dx = x_next_s - step.x_next;
+  dx(3) = NormalizeAngle(dx(3));
+  *x_s = step.x + G * dx;
+  (*x_s)(3) = NormalizeAngle((*x_s)(3));
+  *P_s = step.P + G * (P_next_s - step.P_next) * G.transpose();
+}
+
+void RtsSmoother::Smooth(int lag, std::vector<Smoothed> *out) const {
+  const int n = static_cast<int>(steps_.size());
+  out->resize(n);
+  if (n == 0) {
+    return;
+  }
+
+  if (lag <= 0 || lag >= n - 1) {
+    //fixed interval: one sweep from the last step back
+    Smoothed *s = out->data();
+    s[n - 1].timestamp = steps_[n - 1].timestamp;
+    s[n - 1].x = steps_[n - 1].x;
+    s[n - 1].P = steps_[n - 1].P;
+    for (int k = n - 2; k >= 0; k--) {
+      s[k].timestamp = steps_[k].timestamp;
+      BackwardStep(steps_[k], s[k + 1].x, s[k + 1].P, &s[k].x, &s[k].P);
+    }
+    return;
+  }
+
+  //fixed lag: each step k is swept back from the filtered state at k + lag
+  for (int k = 0; k < n; k++) {
+    const int end = std::min(k + lag, n - 1);
+    UKF::StateVector x = steps_[end].x;
+    UKF::StateMatrix P = steps_[end].P;
+    for (int j = end - 1; j >= k; j--) {
+      UKF::StateVector x_s;
+      UKF::StateMatrix P_s;
+      BackwardStep(steps_[j], x, P, &x_s, &P_s);
+      x = x_s;
+      P = P_s;
+    }
+    Smoothed &s = (*out)[k];
+    s.timestamp = steps_[k].timestamp;
+    s.x = x;
+    s.P = P;
+  }
+}
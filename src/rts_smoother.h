@@ -0,0 +1,80 @@
+#ifndef RTS_SMOOTHER_H_
+#define RTS_SMOOTHER_H_
+
+#include <vector>
+#include "ukf.h"
+
+/**
+ * Unscented Rauch-Tung-Striebel smoother for offline runs. The filtered
+ * posterior of every step is recorded as the filter runs, together with the
+ * prediction to the next step and its cross-covariance, in one preallocated
+ * array; smoothing is then a backward sweep over that array, so any lag
+ * costs one pass instead of a rerun of the filter.
+ *
+ * The recorded prediction is one unscented step of the filter's own model
+ * (UKF::PredictFrom) over the whole gap, without max_predict_step_
+ * sub-steps.
+ */
+class RtsSmoother {
+public:
+  ///* One recorded step, in the order the sweep reads it
+  struct Step {
+    TimeUs timestamp;
+    ///* filtered posterior after this step's measurements
+    UKF::StateVector x;
+    UKF::StateMatrix P;
+    ///* prediction of this posterior to the next step, and the
+    ///* cross-covariance of the two; unset on the last step
+    UKF::StateVector x_next;
+    UKF::StateMatrix P_next;
+    UKF::StateMatrix C;
+  };
+
+  ///* A smoothed state
+  struct Smoothed {
+    TimeUs timestamp;
+    UKF::StateVector x;
+    UKF::StateMatrix P;
+  };
+
+  RtsSmoother();
+  virtual ~RtsSmoother();
+
+  /**
+   * Preallocates room for the whole run, so recording does not allocate
+   * @param steps Expected number of steps
+   */
+  void Reserve(size_t steps);
+
+  /**
+   * Records the filter's posterior after a step. Also completes the
+   * previous step's prediction to this timestamp, with the filter's model.
+   * @param ukf Filter just updated; must be initialised
+   */
+  void Add(const UKF &ukf);
+
+  /**
+   * Runs the backward pass
+   * @param lag Steps of future measurements each estimate may use; 0 or
+   * less smooths the whole interval
+   * @param out One smoothed state per recorded step, resized
+   */
+  void Smooth(int lag, std::vector<Smoothed> *out) const;
+
+  void Clear() { steps_.clear(); }
+
+  size_t size() const { return steps_.size(); }
+
+private:
+  /**
+   * One backward step: the smoothed state at step k from the smoothed
+   * state at k + 1
+   */
+  static void BackwardStep(const Step &step, const UKF::StateVector &x_next_s,
+                           const UKF::StateMatrix &P_next_s,
+                           UKF::StateVector *x_s, UKF::StateMatrix *P_s);
+
+  std::vector<Step> steps_;
+};
+
+#endif /* RTS_SMOOTHER_H_ */
@@ -0,0 +1,147 @@
+#include "scenario.h"
+#include <algorithm>
+#include <cmath>
+#include "angle.h"
+
+namespace {
+
+// one simulated target
+struct Target {
+  ///* CTRV state: x, y, speed, yaw, yaw rate
+  double x[5];
+  ///* accelerations held until the next draw
+  double a;
+  double yawdd;
+  ///* simulated time of the state, and of the next noise draw, in s
+  double time;
+  double next_draw;
+};
+
+// moves a target to time t, drawing new accelerations every step_s
+void Advance(const Scenario::Options &options, double t, std::mt19937_64 *rng,
+             Target *target) {
+  std::normal_distribution<double> normal;
+  double *x = target->x;
+  while (target->time < t) {
+    if (target->time >= target->next_draw) {
+      target->a = options.std_a * normal(*rng);
+      target->yawdd = options.std_yawdd * normal(*rng);
+      target->next_draw += options.step_s;
+    }
+    const double dt = std::min(target->next_draw, t) - target->time;
+    //the CTRV arc at the current speed and yaw rate, then the
+    //accelerations, as the filter's process model applies them
+    if (std::fabs(x[4]) > 1e-6) {
+      x[0] += x[2] / x[4] * (sin(x[3] + x[4] * dt) - sin(x[3]));
+      x[1] += x[2] / x[4] * (cos(x[3]) - cos(x[3] + x[4] * dt));
+    }
+    else {
+      x[0] += x[2] * dt * cos(x[3]);
+      x[1] += x[2] * dt * sin(x[3]);
+    }
+    x[2] += target->a * dt;
+    x[3] = NormalizeAngle(x[3] + x[4] * dt + 0.5 * target->yawdd * dt * dt);
+    x[4] += target->yawdd * dt;
+    target->time += dt;
+  }
+}
+
+}  // namespace
+
+void Scenario::Measure(const Options &options,
+                       MeasurementPackage::SensorType sensor,
+                       TimeUs timestamp, const double *truth,
+                       std::mt19937_64 *rng, LogRecord *record) {
+  std::normal_distribution<double> normal;
+  Measurement &meas = record->meas;
+  meas.timestamp_ = timestamp;
+  meas.sensor_type_ = sensor;
+  if (sensor == MeasurementPackage::LASER) {
+    meas.values_[0] = truth[0] + options.std_laspx * normal(*rng);
+    meas.values_[1] = truth[1] + options.std_laspy * normal(*rng);
+    meas.values_[2] = 0.0;
+  }
+  else {
+    const double rho = std::sqrt(truth[0] * truth[0] + truth[1] * truth[1]);
+    const double rho_dot =
+        rho > 1e-6 ? (truth[0] * truth[2] + truth[1] * truth[3]) / rho : 0.0;
+    meas.values_[0] = rho + options.std_radr * normal(*rng);
+    meas.values_[1] = NormalizeAngle(std::atan2(truth[1], truth[0]) +
+                                     options.std_radphi * normal(*rng));
+    meas.values_[2] = rho_dot + options.std_radrd * normal(*rng);
+  }
+  for (int k = 0; k < 4; k++) {
+    record->ground_truth[k] = truth[k];
+  }
+}
+
+void Scenario::Generate(const Options &options, std::vector<Sample> *samples) {
+  std::mt19937_64 rng(options.seed);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+  std::vector<Target> targets(options.targets);
+  for (size_t i = 0; i < targets.size(); i++) {
+    Target &target = targets[i];
+    //keep clear of the sensor, where the radar bearing is undefined
+    do {
+      target.x[0] = options.area * (2.0 * unit(rng) - 1.0);
+      target.x[1] = options.area * (2.0 * unit(rng) - 1.0);
+    } while (target.x[0] * target.x[0] + target.x[1] * target.x[1] < 4.0);
+    target.x[2] = options.max_speed * unit(rng);
+    target.x[3] = M_PI * (2.0 * unit(rng) - 1.0);
+    target.x[4] = options.max_yawd * (2.0 * unit(rng) - 1.0);
+    target.a = target.yawdd = 0.0;
+    target.time = target.next_draw = 0.0;
+  }
+
+  const size_t first = samples->size();
+  const double lidar_period =
+      options.lidar_hz > 0.0 ? 1.0 / options.lidar_hz : 0.0;
+  const double radar_period =
+      options.radar_hz > 0.0 ? 1.0 / options.radar_hz : 0.0;
+  long long lidar_scan = 0, radar_scan = 0;
+  while (true) {
+    //the next scan of either sensor, lidar first on a tie
+    const double lidar_t = lidar_period > 0.0 ? lidar_scan * lidar_period
+                                              : HUGE_VAL;
+    const double radar_t = radar_period > 0.0
+        ? (radar_scan + 0.5) * radar_period : HUGE_VAL;
+    const bool lidar = lidar_t <= radar_t;
+    const double t = lidar ? lidar_t : radar_t;
+    if (!(t <= options.duration)) {
+      break;
+    }
+    lidar ? ++lidar_scan : ++radar_scan;
+    const TimeUs timestamp = options.start_us + std::llround(t * 1e6);
+
+    for (size_t i = 0; i < targets.size(); i++) {
+      Advance(options, t, &rng, &targets[i]);
+      const double *x = targets[i].x;
+      const double truth[4] = {x[0], x[1], x[2] * cos(x[3]),
+                               x[2] * sin(x[3])};
+      Sample sample;
+      sample.target = static_cast<unsigned>(i);
+      Measure(options, lidar ? MeasurementPackage::LASER
+                             : MeasurementPackage::RADAR,
+              timestamp, truth, &rng, &sample.record);
+      //drawn for every measurement, so the noise sequence does not depend
+      //on the loss and delay settings
+      const double lost = unit(rng);
+      const double delayed = unit(rng);
+      const double delay = options.max_delay * unit(rng);
+      if (lost < options.dropout) {
+        continue;
+      }
+      sample.arrival_us = timestamp;
+      if (delayed < options.late) {
+        sample.arrival_us += std::llround(delay * 1e6);
+      }
+      samples->push_back(sample);
+    }
+  }
+
+  std::stable_sort(samples->begin() + first, samples->end(),
+                   [](const Sample &a, const Sample &b) {
+    return a.arrival_us < b.arrival_us;
+  });
+}
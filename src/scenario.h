@@ -0,0 +1,117 @@
+#ifndef SCENARIO_H_
+#define SCENARIO_H_
+
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "log_reader.h"
+
+/**
+ * Synthetic measurement streams for load and consistency testing: N
+ * targets moving as CTRV with random accelerations, seen by a lidar and a
+ * radar at the origin at fixed rates with Gaussian noise, some
+ * measurements lost and some delivered late.
+ *
+ * Every target is measured on each sensor scan (one scan sees the whole
+ * scene), the lidar at t = k / lidar_hz and the radar half a radar period
+ * later. The ground truth [x, y, vx, vy] of each record is the target's
+ * true state at the measurement time, so the output replays like the
+ * simulator's logs. A run depends only on the options: the same seed gives
+ * the same stream.
+ */
+class Scenario {
+public:
+  struct Options {
+    unsigned targets;
+    ///* simulated time in s, from start_us on
+    double duration;
+    TimeUs start_us;
+    ///* scans per second; 0 turns a sensor off
+    double lidar_hz;
+    double radar_hz;
+
+    ///* the targets' process noise: longitudinal acceleration in m/s^2 and
+    ///* yaw acceleration in rad/s^2, drawn anew every step_s
+    double std_a;
+    double std_yawdd;
+    double step_s;
+
+    ///* initial states: positions uniform over the square of half-width
+    ///* area m around the origin (at least 2 m out), speeds uniform in
+    ///* [0, max_speed] m/s, any heading, yaw rates within max_yawd rad/s
+    double area;
+    double max_speed;
+    double max_yawd;
+
+    ///* sensor noise, as in UKFConfig
+    double std_laspx;
+    double std_laspy;
+    double std_radr;
+    double std_radphi;
+    double std_radrd;
+
+    ///* fraction of measurements lost
+    double dropout;
+    ///* fraction delivered up to max_delay s late, after later ones
+    double late;
+    double max_delay;
+
+    uint64_t seed;
+
+    Options()
+        : targets(1),
+          duration(25.0),
+          start_us(1477010443000000),
+          lidar_hz(10.0),
+          radar_hz(10.0),
+          std_a(0.5),
+          std_yawdd(0.2),
+          step_s(0.01),
+          area(50.0),
+          max_speed(10.0),
+          max_yawd(0.3),
+          std_laspx(0.15),
+          std_laspy(0.15),
+          std_radr(0.3),
+          std_radphi(0.03),
+          std_radrd(0.3),
+          dropout(0.0),
+          late(0.0),
+          max_delay(0.2),
+          seed(1) {}
+  };
+
+  ///* one generated measurement, in delivery order
+  struct Sample {
+    unsigned target;
+    ///* when it is delivered; the measurement time plus any delay
+    TimeUs arrival_us;
+    LogRecord record;
+  };
+
+  /**
+   * Generates a whole run
+   * @param options Scene, sensors and delivery
+   * @param samples Measurements of every target, in delivery order
+   * (appended)
+   */
+  static void Generate(const Options &options, std::vector<Sample> *samples);
+
+  /**
+   * A noisy measurement of a known true state, with the sensor noise of
+   * options; applied to a log's ground truth it gives another independent
+   * replica of the same run
+   * @param options Sensor noise
+   * @param sensor Sensor to measure with
+   * @param timestamp Measurement time in us
+   * @param truth True [x, y, vx, vy]
+   * @param rng Random source
+   * @param record Filled with the measurement and the truth
+   */
+  static void Measure(const Options &options,
+                      MeasurementPackage::SensorType sensor, TimeUs timestamp,
+                      const double *truth, std::mt19937_64 *rng,
+                      LogRecord *record);
+};
+
+#endif /* SCENARIO_H_ */
@@ -0,0 +1,227 @@
+// Synthetic scenario generator: simulates CTRV targets seen by a lidar and
+// a radar (see Scenario) and writes the measurements for load testing the
+// filter, the association and the server.
+//
+//   ukf_scenario [--targets <n>] [--duration <s>] [--lidar-hz <hz>]
+//                [--radar-hz <hz>] [--std-a <m/s^2>] [--std-yawdd <rad/s^2>]
+//                [--std-laspx <m>] [--std-laspy <m>] [--std-radr <m>]
+//                [--std-radphi <rad>] [--std-radrd <m/s>] [--area <m>]
+//                [--max-speed <m/s>] [--dropout <fraction>]
+//                [--late <fraction>] [--max-delay <s>] [--seed <n>]
+//                [--text <file>] [--binary <file>] [--frames <file>]
+//                [--split]
+//
+// --text writes the simulator's "L px py ts gt..." / "R rho phi rho_dot ts
+// gt..." lines, --binary the same as a BinaryLog measurement file, both in
+// delivery order with every target's measurements interleaved. With
+// --split they are written per target instead, "<file>" becoming
+// "<file>-<target>" before the extension, so each replays with ukf_replay
+// (several at once as a multi-file run). --frames writes BinaryProtocol
+// measurement records with track id target + 1, as a client would stream
+// them to the server or over the Unix transport.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "binary_log.h"
+#include "binary_protocol.h"
+#include "buffered_writer.h"
+#include "scenario.h"
+
+namespace {
+
+// path with "-<target>" inserted before the extension
+std::string TargetPath(const char *path, unsigned target) {
+  std::string result(path);
+  const size_t slash = result.find_last_of('/');
+  size_t dot = result.find_last_of('.');
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    dot = result.size();
+  }
+  return result.insert(dot, "-" + std::to_string(target));
+}
+
+// writes records as measurement lines
+bool WriteText(const std::string &path,
+               const std::vector<LogRecord> &records) {
+  BufferedWriter out;
+  std::string error;
+  if (!out.Open(path.c_str(), &error)) {
+    std::cerr << error << std::endl;
+    return false;
+  }
+  for (size_t i = 0; i < records.size(); i++) {
+    const Measurement &meas = records[i].meas;
+    out.Append(meas.sensor_type_ == MeasurementPackage::RADAR ? 'R' : 'L');
+    for (int k = 0; k < meas.size(); k++) {
+      out.Append('\t');
+      out.AppendDouble(meas.values_[k]);
+    }
+    out.Append('\t');
+    out.AppendInteger(meas.timestamp_);
+    for (int k = 0; k < 4; k++) {
+      out.Append('\t');
+      out.AppendDouble(records[i].ground_truth[k]);
+    }
+    out.Append('\n');
+  }
+  if (!out.Close()) {
+    std::cerr << "Cannot write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// writes samples as BinaryProtocol measurement records
+bool WriteFrames(const char *path,
+                 const std::vector<Scenario::Sample> &samples) {
+  BufferedWriter out;
+  std::string error;
+  if (!out.Open(path, &error)) {
+    std::cerr << error << std::endl;
+    return false;
+  }
+  char record[BinaryProtocol::kMeasurementRecordSize];
+  for (size_t i = 0; i < samples.size(); i++) {
+    const Eigen::Vector4d truth(samples[i].record.ground_truth);
+    BinaryProtocol::EncodeMeasurement(samples[i].target + 1,
+                                      samples[i].record.meas, &truth, record);
+    out.Append(record, sizeof(record));
+  }
+  if (!out.Close()) {
+    std::cerr << "Cannot write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// writes records as text and/or a binary log; an empty path is skipped
+bool WriteLog(const std::string &text_path, const std::string &binary_path,
+              const std::vector<LogRecord> &records) {
+  if (!text_path.empty() && !WriteText(text_path, records)) {
+    return false;
+  }
+  if (!binary_path.empty() &&
+      !BinaryLog::WriteMeasurements(binary_path.c_str(), records)) {
+    std::cerr << "Cannot write " << binary_path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  Scenario::Options options;
+  const char *text_path = nullptr;
+  const char *binary_path = nullptr;
+  const char *frames_path = nullptr;
+  bool split = false;
+  struct Flag {
+    const char *name;
+    double *value;
+  };
+  const Flag flags[] = {
+    {"--duration", &options.duration},
+    {"--lidar-hz", &options.lidar_hz},
+    {"--radar-hz", &options.radar_hz},
+    {"--std-a", &options.std_a},
+    {"--std-yawdd", &options.std_yawdd},
+    {"--std-laspx", &options.std_laspx},
+    {"--std-laspy", &options.std_laspy},
+    {"--std-radr", &options.std_radr},
+    {"--std-radphi", &options.std_radphi},
+    {"--std-radrd", &options.std_radrd},
+    {"--area", &options.area},
+    {"--max-speed", &options.max_speed},
+    {"--dropout", &options.dropout},
+    {"--late", &options.late},
+    {"--max-delay", &options.max_delay},
+  };
+  for (int i = 1; i < argc; ++i) {
+    bool matched = false;
+    for (const Flag &flag : flags) {
+      if (strcmp(argv[i], flag.name) == 0 && i + 1 < argc) {
+        *flag.value = atof(argv[++i]);
+        matched = true;
+        break;
+      }
+    }
+    if (matched) {
+      continue;
+    }
+    if (strcmp(argv[i], "--targets") == 0 && i + 1 < argc) {
+      options.targets = static_cast<unsigned>(atol(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      options.seed = strtoull(argv[++i], nullptr, 10);
+    }
+    else if (strcmp(argv[i], "--text") == 0 && i + 1 < argc) {
+      text_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc) {
+      binary_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--split") == 0) {
+      split = true;
+    }
+    else {
+      std::cerr << "usage: ukf_scenario [--targets <n>] [--duration <s>] "
+                << "[--lidar-hz <hz>] [--radar-hz <hz>] [--std-a <m/s^2>] "
+                << "[--std-yawdd <rad/s^2>] [--std-laspx <m>] "
+                << "[--std-laspy <m>] [--std-radr <m>] [--std-radphi <rad>] "
+                << "[--std-radrd <m/s>] [--area <m>] [--max-speed <m/s>] "
+                << "[--dropout <fraction>] [--late <fraction>] "
+                << "[--max-delay <s>] [--seed <n>] [--text <file>] "
+                << "[--binary <file>] [--frames <file>] [--split]"
+                << std::endl;
+      return 2;
+    }
+  }
+  if (!text_path && !binary_path && !frames_path) {
+    std::cerr << "nothing to write: give --text, --binary or --frames"
+              << std::endl;
+    return 2;
+  }
+
+  std::vector<Scenario::Sample> samples;
+  Scenario::Generate(options, &samples);
+
+  if (split) {
+    std::vector<std::vector<LogRecord> > per_target(options.targets);
+    for (size_t i = 0; i < samples.size(); i++) {
+      per_target[samples[i].target].push_back(samples[i].record);
+    }
+    for (unsigned t = 0; t < options.targets; t++) {
+      if (!WriteLog(text_path ? TargetPath(text_path, t) : std::string(),
+                    binary_path ? TargetPath(binary_path, t) : std::string(),
+                    per_target[t])) {
+        return 1;
+      }
+    }
+  }
+  else {
+    std::vector<LogRecord> records;
+    records.reserve(samples.size());
+    for (size_t i = 0; i < samples.size(); i++) {
+      records.push_back(samples[i].record);
+    }
+    if (!WriteLog(text_path ? text_path : "", binary_path ? binary_path : "",
+                  records)) {
+      return 1;
+    }
+  }
+  if (frames_path && !WriteFrames(frames_path, samples)) {
+    return 1;
+  }
+  printf("targets %u measurements %zu\n", options.targets, samples.size());
+  return 0;
+}
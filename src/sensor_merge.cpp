@@ -0,0 +1,95 @@
+#include "sensor_merge.h"
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+// heap order: the earliest head on top, ties to the lower sensor index so
+// simultaneous measurements come out in a fixed order
+struct Later {
+  template <typename Head>
+  bool operator()(const Head &a, const Head &b) const {
+    return a.timestamp != b.timestamp ? a.timestamp > b.timestamp
+                                      : a.sensor > b.sensor;
+  }
+};
+
+}  // namespace
+
+SensorMerge::SensorMerge(int sensors, size_t capacity, TimeUs window)
+    : window_(window),
+      in_heap_(sensors, false),
+      last_delivered_(LLONG_MIN),
+      delivered_(0),
+      late_(0) {
+  for (int s = 0; s < sensors; s++) {
+    queues_.emplace_back(new SpscQueue<Measurement>(capacity));
+  }
+  heap_.reserve(sensors);
+}
+
+SensorMerge::~SensorMerge() {}
+
+bool SensorMerge::Push(int sensor, const Measurement &meas) {
+  return queues_[sensor]->TryPush(meas);
+}
+
+size_t SensorMerge::Poll(TimeUs now, const Deliver &deliver) {
+  return Merge(false, now, deliver);
+}
+
+size_t SensorMerge::Flush(const Deliver &deliver) {
+  return Merge(true, 0, deliver);
+}
+
+void SensorMerge::Refill() {
+  for (size_t s = 0; s < queues_.size(); s++) {
+    if (in_heap_[s]) {
+      continue;
+    }
+    const Measurement *front = queues_[s]->Front();
+    if (front) {
+      Head head = {front->timestamp_, static_cast<int>(s)};
+      heap_.push_back(head);
+      std::push_heap(heap_.begin(), heap_.end(), Later());
+      in_heap_[s] = true;
+    }
+  }
+}
+
+size_t SensorMerge::Merge(bool flush, TimeUs now,
+                          const Deliver &deliver) {
+  size_t count = 0;
+  while (true) {
+    //streams that were empty may have something by now
+    if (heap_.size() < queues_.size()) {
+      Refill();
+    }
+    if (heap_.empty()) {
+      break;
+    }
+    //with every stream queued the earliest head cannot be preceded; with
+    //one silent, only once the window is over
+    const Head top = heap_.front();
+    if (!flush && heap_.size() < queues_.size() &&
+        now - top.timestamp < window_) {
+      break;
+    }
+
+    std::pop_heap(heap_.begin(), heap_.end(), Later());
+    heap_.pop_back();
+    in_heap_[top.sensor] = false;
+    Measurement meas;
+    queues_[top.sensor]->TryPop(&meas);
+    if (meas.timestamp_ < last_delivered_) {
+      ++late_;
+    }
+    else {
+      last_delivered_ = meas.timestamp_;
+    }
+    ++delivered_;
+    ++count;
+    deliver(top.sensor, meas);
+  }
+  return count;
+}
@@ -0,0 +1,104 @@
+#ifndef SENSOR_MERGE_H_
+#define SENSOR_MERGE_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include "measurement_package.h"
+#include "spsc_queue.h"
+
+/**
+ * Merges per-sensor measurement streams into one in timestamp order, for
+ * sensors that arrive on their own connections or threads.
+ *
+ * Every sensor has its own SpscQueue, so each producer pushes without a
+ * lock and without touching the others; a single consumer keeps the queue
+ * heads in a min-heap and hands out the earliest. Each stream is assumed
+ * to be in order on its own, so the earliest head is safe to hand out once
+ * every other sensor has a later one queued. A sensor that has nothing
+ * queued is waited for only while the window lasts: once the clock the
+ * consumer passes to Poll is window past the earliest head's timestamp,
+ * the head goes out anyway. That clock is in the measurements' time base:
+ * the wall clock for sensors that stamp at capture, so no measurement
+ * waits more than window after it was taken, or the replay clock, so a
+ * replay merges the same way however fast it runs.
+ *
+ * A measurement older than one already handed out (a sensor that fell
+ * further behind than the window) is still handed out, in its turn, and
+ * counted in late(); the filter's own out-of-sequence handling takes it
+ * from there.
+ */
+class SensorMerge {
+public:
+  typedef std::function<void(int sensor, const Measurement &meas)> Deliver;
+
+  /**
+   * Constructor
+   * @param sensors Number of input streams
+   * @param capacity Slots in each stream's queue
+   * @param window Longest wait in us for a sensor with nothing queued
+   */
+  SensorMerge(int sensors, size_t capacity, TimeUs window);
+
+  /**
+   * Destructor
+   */
+  virtual ~SensorMerge();
+
+  /**
+   * Producer side, one thread per sensor: queues a measurement
+   * @param sensor Stream index
+   * @param meas Measurement, not older than the stream's previous one
+   * @return false if the stream's queue is full
+   */
+  bool Push(int sensor, const Measurement &meas);
+
+  /**
+   * Consumer side: hands out, in timestamp order, every queued measurement
+   * that no stream can still precede within the window
+   * @param now Current time in us, in the measurements' time base
+   * @param deliver Called once per measurement, e.g. to ProcessMeasurement
+   * @return Number of measurements delivered
+   */
+  size_t Poll(TimeUs now, const Deliver &deliver);
+
+  /**
+   * Consumer side: hands out everything queued, in timestamp order, without
+   * waiting for silent streams; for the end of the input
+   * @param deliver As for Poll
+   * @return Number of measurements delivered
+   */
+  size_t Flush(const Deliver &deliver);
+
+  int sensors() const { return static_cast<int>(queues_.size()); }
+
+  ///* Measurements handed out so far, and those older than one before them
+  unsigned long long delivered() const { return delivered_; }
+  unsigned long long late() const { return late_; }
+
+private:
+  struct Head {
+    TimeUs timestamp;
+    int sensor;
+  };
+
+  // puts the head of every stream that is not in the heap yet into it
+  void Refill();
+  // hands out heads while they are due at now; all of them if flush is set
+  size_t Merge(bool flush, TimeUs now, const Deliver &deliver);
+
+  std::vector<std::unique_ptr<SpscQueue<Measurement> > > queues_;
+  const TimeUs window_;
+
+  ///* heads of non-empty streams, earliest first; which streams are in it
+  std::vector<Head> heap_;
+  std::vector<bool> in_heap_;
+
+  ///* newest timestamp handed out
+  TimeUs last_delivered_;
+
+  unsigned long long delivered_;
+  unsigned long long late_;
+};
+
+#endif /* SENSOR_MERGE_H_ */
@@ -0,0 +1,82 @@
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * A value with one writer and any number of readers that never block it.
+ *
+ * The writer makes the sequence number odd, copies the value in and makes
+ * it even again; a reader copies the value out between two reads of the
+ * sequence and retries if it changed or was odd, so it never returns a torn
+ * value and the writer never waits. The value is held in relaxed atomic
+ * words rather than plain memory, which keeps concurrent copies free of
+ * data races in the C++ memory model at no cost on x86 and ARM.
+ *
+ * Suits small, frequently written and more rarely read values: a reader
+ * may retry while the writer is busy, but the writer's cost is two stores
+ * and the copy.
+ */
+template <typename T>
+class Seqlock {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Seqlock values are copied word by word");
+
+public:
+  Seqlock() : sequence_(0) {
+    for (size_t i = 0; i < kWords; i++) {
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Writer side, one thread: replaces the value
+   */
+  void Store(const T &value) {
+    uint64_t buffer[kWords] = {};
+    memcpy(buffer, &value, sizeof(T));
+    const uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kWords; i++) {
+      words_[i].store(buffer[i], std::memory_order_relaxed);
+    }
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  /**
+   * Reader side, any thread: a consistent copy of the value, retrying while
+   * a Store overlaps
+   */
+  void Load(T *value) const {
+    uint64_t buffer[kWords];
+    uint64_t before, after;
+    do {
+      before = sequence_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < kWords; i++) {
+        buffer[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    memcpy(value, buffer, sizeof(T));
+  }
+
+  /**
+   * Number of Stores so far; any thread
+   */
+  uint64_t version() const {
+    return sequence_.load(std::memory_order_acquire) >> 1;
+  }
+
+private:
+  static const size_t kWords = (sizeof(T) + 7) / 8;
+
+  std::atomic<uint64_t> sequence_;
+  std::atomic<uint64_t> words_[kWords];
+};
+
+#endif /* SEQLOCK_H_ */
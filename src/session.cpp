@@ -0,0 +1,175 @@
+#include "session.h"
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include "binary_protocol.h"
+#include "metrics.h"
+
+namespace {
+
+std::atomic<unsigned long long> g_next_session_id(1);
+
+}  // namespace
+
+Session::Session(const UKF &prototype, size_t history_capacity,
+                 bool evaluate)
+    : id_(g_next_session_id.fetch_add(1, std::memory_order_relaxed)),
+      evaluate_(evaluate),
+      tracks_(prototype),
+      estimations_(evaluate ? history_capacity : 1),
+      ground_truth_(evaluate ? history_capacity : 1),
+      clock_offset_ns_(LLONG_MIN),
+      anchor_timestamp_(LLONG_MIN),
+      anchor_ns_(0),
+      accounted_(),
+      memory_countdown_(0) {
+  parser_.set_parse_ground_truth(evaluate);
+  AccountMemory(true);
+}
+
+Session::~Session() {
+  Metrics::AddMemory(Metrics::MEMORY_TRACKS,
+                     -static_cast<long long>(accounted_.tracks));
+  Metrics::AddMemory(Metrics::MEMORY_HISTORY,
+                     -static_cast<long long>(accounted_.history));
+  Metrics::AddMemory(Metrics::MEMORY_BUFFERS,
+                     -static_cast<long long>(accounted_.buffers));
+  Metrics::AddTracks(-static_cast<long long>(accounted_.track_count));
+}
+
+void Session::Reset(const UKF &prototype) {
+  id_ = g_next_session_id.fetch_add(1, std::memory_order_relaxed);
+  tracks_.Reset(prototype);
+  estimations_.clear();
+  ground_truth_.clear();
+  reply_.clear();
+  reply_stamps_.clear();
+  response_.Clear();
+  batch_.Clear();
+  batch_stamps_.clear();
+  stream_.Clear();
+  published_.clear();
+  clock_offset_ns_ = LLONG_MIN;
+  anchor_timestamp_ = LLONG_MIN;
+  anchor_ns_ = 0;
+  AccountMemory(true);
+}
+
+size_t Session::ProcessRecords(const char *data, size_t count,
+                               const LatencyTrace::Stamps *received) {
+  reply_.resize(count * BinaryProtocol::kEstimateRecordSize);
+  char *out = reply_.data();
+  for (size_t i = 0; i < count; i++) {
+    unsigned id;
+    Measurement meas;
+    Eigen::Vector4d gt_values;
+    if (!BinaryProtocol::DecodeMeasurement(
+            data + i * BinaryProtocol::kMeasurementRecordSize,
+            BinaryProtocol::kMeasurementRecordSize, &id, &meas, &gt_values)) {
+      continue;
+    }
+    TrackTable::Track &track = tracks_.Get(id);
+    Eigen::Vector4d estimate;
+    //the record's own stamps, so its filter can add to them
+    if (received) {
+      reply_stamps_.push_back(*received);
+      LatencyTrace::Enter(&reply_stamps_.back());
+    }
+    if (evaluate_) {
+      track.Process(meas, gt_values, &estimate);
+    }
+    else {
+      track.Process(meas, &estimate);
+    }
+    LatencyTrace::Leave();
+    BinaryProtocol::EncodeEstimate(id, meas.timestamp_, estimate,
+                                   track.rmse.RMSE(), out);
+    out += BinaryProtocol::kEstimateRecordSize;
+    if (received) {
+      LatencyTrace::Stamps &stamps = reply_stamps_.back();
+      LatencyTrace::Stamp(&stamps, LatencyTrace::FILTERED);
+      stamps.timestamp = meas.timestamp_;
+      stamps.track_id = id;
+      LatencyTrace::Stamp(&stamps, LatencyTrace::SERIALIZED);
+    }
+  }
+  AccountMemory();
+  return out - reply_.data();
+}
+
+bool Session::Publish(long long now_ns) {
+  TimeUs newest = LLONG_MIN;
+  tracks_.ForEach([&newest](unsigned, const TrackTable::Track &track) {
+    if (track.ukf.initialized() && track.ukf.timestamp() > newest) {
+      newest = track.ukf.timestamp();
+    }
+  });
+  published_.clear();
+  if (newest == LLONG_MIN) {
+    stream_.Clear();
+    return false;
+  }
+  if (newest != anchor_timestamp_) {
+    anchor_timestamp_ = newest;
+    anchor_ns_ = now_ns;
+  }
+  const TimeUs publish_time = anchor_timestamp_ +
+                              (now_ns - anchor_ns_) / 1000;
+
+  stream_.TracksBegin(id_, publish_time);
+  tracks_.ForEach([this, publish_time](unsigned id,
+                                       const TrackTable::Track &track) {
+    const UKF &ukf = track.ukf;
+    if (!ukf.initialized()) {
+      return;
+    }
+    UKF::StateVector x = ukf.x();
+    const double horizon = ToSeconds(publish_time - ukf.timestamp());
+    if (horizon > 0.0) {
+      ukf.PredictAhead(&horizon, 1, &x, nullptr);
+    }
+    const double v = x(2);
+    const double yaw = x(3);
+    const double estimate[4] = {x(0), x(1), v * std::cos(yaw),
+                                v * std::sin(yaw)};
+    stream_.TrackEstimate(id, estimate);
+    RegionIndex::Entry entry = {id_, id, publish_time,
+                                {estimate[0], estimate[1], estimate[2],
+                                 estimate[3]}};
+    published_.push_back(entry);
+  });
+  stream_.FinishTracks();
+  return true;
+}
+
+Session::MemoryUsage Session::Memory() const {
+  MemoryUsage usage;
+  usage.tracks = tracks_.MemoryBytes();
+  usage.history = estimations_.MemoryBytes() + ground_truth_.MemoryBytes();
+  usage.buffers = sizeof(Session) + parser_.MemoryBytes() +
+                  reply_.capacity() + response_.MemoryBytes() +
+                  batch_.MemoryBytes() + stream_.MemoryBytes() +
+                  (reply_stamps_.capacity() + batch_stamps_.capacity()) *
+                      sizeof(LatencyTrace::Stamps) +
+                  published_.capacity() * sizeof(RegionIndex::Entry);
+  usage.track_count = tracks_.size();
+  return usage;
+}
+
+void Session::AccountMemory(bool force) {
+  if (!force && --memory_countdown_ > 0) {
+    return;
+  }
+  memory_countdown_ = kMemoryInterval;
+  const MemoryUsage usage = Memory();
+  //unsigned differences wrap, and the casts turn them back into signed ones
+  Metrics::AddMemory(Metrics::MEMORY_TRACKS,
+                     static_cast<long long>(usage.tracks - accounted_.tracks));
+  Metrics::AddMemory(Metrics::MEMORY_HISTORY, static_cast<long long>(
+                         usage.history - accounted_.history));
+  Metrics::AddMemory(Metrics::MEMORY_BUFFERS, static_cast<long long>(
+                         usage.buffers - accounted_.buffers));
+  Metrics::AddTracks(
+      static_cast<long long>(usage.track_count - accounted_.track_count));
+  accounted_ = usage;
+}
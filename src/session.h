@@ -0,0 +1,144 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <vector>
+#include "Eigen/Dense"
+#include "latency_trace.h"
+#include "response_writer.h"
+#include "region_index.h"
+#include "ring_buffer.h"
+#include "telemetry_parser.h"
+#include "track_table.h"
+#include "ukf.h"
+
+/**
+ * Everything one client connection owns: its tracks, the bounded
+ * estimate/ground-truth history of its text stream, its frame parser and
+ * its reply buffer. Sessions share nothing, so independent feeds can run
+ * side by side in one server.
+ */
+class Session {
+public:
+  /**
+   * Constructor
+   * @param prototype Filter configuration for new tracks
+   * @param history_capacity Estimate/ground-truth pairs kept
+   * @param evaluate If false, ground truth is neither parsed nor kept and no
+   * RMSE is computed: production feeds have none
+   */
+  Session(const UKF &prototype, size_t history_capacity, bool evaluate = true);
+
+  /**
+   * Destructor
+   */
+  virtual ~Session();
+
+  /**
+   * Filters consecutive binary measurement records inline and encodes an
+   * estimate record for each into reply_; malformed records are skipped
+   * @param data BinaryProtocol measurement records
+   * @param count Number of records
+   * @param received Stamps of the frame, copied into reply_stamps_ for
+   * each record filtered; null to trace nothing
+   * @return Bytes of estimate records written to reply_
+   */
+  size_t ProcessRecords(const char *data, size_t count,
+                        const LatencyTrace::Stamps *received = nullptr);
+
+  /**
+   * Returns the session to its just-constructed state for another client,
+   * with a new id, keeping the capacity of every buffer and the storage of
+   * its tracks
+   * @param prototype Filter configuration for new tracks
+   */
+  void Reset(const UKF &prototype);
+
+  /**
+   * Formats 42["tracks",{...}] into stream_: the estimate of every
+   * initialised track, predicted without touching the filters to one
+   * publish time in the measurement clock. That clock is followed from the
+   * newest measurement seen at each call plus the steady-clock time since,
+   * so the publish time lags the producer by at most one publish period.
+   * @param now_ns Steady clock in ns
+   * The same estimates go to published_, stamped with the publish time.
+   * @return false, with stream_ and published_ empty, if no track is
+   *         initialised
+   */
+  bool Publish(long long now_ns);
+
+  ///* Bytes the session holds, by what holds them, and its track count
+  struct MemoryUsage {
+    size_t tracks;
+    size_t history;
+    size_t buffers;
+    size_t track_count;
+  };
+
+  MemoryUsage Memory() const;
+
+  /**
+   * Pushes the change in Memory() since the last call into the process-wide
+   * gauges (see Metrics::AddMemory). Measuring walks every track, so it is
+   * done only once every kMemoryInterval calls unless forced. Call it from
+   * the thread filtering the session.
+   * @param force Measure now
+   */
+  void AccountMemory(bool force = false);
+
+  ///* calls of AccountMemory between measurements
+  static const int kMemoryInterval = 256;
+
+  ///* unique within the process; names the session in published streams
+  unsigned long long id_;
+
+  ///* whether estimates are scored against ground truth
+  const bool evaluate_;
+
+  ///* filters, keyed by track id; the Socket.IO stream is track 0
+  TrackTable tracks_;
+
+  ///* bounded history of the Socket.IO stream; one slot each and unused
+  ///* without evaluate_
+  RingBuffer<Eigen::Vector4d> estimations_;
+  RingBuffer<Eigen::Vector4d> ground_truth_;
+
+  ///* parses this connection's text frames in place
+  TelemetryParser parser_;
+
+  ///* binary reply, reused across frames
+  std::vector<char> reply_;
+  ///* latency stamps of the estimates in reply_, recorded when it is sent
+  std::vector<LatencyTrace::Stamps> reply_stamps_;
+
+  ///* text reply, reused across frames
+  ResponseWriter response_;
+
+  ///* text replies waiting to go out as one estimate_batch frame
+  ResponseWriter batch_;
+  ///* latency stamps of the replies in batch_
+  std::vector<LatencyTrace::Stamps> batch_stamps_;
+
+  ///* the last Publish, and its estimates one by one for filtered
+  ///* subscriptions
+  ResponseWriter stream_;
+  std::vector<RegionIndex::Entry> published_;
+
+  ///* lowest steady clock minus sensor clock seen, in ns, for the
+  ///* pipeline's deadlines; LLONG_MIN before the first measurement
+  long long clock_offset_ns_;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  // newest measurement time at the last Publish, and the steady clock in ns
+  // when it was first seen
+  TimeUs anchor_timestamp_;
+  long long anchor_ns_;
+
+  ///* what the gauges hold for this session, and calls of AccountMemory
+  ///* left before the next measurement
+  MemoryUsage accounted_;
+  int memory_countdown_;
+};
+
+#endif /* SESSION_H_ */
@@ -0,0 +1,289 @@
+#include "session_executor.h"
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <thread>
+#include "cpu_affinity.h"
+#include "logger.h"
+
+namespace {
+
+// results waiting for the I/O thread before sessions wait for room
+const size_t kResultCapacity = 4096;
+
+// A session's coroutine. It starts suspended, to be resumed on its worker,
+// and frees its frame when it returns after a CLOSE.
+struct SessionTask {
+  struct promise_type {
+    SessionTask get_return_object() {
+      return SessionTask{
+          std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+bool IsMeasurement(const Pipeline::Job &job) {
+  return job.kind == Pipeline::TEXT || job.kind == Pipeline::BINARY;
+}
+
+}  // namespace
+
+struct SessionExecutor::Mailbox {
+  Worker *worker;
+  std::mutex mutex;
+  std::deque<Pipeline::Job> jobs;
+  // the frame suspended in NextJob; null while it runs or is ready to
+  void *waiting;
+};
+
+struct SessionExecutor::Worker {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<void *> ready;
+  bool stop;
+  int cpu;
+  std::thread thread;
+
+  void Run() {
+    if (cpu >= 0 && !CpuAffinity::PinCurrentThread(cpu)) {
+      UKF_LOG_WARN("Cannot pin session executor to CPU %d", cpu);
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cv.wait(lock, [this]() { return stop || !ready.empty(); });
+      if (stop) {
+        break;
+      }
+      void *frame = ready.front();
+      ready.pop_front();
+      lock.unlock();
+      //runs the session until it waits again or ends
+      std::coroutine_handle<>::from_address(frame).resume();
+      lock.lock();
+    }
+  }
+};
+
+// The session's next job: taken at once if one is queued, otherwise the
+// coroutine parks in the mailbox and Submit schedules it with the job
+struct SessionExecutor::NextJob {
+  Mailbox *mailbox;
+  Pipeline::Job job;
+  bool taken;
+
+  bool Take() {
+    if (mailbox->jobs.empty()) {
+      return false;
+    }
+    job = mailbox->jobs.front();
+    mailbox->jobs.pop_front();
+    taken = true;
+    return true;
+  }
+
+  bool await_ready() {
+    std::lock_guard<std::mutex> lock(mailbox->mutex);
+    return Take();
+  }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> lock(mailbox->mutex);
+    if (Take()) {
+      return false;
+    }
+    mailbox->waiting = handle.address();
+    return true;
+  }
+
+  Pipeline::Job await_resume() {
+    if (!taken) {
+      std::lock_guard<std::mutex> lock(mailbox->mutex);
+      Take();
+    }
+    return job;
+  }
+};
+
+// Room in the result ring: the push is retried under the waiters' lock, so
+// a Drain that frees room either sees this waiter or made the push succeed
+struct SessionExecutor::ResultRoom {
+  SessionExecutor *executor;
+  Worker *worker;
+  const Pipeline::Result *result;
+  bool pushed;
+
+  bool await_ready() { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> lock(executor->room_mutex_);
+    if (executor->results_.TryPush(*result)) {
+      pushed = true;
+      return false;
+    }
+    executor->waiting_room_.push_back(
+        std::make_pair(worker, handle.address()));
+    return true;
+  }
+
+  bool await_resume() { return pushed; }
+};
+
+struct SessionExecutor::Coroutine {
+  static SessionTask Run(SessionExecutor *executor, Mailbox *mailbox) {
+    while (true) {
+      Pipeline::Job job = co_await NextJob{mailbox, Pipeline::Job(), false};
+      if (IsMeasurement(job)) {
+        LatencyTrace::Stamp(&job.trace, LatencyTrace::STARTED);
+      }
+      Pipeline::Result result;
+      Pipeline::Process(job, &result);
+      bool pushed = executor->results_.TryPush(result);
+      while (!pushed) {
+        executor->output_stalls_.fetch_add(1, std::memory_order_relaxed);
+        pushed = co_await ResultRoom{executor, mailbox->worker, &result,
+                                     false};
+      }
+      executor->notify_();
+      //the I/O thread frees the mailbox once it has the CLOSE result
+      if (job.kind == Pipeline::CLOSE) {
+        co_return;
+      }
+    }
+  }
+};
+
+SessionExecutor::SessionExecutor(int threads,
+                                 const std::function<void()> &notify,
+                                 const std::vector<int> &cpus)
+    : notify_(notify),
+      results_(kResultCapacity),
+      submitted_(0),
+      completed_(0),
+      output_stalls_(0) {
+  for (int i = 0; i < threads; i++) {
+    std::unique_ptr<Worker> worker(new Worker());
+    worker->stop = false;
+    worker->cpu = static_cast<size_t>(i) < cpus.size() ? cpus[i] : -1;
+    workers_.push_back(std::move(worker));
+  }
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Worker *worker = workers_[i].get();
+    worker->thread = std::thread([worker]() { worker->Run(); });
+  }
+}
+
+SessionExecutor::~SessionExecutor() {
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Worker *worker = workers_[i].get();
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      worker->stop = true;
+    }
+    worker->cv.notify_one();
+    worker->thread.join();
+  }
+  //with the threads gone every live frame is suspended in exactly one of
+  //these places
+  for (size_t i = 0; i < workers_.size(); i++) {
+    for (size_t k = 0; k < workers_[i]->ready.size(); k++) {
+      std::coroutine_handle<>::from_address(workers_[i]->ready[k]).destroy();
+    }
+  }
+  for (size_t i = 0; i < waiting_room_.size(); i++) {
+    std::coroutine_handle<>::from_address(waiting_room_[i].second).destroy();
+  }
+  for (auto it = mailboxes_.begin(); it != mailboxes_.end(); ++it) {
+    if (it->second->waiting) {
+      std::coroutine_handle<>::from_address(it->second->waiting).destroy();
+    }
+  }
+}
+
+SessionExecutor::Worker *SessionExecutor::For(const Session *session) const {
+  unsigned long long h = session->id_ * 0x9E3779B97F4A7C15ULL;
+  return workers_[(h >> 32) % workers_.size()].get();
+}
+
+void SessionExecutor::Schedule(Worker *worker, void *frame) {
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->ready.push_back(frame);
+  }
+  worker->cv.notify_one();
+}
+
+void SessionExecutor::Start(Mailbox *mailbox) {
+  SessionTask task = Coroutine::Run(this, mailbox);
+  Schedule(mailbox->worker, task.handle.address());
+}
+
+void SessionExecutor::Submit(const Pipeline::Job &job) {
+  submitted_.fetch_add(1, std::memory_order_relaxed);
+  Pipeline::Job queued = job;
+  if (IsMeasurement(queued)) {
+    LatencyTrace::Stamp(&queued.trace, LatencyTrace::QUEUED);
+  }
+  std::unique_ptr<Mailbox> &slot = mailboxes_[job.session];
+  const bool start = !slot;
+  if (start) {
+    slot.reset(new Mailbox());
+    slot->worker = For(job.session);
+    slot->waiting = nullptr;
+  }
+  Mailbox *mailbox = slot.get();
+  void *frame;
+  {
+    std::lock_guard<std::mutex> lock(mailbox->mutex);
+    mailbox->jobs.push_back(queued);
+    frame = mailbox->waiting;
+    mailbox->waiting = nullptr;
+  }
+  if (start) {
+    Start(mailbox);
+  }
+  else if (frame) {
+    Schedule(mailbox->worker, frame);
+  }
+}
+
+size_t SessionExecutor::Drain(
+    const std::function<void(const Pipeline::Result &)> &deliver) {
+  size_t delivered = 0;
+  Pipeline::Result result;
+  while (results_.TryPop(&result)) {
+    completed_.fetch_add(1, std::memory_order_relaxed);
+    if (result.kind == Pipeline::CLOSE) {
+      mailboxes_.erase(result.session);
+    }
+    deliver(result);
+    ++delivered;
+  }
+  if (delivered) {
+    {
+      std::lock_guard<std::mutex> lock(room_mutex_);
+      resuming_.swap(waiting_room_);
+    }
+    for (size_t i = 0; i < resuming_.size(); i++) {
+      Schedule(resuming_[i].first, resuming_[i].second);
+    }
+    resuming_.clear();
+  }
+  return delivered;
+}
+
+Pipeline::Stats SessionExecutor::stats() const {
+  Pipeline::Stats stats = Pipeline::Stats();
+  stats.submitted = submitted_.load(std::memory_order_relaxed);
+  stats.completed = completed_.load(std::memory_order_relaxed);
+  stats.output_stalls = output_stalls_.load(std::memory_order_relaxed);
+  stats.queued = static_cast<size_t>(stats.submitted - stats.completed);
+  stats.memory_bytes = results_.capacity() * sizeof(Pipeline::Result);
+  return stats;
+}
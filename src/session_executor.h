@@ -0,0 +1,106 @@
+#ifndef SESSION_EXECUTOR_H_
+#define SESSION_EXECUTOR_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "mpsc_queue.h"
+#include "pipeline.h"
+
+/**
+ * Filters a hub's sessions as coroutines on a few executor threads, one
+ * per core, as an alternative to a Pipeline worker per event loop
+ * (--executor coroutines, built with UKF_COROUTINES).
+ *
+ * Each session's processing is one coroutine: it awaits the session's next
+ * job, filters it with Pipeline::Process, and awaits room in the result
+ * ring when the I/O thread falls behind, instead of blocking its thread.
+ * A waiting session is only a suspended frame; there is no thread per
+ * session, and an executor thread only runs sessions that have work.
+ * Sessions stay on the executor chosen by a hash of their id, so their jobs
+ * come out in order and their filters stay in that core's caches.
+ *
+ * Jobs and results are a Pipeline's and the I/O thread submits and drains
+ * them the same way. A CLOSE job ends the session's coroutine; the next job
+ * for that session starts a new one. No overload policy applies: a job
+ * always waits for its turn. The coroutines are C++20, confined to
+ * session_executor.cpp; this header is C++17 like the rest of the server.
+ */
+class SessionExecutor {
+public:
+  /**
+   * Constructor; starts the executor threads
+   * @param threads Number of executor threads
+   * @param notify Called from any executor thread whenever results are
+   * ready; must be thread safe (e.g. waking the event loop)
+   * @param cpus CPU of each thread, or -1 to let it float
+   */
+  SessionExecutor(int threads, const std::function<void()> &notify,
+                  const std::vector<int> &cpus);
+
+  /**
+   * Destructor; stops the threads and destroys the suspended sessions'
+   * coroutines. Jobs still queued are dropped.
+   */
+  virtual ~SessionExecutor();
+
+  /**
+   * I/O thread: queues a job for its session's coroutine, starting one if
+   * the session has none
+   */
+  void Submit(const Pipeline::Job &job);
+
+  /**
+   * I/O thread: hands every available result to deliver, then resumes the
+   * sessions that were waiting for room
+   * @return Number of results delivered
+   */
+  size_t Drain(const std::function<void(const Pipeline::Result &)> &deliver);
+
+  /**
+   * The counters of Pipeline::Stats that apply: submitted, completed,
+   * output_stalls (times a session waited for room), queued and
+   * memory_bytes
+   */
+  Pipeline::Stats stats() const;
+
+private:
+  // one session's queued jobs and its coroutine, if suspended on them
+  struct Mailbox;
+  // an executor thread and its ready coroutines
+  struct Worker;
+  // a session's coroutine and what it awaits
+  struct Coroutine;
+  struct NextJob;
+  struct ResultRoom;
+
+  // starts the coroutine of a session on a worker
+  void Start(Mailbox *mailbox);
+
+  // queues a coroutine frame to be resumed on its worker
+  void Schedule(Worker *worker, void *frame);
+
+  // the worker of a session (Fibonacci hashing spreads sequential ids)
+  Worker *For(const Session *session) const;
+
+  std::vector<std::unique_ptr<Worker> > workers_;
+  std::function<void()> notify_;
+  // I/O thread only; a mailbox lives until its CLOSE result is drained
+  std::unordered_map<const Session *, std::unique_ptr<Mailbox> > mailboxes_;
+
+  MpscQueue<Pipeline::Result> results_;
+  // frames waiting for room in results_, and their workers
+  std::mutex room_mutex_;
+  std::vector<std::pair<Worker *, void *> > waiting_room_;
+  // I/O thread: the waiters being resumed by Drain
+  std::vector<std::pair<Worker *, void *> > resuming_;
+
+  std::atomic<unsigned long long> submitted_;
+  std::atomic<unsigned long long> completed_;
+  std::atomic<unsigned long long> output_stalls_;
+};
+
+#endif /* SESSION_EXECUTOR_H_ */
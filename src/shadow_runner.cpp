@@ -0,0 +1,74 @@
+#include "shadow_runner.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+// the shadow copy of each thread, kept so that copying a filter into it
+// reuses its history storage instead of allocating
+thread_local UKF t_shadow;
+
+unsigned long long NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// [x, y, vx, vy] of a CTRV posterior
+Eigen::Vector4d Cartesian(const UKF &ukf) {
+  const UKF::StateVector &x = ukf.x();
+  const double v = x(2);
+  const double yaw = x(3);
+  return Eigen::Vector4d(x(0), x(1), v * std::cos(yaw), v * std::sin(yaw));
+}
+
+}  // namespace
+
+ShadowRunner::ShadowRunner(const UKFConfig &config,
+                           unsigned long sample_every)
+    : config_(config),
+      sample_every_(sample_every),
+      stats_(),
+      position_diff_sum_(0.0),
+      velocity_diff_sum_(0.0) {}
+
+void ShadowRunner::Begin(const UKF &before) {
+  t_shadow = before;
+  t_shadow.Configure(config_);
+}
+
+void ShadowRunner::Finish(const UKF &after, const Measurement &meas,
+                          unsigned long long primary_ns) {
+  UKF &shadow = t_shadow;
+  const unsigned long long start = NowNs();
+  shadow.ProcessMeasurement(meas);
+  const unsigned long long shadow_ns = NowNs() - start;
+  primary_ns_.Record(primary_ns);
+  shadow_ns_.Record(shadow_ns);
+
+  const bool healthy = shadow.Healthy();
+  const Eigen::Vector4d diff = Cartesian(shadow) - Cartesian(after);
+  const double position = diff.head<2>().norm();
+  const double velocity = diff.tail<2>().norm();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.samples;
+  if (!healthy) {
+    //a diverged shadow would swamp the distances; it is counted instead
+    ++stats_.divergences;
+    return;
+  }
+  position_diff_sum_ += position;
+  velocity_diff_sum_ += velocity;
+  stats_.position_diff_max = std::max(stats_.position_diff_max, position);
+  stats_.velocity_diff_max = std::max(stats_.velocity_diff_max, velocity);
+}
+
+ShadowRunner::Stats ShadowRunner::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats s = stats_;
+  const unsigned long long compared = s.samples - s.divergences;
+  s.position_diff_mean = compared ? position_diff_sum_ / compared : 0.0;
+  s.velocity_diff_mean = compared ? velocity_diff_sum_ / compared : 0.0;
+  return s;
+}
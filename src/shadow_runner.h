@@ -0,0 +1,96 @@
+#ifndef SHADOW_RUNNER_H_
+#define SHADOW_RUNNER_H_
+
+#include <mutex>
+#include "measurement_package.h"
+#include "stage_timing.h"
+#include "ukf.h"
+#include "ukf_config.h"
+
+/**
+ * Shadow-mode A/B run of an alternative filter configuration on live
+ * traffic, for evidence before a fleet switches to a faster variant (fast
+ * atan2, the simplex or cubature set, another noise tuning ...).
+ *
+ * One in every sample_every measurements a track filters is also fused,
+ * after the fact, by a copy of the track's filter as it was before the
+ * update, retuned to the shadow configuration. The copy is thrown away
+ * afterwards, so each comparison covers one step from the same state and
+ * nothing the shadow does reaches the served estimate. The estimates are
+ * compared and both updates timed.
+ *
+ * Any number of threads may run shadows at once; the statistics are shared.
+ */
+class ShadowRunner {
+public:
+  struct Stats {
+    unsigned long long samples;
+    ///* shadow updates that left a non-finite state or negative variance
+    unsigned long long divergences;
+    ///* distance between the two position and velocity estimates, in m
+    ///* and m/s
+    double position_diff_mean;
+    double position_diff_max;
+    double velocity_diff_mean;
+    double velocity_diff_max;
+  };
+
+  /**
+   * @param config Configuration of the shadow filter
+   * @param sample_every Shadow one measurement in this many; 0 for none
+   */
+  ShadowRunner(const UKFConfig &config, unsigned long sample_every);
+
+  /**
+   * Whether the calling thread's next measurement is shadowed. Each thread
+   * counts its own, so the filter threads share no cache line for it.
+   */
+  bool Sample() {
+    static thread_local unsigned long count = 0;
+    if (sample_every_ == 0 || ++count < sample_every_) {
+      return false;
+    }
+    count = 0;
+    return true;
+  }
+
+  /**
+   * Takes the calling thread's shadow copy of a filter about to fuse a
+   * sampled measurement
+   * @param before The filter before its update
+   */
+  void Begin(const UKF &before);
+
+  /**
+   * Fuses the measurement into the shadow copy taken by Begin on this
+   * thread and compares it with the filter's own update
+   * @param after The filter after its update
+   * @param meas The measurement it fused
+   * @param primary_ns How long its update took
+   */
+  void Finish(const UKF &after, const Measurement &meas,
+              unsigned long long primary_ns);
+
+  Stats stats() const;
+
+  ///* update latency of the served filters and of their shadows, in ns
+  const LatencyHistogram &primary_latency() const { return primary_ns_; }
+  const LatencyHistogram &shadow_latency() const { return shadow_ns_; }
+
+  const UKFConfig &config() const { return config_; }
+
+private:
+  const UKFConfig config_;
+  const unsigned long sample_every_;
+
+  LatencyHistogram primary_ns_;
+  LatencyHistogram shadow_ns_;
+
+  ///* guards the estimate statistics
+  mutable std::mutex mutex_;
+  Stats stats_;
+  double position_diff_sum_;
+  double velocity_diff_sum_;
+};
+
+#endif /* SHADOW_RUNNER_H_ */
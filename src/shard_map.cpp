@@ -0,0 +1,79 @@
+#include "shard_map.h"
+#include <algorithm>
+#include <cstring>
+#include "binary_protocol.h"
+
+const int ShardMap::kPoints;
+
+namespace {
+
+// SplitMix64 finaliser: consecutive track ids and shard numbers land far
+// apart on the ring
+uint64_t Mix(uint64_t z) {
+  z += 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+}  // namespace
+
+ShardMap::ShardMap() {}
+
+ShardMap::~ShardMap() {}
+
+void ShardMap::Add(int shard) {
+  if (std::find(shards_.begin(), shards_.end(), shard) != shards_.end()) {
+    return;
+  }
+  shards_.push_back(shard);
+  std::sort(shards_.begin(), shards_.end());
+  for (int i = 0; i < kPoints; i++) {
+    //a different stream than the track ids, so points do not sit on ids
+    Point point = {Mix((static_cast<uint64_t>(shard) << 32 | unsigned(i)) ^
+                       0x5348415244ULL),
+                   shard};
+    ring_.push_back(point);
+  }
+  std::sort(ring_.begin(), ring_.end());
+}
+
+void ShardMap::Remove(int shard) {
+  shards_.erase(std::remove(shards_.begin(), shards_.end(), shard),
+                shards_.end());
+  ring_.erase(std::remove_if(ring_.begin(), ring_.end(),
+                             [shard](const Point &point) {
+                               return point.shard == shard;
+                             }),
+              ring_.end());
+}
+
+int ShardMap::Owner(unsigned id) const {
+  if (ring_.empty()) {
+    return -1;
+  }
+  const Point key = {Mix(id), -1};
+  std::vector<Point>::const_iterator it =
+      std::lower_bound(ring_.begin(), ring_.end(), key);
+  //past the last point the ring wraps to the first
+  return it == ring_.end() ? ring_.front().shard : it->shard;
+}
+
+size_t ShardMap::Route(const char *data, size_t count,
+                       std::vector<std::vector<char> > *out) const {
+  if (ring_.empty()) {
+    return 0;
+  }
+  if (out->size() <= static_cast<size_t>(shards_.back())) {
+    out->resize(shards_.back() + 1);
+  }
+  const size_t size = BinaryProtocol::kMeasurementRecordSize;
+  for (size_t i = 0; i < count; i++) {
+    const char *record = data + i * size;
+    uint32_t id;
+    memcpy(&id, record + 4, sizeof(id));
+    std::vector<char> &shard = (*out)[Owner(id)];
+    shard.insert(shard.end(), record, record + size);
+  }
+  return count;
+}
@@ -0,0 +1,83 @@
+#ifndef SHARD_MAP_H_
+#define SHARD_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Assignment of track ids to shards (processes or nodes, each running its
+ * own TrackTable) by consistent hashing, so filtering scales out and a
+ * change of shards moves only the tracks it has to.
+ *
+ * Every shard owns kPoints pseudo-random points on a 64-bit ring, and a
+ * track belongs to the shard of the first point at or after the hash of its
+ * id. Adding a shard takes over about 1/n of the tracks, all from other
+ * shards; removing one hands its tracks to the others and moves no other
+ * track. The points depend only on the shard number, so every router and
+ * shard that was given the same shards agrees on every owner without
+ * talking to the others.
+ *
+ * When the shards change, each shard calls TrackTable::Extract for the ids
+ * it no longer owns and ships the FilterSnapshot records to their new
+ * owners (Owner of record.id), which take them in with TrackTable::Insert.
+ */
+class ShardMap {
+public:
+  ///* ring points per shard; more spread the tracks more evenly
+  static const int kPoints = 128;
+
+  ShardMap();
+  virtual ~ShardMap();
+
+  /**
+   * Adds a shard; a shard already present is left as it is
+   * @param shard Shard number, >= 0
+   */
+  void Add(int shard);
+
+  /**
+   * Removes a shard; its tracks fall to the others
+   */
+  void Remove(int shard);
+
+  /**
+   * Shard that owns a track
+   * @param id Track id
+   * @return Shard number, or -1 if there are no shards
+   */
+  int Owner(unsigned id) const;
+
+  /**
+   * Splits consecutive BinaryProtocol measurement records by the shard
+   * that owns their track, keeping their order within each shard
+   * @param data Records
+   * @param count Number of records
+   * @param out Indexed by shard number; records are appended, and out is
+   * grown to the largest shard
+   * @return Records routed; none without shards
+   */
+  size_t Route(const char *data, size_t count,
+               std::vector<std::vector<char> > *out) const;
+
+  ///* number of shards
+  size_t size() const { return shards_.size(); }
+
+  const std::vector<int> &shards() const { return shards_; }
+
+private:
+  struct Point {
+    uint64_t hash;
+    int shard;
+
+    bool operator<(const Point &other) const {
+      return hash != other.hash ? hash < other.hash : shard < other.shard;
+    }
+  };
+
+  // the ring, sorted by hash
+  std::vector<Point> ring_;
+  std::vector<int> shards_;
+};
+
+#endif /* SHARD_MAP_H_ */
@@ -0,0 +1,407 @@
+// Soak test of a running UKF server: drives it with ukf_loadgen's paced,
+// looped replay of a log for hours, samples its /metrics endpoint as it
+// goes and fails if memory, allocations or latency trend upward.
+//
+//   ukf_soak --replay <log> [--host localhost] [--port 4567] [--hours 4]
+//            [--sample-s 60] [--connections 16] [--speed 1]
+//            [--loadgen <path>] [--warmup 0.1] [--csv <path>]
+//            [--max-rss-growth 0.05] [--max-alloc-growth 0.1]
+//            [--max-p99-growth 0.2]
+//
+// Every --sample-s it reads ukf_resident_bytes, ukf_heap_allocations_total,
+// ukf_messages_total and the 0.99 quantile of ukf_receive_to_send_ns. When
+// the replay ends, the first --warmup fraction of the samples is dropped
+// (pools, histories and windows filling up), and a least-squares line is
+// fitted to each of three series: the RSS, the heap allocations per
+// message of each sample interval, and the p99. The run fails, with exit
+// status 1, if a line rises over the run by more than its --max-*-growth,
+// as a fraction of the series' mean; a session history that is never
+// trimmed shows up as RSS growth within the first hour. Exit status 2 is
+// for a run that could not be made.
+//
+// The server's p99 covers every reply since it started, so it answers
+// slowly to drift; ukf_loadgen's progress lines, printed as the run goes,
+// give the p99 of each sample interval. Allocations are only checked when
+// the server counts them (built with UKF_COUNT_ALLOCATIONS). ukf_loadgen
+// is looked for next to ukf_soak unless --loadgen is given.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// timeout of one scrape, in s
+const int kScrapeTimeoutS = 5;
+
+struct Options {
+  const char *replay;
+  std::string host;
+  std::string port;
+  double hours;
+  double sample_s;
+  int connections;
+  double speed;
+  std::string loadgen;
+  double warmup;
+  const char *csv;
+  double max_rss_growth;
+  double max_alloc_growth;
+  double max_p99_growth;
+};
+
+// one scrape of /metrics
+struct Sample {
+  double t_s;
+  double rss;
+  double allocations;
+  double messages;
+  double p99_ns;
+};
+
+// GET /metrics over plain HTTP/1.0; the body goes to body
+bool Scrape(const Options &options, std::string *body) {
+  addrinfo hints = addrinfo();
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if (getaddrinfo(options.host.c_str(), options.port.c_str(), &hints,
+                  &addresses) != 0) {
+    return false;
+  }
+  int fd = -1;
+  for (addrinfo *a = addresses; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    return false;
+  }
+  timeval timeout = {kScrapeTimeoutS, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  const std::string request = "GET /metrics HTTP/1.0\r\nHost: " +
+                              options.host + "\r\n\r\n";
+  bool ok = send(fd, request.data(), request.size(), 0) ==
+            static_cast<ssize_t>(request.size());
+  //read to the end of the body: the close, or Content-Length bytes
+  std::string response;
+  size_t header_end = std::string::npos;
+  size_t length = std::string::npos;
+  char buffer[4096];
+  while (ok) {
+    const ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+    if (got <= 0) {
+      ok = got == 0 && header_end != std::string::npos;
+      break;
+    }
+    response.append(buffer, static_cast<size_t>(got));
+    if (header_end == std::string::npos) {
+      header_end = response.find("\r\n\r\n");
+      if (header_end != std::string::npos) {
+        header_end += 4;
+        const char *field = strstr(response.c_str(), "Content-Length:");
+        if (!field) {
+          field = strstr(response.c_str(), "content-length:");
+        }
+        if (field && static_cast<size_t>(field - response.c_str()) <
+                         header_end) {
+          length = strtoul(field + 15, nullptr, 10);
+        }
+      }
+    }
+    if (length != std::string::npos &&
+        response.size() >= header_end + length) {
+      break;
+    }
+  }
+  close(fd);
+  if (!ok) {
+    return false;
+  }
+  body->assign(response, header_end, length);
+  return true;
+}
+
+// sums the samples of a metric whose name and labels start with prefix,
+// e.g. "ukf_messages_total{" for every kind; false if there are none
+bool Value(const std::string &body, const char *prefix, double *value) {
+  const size_t n = strlen(prefix);
+  bool found = false;
+  double sum = 0.0;
+  size_t line = 0;
+  while (line < body.size()) {
+    size_t end = body.find('\n', line);
+    if (end == std::string::npos) {
+      end = body.size();
+    }
+    if (end > line + n && body.compare(line, n, prefix) == 0) {
+      //the value follows the last space of the line
+      const size_t space = body.rfind(' ', end - 1);
+      if (space != std::string::npos && space + 1 >= line + n) {
+        sum += atof(body.c_str() + space + 1);
+        found = true;
+      }
+    }
+    line = end + 1;
+  }
+  *value = sum;
+  return found;
+}
+
+bool Read(const std::string &body, double t_s, Sample *sample) {
+  sample->t_s = t_s;
+  return Value(body, "ukf_resident_bytes ", &sample->rss) &&
+         Value(body, "ukf_heap_allocations_total ", &sample->allocations) &&
+         Value(body, "ukf_messages_total{", &sample->messages) &&
+         Value(body, "ukf_receive_to_send_ns{quantile=\"0.99\"}",
+               &sample->p99_ns);
+}
+
+// starts ukf_loadgen on the replay; its output goes to ours
+pid_t StartLoadgen(const Options &options) {
+  char duration[32];
+  char connections[16];
+  char speed[32];
+  char progress[32];
+  snprintf(duration, sizeof(duration), "%g", options.hours * 3600.0);
+  snprintf(connections, sizeof(connections), "%d", options.connections);
+  snprintf(speed, sizeof(speed), "%g", options.speed);
+  snprintf(progress, sizeof(progress), "%g", options.sample_s);
+  const std::string url = "ws://" + options.host + ":" + options.port;
+  const char *argv[] = {
+    options.loadgen.c_str(), "--url", url.c_str(), "--replay",
+    options.replay, "--loop", "--speed", speed, "--duration", duration,
+    "--connections", connections, "--progress", progress, nullptr
+  };
+  fflush(stdout);
+  const pid_t pid = fork();
+  if (pid == 0) {
+    execv(argv[0], const_cast<char *const *>(argv));
+    fprintf(stderr, "Cannot run %s\n", argv[0]);
+    _exit(127);
+  }
+  return pid;
+}
+
+// rise of the least-squares line through (t, y) from the first t to the
+// last, as a fraction of the mean of y; 0 for a series without a mean
+double Growth(const std::vector<double> &t, const std::vector<double> &y) {
+  const size_t n = t.size();
+  double mean_t = 0.0;
+  double mean_y = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    mean_t += t[i] / n;
+    mean_y += y[i] / n;
+  }
+  double covariance = 0.0;
+  double variance = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    covariance += (t[i] - mean_t) * (y[i] - mean_y);
+    variance += (t[i] - mean_t) * (t[i] - mean_t);
+  }
+  if (variance <= 0.0 || mean_y <= 0.0) {
+    return 0.0;
+  }
+  return covariance / variance * (t.back() - t.front()) / mean_y;
+}
+
+// prints one series' verdict; false if it grew past its limit
+bool Check(const char *name, const std::vector<double> &t,
+           const std::vector<double> &y, double limit, const char *unit,
+           double scale) {
+  double mean = 0.0;
+  for (size_t i = 0; i < y.size(); i++) {
+    mean += y[i] / y.size();
+  }
+  const double growth = Growth(t, y);
+  const bool ok = growth <= limit;
+  printf("%-12s mean %.3f %s, trend %+.1f%% over the run (limit %.1f%%) %s\n",
+         name, mean * scale, unit, 100.0 * growth, 100.0 * limit,
+         ok ? "ok" : "FAIL");
+  return ok;
+}
+
+bool WriteCsv(const char *path, const std::vector<Sample> &samples) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    return false;
+  }
+  fprintf(f, "t_s,rss_bytes,heap_allocations,messages,p99_ns\n");
+  for (size_t i = 0; i < samples.size(); i++) {
+    const Sample &s = samples[i];
+    fprintf(f, "%.1f,%.0f,%.0f,%.0f,%.0f\n", s.t_s, s.rss, s.allocations,
+            s.messages, s.p99_ns);
+  }
+  return fclose(f) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  Options options;
+  options.replay = nullptr;
+  options.host = "localhost";
+  options.port = "4567";
+  options.hours = 4.0;
+  options.sample_s = 60.0;
+  options.connections = 16;
+  options.speed = 1.0;
+  options.warmup = 0.1;
+  options.csv = nullptr;
+  options.max_rss_growth = 0.05;
+  options.max_alloc_growth = 0.1;
+  options.max_p99_growth = 0.2;
+  const char *slash = strrchr(argv[0], '/');
+  options.loadgen = slash
+      ? std::string(argv[0], slash + 1 - argv[0]) + "ukf_loadgen"
+      : std::string("ukf_loadgen");
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (strcmp(argv[i], "--replay") == 0) {
+      options.replay = argv[++i];
+    }
+    else if (strcmp(argv[i], "--host") == 0) {
+      options.host = argv[++i];
+    }
+    else if (strcmp(argv[i], "--port") == 0) {
+      options.port = argv[++i];
+    }
+    else if (strcmp(argv[i], "--hours") == 0) {
+      options.hours = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--sample-s") == 0) {
+      options.sample_s = std::max(1.0, atof(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--connections") == 0) {
+      options.connections = std::max(1, atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--speed") == 0) {
+      options.speed = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--loadgen") == 0) {
+      options.loadgen = argv[++i];
+    }
+    else if (strcmp(argv[i], "--warmup") == 0) {
+      options.warmup = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--csv") == 0) {
+      options.csv = argv[++i];
+    }
+    else if (strcmp(argv[i], "--max-rss-growth") == 0) {
+      options.max_rss_growth = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--max-alloc-growth") == 0) {
+      options.max_alloc_growth = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--max-p99-growth") == 0) {
+      options.max_p99_growth = atof(argv[++i]);
+    }
+  }
+  if (!options.replay || options.hours <= 0.0) {
+    fprintf(stderr, "usage: ukf_soak --replay <log> [--hours <h>] ...\n");
+    return 2;
+  }
+  std::string body;
+  if (!Scrape(options, &body)) {
+    fprintf(stderr, "Cannot scrape http://%s:%s/metrics\n",
+            options.host.c_str(), options.port.c_str());
+    return 2;
+  }
+
+  const pid_t loadgen = StartLoadgen(options);
+  if (loadgen < 0) {
+    fprintf(stderr, "Cannot start %s\n", options.loadgen.c_str());
+    return 2;
+  }
+  const Clock::time_point start = Clock::now();
+  std::vector<Sample> samples;
+  int status = 0;
+  unsigned long long failed_scrapes = 0;
+  for (long long k = 1;; k++) {
+    //wait for the next sample time, or for the replay to end
+    const Clock::time_point due =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(k * options.sample_s));
+    bool exited = false;
+    while (!exited && Clock::now() < due) {
+      exited = waitpid(loadgen, &status, WNOHANG) == loadgen;
+      if (!exited) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      }
+    }
+    if (exited) {
+      break;
+    }
+    Sample sample;
+    const double t_s =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    if (Scrape(options, &body) && Read(body, t_s, &sample)) {
+      samples.push_back(sample);
+    }
+    else {
+      ++failed_scrapes;
+    }
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "ukf_loadgen failed\n");
+    return 2;
+  }
+  if (options.csv && !WriteCsv(options.csv, samples)) {
+    fprintf(stderr, "Cannot write %s\n", options.csv);
+  }
+  if (failed_scrapes) {
+    printf("%llu scrapes failed\n", failed_scrapes);
+  }
+
+  //the allocation series is per interval, so it starts one sample later
+  const size_t first = static_cast<size_t>(options.warmup * samples.size());
+  if (samples.size() < first + 3) {
+    fprintf(stderr, "Too few samples for a trend: %zu after the warm-up\n",
+            samples.size() - std::min(first, samples.size()));
+    return 2;
+  }
+  std::vector<double> t, rss, p99, alloc_t, allocs;
+  bool counted = false;
+  for (size_t i = first; i < samples.size(); i++) {
+    t.push_back(samples[i].t_s);
+    rss.push_back(samples[i].rss);
+    p99.push_back(samples[i].p99_ns);
+    counted = counted || samples[i].allocations > 0.0;
+    if (i > first && samples[i].messages > samples[i - 1].messages) {
+      alloc_t.push_back(samples[i].t_s);
+      allocs.push_back((samples[i].allocations - samples[i - 1].allocations) /
+                       (samples[i].messages - samples[i - 1].messages));
+    }
+  }
+  printf("%zu samples over %.1f h, %zu after the warm-up\n", samples.size(),
+         samples.back().t_s / 3600.0, t.size());
+  bool ok = Check("rss", t, rss, options.max_rss_growth, "MB", 1e-6);
+  if (counted && allocs.size() >= 2) {
+    ok = Check("allocations", alloc_t, allocs, options.max_alloc_growth,
+               "per message", 1.0) && ok;
+  }
+  else {
+    printf("allocations  not counted by this server build\n");
+  }
+  ok = Check("p99", t, p99, options.max_p99_growth, "us", 1e-3) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#include "spatial_grid.h"
+#include <cmath>
+
+SpatialGrid::SpatialGrid(double cell_size)
+    : cell_size_(cell_size > 0.0 ? cell_size : 1.0),
+      inv_cell_size_(1.0 / cell_size_),
+      size_(0) {}
+
+SpatialGrid::~SpatialGrid() {}
+
+long long SpatialGrid::CellIndex(double v) const {
+  return static_cast<long long>(floor(v * inv_cell_size_));
+}
+
+long long SpatialGrid::Key(long long cx, long long cy) {
+  //32 bits per axis is billions of cells either way
+  return static_cast<long long>((static_cast<unsigned long long>(cx) << 32) ^
+                                (static_cast<unsigned long long>(cy) &
+                                 0xffffffffULL));
+}
+
+void SpatialGrid::Update(int id, double x, double y) {
+  if (id < 0) {
+    return;
+  }
+  if (static_cast<size_t>(id) >= entries_.size()) {
+    Entry empty = {false, 0, 0, 0.0, 0.0};
+    entries_.resize(id + 1, empty);
+  }
+
+  Entry &e = entries_[id];
+  const long long cell = Key(CellIndex(x), CellIndex(y));
+  e.x = x;
+  e.y = y;
+  if (e.present && e.cell == cell) {
+    return;
+  }
+  if (e.present) {
+    Unlink(id);
+  }
+  else {
+    ++size_;
+  }
+
+  std::vector<int> &items = cells_[cell];
+  e.present = true;
+  e.cell = cell;
+  e.slot = static_cast<int>(items.size());
+  items.push_back(id);
+}
+
+void SpatialGrid::Remove(int id) {
+  if (id < 0 || static_cast<size_t>(id) >= entries_.size() ||
+      !entries_[id].present) {
+    return;
+  }
+  Unlink(id);
+  entries_[id].present = false;
+  --size_;
+}
+
+void SpatialGrid::Unlink(int id) {
+  //swap with the last item of the cell so removal is O(1)
+  Entry &e = entries_[id];
+  std::vector<int> &items = cells_[e.cell];
+  int last = items.back();
+  items[e.slot] = last;
+  entries_[last].slot = e.slot;
+  items.pop_back();
+}
+
+void SpatialGrid::Clear() {
+  for (auto it = cells_.begin(); it != cells_.end(); ++it) {
+    it->second.clear();
+  }
+  for (size_t i = 0; i < entries_.size(); i++) {
+    entries_[i].present = false;
+  }
+  size_ = 0;
+}
+
+void SpatialGrid::Query(double x, double y, double radius,
+                        std::vector<int> *ids) const {
+  const long long x0 = CellIndex(x - radius);
+  const long long x1 = CellIndex(x + radius);
+  const long long y0 = CellIndex(y - radius);
+  const long long y1 = CellIndex(y + radius);
+  const double r2 = radius * radius;
+  for (long long cx = x0; cx <= x1; cx++) {
+    for (long long cy = y0; cy <= y1; cy++) {
+      auto it = cells_.find(Key(cx, cy));
+      if (it == cells_.end()) {
+        continue;
+      }
+      const std::vector<int> &items = it->second;
+      for (size_t i = 0; i < items.size(); i++) {
+        const Entry &e = entries_[items[i]];
+        double dx = e.x - x;
+        double dy = e.y - y;
+        if (dx * dx + dy * dy <= r2) {
+          ids->push_back(items[i]);
+        }
+      }
+    }
+  }
+}
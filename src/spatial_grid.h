@@ -0,0 +1,89 @@
+#ifndef SPATIAL_GRID_H_
+#define SPATIAL_GRID_H_
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Uniform grid over track positions for measurement-to-track association.
+ * A query only visits the cells a gating disc overlaps, so associating M
+ * measurements with N tracks costs O(M * nearby) instead of O(M * N)
+ * evaluations of the measurement model.
+ *
+ * Items are small dense ids (e.g. track slots). Update moves an item only
+ * when it changes cell, so refreshing every track after a prediction is
+ * mostly a comparison per track. Cells are hashed, so the covered area is
+ * unbounded; pick the cell size near the typical gating radius.
+ */
+class SpatialGrid {
+public:
+  /**
+   * Constructor
+   * @param cell_size Cell edge in m
+   */
+  explicit SpatialGrid(double cell_size);
+
+  /**
+   * Destructor
+   */
+  virtual ~SpatialGrid();
+
+  /**
+   * Inserts an item or moves it to a new position
+   * @param id Item id, >= 0
+   * @param x Position in m
+   * @param y Position in m
+   */
+  void Update(int id, double x, double y);
+
+  /**
+   * Removes an item; unknown ids are ignored
+   * @param id Item id
+   */
+  void Remove(int id);
+
+  /**
+   * Removes all items, keeping the allocated cells
+   */
+  void Clear();
+
+  /**
+   * Appends the ids of all items within radius of a point
+   * @param x Centre in m
+   * @param y Centre in m
+   * @param radius Radius in m
+   * @param ids Output, appended to
+   */
+  void Query(double x, double y, double radius, std::vector<int> *ids) const;
+
+  size_t size() const { return size_; }
+  double cell_size() const { return cell_size_; }
+
+private:
+  struct Entry {
+    bool present;
+    long long cell;
+    ///* position within the cell's item list
+    int slot;
+    double x;
+    double y;
+  };
+
+  // cell coordinate of a position
+  long long CellIndex(double v) const;
+
+  // hash key of a cell
+  static long long Key(long long cx, long long cy);
+
+  // takes an item out of its cell's list
+  void Unlink(int id);
+
+  double cell_size_;
+  double inv_cell_size_;
+  size_t size_;
+  std::vector<Entry> entries_;
+  std::unordered_map<long long, std::vector<int> > cells_;
+};
+
+#endif /* SPATIAL_GRID_H_ */
@@ -0,0 +1,112 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Bounded lock-free single-producer/single-consumer ring.
+ *
+ * Exactly one thread may call TryPush and exactly one (other) thread may
+ * call TryPop and Front. Each side caches the other side's index and only
+ * reloads it when the ring looks full (or empty), so in steady state a push
+ * or pop touches one shared cache line. T should be cheap to copy; slots are
+ * allocated once at construction.
+ */
+template <typename T>
+class SpscQueue {
+public:
+  /**
+   * Constructor
+   * @param capacity Minimum number of slots, rounded up to a power of two
+   */
+  explicit SpscQueue(size_t capacity)
+      : head_(0), cached_tail_(0), tail_(0), cached_head_(0) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    slots_.resize(n);
+    mask_ = n - 1;
+  }
+
+  /**
+   * Producer side: appends an item
+   * @return false if the ring is full
+   */
+  bool TryPush(const T &item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) {
+        return false;
+      }
+    }
+    slots_[tail & mask_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side: removes the oldest item
+   * @return false if the ring is empty
+   */
+  bool TryPop(T *item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return false;
+      }
+    }
+    *item = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side: the oldest item, left in the ring; valid until the next
+   * TryPop
+   * @return nullptr if the ring is empty
+   */
+  const T *Front() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return nullptr;
+      }
+    }
+    return &slots_[head & mask_];
+  }
+
+  /**
+   * Number of queued items; exact only when called from one of the two
+   * sides while the other is idle
+   */
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  ///* heap bytes of the slots
+  size_t MemoryBytes() const { return slots_.capacity() * sizeof(T); }
+
+private:
+  std::vector<T> slots_;
+  size_t mask_;
+
+  // consumer-owned line: read index and its view of the write index
+  char pad0_[64];
+  std::atomic<size_t> head_;
+  size_t cached_tail_;
+
+  // producer-owned line: write index and its view of the read index
+  char pad1_[64];
+  std::atomic<size_t> tail_;
+  size_t cached_head_;
+  char pad2_[64];
+};
+
+#endif /* SPSC_QUEUE_H_ */
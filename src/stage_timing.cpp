@@ -0,0 +1,174 @@
+#include "stage_timing.h"
+#include <chrono>
+#include <cstdio>
+#include "thread_shards.h"
+
+const int LatencyHistogram::kSubBuckets;
+const int LatencyHistogram::kBuckets;
+
+namespace {
+
+struct alignas(64) StageShard {
+  LatencyHistogram stages[kStageCount];
+};
+
+const char *const kStageNames[kStageCount] = {
+  "parse", "predict", "update_lidar", "update_radar", "rmse", "serialize",
+  "send"
+};
+
+unsigned long long NowNs() {
+  return static_cast<unsigned long long>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+int Log2(unsigned long long v) {
+  int e = 0;
+  while (v >>= 1) ++e;
+  return e;
+}
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() {
+  Reset();
+}
+
+int LatencyHistogram::BucketOf(unsigned long long ns) {
+  if (ns < static_cast<unsigned long long>(kSubBuckets)) {
+    return static_cast<int>(ns);
+  }
+  int e = Log2(ns);
+  int sub = static_cast<int>((ns >> (e - 4)) & (kSubBuckets - 1));
+  return kSubBuckets + (e - 4) * kSubBuckets + sub;
+}
+
+unsigned long long LatencyHistogram::UpperEdge(int bucket) {
+  if (bucket < kSubBuckets) {
+    return static_cast<unsigned long long>(bucket);
+  }
+  int e = (bucket - kSubBuckets) / kSubBuckets + 4;
+  unsigned long long sub = (bucket - kSubBuckets) % kSubBuckets;
+  return ((kSubBuckets + sub + 1) << (e - 4)) - 1;
+}
+
+void LatencyHistogram::Record(unsigned long long ns) {
+  counts_[BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+  total_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(ns, std::memory_order_relaxed);
+  unsigned long long seen = max_.load(std::memory_order_relaxed);
+  while (ns > seen &&
+         !max_.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::RecordOwned(unsigned long long ns) {
+  AddOwned(&counts_[BucketOf(ns)], 1ULL);
+  AddOwned(&total_, 1ULL);
+  AddOwned(&sum_, ns);
+  if (ns > max_.load(std::memory_order_relaxed)) {
+    max_.store(ns, std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+  for (int b = 0; b < kBuckets; b++) {
+    AddOwned(&counts_[b], other.counts_[b].load(std::memory_order_relaxed));
+  }
+  AddOwned(&total_, other.total_.load(std::memory_order_relaxed));
+  AddOwned(&sum_, other.sum_.load(std::memory_order_relaxed));
+  const unsigned long long top = other.max();
+  if (top > max()) {
+    max_.store(top, std::memory_order_relaxed);
+  }
+}
+
+unsigned long long LatencyHistogram::Percentile(double q) const {
+  unsigned long long n = count();
+  if (n == 0) {
+    return 0;
+  }
+  unsigned long long rank = static_cast<unsigned long long>(q * (n - 1)) + 1;
+  unsigned long long seen = 0;
+  for (int b = 0; b < kBuckets; b++) {
+    seen += counts_[b].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      unsigned long long edge = UpperEdge(b);
+      unsigned long long top = max();
+      return edge < top ? edge : top;
+    }
+  }
+  return max();
+}
+
+unsigned long long LatencyHistogram::count() const {
+  return total_.load(std::memory_order_relaxed);
+}
+
+unsigned long long LatencyHistogram::max() const {
+  return max_.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const {
+  unsigned long long n = count();
+  return n ? static_cast<double>(sum_.load(std::memory_order_relaxed)) / n
+           : 0.0;
+}
+
+void LatencyHistogram::Reset() {
+  for (int b = 0; b < kBuckets; b++) {
+    counts_[b].store(0, std::memory_order_relaxed);
+  }
+  total_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+void StageTimings::Merged(Stage stage, LatencyHistogram *out) {
+  out->Reset();
+  ThreadShards<StageShard>::ForEach([stage, out](const StageShard &shard) {
+    out->Merge(shard.stages[stage]);
+  });
+}
+
+void StageTimings::AttachThread() {
+  ThreadShards<StageShard>::Local();
+}
+
+const char *StageTimings::Name(Stage stage) {
+  return kStageNames[stage];
+}
+
+std::string StageTimings::Dump() {
+  std::string out;
+  char line[160];
+  LatencyHistogram h;
+  for (int s = 0; s < kStageCount; s++) {
+    Merged(Stage(s), &h);
+    snprintf(line, sizeof(line),
+             "%-13s count %llu mean %.0f p50 %llu p99 %llu p999 %llu "
+             "max %llu ns\n",
+             kStageNames[s], h.count(), h.mean(), h.Percentile(0.5),
+             h.Percentile(0.99), h.Percentile(0.999), h.max());
+    out += line;
+  }
+  return out;
+}
+
+void StageTimings::Reset() {
+  ThreadShards<StageShard>::ForEachMutable([](StageShard *shard) {
+    for (int s = 0; s < kStageCount; s++) {
+      shard->stages[s].Reset();
+    }
+  });
+}
+
+StageTimer::StageTimer(Stage stage) : stage_(stage), start_(NowNs()) {}
+
+StageTimer::~StageTimer() {
+  StageShard *shard = ThreadShards<StageShard>::Local();
+  if (shard) {
+    shard->stages[stage_].RecordOwned(NowNs() - start_);
+  }
+}
@@ -0,0 +1,128 @@
+#ifndef STAGE_TIMING_H_
+#define STAGE_TIMING_H_
+
+#include <atomic>
+#include <string>
+
+/**
+ * Lock-free latency histogram with HDR-style log-linear buckets: values
+ * below 16 ns get their own bucket, every power of two above is split into 16
+ * linear sub-buckets, so any recorded value is known to within 6.25%.
+ * Record is a couple of relaxed atomic increments and may be called from any
+ * number of threads; RecordOwned, for a histogram only one thread records
+ * into (see ThreadShards), is a few plain loads and stores.
+ */
+class LatencyHistogram {
+public:
+  static const int kSubBuckets = 16;
+  static const int kBuckets = kSubBuckets + (64 - 4) * kSubBuckets;
+
+  LatencyHistogram();
+
+  /**
+   * Adds one sample
+   * @param ns Duration in nanoseconds
+   */
+  void Record(unsigned long long ns);
+
+  /**
+   * Record, for a histogram no other thread records into at the same time
+   */
+  void RecordOwned(unsigned long long ns);
+
+  /**
+   * Adds every sample of other; only the calling thread may be writing to
+   * this histogram
+   */
+  void Merge(const LatencyHistogram &other);
+
+  /**
+   * Value below which a fraction q of the samples fall (the upper edge of
+   * the bucket that contains it)
+   * @param q Quantile in [0, 1]
+   */
+  unsigned long long Percentile(double q) const;
+
+  unsigned long long count() const;
+  unsigned long long max() const;
+  double mean() const;
+
+  void Reset();
+
+private:
+  static int BucketOf(unsigned long long ns);
+  static unsigned long long UpperEdge(int bucket);
+
+  std::atomic<unsigned long long> counts_[kBuckets];
+  std::atomic<unsigned long long> total_;
+  std::atomic<unsigned long long> sum_;
+  std::atomic<unsigned long long> max_;
+};
+
+/**
+ * Hot-path stages with their own histogram
+ */
+enum Stage {
+  STAGE_PARSE,
+  STAGE_PREDICT,
+  STAGE_UPDATE_LIDAR,
+  STAGE_UPDATE_RADAR,
+  STAGE_RMSE,
+  STAGE_SERIALIZE,
+  STAGE_SEND,
+  kStageCount
+};
+
+/**
+ * Process-wide per-stage histograms. Each thread records into a shard of
+ * its own, so timed stages on many workers do not contend; the shards are
+ * merged when read.
+ */
+class StageTimings {
+public:
+  /**
+   * One stage's samples from every thread
+   * @param stage The stage
+   * @param out Receives them, replacing what it held
+   */
+  static void Merged(Stage stage, LatencyHistogram *out);
+  static const char *Name(Stage stage);
+
+  /**
+   * Creates the calling thread's histograms now rather than on its first
+   * timed stage, e.g. before it may no longer allocate
+   */
+  static void AttachThread();
+
+  /**
+   * One line per stage with count, mean, p50, p99, p999 and max in ns
+   */
+  static std::string Dump();
+
+  static void Reset();
+};
+
+/**
+ * Records the lifetime of the object into a stage histogram
+ */
+class StageTimer {
+public:
+  explicit StageTimer(Stage stage);
+  ~StageTimer();
+
+private:
+  Stage stage_;
+  unsigned long long start_;
+};
+
+// The instrumentation compiles to nothing unless UKF_STAGE_TIMING is defined.
+#ifdef UKF_STAGE_TIMING
+#define UKF_STAGE_TIMER_CAT2(a, b) a##b
+#define UKF_STAGE_TIMER_CAT(a, b) UKF_STAGE_TIMER_CAT2(a, b)
+#define UKF_STAGE_TIMER(stage) \
+  StageTimer UKF_STAGE_TIMER_CAT(ukf_stage_timer_, __LINE__)(stage)
+#else
+#define UKF_STAGE_TIMER(stage) do {} while (0)
+#endif
+
+#endif /* STAGE_TIMING_H_ */
@@ -0,0 +1,169 @@
+#include "state_delta.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+const size_t StateDelta::kMaxEncodedSize;
+const int StateDelta::kFields;
+
+namespace {
+
+// bit of the model hash in the field mask
+const int kHashBit = StateDelta::kFields;
+
+// beyond this many quanta a field is clamped; also catches NaN
+const double kMaxQuanta = 4e18;
+
+char *PutVarint(uint64_t v, char *out) {
+  while (v >= 0x80) {
+    *out++ = static_cast<char>((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  *out++ = static_cast<char>(v);
+  return out;
+}
+
+char *PutSigned(long long v, char *out) {
+  //zigzag: small changes of either sign take one byte
+  return PutVarint(
+      (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63), out);
+}
+
+// false if the varint runs past end or over 64 bits
+bool GetVarint(const char **p, const char *end, uint64_t *v) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    const unsigned char byte = static_cast<unsigned char>(*(*p)++);
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *v = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GetSigned(const char **p, const char *end, long long *v) {
+  uint64_t u;
+  if (!GetVarint(p, end, &u)) {
+    return false;
+  }
+  *v = static_cast<long long>((u >> 1) ^ (~(u & 1) + 1));
+  return true;
+}
+
+long long Quantum(double value, double inverse_step) {
+  const double q = std::nearbyint(value * inverse_step);
+  if (!(q > -kMaxQuanta)) {
+    return static_cast<long long>(-kMaxQuanta);
+  }
+  return static_cast<long long>(std::min(q, kMaxQuanta));
+}
+
+}  // namespace
+
+void StateDelta::Quantise(const Options &options,
+                          const FilterSnapshot::Record &record,
+                          long long *q) {
+  const double state = 1.0 / options.state_step;
+  const double covariance = 1.0 / options.covariance_step;
+  for (int i = 0; i < UKF::n_x_; i++) {
+    q[i] = Quantum(record.x[i], state);
+  }
+  for (int i = 0; i < PackedSymmetric<UKF::n_x_>::kSize; i++) {
+    q[UKF::n_x_ + i] = Quantum(record.p[i], covariance);
+  }
+}
+
+StateDelta::Encoder::Encoder(const Options &options) : options_(options) {}
+
+size_t StateDelta::Encoder::Encode(const FilterSnapshot::Record &record,
+                                   std::vector<char> *out) {
+  long long q[kFields];
+  Quantise(options_, record, q);
+  //find first: emplace would build a node for every known track
+  auto found = last_.find(record.id);
+  const bool known = found != last_.end();
+  Sent &last = known ? found->second : last_[record.id];
+
+  //a track is sent in full the first time, and then once it has moved
+  uint64_t mask = 0;
+  bool moved = !known || record.config_hash != last.config_hash;
+  for (int i = 0; i < kFields; i++) {
+    const long long change = q[i] - last.q[i];
+    if (change != 0) {
+      mask |= uint64_t(1) << i;
+      moved = moved || std::llabs(change) >= options_.threshold;
+    }
+  }
+  if (!moved) {
+    return 0;
+  }
+  if (record.config_hash != last.config_hash) {
+    mask |= uint64_t(1) << kHashBit;
+  }
+
+  char buffer[kMaxEncodedSize];
+  char *p = PutVarint(record.id, buffer);
+  p = PutSigned(record.timestamp - last.timestamp, p);
+  p = PutVarint(mask, p);
+  for (int i = 0; i < kFields; i++) {
+    if (mask & (uint64_t(1) << i)) {
+      p = PutSigned(q[i] - last.q[i], p);
+      last.q[i] = q[i];
+    }
+  }
+  if (mask & (uint64_t(1) << kHashBit)) {
+    p = PutVarint(record.config_hash, p);
+    last.config_hash = record.config_hash;
+  }
+  last.timestamp = record.timestamp;
+  out->insert(out->end(), buffer, p);
+  return static_cast<size_t>(p - buffer);
+}
+
+StateDelta::Decoder::Decoder(const Options &options) : options_(options) {}
+
+size_t StateDelta::Decoder::Decode(const char *data, size_t length,
+                                   FilterSnapshot::Record *record) {
+  const char *p = data;
+  const char *end = data + length;
+  uint64_t id, mask;
+  long long dt;
+  if (!GetVarint(&p, end, &id) || !GetSigned(&p, end, &dt) ||
+      !GetVarint(&p, end, &mask) || mask >> (kHashBit + 1)) {
+    return 0;
+  }
+  //decode into a copy, so a short record changes nothing
+  auto found = last_.find(id);
+  Sent next = found != last_.end() ? found->second : Sent();
+  next.timestamp += dt;
+  for (int i = 0; i < kFields; i++) {
+    long long change;
+    if (mask & (uint64_t(1) << i)) {
+      if (!GetSigned(&p, end, &change)) {
+        return 0;
+      }
+      next.q[i] += change;
+    }
+  }
+  if (mask & (uint64_t(1) << kHashBit)) {
+    uint64_t hash;
+    if (!GetVarint(&p, end, &hash)) {
+      return 0;
+    }
+    next.config_hash = hash;
+  }
+  last_[id] = next;
+
+  record->id = id;
+  record->timestamp = next.timestamp;
+  record->config_hash = next.config_hash;
+  for (int i = 0; i < UKF::n_x_; i++) {
+    record->x[i] = next.q[i] * options_.state_step;
+  }
+  for (int i = 0; i < PackedSymmetric<UKF::n_x_>::kSize; i++) {
+    record->p[i] = next.q[UKF::n_x_ + i] * options_.covariance_step;
+  }
+  return static_cast<size_t>(p - data);
+}
@@ -0,0 +1,109 @@
+#ifndef STATE_DELTA_H_
+#define STATE_DELTA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "filter_snapshot.h"
+
+/**
+ * Compact encoding of a stream of track posteriors (FilterSnapshot
+ * records) for export over the network: each field is quantised to a
+ * fixed step and sent as the change from the value last sent for the same
+ * track, so a converged track costs a few bytes per update instead of 184.
+ *
+ * One encoded record is a varint track id, the zigzag varint change of the
+ * timestamp, a varint bit mask of the fields that follow (bits 0-4 the
+ * state, 5-19 the upper triangle of P as in the record, 20 the model hash)
+ * and, per set bit, the zigzag varint change in quanta (the model hash as a
+ * plain varint). A field whose quantised value is unchanged is left out,
+ * and a record whose every field moved by less than the threshold is not
+ * sent at all; the receiver's copy then stays within threshold quanta of
+ * the truth. Both sides keep the last sent state of every track, so the
+ * stream must arrive complete and in order; after a loss both Reset.
+ */
+class StateDelta {
+public:
+  struct Options {
+    ///* quantum of x (m, m/s, rad, rad/s)
+    double state_step;
+    ///* quantum of the entries of P
+    double covariance_step;
+    ///* a record is sent once some field moved by this many quanta
+    long long threshold;
+
+    Options() : state_step(1e-4), covariance_step(1e-7), threshold(1) {}
+  };
+
+  ///* longest encoding of one record
+  static const size_t kMaxEncodedSize = 256;
+
+  static const int kFields = UKF::n_x_ + PackedSymmetric<UKF::n_x_>::kSize;
+
+private:
+  ///* the last sent state of one track, in quanta
+  struct Sent {
+    long long timestamp;
+    unsigned long long config_hash;
+    long long q[kFields];
+  };
+
+  // the record's fields in quanta
+  static void Quantise(const Options &options,
+                       const FilterSnapshot::Record &record, long long *q);
+
+public:
+  class Encoder {
+  public:
+    explicit Encoder(const Options &options = Options());
+
+    /**
+     * Appends a record's encoding, unless it has not moved enough
+     * @param record Posterior to send
+     * @param out Encoding appended
+     * @return Bytes appended, 0 if the record is not sent
+     */
+    size_t Encode(const FilterSnapshot::Record &record,
+                  std::vector<char> *out);
+
+    /**
+     * Drops a track, e.g. on removal; its next record is sent in full
+     */
+    void Forget(unsigned long long id) { last_.erase(id); }
+
+    /**
+     * Drops every track, e.g. when the receiver starts over
+     */
+    void Reset() { last_.clear(); }
+
+  private:
+    const Options options_;
+    std::unordered_map<unsigned long long, Sent> last_;
+  };
+
+  class Decoder {
+  public:
+    explicit Decoder(const Options &options = Options());
+
+    /**
+     * Decodes one record
+     * @param data Encoded bytes
+     * @param length Bytes available
+     * @param record Filled with the track's posterior as now known
+     * @return Bytes consumed, 0 if the data is short or malformed
+     */
+    size_t Decode(const char *data, size_t length,
+                  FilterSnapshot::Record *record);
+
+    void Forget(unsigned long long id) { last_.erase(id); }
+
+    void Reset() { last_.clear(); }
+
+  private:
+    const Options options_;
+    std::unordered_map<unsigned long long, Sent> last_;
+  };
+};
+
+#endif /* STATE_DELTA_H_ */
@@ -0,0 +1,239 @@
+// Parameter sweep for noise tuning: parses a measurement file once, then
+// runs one UKF per point of a grid of configurations over it, in parallel
+// on all cores, and prints the RMSE and NIS consistency of each, best
+// first.
+//
+//   ukf_sweep [--config <file>] [--threads <n>] [--top <n>]
+//             --sweep <key>=<values> [--sweep <key>=<values> ...] <input>
+//
+// Each --sweep names a UKFConfig field and its values, either a list
+// "a,b,c" or a range "first:last:step"; the grid is every combination, on
+// top of --config (or the defaults), e.g.
+//
+//   ukf_sweep --sweep std_a=0.5:5:0.25 --sweep std_yawdd=0.1:1.5:0.1 data.txt
+//
+// runs 19 x 15 = 285 filters. Per configuration it prints the values, the
+// RMSE of px, py, vx, vy, and per sensor the mean NIS over its degrees of
+// freedom (1 for a consistent filter) and the fraction of updates above the
+// 95% bound (0.05 for a consistent filter). Rows are ranked by the sum of
+// the four RMSEs; --top keeps the best n. Input is text or a binary
+// measurement file, as for ukf_replay.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "binary_log.h"
+#include "log_reader.h"
+#include "thread_pool.h"
+#include "tools.h"
+#include "ukf.h"
+
+namespace {
+
+// one swept field and the values it takes
+struct Axis {
+  std::string key;
+  std::vector<double> values;
+};
+
+// outcome of one configuration
+struct Result {
+  std::vector<double> values;
+  double rmse[4];
+  double nis_lidar;
+  double nis_radar;
+  double exceeded_lidar;
+  double exceeded_radar;
+
+  double score() const { return rmse[0] + rmse[1] + rmse[2] + rmse[3]; }
+};
+
+// parses "key=a,b,c" or "key=first:last:step"; false if malformed
+bool ParseAxis(const char *text, Axis *axis) {
+  const char *eq = strchr(text, '=');
+  if (!eq || eq == text) {
+    return false;
+  }
+  axis->key.assign(text, eq - text);
+  const char *p = eq + 1;
+  char *end;
+  const double first = strtod(p, &end);
+  if (end == p) {
+    return false;
+  }
+  if (*end == ':') {
+    p = end + 1;
+    const double last = strtod(p, &end);
+    if (end == p || *end != ':') {
+      return false;
+    }
+    p = end + 1;
+    const double step = strtod(p, &end);
+    if (end == p || *end || !(step > 0.0) || last < first) {
+      return false;
+    }
+    //counted rather than accumulated, so the last value is not lost to
+    //rounding
+    const long count = static_cast<long>(floor((last - first) / step + 1e-9));
+    for (long i = 0; i <= count; i++) {
+      axis->values.push_back(first + i * step);
+    }
+    return true;
+  }
+  axis->values.push_back(first);
+  while (*end == ',') {
+    p = end + 1;
+    axis->values.push_back(strtod(p, &end));
+    if (end == p) {
+      return false;
+    }
+  }
+  return *end == '\0';
+}
+
+// runs one filter over the records
+void Run(const UKFConfig &config, const std::vector<LogRecord> &records,
+         Result *result) {
+  UKF ukf(config);
+  RMSEAccumulator rmse;
+  for (size_t i = 0; i < records.size(); i++) {
+    const LogRecord &record = records[i];
+    ukf.ProcessMeasurement(record.meas);
+    const UKF::StateVector &x = ukf.x();
+    Eigen::Vector4d estimate(x(0), x(1), cos(x(3)) * x(2), sin(x(3)) * x(2));
+    rmse.Add(estimate, Eigen::Vector4d(record.ground_truth));
+  }
+  const Eigen::Vector4d r = rmse.RMSE();
+  for (int k = 0; k < 4; k++) {
+    result->rmse[k] = r(k);
+  }
+  const UKF::NisCounter &lidar = ukf.nis_counter_lidar_;
+  const UKF::NisCounter &radar = ukf.nis_counter_radar_;
+  result->nis_lidar = lidar.Average() / UKF::n_z_lidar_;
+  result->nis_radar = radar.Average() / UKF::n_z_radar_;
+  result->exceeded_lidar = lidar.ExceededFraction();
+  result->exceeded_radar = radar.ExceededFraction();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+  const char *input_path = nullptr;
+  UKFConfig config;
+  int threads = 0;
+  size_t top = 0;
+  std::vector<Axis> axes;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      std::string error;
+      if (!config.Load(argv[++i], &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+      top = static_cast<size_t>(atol(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc) {
+      Axis axis;
+      UKFConfig probe;
+      if (!ParseAxis(argv[++i], &axis) || !probe.Set(axis.key, 0.0)) {
+        std::cerr << "Bad --sweep " << argv[i] << std::endl;
+        return 2;
+      }
+      axes.push_back(axis);
+    }
+    else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      input_path = nullptr;
+      break;
+    }
+    else {
+      input_path = argv[i];
+    }
+  }
+  if (!input_path || axes.empty()) {
+    std::cerr << "usage: ukf_sweep [--config <file>] [--threads <n>] "
+              << "[--top <n>] --sweep <key>=<a,b,...|first:last:step> "
+              << "[--sweep ...] <input>" << std::endl;
+    return 2;
+  }
+
+  ThreadPool pool(threads);
+  std::vector<LogRecord> records;
+  size_t skipped = 0;
+  if (BinaryLog::IsMeasurementFile(input_path)) {
+    if (!BinaryLog::ReadMeasurements(input_path, &records)) {
+      std::cerr << "Cannot read " << input_path << std::endl;
+      return 1;
+    }
+  }
+  else if (!LogReader::Load(input_path, &pool, &records, &skipped)) {
+    std::cerr << "Cannot open " << input_path << std::endl;
+    return 1;
+  }
+
+  //every point of the grid, the first axis varying slowest
+  std::vector<Result> results(1);
+  for (size_t a = 0; a < axes.size(); a++) {
+    std::vector<Result> grid;
+    grid.reserve(results.size() * axes[a].values.size());
+    for (size_t r = 0; r < results.size(); r++) {
+      for (size_t v = 0; v < axes[a].values.size(); v++) {
+        grid.push_back(results[r]);
+        grid.back().values.push_back(axes[a].values[v]);
+      }
+    }
+    results.swap(grid);
+  }
+
+  //one configuration per chunk: each filter run takes the same time, and
+  //there are far more runs than cores
+  pool.ParallelFor(0, static_cast<int>(results.size()), 1,
+                   [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      UKFConfig point = config;
+      for (size_t a = 0; a < axes.size(); a++) {
+        point.Set(axes[a].key, results[c].values[a]);
+      }
+      Run(point, records, &results[c]);
+    }
+  });
+
+  const size_t configurations = results.size();
+  std::stable_sort(results.begin(), results.end(),
+                   [](const Result &a, const Result &b) {
+    return a.score() < b.score();
+  });
+  if (top > 0 && top < results.size()) {
+    results.resize(top);
+  }
+
+  printf("measurements %zu skipped %zu configurations %zu\n", records.size(),
+         skipped, configurations);
+  for (size_t a = 0; a < axes.size(); a++) {
+    printf("%-10s ", axes[a].key.c_str());
+  }
+  printf("%-10s %-10s %-10s %-10s %-9s %-9s %-9s %s\n", "rmse_px",
+         "rmse_py", "rmse_vx", "rmse_vy", "nis_lidar", "nis_radar",
+         "above_l", "above_r");
+  for (size_t r = 0; r < results.size(); r++) {
+    const Result &result = results[r];
+    for (size_t a = 0; a < axes.size(); a++) {
+      printf("%-10g ", result.values[a]);
+    }
+    printf("%-10.6f %-10.6f %-10.6f %-10.6f %-9.3f %-9.3f %-9.3f %.3f\n",
+           result.rmse[0], result.rmse[1], result.rmse[2], result.rmse[3],
+           result.nis_lidar, result.nis_radar, result.exceeded_lidar,
+           result.exceeded_radar);
+  }
+  return 0;
+}
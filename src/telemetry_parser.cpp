@@ -0,0 +1,660 @@
+#include "telemetry_parser.h"
+#include <charconv>
+#include <cstring>
+
+namespace {
+
+// powers of ten that are exact in a double
+const double kPow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+const char kEvent[] = "telemetry";
+const char kKey[] = "\"sensor_measurement\"";
+const char kKeyName[] = "sensor_measurement";
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+const char *SkipSpace(const char *p, const char *end) {
+  while (p < end && IsSpace(*p)) ++p;
+  return p;
+}
+
+// field separators inside the measurement line: whitespace, or a JSON escape
+// such as \t when the line is still JSON encoded
+const char *SkipSeparators(const char *p, const char *end) {
+  for (;;) {
+    if (p < end && IsSpace(*p)) {
+      ++p;
+    }
+    else if (p + 1 < end && *p == '\\') {
+      p += 2;
+    }
+    else {
+      return p;
+    }
+  }
+}
+
+// first occurrence of needle in [p, end)
+const char *Find(const char *p, const char *end, const char *needle,
+                 size_t needle_length) {
+  if (needle_length == 0) return p;
+  while (static_cast<size_t>(end - p) >= needle_length) {
+    const char *hit = static_cast<const char *>(
+        memchr(p, needle[0], end - p - needle_length + 1));
+    if (!hit) return nullptr;
+    if (memcmp(hit, needle, needle_length) == 0) return hit;
+    p = hit + 1;
+  }
+  return 0;
+}
+
+// nesting allowed inside a frame before ParseJson gives up
+const int kMaxJsonDepth = 32;
+
+void AppendUtf8(unsigned code, std::string *out) {
+  if (code < 0x80) {
+    out->push_back(static_cast<char>(code));
+  }
+  else if (code < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (code >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+  }
+  else if (code < 0x10000) {
+    out->push_back(static_cast<char>(0xE0 | (code >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+  }
+  else {
+    out->push_back(static_cast<char>(0xF0 | (code >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+  }
+}
+
+// A pull reader over one JSON text: whitespace is skipped before every
+// token, values are validated as they are skipped, and strings are decoded
+// into a caller's buffer
+class JsonCursor {
+public:
+  JsonCursor(const char *p, const char *end) : p_(p), end_(end) {}
+
+  // consumes c if it is the next token
+  bool Consume(char c) {
+    p_ = SkipSpace(p_, end_);
+    if (p_ < end_ && *p_ == c) {
+      ++p_;
+      return true;
+    }
+    return false;
+  }
+
+  bool ConsumeLiteral(const char *word, size_t length) {
+    p_ = SkipSpace(p_, end_);
+    if (static_cast<size_t>(end_ - p_) >= length &&
+        memcmp(p_, word, length) == 0) {
+      p_ += length;
+      return true;
+    }
+    return false;
+  }
+
+  bool NextIsString() { return NextIs('"'); }
+
+  // whether c starts the next token, without consuming it
+  bool NextIs(char c) {
+    p_ = SkipSpace(p_, end_);
+    return p_ < end_ && *p_ == c;
+  }
+
+  // reads a number, true or false
+  bool ReadNumber(double *out) {
+    p_ = SkipSpace(p_, end_);
+    if (ConsumeLiteral("true", 4)) {
+      *out = 1.0;
+      return true;
+    }
+    if (ConsumeLiteral("false", 5)) {
+      *out = 0.0;
+      return true;
+    }
+    return p_ < end_ && (*p_ == '-' || IsDigit(*p_)) &&
+           TelemetryParser::ParseDouble(&p_, end_, out);
+  }
+
+  bool AtEnd() {
+    p_ = SkipSpace(p_, end_);
+    return p_ == end_;
+  }
+
+  // reads a string token, decoded into out unless out is null
+  bool ReadString(std::string *out) {
+    if (!Consume('"')) return false;
+    if (out) out->clear();
+    while (p_ < end_) {
+      const char c = *p_++;
+      if (c == '"') {
+        return true;
+      }
+      if (c != '\\') {
+        if (out) out->push_back(c);
+        continue;
+      }
+      if (p_ == end_) return false;
+      const char e = *p_++;
+      char plain;
+      switch (e) {
+        case '"': plain = '"'; break;
+        case '\\': plain = '\\'; break;
+        case '/': plain = '/'; break;
+        case 'b': plain = '\b'; break;
+        case 'f': plain = '\f'; break;
+        case 'n': plain = '\n'; break;
+        case 'r': plain = '\r'; break;
+        case 't': plain = '\t'; break;
+        case 'u': {
+          unsigned code;
+          if (!ReadHex4(&code)) return false;
+          //a surrogate pair encodes one code point above U+FFFF
+          if (code >= 0xD800 && code < 0xDC00 && end_ - p_ >= 6 &&
+              p_[0] == '\\' && p_[1] == 'u') {
+            p_ += 2;
+            unsigned low;
+            if (!ReadHex4(&low) || low < 0xDC00 || low >= 0xE000) {
+              return false;
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          }
+          if (out) AppendUtf8(code, out);
+          continue;
+        }
+        default:
+          return false;
+      }
+      if (out) out->push_back(plain);
+    }
+    return false;
+  }
+
+  // validates and steps over one value of any type
+  bool SkipValue(int depth) {
+    if (depth > kMaxJsonDepth) return false;
+    p_ = SkipSpace(p_, end_);
+    if (p_ == end_) return false;
+    switch (*p_) {
+      case '"':
+        return ReadString(nullptr);
+      case '{':
+        ++p_;
+        if (Consume('}')) return true;
+        do {
+          if (!ReadString(nullptr) || !Consume(':') || !SkipValue(depth + 1)) {
+            return false;
+          }
+        } while (Consume(','));
+        return Consume('}');
+      case '[':
+        ++p_;
+        if (Consume(']')) return true;
+        do {
+          if (!SkipValue(depth + 1)) return false;
+        } while (Consume(','));
+        return Consume(']');
+      case 't':
+        return ConsumeLiteral("true", 4);
+      case 'f':
+        return ConsumeLiteral("false", 5);
+      case 'n':
+        return ConsumeLiteral("null", 4);
+      default: {
+        double ignored;
+        return TelemetryParser::ParseDouble(&p_, end_, &ignored);
+      }
+    }
+  }
+
+private:
+  bool ReadHex4(unsigned *code) {
+    if (end_ - p_ < 4) return false;
+    unsigned value = 0;
+    for (int i = 0; i < 4; i++) {
+      const char h = *p_++;
+      value <<= 4;
+      if (h >= '0' && h <= '9') value |= h - '0';
+      else if (h >= 'a' && h <= 'f') value |= h - 'a' + 10;
+      else if (h >= 'A' && h <= 'F') value |= h - 'A' + 10;
+      else return false;
+    }
+    *code = value;
+    return true;
+  }
+
+  const char *p_;
+  const char *end_;
+};
+
+}  // namespace
+
+TelemetryParser::TelemetryParser()
+    : current_(&laser_),
+      has_ground_truth_(false),
+      parse_ground_truth_(true),
+      setting_count_(0) {
+  laser_.sensor_type_ = MeasurementPackage::LASER;
+  laser_.raw_measurements_ = Eigen::VectorXd::Zero(2);
+  laser_.timestamp_ = 0;
+  radar_.sensor_type_ = MeasurementPackage::RADAR;
+  radar_.raw_measurements_ = Eigen::VectorXd::Zero(3);
+  radar_.timestamp_ = 0;
+  ground_truth_.setZero();
+  name_.reserve(32);
+  key_.reserve(32);
+  line_.reserve(256);
+}
+
+TelemetryParser::Result TelemetryParser::Parse(const char *data,
+                                               size_t length) {
+  const char *end = data + length;
+  const char *p = data;
+
+  //Socket.IO event prefix
+  if (length < 2 || p[0] != '4' || p[1] != '2') {
+    return MALFORMED;
+  }
+  p += 2;
+
+  p = SkipSpace(p, end);
+  if (p == end || *p != '[') {
+    return NO_DATA;
+  }
+  p = SkipSpace(p + 1, end);
+
+  //event name
+  if (p == end || *p != '"') {
+    return MALFORMED;
+  }
+  const char *name = ++p;
+  while (p < end && *p != '"') ++p;
+  if (p == end) {
+    return MALFORMED;
+  }
+  size_t name_length = p - name;
+  p = SkipSpace(p + 1, end);
+
+  //payload: null means manual mode
+  if (p < end && *p == ']') {
+    return NO_DATA;
+  }
+  if (p == end || *p != ',') {
+    return MALFORMED;
+  }
+  p = SkipSpace(p + 1, end);
+  if (end - p >= 4 && memcmp(p, "null", 4) == 0) {
+    return NO_DATA;
+  }
+
+  if (name_length != sizeof(kEvent) - 1 ||
+      memcmp(name, kEvent, name_length) != 0) {
+    return OTHER_EVENT;
+  }
+
+  //the sensor_measurement string
+  const char *key = Find(p, end, kKey, sizeof(kKey) - 1);
+  if (!key) {
+    return MALFORMED;
+  }
+  p = SkipSpace(key + sizeof(kKey) - 1, end);
+  if (p == end || *p != ':') {
+    return MALFORMED;
+  }
+  p = SkipSpace(p + 1, end);
+  if (p == end || *p != '"') {
+    return MALFORMED;
+  }
+  const char *line = ++p;
+  while (p < end && *p != '"') {
+    p += (*p == '\\') ? 2 : 1;
+  }
+  if (p >= end) {
+    return MALFORMED;
+  }
+
+  return ParseMeasurement(line, p) ? TELEMETRY : MALFORMED;
+}
+
+TelemetryParser::Result TelemetryParser::ParseJson(const char *data,
+                                                   size_t length) {
+  if (length < 2 || data[0] != '4' || data[1] != '2') {
+    return MALFORMED;
+  }
+  JsonCursor json(data + 2, data + length);
+  if (!json.Consume('[')) {
+    return json.AtEnd() ? NO_DATA : MALFORMED;
+  }
+  if (!json.ReadString(&name_)) {
+    return MALFORMED;
+  }
+  if (json.Consume(']')) {
+    return json.AtEnd() ? NO_DATA : MALFORMED;
+  }
+  if (!json.Consume(',')) {
+    return MALFORMED;
+  }
+
+  //payload: null means manual mode; only telemetry payloads are read
+  bool null_payload = false;
+  bool found = false;
+  if (json.ConsumeLiteral("null", 4)) {
+    null_payload = true;
+  }
+  else if (name_ != kEvent) {
+    if (!json.SkipValue(1)) {
+      return MALFORMED;
+    }
+  }
+  else {
+    if (!json.Consume('{')) {
+      return MALFORMED;
+    }
+    if (!json.Consume('}')) {
+      do {
+        if (!json.ReadString(&key_) || !json.Consume(':')) {
+          return MALFORMED;
+        }
+        if (!found && key_ == kKeyName && json.NextIsString()) {
+          found = json.ReadString(&line_);
+          if (!found) {
+            return MALFORMED;
+          }
+        }
+        else if (!json.SkipValue(2)) {
+          return MALFORMED;
+        }
+      } while (json.Consume(','));
+      if (!json.Consume('}')) {
+        return MALFORMED;
+      }
+    }
+  }
+
+  //any further elements, then the end of the array
+  while (json.Consume(',')) {
+    if (!json.SkipValue(1)) {
+      return MALFORMED;
+    }
+  }
+  if (!json.Consume(']') || !json.AtEnd()) {
+    return MALFORMED;
+  }
+
+  if (null_payload) {
+    return NO_DATA;
+  }
+  if (name_ != kEvent) {
+    return OTHER_EVENT;
+  }
+  if (!found) {
+    return MALFORMED;
+  }
+  return ParseMeasurement(line_.data(), line_.data() + line_.size())
+             ? TELEMETRY : MALFORMED;
+}
+
+TelemetryParser::Result TelemetryParser::ParseEvent(const char *data,
+                                                    size_t length) {
+  setting_count_ = 0;
+  size_t count = 0;
+  if (length < 2 || data[0] != '4' || data[1] != '2') {
+    return MALFORMED;
+  }
+  JsonCursor json(data + 2, data + length);
+  if (!json.Consume('[') || !json.ReadString(&name_) || name_ == kEvent) {
+    return MALFORMED;
+  }
+
+  //settings reuse their key buffers, so a warm parser does not allocate
+  auto add = [this, &count](double value) {
+    if (count == kMaxSettings) {
+      return false;
+    }
+    if (count == settings_.size()) {
+      settings_.push_back(Setting());
+    }
+    settings_[count].key.assign(key_);
+    settings_[count].value = value;
+    ++count;
+    return true;
+  };
+
+  //an object payload is read member by member; anything else is skipped
+  if (json.Consume(',')) {
+    if (!json.NextIs('{')) {
+      if (!json.SkipValue(1)) {
+        return MALFORMED;
+      }
+    }
+    else {
+      json.Consume('{');
+      if (!json.Consume('}')) {
+        do {
+          if (!json.ReadString(&key_) || !json.Consume(':')) {
+            return MALFORMED;
+          }
+          double value;
+          if (json.ReadNumber(&value)) {
+            if (!add(value)) {
+              return MALFORMED;
+            }
+          }
+          else if (json.Consume('[')) {
+            //one setting per number of an array, all under its key
+            if (!json.Consume(']')) {
+              do {
+                if (json.ReadNumber(&value)) {
+                  if (!add(value)) {
+                    return MALFORMED;
+                  }
+                }
+                else if (!json.SkipValue(3)) {
+                  return MALFORMED;
+                }
+              } while (json.Consume(','));
+              if (!json.Consume(']')) {
+                return MALFORMED;
+              }
+            }
+          }
+          else if (!json.SkipValue(2)) {
+            return MALFORMED;
+          }
+        } while (json.Consume(','));
+        if (!json.Consume('}')) {
+          return MALFORMED;
+        }
+      }
+    }
+    while (json.Consume(',')) {
+      if (!json.SkipValue(1)) {
+        return MALFORMED;
+      }
+    }
+  }
+  if (!json.Consume(']') || !json.AtEnd()) {
+    return MALFORMED;
+  }
+  setting_count_ = count;
+  return OTHER_EVENT;
+}
+
+bool TelemetryParser::ParseMeasurement(const char *begin, const char *end) {
+  const char *p = SkipSeparators(begin, end);
+  if (p == end) {
+    return false;
+  }
+
+  MeasurementPackage *meas;
+  int n_values;
+  if (*p == 'L') {
+    meas = &laser_;
+    n_values = 2;
+  }
+  else if (*p == 'R') {
+    meas = &radar_;
+    n_values = 3;
+  }
+  else {
+    return false;
+  }
+  ++p;
+
+  for (int i = 0; i < n_values; i++) {
+    p = SkipSeparators(p, end);
+    double value;
+    if (!ParseDouble(&p, end, &value)) {
+      return false;
+    }
+    meas->raw_measurements_(i) = value;
+  }
+
+  p = SkipSeparators(p, end);
+  long long timestamp;
+  if (!ParseInt64(&p, end, &timestamp)) {
+    return false;
+  }
+  meas->timestamp_ = timestamp;
+  current_ = meas;
+
+  //ground truth is optional
+  if (!parse_ground_truth_) {
+    has_ground_truth_ = false;
+    return true;
+  }
+  has_ground_truth_ = true;
+  for (int i = 0; i < 4; i++) {
+    p = SkipSeparators(p, end);
+    double value;
+    if (!ParseDouble(&p, end, &value)) {
+      has_ground_truth_ = false;
+      ground_truth_.setZero();
+      break;
+    }
+    ground_truth_(i) = value;
+  }
+  return true;
+}
+
+bool TelemetryParser::ParseInt64(const char **p, const char *end,
+                                 long long *out) {
+  const char *s = *p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = (*s == '-');
+    ++s;
+  }
+  if (s == end || !IsDigit(*s)) {
+    return false;
+  }
+  unsigned long long value = 0;
+  while (s < end && IsDigit(*s)) {
+    value = value * 10 + (*s - '0');
+    ++s;
+  }
+  *out = negative ? -static_cast<long long>(value)
+                  : static_cast<long long>(value);
+  *p = s;
+  return true;
+}
+
+bool TelemetryParser::ParseDouble(const char **p, const char *end,
+                                  double *out) {
+  const char *s = *p;
+  const char *start = s;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = (*s == '-');
+    ++s;
+  }
+
+  //up to 19 significant digits fit in the mantissa
+  unsigned long long mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  bool exact = true;
+  while (s < end && IsDigit(*s)) {
+    any = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*s - '0');
+      if (mantissa) ++digits;
+    }
+    else {
+      ++exponent;
+      exact = false;
+    }
+    ++s;
+  }
+  if (s < end && *s == '.') {
+    ++s;
+    while (s < end && IsDigit(*s)) {
+      any = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*s - '0');
+        if (mantissa) ++digits;
+        --exponent;
+      }
+      else {
+        exact = false;
+      }
+      ++s;
+    }
+  }
+  if (!any) {
+    return false;
+  }
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char *e = s + 1;
+    bool exp_negative = false;
+    if (e < end && (*e == '-' || *e == '+')) {
+      exp_negative = (*e == '-');
+      ++e;
+    }
+    if (e < end && IsDigit(*e)) {
+      int exp_value = 0;
+      while (e < end && IsDigit(*e)) {
+        if (exp_value < 10000) exp_value = exp_value * 10 + (*e - '0');
+        ++e;
+      }
+      exponent += exp_negative ? -exp_value : exp_value;
+      s = e;
+    }
+  }
+
+  //exact when both the mantissa and the power of ten are exact doubles
+  double value;
+  if (exact && mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+    value = static_cast<double>(mantissa);
+    value = exponent < 0 ? value / kPow10[-exponent] : value * kPow10[exponent];
+  }
+  else {
+    //correctly rounded in place; from_chars takes no leading '+'
+    const char *first = *start == '+' ? start + 1 : start;
+    if (std::from_chars(first, s, *out).ec != std::errc()) {
+      return false;
+    }
+    *p = s;
+    return true;
+  }
+
+  *out = negative ? -value : value;
+  *p = s;
+  return true;
+}
@@ -0,0 +1,163 @@
+#ifndef TELEMETRY_PARSER_H_
+#define TELEMETRY_PARSER_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "Eigen/Dense"
+#include "measurement_package.h"
+
+/**
+ * Allocation-free parser for the simulator's Socket.IO telemetry frames,
+ *
+ *   42["telemetry",{"sensor_measurement":"L\t<px>\t<py>\t<ts>\t<gt>..."}]
+ *
+ * working directly on the buffer handed over by uWS. Only the event name
+ * and the sensor_measurement string are looked at; no JSON tree, strings or
+ * streams are built. Numbers are parsed without locale, exactly for the
+ * usual short decimal forms and through std::from_chars for anything
+ * longer.
+ *
+ * The measurement is written into one of two packages owned by the parser
+ * (one per sensor type), whose vectors are sized once at construction.
+ */
+class TelemetryParser {
+public:
+  enum Result {
+    ///* a telemetry event with a measurement
+    TELEMETRY,
+    ///* a frame without data, the simulator expects a "manual" reply
+    NO_DATA,
+    ///* a well-formed event other than telemetry
+    OTHER_EVENT,
+    ///* anything this scanner does not understand
+    MALFORMED
+  };
+
+  TelemetryParser();
+
+  /**
+   * Parses one Socket.IO frame
+   * @param data Frame bytes, not necessarily NUL terminated
+   * @param length Number of bytes
+   */
+  Result Parse(const char *data, size_t length);
+
+  /**
+   * Parses a frame Parse rejected, as any valid JSON: a streaming reader
+   * walks the event array once, decodes the event name and the
+   * sensor_measurement string (escapes included) into buffers kept by the
+   * parser, and skips everything else without building a tree. Slower than
+   * Parse, but it accepts any spacing, key order or escaping.
+   * @param data Frame bytes, not necessarily NUL terminated
+   * @param length Number of bytes
+   * @return MALFORMED for invalid JSON or a telemetry event without a
+   *         readable measurement
+   */
+  Result ParseJson(const char *data, size_t length);
+
+  ///* A number or boolean member of a control event's payload, or one
+  ///* number of an array member
+  struct Setting {
+    std::string key;
+    ///* true and false read as 1 and 0
+    double value;
+  };
+
+  /**
+   * Parses a control event Parse returned OTHER_EVENT for, such as
+   * 42["config",{"std_a":2.5}], with the reader of ParseJson: the event name
+   * goes to event() and the number and boolean members of an object payload,
+   * in order, to setting(); an array member such as "ids":[3,7] gives one
+   * setting per number, under its key. Other members and values are
+   * validated and skipped.
+   * Nothing throws and the buffers are reused, so a stream of bad frames
+   * costs no more than a stream of good ones.
+   * @param data Frame bytes, not necessarily NUL terminated
+   * @param length Number of bytes
+   * @return OTHER_EVENT, or MALFORMED for invalid JSON, a telemetry event or
+   *         more than kMaxSettings settings
+   */
+  Result ParseEvent(const char *data, size_t length);
+
+  ///* most settings one event may carry
+  static const size_t kMaxSettings = 64;
+
+  ///* the last event's name and settings
+  const std::string &event() const { return name_; }
+  size_t setting_count() const { return setting_count_; }
+  const Setting &setting(size_t i) const { return settings_[i]; }
+
+  /**
+   * Parses one measurement line in the "L px py ts gt..." / "R rho phi
+   * rho_dot ts gt..." format. Fields may be separated by whitespace or by
+   * JSON escapes such as \t.
+   * @param begin First character of the line
+   * @param end One past the last character
+   * @return true if the sensor type, measurement and timestamp were read
+   */
+  bool ParseMeasurement(const char *begin, const char *end);
+
+  /**
+   * The last parsed measurement; valid after TELEMETRY or a successful
+   * ParseMeasurement
+   */
+  const MeasurementPackage &measurement() const { return *current_; }
+
+  /**
+   * [x, y, vx, vy] ground truth of the last measurement line
+   */
+  const Eigen::Vector4d &ground_truth() const { return ground_truth_; }
+
+  /**
+   * Whether the last line carried all four ground-truth values
+   */
+  bool has_ground_truth() const { return has_ground_truth_; }
+
+  /**
+   * Whether measurement lines are scanned past the timestamp for ground
+   * truth (the default); with false has_ground_truth() stays false
+   */
+  void set_parse_ground_truth(bool parse) { parse_ground_truth_ = parse; }
+
+  ///* heap bytes of the decoded strings
+  size_t MemoryBytes() const {
+    size_t bytes = name_.capacity() + key_.capacity() + line_.capacity() +
+                   settings_.capacity() * sizeof(Setting);
+    for (size_t i = 0; i < settings_.size(); i++) {
+      bytes += settings_[i].key.capacity();
+    }
+    return bytes;
+  }
+
+  /**
+   * Locale-independent number parsing
+   * @param p Cursor, advanced past the number on success
+   * @param end End of the buffer
+   * @param out Parsed value
+   */
+  static bool ParseDouble(const char **p, const char *end, double *out);
+  static bool ParseInt64(const char **p, const char *end, long long *out);
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  MeasurementPackage laser_;
+  MeasurementPackage radar_;
+  MeasurementPackage *current_;
+  Eigen::Vector4d ground_truth_;
+  bool has_ground_truth_;
+  bool parse_ground_truth_;
+
+  ///* ParseJson's decoded strings, reused from frame to frame
+  std::string name_;
+  std::string key_;
+  std::string line_;
+
+  ///* ParseEvent's settings; entries past setting_count_ keep their key
+  ///* buffers for the next event
+  std::vector<Setting> settings_;
+  size_t setting_count_;
+};
+
+#endif /* TELEMETRY_PARSER_H_ */
@@ -0,0 +1,239 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#ifdef UKF_EXECUTOR_TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#endif
+
+#ifndef UKF_DEFAULT_EXECUTOR
+#define UKF_DEFAULT_EXECUTOR WORK_STEALING
+#endif
+
+#ifdef UKF_EXECUTOR_TBB
+struct ThreadPool::Arena {
+  explicit Arena(int threads) : arena(threads) {}
+
+  tbb::task_arena arena;
+};
+#else
+struct ThreadPool::Arena {};
+#endif
+
+namespace {
+
+const char *const kNames[ThreadPool::BACKEND_COUNT] = {
+  "work-stealing", "openmp", "tbb"
+};
+
+int ResolveThreads(int threads) {
+  if (threads < 1) {
+    threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  }
+  return threads;
+}
+
+ThreadPool::Backend Resolve(ThreadPool::Backend backend) {
+  return ThreadPool::Available(backend) ? backend : ThreadPool::WORK_STEALING;
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(int threads, Backend backend)
+    : backend_(Resolve(backend)), threads_(ResolveThreads(threads)),
+      arena_(0), body_(0), generation_(0), busy_workers_(0), stop_(false) {
+#ifdef UKF_EXECUTOR_TBB
+  if (backend_ == TBB) {
+    arena_ = new Arena(threads_);
+  }
+#endif
+  if (backend_ != WORK_STEALING) {
+    return;
+  }
+  queues_ = std::vector<ChunkQueue>(threads_);
+  for (int i = 1; i < threads_; i++) {
+    workers_.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+  }
+}
+
+ThreadPool::Backend ThreadPool::DefaultBackend() {
+  Backend backend = UKF_DEFAULT_EXECUTOR;
+  const char *requested = getenv("UKF_EXECUTOR");
+  if (requested) {
+    ParseBackend(requested, &backend);
+  }
+  return Resolve(backend);
+}
+
+bool ThreadPool::Available(Backend backend) {
+  switch (backend) {
+  case WORK_STEALING:
+    return true;
+  case OPENMP:
+#ifdef UKF_EXECUTOR_OPENMP
+    return true;
+#else
+    return false;
+#endif
+  case TBB:
+#ifdef UKF_EXECUTOR_TBB
+    return true;
+#else
+    return false;
+#endif
+  default:
+    return false;
+  }
+}
+
+const char *ThreadPool::Name(Backend backend) {
+  return backend >= 0 && backend < BACKEND_COUNT ? kNames[backend] : "";
+}
+
+bool ThreadPool::ParseBackend(const char *name, Backend *backend) {
+  for (int i = 0; i < BACKEND_COUNT; i++) {
+    if (strcmp(name, kNames[i]) == 0) {
+      *backend = Backend(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+ThreadPool::~ThreadPool() {
+  delete arena_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_cv_.notify_all();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    workers_[i].join();
+  }
+}
+
+void ThreadPool::ParallelFor(int begin, int end, int grain,
+                             const std::function<void(int, int)> &body) {
+  if (end <= begin) {
+    return;
+  }
+  grain = std::max(1, grain);
+  int chunks = (end - begin + grain - 1) / grain;
+
+  //nothing to share: run inline
+  if (threads_ == 1 || chunks == 1) {
+    for (int b = begin; b < end; b += grain) {
+      body(b, std::min(end, b + grain));
+    }
+    return;
+  }
+
+  //the runtimes' executors take the same chunks, one per iteration
+#ifdef UKF_EXECUTOR_OPENMP
+  if (backend_ == OPENMP) {
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads_)
+    for (int c = 0; c < chunks; c++) {
+      const int b = begin + c * grain;
+      body(b, std::min(end, b + grain));
+    }
+    return;
+  }
+#endif
+#ifdef UKF_EXECUTOR_TBB
+  if (backend_ == TBB) {
+    arena_->arena.execute([&] {
+      tbb::parallel_for(
+          tbb::blocked_range<int>(0, chunks, 1),
+          [&](const tbb::blocked_range<int> &range) {
+            for (int c = range.begin(); c != range.end(); c++) {
+              const int b = begin + c * grain;
+              body(b, std::min(end, b + grain));
+            }
+          },
+          tbb::simple_partitioner());
+    });
+    return;
+  }
+#endif
+
+  //deal the chunks round-robin
+  int n_queues = static_cast<int>(queues_.size());
+  for (int c = 0; c < chunks; c++) {
+    int b = begin + c * grain;
+    ChunkQueue &q = queues_[c % n_queues];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    q.chunks.push_back(std::make_pair(b, std::min(end, b + grain)));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    body_ = &body;
+    busy_workers_ = static_cast<int>(workers_.size());
+    generation_++;
+  }
+  start_cv_.notify_all();
+
+  RunChunks(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+  body_ = 0;
+}
+
+void ThreadPool::WorkerLoop(int index) {
+  unsigned long long seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_cv_.wait(lock, [this, seen] {
+        return stop_ || generation_ != seen;
+      });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+    }
+
+    RunChunks(index);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--busy_workers_ == 0) {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+void ThreadPool::RunChunks(int index) {
+  std::pair<int, int> chunk;
+  while (TakeChunk(index, &chunk)) {
+    (*body_)(chunk.first, chunk.second);
+  }
+}
+
+bool ThreadPool::TakeChunk(int index, std::pair<int, int> *chunk) {
+  //own queue first, oldest chunk
+  {
+    ChunkQueue &q = queues_[index];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (!q.chunks.empty()) {
+      *chunk = q.chunks.front();
+      q.chunks.pop_front();
+      return true;
+    }
+  }
+
+  //steal the newest chunk from the others
+  int n_queues = static_cast<int>(queues_.size());
+  for (int k = 1; k < n_queues; k++) {
+    ChunkQueue &q = queues_[(index + k) % n_queues];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (!q.chunks.empty()) {
+      *chunk = q.chunks.back();
+      q.chunks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
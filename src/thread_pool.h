@@ -0,0 +1,127 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Fixed-size thread pool for data-parallel loops.
+ *
+ * ParallelFor splits [begin, end) into chunks of `grain` indices and runs
+ * them on one of three executors:
+ *
+ *   WORK_STEALING  the pool's own workers: the chunks are dealt round-robin
+ *                  onto one queue per participant (the workers plus the
+ *                  calling thread); each drains its own queue from the
+ *                  front and steals from the back of the others
+ *   OPENMP         a parallel loop on the OpenMP runtime's threads
+ *   TBB            a parallel_for in a task_arena of the pool's size, on
+ *                  the TBB scheduler's threads
+ *
+ * Only WORK_STEALING starts threads of its own. The others share the
+ * runtime's, so a host application that already runs OpenMP or TBB keeps
+ * one set of threads per core instead of adding the pool's to its own.
+ * Which backends exist is a build option (UKF_EXECUTOR); UKF_EXECUTOR in
+ * the environment (work-stealing, openmp, tbb) overrides the default, and
+ * a backend not built in falls back to WORK_STEALING.
+ *
+ * Every backend runs the same chunks, but which thread runs a chunk varies
+ * between calls, so bodies must not depend on it.
+ */
+class ThreadPool {
+public:
+  enum Backend {
+    WORK_STEALING,
+    OPENMP,
+    TBB,
+    BACKEND_COUNT
+  };
+
+  /**
+   * Constructor
+   * @param threads Total number of threads including the caller; values
+   * below 1 use std::thread::hardware_concurrency()
+   * @param backend Executor of the loops
+   */
+  explicit ThreadPool(int threads, Backend backend = DefaultBackend());
+
+  /**
+   * Destructor, joins the workers
+   */
+  virtual ~ThreadPool();
+
+  /**
+   * Number of threads that take part in a ParallelFor, including the caller
+   */
+  int size() const { return threads_; }
+
+  ///* the executor in use, after any fallback
+  Backend backend() const { return backend_; }
+
+  /**
+   * The build's default executor, or the one UKF_EXECUTOR names
+   */
+  static Backend DefaultBackend();
+
+  /**
+   * Whether a backend was built in
+   */
+  static bool Available(Backend backend);
+
+  /**
+   * Name of a backend as UKF_EXECUTOR spells it
+   */
+  static const char *Name(Backend backend);
+
+  /**
+   * Parses a backend name
+   * @return false if it names none
+   */
+  static bool ParseBackend(const char *name, Backend *backend);
+
+  /**
+   * Runs body(chunk_begin, chunk_end) over [begin, end) and returns when all
+   * chunks are done. Not reentrant: call from one thread at a time.
+   * @param begin First index
+   * @param end One past the last index
+   * @param grain Indices per chunk
+   * @param body Function called once per chunk
+   */
+  void ParallelFor(int begin, int end, int grain,
+                   const std::function<void(int, int)> &body);
+
+private:
+  struct ChunkQueue {
+    std::mutex mutex;
+    std::deque<std::pair<int, int> > chunks;
+  };
+
+  // the TBB backend's task_arena, defined where TBB is included
+  struct Arena;
+
+  void WorkerLoop(int index);
+  void RunChunks(int index);
+  bool TakeChunk(int index, std::pair<int, int> *chunk);
+
+  Backend backend_;
+  int threads_;
+  Arena *arena_;
+
+  std::vector<std::thread> workers_;
+  std::vector<ChunkQueue> queues_;
+
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(int, int)> *body_;
+  unsigned long long generation_;
+  int busy_workers_;
+  bool stop_;
+};
+
+#endif /* THREAD_POOL_H_ */
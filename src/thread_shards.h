@@ -0,0 +1,137 @@
+#ifndef THREAD_SHARDS_H_
+#define THREAD_SHARDS_H_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+ * One T per thread for statistics that many threads bump and few read, so
+ * that every thread writes only its own cache lines.
+ *
+ * A thread's shard is created on its first Local() and registered; readers
+ * combine the shards with ForEach, under the registry's lock. When the
+ * thread exits its shard is kept, values included, and handed to the next
+ * new thread, so totals summed over every shard never go backwards and
+ * there are never more shards than threads that ran at once. T's fields
+ * must be atomics, since a reader may load them while their owner writes;
+ * the owner updates them with AddOwned, a relaxed load and store rather than
+ * a locked read-modify-write.
+ *
+ * Each T is its own set of shards; T should be a type of the one file that
+ * uses it.
+ */
+template <typename T>
+class ThreadShards {
+public:
+  /**
+   * The calling thread's shard, created on first use (which allocates)
+   * @return nullptr while the thread is being torn down, after its shard
+   * was handed back
+   */
+  static T *Local() {
+    T *shard = local_;
+    return shard ? shard : Attach();
+  }
+
+  /**
+   * Calls f(const T &) on every shard, live or kept from an exited thread
+   */
+  template <typename F>
+  static void ForEach(F f) {
+    Registry &registry = Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (size_t i = 0; i < registry.shards.size(); i++) {
+      f(*registry.shards[i]);
+    }
+  }
+
+  /**
+   * Calls f(T *) on every shard, e.g. to reset them; the owners must not
+   * be writing at the time
+   */
+  template <typename F>
+  static void ForEachMutable(F f) {
+    Registry &registry = Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (size_t i = 0; i < registry.shards.size(); i++) {
+      f(registry.shards[i]);
+    }
+  }
+
+private:
+  struct Registry {
+    std::mutex mutex;
+    // every shard ever created; never freed
+    std::vector<T *> shards;
+    // those of exited threads, waiting for a new owner
+    std::vector<T *> spare;
+  };
+
+  // hands the shard back when its thread exits
+  struct Owner {
+    T *shard;
+
+    ~Owner() {
+      if (!shard) {
+        return;
+      }
+      Registry &registry = Get();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      registry.spare.push_back(shard);
+      local_ = nullptr;
+      detached_ = true;
+    }
+  };
+
+  // leaked, so that threads exiting during static destruction can still
+  // hand back their shards
+  static Registry &Get() {
+    static Registry *registry = new Registry();
+    return *registry;
+  }
+
+  static T *Attach() {
+    if (detached_) {
+      return nullptr;
+    }
+    Registry &registry = Get();
+    T *shard;
+    {
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      if (registry.spare.empty()) {
+        shard = new T();
+        registry.shards.push_back(shard);
+      }
+      else {
+        shard = registry.spare.back();
+        registry.spare.pop_back();
+      }
+    }
+    owner_.shard = shard;
+    local_ = shard;
+    return shard;
+  }
+
+  static thread_local T *local_;
+  static thread_local bool detached_;
+  static thread_local Owner owner_;
+};
+
+template <typename T>
+thread_local T *ThreadShards<T>::local_ = nullptr;
+template <typename T>
+thread_local bool ThreadShards<T>::detached_ = false;
+template <typename T>
+thread_local typename ThreadShards<T>::Owner ThreadShards<T>::owner_;
+
+/**
+ * Adds to a value only the calling thread writes
+ */
+template <typename V>
+inline void AddOwned(std::atomic<V> *value, V amount) {
+  value->store(value->load(std::memory_order_relaxed) + amount,
+               std::memory_order_relaxed);
+}
+
+#endif /* THREAD_SHARDS_H_ */
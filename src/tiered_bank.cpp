@@ -0,0 +1,228 @@
+#include "tiered_bank.h"
+#include <algorithm>
+
+namespace {
+
+// a bank slot's state and packed covariance into a cold row
+template <typename T>
+void PackRow(const UKFBank &bank, int slot, T *row) {
+  const int capacity = bank.capacity();
+  for (int r = 0; r < UKFBank::n_x_; r++) {
+    row[r] = static_cast<T>(bank.states()[r * capacity + slot]);
+  }
+  //the bank's covariance rows are in PackedSymmetric order already
+  for (int k = 0; k < UKFBank::n_p_; k++) {
+    row[UKFBank::n_x_ + k] =
+        static_cast<T>(bank.covariances()[k * capacity + slot]);
+  }
+}
+
+template <typename T>
+void UnpackRow(const T *row, UKF::StateVector *x, UKF::StateMatrix *P) {
+  for (int r = 0; r < UKFBank::n_x_; r++) {
+    (*x)(r) = static_cast<UKF::Scalar>(row[r]);
+  }
+  PackedSymmetric<UKFBank::n_x_>::Unpack(row + UKFBank::n_x_, P);
+}
+
+}  // namespace
+
+TieredBank::TieredBank(UKFBank *hot, const Options &options)
+    : hot_(hot),
+      options_(options),
+      stats_(),
+      hot_size_(0),
+      hot_entry_(hot->capacity(), -1) {}
+
+TieredBank::~TieredBank() {}
+
+int TieredBank::NewEntry() {
+  if (free_entries_.empty()) {
+    Entry entry = {0, -1, {-1, 0}, 0};
+    entries_.push_back(entry);
+    free_entries_.push_back(static_cast<int>(entries_.size()) - 1);
+  }
+  const int entry = free_entries_.back();
+  free_entries_.pop_back();
+  ++entries_[entry].generation;
+  return entry;
+}
+
+void TieredBank::FreeEntry(int entry) {
+  ++entries_[entry].generation;
+  entries_[entry].cold = -1;
+  free_entries_.push_back(entry);
+}
+
+bool TieredBank::Add(const UKF::StateVector &x, const UKF::StateMatrix &P,
+                     TimeUs timestamp, Handle *handle) {
+  const int slot = hot_->Add(x, P);
+  if (slot < 0) {
+    return false;
+  }
+  const int entry = NewEntry();
+  Entry &e = entries_[entry];
+  e.cold = -1;
+  e.hot = hot_->HandleOf(slot);
+  e.timestamp = timestamp;
+  hot_entry_[e.hot.index] = entry;
+  ++hot_size_;
+  handle->index = entry;
+  handle->generation = e.generation;
+  return true;
+}
+
+bool TieredBank::Remove(Handle handle) {
+  if (!Live(handle)) {
+    return false;
+  }
+  Entry &e = entries_[handle.index];
+  if (e.cold >= 0) {
+    PopCold(e.cold);
+  }
+  else {
+    const int slot = hot_->Slot(e.hot);
+    if (slot >= 0) {
+      hot_->Remove(slot);
+    }
+    hot_entry_[e.hot.index] = -1;
+    --hot_size_;
+  }
+  FreeEntry(handle.index);
+  return true;
+}
+
+void TieredBank::Touch(Handle handle, TimeUs timestamp) {
+  if (Live(handle)) {
+    entries_[handle.index].timestamp = timestamp;
+  }
+}
+
+int TieredBank::Promote(Handle handle) {
+  if (!Live(handle)) {
+    return -1;
+  }
+  Entry &e = entries_[handle.index];
+  if (e.cold < 0) {
+    return hot_->Slot(e.hot);
+  }
+  UKF::StateVector x;
+  UKF::StateMatrix P;
+  if (options_.float_cold) {
+    UnpackRow(&cold_float_[e.cold * kColdValues], &x, &P);
+  }
+  else {
+    UnpackRow(&cold_double_[e.cold * kColdValues], &x, &P);
+  }
+  const int slot = hot_->Add(x, P);
+  if (slot < 0) {
+    ++stats_.full;
+    return -1;
+  }
+  PopCold(e.cold);
+  e.cold = -1;
+  e.hot = hot_->HandleOf(slot);
+  hot_entry_[e.hot.index] = handle.index;
+  ++hot_size_;
+  ++stats_.promoted;
+  return slot;
+}
+
+int TieredBank::Demote(TimeUs now) {
+  int demoted = 0;
+  //from the end, so the track Remove moves into a slot was already seen
+  for (int slot = hot_->size() - 1; slot >= 0; slot--) {
+    const int entry = hot_entry_[hot_->HandleOf(slot).index];
+    if (entry < 0 ||
+        ToSeconds(now - entries_[entry].timestamp) <= options_.idle_s) {
+      continue;
+    }
+    PushCold(entry, slot);
+    hot_entry_[entries_[entry].hot.index] = -1;
+    hot_->Remove(slot);
+    --hot_size_;
+    ++demoted;
+  }
+  stats_.demoted += demoted;
+  return demoted;
+}
+
+int TieredBank::HotSlot(Handle handle) const {
+  if (!Live(handle) || entries_[handle.index].cold >= 0) {
+    return -1;
+  }
+  return hot_->Slot(entries_[handle.index].hot);
+}
+
+UKFBank::Handle TieredBank::HotHandle(Handle handle) const {
+  if (!Live(handle) || entries_[handle.index].cold >= 0) {
+    UKFBank::Handle stale = {-1, 0};
+    return stale;
+  }
+  return entries_[handle.index].hot;
+}
+
+bool TieredBank::Get(Handle handle, UKF::StateVector *x, UKF::StateMatrix *P,
+                     TimeUs *timestamp) const {
+  if (!Live(handle)) {
+    return false;
+  }
+  const Entry &e = entries_[handle.index];
+  if (e.cold >= 0) {
+    if (options_.float_cold) {
+      UnpackRow(&cold_float_[e.cold * kColdValues], x, P);
+    }
+    else {
+      UnpackRow(&cold_double_[e.cold * kColdValues], x, P);
+    }
+  }
+  else {
+    const int slot = hot_->Slot(e.hot);
+    if (slot < 0) {
+      return false;
+    }
+    *x = hot_->State(slot);
+    *P = hot_->Covariance(slot);
+  }
+  *timestamp = e.timestamp;
+  return true;
+}
+
+void TieredBank::PushCold(int entry, int slot) {
+  const int row = static_cast<int>(cold_entry_.size());
+  if (options_.float_cold) {
+    cold_float_.resize((row + 1) * kColdValues);
+    PackRow(*hot_, slot, &cold_float_[row * kColdValues]);
+  }
+  else {
+    cold_double_.resize((row + 1) * kColdValues);
+    PackRow(*hot_, slot, &cold_double_[row * kColdValues]);
+  }
+  cold_entry_.push_back(entry);
+  entries_[entry].cold = row;
+}
+
+void TieredBank::PopCold(int row) {
+  const int last = static_cast<int>(cold_entry_.size()) - 1;
+  if (row != last) {
+    if (options_.float_cold) {
+      std::copy(&cold_float_[last * kColdValues],
+                &cold_float_[last * kColdValues] + kColdValues,
+                &cold_float_[row * kColdValues]);
+    }
+    else {
+      std::copy(&cold_double_[last * kColdValues],
+                &cold_double_[last * kColdValues] + kColdValues,
+                &cold_double_[row * kColdValues]);
+    }
+    cold_entry_[row] = cold_entry_[last];
+    entries_[cold_entry_[row]].cold = row;
+  }
+  cold_entry_.pop_back();
+  if (options_.float_cold) {
+    cold_float_.resize(last * kColdValues);
+  }
+  else {
+    cold_double_.resize(last * kColdValues);
+  }
+}
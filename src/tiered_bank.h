@@ -0,0 +1,192 @@
+#ifndef TIERED_BANK_H_
+#define TIERED_BANK_H_
+
+#include <vector>
+#include "time_base.h"
+#include "ukf_bank.h"
+
+/**
+ * Two tiers of track storage: a UKFBank of the tracks being measured, which
+ * every Prediction and Update sweep runs over, and a compact cold store of
+ * coasting tracks that must be kept but have nothing to fuse. Demote moves
+ * the tracks of the bank not measured for idle_s into the cold store;
+ * Promote brings one back when a measurement is associated with it. The
+ * sweeps then cost only the tracks in play, and a coasting track takes its
+ * state and packed covariance, 20 doubles (or floats), instead of the ~100
+ * rows of a bank slot with its sigma points.
+ *
+ * A cold track is frozen at the time of its last measurement and is not
+ * predicted; it is promoted with that state and time (see Get), and the
+ * caller predicts it across the gap, e.g. through BankBatcher::Start and
+ * the next batch. Its sigma points are not kept either, so a promoted track
+ * must be predicted before it is updated.
+ *
+ * Tracks are named by Handles of their own, which stay valid across both
+ * tiers and go stale, as UKFBank's do, once the track is removed. The bank
+ * may hold tracks added to it directly; they are left in the hot tier.
+ */
+class TieredBank {
+public:
+  static const int n_x_ = UKFBank::n_x_;
+  static const int n_p_ = UKFBank::n_p_;
+
+  /**
+   * A track's entry and the entry's generation, odd while the track is live
+   */
+  struct Handle {
+    int index;
+    unsigned generation;
+  };
+
+  struct Options {
+    ///* a hot track not measured for this long is demoted, in s
+    double idle_s;
+    ///* keep cold tracks in single precision
+    bool float_cold;
+
+    Options() : idle_s(2.0), float_cold(false) {}
+  };
+
+  struct Stats {
+    unsigned long long demoted;
+    unsigned long long promoted;
+    ///* promotions left cold because the bank was full
+    unsigned long long full;
+  };
+
+  /**
+   * Constructor
+   * @param hot Bank of the hot tier; must outlive this
+   * @param options Idle threshold and cold precision
+   */
+  TieredBank(UKFBank *hot, const Options &options = Options());
+
+  virtual ~TieredBank();
+
+  /**
+   * Adds a track to the hot tier
+   * @param x Initial state
+   * @param P Initial covariance
+   * @param timestamp Time of the state
+   * @param handle The new track
+   * @return false if the bank is full
+   */
+  bool Add(const UKF::StateVector &x, const UKF::StateMatrix &P,
+           TimeUs timestamp, Handle *handle);
+
+  /**
+   * Removes a track from whichever tier holds it
+   * @return false if the handle is stale
+   */
+  bool Remove(Handle handle);
+
+  /**
+   * Records that a hot track was measured; its state is then at timestamp
+   * @param handle Track
+   * @param timestamp Time of the measurement
+   */
+  void Touch(Handle handle, TimeUs timestamp);
+
+  /**
+   * Moves a track to the hot tier if it is cold, for a measurement
+   * associated with it
+   * @param handle Track
+   * @return Its bank slot, or -1 if the handle is stale or the bank is full
+   */
+  int Promote(Handle handle);
+
+  /**
+   * Moves the hot tracks last measured more than idle_s before now to the
+   * cold tier
+   * @param now Current time
+   * @return Tracks demoted
+   */
+  int Demote(TimeUs now);
+
+  /**
+   * A track's bank slot
+   * @return -1 if it is cold or the handle is stale
+   */
+  int HotSlot(Handle handle) const;
+
+  /**
+   * The track's bank handle, e.g. for BankBatcher; stale if it is cold
+   */
+  UKFBank::Handle HotHandle(Handle handle) const;
+
+  /**
+   * Copies a track's state out of whichever tier holds it
+   * @param handle Track
+   * @param x State
+   * @param P Covariance
+   * @param timestamp Time of the state
+   * @return false if the handle is stale
+   */
+  bool Get(Handle handle, UKF::StateVector *x, UKF::StateMatrix *P,
+           TimeUs *timestamp) const;
+
+  ///* the handle names a live track, and that track is cold
+  bool Live(Handle handle) const {
+    return handle.index >= 0 &&
+           handle.index < static_cast<int>(entries_.size()) &&
+           entries_[handle.index].generation == handle.generation;
+  }
+  bool IsCold(Handle handle) const {
+    return Live(handle) && entries_[handle.index].cold >= 0;
+  }
+
+  ///* tracks of this in each tier, and the cold store's bytes
+  int hot_size() const { return hot_size_; }
+  int cold_size() const { return static_cast<int>(cold_entry_.size()); }
+  size_t cold_bytes() const {
+    return cold_entry_.size() *
+           ((options_.float_cold ? sizeof(float) : sizeof(double)) *
+                kColdValues + sizeof(int));
+  }
+
+  const Stats &stats() const { return stats_; }
+  const Options &options() const { return options_; }
+
+private:
+  ///* a cold row: the state, then the packed upper triangle of P
+  static const int kColdValues = n_x_ + n_p_;
+
+  struct Entry {
+    unsigned generation;
+    ///* row in the cold store, or -1 while hot
+    int cold;
+    UKFBank::Handle hot;
+    ///* time of the state
+    TimeUs timestamp;
+  };
+
+  // takes an entry for a new track
+  int NewEntry();
+
+  // frees a live entry
+  void FreeEntry(int entry);
+
+  // copies bank slot slot into a new cold row for entry
+  void PushCold(int entry, int slot);
+
+  // removes a cold row; the last row moves into it
+  void PopCold(int row);
+
+  UKFBank *hot_;
+  Options options_;
+  Stats stats_;
+  int hot_size_;
+
+  std::vector<Entry> entries_;
+  std::vector<int> free_entries_;
+  ///* per bank handle index, the entry of the track there, or -1
+  std::vector<int> hot_entry_;
+
+  ///* cold rows of kColdValues, in the precision of options_, and the
+  ///* entry of each row
+  std::vector<double> cold_double_;
+  std::vector<float> cold_float_;
+  std::vector<int> cold_entry_;
+};
+
+#endif /* TIERED_BANK_H_ */
@@ -0,0 +1,20 @@
+#ifndef TIME_BASE_H_
+#define TIME_BASE_H_
+
+/**
+ * The filter's time base: timestamps, and gaps between them, are whole
+ * microseconds in a signed 64-bit integer (long long is 64 bits on every
+ * platform, unlike long). Ordering and equality tests in the history, the
+ * reordering queues and the out-of-sequence logic are exact integer
+ * comparisons; a gap becomes seconds only where a motion model needs it,
+ * through ToSeconds.
+ */
+typedef long long TimeUs;
+
+/**
+ * @param us A time or gap in microseconds
+ * @return The same in seconds
+ */
+inline double ToSeconds(TimeUs us) { return us / 1000000.0; }
+
+#endif /* TIME_BASE_H_ */
@@ -0,0 +1,157 @@
+#include "timer_wheel.h"
+#include <algorithm>
+
+const int TimerWheel::kBits;
+const int TimerWheel::kSlots;
+const int TimerWheel::kLevels;
+
+namespace {
+
+// head_ index of the timers waiting for the first Advance
+const int kParked = TimerWheel::kLevels * TimerWheel::kSlots;
+
+}  // namespace
+
+TimerWheel::TimerWheel(int capacity, TimeUs tick)
+    : tick_(tick > 0 ? tick : 1),
+      current_(-1),
+      size_(0),
+      due_(capacity, 0),
+      next_(capacity, -1),
+      prev_(capacity, -1),
+      slot_of_(capacity, -1),
+      head_(kParked + 1, -1) {
+  std::fill(level_size_, level_size_ + kLevels, 0);
+}
+
+TimerWheel::~TimerWheel() {}
+
+void TimerWheel::Schedule(int id, TimeUs deadline) {
+  if (Pending(id)) {
+    Unlink(id);
+  }
+  else {
+    ++size_;
+  }
+  //rounded up, so a timer never fires before its deadline
+  due_[id] = (std::max(deadline, TimeUs(0)) + tick_ - 1) / tick_;
+  if (current_ < 0) {
+    Link(id, kParked);
+  }
+  else {
+    Insert(id, current_);
+  }
+}
+
+void TimerWheel::Cancel(int id) {
+  if (Pending(id)) {
+    Unlink(id);
+    --size_;
+  }
+}
+
+void TimerWheel::Advance(TimeUs now, std::vector<int> *expired) {
+  const TimeUs target = std::max(now, TimeUs(0)) / tick_;
+  if (current_ < 0) {
+    current_ = target;
+    while (head_[kParked] >= 0) {
+      const int id = head_[kParked];
+      Unlink(id);
+      Insert(id, current_);
+    }
+  }
+
+  //deadlines that had passed when they were scheduled
+  Fire(Slot(0, current_), expired);
+  while (current_ < target) {
+    if (size_ == 0) {
+      current_ = target;
+      break;
+    }
+    //with level 0 empty nothing happens before the next boundary of the
+    //lowest occupied level, so the ticks up to it are skipped
+    if (level_size_[0] == 0) {
+      int level = 1;
+      while (level_size_[level] == 0) level++;
+      const int shift = kBits * level;
+      const TimeUs boundary = ((current_ >> shift) + 1) << shift;
+      current_ = std::max(current_, std::min(target, boundary) - 1);
+      if (current_ == target) {
+        break;
+      }
+    }
+
+    ++current_;
+    for (int level = 1; level < kLevels; level++) {
+      if (current_ & ((TimeUs(1) << (kBits * level)) - 1)) {
+        break;
+      }
+      Cascade(level);
+    }
+
+    Fire(Slot(0, current_), expired);
+  }
+}
+
+void TimerWheel::Insert(int id, TimeUs first) {
+  const TimeUs t = std::max(due_[id], first);
+  for (int level = 0; level < kLevels; level++) {
+    const int shift = kBits * level;
+    if ((t >> shift) - (current_ >> shift) < kSlots) {
+      Link(id, Slot(level, t));
+      return;
+    }
+  }
+  //too far for the top level: its farthest slot, placed again from there
+  const int shift = kBits * (kLevels - 1);
+  Link(id, Slot(kLevels - 1, ((current_ >> shift) + kSlots - 1) << shift));
+}
+
+void TimerWheel::Link(int id, int slot) {
+  next_[id] = head_[slot];
+  prev_[id] = -1;
+  if (head_[slot] >= 0) {
+    prev_[head_[slot]] = id;
+  }
+  head_[slot] = id;
+  slot_of_[id] = slot;
+  if (slot < kParked) {
+    ++level_size_[slot / kSlots];
+  }
+}
+
+void TimerWheel::Unlink(int id) {
+  const int slot = slot_of_[id];
+  if (prev_[id] >= 0) {
+    next_[prev_[id]] = next_[id];
+  }
+  else {
+    head_[slot] = next_[id];
+  }
+  if (next_[id] >= 0) {
+    prev_[next_[id]] = prev_[id];
+  }
+  slot_of_[id] = -1;
+  if (slot < kParked) {
+    --level_size_[slot / kSlots];
+  }
+}
+
+void TimerWheel::Fire(int slot, std::vector<int> *expired) {
+  while (head_[slot] >= 0) {
+    const int id = head_[slot];
+    Unlink(id);
+    expired->push_back(id);
+    --size_;
+  }
+}
+
+void TimerWheel::Cascade(int level) {
+  //the slot the wheel has just entered; its timers are all due within it
+  const int slot = Slot(level, current_);
+  while (head_[slot] >= 0) {
+    const int id = head_[slot];
+    Unlink(id);
+    Insert(id, current_);
+  }
+}
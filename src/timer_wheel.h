@@ -0,0 +1,105 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <vector>
+#include "time_base.h"
+
+/**
+ * Hierarchical timer wheel over a fixed set of ids 0..capacity-1, each with
+ * at most one pending deadline.
+ *
+ * Time is counted in ticks of a fixed length. Level 0 has one slot per tick
+ * for the next kSlots ticks, level 1 one slot per kSlots ticks, and so on;
+ * a timer sits in the lowest level whose slots still tell it apart from
+ * the current tick, and moves down a level each time the wheel enters its
+ * slot. Schedule and Cancel are O(1) list operations, and Advance costs
+ * one step per elapsed tick plus the timers it fires or moves, however
+ * many timers are pending. Deadlines beyond the top level wait in its
+ * farthest slot and are placed again when it comes round.
+ *
+ * Timers never fire early and at most one tick late. Nothing is allocated
+ * after construction.
+ */
+class TimerWheel {
+public:
+  static const int kBits = 6;
+  static const int kSlots = 1 << kBits;
+  static const int kLevels = 4;
+
+  /**
+   * Constructor
+   * @param capacity Number of ids
+   * @param tick Tick length in us
+   */
+  TimerWheel(int capacity, TimeUs tick);
+
+  /**
+   * Destructor
+   */
+  virtual ~TimerWheel();
+
+  /**
+   * Sets or moves the deadline of an id. A deadline already passed fires
+   * on the next Advance.
+   * @param id Id
+   * @param deadline Time in us at or after which it fires
+   */
+  void Schedule(int id, TimeUs deadline);
+
+  /**
+   * Removes the deadline of an id, if it has one
+   * @param id Id
+   */
+  void Cancel(int id);
+
+  /**
+   * Whether an id has a pending deadline
+   * @param id Id
+   */
+  bool Pending(int id) const { return slot_of_[id] >= 0; }
+
+  /**
+   * Moves the wheel to a time and collects the timers due by then; they are
+   * no longer pending. Time never goes back: an earlier time does nothing.
+   * @param now Time in us
+   * @param expired Ids of the fired timers, appended
+   */
+  void Advance(TimeUs now, std::vector<int> *expired);
+
+  ///* Number of pending timers
+  int size() const { return size_; }
+
+private:
+  // puts id into the slot for its due tick, or for first if that is later
+  void Insert(int id, TimeUs first);
+  void Link(int id, int slot);
+  void Unlink(int id);
+  // collects every timer of a level 0 slot
+  void Fire(int slot, std::vector<int> *expired);
+  // moves the timers of the slot just entered on a level above 0 down
+  void Cascade(int level);
+
+  static int Slot(int level, TimeUs tick) {
+    return level * kSlots + static_cast<int>((tick >> (kBits * level)) &
+                                             (kSlots - 1));
+  }
+
+  const TimeUs tick_;
+  ///* tick the wheel has reached; -1 until the first Advance
+  TimeUs current_;
+  int size_;
+
+  ///* per-id due tick, list links and slot (-1 if not pending)
+  std::vector<TimeUs> due_;
+  std::vector<int> next_;
+  std::vector<int> prev_;
+  std::vector<int> slot_of_;
+
+  ///* first id of each slot's list, kLevels * kSlots of them, then the
+  ///* list of timers scheduled before the first Advance
+  std::vector<int> head_;
+  ///* pending timers per level
+  int level_size_[kLevels];
+};
+
+#endif /* TIMER_WHEEL_H_ */
@@ -1,10 +1,47 @@
-#include <iostream>
 #include "tools.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "logger.h"
+#include "thread_pool.h"
 
 using Eigen::VectorXd;
 using Eigen::MatrixXd;
 using std::vector;
 
+namespace {
+
+// rows per block when no segments are asked for: large enough to amortise
+// dispatch, small enough to spread over the pool
+const long kRMSEBlock = 1 << 16;
+
+// sum of squared residuals over rows [begin, end)
+Eigen::Vector4d SumSquares(const Eigen::Ref<const Tools::Rows4> &estimations,
+                           const Eigen::Ref<const Tools::Rows4> &truth,
+                           long begin, long end) {
+  //two independent accumulators, so consecutive rows do not wait on one
+  //another's adds
+  Eigen::Vector4d even = Eigen::Vector4d::Zero();
+  Eigen::Vector4d odd = Eigen::Vector4d::Zero();
+  long i = begin;
+  for (; i + 1 < end; i += 2) {
+    const Eigen::Vector4d a = estimations.row(i) - truth.row(i);
+    const Eigen::Vector4d b = estimations.row(i + 1) - truth.row(i + 1);
+    even += a.cwiseProduct(a);
+    odd += b.cwiseProduct(b);
+  }
+  if (i < end) {
+    const Eigen::Vector4d a = estimations.row(i) - truth.row(i);
+    even += a.cwiseProduct(a);
+  }
+  return even + odd;
+}
+
+// 95% point of the chi-square distribution with 4 degrees of freedom
+const double kChiSquare95Four = 9.488;
+
+}  // namespace
+
 Tools::Tools() {}
 
 Tools::~Tools() {}
@@ -24,7 +61,7 @@ VectorXd Tools::CalculateRMSE(const vector<VectorXd> &estimations,
   //  * the estimation vector size should equal ground truth vector size
   if(estimations.size() != ground_truth.size()
    || estimations.size() == 0){
-    cout << "Invalid estimation or ground_truth data" << endl;
+    UKF_LOG_WARN("Invalid estimation or ground_truth data");
     return rmse;
   }
 
@@ -45,4 +82,210 @@ VectorXd Tools::CalculateRMSE(const vector<VectorXd> &estimations,
 
   //return the result
   return rmse;
-}
\ No newline at end of file
+}
+
+Eigen::Vector4d Tools::CalculateRMSE(
+    const Eigen::Ref<const Rows4> &estimations,
+    const Eigen::Ref<const Rows4> &ground_truth, long segment,
+    RMSEList *segment_rmse, ThreadPool *pool) {
+  const long n = estimations.rows();
+  if (segment_rmse) {
+    segment_rmse->clear();
+  }
+  if (n != ground_truth.rows() || n == 0) {
+    UKF_LOG_WARN("Invalid estimation or ground_truth data");
+    return Eigen::Vector4d::Zero();
+  }
+
+  //one block per segment, so a block sum is also a segment's sum
+  const long block = segment > 0 ? segment : kRMSEBlock;
+  const long blocks = (n + block - 1) / block;
+  if (blocks == 1 && !segment_rmse) {
+    return (SumSquares(estimations, ground_truth, 0, n) / n).cwiseSqrt();
+  }
+  RMSEList sums(blocks, Eigen::Vector4d::Zero());
+  auto reduce = [&](int first, int last) {
+    for (int b = first; b < last; b++) {
+      sums[b] = SumSquares(estimations, ground_truth, b * block,
+                           std::min(n, (b + 1) * block));
+    }
+  };
+  if (pool && blocks > 1) {
+    pool->ParallelFor(0, static_cast<int>(blocks), 1, reduce);
+  }
+  else {
+    reduce(0, static_cast<int>(blocks));
+  }
+
+  Eigen::Vector4d total = Eigen::Vector4d::Zero();
+  for (long b = 0; b < blocks; b++) {
+    total += sums[b];
+    if (segment_rmse && segment > 0) {
+      const long rows = std::min(n, (b + 1) * block) - b * block;
+      segment_rmse->push_back((sums[b] / rows).cwiseSqrt());
+    }
+  }
+  return (total / n).cwiseSqrt();
+}
+
+RMSEAccumulator::RMSEAccumulator() {
+  Reset();
+}
+
+void RMSEAccumulator::Add(const Eigen::Vector4d &estimate,
+                          const Eigen::Vector4d &ground_truth) {
+  Eigen::Vector4d residual = estimate - ground_truth;
+  sum_sq_ += residual.cwiseProduct(residual);
+  ++count_;
+}
+
+Eigen::Vector4d RMSEAccumulator::RMSE() const {
+  if (count_ == 0) {
+    return Eigen::Vector4d::Zero();
+  }
+  return (sum_sq_ / count_).cwiseSqrt();
+}
+
+void RMSEAccumulator::Reset() {
+  sum_sq_.setZero();
+  count_ = 0;
+}
+
+ExponentialRMSE::ExponentialRMSE(double alpha) : alpha_(alpha) {
+  Reset();
+}
+
+void ExponentialRMSE::Add(const Eigen::Vector4d &estimate,
+                          const Eigen::Vector4d &ground_truth) {
+  Eigen::Vector4d residual = estimate - ground_truth;
+  Eigen::Vector4d sq = residual.cwiseProduct(residual);
+  if (empty_) {
+    mean_sq_ = sq;
+    empty_ = false;
+  }
+  else {
+    mean_sq_ += alpha_ * (sq - mean_sq_);
+  }
+}
+
+Eigen::Vector4d ExponentialRMSE::RMSE() const {
+  return mean_sq_.cwiseSqrt();
+}
+
+void ExponentialRMSE::Reset() {
+  mean_sq_.setZero();
+  empty_ = true;
+}
+
+WindowedRMSE::WindowedRMSE(unsigned long window, long long span_us) {
+  SetWindow(window, span_us);
+}
+
+void WindowedRMSE::Add(const Eigen::Vector4d &estimate,
+                       const Eigen::Vector4d &ground_truth,
+                       long long timestamp) {
+  const unsigned long size = ring_.size();
+  if (size == 0) {
+    return;
+  }
+  Eigen::Vector4d residual = estimate - ground_truth;
+  Eigen::Vector4d sq = residual.cwiseProduct(residual);
+
+  if (span_us_ > 0) {
+    //drop the oldest entries that fell out of the time span
+    while (count_ > 0) {
+      const unsigned long oldest = (next_ + size - count_) % size;
+      if (timestamp - times_[oldest] <= span_us_) {
+        break;
+      }
+      sum_sq_ -= ring_[oldest];
+      --count_;
+    }
+    times_[next_] = timestamp;
+  }
+  if (count_ == size) {
+    sum_sq_ -= ring_[next_];
+  }
+  else {
+    ++count_;
+  }
+  ring_[next_] = sq;
+  sum_sq_ += sq;
+
+  if (++next_ == size) {
+    next_ = 0;
+    //refresh the running sum once per lap to drop accumulated rounding;
+    //the live entries are the count_ before next_, here the last count_
+    sum_sq_.setZero();
+    for (unsigned long i = size - count_; i < size; ++i) {
+      sum_sq_ += ring_[i];
+    }
+  }
+}
+
+Eigen::Vector4d WindowedRMSE::RMSE() const {
+  if (count_ == 0) {
+    return Eigen::Vector4d::Zero();
+  }
+  return (sum_sq_ / count_).cwiseSqrt();
+}
+
+void WindowedRMSE::SetWindow(unsigned long window, long long span_us) {
+  ring_.assign(window, Eigen::Vector4d::Zero());
+  span_us_ = span_us;
+  times_.assign(span_us > 0 ? window : 0, 0);
+  Reset();
+}
+
+void WindowedRMSE::Reset() {
+  sum_sq_.setZero();
+  next_ = 0;
+  count_ = 0;
+}
+
+NEESAccumulator::NEESAccumulator() {
+  Reset();
+}
+
+bool NEESAccumulator::Add(const Eigen::Vector4d &estimate,
+                          const Eigen::Matrix4d &covariance,
+                          const Eigen::Vector4d &ground_truth) {
+  Eigen::LLT<Eigen::Matrix4d> llt(covariance);
+  if (llt.info() != Eigen::Success) {
+    ++skipped_;
+    return false;
+  }
+  const Eigen::Vector4d error = estimate - ground_truth;
+  const double nees = error.dot(llt.solve(error));
+  if (!std::isfinite(nees)) {
+    ++skipped_;
+    return false;
+  }
+  sum_ += nees;
+  ++count_;
+  if (nees > kChiSquare95Four) ++exceeded_;
+  return true;
+}
+
+void NEESAccumulator::Merge(const NEESAccumulator &other) {
+  sum_ += other.sum_;
+  count_ += other.count_;
+  exceeded_ += other.exceeded_;
+  skipped_ += other.skipped_;
+}
+
+void NEESAccumulator::Reset() {
+  sum_ = 0.0;
+  count_ = exceeded_ = skipped_ = 0;
+}
+
+void StateDigest::Add(double value) {
+  const unsigned long long kPrime = 1099511628211ULL;
+  //the bit pattern, so -0 and +0 (and NaN payloads) hash differently
+  unsigned char bytes[sizeof(value)];
+  memcpy(bytes, &value, sizeof(value));
+  for (size_t i = 0; i < sizeof(value); i++) {
+    hash_ = (hash_ ^ bytes[i]) * kPrime;
+  }
+}
+
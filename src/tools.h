@@ -1,12 +1,16 @@
 #ifndef TOOLS_H_
 #define TOOLS_H_
+#include <cmath>
 #include <vector>
 #include "Eigen/Dense"
+#include "Eigen/StdVector"
 
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 using namespace std;
 
+class ThreadPool;
+
 class Tools {
 public:
   /**
@@ -24,6 +28,257 @@ public:
   */
   VectorXd CalculateRMSE(const vector<VectorXd> &estimations, const vector<VectorXd> &ground_truth);
 
+  ///* n x 4 [px, py, vx, vy] rows in one contiguous buffer
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 4, Eigen::RowMajor> Rows4;
+  typedef std::vector<Eigen::Vector4d,
+                      Eigen::aligned_allocator<Eigen::Vector4d> > RMSEList;
+
+  /**
+   * RMSE over contiguous rows, e.g. an Eigen::Map over a replay's output
+   * arrays: each row is one 4-wide vector operation, with no per-row heap
+   * objects to chase. The rows are reduced in blocks, on a pool if one is
+   * given, and the block sums are added in order, so the result is the same
+   * for any thread count.
+   * @param estimations n x 4 estimates
+   * @param ground_truth n x 4 truths, the same n
+   * @param segment Rows per segment for segment_rmse; 0 for none
+   * @param segment_rmse If not null, set to the RMSE of each segment of
+   * segment rows (the last one may be shorter)
+   * @param pool Pool to reduce on, or nullptr for the calling thread
+   * @return RMSE over all rows; zero if empty or the sizes differ
+   */
+  Eigen::Vector4d CalculateRMSE(const Eigen::Ref<const Rows4> &estimations,
+                                const Eigen::Ref<const Rows4> &ground_truth,
+                                long segment = 0,
+                                RMSEList *segment_rmse = nullptr,
+                                ThreadPool *pool = nullptr);
+};
+
+/**
+ * Streaming RMSE over [px, py, vx, vy]: keeps running sums of the squared
+ * residuals, so each Add and RMSE is O(1) regardless of history length.
+ */
+class RMSEAccumulator {
+public:
+  RMSEAccumulator();
+
+  /**
+   * Accumulates one estimate / ground truth pair
+   */
+  void Add(const Eigen::Vector4d &estimate, const Eigen::Vector4d &ground_truth);
+
+  /**
+   * RMSE over everything added since construction or Reset(); zero if empty
+   */
+  Eigen::Vector4d RMSE() const;
+
+  /**
+   * Adds everything another accumulator has seen, as if its pairs had been
+   * added here (e.g. to combine per-file or per-thread results)
+   */
+  void Merge(const RMSEAccumulator &other) {
+    sum_sq_ += other.sum_sq_;
+    count_ += other.count_;
+  }
+
+  void Reset();
+
+  unsigned long count() const { return count_; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  Eigen::Vector4d sum_sq_;
+  unsigned long count_;
+};
+
+/**
+ * Exponentially weighted RMSE: each new squared residual gets weight alpha,
+ * the running mean square decays by (1 - alpha).
+ */
+class ExponentialRMSE {
+public:
+  /**
+   * @param alpha Weight of the newest residual, in (0, 1]
+   */
+  explicit ExponentialRMSE(double alpha);
+
+  void Add(const Eigen::Vector4d &estimate, const Eigen::Vector4d &ground_truth);
+
+  Eigen::Vector4d RMSE() const;
+
+  void Reset();
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  double alpha_;
+  Eigen::Vector4d mean_sq_;
+  bool empty_;
+};
+
+/**
+ * RMSE over the last `window` residuals, and optionally only those of the
+ * last span_us microseconds. The squared residuals are kept in a ring and
+ * the running sum is recomputed from the ring each time it wraps, so
+ * rounding from the subtract-on-evict updates cannot accumulate.
+ */
+class WindowedRMSE {
+public:
+  /**
+   * @param window Number of most recent residuals to include; 0 disables
+   * the window, Add then records nothing
+   * @param span_us If positive, residuals older than this many us before
+   * the newest one are dropped as well
+   */
+  explicit WindowedRMSE(unsigned long window = 1, long long span_us = 0);
+
+  /**
+   * Adds one pair at a timestamp in us; timestamps only matter with a span
+   * and must not decrease
+   */
+  void Add(const Eigen::Vector4d &estimate, const Eigen::Vector4d &ground_truth,
+           long long timestamp = 0);
+
+  Eigen::Vector4d RMSE() const;
+
+  /**
+   * Resizes the window and forgets everything added
+   */
+  void SetWindow(unsigned long window, long long span_us = 0);
+
+  void Reset();
+
+  bool enabled() const { return !ring_.empty(); }
+
+  unsigned long count() const { return count_; }
+
+  ///* heap bytes of the window
+  size_t MemoryBytes() const {
+    return ring_.capacity() * sizeof(Eigen::Vector4d) +
+           times_.capacity() * sizeof(long long);
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > ring_;
+  ///* timestamp of each ring entry, kept only with a span
+  std::vector<long long> times_;
+  long long span_us_;
+  Eigen::Vector4d sum_sq_;
+  unsigned long next_;
+  unsigned long count_;
+};
+
+/**
+ * Streaming normalised estimation error squared over [px, py, vx, vy]: the
+ * e^T P^-1 e of each estimate against its ground truth, with P the state
+ * covariance in those coordinates, kept as running sums so each Add is
+ * O(1). A consistent filter averages 4 (the ANEES) and exceeds the 95%
+ * bound of 9.488 about 5% of the time; more means it is overconfident.
+ * Filters started from the historical zero covariance are overconfident
+ * for their first steps by many orders of magnitude, which swamps the
+ * mean; consistency runs want UKFConfig::initial_covariance 1.
+ */
+class NEESAccumulator {
+public:
+  NEESAccumulator();
+
+  /**
+   * Accumulates one estimate
+   * @param estimate [px, py, vx, vy] estimate
+   * @param covariance Its covariance
+   * @param ground_truth [px, py, vx, vy] truth
+   * @return false, and the estimate is counted as skipped, if the
+   * covariance is not positive definite (e.g. before the filter has
+   * converged from a zero initial P)
+   */
+  bool Add(const Eigen::Vector4d &estimate, const Eigen::Matrix4d &covariance,
+           const Eigen::Vector4d &ground_truth);
+
+  /**
+   * Accumulates a CTRV posterior [px, py, v, yaw, yawd] with covariance P,
+   * mapped to [px, py, vx, vy] through the Jacobian of vx = v cos(yaw),
+   * vy = v sin(yaw)
+   */
+  template <typename State, typename Covariance>
+  bool AddCtrv(const Eigen::MatrixBase<State> &x,
+               const Eigen::MatrixBase<Covariance> &P,
+               const Eigen::Vector4d &ground_truth) {
+    const double v = static_cast<double>(x(2));
+    const double c = std::cos(static_cast<double>(x(3)));
+    const double s = std::sin(static_cast<double>(x(3)));
+    Eigen::Matrix<double, 4, 5> J = Eigen::Matrix<double, 4, 5>::Zero();
+    J(0, 0) = 1.0;
+    J(1, 1) = 1.0;
+    J(2, 2) = c;
+    J(2, 3) = -v * s;
+    J(3, 2) = s;
+    J(3, 3) = v * c;
+    const Eigen::Matrix<double, 5, 5> Pd =
+        P.template topLeftCorner<5, 5>().template cast<double>();
+    const Eigen::Vector4d estimate(static_cast<double>(x(0)),
+                                   static_cast<double>(x(1)), v * c, v * s);
+    return Add(estimate, J * Pd * J.transpose(), ground_truth);
+  }
+
+  ///* mean NEES over the estimates added (the ANEES); 0 if none
+  double Average() const { return count_ ? sum_ / count_ : 0.0; }
+
+  ///* fraction of estimates above the 95% chi-square bound
+  double ExceededFraction() const {
+    return count_ ? static_cast<double>(exceeded_) / count_ : 0.0;
+  }
+
+  /**
+   * Adds everything another accumulator has seen
+   */
+  void Merge(const NEESAccumulator &other);
+
+  void Reset();
+
+  unsigned long count() const { return count_; }
+  unsigned long exceeded() const { return exceeded_; }
+  unsigned long skipped() const { return skipped_; }
+
+private:
+  double sum_;
+  unsigned long count_;
+  unsigned long exceeded_;
+  unsigned long skipped_;
+};
+
+/**
+ * 64-bit FNV-1a digest of floating-point values by their bit patterns, for
+ * bit-exact regression checks: two runs agree only if every value hashed was
+ * identical. Values are widened to double first, so float and double builds
+ * hash the same way (and differ wherever their numbers do).
+ */
+class StateDigest {
+public:
+  StateDigest() : hash_(kOffsetBasis) {}
+
+  /**
+   * Hashes a block of values, coefficient by coefficient in storage order
+   */
+  template <typename Derived>
+  void Add(const Eigen::MatrixBase<Derived> &values) {
+    for (int i = 0; i < values.size(); i++) {
+      Add(static_cast<double>(values(i)));
+    }
+  }
+
+  void Add(double value);
+
+  unsigned long long value() const { return hash_; }
+
+  void Reset() { hash_ = kOffsetBasis; }
+
+private:
+  static const unsigned long long kOffsetBasis = 14695981039346656037ULL;
+
+  unsigned long long hash_;
 };
 
 #endif /* TOOLS_H_ */
\ No newline at end of file
@@ -0,0 +1,347 @@
+#include "track_actors.h"
+#include <chrono>
+#include <limits>
+#include "metrics.h"
+
+namespace {
+
+// messages a worker takes from its inbox at a time
+const int kBatch = 64;
+
+// idle worker: spin, then yield, then sleep for this long between polls
+const int kSpins = 64;
+const int kYields = 64;
+const int kSleepMicroseconds = 100;
+
+}  // namespace
+
+TrackActors::TrackActors(const UKF &prototype, const Options &options)
+    : options_(options),
+      outbox_(options.outbox_capacity),
+      sequence_(0),
+      dropped_(0),
+      forwarded_(0),
+      stop_(false) {
+  const int workers = options_.workers > 0 ? options_.workers : 1;
+  for (int w = 0; w < workers; w++) {
+    map_.Add(w);
+    actors_.emplace_back(
+        new Actor(prototype, options_.inbox_capacity, workers));
+  }
+  //every actor exists before any worker may post to it
+  for (int w = 0; w < workers; w++) {
+    actors_[w]->thread = std::thread(&TrackActors::Run, this, w);
+  }
+}
+
+TrackActors::~TrackActors() {
+  stop_.store(true, std::memory_order_relaxed);
+  for (size_t w = 0; w < actors_.size(); w++) {
+    actors_[w]->thread.join();
+  }
+  //a track in transit is lost with the rest, but not leaked
+  for (size_t w = 0; w < actors_.size(); w++) {
+    Message message;
+    while (actors_[w]->inbox.TryPop(&message)) {
+      if (message.kind == ADOPT) {
+        delete message.record;
+      }
+    }
+    for (size_t peer = 0; peer < actors_[w]->held.size(); peer++) {
+      for (const Message &held : actors_[w]->held[peer]) {
+        if (held.kind == ADOPT) {
+          delete held.record;
+        }
+      }
+    }
+  }
+}
+
+bool TrackActors::Measure(unsigned id, const Measurement &meas) {
+  Message message = {MEASURE, id, -1, -1, false, 0, 0.0, meas, nullptr};
+  return actors_[Home(id)]->inbox.TryPush(message);
+}
+
+bool TrackActors::Associate(const Measurement &meas, unsigned new_id) {
+  //the coordinator gates first and then asks the others
+  Message message = {ASSOCIATE, new_id, -1, -1, false,
+                     sequence_.fetch_add(1, std::memory_order_relaxed), 0.0,
+                     meas, nullptr};
+  return actors_[Home(new_id)]->inbox.TryPush(message);
+}
+
+bool TrackActors::Handoff(unsigned id, int worker) {
+  if (worker < 0 || worker >= workers()) {
+    return false;
+  }
+  Message message = {HANDOFF, id, worker, -1, false, 0, 0.0, Measurement(),
+                     nullptr};
+  return actors_[Home(id)]->inbox.TryPush(message);
+}
+
+size_t TrackActors::Drain(Result *out, size_t max) {
+  return outbox_.TryPopBatch(out, max);
+}
+
+void TrackActors::Run(int worker) {
+  Metrics::AttachThread();
+  Actor &actor = *actors_[worker];
+  Message batch[kBatch];
+  int idle = 0;
+  while (!stop_.load(std::memory_order_relaxed)) {
+    const size_t count = actor.inbox.TryPopBatch(batch, kBatch);
+    for (size_t i = 0; i < count; i++) {
+      Handle(worker, batch[i]);
+    }
+    //held-back messages wait for a peer that is busy, not asleep
+    const bool holding = Flush(worker);
+    if (count > 0) {
+      idle = 0;
+    }
+    else if (holding) {
+      std::this_thread::yield();
+    }
+    else if (++idle > kSpins + kYields) {
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(kSleepMicroseconds));
+    }
+    else if (idle > kSpins) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void TrackActors::Handle(int worker, const Message &message) {
+  Actor *actor = actors_[worker].get();
+  switch (message.kind) {
+  case MEASURE:
+  case HANDOFF:
+  case FENCE:
+    Route(worker, message);
+    break;
+  case ASSOCIATE: {
+    Pending pending;
+    pending.sequence = message.sequence;
+    pending.replies = 0;
+    pending.best_nis = Gate(actor, message.meas, &pending.best_id);
+    pending.best_worker =
+        pending.best_nis < std::numeric_limits<double>::infinity() ? worker
+                                                                   : -1;
+    pending.meas = message.meas;
+    pending.new_id = message.id;
+    if (workers() == 1) {
+      Assign(worker, pending);
+      break;
+    }
+    actor->pending.push_back(pending);
+    Message gate = message;
+    gate.kind = GATE;
+    gate.worker = worker;
+    gate.from = worker;
+    for (int w = 0; w < workers(); w++) {
+      if (w != worker) {
+        Post(worker, w, gate);
+      }
+    }
+    break;
+  }
+  case GATE: {
+    Message reply = message;
+    reply.kind = GATED;
+    reply.nis = Gate(actor, message.meas, &reply.id);
+    reply.worker = worker;
+    reply.from = worker;
+    Post(worker, message.worker, reply);
+    break;
+  }
+  case GATED:
+    Gated(worker, message);
+    break;
+  case ADOPT:
+    Adopt(worker, message);
+    break;
+  }
+}
+
+void TrackActors::Route(int worker, const Message &message) {
+  Actor &actor = *actors_[worker];
+  const unsigned id = message.id;
+
+  //a track taken back: what comes round the old path first, the rest after
+  auto fence = actor.fences.find(id);
+  if (fence != actor.fences.end()) {
+    if (message.kind == FENCE && message.worker == worker) {
+      std::vector<Message> held;
+      held.swap(fence->second.held);
+      actor.fences.erase(fence);
+      for (size_t i = 0; i < held.size(); i++) {
+        Route(worker, held[i]);
+      }
+      return;
+    }
+    if (message.from != fence->second.from) {
+      fence->second.held.push_back(message);
+      return;
+    }
+  }
+
+  auto forward = actor.forwards.find(id);
+  if (forward != actor.forwards.end()) {
+    Message next = message;
+    next.from = worker;
+    forwarded_.fetch_add(1, std::memory_order_relaxed);
+    Post(worker, forward->second, next);
+    return;
+  }
+
+  switch (message.kind) {
+  case MEASURE:
+    Filter(worker, &actor.table.Get(id), message.meas, message.created);
+    break;
+  case HANDOFF: {
+    const int target = message.worker;
+    if (target == worker) {
+      break;
+    }
+    std::vector<FilterSnapshot::Record> records;
+    actor.table.Extract([id](unsigned track) { return track == id; },
+                        &records);
+    Message adopt = {ADOPT, id, target, worker, false, 0, 0.0, Measurement(),
+                     nullptr};
+    if (!records.empty()) {
+      adopt.record = new FilterSnapshot::Record(records[0]);
+    }
+    actor.forwards[id] = target;
+    Post(worker, target, adopt);
+    break;
+  }
+  default:
+    //a fence whose worker no longer waits for it
+    break;
+  }
+}
+
+void TrackActors::Adopt(int worker, const Message &message) {
+  Actor &actor = *actors_[worker];
+  if (message.record) {
+    actor.table.Insert(message.record, 1);
+    delete message.record;
+  }
+
+  //messages forwarded along the old path may still be on their way back
+  auto forward = actor.forwards.find(message.id);
+  if (forward == actor.forwards.end()) {
+    return;
+  }
+  const int next = forward->second;
+  actor.forwards.erase(forward);
+  actor.fences[message.id].from = message.from;
+  Message fence = {FENCE, message.id, worker, worker, false, 0, 0.0,
+                   Measurement(), nullptr};
+  Post(worker, next, fence);
+}
+
+void TrackActors::Filter(int worker, TrackTable::Track *track,
+                         const Measurement &meas, bool created) {
+  Eigen::Vector4d estimate;
+  track->Process(meas, &estimate);
+  Result result;
+  result.id = track->id;
+  result.worker = worker;
+  result.timestamp = meas.timestamp_;
+  for (int i = 0; i < 4; i++) {
+    result.estimate[i] = estimate(i);
+  }
+  result.nis = track->nis();
+  result.created = created;
+  if (!outbox_.TryPush(result)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void TrackActors::Post(int from, int worker, const Message &message) {
+  //behind what is held for the peer, so its messages stay in order
+  std::deque<Message> &held = actors_[from]->held[worker];
+  if (!held.empty() || !actors_[worker]->inbox.TryPush(message)) {
+    held.push_back(message);
+  }
+}
+
+bool TrackActors::Flush(int worker) {
+  bool holding = false;
+  std::vector<std::deque<Message> > &held = actors_[worker]->held;
+  for (size_t peer = 0; peer < held.size(); peer++) {
+    std::deque<Message> &queue = held[peer];
+    while (!queue.empty() && actors_[peer]->inbox.TryPush(queue.front())) {
+      queue.pop_front();
+    }
+    holding = holding || !queue.empty();
+  }
+  return holding;
+}
+
+double TrackActors::Gate(Actor *actor, const Measurement &meas,
+                         unsigned *best_id) {
+  double best = std::numeric_limits<double>::infinity();
+  UKF &scratch = actor->scratch;
+  actor->table.ForEach([&](unsigned id, const TrackTable::Track &track) {
+    if (!track.ukf.initialized()) {
+      return;
+    }
+    //predicted on a copy of the posterior, so the track is left as it was
+    scratch.SetState(track.ukf.x(), track.ukf.P(), track.ukf.timestamp());
+    const double delta_t = ToSeconds(meas.timestamp_ - track.ukf.timestamp());
+    if (delta_t != 0.0) {
+      scratch.PredictInSteps(delta_t);
+    }
+    if (delta_t == 0.0 || scratch.ekf_predicted_) {
+      scratch.RefreshSigmaPoints();
+    }
+    const double nis = scratch.MeasurementNis(meas);
+    if (nis < options_.gate && nis < best) {
+      best = nis;
+      *best_id = id;
+    }
+  });
+  return best;
+}
+
+void TrackActors::Gated(int worker, const Message &message) {
+  std::vector<Pending> &pending = actors_[worker]->pending;
+  for (size_t i = 0; i < pending.size(); i++) {
+    Pending &entry = pending[i];
+    if (entry.sequence != message.sequence) {
+      continue;
+    }
+    if (message.nis < entry.best_nis) {
+      entry.best_nis = message.nis;
+      entry.best_id = message.id;
+      entry.best_worker = message.worker;
+    }
+    if (++entry.replies == workers() - 1) {
+      const Pending done = entry;
+      pending.erase(pending.begin() + i);
+      Assign(worker, done);
+    }
+    return;
+  }
+}
+
+void TrackActors::Assign(int worker, const Pending &pending) {
+  //nothing gated: the new track's home is this worker
+  if (pending.best_worker < 0) {
+    Message start = {MEASURE, pending.new_id, -1, -1, true, 0, 0.0,
+                     pending.meas, nullptr};
+    Route(worker, start);
+    return;
+  }
+  Message assign = {MEASURE, pending.best_id, -1, worker, false, 0, 0.0,
+                    pending.meas, nullptr};
+  if (pending.best_worker == worker) {
+    assign.from = -1;
+    Route(worker, assign);
+  }
+  else {
+    Post(worker, pending.best_worker, assign);
+  }
+}
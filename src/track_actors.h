@@ -0,0 +1,249 @@
+#ifndef TRACK_ACTORS_H_
+#define TRACK_ACTORS_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "filter_snapshot.h"
+#include "measurement_package.h"
+#include "mpsc_queue.h"
+#include "shard_map.h"
+#include "track_table.h"
+
+/**
+ * Tracks partitioned over worker threads, each the only thread that ever
+ * touches its partition: an actor per worker with a TrackTable of its own
+ * and an MpscQueue inbox any thread may post to. Nothing is locked, and a
+ * track's filter stays in the caches of the one core that runs it.
+ *
+ * A track's home worker is its id's owner in a ShardMap over the workers,
+ * so posting needs no shared table and every producer agrees. Everything
+ * that spans partitions is a message:
+ *
+ *   Measure    goes to the home worker, which filters it
+ *   Associate  a measurement without a track id goes to every worker,
+ *              each gates it against its own tracks and sends its best
+ *              NIS to the coordinating worker (the home of the id a new
+ *              track would take), which forwards the measurement to the
+ *              winner's home, or starts the new track there if nothing
+ *              gated
+ *   Handoff    the owner extracts the track and posts its posterior to
+ *              the new worker; later messages that still reach the old
+ *              owner are forwarded after it, in order, so a track's
+ *              measurements are filtered in the order posted. A worker
+ *              that takes back a track it had been forwarding holds the
+ *              track's new messages until a fence it sends round the old
+ *              forwarding path returns, which brings back everything it
+ *              forwarded before.
+ *
+ * Each filtered measurement produces a Result in one MPSC outbox, drained
+ * by the caller's thread; a result that finds it full is dropped and
+ * counted. Workers spin, yield and then sleep when idle, like Pipeline's.
+ * A worker never waits on another's inbox: what does not fit goes into a
+ * queue of its own for that peer, in order, and is moved over as the peer
+ * drains, so two workers with full inboxes cannot wait on each other. Only
+ * the caller's posts are refused when an inbox is full.
+ */
+class TrackActors {
+public:
+  struct Options {
+    ///* worker threads, each owning a partition
+    int workers;
+    ///* slots of each inbox and of the outbox
+    size_t inbox_capacity;
+    size_t outbox_capacity;
+    ///* largest NIS at which Associate assigns a measurement to a track
+    double gate;
+
+    Options()
+        : workers(2),
+          inbox_capacity(4096),
+          outbox_capacity(16384),
+          gate(11.8) {}
+  };
+
+  struct Result {
+    ///* track that filtered the measurement, and the worker that owns it
+    unsigned id;
+    int worker;
+    TimeUs timestamp;
+    ///* [x, y, vx, vy] after the update, and its NIS
+    double estimate[4];
+    double nis;
+    ///* Associate started a new track with this measurement
+    bool created;
+  };
+
+  /**
+   * Constructor; starts the workers
+   * @param prototype Configuration of every track
+   * @param options Workers, queue sizes and association gate
+   */
+  TrackActors(const UKF &prototype, const Options &options = Options());
+
+  /**
+   * Destructor; stops the workers and drops what they had not done
+   */
+  virtual ~TrackActors();
+
+  /**
+   * Any thread: posts a measurement of a known track
+   * @return false if the home worker's inbox is full
+   */
+  bool Measure(unsigned id, const Measurement &meas);
+
+  /**
+   * Any thread: posts a measurement to the track that gates it best, or to
+   * a new track
+   * @param meas Measurement of some track
+   * @param new_id Id a new track takes if no track gates it
+   * @return false if an inbox was full, in which case no worker has it
+   */
+  bool Associate(const Measurement &meas, unsigned new_id);
+
+  /**
+   * Any thread: moves a track to another worker
+   * @param id Track
+   * @param worker New owner
+   * @return false if the home worker's inbox is full
+   */
+  bool Handoff(unsigned id, int worker);
+
+  /**
+   * The caller's thread (one at a time): takes filtered measurements' results
+   * @param out Room for max results
+   * @return Number taken
+   */
+  size_t Drain(Result *out, size_t max);
+
+  ///* the worker a track's messages are posted to
+  int Home(unsigned id) const { return map_.Owner(id); }
+
+  int workers() const { return static_cast<int>(actors_.size()); }
+
+  ///* results dropped because the outbox was full, and messages forwarded
+  ///* after a handoff
+  unsigned long long dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+  unsigned long long forwarded() const {
+    return forwarded_.load(std::memory_order_relaxed);
+  }
+
+private:
+  enum Kind {
+    ///* filter meas on track id; created if Associate starts the track
+    MEASURE,
+    ///* to the coordinator; id is the new track's
+    ASSOCIATE,
+    ///* gate meas on this worker; worker is the coordinator
+    GATE,
+    ///* a worker's best NIS for an association; worker is the reporter
+    GATED,
+    ///* give up a track; worker is the new owner
+    HANDOFF,
+    ///* take in a track; record is its posterior (or nullptr if it had
+    ///* none), owned by the message
+    ADOPT,
+    ///* goes round a track's forwarding path; worker is the one waiting
+    FENCE
+  };
+
+  struct Message {
+    Kind kind;
+    unsigned id;
+    int worker;
+    ///* worker that posted it, -1 for the caller's
+    int from;
+    bool created;
+    unsigned long long sequence;
+    double nis;
+    Measurement meas;
+    FilterSnapshot::Record *record;
+  };
+
+  // a track taken back while messages forwarded for it may still be
+  // coming back from from, and its newer messages held until they have
+  struct Fence {
+    int from;
+    std::vector<Message> held;
+  };
+
+  // an association waiting for the gating results of every worker
+  struct Pending {
+    unsigned long long sequence;
+    int replies;
+    ///* the best gated track so far and its owner, or -1
+    double best_nis;
+    unsigned best_id;
+    int best_worker;
+    Measurement meas;
+    unsigned new_id;
+  };
+
+  struct Actor {
+    Actor(const UKF &prototype, size_t capacity, int workers)
+        : table(prototype), scratch(prototype), inbox(capacity),
+          held(workers) {}
+
+    TrackTable table;
+    // a copy of a track, predicted to a candidate measurement for gating
+    UKF scratch;
+    MpscQueue<Message> inbox;
+    ///* tracks handed off, by their new owner
+    std::unordered_map<unsigned, int> forwards;
+    std::unordered_map<unsigned, Fence> fences;
+    std::vector<Pending> pending;
+    ///* per peer, messages posted while its inbox was full, oldest first
+    std::vector<std::deque<Message> > held;
+    std::thread thread;
+  };
+
+  // the worker thread of an actor
+  void Run(int worker);
+
+  // handles one message on its worker
+  void Handle(int worker, const Message &message);
+
+  // holds, forwards or carries out a message for one track
+  void Route(int worker, const Message &message);
+
+  // takes in a handed-off track
+  void Adopt(int worker, const Message &message);
+
+  // filters a measurement of a track of this worker and posts its result
+  void Filter(int worker, TrackTable::Track *track, const Measurement &meas,
+              bool created);
+
+  // posts from one worker to another, behind any of its messages to that
+  // worker still held back
+  void Post(int from, int worker, const Message &message);
+
+  // moves a worker's held-back messages into the inboxes with room; true
+  // if any are still held
+  bool Flush(int worker);
+
+  // the best NIS of the worker's tracks for a measurement
+  double Gate(Actor *actor, const Measurement &meas, unsigned *best_id);
+
+  // counts a GATED reply at the coordinator, assigning the measurement
+  // once every worker has replied
+  void Gated(int worker, const Message &message);
+
+  // sends a gated measurement to its track, or starts a new one
+  void Assign(int worker, const Pending &pending);
+
+  ShardMap map_;
+  Options options_;
+  std::vector<std::unique_ptr<Actor> > actors_;
+  MpscQueue<Result> outbox_;
+  std::atomic<unsigned long long> sequence_;
+  std::atomic<unsigned long long> dropped_;
+  std::atomic<unsigned long long> forwarded_;
+  std::atomic<bool> stop_;
+};
+
+#endif /* TRACK_ACTORS_H_ */
@@ -0,0 +1,190 @@
+#include "track_fusion.h"
+#include <algorithm>
+#include <cmath>
+#include "angle.h"
+#include "thread_pool.h"
+
+namespace {
+
+typedef Eigen::Matrix<double, UKF::n_x_, 1> Vector;
+typedef Eigen::Matrix<double, UKF::n_x_, UKF::n_x_> Matrix;
+
+// log determinant from a Cholesky factorisation
+double LogDet(const Eigen::LLT<Matrix> &llt) {
+  const Matrix &L = llt.matrixLLT();
+  double sum = 0.0;
+  for (int i = 0; i < UKF::n_x_; i++) {
+    sum += std::log(L(i, i));
+  }
+  return 2.0 * sum;
+}
+
+// inverse and log determinant of a symmetric positive definite matrix;
+// false if it is not one
+bool Invert(const Matrix &M, Matrix *inverse, double *log_det) {
+  Eigen::LLT<Matrix> llt(M);
+  if (llt.info() != Eigen::Success) {
+    return false;
+  }
+  *inverse = llt.solve(Matrix::Identity());
+  if (log_det) {
+    *log_det = LogDet(llt);
+  }
+  return true;
+}
+
+// Franken and Hupper's weight for two informations, from
+// det(Ia + Ib) - det(Ib) + det(Ia) over 2 det(Ia + Ib), taken in logs so
+// the determinants of small covariances do not overflow; log_a and log_b
+// are those of the two covariances
+double FastOmega(const Matrix &Ia, const Matrix &Ib, double log_a,
+                 double log_b) {
+  //the sum of two informations is positive definite already
+  const double log_sum = LogDet(Eigen::LLT<Matrix>(Ia + Ib));
+  const double w = 0.5 * (1.0 + std::exp(-log_a - log_sum) -
+                          std::exp(-log_b - log_sum));
+  return std::min(1.0, std::max(0.0, w));
+}
+
+// first and second derivative in w of -log det(P) or trace(P), with
+// P^-1 = Ib + w (Ia - Ib)
+void Derivatives(const Matrix &Ib, const Matrix &delta, double w,
+                 TrackFusion::Omega omega, double *d1, double *d2) {
+  Matrix P;
+  Invert(Ib + w * delta, &P, nullptr);
+  const Matrix A = P * delta;
+  if (omega == TrackFusion::kTrace) {
+    *d1 = -(A * P).trace();
+    *d2 = 2.0 * (A * A * P).trace();
+  }
+  else {
+    *d1 = -A.trace();
+    *d2 = (A * A).trace();
+  }
+}
+
+// the weight in [0, 1] minimising a convex objective: Newton from start,
+// kept inside the bracket of the derivative's sign change, with a
+// bisection whenever a step would leave it
+double MinimiseOmega(const Matrix &Ia, const Matrix &Ib, double start,
+                     TrackFusion::Omega omega, int iterations) {
+  const Matrix delta = Ia - Ib;
+  double d1, d2;
+  Derivatives(Ib, delta, 0.0, omega, &d1, &d2);
+  if (d1 >= 0.0) {
+    return 0.0;
+  }
+  Derivatives(Ib, delta, 1.0, omega, &d1, &d2);
+  if (d1 <= 0.0) {
+    return 1.0;
+  }
+  double lo = 0.0, hi = 1.0;
+  double w = start > lo && start < hi ? start : 0.5;
+  for (int k = 0; k < iterations; k++) {
+    Derivatives(Ib, delta, w, omega, &d1, &d2);
+    if (d1 > 0.0) {
+      hi = w;
+    }
+    else {
+      lo = w;
+    }
+    double next = d2 > 0.0 ? w - d1 / d2 : 0.5 * (lo + hi);
+    if (!(next > lo && next < hi)) {
+      next = 0.5 * (lo + hi);
+    }
+    if (std::fabs(next - w) < 1e-12) {
+      break;
+    }
+    w = next;
+  }
+  return w;
+}
+
+}  // namespace
+
+TrackFusion::TrackFusion(const Options &options)
+    : options_(options), pool_(nullptr) {
+  if (options_.iterations < 0) {
+    options_.iterations = 0;
+  }
+  if (options_.grain < 1) {
+    options_.grain = 1;
+  }
+}
+
+TrackFusion::~TrackFusion() {}
+
+bool TrackFusion::Fuse(const Track &a, const Track &b, Fused *out) const {
+  typedef UKF::Scalar Scalar;
+  const Vector xa = a.x.cast<double>();
+  Vector xb = b.x.cast<double>();
+  //average the yaw on the short way round
+  xb(3) = xa(3) + NormalizeAngle(xb(3) - xa(3));
+
+  Matrix Ia, Ib;
+  double log_a, log_b;
+  if (!Invert(a.P.cast<double>(), &Ia, &log_a) ||
+      !Invert(b.P.cast<double>(), &Ib, &log_b)) {
+    out->x = a.x;
+    out->P = a.P;
+    out->omega = 1.0;
+    out->valid = false;
+    return false;
+  }
+
+  double wa = 1.0, wb = 1.0;
+  if (options_.method == kCovarianceIntersection) {
+    wa = FastOmega(Ia, Ib, log_a, log_b);
+    if (options_.omega != kFast) {
+      wa = MinimiseOmega(Ia, Ib, wa, options_.omega, options_.iterations);
+    }
+    wb = 1.0 - wa;
+  }
+
+  Matrix P;
+  Invert(wa * Ia + wb * Ib, &P, nullptr);
+  Vector x = P * (wa * (Ia * xa) + wb * (Ib * xb));
+  x(3) = NormalizeAngle(x(3));
+  //symmetric to the last bit, as the filter expects
+  P = 0.5 * (P + P.transpose());
+
+  out->x = x.cast<Scalar>();
+  out->P = P.cast<Scalar>();
+  out->omega = wa;
+  out->valid = true;
+  return true;
+}
+
+bool TrackFusion::Fuse(const UKF &a, const UKF &b, Fused *out) const {
+  Track ta = {a.x(), a.P()};
+  Track tb = {b.x(), b.P()};
+  if (a.timestamp() < b.timestamp()) {
+    const double dt = ToSeconds(b.timestamp() - a.timestamp());
+    a.PredictAhead(&dt, 1, &ta.x, &ta.P);
+  }
+  else if (b.timestamp() < a.timestamp()) {
+    const double dt = ToSeconds(a.timestamp() - b.timestamp());
+    b.PredictAhead(&dt, 1, &tb.x, &tb.P);
+  }
+  return Fuse(ta, tb, out);
+}
+
+size_t TrackFusion::FuseBatch(const Track *a, const Track *b, size_t n,
+                              Fused *out) const {
+  auto body = [this, a, b, out](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      Fuse(a[i], b[i], &out[i]);
+    }
+  };
+  if (pool_ && n > static_cast<size_t>(options_.grain)) {
+    pool_->ParallelFor(0, static_cast<int>(n), options_.grain, body);
+  }
+  else {
+    body(0, static_cast<int>(n));
+  }
+  size_t valid = 0;
+  for (size_t i = 0; i < n; i++) {
+    valid += out[i].valid ? 1 : 0;
+  }
+  return valid;
+}
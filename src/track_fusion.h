@@ -0,0 +1,125 @@
+#ifndef TRACK_FUSION_H_
+#define TRACK_FUSION_H_
+
+#include <cstddef>
+#include "ukf.h"
+
+class ThreadPool;
+
+/**
+ * Track-to-track fusion of estimates of the same object made by different
+ * nodes or sensors, so cross-node fusion combines two posteriors instead of
+ * re-running a filter over the merged raw measurements.
+ *
+ * Two tracks fed by the same measurements, or by the same process noise,
+ * are correlated in a way neither knows, and adding their information
+ * counts it twice. Covariance intersection is consistent for any such
+ * correlation:
+ *
+ *   P^-1 = w Pa^-1 + (1 - w) Pb^-1,  x = P (w Pa^-1 xa + (1 - w) Pb^-1 xb)
+ *
+ * with the weight w in [0, 1] chosen to make P small. kFast takes w in
+ * closed form from the determinants of the two informations and their sum
+ * (Franken and Hupper's fast CI), which costs three extra factorisations;
+ * kDeterminant and kTrace minimise det(P) or trace(P) exactly, with a few
+ * safeguarded Newton steps on the convex objective started from the fast
+ * weight. kInformation adds the informations (w = 1 for both), which is
+ * right only for independent tracks.
+ *
+ * The yaw of b is wrapped to within pi of a's before it is averaged. Both
+ * tracks must be at the same time; Fuse(UKF, UKF) predicts the older one.
+ */
+class TrackFusion {
+public:
+  enum Method {
+    kInformation,
+    kCovarianceIntersection
+  };
+
+  ///* what the covariance intersection weight minimises
+  enum Omega {
+    kFast,
+    kDeterminant,
+    kTrace
+  };
+
+  struct Options {
+    Method method;
+    Omega omega;
+    ///* Newton steps of kDeterminant and kTrace
+    int iterations;
+    ///* tracks per parallel chunk of FuseBatch
+    int grain;
+
+    Options()
+        : method(kCovarianceIntersection),
+          omega(kFast),
+          iterations(8),
+          grain(256) {}
+  };
+
+  ///* One track to fuse
+  struct Track {
+    UKF::StateVector x;
+    UKF::StateMatrix P;
+  };
+
+  ///* A fused track
+  struct Fused {
+    UKF::StateVector x;
+    UKF::StateMatrix P;
+    ///* weight of a; 1 for kInformation
+    double omega;
+    ///* false if a covariance was not positive definite; x and P are then
+    ///* a's
+    bool valid;
+  };
+
+  explicit TrackFusion(const Options &options = Options());
+
+  virtual ~TrackFusion();
+
+  /**
+   * Runs FuseBatch on a pool
+   * @param pool Pool to use, or nullptr for the calling thread
+   */
+  void SetThreadPool(ThreadPool *pool) { pool_ = pool; }
+
+  /**
+   * Fuses two tracks at the same time
+   * @param a First track
+   * @param b Second track
+   * @param out Fused track
+   * @return out->valid
+   */
+  bool Fuse(const Track &a, const Track &b, Fused *out) const;
+
+  /**
+   * Fuses the posteriors of two filters, the older predicted forward (with
+   * UKF::PredictAhead) to the time of the newer one
+   * @param a First filter; must be initialised
+   * @param b Second filter; must be initialised
+   * @param out Fused track, at the later of the two timestamps
+   * @return out->valid
+   */
+  bool Fuse(const UKF &a, const UKF &b, Fused *out) const;
+
+  /**
+   * Fuses n pairs, a[i] with b[i], on the pool if one is set
+   * @param a n tracks
+   * @param b n tracks
+   * @param n Number of pairs
+   * @param out n fused tracks
+   * @return Number of valid results
+   */
+  size_t FuseBatch(const Track *a, const Track *b, size_t n,
+                   Fused *out) const;
+
+  const Options &options() const { return options_; }
+
+private:
+  Options options_;
+  ThreadPool *pool_;
+};
+
+#endif /* TRACK_FUSION_H_ */
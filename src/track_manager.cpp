@@ -0,0 +1,251 @@
+#include "track_manager.h"
+#include <algorithm>
+#include <cmath>
+#include "thread_pool.h"
+
+namespace {
+
+// tracks per chunk of PredictAll, a few microseconds of work each
+const int kPredictGrain = 16;
+
+// resolution of the timeouts
+const TimeUs kTimeoutTick = 1000;
+
+// 99% chi-square bounds of the NIS for 2 and 3 dimensions: a gate would
+// have refused anything worse, so worse costs no more (and the large NIS of
+// a young filter's first radar updates does not prune a real target)
+const double kNisCap[4] = {0.0, 0.0, 9.21, 11.34};
+
+}  // namespace
+
+TrackManager::TrackManager(const UKF &prototype, int capacity)
+    : confirm_hits_(3),
+      tentative_misses_(1),
+      confirmed_misses_(5),
+      hit_score_(0.0),
+      miss_score_(0.0),
+      prune_drop_(0.0),
+      wheel_(capacity > 0 ? capacity : 0, kTimeoutTick),
+      coast_after_(0),
+      delete_after_(0),
+      next_id_(0),
+      created_(0),
+      deleted_(0),
+      pruned_(0) {
+  Track blank;
+  blank.ukf = prototype;
+  blank.state = FREE;
+  blank.id = 0;
+  blank.hits = 0;
+  blank.misses = 0;
+  blank.active_index = -1;
+  blank.score = 0.0;
+  blank.peak_score = 0.0;
+  slab_.assign(capacity > 0 ? capacity : 0, blank);
+
+  //lowest slots are handed out first
+  free_.reserve(slab_.size());
+  for (int i = static_cast<int>(slab_.size()) - 1; i >= 0; i--) {
+    free_.push_back(i);
+  }
+  active_.reserve(slab_.size());
+  expired_.reserve(slab_.size());
+}
+
+TrackManager::~TrackManager() {}
+
+void TrackManager::SetRules(int confirm_hits, int tentative_misses,
+                            int confirmed_misses) {
+  confirm_hits_ = confirm_hits;
+  tentative_misses_ = tentative_misses;
+  confirmed_misses_ = confirmed_misses;
+}
+
+void TrackManager::SetScoring(double detection_probability,
+                              double false_alarm_probability,
+                              double prune_drop) {
+  hit_score_ = std::log(detection_probability / false_alarm_probability);
+  miss_score_ = std::log(1.0 - detection_probability);
+  prune_drop_ = prune_drop;
+}
+
+int TrackManager::Create(const Measurement &meas) {
+  if (free_.empty()) {
+    return -1;
+  }
+  int slot = free_.back();
+  free_.pop_back();
+
+  Track &track = slab_[slot];
+  track.ukf.Reset();
+  track.ukf.ProcessMeasurement(meas);
+  track.state = TENTATIVE;
+  track.id = next_id_++;
+  track.hits = 1;
+  track.misses = 0;
+  track.score = 0.0;
+  track.peak_score = 0.0;
+  track.active_index = static_cast<int>(active_.size());
+  active_.push_back(slot);
+  if (coast_after_ > 0) {
+    wheel_.Schedule(slot, track.ukf.timestamp() + coast_after_);
+  }
+  ++created_;
+  return slot;
+}
+
+int TrackManager::Branch(int slot) {
+  if (free_.empty()) {
+    return -1;
+  }
+  int copy = free_.back();
+  free_.pop_back();
+
+  Track &track = slab_[copy];
+  const Track &parent = slab_[slot];
+  track.ukf = parent.ukf;
+  track.state = parent.state;
+  track.id = next_id_++;
+  track.hits = parent.hits;
+  track.misses = parent.misses;
+  track.score = parent.score;
+  track.peak_score = parent.peak_score;
+  track.active_index = static_cast<int>(active_.size());
+  active_.push_back(copy);
+  if (coast_after_ > 0) {
+    wheel_.Schedule(copy, track.ukf.timestamp() +
+                              (track.state == COASTING ? delete_after_
+                                                       : coast_after_));
+  }
+  ++created_;
+  return copy;
+}
+
+void TrackManager::Hit(int slot) {
+  Track &track = slab_[slot];
+  ++track.hits;
+  track.misses = 0;
+  if ((track.state == TENTATIVE && track.hits >= confirm_hits_) ||
+      track.state == COASTING) {
+    track.state = CONFIRMED;
+  }
+  if (coast_after_ > 0) {
+    wheel_.Schedule(slot, track.ukf.timestamp() + coast_after_);
+  }
+}
+
+bool TrackManager::Update(int slot, const Measurement &meas) {
+  Track &track = slab_[slot];
+  track.ukf.ProcessMeasurement(meas);
+  if (prune_drop_ > 0.0) {
+    const int m = meas.size();
+    const double nis = track.ukf.nis(meas.sensor_type_);
+    //a non-finite NIS (a diverged filter) prunes at once
+    const double delta = std::isfinite(nis)
+        ? hit_score_ - 0.5 * (std::min(nis, kNisCap[m]) - m) : -HUGE_VAL;
+    if (Score(slot, delta)) {
+      return false;
+    }
+  }
+  Hit(slot);
+  return true;
+}
+
+bool TrackManager::Score(int slot, double delta) {
+  Track &track = slab_[slot];
+  track.score += delta;
+  track.peak_score = std::max(track.peak_score, track.score);
+  if (track.score >= track.peak_score - prune_drop_) {
+    return false;
+  }
+  Remove(slot);
+  ++pruned_;
+  return true;
+}
+
+bool TrackManager::Miss(int slot) {
+  Track &track = slab_[slot];
+  if (prune_drop_ > 0.0 && Score(slot, miss_score_)) {
+    return true;
+  }
+  ++track.misses;
+  int limit = track.state == TENTATIVE ? tentative_misses_ : confirmed_misses_;
+  if (track.misses >= limit) {
+    Remove(slot);
+    return true;
+  }
+  return false;
+}
+
+void TrackManager::Remove(int slot) {
+  Track &track = slab_[slot];
+  if (track.state == FREE) {
+    return;
+  }
+
+  //swap-remove from the active list
+  int last = active_.back();
+  active_[track.active_index] = last;
+  slab_[last].active_index = track.active_index;
+  active_.pop_back();
+
+  track.state = FREE;
+  track.active_index = -1;
+  wheel_.Cancel(slot);
+  free_.push_back(slot);
+  ++deleted_;
+}
+
+void TrackManager::SetTimeouts(TimeUs coast_after, TimeUs delete_after) {
+  coast_after_ = coast_after;
+  delete_after_ = delete_after;
+}
+
+int TrackManager::Expire(TimeUs now) {
+  expired_.clear();
+  wheel_.Advance(now, &expired_);
+  int deleted = 0;
+  for (size_t k = 0; k < expired_.size(); k++) {
+    const int slot = expired_[k];
+    Track &track = slab_[slot];
+    if (track.state == CONFIRMED && delete_after_ > coast_after_) {
+      track.state = COASTING;
+      wheel_.Schedule(slot, track.ukf.timestamp() + delete_after_);
+    }
+    else {
+      Remove(slot);
+      ++deleted;
+    }
+  }
+  return deleted;
+}
+
+void TrackManager::Configure(const UKFConfig &config) {
+  for (size_t i = 0; i < slab_.size(); i++) {
+    slab_[i].ukf.Configure(config);
+  }
+}
+
+void TrackManager::PredictAll(TimeUs timestamp, ThreadPool *pool,
+                              UKF::PredictedState *out) const {
+  auto predict = [this, timestamp, out](int begin, int end) {
+    for (int k = begin; k < end; k++) {
+      const UKF &ukf = slab_[active_[k]].ukf;
+      if (timestamp > ukf.timestamp()) {
+        ukf.PredictTrajectory(&timestamp, 1, &out[k]);
+      }
+      else {
+        out[k].timestamp = ukf.timestamp();
+        out[k].x = ukf.x();
+        out[k].P = ukf.P();
+      }
+    }
+  };
+  const int count = static_cast<int>(active_.size());
+  if (pool) {
+    pool->ParallelFor(0, count, kPredictGrain, predict);
+  }
+  else {
+    predict(0, count);
+  }
+}
@@ -0,0 +1,233 @@
+#ifndef TRACK_MANAGER_H_
+#define TRACK_MANAGER_H_
+
+#include <vector>
+#include "Eigen/StdVector"
+#include "measurement_package.h"
+#include "timer_wheel.h"
+#include "ukf.h"
+
+class ThreadPool;
+
+/**
+ * Multi-target track lifecycle over a fixed slab of filters.
+ *
+ * A track starts TENTATIVE on an unassociated measurement, becomes
+ * CONFIRMED after confirm_hits associated updates, and is deleted after
+ * tentative_misses (while tentative) or confirmed_misses (once confirmed)
+ * consecutive scans without a measurement. Deleted slots go back on a free
+ * list and their filters are Reset in place, so track churn does not touch
+ * the allocator once the slab is built.
+ *
+ * Tracks can also be scored (SetScoring): each keeps a running log-likelihood
+ * ratio of being a real target, raised by consistent updates and lowered
+ * by misses and by updates whose NIS says the measurement hardly fits, and
+ * is pruned as soon as it falls too far below its best. Updating the score
+ * is O(1) per Update or Miss, so clutter tracks go before the miss rules
+ * would delete them, and take no more filter work.
+ *
+ * Tracks can also time out by the clock (SetTimeouts): every live track has
+ * a deadline in a TimerWheel, moved on each Hit, so Expire finds the stale
+ * ones without scanning the others. A confirmed track first coasts
+ * (COASTING, predicted but unconfirmed by data) and is deleted later; a
+ * tentative one is deleted when it would start to coast.
+ *
+ * Slots are the dense ids SpatialGrid and GnnAssociator expect; active()
+ * lists the live ones.
+ */
+class TrackManager {
+public:
+  enum State {
+    FREE,
+    TENTATIVE,
+    CONFIRMED,
+    COASTING
+  };
+
+  struct Track {
+    UKF ukf;
+    State state;
+    ///* unique over the manager's lifetime, unlike the slot
+    unsigned long long id;
+    ///* associated updates, and consecutive scans without one
+    int hits;
+    int misses;
+    ///* position in active_
+    int active_index;
+    ///* log-likelihood ratio of the track (0 at birth), and the highest it
+    ///* reached; only kept while scoring
+    double score;
+    double peak_score;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /**
+   * Constructor; allocates every filter up front
+   * @param prototype Configuration of every track
+   * @param capacity Maximum number of live tracks
+   */
+  TrackManager(const UKF &prototype, int capacity);
+
+  /**
+   * Destructor
+   */
+  virtual ~TrackManager();
+
+  /**
+   * Confirmation and deletion thresholds
+   * @param confirm_hits Hits that confirm a tentative track
+   * @param tentative_misses Misses that delete a tentative track
+   * @param confirmed_misses Misses that delete a confirmed track
+   */
+  void SetRules(int confirm_hits, int tentative_misses, int confirmed_misses);
+
+  /**
+   * Scores tracks by their log-likelihood ratio and prunes those whose score
+   * drops prune_drop below its peak. An Update adds ln(P_D / P_FA) and
+   * -(NIS - m) / 2 (m the measurement dimension, the NIS an average update
+   * has), with the NIS capped at its 99% bound; a Miss adds ln(1 - P_D).
+   * @param detection_probability P_D, in (0, 1)
+   * @param false_alarm_probability P_FA, chance that a gated measurement is
+   * clutter, in (0, 1]
+   * @param prune_drop Fall from the peak score that prunes, e.g. 10; 0, the
+   * default, turns scoring off
+   */
+  void SetScoring(double detection_probability,
+                  double false_alarm_probability, double prune_drop);
+
+  /**
+   * Fuses an associated measurement into a track, scores the update by its
+   * NIS and Hits the track
+   * @param slot Live track
+   * @param meas The measurement
+   * @return false if the score pruned the track
+   */
+  bool Update(int slot, const Measurement &meas);
+
+  /**
+   * Starts a tentative track on a measurement
+   * @param meas Its first measurement
+   * @return Slot, or -1 if the slab is full
+   */
+  int Create(const Measurement &meas);
+
+  /**
+   * Starts a track as a copy of a live one, filter, state, counts and
+   * score included, e.g. a hypothesis branching from it. The filter is
+   * copied into a pooled slot, which allocates nothing unless the parent's
+   * out-of-sequence history outgrew the slot's.
+   * @param slot Live track to copy
+   * @return Slot of the copy, or -1 if the slab is full
+   */
+  int Branch(int slot);
+
+  /**
+   * Records that a track was updated with an associated measurement this
+   * scan, confirming it once it has enough hits. A coasting track is
+   * confirmed again, and the track's timeout restarts from its filter's
+   * timestamp().
+   * @param slot Live track
+   */
+  void Hit(int slot);
+
+  /**
+   * Records a scan without a measurement for a track, deleting it once it
+   * has missed too often or its score is pruned
+   * @param slot Live track
+   * @return true if the track was deleted
+   */
+  bool Miss(int slot);
+
+  /**
+   * Deletes a track and returns its slot to the pool
+   * @param slot Live track
+   */
+  void Remove(int slot);
+
+  /**
+   * Timeouts measured from a track's last update (its filter's
+   * timestamp()), enforced by Expire; both 0, the default, turns them off.
+   * Applies to tracks created or hit from now on.
+   * @param coast_after Silence in us after which a confirmed track coasts
+   * and a tentative one is deleted
+   * @param delete_after Silence in us after which a coasting track is
+   * deleted
+   */
+  void SetTimeouts(TimeUs coast_after, TimeUs delete_after);
+
+  /**
+   * Applies the timeouts due by a time: coasts or deletes the tracks whose
+   * deadline has passed. Costs O(1) per elapsed millisecond and per timed
+   * out track, however many tracks are live.
+   * @param now Current time in us, not decreasing between calls
+   * @return Number of tracks deleted
+   */
+  int Expire(TimeUs now);
+
+  /**
+   * Applies a config to every filter in the slab, free ones included
+   * @param config New settings
+   */
+  void Configure(const UKFConfig &config);
+
+  /**
+   * Predicts every live track to one frame time, for consumers that want
+   * all states at the same instant while each filter only advances on its
+   * own measurements. No filter changes: each track is predicted with
+   * PredictTrajectory, so the result is what the filter itself would
+   * predict, sub-steps included. A track already at or past the frame
+   * time is reported at its own estimate.
+   * @param timestamp Frame time in us
+   * @param pool Pool to spread the tracks over, or nullptr for the calling
+   * thread
+   * @param out size() predictions, in the order of active()
+   */
+  void PredictAll(TimeUs timestamp, ThreadPool *pool,
+                  UKF::PredictedState *out) const;
+
+  Track &operator[](int slot) { return slab_[slot]; }
+  const Track &operator[](int slot) const { return slab_[slot]; }
+
+  ///* Slots of the live tracks, in no particular order
+  const std::vector<int> &active() const { return active_; }
+
+  int capacity() const { return static_cast<int>(slab_.size()); }
+  size_t size() const { return active_.size(); }
+
+  ///* Tracks created and deleted so far
+  unsigned long long created() const { return created_; }
+  unsigned long long deleted() const { return deleted_; }
+  ///* deletions by the score, among deleted()
+  unsigned long long pruned() const { return pruned_; }
+
+private:
+  std::vector<Track, Eigen::aligned_allocator<Track> > slab_;
+  std::vector<int> free_;
+  std::vector<int> active_;
+
+  int confirm_hits_;
+  int tentative_misses_;
+  int confirmed_misses_;
+
+  // removes a scored track if it fell prune_drop_ below its peak
+  bool Score(int slot, double delta);
+
+  ///* score steps, and the fall that prunes (0: not scoring)
+  double hit_score_;
+  double miss_score_;
+  double prune_drop_;
+
+  ///* per-slot timeout deadlines, and the slots due in one Expire
+  TimerWheel wheel_;
+  std::vector<int> expired_;
+  TimeUs coast_after_;
+  TimeUs delete_after_;
+
+  unsigned long long next_id_;
+  unsigned long long created_;
+  unsigned long long deleted_;
+  unsigned long long pruned_;
+};
+
+#endif /* TRACK_MANAGER_H_ */
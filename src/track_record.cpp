@@ -0,0 +1,43 @@
+#include "track_record.h"
+
+static_assert(sizeof(TrackRecord) == 192, "three cache lines per track");
+
+void TrackRecord::Capture(const UKF &ukf, unsigned long long track_id) {
+  id = track_id;
+  Set(ukf.x(), ukf.P(), ukf.timestamp());
+}
+
+void TrackRecord::Get(UKF::StateVector *x_out,
+                      UKF::StateMatrix *P_out) const {
+  for (int i = 0; i < UKF::n_x_; i++) {
+    (*x_out)(i) = static_cast<UKF::Scalar>(x[i]);
+  }
+  PackedSymmetric<UKF::n_x_>::Unpack(p, P_out);
+}
+
+void TrackRecord::Set(const UKF::StateVector &x_in,
+                      const UKF::StateMatrix &P_in, TimeUs time_us) {
+  for (int i = 0; i < UKF::n_x_; i++) {
+    x[i] = x_in(i);
+  }
+  PackedSymmetric<UKF::n_x_>::Pack(P_in, p);
+  timestamp = time_us;
+}
+
+void PredictRecords(const UKF &model, TimeUs timestamp,
+                    TrackRecord *records, size_t count) {
+  UKF::StateVector x;
+  UKF::StateMatrix P;
+  UKF::StateVector x_pred;
+  UKF::StateMatrix P_pred;
+  for (size_t i = 0; i < count; i++) {
+    TrackRecord &record = records[i];
+    if (record.timestamp >= timestamp) {
+      continue;
+    }
+    record.Get(&x, &P);
+    model.PredictFrom(x, P, ToSeconds(timestamp - record.timestamp),
+                      &x_pred, &P_pred, nullptr);
+    record.Set(x_pred, P_pred, timestamp);
+  }
+}
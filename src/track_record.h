@@ -0,0 +1,89 @@
+#ifndef TRACK_RECORD_H_
+#define TRACK_RECORD_H_
+
+#include <cstddef>
+#include <new>
+#include <stdlib.h>
+#include <vector>
+#include "packed_symmetric.h"
+#include "ukf.h"
+
+/**
+ * One track's posterior packed into whole cache lines: the state, the upper
+ * triangle of its covariance and its timestamp, 176 bytes padded to three
+ * 64-byte lines. An array of these is a single sequential stream, so sweeps
+ * over many tracks (prediction, export) run at prefetch speed, where a
+ * vector of UKF objects strides over 2.7 KB of sigma points, scratch and
+ * counters per track.
+ */
+struct alignas(64) TrackRecord {
+  double x[UKF::n_x_];
+  ///* upper triangle of P, row by row
+  double p[PackedSymmetric<UKF::n_x_>::kSize];
+  ///* time of the state in us
+  TimeUs timestamp;
+  unsigned long long id;
+
+  /**
+   * Packs a filter's posterior
+   * @param ukf Filter
+   * @param track_id Id stored with it
+   */
+  void Capture(const UKF &ukf, unsigned long long track_id);
+
+  /**
+   * Unpacks the state and covariance
+   */
+  void Get(UKF::StateVector *x_out, UKF::StateMatrix *P_out) const;
+
+  /**
+   * Packs a state and covariance, keeping the id
+   */
+  void Set(const UKF::StateVector &x_in, const UKF::StateMatrix &P_in,
+           TimeUs time_us);
+};
+
+/**
+ * std::allocator with 64-byte alignment, which C++11 operator new does not
+ * give over-aligned types
+ */
+template <typename T>
+class CacheAlignedAllocator {
+public:
+  typedef T value_type;
+
+  CacheAlignedAllocator() {}
+  template <typename U>
+  CacheAlignedAllocator(const CacheAlignedAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    void *p = nullptr;
+    if (posix_memalign(&p, 64, n * sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+  }
+  void deallocate(T *p, size_t) { free(p); }
+
+  template <typename U>
+  bool operator==(const CacheAlignedAllocator<U> &) const { return true; }
+  template <typename U>
+  bool operator!=(const CacheAlignedAllocator<U> &) const { return false; }
+};
+
+typedef std::vector<TrackRecord, CacheAlignedAllocator<TrackRecord> >
+    TrackRecords;
+
+/**
+ * Predicts every record to one time in a single sequential sweep, with the
+ * model, noise and weights of a prototype filter. Records already at or
+ * past the time are left as they are.
+ * @param model Prototype filter; only its settings are used
+ * @param timestamp Target time in us
+ * @param records First record
+ * @param count Number of records
+ */
+void PredictRecords(const UKF &model, TimeUs timestamp,
+                    TrackRecord *records, size_t count);
+
+#endif /* TRACK_RECORD_H_ */
@@ -0,0 +1,317 @@
+#include "track_table.h"
+#include <chrono>
+#include <vector>
+#include "latency_trace.h"
+#include "metrics.h"
+#include "stage_timing.h"
+
+void TrackTable::Track::Process(const Measurement &meas,
+                                const Eigen::Vector4d &ground_truth,
+                                Eigen::Vector4d *estimate) {
+  Process(meas, estimate);
+
+  UKF_STAGE_TIMER(STAGE_RMSE);
+  rmse.Add(*estimate, ground_truth);
+  nees.AddCtrv(ukf.x(), ukf.P(), ground_truth);
+  window_rmse.Add(*estimate, ground_truth, meas.timestamp_);
+}
+
+void TrackTable::Track::Process(const Measurement &meas,
+                                Eigen::Vector4d *estimate) {
+  const unsigned long long repairs = ukf.covariance_repairs_;
+  UKF::Estimate e;
+  if (shadow && shadow->Sample()) {
+    //the sampled update is timed and replayed on a retuned copy of the
+    //filter as it was before
+    shadow->Begin(ukf);
+    const auto start = std::chrono::steady_clock::now();
+    ukf.ProcessMeasurement(meas, &e);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    shadow->Finish(ukf, meas,
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       elapsed).count());
+  }
+  else {
+    ukf.ProcessMeasurement(meas, &e);
+  }
+  last_sensor = meas.sensor_type_;
+  if (ukf.covariance_repairs_ != repairs) {
+    LatencyTrace::Repaired(ukf.covariance_repairs_ - repairs);
+    Metrics::Increment(Metrics::COVARIANCE_REPAIRS);
+  }
+  Metrics::Increment(meas.sensor_type_ == MeasurementPackage::RADAR
+                         ? Metrics::UPDATES_RADAR
+                         : Metrics::UPDATES_LIDAR);
+  if (!ukf.Healthy()) {
+    Metrics::Increment(Metrics::DIVERGENCES);
+  }
+
+  *estimate << e.px, e.py, e.vx, e.vy;
+  Publish();
+}
+
+TrackTable::TrackTable(const UKF &prototype)
+    : prototype_(prototype),
+      view_(nullptr),
+      leader_(nullptr),
+      shadow_(nullptr),
+      config_generation_(0),
+      window_(0),
+      window_span_us_(0) {}
+
+TrackTable::~TrackTable() {}
+
+TrackTable::Track &TrackTable::Get(unsigned id) {
+  const uint32_t *slot = ids_.Find(id);
+  Track *track = slot ? pool_[*slot].get() : Create(id);
+  Refresh(track);
+  return *track;
+}
+
+TrackTable::Track *TrackTable::Resolve(Handle handle) {
+  if (handle.slot >= generations_.size() ||
+      generations_[handle.slot] != handle.generation ||
+      !(handle.generation & 1)) {
+    return nullptr;
+  }
+  Track *track = pool_[handle.slot].get();
+  Refresh(track);
+  return track;
+}
+
+uint32_t TrackTable::AddSlot() {
+  const uint32_t slot = static_cast<uint32_t>(pool_.size());
+  pool_.push_back(std::unique_ptr<Track>(new Track()));
+  pool_.back()->slot = slot;
+  generations_.push_back(0);
+  places_.push_back(0);
+  return slot;
+}
+
+TrackTable::Track *TrackTable::Create(unsigned id) {
+  uint32_t slot;
+  if (free_.empty()) {
+    slot = AddSlot();
+  }
+  else {
+    slot = free_.back();
+    free_.pop_back();
+  }
+  Track *track = pool_[slot].get();
+  track->rmse = RMSEAccumulator();
+  track->nees.Reset();
+  track->window_rmse.SetWindow(window_, window_span_us_);
+  track->last_sensor = MeasurementPackage::LASER;
+  track->ukf = prototype_;
+  track->id = id;
+  track->view = view_;
+  track->view_slot = view_ ? view_->Add(id) : -1;
+  track->leader = leader_;
+  track->shadow = shadow_;
+  track->config_generation = config_generation_;
+  ++generations_[slot];
+  places_[slot] = static_cast<uint32_t>(live_.size());
+  live_.push_back(slot);
+  ids_.Insert(id, slot);
+  return track;
+}
+
+void TrackTable::Refresh(Track *track) {
+  const ConfigReload::Published *current = ConfigReload::Current();
+  if (!current) {
+    return;
+  }
+  if (current->generation != config_generation_) {
+    prototype_.Configure(current->config);
+    config_generation_ = current->generation;
+  }
+  //each track pays for its own retune on its next measurement
+  if (track->config_generation != config_generation_) {
+    track->ukf.Configure(current->config);
+    track->config_generation = config_generation_;
+  }
+}
+
+void TrackTable::SetView(TrackView *view) {
+  if (view_) {
+    view_->Clear();
+  }
+  view_ = view;
+  for (size_t i = 0; i < live_.size(); i++) {
+    Track &track = *pool_[live_[i]];
+    track.view = view_;
+    track.view_slot = view_ ? view_->Add(track.id) : -1;
+    track.Publish();
+  }
+}
+
+void TrackTable::SetReplication(ReplicationLeader *leader) {
+  leader_ = leader;
+  for (size_t i = 0; i < live_.size(); i++) {
+    pool_[live_[i]]->leader = leader_;
+  }
+  if (leader_) {
+    leader_->Sync(*this);
+  }
+}
+
+void TrackTable::SetRMSEWindow(unsigned long window, long long span_us) {
+  window_ = window;
+  window_span_us_ = span_us;
+  for (size_t i = 0; i < live_.size(); i++) {
+    pool_[live_[i]]->window_rmse.SetWindow(window_, window_span_us_);
+  }
+}
+
+void TrackTable::SetShadow(ShadowRunner *shadow) {
+  shadow_ = shadow;
+  for (size_t i = 0; i < live_.size(); i++) {
+    pool_[live_[i]]->shadow = shadow_;
+  }
+}
+
+void TrackTable::Configure(const UKFConfig &config) {
+  prototype_.Configure(config);
+  for (size_t i = 0; i < live_.size(); i++) {
+    pool_[live_[i]]->ukf.Configure(config);
+  }
+}
+
+bool TrackTable::Save(const char *path) const {
+  std::vector<FilterSnapshot::Record> records;
+  Capture(&records);
+  return FilterSnapshot::Write(path, records);
+}
+
+void TrackTable::Capture(std::vector<FilterSnapshot::Record> *records) const {
+  records->reserve(records->size() + live_.size());
+  for (size_t i = 0; i < live_.size(); i++) {
+    const Track &track = *pool_[live_[i]];
+    if (track.ukf.initialized()) {
+      records->push_back(FilterSnapshot::Record());
+      FilterSnapshot::Capture(track.ukf, track.id, &records->back());
+    }
+  }
+}
+
+bool TrackTable::Load(const char *path, size_t *restored) {
+  FilterSnapshot::File file;
+  if (!file.Open(path)) {
+    return false;
+  }
+  const size_t n = Insert(file.records(), file.size());
+  if (restored) {
+    *restored = n;
+  }
+  return true;
+}
+
+bool TrackTable::Remove(unsigned id) {
+  const uint32_t *slot = ids_.Find(id);
+  if (!slot) {
+    return false;
+  }
+  Retire(*slot);
+  return true;
+}
+
+void TrackTable::Retire(uint32_t slot) {
+  Track *track = pool_[slot].get();
+  if (track->view_slot >= 0) {
+    track->view->Withdraw(track->view_slot, track->id);
+  }
+  if (track->leader) {
+    track->leader->Remove(track->id);
+  }
+  ids_.Erase(track->id);
+  ++generations_[slot];
+  //the last live slot fills the place
+  const uint32_t moved = live_.back();
+  live_[places_[slot]] = moved;
+  places_[moved] = places_[slot];
+  live_.pop_back();
+  free_.push_back(slot);
+}
+
+size_t TrackTable::Extract(const std::function<bool(unsigned)> &leaves,
+                           std::vector<FilterSnapshot::Record> *records) {
+  size_t n = 0;
+  //Retire moves the last live slot into place i, so i stays put
+  for (size_t i = 0; i < live_.size();) {
+    Track &track = *pool_[live_[i]];
+    if (!leaves(track.id)) {
+      ++i;
+      continue;
+    }
+    if (track.ukf.initialized()) {
+      records->push_back(FilterSnapshot::Record());
+      FilterSnapshot::Capture(track.ukf, track.id, &records->back());
+    }
+    Retire(live_[i]);
+    ++n;
+  }
+  return n;
+}
+
+size_t TrackTable::Insert(const FilterSnapshot::Record *records,
+                          size_t count) {
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    const FilterSnapshot::Record &record = records[i];
+    //check against the prototype before creating the track
+    if (record.config_hash != prototype_.Config().ModelHash()) {
+      continue;
+    }
+    Track &track = Get(unsigned(record.id));
+    if (FilterSnapshot::Restore(record, &track.ukf)) {
+      track.Publish();
+      ++n;
+    }
+  }
+  return n;
+}
+
+void TrackTable::Clear() {
+  for (size_t i = 0; i < live_.size(); i++) {
+    ++generations_[live_[i]];
+    free_.push_back(live_[i]);
+  }
+  live_.clear();
+  ids_.Clear();
+  if (view_) {
+    view_->Clear();
+  }
+  if (leader_) {
+    leader_->Clear();
+  }
+}
+
+void TrackTable::Reset(const UKF &prototype) {
+  Clear();
+  prototype_ = prototype;
+  config_generation_ = 0;
+}
+
+void TrackTable::Reserve(size_t count) {
+  ids_.Reserve(live_.size() + count);
+  live_.reserve(live_.size() + count);
+  while (free_.size() < count) {
+    free_.push_back(AddSlot());
+  }
+}
+
+size_t TrackTable::MemoryBytes() const {
+  size_t bytes = prototype_.MemoryBytes() + ids_.MemoryBytes() +
+                 pool_.capacity() * sizeof(std::unique_ptr<Track>) +
+                 (generations_.capacity() + places_.capacity() +
+                  live_.capacity() + free_.capacity()) * sizeof(uint32_t);
+  for (size_t i = 0; i < pool_.size(); i++) {
+    bytes += TrackBytes(*pool_[i]);
+  }
+  return bytes;
+}
+
+size_t TrackTable::TrackBytes(const Track &track) {
+  return sizeof(Track) + track.ukf.MemoryBytes() +
+         track.window_rmse.MemoryBytes();
+}
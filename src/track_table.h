@@ -0,0 +1,309 @@
+#ifndef TRACK_TABLE_H_
+#define TRACK_TABLE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Eigen/Dense"
+#include "config_reload.h"
+#include "filter_snapshot.h"
+#include "id_map.h"
+#include "measurement_package.h"
+#include "replication.h"
+#include "shadow_runner.h"
+#include "tools.h"
+#include "track_view.h"
+#include "ukf.h"
+
+/**
+ * Independent filters keyed by track id, created on first use from a
+ * prototype UKF. Each track keeps its own running RMSE, and optionally an
+ * RMSE over a sliding window of its latest estimates. With a TrackView
+ * attached, every track's posterior is published there after each update
+ * for readers on other threads; with a ReplicationLeader, it is also
+ * shipped to a standby.
+ *
+ * Tracks live in a pool of slots that keep their storage when a track is
+ * removed, for the next one created. Ids map to slots through an IdMap,
+ * so routing a measurement to its track is one probe of a flat array; a
+ * Handle names a slot and its generation, which lets a caller keep a
+ * reference that goes stale, instead of dangling or silently pointing at
+ * another track, when the track is removed.
+ */
+class TrackTable {
+public:
+  struct Track {
+    UKF ukf;
+    RMSEAccumulator rmse;
+    NEESAccumulator nees;
+    ///* RMSE over the table's window (see SetRMSEWindow); empty if none
+    WindowedRMSE window_rmse;
+
+    /**
+     * Filters one measurement and scores the estimate
+     * @param meas Measurement for this track
+     * @param ground_truth [x, y, vx, vy] truth for the RMSEs and NEES
+     * @param estimate [x, y, vx, vy] estimate after the update
+     */
+    void Process(const Measurement &meas, const Eigen::Vector4d &ground_truth,
+                 Eigen::Vector4d *estimate);
+
+    /**
+     * Filters one measurement without scoring it, for feeds with no ground
+     * truth; rmse, window_rmse and nees are left as they were
+     * @param meas Measurement for this track
+     * @param estimate [x, y, vx, vy] estimate after the update
+     */
+    void Process(const Measurement &meas, Eigen::Vector4d *estimate);
+
+    /**
+     * Copies the posterior into the table's TrackView and replication
+     * stream, if it has them
+     */
+    void Publish() const {
+      if (view_slot >= 0) {
+        view->Publish(view_slot, id, ukf);
+      }
+      if (leader && ukf.initialized()) {
+        leader->Update(id, ukf);
+      }
+    }
+
+    /**
+     * NIS of the last update, and the consistency counter of its sensor
+     */
+    double nis() const {
+      return last_sensor == MeasurementPackage::RADAR ? ukf.nis_radar_
+                                                      : ukf.nis_lidar_;
+    }
+    const UKF::NisCounter &nis_counter() const {
+      return last_sensor == MeasurementPackage::RADAR ? ukf.nis_counter_radar_
+                                                      : ukf.nis_counter_lidar_;
+    }
+
+    MeasurementPackage::SensorType last_sensor;
+
+    ///* key in the table, its pool slot, and where the track is published
+    ///* (-1 if not)
+    unsigned id;
+    uint32_t slot;
+    TrackView *view;
+    int view_slot;
+    ReplicationLeader *leader;
+    ///* the table's shadow configuration, or nullptr
+    ShadowRunner *shadow;
+    ///* ConfigReload generation the filter is tuned to
+    unsigned long config_generation;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /**
+   * A track's pool slot and the slot's generation, which is odd while the
+   * slot holds a live track and counts up when one is created or removed
+   */
+  struct Handle {
+    uint32_t slot;
+    uint32_t generation;
+  };
+
+  /**
+   * Constructor
+   * @param prototype Configuration copied into every new track
+   */
+  explicit TrackTable(const UKF &prototype);
+
+  /**
+   * Destructor
+   */
+  virtual ~TrackTable();
+
+  /**
+   * Returns the track with the given id, creating it if needed
+   * @param id Track id
+   */
+  Track &Get(unsigned id);
+
+  /**
+   * A handle to a live track of this table
+   */
+  Handle HandleOf(const Track &track) const {
+    Handle handle = {track.slot, generations_[track.slot]};
+    return handle;
+  }
+
+  /**
+   * The track a handle refers to, as Get returns it
+   * @return nullptr if the track has been removed since
+   */
+  Track *Resolve(Handle handle);
+
+  /**
+   * Publishes every track into a view from now on, existing ones at once;
+   * tracks beyond its capacity are not published. The view must outlive
+   * the table or be detached first.
+   * @param view View to publish into, or nullptr to stop publishing
+   */
+  void SetView(TrackView *view);
+
+  /**
+   * Ships every update to a standby from now on, starting with a full copy
+   * of the table. The leader must outlive the table or be detached first.
+   * @param leader Stream to the standby, or nullptr to stop replicating
+   */
+  void SetReplication(ReplicationLeader *leader);
+
+  /**
+   * Scores every track over a sliding window from now on as well, in
+   * window_rmse; existing tracks start with an empty window
+   * @param window Latest estimates included; 0 for no window
+   * @param span_us If positive, only those of the last span_us us
+   */
+  void SetRMSEWindow(unsigned long window, long long span_us);
+
+  /**
+   * Shadows a sample of every track's measurements from now on (see
+   * ShadowRunner). The runner must outlive the table or be detached first.
+   * @param shadow Runner, or nullptr to stop
+   */
+  void SetShadow(ShadowRunner *shadow);
+
+  /**
+   * Retunes the prototype and every existing track, keeping their states
+   * @param config New settings
+   */
+  void Configure(const UKFConfig &config);
+
+  /**
+   * Saves every initialised track's posterior, see FilterSnapshot
+   * @param path Snapshot file, replaced atomically
+   * @return false on I/O errors
+   */
+  bool Save(const char *path) const;
+
+  /**
+   * Appends every initialised track's posterior, as Save writes them
+   * @param records Records are appended
+   */
+  void Capture(std::vector<FilterSnapshot::Record> *records) const;
+
+  /**
+   * Restores tracks saved by Save, creating them from the prototype
+   * @param path Snapshot file
+   * @param restored Number of tracks restored; records from filters with a
+   * different model are skipped
+   * @return false if the file cannot be read
+   */
+  bool Load(const char *path, size_t *restored = nullptr);
+
+  /**
+   * Removes one track
+   * @return false if there is no track with that id
+   */
+  bool Remove(unsigned id);
+
+  /**
+   * Removes the tracks that leave the table, e.g. for another shard (see
+   * ShardMap), and captures the initialised ones
+   * @param leaves leaves(id) is true for every track to remove
+   * @param records Records of the removed tracks are appended
+   * @return Number of tracks removed
+   */
+  size_t Extract(const std::function<bool(unsigned)> &leaves,
+                 std::vector<FilterSnapshot::Record> *records);
+
+  /**
+   * Creates or overwrites tracks from records of Save or Extract
+   * @param records Records
+   * @param count Number of records
+   * @return Tracks restored; records from filters with a different model
+   * are skipped
+   */
+  size_t Insert(const FilterSnapshot::Record *records, size_t count);
+
+  /**
+   * Removes all tracks. Their storage is kept for the tracks created next,
+   * which then allocate nothing.
+   */
+  void Clear();
+
+  /**
+   * Clears the table and replaces its prototype, as for a new table
+   * @param prototype Configuration copied into every new track
+   */
+  void Reset(const UKF &prototype);
+
+  /**
+   * Preallocates storage for a number of tracks
+   * @param count Tracks that can be created without allocating one
+   */
+  void Reserve(size_t count);
+
+  /**
+   * Calls f(id, track) for every track, in no particular order
+   */
+  template <typename F>
+  void ForEach(F f) const {
+    for (size_t i = 0; i < live_.size(); i++) {
+      const Track &track = *pool_[live_[i]];
+      f(track.id, track);
+    }
+  }
+
+  const UKF &prototype() const { return prototype_; }
+
+  ///* estimates in each track's sliding RMSE window; 0 if none
+  unsigned long rmse_window() const { return window_; }
+
+  size_t size() const { return live_.size(); }
+
+  /**
+   * Bytes held by the table: its tracks and their spares with their
+   * out-of-sequence histories and RMSE windows, the pool and the id map
+   */
+  size_t MemoryBytes() const;
+
+  /**
+   * Bytes held by one track
+   */
+  static size_t TrackBytes(const Track &track);
+
+private:
+  UKF prototype_;
+  ///* every track created, live or spare; indexed by slot
+  std::vector<std::unique_ptr<Track> > pool_;
+  ///* per slot: its generation (see Handle) and its place in live_
+  std::vector<uint32_t> generations_;
+  std::vector<uint32_t> places_;
+  ///* slots of the live tracks, packed, and of the spare ones, reused by
+  ///* Get
+  std::vector<uint32_t> live_;
+  std::vector<uint32_t> free_;
+  ///* track id to slot of the live tracks
+  IdMap ids_;
+  TrackView *view_;
+  ReplicationLeader *leader_;
+  ShadowRunner *shadow_;
+  ///* ConfigReload generation the prototype is tuned to; 0 for the one it
+  ///* was built or reset with
+  unsigned long config_generation_;
+  ///* sliding RMSE window of every track
+  unsigned long window_;
+  long long window_span_us_;
+  // retunes the prototype, and the track about to be handed out, to the
+  // last reloaded configuration
+  void Refresh(Track *track);
+
+  // a live track for id, in a spare slot if there is one
+  Track *Create(unsigned id);
+
+  // a new spare slot
+  uint32_t AddSlot();
+
+  // withdraws a track from the view and the standby and makes its slot
+  // spare
+  void Retire(uint32_t slot);
+};
+
+#endif /* TRACK_TABLE_H_ */
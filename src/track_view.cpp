@@ -0,0 +1,171 @@
+#include "track_view.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const uint64_t TrackView::kMagic;
+const uint32_t TrackView::kVersion;
+const size_t TrackView::kSlotsOffset;
+
+TrackView::TrackView(size_t capacity)
+    : memory_(new char[Bytes(capacity)]),
+      bytes_(Bytes(capacity)),
+      mapped_(false),
+      header_(reinterpret_cast<Header *>(memory_)),
+      slots_(reinterpret_cast<Seqlock<Track> *>(memory_ + kSlotsOffset)) {
+  Format(memory_, capacity);
+}
+
+TrackView::TrackView(char *memory, size_t bytes, bool mapped,
+                     const char *name)
+    : memory_(memory),
+      bytes_(bytes),
+      mapped_(mapped),
+      name_(name ? name : ""),
+      header_(reinterpret_cast<Header *>(memory_)),
+      slots_(reinterpret_cast<Seqlock<Track> *>(memory_ + kSlotsOffset)) {}
+
+TrackView::~TrackView() {
+  if (!mapped_) {
+    delete[] memory_;
+    return;
+  }
+  munmap(memory_, bytes_);
+  if (!name_.empty()) {
+    shm_unlink(name_.c_str());
+  }
+}
+
+void TrackView::Format(char *memory, size_t capacity) {
+  static_assert(sizeof(Header) <= kSlotsOffset, "header overlaps slots");
+  Header *header = reinterpret_cast<Header *>(memory);
+  header->version = kVersion;
+  header->slot_size = sizeof(Seqlock<Track>);
+  header->capacity = capacity;
+  new (&header->size) std::atomic<uint64_t>(0);
+  Seqlock<Track> *slots =
+      reinterpret_cast<Seqlock<Track> *>(memory + kSlotsOffset);
+  for (size_t i = 0; i < capacity; i++) {
+    new (&slots[i]) Seqlock<Track>();
+  }
+  //the magic goes in last, so a process that opens a shared region early
+  //sees no layout rather than a half-written one
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = kMagic;
+}
+
+std::unique_ptr<TrackView> TrackView::CreateShared(const char *name,
+                                                   size_t capacity,
+                                                   std::string *error) {
+  //a stale region of a crashed writer would keep its old layout; readers
+  //that still map it keep their copy
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    *error = std::string(name) + ": " + strerror(errno);
+    return nullptr;
+  }
+  const size_t bytes = Bytes(capacity);
+  if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+    *error = std::string("ftruncate: ") + strerror(errno);
+    close(fd);
+    shm_unlink(name);
+    return nullptr;
+  }
+  void *memory =
+      mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    *error = std::string("mmap: ") + strerror(errno);
+    shm_unlink(name);
+    return nullptr;
+  }
+  char *block = static_cast<char *>(memory);
+  Format(block, capacity);
+  return std::unique_ptr<TrackView>(new TrackView(block, bytes, true, name));
+}
+
+std::unique_ptr<const TrackView> TrackView::OpenShared(const char *name,
+                                                       std::string *error) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    *error = std::string(name) + ": " + strerror(errno);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(kSlotsOffset)) {
+    *error = std::string(name) + ": not a track view";
+    close(fd);
+    return nullptr;
+  }
+  const size_t bytes = static_cast<size_t>(st.st_size);
+  void *memory = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    *error = std::string("mmap: ") + strerror(errno);
+    return nullptr;
+  }
+  const Header *header = static_cast<const Header *>(memory);
+  const char *mismatch = nullptr;
+  if (header->magic != kMagic) {
+    mismatch = "not a track view";
+  }
+  else if (header->version != kVersion ||
+           header->slot_size != sizeof(Seqlock<Track>)) {
+    mismatch = "track view layout differs from this build";
+  }
+  else if (Bytes(header->capacity) > bytes) {
+    mismatch = "track view is truncated";
+  }
+  if (mismatch) {
+    *error = std::string(name) + ": " + mismatch;
+    munmap(memory, bytes);
+    return nullptr;
+  }
+  return std::unique_ptr<const TrackView>(
+      new TrackView(static_cast<char *>(memory), bytes, true, nullptr));
+}
+
+int TrackView::Add(unsigned id) {
+  const uint64_t slot = header_->size.load(std::memory_order_relaxed);
+  if (slot >= header_->capacity) {
+    return -1;
+  }
+  Track track = Track();
+  track.id = id;
+  track.live = false;
+  slots_[slot].Store(track);
+  header_->size.store(slot + 1, std::memory_order_release);
+  return static_cast<int>(slot);
+}
+
+void TrackView::Publish(int slot, unsigned id, const UKF &ukf) {
+  Track track;
+  track.id = id;
+  track.live = ukf.initialized();
+  track.timestamp = ukf.timestamp();
+  Eigen::Map<Eigen::Matrix<double, UKF::n_x_, 1> > x(track.x);
+  Eigen::Map<Eigen::Matrix<double, UKF::n_x_, UKF::n_x_, Eigen::RowMajor> >
+      P(track.P);
+  ukf.ExportState(x, P);
+  slots_[slot].Store(track);
+}
+
+void TrackView::Withdraw(int slot, unsigned id) {
+  Track gone = Track();
+  gone.id = id;
+  slots_[slot].Store(gone);
+}
+
+void TrackView::Clear() {
+  const Track gone = Track();
+  const uint64_t n = header_->size.load(std::memory_order_relaxed);
+  for (uint64_t i = 0; i < n; i++) {
+    slots_[i].Store(gone);
+  }
+  header_->size.store(0, std::memory_order_release);
+}
@@ -0,0 +1,174 @@
+#ifndef TRACK_VIEW_H_
+#define TRACK_VIEW_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "seqlock.h"
+#include "time_base.h"
+#include "ukf.h"
+
+/**
+ * The posteriors of a track table, published for readers on other threads
+ * (metrics, subscription streams, snapshots) while the filter thread keeps
+ * updating the tracks.
+ *
+ * Every track has a fixed slot holding a copy of its state under a
+ * Seqlock: the filter thread stores a fresh copy after each update and
+ * never waits, and a reader gets either the previous or the new copy of a
+ * track, never a mix. Slots are allocated up front and only appended, so a
+ * reader can walk them while tracks are added. Copies of different tracks
+ * are independent: a walk is not one instant of the whole table.
+ *
+ * The slots sit behind a versioned Header in one block of memory, either
+ * the heap or a named POSIX shared-memory region (CreateShared), which
+ * other processes on the host open with OpenShared and read without a
+ * system call: the seqlocks work across processes because their atomics
+ * are lock-free. A consumer builds against this header; the layout is
+ * kVersion of it.
+ */
+class TrackView {
+public:
+  ///* One track as published; P is row-major
+  struct Track {
+    unsigned id;
+    ///* false for a slot whose track is gone, or not initialised yet
+    bool live;
+    TimeUs timestamp;
+    double x[UKF::n_x_];
+    double P[UKF::n_x_ * UKF::n_x_];
+  };
+
+  ///* Start of the memory block, followed by the slots at kSlotsOffset
+  struct Header {
+    uint64_t magic;
+    uint32_t version;
+    ///* sizeof(Seqlock<Track>), checked by readers
+    uint32_t slot_size;
+    uint64_t capacity;
+    std::atomic<uint64_t> size;
+  };
+
+  static const uint64_t kMagic = 0x3156545254464b55ULL;  // "UKFTRTV1"
+  static const uint32_t kVersion = 1;
+  static const size_t kSlotsOffset = 64;
+
+  /**
+   * Constructor; the slots live on the heap
+   * @param capacity Most tracks that can be published
+   */
+  explicit TrackView(size_t capacity);
+
+  /**
+   * Destructor; a view created by CreateShared also removes its name
+   */
+  virtual ~TrackView();
+
+  /**
+   * A view whose slots live in a new shared-memory region, replacing any
+   * left behind under the same name
+   * @param name POSIX shared-memory name, e.g. "/ukf_tracks"
+   * @param capacity Most tracks that can be published
+   * @param error Reason for a failure
+   * @return nullptr on failure
+   */
+  static std::unique_ptr<TrackView> CreateShared(const char *name,
+                                                 size_t capacity,
+                                                 std::string *error);
+
+  /**
+   * Maps a region made by CreateShared in another process, read-only: only
+   * Read, ForEach and size may be called on the result
+   * @param name Name given to CreateShared
+   * @param error Reason for a failure, including a layout mismatch
+   * @return nullptr on failure
+   */
+  static std::unique_ptr<const TrackView> OpenShared(const char *name,
+                                                     std::string *error);
+
+  /**
+   * Filter thread: reserves the slot of a new track
+   * @param id Track id
+   * @return Slot, or -1 if the view is full
+   */
+  int Add(unsigned id);
+
+  /**
+   * Filter thread: publishes a track's posterior
+   * @param slot Slot from Add
+   * @param id Track id
+   * @param ukf The track's filter
+   */
+  void Publish(int slot, unsigned id, const UKF &ukf);
+
+  /**
+   * Filter thread: marks one track gone. Its slot stays taken until Clear.
+   * @param slot Slot from Add
+   * @param id Track id
+   */
+  void Withdraw(int slot, unsigned id);
+
+  /**
+   * Filter thread: withdraws every track; their slots are reused by Add
+   */
+  void Clear();
+
+  /**
+   * Any thread: the latest copy of one slot
+   * @param slot Index below size()
+   * @param track Filled with the copy
+   * @return Whether the slot holds a live track
+   */
+  bool Read(size_t slot, Track *track) const {
+    slots_[slot].Load(track);
+    return track->live;
+  }
+
+  /**
+   * Any thread: calls f(track) with a copy of every live track
+   */
+  template <typename F>
+  void ForEach(F f) const {
+    Track track;
+    const size_t n = size();
+    for (size_t i = 0; i < n; i++) {
+      if (Read(i, &track)) {
+        f(track);
+      }
+    }
+  }
+
+  ///* Any thread: number of slots in use
+  size_t size() const {
+    return static_cast<size_t>(
+        header_->size.load(std::memory_order_acquire));
+  }
+
+  size_t capacity() const { return static_cast<size_t>(header_->capacity); }
+
+private:
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "shared views need address-free atomics");
+
+  // a view over a memory block that is already laid out
+  TrackView(char *memory, size_t bytes, bool mapped, const char *name);
+
+  static size_t Bytes(size_t capacity) {
+    return kSlotsOffset + capacity * sizeof(Seqlock<Track>);
+  }
+  // writes the header and empty slots into a block
+  static void Format(char *memory, size_t capacity);
+
+  char *memory_;
+  size_t bytes_;
+  ///* memory_ is an mmap of bytes_, else a new[] block
+  bool mapped_;
+  ///* shared-memory name to remove on destruction; empty for readers
+  std::string name_;
+
+  Header *header_;
+  Seqlock<Track> *slots_;
+};
+
+#endif /* TRACK_VIEW_H_ */
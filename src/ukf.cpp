@@ -1,4 +1,12 @@
 #include "ukf.h"
+#include "angle.h"
+#include "cholesky_update.h"
+#include "latency_trace.h"
+#include "measurement_models.h"
+#include "motion_models.h"
+#include "profiler_zones.h"
+#include "stage_timing.h"
+#include "ukf_kernels.h"
 #include "Eigen/Dense"
 #include <iostream>
 
@@ -7,29 +15,58 @@ using Eigen::MatrixXd;
 using Eigen::VectorXd;
 using std::vector;
 
+const int UKF::n_x_;
+const int UKF::n_aug_;
+const int UKF::n_sig_;
+const int UKF::n_sig_simplex_;
+const int UKF::n_z_lidar_;
+const int UKF::n_z_radar_;
+const int UKF::n_z_fused_;
+
+namespace {
+
+// diagonal jitter of a repaired covariance, relative to its mean variance
+const double kRepairJitter = 1e-9;
+
+// 95% quantiles of the chi-square distribution for the lidar and radar
+// measurement dimensions
+const double kChiSquare95Lidar = 5.991;
+const double kChiSquare95Radar = 7.815;
+
+}  // namespace
+
 /**
  * Initializes Unscented Kalman filter
  */
-UKF::UKF() {
+UKF::UKF() : history_(1) {
   // if this is false, laser measurements will be ignored (except during init)
   use_laser_ = true;
 
   // if this is false, radar measurements will be ignored (except during init)
   use_radar_ = true;
 
-  is_initialized_ = false;
+  // if this is true, the square-root UKF is used
+  use_sqrt_ukf_ = false;
+
+  // if this is true, the lidar covariance update uses the Joseph form
+  use_joseph_form_ = false;
+  radar_fast_atan2_ = false;
 
-  //set state dimension
-  n_x_ = 5;
+  // sigma-point kernels
+  kernels_ = VECTOR_KERNELS;
+  isa_kernels_ = &UkfKernels::Selected();
 
-  //set augmented dimension
-  n_aug_ = 7;
+  // CTRV motion
+  motion_model_ = CTRV_MODEL;
+
+  is_initialized_ = false;
 
   // initial state vector
-  x_pred_ = VectorXd(5);
+  x_pred_.fill(0.0);
 
   // initial covariance matrix
-  P_pred_ = MatrixXd(n_x_, n_x_);
+  P_pred_.fill(0.0);
+  L_pred_.fill(0.0);
 
   // Process noise standard deviation longitudinal acceleration in m/s^2
   std_a_ = 3.80;
@@ -52,216 +89,888 @@ UKF::UKF() {
   // Radar measurement noise standard deviation radius change in m/s
   std_radrd_ = 0.3;
 
-  //create matrix with predicted sigma points as columns
-  Xsig_pred_ = MatrixXd(n_x_, 2 * n_aug_ + 1);
+  UpdateNoise();
+
+  //matrix with predicted sigma points as columns
+  Xsig_pred_.fill(0.0);
 
-  //create vector for weights_
-  weights_ = VectorXd(2 * n_aug_ + 1);
+  //vector for weights_
+  weights_.fill(0.0);
 
-  //define spreading parameter
-  lambda_ = 3 - n_aug_;
+  //the symmetric 2n + 1 sigma points
+  sigma_points_ = SYMMETRIC_POINTS;
+  simplex_points_.fill(0.0);
 
-  //create sigma point matrix
-  Xsig_aug = MatrixXd(n_aug_, 2 * n_aug_ + 1);
+  //define spreading parameter: alpha = 1, beta = 0 gives lambda = 3 - n_aug_
+  SetScaling(1.0, 0.0, 3 - n_aug_);
 
-  //create augmented mean vector
-  x_aug = VectorXd(7);
+  //sigma point matrix
+  Xsig_aug.fill(0.0);
+
+  //augmented mean vector
+  x_aug.fill(0.0);
 
-  //create augmented state covariance
-  P_aug = MatrixXd(7, 7);
+  //last innovations and their covariance factors
+  z_diff_lidar_.fill(0.0);
+  S_lidar_factor_.fill(0.0);
+  z_diff_radar_.fill(0.0);
+  S_radar_factor_.fill(0.0);
+  nis_lidar_ = 0.0;
+  nis_radar_ = 0.0;
+  nis_counter_lidar_.updates = nis_counter_lidar_.exceeded = 0;
+  nis_counter_radar_.updates = nis_counter_radar_.exceeded = 0;
+  nis_counter_lidar_.rejected = nis_counter_radar_.rejected = 0;
+  nis_counter_lidar_.nis_sum = nis_counter_radar_.nis_sum = 0.0;
+
+  //fuse every measurement
+  gate_lidar_ = 0.0;
+  gate_radar_ = 0.0;
+  gate_warmup_ = 20;
+
+  //fixed process noise
+  adaptive_rate_ = 0.0;
+  adaptive_limit_ = 4.0;
+  noise_scale_ = 1.0;
+  noise_std_scale_ = 1.0;
+
+  //sigma points for every step
+  ekf_angle_ = 0.0;
+  ekf_predicted_ = false;
+  ekf_predictions_ = 0;
+  ekf_radar_updates_ = 0;
+
+  //a full update for every lidar measurement
+  steady_state_tolerance_ = 0.0;
+  steady_updates_ = 0;
+  LeaveSteadyState();
+
+  //predict any gap in one step
+  max_predict_step_ = 0.0;
+
+  //start from a zero covariance unless configured otherwise
+  initial_covariance_ = ZERO_COVARIANCE;
+  init_std_v_ = 5.0;
+  init_std_yaw_ = M_PI;
+  init_std_yawd_ = 1.0;
+
+  covariance_repairs_ = 0;
+
+  //no out-of-sequence history until SetHistoryDepth
+  history_depth_ = 0;
+  oosm_fused_ = 0;
+  oosm_dropped_ = 0;
+}
+
+UKF::UKF(const UKFConfig &config) : UKF() {
+  Configure(config);
 }
 
 UKF::~UKF() {}
 
+void UKF::Reset() {
+  is_initialized_ = false;
+  x_pred_.fill(0.0);
+  P_pred_.fill(0.0);
+  L_pred_.fill(0.0);
+  Xsig_pred_.fill(0.0);
+  previous_timestamp_ = 0;
+
+  z_diff_lidar_.fill(0.0);
+  S_lidar_factor_.fill(0.0);
+  z_diff_radar_.fill(0.0);
+  S_radar_factor_.fill(0.0);
+  nis_lidar_ = 0.0;
+  nis_radar_ = 0.0;
+  nis_counter_lidar_.updates = nis_counter_lidar_.exceeded = 0;
+  nis_counter_radar_.updates = nis_counter_radar_.exceeded = 0;
+  nis_counter_lidar_.rejected = nis_counter_radar_.rejected = 0;
+  nis_counter_lidar_.nis_sum = nis_counter_radar_.nis_sum = 0.0;
+  noise_scale_ = 1.0;
+  noise_std_scale_ = 1.0;
+  ekf_predicted_ = false;
+  ekf_predictions_ = 0;
+  ekf_radar_updates_ = 0;
+  steady_updates_ = 0;
+  LeaveSteadyState();
+
+  history_.clear();
+  covariance_repairs_ = 0;
+  oosm_fused_ = 0;
+  oosm_dropped_ = 0;
+}
+
+void UKF::Configure(const UKFConfig &config) {
+  std_a_ = config.std_a;
+  std_yawdd_ = config.std_yawdd;
+  std_laspx_ = config.std_laspx;
+  std_laspy_ = config.std_laspy;
+  std_radr_ = config.std_radr;
+  std_radphi_ = config.std_radphi;
+  std_radrd_ = config.std_radrd;
+  UpdateNoise();
+  //the square-root filter's QR assumes equal weights past the centre
+  sigma_points_ = SYMMETRIC_POINTS;
+  if (config.sigma_points == CUBATURE_POINTS ||
+      (config.sigma_points == SIMPLEX_POINTS && !config.sqrt)) {
+    sigma_points_ = static_cast<SigmaPoints>(config.sigma_points);
+  }
+  SetScaling(config.alpha, config.beta, config.kappa);
+
+  use_laser_ = config.use_laser;
+  use_radar_ = config.use_radar;
+  use_joseph_form_ = config.joseph;
+  radar_fast_atan2_ = config.fast_atan2;
+  motion_model_ = config.motion_model == CV_MODEL ? CV_MODEL : CTRV_MODEL;
+  max_predict_step_ = config.max_predict_step;
+  gate_lidar_ = config.gate_lidar;
+  gate_radar_ = config.gate_radar;
+  gate_warmup_ = config.gate_warmup;
+  adaptive_rate_ = config.adaptive_noise;
+  adaptive_limit_ = config.adaptive_noise_limit > 1.0
+                    ? config.adaptive_noise_limit : 1.0;
+  if (adaptive_rate_ <= 0.0) {
+    noise_scale_ = 1.0;
+    noise_std_scale_ = 1.0;
+  }
+  ekf_angle_ = config.ekf_angle;
+  steady_state_tolerance_ = config.steady_state;
+  LeaveSteadyState();
+  initial_covariance_ = config.initial_covariance == SENSOR_COVARIANCE
+                        ? SENSOR_COVARIANCE : ZERO_COVARIANCE;
+  init_std_v_ = config.init_std_v;
+  init_std_yaw_ = config.init_std_yaw;
+  init_std_yawd_ = config.init_std_yawd;
+
+  //a running filter switching to square-root mode needs its factor
+  if (config.sqrt && !use_sqrt_ukf_ && is_initialized_) {
+    L_pred_ = RobustLowerFactor(P_pred_);
+  }
+  use_sqrt_ukf_ = config.sqrt;
+
+  if (config.history_depth != history_depth_) {
+    SetHistoryDepth(config.history_depth);
+  }
+}
+
+UKFConfig UKF::Config() const {
+  UKFConfig config;
+  config.std_a = std_a_;
+  config.std_yawdd = std_yawdd_;
+  config.std_laspx = std_laspx_;
+  config.std_laspy = std_laspy_;
+  config.std_radr = std_radr_;
+  config.std_radphi = std_radphi_;
+  config.std_radrd = std_radrd_;
+  config.alpha = alpha_;
+  config.beta = beta_;
+  config.kappa = kappa_;
+  config.use_laser = use_laser_;
+  config.use_radar = use_radar_;
+  config.sqrt = use_sqrt_ukf_;
+  config.joseph = use_joseph_form_;
+  config.fast_atan2 = radar_fast_atan2_;
+  config.motion_model = motion_model_;
+  config.sigma_points = sigma_points_;
+  config.max_predict_step = max_predict_step_;
+  config.history_depth = history_depth_;
+  config.gate_lidar = gate_lidar_;
+  config.gate_radar = gate_radar_;
+  config.gate_warmup = gate_warmup_;
+  config.adaptive_noise = adaptive_rate_;
+  config.adaptive_noise_limit = adaptive_limit_;
+  config.ekf_angle = ekf_angle_;
+  config.steady_state = steady_state_tolerance_;
+  config.initial_covariance = initial_covariance_;
+  config.init_std_v = init_std_v_;
+  config.init_std_yaw = init_std_yaw_;
+  config.init_std_yawd = init_std_yawd_;
+  return config;
+}
+
+void UKF::UpdateNoise() {
+  lidar_noise_ << std_laspx_ * std_laspx_, std_laspy_ * std_laspy_;
+  radar_noise_ << std_radr_ * std_radr_, std_radphi_ * std_radphi_,
+                  std_radrd_ * std_radrd_;
+}
+
+void UKF::SetHistoryDepth(int depth) {
+  history_depth_ = depth > 0 ? depth : 0;
+  history_ = RingBuffer<Snapshot>(history_depth_);
+  replay_.resize(history_depth_);
+}
+
+void UKF::SetScaling(double alpha, double beta, double kappa) {
+  alpha_ = alpha;
+  beta_ = beta;
+  kappa_ = kappa;
+  lambda_ = alpha_ * alpha_ * (n_aug_ + kappa_) - n_aug_;
+  UpdateWeights();
+}
+
+void UKF::UpdateWeights() {
+  sigma_count_ = n_sig_;
+  sigma_scale_ = sqrt(lambda_ + n_aug_);
+
+  if (sigma_points_ == CUBATURE_POINTS) {
+    //the symmetric layout at lambda = 0: +/- sqrt(n) along each axis with
+    //weight 1 / 2n, and a centre of weight zero
+    sigma_scale_ = sqrt(static_cast<double>(n_aug_));
+    weights_.setConstant(0.5 / n_aug_);
+    weights_(0) = 0.0;
+    weights_c_ = weights_;
+    return;
+  }
+  if (sigma_points_ == SIMPLEX_POINTS) {
+    //spherical simplex with equal weights: point 0 is the centre, and in
+    //dimension j one more point is added on the j-th axis while the earlier
+    //ones step back, so the weighted points have zero mean and identity
+    //covariance
+    sigma_count_ = n_sig_simplex_;
+    const double w = 1.0 / n_sig_simplex_;
+    simplex_points_.setZero();
+    for (int j = 1; j <= n_aug_; j++) {
+      const double d = 1.0 / sqrt(j * (j + 1) * w);
+      for (int i = 1; i <= j; i++) {
+        simplex_points_(j - 1, i) = -d;
+      }
+      simplex_points_(j - 1, j + 1) = j * d;
+    }
+    weights_.setZero();
+    weights_.head<n_sig_simplex_>().setConstant(w);
+    weights_c_ = weights_;
+    return;
+  }
+
+  // set weights_
+  weights_(0) = lambda_ / (lambda_ + n_aug_);
+  for (int i = 1; i < n_sig_; i++) {
+    weights_(i) = 0.5 / (n_aug_ + lambda_);
+  }
+
+  // the covariance weights only differ in the centre point
+  weights_c_ = weights_;
+  weights_c_(0) += 1 - alpha_ * alpha_ + beta_;
+}
+
 /**
- * @param {MeasurementPackage} meas_package The latest measurement data of
+ * @param {Measurement} meas_package The latest measurement data of
  * either radar or laser.
  */
-void UKF::ProcessMeasurement(MeasurementPackage meas_package) {
+void UKF::ProcessMeasurement(const Measurement &meas_package) {
+  if (history_depth_ == 0) {
+    FuseMeasurement(meas_package);
+    return;
+  }
+
+  //in order: fuse and remember the posterior
+  size_t n = history_.size();
+  if (!is_initialized_ || meas_package.timestamp_ >= previous_timestamp_) {
+    FuseMeasurement(meas_package);
+    Snapshot snapshot = {meas_package, x_pred_, P_pred_, L_pred_};
+    history_.push_back(snapshot);
+    return;
+  }
+
+  //late: find the newest snapshot it does not precede
+  size_t later = 0;
+  while (later < n &&
+         history_[n - 1 - later].meas.timestamp_ > meas_package.timestamp_) {
+    ++later;
+  }
+  if (later == n) {
+    //older than everything kept; there is nothing to roll back to
+    ++oosm_dropped_;
+    return;
+  }
+
+  //take the later measurements off the history, oldest first in replay_
+  for (size_t i = 0; i < later; i++) {
+    replay_[later - 1 - i] = history_.back().meas;
+    history_.pop_back();
+  }
+
+  const Snapshot &base = history_.back();
+  x_pred_ = base.x;
+  P_pred_ = base.P;
+  L_pred_ = base.L;
+  previous_timestamp_ = base.meas.timestamp_;
+  ++oosm_fused_;
+  LeaveSteadyState();
+
+  //re-fuse the window with the late measurement in its place
+  FuseMeasurement(meas_package);
+  Snapshot snapshot = {meas_package, x_pred_, P_pred_, L_pred_};
+  history_.push_back(snapshot);
+  for (size_t i = 0; i < later; i++) {
+    FuseMeasurement(replay_[i]);
+    Snapshot replayed = {replay_[i], x_pred_, P_pred_, L_pred_};
+    history_.push_back(replayed);
+  }
+}
+
+void UKF::FuseMeasurement(const Measurement &meas_package) {
   /*****************************************************************************
    *  Initialization
    ****************************************************************************/
 
   if (!is_initialized_) {
-    cout << "UKF: " << endl;
-
-    if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
-      /**
-      Convert radar from polar to cartesian coordinates and initialize state.
-      */
-      float rho = meas_package.raw_measurements_[0];
-      float phi = meas_package.raw_measurements_[1];
-      float px = rho * cos(phi);
-      float py = rho * sin(phi);
-
-      x_pred_ << px,
-            py,
-            0,
-            0,
-            0;
-    }
-    else if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
-      /**
-      Initialize state.
-      */
-      //set the state with the initial location and zero velocity
-      x_pred_ << meas_package.raw_measurements_[0],
-            meas_package.raw_measurements_[1],
-            0,
-            0,
-            0;
-    }
+    Initialize(meas_package);
 
     previous_timestamp_ = meas_package.timestamp_;
 
+    if (use_sqrt_ukf_) {
+      L_pred_ = RobustLowerFactor(P_pred_);
+    }
+
     // done initializing, no need to predict or update
     is_initialized_ = true;
 
     return;
   }
 
-  double delta_t = (meas_package.timestamp_ - previous_timestamp_) / 1000000.0;
-  Prediction(delta_t);
+  const TimeUs gap = meas_package.timestamp_ - previous_timestamp_;
+  const bool laser = meas_package.sensor_type_ == MeasurementPackage::LASER;
+  if (steady_ && (!laser || !use_laser_ || gap != steady_gap_)) {
+    LeaveSteadyState();
+  }
+  const bool steady = steady_;
+  {
+    UKF_STAGE_TIMER(STAGE_PREDICT);
+    if (steady) {
+      PredictMeanInSteps(ToSeconds(gap));
+    }
+    else if (gap == 0) {
+      //e.g. radar and lidar of one scan: nothing to propagate, and the
+      //linear lidar update does not need sigma points at all
+      if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
+        RefreshSigmaPoints();
+      }
+    }
+    else {
+      PredictInSteps(ToSeconds(gap));
+    }
+  }
+  if (LatencyTrace::Tracing()) {
+    TracePrediction(gap, steady);
+  }
 
   /*****************************************************************************
   *  Update
   ****************************************************************************/
 
+  //a sensor switched off is predicted to but not fused
   if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
-    UpdateRadar(meas_package);
+    if (use_radar_) {
+      UKF_STAGE_TIMER(STAGE_UPDATE_RADAR);
+      bool fused = use_sqrt_ukf_ ? UpdateRadarSqrt(meas_package)
+                                 : UpdateRadar(meas_package);
+      CountNis(MeasurementPackage::RADAR, fused);
+    }
   }
-  else if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
-    UpdateLidar(meas_package);
+  else if (laser && use_laser_) {
+    UKF_STAGE_TIMER(STAGE_UPDATE_LIDAR);
+    bool fused;
+    if (steady) {
+      fused = UpdateLidarSteady(meas_package);
+    }
+    else {
+      const bool track = steady_state_tolerance_ > 0.0 && !use_sqrt_ukf_ &&
+                         adaptive_rate_ <= 0.0;
+      if (track) {
+        steady_prior_ = P_pred_;
+      }
+      fused = use_sqrt_ukf_ ? UpdateLidarSqrt(meas_package)
+                            : UpdateLidar(meas_package);
+      if (track) {
+        TrackSteadyState(gap, fused);
+      }
+    }
+    CountNis(MeasurementPackage::LASER, fused);
   }
 
   previous_timestamp_ = meas_package.timestamp_;
 }
 
+void UKF::Initialize(const Measurement &meas_package) {
+  if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
+    /**
+    Convert radar from polar to cartesian coordinates and initialize state.
+    */
+    double rho = meas_package.values_[0];
+    double phi = meas_package.values_[1];
+    double px = rho * cos(phi);
+    double py = rho * sin(phi);
+
+    x_pred_ << px,
+          py,
+          0,
+          0,
+          0;
+
+    if (initial_covariance_ == SENSOR_COVARIANCE) {
+      //the range rate is the speed along the line of sight; moving away
+      //means heading phi, closing heading phi + pi
+      double rho_dot = meas_package.values_[2];
+      x_pred_(2) = fabs(rho_dot);
+      x_pred_(3) = rho_dot >= 0.0 ? phi : NormalizeAngle(phi + M_PI);
+
+      //position covariance J diag(var_r, var_phi) J^T
+      Eigen::Matrix<Scalar, 2, 2> J;
+      J << cos(phi), -rho * sin(phi),
+           sin(phi), rho * cos(phi);
+      P_pred_.fill(0.0);
+      P_pred_.topLeftCorner<2, 2>() =
+          J * radar_noise_.head<2>().asDiagonal() * J.transpose();
+      P_pred_(2,2) = init_std_v_ * init_std_v_;
+      P_pred_(3,3) = init_std_yaw_ * init_std_yaw_;
+      P_pred_(4,4) = init_std_yawd_ * init_std_yawd_;
+    }
+  }
+  else if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
+    /**
+    Initialize state.
+    */
+    //set the state with the initial location and zero velocity
+    x_pred_ << meas_package.values_[0],
+          meas_package.values_[1],
+          0,
+          0,
+          0;
+
+    if (initial_covariance_ == SENSOR_COVARIANCE) {
+      P_pred_.fill(0.0);
+      P_pred_(0,0) = lidar_noise_(0);
+      P_pred_(1,1) = lidar_noise_(1);
+      P_pred_(2,2) = init_std_v_ * init_std_v_;
+      P_pred_(3,3) = init_std_yaw_ * init_std_yaw_;
+      P_pred_(4,4) = init_std_yawd_ * init_std_yawd_;
+    }
+  }
+}
+
+void UKF::ProcessMeasurement(const MeasurementPackage &meas_package) {
+  ProcessMeasurement(Measurement::From(meas_package));
+}
+
+void UKF::SetState(const StateVector &x, const StateMatrix &P,
+                   TimeUs timestamp) {
+  x_pred_ = x;
+  P_pred_ = P;
+  if (use_sqrt_ukf_) {
+    L_pred_ = RobustLowerFactor(P_pred_);
+  }
+  previous_timestamp_ = timestamp;
+  is_initialized_ = true;
+  LeaveSteadyState();
+}
+
+void UKF::ProcessMeasurement(const Measurement &meas_package,
+                             Estimate *estimate) {
+  ProcessMeasurement(meas_package);
+  GetEstimate(meas_package.sensor_type_, estimate);
+}
+
+void UKF::GetEstimate(MeasurementPackage::SensorType sensor,
+                      Estimate *estimate) const {
+  const double v = x_pred_(2);
+  const double yaw = x_pred_(3);
+  estimate->px = x_pred_(0);
+  estimate->py = x_pred_(1);
+  estimate->vx = cos(yaw) * v;
+  estimate->vy = sin(yaw) * v;
+  for (int i = 0; i < n_x_; i++) {
+    estimate->p_diag[i] = P_pred_(i,i);
+  }
+  estimate->nis = sensor == MeasurementPackage::RADAR ? nis_radar_ : nis_lidar_;
+}
+
+void UKF::ProcessMeasurement(MeasurementPackage::SensorType sensor,
+                             TimeUs timestamp,
+                             const Eigen::Ref<const Eigen::VectorXd> &z,
+                             Estimate *estimate) {
+  //the history keeps Measurements, so the values are copied once, onto
+  //the stack
+  Measurement meas;
+  meas.timestamp_ = timestamp;
+  meas.sensor_type_ = sensor;
+  const int n = meas.size();
+  eigen_assert(z.size() >= n);
+  for (int i = 0; i < 3; i++) {
+    meas.values_[i] = i < n ? z(i) : 0.0;
+  }
+  ProcessMeasurement(meas);
+  if (estimate) {
+    GetEstimate(sensor, estimate);
+  }
+}
+
+void UKF::ExportState(
+    Eigen::Ref<Eigen::Matrix<double, n_x_, 1> > x,
+    Eigen::Ref<Eigen::Matrix<double, n_x_, n_x_, Eigen::RowMajor>, 0,
+               Eigen::OuterStride<> > P) const {
+  x = x_pred_.cast<double>();
+  P = P_pred_.cast<double>();
+}
+
+void UKF::ExportEstimate(Eigen::Ref<Eigen::Vector4d> estimate) const {
+  const double v = x_pred_(2);
+  const double yaw = x_pred_(3);
+  estimate << x_pred_(0), x_pred_(1), cos(yaw) * v, sin(yaw) * v;
+}
+
+void UKF::ProcessMeasurements(const Measurement *measurements, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    ProcessMeasurement(measurements[i]);
+  }
+}
+
+void UKF::PredictInSteps(double delta_t) {
+  const int steps = PredictSteps(delta_t);
+
+  //equal sub-steps, so each one's discretisation error is the same
+  const double step = delta_t / steps;
+  for (int i = 0; i < steps; i++) {
+    if (use_sqrt_ukf_) {
+      PredictionSqrt(step);
+    }
+    else if (ekf_angle_ > 0.0 && NearLinearMotion(step)) {
+      PredictionEkf(step);
+    }
+    else {
+      Prediction(step);
+    }
+  }
+}
+
+void UKF::RefreshSigmaPoints() {
+  //with delta_t = 0 the process model is the identity and the noise terms
+  //vanish, so the predicted sigma points are the state rows themselves
+  if (use_sqrt_ukf_) {
+    GenerateSigmaPoints(L_pred_, &Xsig_aug);
+  }
+  else {
+    GenerateSigmaPoints(&Xsig_aug);
+  }
+  Xsig_pred_ = Xsig_aug.topRows<n_x_>();
+  ekf_predicted_ = false;
+}
+
+void UKF::ProcessMeasurementGroup(const Measurement *measurements,
+                                  size_t count) {
+  const Measurement *radar = nullptr;
+  const Measurement *lidar = nullptr;
+  if (count == 2 && is_initialized_ && !use_sqrt_ukf_ &&
+      history_depth_ == 0 && use_radar_ && use_laser_ &&
+      gate_lidar_ <= 0.0 && gate_radar_ <= 0.0) {
+    for (size_t i = 0; i < count; i++) {
+      if (measurements[i].sensor_type_ == MeasurementPackage::RADAR) {
+        radar = &measurements[i];
+      }
+      else if (measurements[i].sensor_type_ == MeasurementPackage::LASER) {
+        lidar = &measurements[i];
+      }
+    }
+  }
+  if (!radar || !lidar || radar->timestamp_ != lidar->timestamp_) {
+    ProcessMeasurements(measurements, count);
+    return;
+  }
+
+  //the radar fusion changes P, so a cached lidar gain no longer holds
+  if (steady_) {
+    LeaveSteadyState();
+  }
+  const TimeUs gap = radar->timestamp_ - previous_timestamp_;
+  {
+    UKF_STAGE_TIMER(STAGE_PREDICT);
+    if (gap == 0) {
+      RefreshSigmaPoints();
+    }
+    else {
+      PredictInSteps(ToSeconds(gap));
+    }
+  }
+  if (LatencyTrace::Tracing()) {
+    TracePrediction(gap, false);
+  }
+  {
+    UKF_STAGE_TIMER(STAGE_UPDATE_RADAR);
+    UpdateRadarLidar(*radar, *lidar);
+  }
+  CountNis(MeasurementPackage::RADAR, true);
+  CountNis(MeasurementPackage::LASER, true);
+  previous_timestamp_ = radar->timestamp_;
+}
+
+void UKF::CountNis(MeasurementPackage::SensorType sensor, bool fused) {
+  NisCounter &counter = sensor == MeasurementPackage::RADAR
+                        ? nis_counter_radar_ : nis_counter_lidar_;
+  const double nis = sensor == MeasurementPackage::RADAR ? nis_radar_
+                                                         : nis_lidar_;
+  const double bound = sensor == MeasurementPackage::RADAR ? kChiSquare95Radar
+                                                           : kChiSquare95Lidar;
+  ++counter.updates;
+  counter.nis_sum += nis;
+  if (nis > bound) ++counter.exceeded;
+  if (!fused) ++counter.rejected;
+
+  //a rejected outlier says nothing about the process noise, and before the
+  //warm-up S still reflects the initial covariance
+  if (adaptive_rate_ > 0.0 && fused &&
+      nis_counter_lidar_.updates + nis_counter_radar_.updates >
+          static_cast<unsigned long long>(gate_warmup_)) {
+    AdaptNoise(nis, sensor == MeasurementPackage::RADAR ? n_z_radar_
+                                                        : n_z_lidar_);
+  }
+}
+
+void UKF::AdaptNoise(double nis, int dof) {
+  //stochastic approximation of E[NIS / dof] = 1: a multiplicative step
+  //keeps the scale positive, and the clamp keeps one bad stretch from
+  //running it away
+  double scale = noise_scale_ * (1.0 + adaptive_rate_ * (nis / dof - 1.0));
+  const double low = 1.0 / adaptive_limit_;
+  scale = scale < low ? low : (scale > adaptive_limit_ ? adaptive_limit_
+                                                       : scale);
+  if (!std::isfinite(scale)) {
+    return;
+  }
+  noise_scale_ = scale;
+  noise_std_scale_ = static_cast<Scalar>(std::sqrt(scale));
+}
+
 /**
  * Creates sigma points
  * @param Xsig_out Reference to state mean
  */
-void UKF::GenerateSigmaPoints(MatrixXd* Xsig_out) {
-  //create augmented mean state
-  x_aug.fill(0.0);
-  x_aug.head(5) = x_pred_;
-  x_aug(5) = 0;
-  x_aug(6) = 0;
+void UKF::GenerateSigmaPoints(AugSigmaMatrix* Xsig_out) {
+  //P_aug is block diagonal, so only the P_pred_ block needs a factor
+  GenerateSigmaPoints(CovarianceFactor(), Xsig_out);
+}
 
-  //create augmented covariance matrix
-  P_aug.fill(0.0);
-  P_aug.topLeftCorner(5,5) = P_pred_;
-  P_aug(5,5) = std_a_ * std_a_;
-  P_aug(6,6) = std_yawdd_ * std_yawdd_;
+bool UKF::Healthy() const {
+  return x_pred_.allFinite() && P_pred_.allFinite() &&
+         P_pred_.diagonal().minCoeff() >= 0.0;
+}
 
-  //create square root matrix
-  MatrixXd L = P_aug.llt().matrixL();
+UKF::StateMatrix UKF::CovarianceFactor() {
+  Eigen::LLT<StateMatrix> llt(P_pred_);
+  if (llt.info() == Eigen::Success) {
+    return llt.matrixL();
+  }
+  //a zero covariance (the default start) is fine as it is
+  if (P_pred_.isZero(0.0)) {
+    return StateMatrix::Zero();
+  }
 
-  //create augmented sigma points
-  Xsig_aug.fill(0.0);
-  Xsig_aug.col(0)  = x_aug;
-  for (int i = 0; i < n_aug_; i++)
-  {
-    Xsig_aug.col(i + 1) = x_aug + sqrt(lambda_ + n_aug_) * L.col(i);
-    Xsig_aug.col(i + 1 + n_aug_) = x_aug - sqrt(lambda_ + n_aug_) * L.col(i);
+  ++covariance_repairs_;
+  Symmetrize(&P_pred_);
+  const double mean_variance = P_pred_.diagonal().cwiseAbs().mean();
+  P_pred_.diagonal().array() += kRepairJitter * mean_variance;
+
+  //P = Pi^T L D L^T Pi; with D clamped, S = Pi^T L sqrt(D) is a square
+  //root of the nearest positive semi-definite matrix of that form
+  Eigen::LDLT<StateMatrix> ldlt(P_pred_);
+  const StateVector d = ldlt.vectorD().cwiseMax(0.0).cwiseSqrt();
+  StateMatrix S = ldlt.matrixL();
+  S = S * d.asDiagonal();
+  S = ldlt.transpositionsP().transpose() * S;
+  P_pred_ = S * S.transpose();
+  return S;
+}
+
+/**
+ * Creates sigma points from a lower factor of P_pred_. The noise block of
+ * the augmented factor is diag(std_a_, std_yawdd_), so the noise columns are
+ * written directly and the rest of rows 5-6 stays zero.
+ * @param L Lower factor of P_pred_
+ * @param Xsig_out Augmented sigma points, filled in place
+ */
+void UKF::GenerateSigmaPoints(const StateMatrix &L, AugSigmaMatrix* Xsig_out) {
+  UKF_ZONE("GenerateSigmaPoints");
+  //augmented mean state
+  x_aug.head<n_x_>() = x_pred_;
+  x_aug.tail<n_aug_ - n_x_>().setZero();
+
+  SigmaPointsFrom(x_pred_, L, Xsig_out);
+}
+
+void UKF::SigmaPointsFrom(const StateVector &x, const StateMatrix &L,
+                          AugSigmaMatrix *Xsig_out) const {
+  AugSigmaMatrix &Xsig = *Xsig_out;
+
+  //simplex: x_aug + diag(L, std_a_, std_yawdd_) U over the points in use;
+  //the padding columns are the mean
+  if (sigma_points_ == SIMPLEX_POINTS) {
+    Xsig.topLeftCorner<n_x_, n_sig_simplex_>() =
+        L.lazyProduct(simplex_points_.topLeftCorner<n_x_, n_sig_simplex_>());
+    Xsig.topRightCorner<n_x_, n_sig_ - n_sig_simplex_>().setZero();
+    Xsig.topRows<n_x_>().colwise() += x;
+    Xsig.row(5) = (noise_std_scale_ * std_a_) * simplex_points_.row(5);
+    Xsig.row(6) = (noise_std_scale_ * std_yawdd_) * simplex_points_.row(6);
+    return;
   }
 
-  *Xsig_out = Xsig_aug;
+  //state rows: mean, then +/- the scaled columns of L
+  Xsig.topRows<n_x_>().colwise() = x;
+  Xsig.block<n_x_, n_x_>(0, 1) += sigma_scale_ * L;
+  Xsig.block<n_x_, n_x_>(0, 1 + n_aug_) -= sigma_scale_ * L;
+
+  //noise rows: only the two noise columns on each side are non-zero
+  Xsig.bottomRows<n_aug_ - n_x_>().setZero();
+  const Scalar noise_scale = sigma_scale_ * noise_std_scale_;
+  Xsig(5, nu_a_col_) = noise_scale * std_a_;
+  Xsig(6, nu_yawdd_col_) = noise_scale * std_yawdd_;
+  Xsig(5, nu_a_col_ + n_aug_) = -noise_scale * std_a_;
+  Xsig(6, nu_yawdd_col_ + n_aug_) = -noise_scale * std_yawdd_;
+}
+
+UKF::StateMatrix UKF::PosteriorFactor() const {
+  return use_sqrt_ukf_ ? L_pred_ : RobustLowerFactor(P_pred_);
 }
 
 /**
  * Predicts Sigma Points
  * @param Xsig_out Reference to state mean
- * @param n_aug_ Augmented state dimension
+ * @param n_aug Augmented state dimension
  * @param delta_t Time difference since last measurement
  */
-void UKF::PredictSigmaPoints(MatrixXd *Xsig_out, int n_aug_, double delta_t) {
-  //predict sigma points
-  for (int i = 0; i < 1 + (2 * n_aug_); i++)
-  {
-    //extract values for better readability
-    double p_x = Xsig_aug(0,i);
-    double p_y = Xsig_aug(1,i);
-    double v = Xsig_aug(2,i);
-    double yaw = Xsig_aug(3,i);
-    double yawd = Xsig_aug(4,i);
-    double nu_a = Xsig_aug(5,i);
-    double nu_yawdd = Xsig_aug(6,i);
-
-    //predicted state values
-    double px_p, py_p;
-
-    //avoid division by zero
-    if (fabs(yawd) > 0.001) {
-      px_p = p_x + v / yawd * (sin(yaw + yawd * delta_t) - sin(yaw));
-      py_p = p_y + v / yawd * (cos(yaw) - cos(yaw + yawd * delta_t));
+void UKF::PredictSigmaPoints(SigmaMatrix *Xsig_out, int n_aug, double delta_t) {
+  UKF_ZONE("PredictSigmaPoints");
+  if (n_aug == n_aug_) {
+    PropagateSigmaPoints(Xsig_aug, delta_t, Xsig_out);
+  }
+  else if (motion_model_ == CV_MODEL) {
+    PredictSigmaPointsWith<CVModel>(Xsig_out, n_aug, delta_t);
+  }
+  else {
+    PredictSigmaPointsWith<CTRVModel>(Xsig_out, n_aug, delta_t);
+  }
+}
+
+namespace {
+
+// whether column i of the augmented sigma points carries process noise
+inline bool NoiseColumn(int i) {
+  const int c = i > UKF::n_aug_ ? i - UKF::n_aug_ : i;
+  return c == UKF::nu_a_col_ || c == UKF::nu_yawdd_col_;
+}
+
+// one motion model step over every column of Xsig_in; the noise terms are
+// only evaluated for the four columns where they are non-zero
+template <typename Model>
+void PropagateWith(const UKF::AugSigmaMatrix &Xsig_in, double delta_t,
+                   UKF::SigmaMatrix *Xsig_out) {
+  const UKF::Scalar dt = static_cast<UKF::Scalar>(delta_t);
+  const UKF::Scalar half_dt2 = UKF::Scalar(0.5) * dt * dt;
+  for (int i = 0; i < UKF::n_sig_; i++) {
+    if (NoiseColumn(i)) {
+      Model::Propagate(Xsig_in.col(i).data(), dt, half_dt2,
+                       Xsig_out->col(i).data());
     }
     else {
-      px_p = p_x + (v * delta_t * cos(yaw));
-      py_p = p_y + (v * delta_t * sin(yaw));
+      Model::PropagateNoiseFree(Xsig_in.col(i).data(), dt,
+                                Xsig_out->col(i).data());
     }
+  }
+}
 
-    double v_p = v;
-    double yaw_p = yaw + yawd * delta_t;
-    double yawd_p = yawd;
+// one motion model step over the simplex points, with the padding columns
+// zeroed
+template <typename Model>
+void PropagateSimplex(const UKF::AugSigmaMatrix &Xsig_in, double delta_t,
+                      UKF::SigmaMatrix *Xsig_out) {
+  const UKF::Scalar dt = static_cast<UKF::Scalar>(delta_t);
+  const UKF::Scalar half_dt2 = UKF::Scalar(0.5) * dt * dt;
+  for (int i = 0; i < UKF::n_sig_simplex_; i++) {
+    Model::Propagate(Xsig_in.col(i).data(), dt, half_dt2,
+                     Xsig_out->col(i).data());
+  }
+  Xsig_out->rightCols<UKF::n_sig_ - UKF::n_sig_simplex_>().setZero();
+}
 
-    //add noise
-    px_p = px_p + (0.5 * nu_a * delta_t * delta_t * cos(yaw));
-    py_p = py_p + (0.5 * nu_a * delta_t * delta_t * sin(yaw));
-    v_p = v_p + nu_a * delta_t;
+}  // namespace
 
-    yaw_p  = yaw_p  + (0.5 * nu_yawdd * delta_t * delta_t);
-    yawd_p = yawd_p + (nu_yawdd * delta_t);
+void UKF::PropagateSigmaPoints(const AugSigmaMatrix &Xsig_in, double delta_t,
+                               SigmaMatrix *Xsig_out) const {
+  if (sigma_count_ == n_sig_simplex_) {
+    if (motion_model_ == CV_MODEL) {
+      PropagateSimplex<CVModel>(Xsig_in, delta_t, Xsig_out);
+    }
+    else if (kernels_ == VECTOR_KERNELS) {
+      isa_kernels_->predict_ctrv_simplex(Xsig_in, delta_t, Xsig_out);
+    }
+    else {
+      PropagateSimplex<CTRVModel>(Xsig_in, delta_t, Xsig_out);
+    }
+  }
+  else if (motion_model_ == CV_MODEL) {
+    PropagateWith<CVModel>(Xsig_in, delta_t, Xsig_out);
+  }
+  else if (kernels_ == VECTOR_KERNELS) {
+    isa_kernels_->predict_ctrv(Xsig_in, delta_t, Xsig_out);
+  }
+  else {
+    PropagateWith<CTRVModel>(Xsig_in, delta_t, Xsig_out);
+  }
+}
 
-    //write predicted sigma point into right column
-    Xsig_pred_(0,i) = px_p;
-    Xsig_pred_(1,i) = py_p;
-    Xsig_pred_(2,i) = v_p;
-    Xsig_pred_(3,i) = yaw_p;
-    Xsig_pred_(4,i) = yawd_p;
+/**
+ * Predicts Sigma Points with a motion model policy, one sigma point at a time
+ * @param Xsig_out Predicted sigma points
+ * @param n_aug Augmented state dimension
+ * @param delta_t Time difference since last measurement
+ */
+template <typename Model>
+void UKF::PredictSigmaPointsWith(SigmaMatrix *Xsig_out, int n_aug,
+                                 double delta_t) {
+  //per-step constants, shared by every sigma point
+  const Scalar dt = static_cast<Scalar>(delta_t);
+  const Scalar half_dt2 = Scalar(0.5) * dt * dt;
+
+  //columns are contiguous, so each sigma point is a plain array
+  for (int i = 0; i < 1 + (2 * n_aug); i++) {
+    Model::Propagate(Xsig_aug.col(i).data(), dt, half_dt2,
+                     Xsig_out->col(i).data());
   }
+}
 
-  *Xsig_out = Xsig_pred_;
-};
+/**
+ * Predicts Sigma Points with the CTRV model evaluated row-wise over all
+ * sigma points at once. Each state row is copied into a contiguous array and
+ * the turning and straight-line cases are both computed and blended with a
+ * select, so the loop bodies have no branches and vectorise. Runs the
+ * isa_kernels_ build (see ukf_kernels.cpp).
+ * @param Xsig_out Predicted sigma points
+ * @param delta_t Time difference since last measurement
+ */
+void UKF::PredictSigmaPointsVectorized(SigmaMatrix *Xsig_out, double delta_t) {
+  isa_kernels_->predict_ctrv(Xsig_aug, delta_t, Xsig_out);
+}
 
 /**
- * Predict Mean And Covariance
+ * Predict Mean And Covariance. The mean is one matrix-vector product; the
+ * covariance is Xd W Xd^T over the centred, yaw-wrapped deviations. Runs
+ * the isa_kernels_ build (see ukf_kernels.cpp).
  * @param x_pred_out Reference to state mean
  * @param P_pred_out Reference to state covariance
  */
-void UKF::PredictMeanAndCovariance(VectorXd* x_pred_out, MatrixXd* P_pred_out) {
-  // set weights_
-  weights_(0) = lambda_ / (lambda_ + n_aug_);
-  for (int i = 1; i < 2 * n_aug_ + 1; i++) {
-    weights_(i) = 0.5 / (n_aug_ + lambda_);
-  }
+void UKF::PredictMeanAndCovariance(StateVector* x_pred_out, StateMatrix* P_pred_out) {
+  UKF_ZONE("PredictMeanAndCovariance");
+  MeanAndCovariance(Xsig_pred_, x_pred_out, P_pred_out);
+}
 
-  //predicted state mean
-  VectorXd x_pred_ = VectorXd(5);
-  x_pred_.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++) {
-    x_pred_ = x_pred_ + weights_(i) * Xsig_pred_.col(i);
+void UKF::MeanAndCovariance(const SigmaMatrix &Xsig, StateVector *x_out,
+                            StateMatrix *P_out) const {
+  if (sigma_count_ == n_sig_simplex_) {
+    isa_kernels_->mean_and_covariance_simplex(Xsig, weights_, weights_c_,
+                                              x_out, P_out);
   }
-
-  //predicted state covariance matrix
-  MatrixXd P_pred_ = MatrixXd(n_x_, n_x_);
-  P_pred_.fill(0.0);
-
-  for (int i = 0; i < 2 * n_aug_ + 1; i++) {
-
-    // state difference
-    VectorXd x_diff = Xsig_pred_.col(i) - x_pred_;
-
-    //angle normalization
-    while (x_diff(3) > M_PI) x_diff(3) -= 2. * M_PI;
-    while (x_diff(3) < -M_PI) x_diff(3) += 2. * M_PI;
-
-    P_pred_ = P_pred_ + weights_(i) * x_diff * x_diff.transpose() ;
+  else {
+    isa_kernels_->mean_and_covariance(Xsig, weights_, weights_c_, x_out,
+                                      P_out);
   }
-
-  *x_pred_out = x_pred_;
-  *P_pred_out = P_pred_;
-};
+}
 
 /**
  * Predicts sigma points, the state, and the state covariance matrix.
@@ -272,147 +981,541 @@ void UKF::Prediction(double delta_t) {
   GenerateSigmaPoints(&Xsig_aug);
   PredictSigmaPoints(&Xsig_pred_, n_aug_, delta_t);
   PredictMeanAndCovariance(&x_pred_, &P_pred_);
+  ekf_predicted_ = false;
+}
+
+bool UKF::NearLinearMotion(double delta_t) const {
+  //the models bend the motion through sin and cos of the heading, so what
+  //matters is the heading's spread over the step
+  const double heading_var = P_pred_(3, 3) + 2 * delta_t * P_pred_(3, 4) +
+                             delta_t * delta_t * P_pred_(4, 4);
+  return heading_var <= ekf_angle_ * ekf_angle_;
+}
+
+bool UKF::NearLinearRadar() const {
+  //range and bearing are near-linear while the position spread is small
+  //next to the range; the range rate also needs a narrow heading
+  const double range2 = x_pred_(0) * x_pred_(0) + x_pred_(1) * x_pred_(1);
+  const double angle2 = ekf_angle_ * ekf_angle_;
+  return P_pred_(0, 0) + P_pred_(1, 1) <= angle2 * range2 &&
+         P_pred_(3, 3) <= angle2;
+}
+
+namespace {
+
+typedef Eigen::Matrix<UKF::Scalar, UKF::n_x_, UKF::n_x_, Eigen::RowMajor>
+    StateJacobian;
+typedef Eigen::Matrix<UKF::Scalar, UKF::n_x_, 2, Eigen::RowMajor>
+    NoiseJacobianMatrix;
+
+// the EKF step with the motion model inlined
+template <typename Model>
+void LinearizedStep(const UKF::StateVector &x, double delta_t,
+                    UKF::StateVector *x_out, StateJacobian *F,
+                    NoiseJacobianMatrix *G) {
+  const UKF::Scalar dt = static_cast<UKF::Scalar>(delta_t);
+  const UKF::Scalar half_dt2 = UKF::Scalar(0.5) * dt * dt;
+  Model::Linearize(x.data(), dt, half_dt2, F->data(), G->data());
+  Model::PropagateNoiseFree(x.data(), dt, x_out->data());
+}
+
+}  // namespace
+
+void UKF::PredictionEkf(double delta_t) {
+  StateVector x;
+  StateJacobian F;
+  NoiseJacobianMatrix G;
+  if (motion_model_ == CV_MODEL) {
+    LinearizedStep<CVModel>(x_pred_, delta_t, &x, &F, &G);
+  }
+  else {
+    LinearizedStep<CTRVModel>(x_pred_, delta_t, &x, &F, &G);
+  }
+
+  //P = F P F^T + G Q G^T, Q = diag(std_a^2, std_yawdd^2) times the adaptive
+  //scale, as the sigma points would see it
+  const Eigen::Matrix<Scalar, 2, 1> q(
+      static_cast<Scalar>(noise_scale_ * std_a_ * std_a_),
+      static_cast<Scalar>(noise_scale_ * std_yawdd_ * std_yawdd_));
+  const StateMatrix FP = F.lazyProduct(P_pred_);
+  const NoiseJacobianMatrix GQ = G * q.asDiagonal();
+  P_pred_ = FP.lazyProduct(F.transpose());
+  P_pred_ += GQ.lazyProduct(G.transpose());
+  Symmetrize(&P_pred_);
+
+  x_pred_ = x;
+  ekf_predicted_ = true;
+  ++ekf_predictions_;
+}
+
+void UKF::PredictAhead(const double *horizons, int count, StateVector *x_out,
+                       StateMatrix *P_out) const {
+  //everything on the stack: one sigma set shared by all horizons
+  AugSigmaMatrix Xsig;
+  SigmaPointsFrom(x_pred_, PosteriorFactor(), &Xsig);
+
+  SigmaMatrix Xsig_ahead;
+  StateMatrix P_scratch;
+  for (int k = 0; k < count; k++) {
+    PropagateSigmaPoints(Xsig, horizons[k], &Xsig_ahead);
+    MeanAndCovariance(Xsig_ahead, &x_out[k], P_out ? &P_out[k] : &P_scratch);
+  }
+}
+
+void UKF::PredictTrajectory(const TimeUs *timestamps, int count,
+                            PredictedState *trajectory) const {
+  AugSigmaMatrix Xsig;
+  SigmaMatrix Xsig_step;
+  StateVector x = x_pred_;
+  StateMatrix P = P_pred_;
+  StateMatrix L = PosteriorFactor();
+  TimeUs t = previous_timestamp_;
+  for (int k = 0; k < count; k++) {
+    //the same equal sub-steps as PredictInSteps
+    const double delta_t = ToSeconds(timestamps[k] - t);
+    int steps = 1;
+    if (max_predict_step_ > 0.0 && delta_t > max_predict_step_) {
+      steps = static_cast<int>(ceil(delta_t / max_predict_step_));
+    }
+    const double step = delta_t / steps;
+    for (int i = 0; i < steps; i++) {
+      if (i > 0 || k > 0) {
+        L = RobustLowerFactor(P);
+      }
+      SigmaPointsFrom(x, L, &Xsig);
+      PropagateSigmaPoints(Xsig, step, &Xsig_step);
+      MeanAndCovariance(Xsig_step, &x, &P);
+    }
+    t = timestamps[k];
+    trajectory[k].timestamp = t;
+    trajectory[k].x = x;
+    trajectory[k].P = P;
+  }
+}
+
+void UKF::PredictFrom(const StateVector &x, const StateMatrix &P,
+                      double delta_t, StateVector *x_out, StateMatrix *P_out,
+                      StateMatrix *C_out) const {
+  AugSigmaMatrix Xsig;
+  SigmaMatrix Xsig_step;
+  SigmaPointsFrom(x, RobustLowerFactor(P), &Xsig);
+  PropagateSigmaPoints(Xsig, delta_t, &Xsig_step);
+  MeanAndCovariance(Xsig_step, x_out, P_out);
+  if (!C_out) {
+    return;
+  }
+
+  //C = sum w_c (X - x)(X_pred - x_pred)^T, yaw wrapped on both sides
+  SigmaMatrix Xd = Xsig.topRows<n_x_>().colwise() - x;
+  SigmaMatrix Yd = Xsig_step.colwise() - *x_out;
+  NormalizeAngles(Xd.row(3));
+  NormalizeAngles(Yd.row(3));
+  const SigmaMatrix Xw = Xd * weights_c_.asDiagonal();
+  *C_out = WeightedProduct<Accumulator>(Xw, Yd);
 }
 
 /**
  * Updates the state and the state covariance matrix using a laser measurement.
- * @param {MeasurementPackage} meas_package
+ * The lidar model is linear and just selects px and py, so H P is the top
+ * two rows of P_pred_ and H P H^T its top-left block; no H or identity
+ * matrix is formed. The noise comes from std_laspx_ and std_laspy_.
+ * @param {Measurement} meas_package
  */
-void UKF::UpdateLidar(MeasurementPackage meas_package) {
-  // Laser updates
-  //measurement matrix
-  MatrixXd H_ = MatrixXd(2, 5);
-  H_ << 1, 0, 0, 0, 0,
-        0, 1, 0, 0, 0;
-  MatrixXd R_ = MatrixXd(2, 2);
-
-  //measurement covariance matrix - laser
-  R_ << 0.0225, 0,
-        0, 0.0225;
-
-  VectorXd z = meas_package.raw_measurements_;
-  VectorXd z_pred = H_ * x_pred_;
-  VectorXd y = z - z_pred;
-  MatrixXd Ht = H_.transpose();
-  MatrixXd S = H_ * P_pred_ * Ht + R_;
-  MatrixXd Si = S.inverse();
-  MatrixXd PHt = P_pred_ * Ht;
-  MatrixXd K = PHt * Si;
-
-  //new estimate
-  x_pred_ = x_pred_ + (K * y);
-  long x_size = x_pred_.size();
-  MatrixXd I = MatrixXd::Identity(x_size, x_size);
-  P_pred_ = (I - K * H_) * P_pred_;
+bool UKF::UpdateLidar(const Measurement &meas_package) {
+  UKF_ZONE("UpdateLidar");
+  //innovation, written straight into the member kept for NIS and gating
+  z_diff_lidar_ << meas_package.values_[0] - x_pred_(0),
+                   meas_package.values_[1] - x_pred_(1);
+
+  //S = H P H^T + R
+  LidarMatrix S = P_pred_.topLeftCorner<n_z_lidar_, n_z_lidar_>();
+  S.diagonal() += lidar_noise_;
+  S_lidar_factor_ = RobustLowerFactor(S);
+
+  //gate on the NIS before any n_x_-sized work
+  nis_lidar_ = NisFromFactor(S_lidar_factor_, z_diff_lidar_);
+  if (GatedOut(nis_lidar_, gate_lidar_)) {
+    return false;
+  }
+
+  //P H^T, the first two columns of P
+  const Eigen::Matrix<Scalar, n_x_, n_z_lidar_> PHt =
+      P_pred_.leftCols<n_z_lidar_>();
+
+  //gain from the factor of S rather than its inverse
+  Eigen::Matrix<Scalar, n_x_, n_z_lidar_> K =
+      GainFromFactor(S_lidar_factor_, PHt);
+
+  //new estimate; (I - K H) P = P - K (H P)
+  x_pred_ += K * z_diff_lidar_;
+  if (use_joseph_form_) {
+    //A = (I - K H) P, then A (I - K H)^T = A - (A H^T) K^T where A H^T is
+    //the first two columns of A; plus K R K^T with R diagonal
+    const StateMatrix A = P_pred_ - K.lazyProduct(PHt.transpose());
+    const Eigen::Matrix<Scalar, n_x_, n_z_lidar_> KR =
+        K * lidar_noise_.asDiagonal();
+    P_pred_ = A;
+    P_pred_ -= A.leftCols<n_z_lidar_>().lazyProduct(K.transpose());
+    P_pred_ += KR.lazyProduct(K.transpose());
+  }
+  else {
+    P_pred_ -= K.lazyProduct(PHt.transpose());
+  }
+  Symmetrize(&P_pred_);
+  return true;
 }
 
-/**
- * Updates the state and the state covariance matrix using a radar measurement.
- * @param {MeasurementPackage} meas_package
- */
-void UKF::UpdateRadar(MeasurementPackage meas_package) {
-  /*******************************************************************************
-   * PREDICT RADAR SIGMA POINTS
-   ******************************************************************************/
+bool UKF::UpdateLidar(const MeasurementPackage &meas_package) {
+  return UpdateLidar(Measurement::From(meas_package));
+}
+
+void UKF::PredictMeanInSteps(double delta_t) {
+  const int steps = PredictSteps(delta_t);
+  const Scalar step = static_cast<Scalar>(delta_t / steps);
+  StateVector x;
+  for (int i = 0; i < steps; i++) {
+    if (motion_model_ == CV_MODEL) {
+      CVModel::PropagateNoiseFree(x_pred_.data(), step, x.data());
+    }
+    else {
+      CTRVModel::PropagateNoiseFree(x_pred_.data(), step, x.data());
+    }
+    x_pred_ = x;
+  }
+  ekf_predicted_ = true;
+}
 
-  //set measurement dimension, radar can measure r, phi, and r_dot
-  int n_z_ = 3;
+int UKF::PredictSteps(double delta_t) const {
+  if (max_predict_step_ > 0.0 && delta_t > max_predict_step_) {
+    return static_cast<int>(ceil(delta_t / max_predict_step_));
+  }
+  return 1;
+}
 
-  //create matrix for sigma points in measurement space
-  MatrixXd Zsig = MatrixXd(n_z_, 2 * n_aug_ + 1);
+void UKF::TracePrediction(TimeUs gap, bool steady) const {
+  //as PredictInSteps or PredictMeanInSteps divided it
+  const int steps = gap == 0 ? 0 : PredictSteps(ToSeconds(gap));
+  LatencyTrace::Predicted(steps, steady || ekf_predicted_ ? 0 : sigma_count_);
+}
 
-  //transform sigma points into measurement space
-  for (int i = 0; i < 2 * n_aug_ + 1; i++) {
+bool UKF::UpdateLidarSteady(const Measurement &meas_package) {
+  z_diff_lidar_ << meas_package.values_[0] - x_pred_(0),
+                   meas_package.values_[1] - x_pred_(1);
+  S_lidar_factor_ = steady_S_factor_;
+  nis_lidar_ = NisFromFactor(S_lidar_factor_, z_diff_lidar_);
+  if (GatedOut(nis_lidar_, gate_lidar_)) {
+    //unfused, the track keeps the prior
+    P_pred_ = steady_prior_;
+    LeaveSteadyState();
+    return false;
+  }
+  x_pred_ += steady_K_ * z_diff_lidar_;
+  P_pred_ = steady_P_;
+  ++steady_updates_;
+  return true;
+}
 
-    // extract values for better readibility
-    double p_x = Xsig_pred_(0,i);
-    double p_y = Xsig_pred_(1,i);
-    double v  = Xsig_pred_(2,i);
-    double yaw = Xsig_pred_(3,i);
+void UKF::TrackSteadyState(TimeUs gap, bool fused) {
+  if (!fused || gap <= 0 || gap != steady_gap_) {
+    steady_count_ = 0;
+  }
+  else {
+    const Scalar change = (P_pred_ - steady_P_).cwiseAbs().maxCoeff();
+    const Scalar scale = P_pred_.cwiseAbs().maxCoeff();
+    steady_count_ = change <= steady_state_tolerance_ * scale
+                    ? steady_count_ + 1 : 0;
+  }
+  steady_gap_ = gap;
+  steady_P_ = P_pred_;
+  if (steady_count_ < kSteadySteps) {
+    return;
+  }
 
-    double v1 = cos(yaw)*v;
-    double v2 = sin(yaw)*v;
+  //the gain of the last full update, from the prior it was computed with
+  steady_S_factor_ = S_lidar_factor_;
+  steady_K_ = GainFromFactor(
+      steady_S_factor_,
+      Eigen::Matrix<Scalar, n_x_, n_z_lidar_>(
+          steady_prior_.leftCols<n_z_lidar_>()));
+  steady_ = true;
+}
 
-    // measurement model
-    // rho
-    Zsig(0,i) = sqrt(p_x * p_x + p_y * p_y);
-    // phi
-    Zsig(1,i) = atan2(p_y,p_x);
-    // rho_dot
-    Zsig(2,i) = (p_x * v1 + p_y * v2 ) / sqrt(p_x * p_x + p_y * p_y);
+void UKF::LeaveSteadyState() {
+  steady_ = false;
+  steady_count_ = 0;
+  steady_gap_ = 0;
+}
+
+/**
+ * Updates the state and the state covariance matrix using a radar measurement.
+ * @param {Measurement} meas_package
+ */
+bool UKF::UpdateRadar(const Measurement &meas_package) {
+  UKF_ZONE("UpdateRadar");
+  //after an EKF prediction the sigma points are stale: near-linear geometry
+  //takes the EKF update, anything else redraws them
+  if (ekf_predicted_) {
+    if (NearLinearRadar()) {
+      return UpdateRadarEkf(meas_package);
+    }
+    RefreshSigmaPoints();
   }
+  return UpdateWithModel<RadarModel>(meas_package, radar_noise_, gate_radar_,
+                                     &z_diff_radar_, &S_radar_factor_,
+                                     &nis_radar_);
+}
 
-  //mean predicted measurement
-  VectorXd z_pred = VectorXd(n_z_);
-  z_pred.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++) {
-    z_pred = z_pred + weights_(i) * Zsig.col(i);
+bool UKF::UpdateRadar(const MeasurementPackage &meas_package) {
+  return UpdateRadar(Measurement::From(meas_package));
+}
+
+bool UKF::UpdateRadarEkf(const Measurement &meas_package) {
+  //h(x) and its Jacobian at the prediction
+  RadarVector z_pred;
+  RadarModel::Measure(x_pred_.data(), z_pred.data());
+  Eigen::Matrix<Scalar, n_z_radar_, n_x_, Eigen::RowMajor> H;
+  RadarModel::Jacobian(x_pred_.data(), H.data());
+
+  //S = H P H^T + R, with P H^T shared by the gain
+  const Eigen::Matrix<Scalar, n_x_, n_z_radar_> PHt =
+      P_pred_.lazyProduct(H.transpose());
+  RadarMatrix S = H.lazyProduct(PHt);
+  S.diagonal() += radar_noise_;
+  S_radar_factor_ = RobustLowerFactor(S);
+
+  RadarVector z_diff = Eigen::Map<const Eigen::Vector3d>(
+      meas_package.values_.data()).cast<Scalar>() - z_pred;
+  z_diff(1) = NormalizeAngle(z_diff(1));
+  z_diff_radar_ = z_diff;
+  nis_radar_ = NisFromFactor(S_radar_factor_, z_diff);
+  if (GatedOut(nis_radar_, gate_radar_)) {
+    return false;
   }
 
-  //measurement covariance matrix S
-  MatrixXd S = MatrixXd(n_z_,n_z_);
-  S.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++) {
-    //residual
-    VectorXd z_diff = Zsig.col(i) - z_pred;
+  //as the unscented update with Tc = P H^T
+  const Eigen::Matrix<Scalar, n_x_, n_z_radar_> K =
+      GainFromFactor(S_radar_factor_, PHt);
+  x_pred_ += K * z_diff;
+  P_pred_ -= K.lazyProduct(PHt.transpose());
+  Symmetrize(&P_pred_);
+  ++ekf_radar_updates_;
+  return true;
+}
 
-    //angle normalization
-    while (z_diff(1) >  M_PI) z_diff(1) -= 2. * M_PI;
-    while (z_diff(1) < -M_PI) z_diff(1) += 2. * M_PI;
+double UKF::MeasurementNis(const Measurement &meas) const {
+  if (meas.sensor_type_ == MeasurementPackage::RADAR) {
+    return NisWithModel<RadarModel>(meas, radar_noise_);
+  }
+  LidarVector z_diff(meas.values_[0] - x_pred_(0),
+                     meas.values_[1] - x_pred_(1));
+  LidarMatrix S = P_pred_.topLeftCorner<n_z_lidar_, n_z_lidar_>();
+  S.diagonal() += lidar_noise_;
+  return NisFromFactor(LidarMatrix(RobustLowerFactor(S)), z_diff);
+}
 
-    S = S + weights_(i) * z_diff * z_diff.transpose();
+/**
+ * Stacked radar + lidar update. The lidar rows of the measurement sigma
+ * points are just px and py, so both sensors share one pass over the
+ * predicted sigma points, one S and one gain.
+ * @param {Measurement} radar
+ * @param {Measurement} lidar
+ */
+void UKF::UpdateRadarLidar(const Measurement &radar, const Measurement &lidar) {
+  if (ekf_predicted_) {
+    RefreshSigmaPoints();
   }
 
-  //add measurement noise covariance matrix
-  MatrixXd R = MatrixXd(n_z_,n_z_);
-  R << std_radr_ * std_radr_, 0, 0,
-       0, std_radphi_ * std_radphi_, 0,
-       0, 0, std_radrd_ * std_radrd_;
-  S = S + R;
+  //sigma points in the stacked measurement space
+  RadarSigmaMatrix Zsig_radar;
+  PredictRadarSigmaPoints(&Zsig_radar);
+  FusedSigmaMatrix Zsig;
+  Zsig.topRows<n_z_radar_>() = Zsig_radar;
+  Zsig.bottomRows<n_z_lidar_>() = Xsig_pred_.topRows<n_z_lidar_>();
 
+  //mean predicted measurement
+  FusedVector z_pred = Zsig * weights_;
 
-  /*******************************************************************************
-   * UPDATE RADAR
-   ******************************************************************************/
+  //centred deviations
+  FusedSigmaMatrix Zd = Zsig.colwise() - z_pred;
+  SigmaMatrix Xd = Xsig_pred_.colwise() - x_pred_;
+  NormalizeAngles(Zd.row(1));
+  NormalizeAngles(Xd.row(3));
 
-  //create example vector for incoming radar measurement
-  VectorXd z = meas_package.raw_measurements_;
+  //weight the measurement deviations once for both S and Tc
+  FusedSigmaMatrix Zw = Zd * weights_c_.asDiagonal();
 
-  //create matrix for cross correlation Tc
-  MatrixXd Tc = MatrixXd(n_x_, n_z_);
+  //innovation covariance with the block-diagonal noise of both sensors
+  FusedMatrix S = WeightedProduct<Accumulator>(Zw, Zd);
+  S.diagonal().head<n_z_radar_>() += radar_noise_;
+  S.diagonal().tail<n_z_lidar_>() += lidar_noise_;
 
-  //calculate cross correlation matrix
-  Tc.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++) {
+  Eigen::Matrix<Scalar, n_x_, n_z_fused_> Tc =
+      WeightedProduct<Accumulator>(Xd, Zw);
+  FusedMatrix Sz = RobustLowerFactor(S);
+  Eigen::Matrix<Scalar, n_x_, n_z_fused_> K = GainFromFactor(Sz, Tc);
 
-    //residual
-    VectorXd z_diff = Zsig.col(i) - z_pred;
+  //residual
+  FusedVector z;
+  z << radar.values_[0], radar.values_[1], radar.values_[2],
+       lidar.values_[0], lidar.values_[1];
+  FusedVector z_diff = z - z_pred;
+  z_diff(1) = NormalizeAngle(z_diff(1));
+
+  //per-sensor innovations for NIS; the leading block of the stacked factor
+  //is the radar factor, the lidar one needs its own (2x2) Cholesky
+  z_diff_radar_ = z_diff.head<n_z_radar_>();
+  S_radar_factor_ = Sz.topLeftCorner<n_z_radar_, n_z_radar_>();
+  z_diff_lidar_ = z_diff.tail<n_z_lidar_>();
+  S_lidar_factor_ = RobustLowerFactor(
+      LidarMatrix(S.bottomRightCorner<n_z_lidar_, n_z_lidar_>()));
+  nis_radar_ = NisFromFactor(S_radar_factor_, z_diff_radar_);
+  nis_lidar_ = NisFromFactor(S_lidar_factor_, z_diff_lidar_);
+
+  //update state mean and covariance matrix; K S K^T = K Tc^T
+  x_pred_ = x_pred_ + K * z_diff;
+  P_pred_ -= K.lazyProduct(Tc.transpose());
+  Symmetrize(&P_pred_);
+}
 
-    //angle normalization
-    while (z_diff(1) >  M_PI) z_diff(1) -= 2. * M_PI;
-    while (z_diff(1) < -M_PI) z_diff(1) += 2. * M_PI;
+/**
+ * Transforms the predicted sigma points into radar measurement space.
+ * @param Zsig_out Radar sigma points
+ */
+void UKF::PredictRadarSigmaPoints(RadarSigmaMatrix* Zsig_out) {
+  RadarModel::MeasureSigmaPoints(Xsig_pred_, Zsig_out, radar_fast_atan2_);
+}
 
-    // state difference
-    VectorXd x_diff = Xsig_pred_.col(i) - x_pred_;
+/**
+ * Square-root prediction. The sigma points come straight from L_pred_, so
+ * there is no Cholesky at all.
+ * @param {double} delta_t the change in time (in seconds) between the last
+ * measurement and this one.
+ */
+void UKF::PredictionSqrt(double delta_t) {
+  GenerateSigmaPoints(L_pred_, &Xsig_aug);
+  PredictSigmaPoints(&Xsig_pred_, n_aug_, delta_t);
 
-    //angle normalization
-    while (x_diff(3) >  M_PI) x_diff(3) -= 2. * M_PI;
-    while (x_diff(3) <- M_PI) x_diff(3) += 2. * M_PI;
+  //predicted state mean
+  x_pred_ = Xsig_pred_ * weights_;
+
+  //centred deviations
+  SigmaMatrix Xd = Xsig_pred_.colwise() - x_pred_;
+  NormalizeAngles(Xd.row(3));
+
+  //QR of the equally weighted columns, then fold in the centre point
+  Eigen::Matrix<Scalar, n_sig_ - 1, n_x_> A =
+      sqrt(weights_c_(1)) * Xd.rightCols<n_sig_ - 1>().transpose();
+  L_pred_ = LowerFactorFromQR(A);
+  if (!CholUpdate(&L_pred_, StateVector(Xd.col(0)), weights_c_(0))) {
+    StateMatrix P = Xd * weights_c_.asDiagonal() * Xd.transpose();
+    L_pred_ = RobustLowerFactor(P);
+  }
+
+  P_pred_ = L_pred_ * L_pred_.transpose();
+}
 
-    Tc = Tc + weights_(i) * x_diff * z_diff.transpose();
+/**
+ * Square-root lidar update. H selects the position rows, so H * L is just the
+ * top two rows of L_pred_.
+ * @param {Measurement} meas_package
+ */
+bool UKF::UpdateLidarSqrt(const Measurement &meas_package) {
+  Eigen::Matrix<Scalar, 2, n_x_> HL = L_pred_.topRows<2>();
+
+  //innovation factor from [H*L, sqrt(R)]
+  Eigen::Matrix<Scalar, n_x_ + 2, 2> A;
+  A.topRows<n_x_>() = HL.transpose();
+  A.bottomRows<2>() << std_laspx_, 0,
+                       0, std_laspy_;
+  LidarMatrix Sz = LowerFactorFromQR(A);
+
+  LidarVector z(meas_package.values_[0], meas_package.values_[1]);
+  LidarVector y = z - x_pred_.head<2>();
+  S_lidar_factor_ = Sz;
+  z_diff_lidar_ = y;
+  nis_lidar_ = NisFromFactor(S_lidar_factor_, z_diff_lidar_);
+  if (GatedOut(nis_lidar_, gate_lidar_)) {
+    return false;
   }
 
-  //Kalman gain K;
-  MatrixXd K = Tc * S.inverse();
+  //K = P H^T S^-1 with S = Sz * Sz^T
+  Eigen::Matrix<Scalar, n_x_, 2> PHt = L_pred_ * HL.transpose();
+  Eigen::Matrix<Scalar, n_x_, 2> K = GainFromFactor(Sz, PHt);
+  x_pred_ = x_pred_ + K * y;
+
+  //P <- P - (K Sz)(K Sz)^T
+  Eigen::Matrix<Scalar, n_x_, 2> U = K * Sz;
+  StateMatrix L = L_pred_;
+  for (int j = 0; j < 2; j++) {
+    if (!CholUpdate(&L, StateVector(U.col(j)), Scalar(-1))) {
+      L = RobustLowerFactor(StateMatrix(P_pred_ - U * U.transpose()));
+      break;
+    }
+  }
+  L_pred_ = L;
+  P_pred_ = L_pred_ * L_pred_.transpose();
+  return true;
+}
 
-  //residual
-  VectorXd z_diff = z - z_pred;
+/**
+ * Square-root radar update.
+ * @param {Measurement} meas_package
+ */
+bool UKF::UpdateRadarSqrt(const Measurement &meas_package) {
+  RadarSigmaMatrix Zsig;
+  PredictRadarSigmaPoints(&Zsig);
 
-  //angle normalization
-  while (z_diff(1) >  M_PI) z_diff(1) -= 2. * M_PI;
-  while (z_diff(1) < -M_PI) z_diff(1) += 2. * M_PI;
+  //mean predicted measurement
+  RadarVector z_pred = Zsig * weights_;
+
+  //centred deviations
+  RadarSigmaMatrix Zd = Zsig.colwise() - z_pred;
+  SigmaMatrix Xd = Xsig_pred_.colwise() - x_pred_;
+  NormalizeAngles(Zd.row(1));
+  NormalizeAngles(Xd.row(3));
+
+  //innovation factor from the weighted deviations and sqrt(R)
+  Eigen::Matrix<Scalar, n_sig_ - 1 + n_z_radar_, n_z_radar_> A;
+  A.topRows<n_sig_ - 1>() =
+      sqrt(weights_c_(1)) * Zd.rightCols<n_sig_ - 1>().transpose();
+  A.bottomRows<n_z_radar_>() << std_radr_, 0, 0,
+                                0, std_radphi_, 0,
+                                0, 0, std_radrd_;
+  RadarMatrix Sz = LowerFactorFromQR(A);
+  if (!CholUpdate(&Sz, RadarVector(Zd.col(0)), weights_c_(0))) {
+    RadarMatrix S = Zd * weights_c_.asDiagonal() * Zd.transpose();
+    S.diagonal() += radar_noise_;
+    Sz = RobustLowerFactor(S);
+  }
 
-  //update state mean and covariance matrix
+  //residual and gate
+  RadarVector z(meas_package.values_[0], meas_package.values_[1],
+                meas_package.values_[2]);
+  RadarVector z_diff = z - z_pred;
+  z_diff(1) = NormalizeAngle(z_diff(1));
+  S_radar_factor_ = Sz;
+  z_diff_radar_ = z_diff;
+  nis_radar_ = NisFromFactor(S_radar_factor_, z_diff_radar_);
+  if (GatedOut(nis_radar_, gate_radar_)) {
+    return false;
+  }
+
+  //cross correlation and gain from two triangular solves
+  Eigen::Matrix<Scalar, n_x_, n_z_radar_> Tc =
+      Xd * weights_c_.asDiagonal() * Zd.transpose();
+  Eigen::Matrix<Scalar, n_x_, n_z_radar_> K = GainFromFactor(Sz, Tc);
   x_pred_ = x_pred_ + K * z_diff;
-  P_pred_ = P_pred_ - K * S * K.transpose();
+
+  //P <- P - (K Sz)(K Sz)^T
+  Eigen::Matrix<Scalar, n_x_, n_z_radar_> U = K * Sz;
+  StateMatrix L = L_pred_;
+  for (int j = 0; j < n_z_radar_; j++) {
+    if (!CholUpdate(&L, StateVector(U.col(j)), Scalar(-1))) {
+      L = RobustLowerFactor(StateMatrix(P_pred_ - U * U.transpose()));
+      break;
+    }
+  }
+  L_pred_ = L;
+  P_pred_ = L_pred_ * L_pred_.transpose();
+  return true;
 }
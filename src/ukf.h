@@ -2,6 +2,8 @@
 #define UKF_H
 
 #include "measurement_package.h"
+#include "ring_buffer.h"
+#include "ukf_config.h"
 #include "Eigen/Dense"
 #include <vector>
 #include <string>
@@ -10,9 +12,90 @@
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
+struct UkfKernels;
+
 class UKF {
 public:
 
+  ///* State dimension
+  static const int n_x_ = 5;
+
+  ///* Augmented state dimension
+  static const int n_aug_ = 7;
+
+  ///* Number of sigma points
+  static const int n_sig_ = 2 * n_aug_ + 1;
+
+  ///* Filter arithmetic type: float in builds with UKF_SINGLE_PRECISION (twice
+  ///* the SIMD width); covariance reductions still accumulate in Accumulator
+#ifdef UKF_SINGLE_PRECISION
+  typedef float Scalar;
+#else
+  typedef double Scalar;
+#endif
+  typedef double Accumulator;
+
+  ///* Fixed-size storage for the sigma-point pipeline (no heap allocation).
+  ///* Sizes that are a multiple of 16 bytes (LidarVector, LidarMatrix) are
+  ///* 16-byte aligned for SSE, which makes UKF and everything holding one
+  ///* over-aligned: allocate them with new (see
+  ///* EIGEN_MAKE_ALIGNED_OPERATOR_NEW below) or in a UKFVector, never with
+  ///* std::allocator or malloc.
+  typedef Eigen::Matrix<Scalar, n_x_, 1> StateVector;
+  typedef Eigen::Matrix<Scalar, n_x_, n_x_> StateMatrix;
+  typedef Eigen::Matrix<Scalar, n_aug_, 1> AugVector;
+  typedef Eigen::Matrix<Scalar, n_aug_, n_aug_> AugMatrix;
+  typedef Eigen::Matrix<Scalar, n_x_, n_sig_> SigmaMatrix;
+  typedef Eigen::Matrix<Scalar, n_aug_, n_sig_> AugSigmaMatrix;
+  typedef Eigen::Matrix<Scalar, n_sig_, 1> WeightVector;
+
+  ///* Columns of the augmented sigma points with non-zero noise rows: nu_a
+  ///* is +/- sigma_scale_ * std_a_ in nu_a_col_ and nu_a_col_ + n_aug_,
+  ///* nu_yawdd likewise in nu_yawdd_col_ and nu_yawdd_col_ + n_aug_. Row 5
+  ///* and 6 are zero everywhere else, which the prediction kernels exploit.
+  static const int nu_a_col_ = 1 + n_x_;
+  static const int nu_yawdd_col_ = 2 + n_x_;
+
+  ///* Number of spherical simplex sigma points (see SigmaPoints)
+  static const int n_sig_simplex_ = n_aug_ + 2;
+
+  ///* Lidar measurement dimension: px, py
+  static const int n_z_lidar_ = 2;
+
+  typedef Eigen::Matrix<Scalar, n_z_lidar_, 1> LidarVector;
+  typedef Eigen::Matrix<Scalar, n_z_lidar_, n_z_lidar_> LidarMatrix;
+
+  ///* Radar measurement dimension: r, phi, and r_dot
+  static const int n_z_radar_ = 3;
+
+  typedef Eigen::Matrix<Scalar, n_z_radar_, 1> RadarVector;
+  typedef Eigen::Matrix<Scalar, n_z_radar_, n_z_radar_> RadarMatrix;
+  typedef Eigen::Matrix<Scalar, n_z_radar_, n_sig_> RadarSigmaMatrix;
+
+  ///* Stacked radar + lidar measurement dimension: r, phi, r_dot, px, py
+  static const int n_z_fused_ = n_z_radar_ + n_z_lidar_;
+
+  typedef Eigen::Matrix<Scalar, n_z_fused_, 1> FusedVector;
+  typedef Eigen::Matrix<Scalar, n_z_fused_, n_z_fused_> FusedMatrix;
+  typedef Eigen::Matrix<Scalar, n_z_fused_, n_sig_> FusedSigmaMatrix;
+
+  /**
+   * What a caller needs after an update, in one fixed-size struct: the
+   * cartesian estimate plus the covariance diagonal and NIS for consumers
+   * that want them
+   */
+  struct Estimate {
+    ///* position in m and cartesian velocity in m/s
+    double px;
+    double py;
+    double vx;
+    double vy;
+    ///* variances of px, py, v, yaw and yawd, the diagonal of P_pred_
+    double p_diag[n_x_];
+    ///* NIS of the sensor's last update
+    double nis;
+  };
+
   ///* initially set to false, set to true in first call of ProcessMeasurement
   bool is_initialized_;
 
@@ -22,17 +105,90 @@ public:
   ///* if this is false, radar measurements will be ignored (except for init)
   bool use_radar_;
 
+  ///* if this is true, the square-root UKF propagates L_pred_ directly
+  bool use_sqrt_ukf_;
+
+  ///* if this is true, UpdateLidar uses the Joseph form
+  ///* (I - K H) P (I - K H)^T + K R K^T, which stays positive semi-definite
+  ///* for any K, instead of P - K H P
+  bool use_joseph_form_;
+
+  ///* if this is true, the radar bearing of each sigma point uses FastAtan2
+  ///* instead of std::atan2
+  bool radar_fast_atan2_;
+
+  ///* Implementation of the per-sigma-point kernels
+  enum KernelVariant {
+    SCALAR_KERNELS,
+    VECTOR_KERNELS
+  } kernels_;
+
+  ///* ISA-specific builds of the vector kernels and the mean and covariance
+  ///* reduction; UkfKernels::Selected() unless set otherwise
+  const UkfKernels *isa_kernels_;
+
+  ///* Motion model of the prediction (see motion_models.h)
+  enum MotionModel {
+    CTRV_MODEL,
+    CV_MODEL
+  } motion_model_;
+
+  ///* Sigma-point set. SYMMETRIC_POINTS is the scaled 2n + 1 set.
+  ///* CUBATURE_POINTS is the third-degree cubature rule, +/- sqrt(n) along
+  ///* each axis with weights 1 / 2n: the symmetric layout at lambda = 0, so
+  ///* it runs on the same kernels (and in square-root mode), its centre
+  ///* column weighing zero. No weight is negative, so P stays positive
+  ///* semi-definite where the default set's negative centre weight can
+  ///* break it. SIMPLEX_POINTS is the spherical simplex of n + 2 equally
+  ///* weighted points (Julier 2003) in the first n_sig_simplex_ columns;
+  ///* the remaining columns are zero with zero weights, so code written for
+  ///* all n_sig_ columns still gives its result, while generation,
+  ///* propagation, the reduction and the unscented update run on its 9
+  ///* columns only. alpha, beta and kappa only shape the symmetric set.
+  ///* Square-root mode uses the symmetric set in place of the simplex.
+  enum SigmaPoints {
+    SYMMETRIC_POINTS,
+    SIMPLEX_POINTS,
+    CUBATURE_POINTS
+  } sigma_points_;
+
+  ///* Columns of the sigma matrices in use: n_sig_ or n_sig_simplex_
+  int sigma_count_;
+
+  ///* Unit points of the simplex set, zero-padded: column i of the
+  ///* augmented sigma points is x_aug + L_aug * simplex_points_.col(i)
+  AugSigmaMatrix simplex_points_;
+
+  ///* Covariance the filter starts from (see UKFConfig::initial_covariance)
+  enum InitialCovariance {
+    ZERO_COVARIANCE,
+    SENSOR_COVARIANCE
+  } initial_covariance_;
+
+  ///* prior standard deviations of speed, yaw and yaw rate at initialisation
+  ///* with SENSOR_COVARIANCE
+  double init_std_v_;
+  double init_std_yaw_;
+  double init_std_yawd_;
+
+  ///* Filter storage. Public for the stage benchmarks, which drive the
+  ///* pipeline step by step; everything else goes through the accessors
+  ///* below (x(), P(), SetState, ...) so the layout can change.
+
   ///* state vector: [pos1 pos2 vel_abs yaw_angle yaw_rate] in SI units and rad
-  VectorXd x_pred_;
+  StateVector x_pred_;
 
   ///* state covariance matrix
-  MatrixXd P_pred_;
+  StateMatrix P_pred_;
+
+  ///* lower Cholesky factor of P_pred_, authoritative in square-root mode
+  StateMatrix L_pred_;
 
   ///* predicted sigma points matrix
-  MatrixXd Xsig_pred_;
+  SigmaMatrix Xsig_pred_;
 
   ///* time when the state is true, in us
-  long long time_us_;
+  TimeUs time_us_;
 
   ///* Process noise standard deviation longitudinal acceleration in m/s^2
   double std_a_;
@@ -55,65 +211,540 @@ public:
   ///* Radar measurement noise standard deviation radius change in m/s
   double std_radrd_ ;
 
-  ///* Weights of sigma points
-  VectorXd weights_;
+  ///* measurement noise variances, the diagonals of R; rebuilt from the
+  ///* std members by UpdateNoise
+  LidarVector lidar_noise_;
+  RadarVector radar_noise_;
 
-  ///* State dimension
-  int n_x_;
+  ///* Weights of sigma points for the mean
+  WeightVector weights_;
 
-  ///* Augmented state dimension
-  int n_aug_;
+  ///* Weights of sigma points for the covariance
+  WeightVector weights_c_;
 
   ///* Sigma point spreading parameter
   double lambda_;
 
-  long long previous_timestamp_;
+  ///* Scaled UKF parameters: spread alpha, prior knowledge beta, kappa
+  double alpha_;
+  double beta_;
+  double kappa_;
+
+  ///* Sigma point column scale sqrt(lambda_ + n_aug_)
+  Scalar sigma_scale_;
+
+  TimeUs previous_timestamp_;
+
+  ///* longest single CTRV step in s; longer gaps are predicted as equal
+  ///* sub-steps no longer than this. 0 predicts any gap in one step.
+  double max_predict_step_;
 
   // augmented sigma point matrix
-  MatrixXd Xsig_aug;
+  AugSigmaMatrix Xsig_aug;
 
   // augmented mean vector
-  VectorXd x_aug;
-
-  // augmented state covariance
-  MatrixXd P_aug;
+  AugVector x_aug;
+
+  ///* innovation of the last lidar update and the lower Cholesky factor of
+  ///* its covariance S, reusable for gating and NIS without another solve
+  LidarVector z_diff_lidar_;
+  LidarMatrix S_lidar_factor_;
+
+  ///* innovation of the last radar update and the factor of its S
+  RadarVector z_diff_radar_;
+  RadarMatrix S_radar_factor_;
+
+  ///* times the prediction found P_pred_ not positive definite and repaired
+  ///* it (symmetrised, jittered, refactored with LDLT)
+  unsigned long long covariance_repairs_;
+
+  ///* Normalized Innovation Squared of the last lidar and radar updates,
+  ///* z_diff^T S^-1 z_diff from the kept factors
+  double nis_lidar_;
+  double nis_radar_;
+
+  ///* Chi-square consistency of one sensor's updates: a consistent filter
+  ///* exceeds the 95% bound (5.991 for 2 dof, 7.815 for 3) about 5% of the
+  ///* time; much more means the noise is set too low, much less too high
+  struct NisCounter {
+    unsigned long long updates;
+    unsigned long long exceeded;
+    ///* measurements not fused because their NIS was above the gate
+    unsigned long long rejected;
+    ///* sum of the NIS of every update, for the mean
+    double nis_sum;
+
+    double ExceededFraction() const {
+      return updates ? static_cast<double>(exceeded) / updates : 0.0;
+    }
+
+    ///* mean NIS; a consistent filter averages the measurement dimension
+    double Average() const { return updates ? nis_sum / updates : 0.0; }
+  };
+  NisCounter nis_counter_lidar_;
+  NisCounter nis_counter_radar_;
+
+  ///* chi-square gates: a measurement whose NIS exceeds its sensor's gate is
+  ///* rejected before the gain and covariance update. 0 fuses everything.
+  ///* The first gate_warmup_ updates are never gated, since S is not
+  ///* meaningful until the filter has converged from its initial P.
+  double gate_lidar_;
+  double gate_radar_;
+  int gate_warmup_;
+
+  ///* Adaptive process noise (innovation-based covariance matching): after
+  ///* each fused update past the gate warm-up, the process noise variance
+  ///* scale moves by adaptive_rate_ * (NIS / dof - 1), clamped to
+  ///* [1 / adaptive_limit_, adaptive_limit_]. A consistent filter has
+  ///* E[NIS] = dof, so the scale settles where the innovations match S.
+  ///* The sigma points use std_a_ and std_yawdd_ times noise_std_scale_,
+  ///* sqrt(noise_scale_); std_a_ and std_yawdd_ stay as configured.
+  ///* adaptive_rate_ 0 keeps the noise fixed.
+  double adaptive_rate_;
+  double adaptive_limit_;
+  double noise_scale_;
+  Scalar noise_std_scale_;
+
+  ///* UKF/EKF switching: a prediction step whose heading spread,
+  ///* sqrt(var(yaw + yawd dt)), is at most ekf_angle_ is taken with the
+  ///* motion model's Jacobians (PredictionEkf) instead of sigma points.
+  ///* Xsig_pred_ is then stale, so a following radar update either takes
+  ///* the EKF form too, if the bearing spread of the position and the
+  ///* heading spread are within ekf_angle_, or redraws the sigma points.
+  ///* Tracks switch back as soon as their spread grows. ekf_angle_ 0
+  ///* always uses sigma points, as does square-root mode.
+  double ekf_angle_;
+  bool ekf_predicted_;
+
+  ///* prediction steps and radar updates taken in EKF form
+  unsigned long long ekf_predictions_;
+  unsigned long long ekf_radar_updates_;
+
+  ///* Steady-state lidar gain: a lidar-only track at a constant rate ends
+  ///* up with the same prior, gain and posterior P at every step. After
+  ///* kSteadySteps consecutive full lidar updates at one interval whose
+  ///* posterior P moved by at most steady_state_tolerance_ times its
+  ///* largest entry, the gain and covariances are kept and each further
+  ///* lidar measurement at that interval takes the noise-free motion model
+  ///* for the mean and x + K nu, leaving P at steady_P_; Xsig_pred_ is then
+  ///* stale, as after an EKF step. A radar measurement, another interval or
+  ///* a gated-out measurement falls back to the full filter from the kept
+  ///* P. steady_state_tolerance_ 0 is off; square-root mode and adaptive
+  ///* noise never cache.
+  static const int kSteadySteps = 3;
+  double steady_state_tolerance_;
+  bool steady_;
+  int steady_count_;
+  TimeUs steady_gap_;
+  StateMatrix steady_P_;
+  StateMatrix steady_prior_;
+  LidarMatrix steady_S_factor_;
+  Eigen::Matrix<Scalar, n_x_, n_z_lidar_> steady_K_;
+
+  ///* lidar updates taken with the cached gain
+  unsigned long long steady_updates_;
+
+  ///* A measurement and the posterior the filter held after fusing it
+  struct Snapshot {
+    Measurement meas;
+    StateVector x;
+    StateMatrix P;
+    StateMatrix L;
+  };
+
+  ///* past measurements in timestamp order, newest last; out-of-sequence
+  ///* handling is off while history_depth_ is 0
+  int history_depth_;
+  RingBuffer<Snapshot> history_;
+
+  ///* measurements re-fused after a late one, sized with the history
+  std::vector<Measurement> replay_;
+
+  ///* late measurements fused by rolling back, and late measurements older
+  ///* than the whole history that were dropped
+  unsigned long long oosm_fused_;
+  unsigned long long oosm_dropped_;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   /**
    * Constructor
    */
   UKF();
 
+  /**
+   * Constructor from a config
+   * @param config Noise levels, scaling and modes
+   */
+  explicit UKF(const UKFConfig &config);
+
   /**
    * Destructor
    */
   virtual ~UKF();
 
+  /**
+   * Returns the filter to its uninitialised state in place, keeping the
+   * configuration and all storage, so a pooled filter can start a new
+   * track without allocating
+   */
+  void Reset();
+
+  /**
+   * Applies a config and rebuilds the noise and weight tables. The state is
+   * kept, so this also retunes a running filter; the out-of-sequence
+   * history is only reset if its depth changes.
+   * @param config Noise levels, scaling and modes
+   */
+  void Configure(const UKFConfig &config);
+
+  /**
+   * The current settings as a config
+   */
+  UKFConfig Config() const;
+
+  /**
+   * Rebuilds lidar_noise_ and radar_noise_ from the std members. Must be
+   * called after changing those directly.
+   */
+  void UpdateNoise();
+
+  /**
+   * Sets the scaled UKF parameters and rebuilds the weight table.
+   * lambda = alpha^2 * (n_aug + kappa) - n_aug
+   * @param alpha Spread of the sigma points around the mean
+   * @param beta Prior knowledge of the distribution (2 is optimal for
+   * Gaussians)
+   * @param kappa Secondary scaling parameter
+   */
+  void SetScaling(double alpha, double beta, double kappa);
+
+  /**
+   * Rebuilds weights_, weights_c_, sigma_scale_, sigma_count_ and
+   * simplex_points_ from sigma_points_, lambda_, alpha_ and beta_. Must be
+   * called after changing lambda_ or sigma_points_ directly.
+   */
+  void UpdateWeights();
+
   /**
    * ProcessMeasurement
+   * Once the filter is initialised this performs no heap allocations; build
+   * with UKF_COUNT_ALLOCATIONS and use AllocScope to check it. The
+   * MeasurementPackage overloads copy into a Measurement and forward.
+   * @param meas_package The latest measurement data of either radar or laser
+   */
+  void ProcessMeasurement(const Measurement &meas_package);
+  void ProcessMeasurement(const MeasurementPackage &meas_package);
+
+  /**
+   * ProcessMeasurement, returning the estimate after it
    * @param meas_package The latest measurement data of either radar or laser
+   * @param estimate Filled from the updated state; nis is that sensor's
    */
-  void ProcessMeasurement(MeasurementPackage meas_package);
+  void ProcessMeasurement(const Measurement &meas_package, Estimate *estimate);
+
+  /**
+   * ProcessMeasurement of values in external memory, e.g. an Eigen::Map
+   * over a measurement ring slot or a shared-memory record, with no
+   * MeasurementPackage or VectorXd built in between
+   * @param sensor Sensor of the measurement
+   * @param timestamp Measurement time in us
+   * @param z Its values: px, py for lidar, rho, phi, rho_dot for radar
+   * (at least that many; any more are ignored)
+   * @param estimate If not null, filled as by GetEstimate after the update
+   */
+  void ProcessMeasurement(MeasurementPackage::SensorType sensor,
+                          TimeUs timestamp,
+                          const Eigen::Ref<const Eigen::VectorXd> &z,
+                          Estimate *estimate = nullptr);
+
+  /**
+   * The current estimate, without touching the filter
+   * @param sensor Sensor whose last NIS is reported
+   * @param estimate Filled from x_pred_ and P_pred_
+   */
+  void GetEstimate(MeasurementPackage::SensorType sensor,
+                   Estimate *estimate) const;
+
+  /**
+   * Writes the posterior straight into external memory, e.g. Eigen::Maps
+   * over a shared-memory slot or the next stage's buffers
+   * @param x [px, py, v, yaw, yawd]
+   * @param P Its covariance, row major as C and NumPy callers store it
+   */
+  void ExportState(
+      Eigen::Ref<Eigen::Matrix<double, n_x_, 1> > x,
+      Eigen::Ref<Eigen::Matrix<double, n_x_, n_x_, Eigen::RowMajor>, 0,
+                 Eigen::OuterStride<> > P) const;
+
+  /**
+   * Writes the [px, py, vx, vy] estimate into external memory
+   */
+  void ExportEstimate(Eigen::Ref<Eigen::Vector4d> estimate) const;
+
+  /**
+   * Views of the posterior after the last measurement
+   */
+  const StateVector &x() const { return x_pred_; }
+  const StateMatrix &P() const { return P_pred_; }
+
+  ///* timestamp of the last measurement in us, and whether there was one
+  TimeUs timestamp() const { return previous_timestamp_; }
+  bool initialized() const { return is_initialized_; }
+
+  ///* NIS of the last update of a sensor, gated out or not
+  double nis(MeasurementPackage::SensorType sensor) const {
+    return sensor == MeasurementPackage::RADAR ? nis_radar_ : nis_lidar_;
+  }
+
+  ///* heap bytes of the out-of-sequence history, beyond sizeof(UKF)
+  size_t MemoryBytes() const {
+    return history_.MemoryBytes() + replay_.capacity() * sizeof(Measurement);
+  }
+
+  ///* sigma-point weights for the mean and the covariance
+  const WeightVector &weights() const { return weights_; }
+  const WeightVector &weights_c() const { return weights_c_; }
+
+  /**
+   * Replaces the posterior, e.g. for IMM mixing or a restart, and marks the
+   * filter initialised. In square-root mode the factor is rebuilt from P.
+   * @param x State
+   * @param P State covariance
+   * @param timestamp Time of the state in us
+   */
+  void SetState(const StateVector &x, const StateMatrix &P,
+                TimeUs timestamp);
+
+  /**
+   * Processes measurements that share one timestamp. A radar + lidar pair is
+   * fused in a single stacked 5-dimensional update from one set of
+   * predicted sigma points; any other mix (and everything in square-root or
+   * out-of-sequence mode) is processed one by one.
+   * @param measurements First measurement of the group
+   * @param count Number of measurements, all with the same timestamp
+   */
+  void ProcessMeasurementGroup(const Measurement *measurements, size_t count);
+
+  /**
+   * Keeps the last depth measurements with their posteriors, so that a
+   * measurement older than the latest one is fused by restoring the newest
+   * snapshot before it and re-fusing the measurements after it, instead of
+   * predicting backwards. Allocates; call before filtering. 0 turns
+   * out-of-sequence handling off.
+   * @param depth Measurements kept
+   */
+  void SetHistoryDepth(int depth);
+
+  /**
+   * Processes a contiguous run of measurements in order
+   * @param measurements First measurement
+   * @param count Number of measurements
+   */
+  void ProcessMeasurements(const Measurement *measurements, size_t count);
+
+  /**
+   * Sets x_pred_ and P_pred_ from a first measurement. With
+   * SENSOR_COVARIANCE the position block is the sensor noise (for radar
+   * mapped through the polar-to-cartesian Jacobian), a radar range rate
+   * gives the initial speed along the line of sight, and the rest comes
+   * from the init_std_* priors.
+   * @param meas_package First measurement of the track
+   */
+  void Initialize(const Measurement &meas_package);
+
+  /**
+   * Predicts to the measurement time and fuses it, without looking at the
+   * history
+   * @param meas_package A measurement not older than previous_timestamp_
+   */
+  void FuseMeasurement(const Measurement &meas_package);
+
+  /**
+   * Predicts the state delta_t ahead, in sub-steps of at most
+   * max_predict_step_, using the square-root form if use_sqrt_ukf_ is set
+   * @param delta_t Time since the last update in s; a negative gap is
+   * predicted backwards in one step
+   */
+  void PredictInSteps(double delta_t);
+
+  /**
+   * Zero-time prediction for a measurement taken at the same instant as the
+   * last one: the state and covariance stay as they are, and Xsig_pred_ is
+   * rebuilt from the posterior so a sigma-point update can follow
+   */
+  void RefreshSigmaPoints();
+
+  /**
+   * Counts the NIS of the last update of one sensor against the 95%
+   * chi-square bound
+   * @param sensor Sensor that was just updated
+   * @param fused false if the gate rejected the measurement
+   */
+  void CountNis(MeasurementPackage::SensorType sensor, bool fused);
+
+  /**
+   * One O(1) step of the adaptive process noise from a fused update's NIS
+   * @param nis NIS of the update
+   * @param dof Measurement dimension
+   */
+  void AdaptNoise(double nis, int dof);
+
+  /**
+   * Whether a measurement with this NIS is rejected
+   * @param nis NIS of the innovation
+   * @param gate The sensor's gate
+   */
+  bool GatedOut(double nis, double gate) const {
+    return gate > 0.0 && nis > gate &&
+           nis_counter_lidar_.updates + nis_counter_radar_.updates >=
+               static_cast<unsigned long long>(gate_warmup_);
+  }
+
+  /**
+   * Whether the state is finite and P_pred_ has no negative variance
+   */
+  bool Healthy() const;
+
+  /**
+   * A square root of P_pred_ for the sigma points: its Cholesky factor, or,
+   * if LLT fails on a non-zero P_pred_, a pivoted LDLT factor of P_pred_
+   * symmetrised and jittered, with negative pivots clamped to zero.
+   * P_pred_ is replaced by the repaired matrix and covariance_repairs_
+   * counts the repair.
+   */
+  StateMatrix CovarianceFactor();
 
   /**
    * Creates sigma points
    * @param Xsig_out Reference to state mean
    */
-  void GenerateSigmaPoints(MatrixXd* Xsig_out);
+  void GenerateSigmaPoints(AugSigmaMatrix* Xsig_out);
+
+  /**
+   * Creates sigma points from an existing lower factor of P_pred_
+   * @param L Lower Cholesky factor of P_pred_
+   * @param Xsig_out Augmented sigma points, filled in place
+   */
+  void GenerateSigmaPoints(const StateMatrix &L, AugSigmaMatrix* Xsig_out);
 
   /**
    * Predicts Sigma Points
    * @param Xsig_out Reference to state mean
-   * @param n_aug_ Augmented state dimension
+   * @param n_aug Augmented state dimension
+   * @param delta_t Time difference since last measurement
+   */
+  void PredictSigmaPoints(SigmaMatrix *Xsig_out, int n_aug, double delta_t);
+
+  /**
+   * Scalar sigma-point prediction with the motion model inlined
+   * @param Xsig_out Predicted sigma points
+   * @param n_aug Augmented state dimension
+   * @param delta_t Time difference since last measurement
+   */
+  template <typename Model>
+  void PredictSigmaPointsWith(SigmaMatrix *Xsig_out, int n_aug, double delta_t);
+
+  /**
+   * Branch-free structure-of-arrays form of PredictSigmaPoints for CTRV,
+   * used when kernels_ is VECTOR_KERNELS
+   * @param Xsig_out Predicted sigma points
    * @param delta_t Time difference since last measurement
    */
-  void PredictSigmaPoints(MatrixXd *Xsig_out, int n_aug_, double delta_t);
+  void PredictSigmaPointsVectorized(SigmaMatrix *Xsig_out, double delta_t);
 
   /**
    * Predict Mean And Covariance
    * @param x_pred_out Reference to state mean
    * @param P_pred_out Reference to state covariance
    */
-  void PredictMeanAndCovariance(VectorXd* x_pred_out, MatrixXd* P_pred_out);
+  void PredictMeanAndCovariance(StateVector* x_pred_out, StateMatrix* P_pred_out);
+
+  /**
+   * Weighted mean and covariance of predicted sigma points, over the
+   * sigma_count_ columns in use
+   * @param Xsig Predicted sigma points
+   * @param x_out Mean
+   * @param P_out Covariance
+   */
+  void MeanAndCovariance(const SigmaMatrix &Xsig, StateVector *x_out,
+                         StateMatrix *P_out) const;
+
+  /**
+   * What-if prediction that leaves the filter untouched: one set of sigma
+   * points is drawn from the posterior and propagated to each horizon, so N
+   * horizons cost one factorisation and N propagations, with no UKF copy.
+   * Each horizon is predicted in one step from the posterior, without the
+   * max_predict_step_ sub-steps.
+   * @param horizons Times ahead of timestamp() in s
+   * @param count Number of horizons
+   * @param x_out count predicted states
+   * @param P_out count predicted covariances; may be nullptr
+   */
+  void PredictAhead(const double *horizons, int count, StateVector *x_out,
+                    StateMatrix *P_out) const;
+
+  ///* One point of a predicted trajectory
+  struct PredictedState {
+    TimeUs timestamp;
+    StateVector x;
+    StateMatrix P;
+  };
+
+  /**
+   * Predicts one trajectory through future timestamps in a single call,
+   * leaving the filter untouched. Unlike PredictAhead the horizons are
+   * chained: each is predicted from the previous one over the interval
+   * between them, with fresh sigma points per interval and the
+   * max_predict_step_ sub-steps, so it matches what the filter itself would
+   * predict.
+   * @param timestamps count increasing times in us, after timestamp()
+   * @param count Number of timestamps
+   * @param trajectory count predicted states, filled in order
+   */
+  void PredictTrajectory(const TimeUs *timestamps, int count,
+                         PredictedState *trajectory) const;
+
+  /**
+   * One unscented prediction of a given state with this filter's model,
+   * plus the cross-covariance of the state before and after it, as the RTS
+   * smoother needs (see RtsSmoother). Leaves the filter untouched.
+   * @param x State
+   * @param P State covariance
+   * @param delta_t Time step in s
+   * @param x_out Predicted state
+   * @param P_out Predicted covariance
+   * @param C_out Cross-covariance of x and the predicted state; nullptr
+   * skips it
+   */
+  void PredictFrom(const StateVector &x, const StateMatrix &P, double delta_t,
+                   StateVector *x_out, StateMatrix *P_out,
+                   StateMatrix *C_out) const;
+
+  /**
+   * Lower factor of the posterior covariance without repairing P_pred_: the
+   * kept factor in square-root mode, else a RobustLowerFactor of P_pred_
+   */
+  StateMatrix PosteriorFactor() const;
+
+  /**
+   * Augmented sigma points of a state and a factor of its covariance, see
+   * GenerateSigmaPoints
+   * @param x State
+   * @param L Lower factor of the state covariance
+   * @param Xsig_out Augmented sigma points
+   */
+  void SigmaPointsFrom(const StateVector &x, const StateMatrix &L,
+                       AugSigmaMatrix *Xsig_out) const;
+
+  /**
+   * The motion model step of PredictSigmaPoints on given sigma points
+   * @param Xsig_in Augmented sigma points
+   * @param delta_t Time step in s
+   * @param Xsig_out Predicted sigma points
+   */
+  void PropagateSigmaPoints(const AugSigmaMatrix &Xsig_in, double delta_t,
+                            SigmaMatrix *Xsig_out) const;
 
   /**
    * Prediction Predicts sigma points, the state, and the state covariance
@@ -122,17 +753,212 @@ public:
    */
   void Prediction(double delta_t);
 
+  /**
+   * Whether a prediction step of delta_t is near-linear, see ekf_angle_
+   * @param delta_t Time step in s
+   */
+  bool NearLinearMotion(double delta_t) const;
+
+  /**
+   * Whether the radar model is near-linear at the current estimate, see
+   * ekf_angle_
+   */
+  bool NearLinearRadar() const;
+
+  /**
+   * Extended Kalman prediction: the noise-free motion model for the mean
+   * and P = F P F^T + G Q G^T from its Jacobians. Leaves Xsig_pred_ stale.
+   * @param delta_t Time between k and k+1 in s
+   */
+  void PredictionEkf(double delta_t);
+
+  /**
+   * Extended Kalman radar update from the radar model's Jacobian, setting
+   * the same innovation, S factor and NIS as UpdateRadar
+   * @param meas_package The measurement at k+1
+   * @return false if the measurement was gated out
+   */
+  bool UpdateRadarEkf(const Measurement &meas_package);
+
+  /**
+   * Noise-free motion model prediction of the mean alone, in the same
+   * sub-steps as PredictInSteps; P_pred_ is left as it was
+   * @param delta_t Time between k and k+1 in s
+   */
+  void PredictMeanInSteps(double delta_t);
+
+  /**
+   * Sub-steps PredictInSteps and PredictMeanInSteps divide delta_t into
+   */
+  int PredictSteps(double delta_t) const;
+
+  /**
+   * Stamps the prediction of the measurement LatencyTrace is sampling
+   * @param gap Time predicted across
+   * @param steady Whether only the mean was predicted
+   */
+  void TracePrediction(TimeUs gap, bool steady) const;
+
+  /**
+   * Lidar update with the cached steady-state gain and covariance, setting
+   * the same innovation, S factor and NIS as UpdateLidar
+   * @param meas_package The measurement at k+1
+   * @return false if the measurement was gated out, which leaves the
+   * steady state
+   */
+  bool UpdateLidarSteady(const Measurement &meas_package);
+
+  /**
+   * Counts full lidar updates towards the steady state, and caches the
+   * gain once the posterior has settled; see steady_state_tolerance_
+   * @param gap Interval the update was predicted over
+   * @param fused Whether the measurement was fused
+   */
+  void TrackSteadyState(TimeUs gap, bool fused);
+
+  /**
+   * Drops the cached gain and the run of settled updates
+   */
+  void LeaveSteadyState();
+
   /**
    * Updates the state and the state covariance matrix using a laser measurement
    * @param meas_package The measurement at k+1
+   * @return false if the measurement was gated out; the innovation, S
+   * factor and NIS are set either way
    */
-  void UpdateLidar(MeasurementPackage meas_package);
+  bool UpdateLidar(const Measurement &meas_package);
+  bool UpdateLidar(const MeasurementPackage &meas_package);
 
   /**
    * Updates the state and the state covariance matrix using a radar measurement
    * @param meas_package The measurement at k+1
+   * @return false if the measurement was gated out
+   */
+  bool UpdateRadar(const Measurement &meas_package);
+  bool UpdateRadar(const MeasurementPackage &meas_package);
+
+  /**
+   * Updates the state with a radar and a lidar measurement taken at the
+   * same time, as one stacked measurement. Leaves both sensors'
+   * innovations, S factors and NIS set, as the separate updates do. Not
+   * gated.
+   * @param radar The radar measurement at k+1
+   * @param lidar The lidar measurement at k+1
+   */
+  void UpdateRadarLidar(const Measurement &radar, const Measurement &lidar);
+
+  /**
+   * Unscented update with a measurement model policy (see
+   * measurement_models.h, which defines this template)
+   * @param meas The measurement at k+1
+   * @param noise Measurement noise variances, diag(R)
+   * @param gate NIS above which the measurement is rejected; 0 for none
+   * @param z_diff_out Innovation
+   * @param S_factor_out Lower Cholesky factor of the innovation covariance
+   * @param nis_out NIS of the innovation
+   * @return false if the measurement was gated out
+   */
+  template <typename Model>
+  bool UpdateWithModel(
+      const Measurement &meas,
+      const Eigen::Matrix<Scalar, Model::kDim, 1> &noise,
+      double gate,
+      Eigen::Matrix<Scalar, Model::kDim, 1> *z_diff_out,
+      Eigen::Matrix<Scalar, Model::kDim, Model::kDim> *S_factor_out,
+      double *nis_out);
+
+  /**
+   * UpdateWithModel on the first N sigma points: n_sig_simplex_ for the
+   * simplex set, n_sig_ otherwise
+   */
+  template <typename Model, int N>
+  bool UpdateWithPoints(
+      const Measurement &meas,
+      const Eigen::Matrix<Scalar, Model::kDim, 1> &noise,
+      double gate,
+      Eigen::Matrix<Scalar, Model::kDim, 1> *z_diff_out,
+      Eigen::Matrix<Scalar, Model::kDim, Model::kDim> *S_factor_out,
+      double *nis_out);
+
+  /**
+   * NIS a measurement would have, without updating; the gating and
+   * association cost. The filter must be predicted to the measurement time.
+   * @param meas Candidate measurement
+   */
+  double MeasurementNis(const Measurement &meas) const;
+
+  /**
+   * MeasurementNis for a measurement model policy
+   * @param meas Candidate measurement
+   * @param noise Measurement noise variances, diag(R)
    */
-  void UpdateRadar(MeasurementPackage meas_package);
+  template <typename Model>
+  double NisWithModel(const Measurement &meas,
+                      const Eigen::Matrix<Scalar, Model::kDim, 1> &noise) const;
+
+  /**
+   * NisWithModel on the first N sigma points: n_sig_simplex_ for the
+   * simplex set, n_sig_ otherwise
+   */
+  template <typename Model, int N>
+  double NisWithPoints(
+      const Measurement &meas,
+      const Eigen::Matrix<Scalar, Model::kDim, 1> &noise) const;
+
+  /**
+   * The front half of UpdateWithModel, before it looks at the measurement,
+   * for associators that score or fuse many measurements against one
+   * prediction. The leading Model::kDim rows are used; the rest of z and K
+   * are zero and the rest of L is the identity.
+   * @param noise Measurement noise variances, diag(R)
+   * @param z Predicted measurement
+   * @param L Lower factor of the innovation covariance S
+   * @param K Kalman gain
+   */
+  template <typename Model>
+  void PredictMeasurement(
+      const Eigen::Matrix<Scalar, Model::kDim, 1> &noise, Eigen::Vector3d *z,
+      Eigen::Matrix3d *L, Eigen::Matrix<double, n_x_, 3> *K) const;
+
+  /**
+   * PredictMeasurement on the first N sigma points
+   */
+  template <typename Model, int N>
+  void PredictMeasurementWithPoints(
+      const Eigen::Matrix<Scalar, Model::kDim, 1> &noise, Eigen::Vector3d *z,
+      Eigen::Matrix3d *L, Eigen::Matrix<double, n_x_, 3> *K) const;
+
+  /**
+   * Transforms the predicted sigma points into radar measurement space
+   * @param Zsig_out Radar sigma points
+   */
+  void PredictRadarSigmaPoints(RadarSigmaMatrix* Zsig_out);
+
+  /**
+   * Square-root UKF prediction: builds the sigma points from L_pred_ and the
+   * noise standard deviations, then refactors with QR and a rank-1 update
+   * instead of a Cholesky of the augmented covariance
+   * @param delta_t Time between k and k+1 in s
+   */
+  void PredictionSqrt(double delta_t);
+
+  /**
+   * Square-root form of UpdateLidar, downdating L_pred_ directly
+   * @param meas_package The measurement at k+1
+   * @return false if the measurement was gated out
+   */
+  bool UpdateLidarSqrt(const Measurement &meas_package);
+
+  /**
+   * Square-root form of UpdateRadar, downdating L_pred_ directly
+   * @param meas_package The measurement at k+1
+   * @return false if the measurement was gated out
+   */
+  bool UpdateRadarSqrt(const Measurement &meas_package);
 };
 
+///* A vector of filters; std::allocator does not honour UKF's alignment
+typedef std::vector<UKF, Eigen::aligned_allocator<UKF> > UKFVector;
+
 #endif /* UKF_H */
@@ -0,0 +1,787 @@
+#include "ukf_bank.h"
+#include <algorithm>
+#include <cmath>
+#include "angle.h"
+#include "ego_motion.h"
+#include "ukf_kernels.h"
+
+using std::vector;
+
+const int UKFBank::n_x_;
+const int UKFBank::n_aug_;
+const int UKFBank::n_sig_;
+const int UKFBank::n_p_;
+
+namespace {
+
+// rows of per-track scratch needed by UpdateRadar: centred state and
+// measurement sigma deviations, S, Tc, gain and innovation
+const int kRadarScratchRows = UKF::n_x_ * UKF::n_sig_ + 3 * 9 + 3 * 5 * 2;
+
+// tracks in a row with one dt worth the shared-dt kernel
+const int kSharedDtRun = 8;
+
+// tracks predicted together through every phase: about 2 KB of rows per
+// track, so a tile's working set stays in L2
+const int kPredictTile = 128;
+
+/**
+ * End of the stretch of tracks starting at begin: a run of at least
+ * kSharedDtRun tracks with one dt, or the tracks up to the next such run
+ * @param delta_t Per-track time steps
+ * @param shared Set if the stretch is one run
+ */
+int NextStretch(const double *delta_t, int begin, int end, bool *shared) {
+  int i = begin;
+  while (i < end) {
+    int j = i + 1;
+    while (j < end && delta_t[j] == delta_t[i]) j++;
+    if (j - i >= kSharedDtRun) {
+      *shared = i == begin;
+      return *shared ? j : i;
+    }
+    i = j;
+  }
+  *shared = false;
+  return end;
+}
+
+// dt of each track read from its lane
+struct TrackDt {
+  const double *dt;
+  double Dt(int i) const { return dt[i]; }
+  double HalfDt2(int i) const { return 0.5 * dt[i] * dt[i]; }
+};
+
+// one dt shared by a range of tracks; its constants are loop invariants
+struct SharedDt {
+  double dt;
+  double half_dt2;
+  double Dt(int) const { return dt; }
+  double HalfDt2(int) const { return half_dt2; }
+};
+
+/**
+ * CTRV step of one sigma point across tracks [begin, end). kNoise is false
+ * for the 11 of 15 points with zero noise entries, which skip the noise
+ * terms instead of adding zeros.
+ * @param dt_of TrackDt or SharedDt
+ * @param x Rows of the track means
+ * @param Lc Rows of the factor column this point adds, or nullptr
+ * @param coef Sign times sigma scale of the column
+ * @param nu_a Acceleration noise of the point
+ * @param nu_yawdd Yaw acceleration noise of the point
+ * @param out Rows of the predicted sigma point
+ */
+template <bool kNoise, typename Dt>
+void PropagateTracks(const Dt &dt_of, const double *const *x,
+                     const double *const *Lc, double coef, double nu_a,
+                     double nu_yawdd, double *const *out, int begin,
+                     int end) {
+  for (int i = begin; i < end; i++) {
+    const double dt = dt_of.Dt(i);
+    double p_x = x[0][i];
+    double p_y = x[1][i];
+    double v = x[2][i];
+    double yaw = x[3][i];
+    double yawd = x[4][i];
+    if (Lc) {
+      p_x += coef * Lc[0][i];
+      p_y += coef * Lc[1][i];
+      v += coef * Lc[2][i];
+      yaw += coef * Lc[3][i];
+      yawd += coef * Lc[4][i];
+    }
+
+    double yaw_p = yaw + yawd * dt;
+    double sin_yaw, cos_yaw;
+    KernelMath::SinCos(yaw, &sin_yaw, &cos_yaw);
+
+    //branch-free blend of the turning and straight-line cases
+    bool turning = fabs(yawd) > 0.001;
+    double v_yawd = v / (turning ? yawd : 1.0);
+    double sin_yaw_p, cos_yaw_p;
+    KernelMath::SinCos(yaw_p, &sin_yaw_p, &cos_yaw_p);
+    double dx = turning ? v_yawd * (sin_yaw_p - sin_yaw) : v * dt * cos_yaw;
+    double dy = turning ? v_yawd * (cos_yaw - cos_yaw_p) : v * dt * sin_yaw;
+
+    if (kNoise) {
+      const double half_dt2 = dt_of.HalfDt2(i);
+      out[0][i] = p_x + dx + half_dt2 * nu_a * cos_yaw;
+      out[1][i] = p_y + dy + half_dt2 * nu_a * sin_yaw;
+      out[2][i] = v + nu_a * dt;
+      out[3][i] = yaw_p + half_dt2 * nu_yawdd;
+      out[4][i] = yawd + nu_yawdd * dt;
+    }
+    else {
+      out[0][i] = p_x + dx;
+      out[1][i] = p_y + dy;
+      out[2][i] = v;
+      out[3][i] = yaw_p;
+      out[4][i] = yawd;
+    }
+  }
+}
+
+}  // namespace
+
+/**
+ * Initializes the bank
+ * @param prototype Filter whose noise and weight configuration is used
+ * @param capacity Maximum number of tracks
+ */
+UKFBank::UKFBank(const UKF &prototype, int capacity, Sensors sensors)
+    : capacity_(capacity), size_(0), sensors_(sensors), pool_(0), grain_(64),
+      kernels_(&UkfKernels::Selected()) {
+  std_a_ = prototype.std_a_;
+  std_yawdd_ = prototype.std_yawdd_;
+  std_laspx_ = prototype.std_laspx_;
+  std_laspy_ = prototype.std_laspy_;
+  std_radr_ = prototype.std_radr_;
+  std_radphi_ = prototype.std_radphi_;
+  std_radrd_ = prototype.std_radrd_;
+  //the bank always draws the symmetric layout, so a simplex prototype
+  //lends its scaling through a symmetric copy
+  if (prototype.sigma_points_ == UKF::SIMPLEX_POINTS) {
+    UKFConfig config = prototype.Config();
+    config.sigma_points = UKF::SYMMETRIC_POINTS;
+    UKF symmetric;
+    symmetric.Configure(config);
+    sigma_scale_ = symmetric.sigma_scale_;
+    weights_ = symmetric.weights();
+    weights_c_ = symmetric.weights_c();
+  }
+  else {
+    sigma_scale_ = prototype.sigma_scale_;
+    weights_ = prototype.weights();
+    weights_c_ = prototype.weights_c();
+  }
+
+  x_.assign(n_x_ * capacity_, 0.0);
+  P_.assign(n_p_ * capacity_, 0.0);
+  Xsig_pred_.assign(n_x_ * n_sig_ * capacity_, 0.0);
+  L_.assign((n_p_ + 1) * capacity_, 0.0);
+  if (sensors_ != LIDAR_ONLY) {
+    gather_.assign(kRadarScratchRows * capacity_, 0.0);
+    zsig_.assign(3 * n_sig_ * capacity_, 0.0);
+  }
+  dt_.assign(capacity_, 0.0);
+  handle_of_.assign(capacity_, -1);
+  slot_of_.assign(capacity_, -1);
+  generations_.assign(capacity_, 0);
+  Clear();
+}
+
+UKFBank::~UKFBank() {}
+
+UKFBank::Sensors UKFBank::SensorsOf(const UKF &prototype) {
+  if (prototype.use_laser_ && !prototype.use_radar_) {
+    return LIDAR_ONLY;
+  }
+  if (prototype.use_radar_ && !prototype.use_laser_) {
+    return RADAR_ONLY;
+  }
+  return FUSED;
+}
+
+size_t UKFBank::MemoryBytes() const {
+  const size_t rows = x_.size() + P_.size() + Xsig_pred_.size() + L_.size() +
+                      gather_.size() + zsig_.size() + dt_.size();
+  const size_t table = handle_of_.size() + slot_of_.size() +
+                       free_handles_.capacity();
+  return rows * sizeof(double) + table * sizeof(int) +
+         generations_.size() * sizeof(unsigned);
+}
+
+int UKFBank::Add(const UKF::StateVector &x, const UKF::StateMatrix &P) {
+  if (size_ == capacity_) {
+    return -1;
+  }
+  int i = size_++;
+  SetState(i, x, P);
+  const int h = free_handles_.back();
+  free_handles_.pop_back();
+  ++generations_[h];
+  handle_of_[i] = h;
+  slot_of_[h] = i;
+  return i;
+}
+
+void UKFBank::Remove(int i) {
+  const int h = handle_of_[i];
+  ++generations_[h];
+  slot_of_[h] = -1;
+  free_handles_.push_back(h);
+  const int last = --size_;
+  if (i == last) {
+    return;
+  }
+  //the sigma points move too, so a radar update right after still applies
+  for (int r = 0; r < n_x_; r++) {
+    X(r, i) = X(r, last);
+  }
+  for (int r = 0; r < n_p_; r++) {
+    P_[r * capacity_ + i] = P_[r * capacity_ + last];
+  }
+  if (sensors_ != LIDAR_ONLY) {
+    for (int r = 0; r < n_x_ * n_sig_; r++) {
+      Xsig_pred_[r * capacity_ + i] = Xsig_pred_[r * capacity_ + last];
+    }
+  }
+  handle_of_[i] = handle_of_[last];
+  slot_of_[handle_of_[i]] = i;
+}
+
+void UKFBank::Clear() {
+  for (int i = 0; i < size_; i++) {
+    ++generations_[handle_of_[i]];
+    slot_of_[handle_of_[i]] = -1;
+  }
+  size_ = 0;
+  //entries are handed out lowest first
+  free_handles_.clear();
+  for (int h = capacity_; h-- > 0; ) {
+    free_handles_.push_back(h);
+  }
+}
+
+UKF::StateVector UKFBank::State(int i) const {
+  UKF::StateVector x;
+  for (int r = 0; r < n_x_; r++) {
+    x(r) = x_[r * capacity_ + i];
+  }
+  return x;
+}
+
+UKF::StateMatrix UKFBank::Covariance(int i) const {
+  UKF::StateMatrix P;
+  for (int r = 0; r < n_x_; r++) {
+    for (int c = r; c < n_x_; c++) {
+      P(r,c) = P(c,r) =
+          P_[PackedSymmetric<n_x_>::Index(r, c) * capacity_ + i];
+    }
+  }
+  return P;
+}
+
+void UKFBank::SetState(int i, const UKF::StateVector &x,
+                       const UKF::StateMatrix &P) {
+  for (int r = 0; r < n_x_; r++) {
+    X(r, i) = x(r);
+    for (int c = r; c < n_x_; c++) {
+      this->P(r, c, i) = P(r,c);
+    }
+  }
+}
+
+void UKFBank::SetThreadPool(ThreadPool *pool, int grain) {
+  pool_ = pool;
+  grain_ = grain;
+}
+
+void UKFBank::Prediction(const double *delta_t) {
+  if (pool_) {
+    pool_->ParallelFor(0, size_, grain_, [this, delta_t](int begin, int end) {
+      PredictRange(delta_t, begin, end);
+    });
+  }
+  else {
+    PredictRange(delta_t, 0, size_);
+  }
+}
+
+void UKFBank::UpdateRadar(const int *tracks, const double *z, int count) {
+  if (sensors_ == LIDAR_ONLY) {
+    return;
+  }
+  if (pool_) {
+    pool_->ParallelFor(0, count, grain_,
+                       [this, tracks, z, count](int begin, int end) {
+      UpdateRadarRange(tracks, z, count, begin, end);
+    });
+  }
+  else {
+    UpdateRadarRange(tracks, z, count, 0, count);
+  }
+}
+
+void UKFBank::UpdateLidar(const int *tracks, const double *z, int count) {
+  if (sensors_ == RADAR_ONLY) {
+    return;
+  }
+  if (pool_) {
+    pool_->ParallelFor(0, count, grain_, [this, tracks, z](int begin, int end) {
+      UpdateLidarRange(tracks, z, begin, end);
+    });
+  }
+  else {
+    UpdateLidarRange(tracks, z, 0, count);
+  }
+}
+
+void UKFBank::Update(const int *tracks,
+                     const MeasurementPackage::SensorType *sensors,
+                     const double *z, int count) {
+  switch (sensors_) {
+  case LIDAR_ONLY:
+    UpdateSensors<LIDAR_ONLY>(tracks, sensors, z, count);
+    break;
+  case RADAR_ONLY:
+    UpdateSensors<RADAR_ONLY>(tracks, sensors, z, count);
+    break;
+  default:
+    UpdateSensors<FUSED>(tracks, sensors, z, count);
+    break;
+  }
+}
+
+/**
+ * Update of a FUSED bank's batch bucketed by sensor, or of one sensor's
+ * measurements of a single-sensor batch, each bucket ordered by slot
+ */
+template <UKFBank::Sensors kSensors>
+void UKFBank::UpdateSensors(const int *tracks,
+                            const MeasurementPackage::SensorType *sensors,
+                            const double *z, int count) {
+  const bool take_radar = kSensors != LIDAR_ONLY;
+  const bool take_lidar = kSensors != RADAR_ONLY;
+  order_.clear();
+  for (int j = 0; j < count; j++) {
+    const bool radar = sensors[j] == MeasurementPackage::RADAR;
+    if (radar ? take_radar : take_lidar) {
+      order_.push_back(j);
+    }
+  }
+  if (kSensors == FUSED) {
+    std::sort(order_.begin(), order_.end(), [tracks, sensors](int a, int b) {
+      const bool radar_a = sensors[a] == MeasurementPackage::RADAR;
+      const bool radar_b = sensors[b] == MeasurementPackage::RADAR;
+      return radar_a != radar_b ? radar_a : tracks[a] < tracks[b];
+    });
+  }
+  else {
+    std::sort(order_.begin(), order_.end(), [tracks](int a, int b) {
+      return tracks[a] < tracks[b];
+    });
+  }
+  count = static_cast<int>(order_.size());
+
+  //radar measurements keep 3 values, lidar ones are packed to 2
+  sorted_tracks_.resize(count);
+  sorted_z_.resize(3 * count);
+  int radar = 0;
+  double *out = sorted_z_.data();
+  for (int k = 0; k < count; k++) {
+    const int j = order_[k];
+    const int n = kSensors == FUSED
+        ? (sensors[j] == MeasurementPackage::RADAR ? 3 : 2)
+        : (kSensors == RADAR_ONLY ? 3 : 2);
+    radar += n == 3;
+    sorted_tracks_[k] = tracks[j];
+    for (int v = 0; v < n; v++) {
+      *out++ = z[3 * j + v];
+    }
+  }
+  if (take_radar) {
+    UpdateRadar(sorted_tracks_.data(), sorted_z_.data(), radar);
+  }
+  if (take_lidar) {
+    UpdateLidar(sorted_tracks_.data() + radar, sorted_z_.data() + 3 * radar,
+                count - radar);
+  }
+}
+
+void UKFBank::Transform(const RigidTransform &transform) {
+  if (pool_) {
+    pool_->ParallelFor(0, size_, grain_,
+                       [this, &transform](int begin, int end) {
+      TransformRange(transform, begin, end);
+    });
+  }
+  else {
+    TransformRange(transform, 0, size_);
+  }
+}
+
+void UKFBank::Prediction(double delta_t) {
+  std::fill(dt_.begin(), dt_.begin() + size_, delta_t);
+  Prediction(dt_.data());
+}
+
+/**
+ * Predicts tracks [begin, end) tile by tile. Each phase reads what the one
+ * before it wrote, so with the whole range in one pass a large bank would
+ * stream every row through memory once per phase; a tile's rows are still
+ * in cache.
+ * @param delta_t Array of size() time steps in s
+ */
+void UKFBank::PredictRange(const double *delta_t, int begin, int end) {
+  for (int i = begin; i < end; i += kPredictTile) {
+    if (sensors_ == LIDAR_ONLY) {
+      PredictTile<false>(delta_t, i, std::min(i + kPredictTile, end));
+    }
+    else {
+      PredictTile<true>(delta_t, i, std::min(i + kPredictTile, end));
+    }
+  }
+}
+
+/**
+ * Predicts tracks [begin, end). The per-track Cholesky factors are computed
+ * first; then for each sigma point the CTRV step is evaluated across the
+ * range. Ranges touch disjoint lanes of every array, so they can run on
+ * different threads. Runs of tracks that share one dt, as fixed-rate
+ * sensors and Prediction(double) give, take the dt constants out of the
+ * track loop. Without kKeepSigma (no radar update will read them) the
+ * sigma points are centred in place instead of into the update scratch.
+ * @param delta_t Array of size() time steps in s
+ */
+template <bool kKeepSigma>
+void UKFBank::PredictTile(const double *delta_t, int begin, int end) {
+  const int cap = capacity_;
+
+  //factor the covariances lane-wise; L(r, c) with r >= c is stored at
+  //Index(c, r)
+  kernels_->batched_cholesky(&P_[0], &L_[0], cap, begin, end);
+  const double *zeros = &L_[n_p_ * cap];
+
+  const TrackDt track_dt = {delta_t};
+  const double *x[n_x_];
+  for (int r = 0; r < n_x_; r++) {
+    x[r] = &x_[r * cap];
+  }
+
+  for (int s = 0; s < n_sig_; s++) {
+    //which column of the augmented factor this sigma point uses, and its sign
+    int col = (s == 0) ? -1 : (s - 1) % n_aug_;
+    double sign = (s <= n_aug_) ? 1.0 : -1.0;
+    double coef = sign * sigma_scale_;
+    double nu_a = (col == 5) ? coef * std_a_ : 0.0;
+    double nu_yawdd = (col == 6) ? coef * std_yawdd_ : 0.0;
+    bool state_col = (col >= 0 && col < n_x_);
+    bool noise_col = col >= n_x_;
+
+    //column col of L, with the zero row above the diagonal
+    const double *Lc[n_x_];
+    for (int r = 0; r < n_x_; r++) {
+      Lc[r] = state_col && r >= col
+          ? &L_[PackedSymmetric<n_x_>::Index(col, r) * cap] : zeros;
+    }
+    double *out[n_x_];
+    for (int r = 0; r < n_x_; r++) {
+      out[r] = &Xsig_pred_[(r * n_sig_ + s) * cap];
+    }
+
+    const double *const *L = state_col ? Lc : nullptr;
+    for (int i = begin; i < end;) {
+      bool shared;
+      const int j = NextStretch(delta_t, i, end, &shared);
+      if (shared) {
+        const SharedDt shared_dt = {delta_t[i], 0.5 * delta_t[i] * delta_t[i]};
+        if (noise_col) {
+          PropagateTracks<true>(shared_dt, x, L, coef, nu_a, nu_yawdd, out, i,
+                                j);
+        }
+        else {
+          PropagateTracks<false>(shared_dt, x, L, coef, nu_a, nu_yawdd, out,
+                                 i, j);
+        }
+      }
+      else if (noise_col) {
+        PropagateTracks<true>(track_dt, x, L, coef, nu_a, nu_yawdd, out, i, j);
+      }
+      else {
+        PropagateTracks<false>(track_dt, x, L, coef, nu_a, nu_yawdd, out, i,
+                               j);
+      }
+      i = j;
+    }
+  }
+
+  //predicted state mean
+  for (int r = 0; r < n_x_; r++) {
+    double *xr = &x_[r * cap];
+    for (int i = begin; i < end; i++) xr[i] = 0.0;
+    for (int s = 0; s < n_sig_; s++) {
+      const double w = weights_(s);
+      const double *xs = &Xsig_pred_[(r * n_sig_ + s) * cap];
+      for (int i = begin; i < end; i++) xr[i] += w * xs[i];
+    }
+  }
+
+  //predicted state covariance from the centred deviations, which are
+  //written into the update scratch rows
+  double *Xd = kKeepSigma ? &gather_[0] : &Xsig_pred_[0];
+  for (int r = 0; r < n_x_; r++) {
+    const double *xr = &x_[r * cap];
+    for (int s = 0; s < n_sig_; s++) {
+      const double *xs = &Xsig_pred_[(r * n_sig_ + s) * cap];
+      double *d = &Xd[(r * n_sig_ + s) * cap];
+      for (int i = begin; i < end; i++) d[i] = xs[i] - xr[i];
+    }
+  }
+  for (int s = 0; s < n_sig_; s++) {
+    double *d = &Xd[(3 * n_sig_ + s) * cap];
+    for (int i = begin; i < end; i++) {
+      d[i] = NormalizeAngle(d[i]);
+    }
+  }
+  for (int r = 0; r < n_x_; r++) {
+    for (int c = r; c < n_x_; c++) {
+      double *prc = &P_[PackedSymmetric<n_x_>::Index(r, c) * cap];
+      for (int i = begin; i < end; i++) prc[i] = 0.0;
+      for (int s = 0; s < n_sig_; s++) {
+        const double w = weights_c_(s);
+        const double *dr = &Xd[(r * n_sig_ + s) * cap];
+        const double *dc = &Xd[(c * n_sig_ + s) * cap];
+        for (int i = begin; i < end; i++) prc[i] += w * dr[i] * dc[i];
+      }
+    }
+  }
+}
+
+/**
+ * Batched radar update. The listed tracks are gathered into dense scratch
+ * rows, the measurement model, S, Tc and a lane-wise 3x3 Cholesky solve are
+ * evaluated across them, and the results are scattered back.
+ */
+void UKFBank::UpdateRadarRange(const int *tracks, const double *z, int count,
+                               int begin, int end) {
+  const int n = count;
+
+  //scratch layout, each row count long
+  double *Xd = &gather_[0];                              //5 x 15 rows
+  double *S = Xd + n_x_ * n_sig_ * n;                    //3 x 3 rows
+  double *Lz = S + 9 * n;                                //3 x 3 rows
+  double *Tc = Lz + 9 * n;                               //5 x 3 rows
+  double *K = Tc + 15 * n;                               //5 x 3 rows
+  double *zd = K + 15 * n;                               //3 rows
+  double *Zd = &zsig_[0];                                //3 x 15 rows
+
+  //measurement model on the gathered sigma points
+  for (int s = 0; s < n_sig_; s++) {
+    double *rho = &Zd[(0 * n_sig_ + s) * n];
+    double *phi = &Zd[(1 * n_sig_ + s) * n];
+    double *rho_dot = &Zd[(2 * n_sig_ + s) * n];
+    for (int j = begin; j < end; j++) {
+      int t = tracks[j];
+      double p_x = Xsig(0, s, t);
+      double p_y = Xsig(1, s, t);
+      double v = Xsig(2, s, t);
+      double yaw = Xsig(3, s, t);
+      double sin_yaw, cos_yaw;
+      KernelMath::SinCos(yaw, &sin_yaw, &cos_yaw);
+      double r = KernelMath::Sqrt(p_x * p_x + p_y * p_y);
+      rho[j] = r;
+      phi[j] = KernelMath::Atan2(p_y, p_x);
+      rho_dot[j] = (p_x * cos_yaw * v + p_y * sin_yaw * v) / r;
+      for (int k = 0; k < n_x_; k++) {
+        Xd[(k * n_sig_ + s) * n + j] = Xsig(k, s, t) - X(k, t);
+      }
+    }
+  }
+
+  //centre the measurement sigma points and normalise angles
+  for (int m = 0; m < 3; m++) {
+    for (int j = begin; j < end; j++) zd[m * n + j] = 0.0;
+    for (int s = 0; s < n_sig_; s++) {
+      const double *row = &Zd[(m * n_sig_ + s) * n];
+      for (int j = begin; j < end; j++) zd[m * n + j] += weights_(s) * row[j];
+    }
+  }
+  for (int s = 0; s < n_sig_; s++) {
+    for (int m = 0; m < 3; m++) {
+      double *row = &Zd[(m * n_sig_ + s) * n];
+      for (int j = begin; j < end; j++) row[j] -= zd[m * n + j];
+    }
+    double *phi = &Zd[(1 * n_sig_ + s) * n];
+    double *yaw = &Xd[(3 * n_sig_ + s) * n];
+    for (int j = begin; j < end; j++) {
+      phi[j] = NormalizeAngle(phi[j]);
+      yaw[j] = NormalizeAngle(yaw[j]);
+    }
+  }
+
+  //innovation residual z - z_pred (zd held z_pred until here)
+  for (int j = begin; j < end; j++) {
+    for (int m = 0; m < 3; m++) {
+      zd[m * n + j] = z[3 * j + m] - zd[m * n + j];
+    }
+    zd[n + j] = NormalizeAngle(zd[n + j]);
+  }
+
+  //S and Tc as weighted sums over the sigma points
+  const double R[3] = {std_radr_ * std_radr_, std_radphi_ * std_radphi_,
+                       std_radrd_ * std_radrd_};
+  for (int a = 0; a < 3; a++) {
+    for (int b = 0; b < 3; b++) {
+      double *sab = &S[(a * 3 + b) * n];
+      for (int j = begin; j < end; j++) sab[j] = (a == b) ? R[a] : 0.0;
+      for (int s = 0; s < n_sig_; s++) {
+        const double w = weights_c_(s);
+        const double *za = &Zd[(a * n_sig_ + s) * n];
+        const double *zb = &Zd[(b * n_sig_ + s) * n];
+        for (int j = begin; j < end; j++) sab[j] += w * za[j] * zb[j];
+      }
+    }
+  }
+  for (int k = 0; k < n_x_; k++) {
+    for (int m = 0; m < 3; m++) {
+      double *tkm = &Tc[(k * 3 + m) * n];
+      for (int j = begin; j < end; j++) tkm[j] = 0.0;
+      for (int s = 0; s < n_sig_; s++) {
+        const double w = weights_c_(s);
+        const double *xk = &Xd[(k * n_sig_ + s) * n];
+        const double *zm = &Zd[(m * n_sig_ + s) * n];
+        for (int j = begin; j < end; j++) tkm[j] += w * xk[j] * zm[j];
+      }
+    }
+  }
+
+  //lane-wise 3x3 Cholesky of S
+  for (int j = begin; j < end; j++) {
+    double l00 = sqrt(S[0 * n + j]);
+    double l10 = S[3 * n + j] / l00;
+    double l20 = S[6 * n + j] / l00;
+    double l11 = sqrt(S[4 * n + j] - l10 * l10);
+    double l21 = (S[7 * n + j] - l20 * l10) / l11;
+    double l22 = sqrt(S[8 * n + j] - l20 * l20 - l21 * l21);
+    Lz[0 * n + j] = l00;
+    Lz[3 * n + j] = l10;
+    Lz[4 * n + j] = l11;
+    Lz[6 * n + j] = l20;
+    Lz[7 * n + j] = l21;
+    Lz[8 * n + j] = l22;
+  }
+
+  //K^T = S^-1 Tc^T by forward and back substitution, one state row at a time
+  for (int k = 0; k < n_x_; k++) {
+    for (int j = begin; j < end; j++) {
+      double l00 = Lz[0 * n + j], l10 = Lz[3 * n + j], l11 = Lz[4 * n + j];
+      double l20 = Lz[6 * n + j], l21 = Lz[7 * n + j], l22 = Lz[8 * n + j];
+      double y0 = Tc[(k * 3 + 0) * n + j] / l00;
+      double y1 = (Tc[(k * 3 + 1) * n + j] - l10 * y0) / l11;
+      double y2 = (Tc[(k * 3 + 2) * n + j] - l20 * y0 - l21 * y1) / l22;
+      double k2 = y2 / l22;
+      double k1 = (y1 - l21 * k2) / l11;
+      double k0 = (y0 - l10 * k1 - l20 * k2) / l00;
+      K[(k * 3 + 0) * n + j] = k0;
+      K[(k * 3 + 1) * n + j] = k1;
+      K[(k * 3 + 2) * n + j] = k2;
+    }
+  }
+
+  //scatter x += K * zd and P -= Tc * K^T (K * S * K^T == Tc * K^T)
+  for (int j = begin; j < end; j++) {
+    int t = tracks[j];
+    for (int r = 0; r < n_x_; r++) {
+      double dx = 0.0;
+      for (int m = 0; m < 3; m++) dx += K[(r * 3 + m) * n + j] * zd[m * n + j];
+      X(r, t) += dx;
+      for (int c = r; c < n_x_; c++) {
+        double dp = 0.0;
+        for (int m = 0; m < 3; m++) {
+          dp += Tc[(r * 3 + m) * n + j] * K[(c * 3 + m) * n + j];
+        }
+        P(r, c, t) -= dp;
+      }
+    }
+  }
+}
+
+/**
+ * Batched lidar update. The measurement model is linear in the position, so
+ * S is the top-left 2x2 block of P plus R and is inverted in closed form.
+ */
+void UKFBank::UpdateLidarRange(const int *tracks, const double *z, int begin,
+                               int end) {
+  const double r_px = std_laspx_ * std_laspx_;
+  const double r_py = std_laspy_ * std_laspy_;
+
+  for (int j = begin; j < end; j++) {
+    int t = tracks[j];
+    double s00 = P(0, 0, t) + r_px;
+    double s01 = P(0, 1, t);
+    double s11 = P(1, 1, t) + r_py;
+    double inv_det = 1.0 / (s00 * s11 - s01 * s01);
+    double i00 = s11 * inv_det;
+    double i01 = -s01 * inv_det;
+    double i11 = s00 * inv_det;
+
+    double y0 = z[2 * j] - X(0, t);
+    double y1 = z[2 * j + 1] - X(1, t);
+
+    //K = P H^T S^-1, where P H^T is the first two columns of P
+    double K0[n_x_], K1[n_x_], PH0[n_x_], PH1[n_x_];
+    for (int r = 0; r < n_x_; r++) {
+      PH0[r] = P(r, 0, t);
+      PH1[r] = P(r, 1, t);
+      K0[r] = PH0[r] * i00 + PH1[r] * i01;
+      K1[r] = PH0[r] * i01 + PH1[r] * i11;
+    }
+    for (int r = 0; r < n_x_; r++) {
+      X(r, t) += K0[r] * y0 + K1[r] * y1;
+      for (int c = r; c < n_x_; c++) {
+        P(r, c, t) -= K0[r] * PH0[c] + K1[r] * PH1[c];
+      }
+    }
+  }
+}
+
+/**
+ * Transforms tracks [begin, end). Every row is a contiguous run of lanes,
+ * so each statement below vectorises across tracks.
+ */
+void UKFBank::TransformRange(const RigidTransform &transform, int begin,
+                             int end) {
+  const int cap = capacity_;
+  const double c = transform.cos_theta, s = transform.sin_theta;
+  const double cc = c * c, ss = s * s, cs = c * s;
+  const double tx = transform.tx, ty = transform.ty;
+  const double theta = transform.theta;
+  typedef PackedSymmetric<n_x_> Packed;
+
+  double *px = &x_[0], *py = &x_[cap], *yaw = &x_[3 * cap];
+  for (int i = begin; i < end; i++) {
+    const double x0 = px[i], x1 = py[i];
+    px[i] = c * x0 - s * x1 + tx;
+    py[i] = s * x0 + c * x1 + ty;
+    yaw[i] = NormalizeAngle(yaw[i] + theta);
+  }
+
+  //R P R^T touches the position block and the position rows of the rest
+  double *p00 = &P_[Packed::Index(0, 0) * cap];
+  double *p01 = &P_[Packed::Index(0, 1) * cap];
+  double *p11 = &P_[Packed::Index(1, 1) * cap];
+  for (int i = begin; i < end; i++) {
+    const double a = p00[i], b = p01[i], d = p11[i];
+    p00[i] = cc * a - 2.0 * cs * b + ss * d;
+    p01[i] = cs * (a - d) + (cc - ss) * b;
+    p11[i] = ss * a + 2.0 * cs * b + cc * d;
+  }
+  for (int k = 2; k < n_x_; k++) {
+    double *p0k = &P_[Packed::Index(0, k) * cap];
+    double *p1k = &P_[Packed::Index(1, k) * cap];
+    for (int i = begin; i < end; i++) {
+      const double a = p0k[i], b = p1k[i];
+      p0k[i] = c * a - s * b;
+      p1k[i] = s * a + c * b;
+    }
+  }
+
+  //the sigma yaws are only used through wrapped differences, so a plain
+  //add keeps this loop free of libm calls
+  if (sensors_ == LIDAR_ONLY) {
+    return;
+  }
+  for (int sig = 0; sig < n_sig_; sig++) {
+    double *sx = &Xsig(0, sig, 0), *sy = &Xsig(1, sig, 0);
+    double *syaw = &Xsig(3, sig, 0);
+    for (int i = begin; i < end; i++) {
+      const double x0 = sx[i], x1 = sy[i];
+      sx[i] = c * x0 - s * x1 + tx;
+      sy[i] = s * x0 + c * x1 + ty;
+      syaw[i] += theta;
+    }
+  }
+}
@@ -0,0 +1,303 @@
+#ifndef UKF_BANK_H_
+#define UKF_BANK_H_
+
+#include "huge_pages.h"
+#include "packed_symmetric.h"
+#include "thread_pool.h"
+#include "ukf.h"
+#include <cstddef>
+#include <vector>
+
+struct RigidTransform;
+struct UkfKernels;
+
+/**
+ * A bank of CTRV unscented Kalman filters stored as structure of arrays.
+ *
+ * Every scalar of every track lives in its own row of length capacity(), so
+ * element (r) of track i is x_[r * capacity_ + i]. The batched kernels loop
+ * over tracks in the innermost loop, which lets the CTRV and radar models
+ * vectorise across tracks instead of across the 15 sigma points.
+ * Covariances and their Cholesky factors keep only one triangle
+ * (PackedSymmetric), 15 rows per track instead of 25. The factors are
+ * computed the same way, across tracks in SIMD lanes (BatchedCholesky, in
+ * the widest ISA of UkfKernels), rather than with one llt() per track.
+ *
+ * Noise parameters and sigma-point weights are taken from a prototype UKF
+ * at construction and shared by all tracks. The bank always uses the
+ * symmetric (or cubature) layout; a simplex prototype gets the symmetric
+ * set with its scaling.
+ *
+ * Live tracks always fill slots [0, size()): Remove moves the last track
+ * into the hole, so the kernels never sweep dead slots. A slot therefore
+ * names a track only until the next Remove; a Handle names it for life,
+ * through an indirection that follows the moves, and goes stale, carrying
+ * an old generation, once the track is removed.
+ *
+ * A bank of one sensor's tracks leaves the other sensor out (see Sensors):
+ * its update paths are instantiated for the one sensor, and a lidar-only
+ * bank keeps neither the predicted sigma points nor the radar scratch
+ * between calls, 112 rows per track instead of 289.
+ */
+class UKFBank {
+public:
+  static const int n_x_ = UKF::n_x_;
+  static const int n_aug_ = UKF::n_aug_;
+  static const int n_sig_ = UKF::n_sig_;
+  static const int n_p_ = PackedSymmetric<n_x_>::kSize;
+
+  /**
+   * A track's entry in the handle table and the entry's generation, which
+   * is odd while the track is live and counts up when one is added or
+   * removed
+   */
+  struct Handle {
+    int index;
+    unsigned generation;
+  };
+
+  /**
+   * The measurements a bank takes; a single-sensor bank ignores the other
+   * sensor's
+   */
+  enum Sensors {
+    FUSED,
+    LIDAR_ONLY,
+    RADAR_ONLY
+  };
+
+  /**
+   * Constructor
+   * @param prototype Filter whose noise and weight configuration is used
+   * @param capacity Maximum number of tracks
+   * @param sensors Measurements the tracks take
+   */
+  UKFBank(const UKF &prototype, int capacity, Sensors sensors = FUSED);
+
+  /**
+   * Destructor
+   */
+  virtual ~UKFBank();
+
+  /**
+   * Adds a track
+   * @param x Initial state
+   * @param P Initial covariance
+   * @return Slot of the new track, or -1 if the bank is full
+   */
+  int Add(const UKF::StateVector &x, const UKF::StateMatrix &P);
+
+  /**
+   * Removes a track; the last track moves into its slot
+   * @param i Track slot
+   */
+  void Remove(int i);
+
+  /**
+   * Removes all tracks
+   */
+  void Clear();
+
+  /**
+   * The handle of the track in a slot
+   */
+  Handle HandleOf(int i) const {
+    Handle handle = {handle_of_[i], generations_[handle_of_[i]]};
+    return handle;
+  }
+
+  /**
+   * @return The track's current slot, or -1 if it has been removed
+   */
+  int Slot(Handle handle) const {
+    if (handle.index < 0 || handle.index >= capacity_ ||
+        generations_[handle.index] != handle.generation) {
+      return -1;
+    }
+    return slot_of_[handle.index];
+  }
+
+  int size() const { return size_; }
+  int capacity() const { return capacity_; }
+  Sensors sensors() const { return sensors_; }
+
+  /**
+   * The sensor set of a filter's use_laser_ and use_radar_, so a bank made
+   * from a filter's configuration fuses the measurements the filter does.
+   * The exception is a filter with both off, which fuses nothing after
+   * initialisation: Sensors has no empty set, so it gets FUSED, and a
+   * bank from such a configuration fuses both sensors.
+   */
+  static Sensors SensorsOf(const UKF &prototype);
+
+  /**
+   * Bytes of the bank's rows and handle table
+   */
+  size_t MemoryBytes() const;
+
+  /**
+   * The bank's own state and packed covariance rows, for zero-copy views:
+   * element (r) of track i is states()[r * capacity() + i], and element
+   * (r, c) of its covariance is
+   * covariances()[PackedSymmetric<n_x_>::Index(r, c) * capacity() + i].
+   * Valid for the bank's lifetime.
+   */
+  const double *states() const { return x_.data(); }
+  const double *covariances() const { return P_.data(); }
+
+  /**
+   * Copies a track's state or covariance out of / into the bank
+   * @param i Track slot
+   */
+  UKF::StateVector State(int i) const;
+  UKF::StateMatrix Covariance(int i) const;
+  void SetState(int i, const UKF::StateVector &x, const UKF::StateMatrix &P);
+
+  /**
+   * Runs the batched kernels on a thread pool, split into chunks of grain
+   * tracks. Each track is computed by exactly one thread with the same
+   * arithmetic, so results do not depend on the thread count.
+   * @param pool Pool to use, or nullptr to run on the calling thread
+   * @param grain Tracks per chunk
+   */
+  void SetThreadPool(ThreadPool *pool, int grain);
+
+  /**
+   * Predicts every track by its own time step
+   * @param delta_t Array of size() time steps in s
+   */
+  void Prediction(const double *delta_t);
+
+  /**
+   * Predicts every track by the same time step
+   * @param delta_t Time step in s
+   */
+  void Prediction(double delta_t);
+
+  /**
+   * Radar update of a set of tracks from their last predicted sigma points.
+   * Each track may appear at most once per call. Does nothing in a
+   * lidar-only bank.
+   * @param tracks Track slots to update
+   * @param z Measurements, 3 consecutive values (rho, phi, rho_dot) per track
+   * @param count Number of tracks/measurements
+   */
+  void UpdateRadar(const int *tracks, const double *z, int count);
+
+  /**
+   * Lidar update of a set of tracks. Each track may appear at most once.
+   * Does nothing in a radar-only bank.
+   * @param tracks Track slots to update
+   * @param z Measurements, 2 consecutive values (px, py) per track
+   * @param count Number of tracks/measurements
+   */
+  void UpdateLidar(const int *tracks, const double *z, int count);
+
+  /**
+   * Update of a set of tracks from a mixed batch of radar and lidar
+   * measurements. The batch is bucketed by sensor and each bucket ordered
+   * by slot, so each kernel runs over one kind of measurement walking the
+   * rows forwards; the radar bucket goes first, as it reads the last
+   * predicted sigma points. A track may appear once per sensor. A
+   * single-sensor bank skips the bucketing and the other sensor's
+   * measurements.
+   * @param tracks Track slots to update
+   * @param sensors Sensor of each measurement
+   * @param z Measurements, 3 consecutive values per measurement, of which
+   * lidar uses the first 2
+   * @param count Number of measurements
+   */
+  void Update(const int *tracks, const MeasurementPackage::SensorType *sensors,
+              const double *z, int count);
+
+  /**
+   * Moves every track into another frame (see TransformBank): positions,
+   * yaws, the covariances and the last predicted sigma points, so an update
+   * after the transform uses sigma points in the new frame
+   * @param transform Transform to apply
+   */
+  void Transform(const RigidTransform &transform);
+
+private:
+  // rows of a large bank span many pages; see HugePages
+  typedef std::vector<double, HugePageAllocator<double> > Rows;
+
+  // kernels over the track (or measurement) index range [begin, end)
+  void PredictRange(const double *delta_t, int begin, int end);
+  template <bool kKeepSigma>
+  void PredictTile(const double *delta_t, int begin, int end);
+  void UpdateRadarRange(const int *tracks, const double *z, int count,
+                        int begin, int end);
+  void UpdateLidarRange(const int *tracks, const double *z, int begin,
+                        int end);
+  void TransformRange(const RigidTransform &transform, int begin, int end);
+
+  // Update for the measurements a bank of kSensors takes
+  template <Sensors kSensors>
+  void UpdateSensors(const int *tracks,
+                     const MeasurementPackage::SensorType *sensors,
+                     const double *z, int count);
+
+  // element accessors into the SoA rows
+  double &X(int r, int i) { return x_[r * capacity_ + i]; }
+  double &P(int r, int c, int i) {
+    return P_[PackedSymmetric<n_x_>::Index(r, c) * capacity_ + i];
+  }
+  double &Xsig(int r, int s, int i) {
+    return Xsig_pred_[(r * n_sig_ + s) * capacity_ + i];
+  }
+
+  int capacity_;
+  int size_;
+  Sensors sensors_;
+
+  // optional parallel execution
+  ThreadPool *pool_;
+  int grain_;
+
+  // the widest ISA's batched Cholesky
+  const UkfKernels *kernels_;
+
+  // noise and sigma-point configuration shared by all tracks
+  double std_a_;
+  double std_yawdd_;
+  double std_laspx_;
+  double std_laspy_;
+  double std_radr_;
+  double std_radphi_;
+  double std_radrd_;
+  double sigma_scale_;
+  UKF::WeightVector weights_;
+  UKF::WeightVector weights_c_;
+
+  // per-track state, packed covariance and predicted sigma points; in a
+  // lidar-only bank the sigma points are centred in place by Prediction
+  // and not kept
+  Rows x_;
+  Rows P_;
+  Rows Xsig_pred_;
+
+  // workspace: packed lower Cholesky factors for prediction, plus a row
+  // of zeros standing in for their upper triangle
+  Rows L_;
+
+  // workspace for batched updates, sized for capacity_ tracks; empty in a
+  // lidar-only bank
+  Rows gather_;
+  Rows zsig_;
+  Rows dt_;
+
+  // handle table: per slot its entry, per entry its slot (-1 if free) and
+  // generation, and the free entries
+  std::vector<int> handle_of_;
+  std::vector<int> slot_of_;
+  std::vector<unsigned> generations_;
+  std::vector<int> free_handles_;
+
+  // workspace for Update's sorted batch, grown to the largest batch
+  std::vector<int> order_;
+  std::vector<int> sorted_tracks_;
+  std::vector<double> sorted_z_;
+};
+
+#endif /* UKF_BANK_H_ */
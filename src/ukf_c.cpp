@@ -0,0 +1,187 @@
+#include "ukf_c.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include "ukf.h"
+#include "ukf_config.h"
+
+struct ukf_ctx {
+  UKFConfig config;
+  std::vector<std::unique_ptr<UKF> > tracks;
+};
+
+namespace {
+
+void SetError(const std::string &message, char *error, size_t error_size) {
+  if (error && error_size > 0) {
+    const size_t n = std::min(message.size(), error_size - 1);
+    memcpy(error, message.data(), n);
+    error[n] = '\0';
+  }
+}
+
+void FromEstimate(const UKF::Estimate &in, ukf_est_t *out) {
+  out->px = in.px;
+  out->py = in.py;
+  out->vx = in.vx;
+  out->vy = in.vy;
+  for (int i = 0; i < UKF::n_x_; i++) {
+    out->variance[i] = in.p_diag[i];
+  }
+  out->nis = in.nis;
+}
+
+// filters one measurement on one track
+int Process(UKF *ukf, const ukf_meas_t &meas, ukf_est_t *out) {
+  if (meas.sensor != UKF_LIDAR && meas.sensor != UKF_RADAR) {
+    return UKF_EINVAL;
+  }
+  UKF::Estimate e;
+  ukf->ProcessMeasurement(meas.sensor == UKF_RADAR
+                              ? MeasurementPackage::RADAR
+                              : MeasurementPackage::LASER,
+                          meas.timestamp_us,
+                          Eigen::Map<const Eigen::Vector3d>(meas.z), &e);
+  if (out) {
+    FromEstimate(e, out);
+  }
+  return UKF_OK;
+}
+
+}  // namespace
+
+static_assert(UKF::n_x_ == 5, "ukf_c.h hardcodes a 5-state filter");
+
+extern "C" {
+
+int ukf_api_version(void) {
+  return UKF_C_API_VERSION;
+}
+
+ukf_ctx *ukf_create(size_t tracks, const char *config_path, char *error,
+                    size_t error_size) {
+  if (tracks == 0) {
+    SetError("a context needs at least one track", error, error_size);
+    return nullptr;
+  }
+  try {
+    std::unique_ptr<ukf_ctx> ctx(new ukf_ctx());
+    std::string message;
+    if (config_path && !ctx->config.Load(config_path, &message)) {
+      SetError(message, error, error_size);
+      return nullptr;
+    }
+    ctx->tracks.reserve(tracks);
+    for (size_t i = 0; i < tracks; i++) {
+      ctx->tracks.emplace_back(new UKF(ctx->config));
+    }
+    return ctx.release();
+  }
+  catch (const std::exception &e) {
+    SetError(e.what(), error, error_size);
+    return nullptr;
+  }
+}
+
+void ukf_destroy(ukf_ctx *ctx) {
+  delete ctx;
+}
+
+int ukf_set(ukf_ctx *ctx, const char *key, double value) {
+  if (!ctx || !key) {
+    return UKF_EINVAL;
+  }
+  if (!ctx->config.Set(key, value)) {
+    return UKF_ECONFIG;
+  }
+  try {
+    for (size_t i = 0; i < ctx->tracks.size(); i++) {
+      ctx->tracks[i]->Configure(ctx->config);
+    }
+  }
+  catch (const std::exception &) {
+    return UKF_EINTERNAL;
+  }
+  return UKF_OK;
+}
+
+size_t ukf_tracks(const ukf_ctx *ctx) {
+  return ctx ? ctx->tracks.size() : 0;
+}
+
+int ukf_reset(ukf_ctx *ctx, size_t track) {
+  if (!ctx || track >= ctx->tracks.size()) {
+    return UKF_EINVAL;
+  }
+  ctx->tracks[track]->Reset();
+  return UKF_OK;
+}
+
+int ukf_process(ukf_ctx *ctx, const ukf_meas_t *meas, size_t n,
+                ukf_est_t *out) {
+  if (!ctx || (n > 0 && !meas)) {
+    return UKF_EINVAL;
+  }
+  try {
+    UKF *ukf = ctx->tracks[0].get();
+    for (size_t i = 0; i < n; i++) {
+      const int status = Process(ukf, meas[i], out ? out + i : nullptr);
+      if (status != UKF_OK) {
+        return status;
+      }
+    }
+  }
+  catch (const std::exception &) {
+    return UKF_EINTERNAL;
+  }
+  return UKF_OK;
+}
+
+int ukf_process_batch(ukf_ctx *ctx, const uint32_t *tracks,
+                      const ukf_meas_t *meas, size_t n, ukf_est_t *out) {
+  if (!ctx || (n > 0 && (!tracks || !meas))) {
+    return UKF_EINVAL;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (tracks[i] >= ctx->tracks.size()) {
+      return UKF_EINVAL;
+    }
+  }
+  try {
+    for (size_t i = 0; i < n; i++) {
+      const int status = Process(ctx->tracks[tracks[i]].get(), meas[i],
+                                 out ? out + i : nullptr);
+      if (status != UKF_OK) {
+        return status;
+      }
+    }
+  }
+  catch (const std::exception &) {
+    return UKF_EINTERNAL;
+  }
+  return UKF_OK;
+}
+
+int ukf_state(const ukf_ctx *ctx, size_t track, double x[5], double P[25],
+              int *initialized) {
+  if (!ctx || track >= ctx->tracks.size()) {
+    return UKF_EINVAL;
+  }
+  const UKF &ukf = *ctx->tracks[track];
+  double x_out[UKF::n_x_];
+  double P_out[UKF::n_x_ * UKF::n_x_];
+  Eigen::Map<Eigen::Matrix<double, UKF::n_x_, 1> > x_map(x ? x : x_out);
+  Eigen::Map<Eigen::Matrix<double, UKF::n_x_, UKF::n_x_, Eigen::RowMajor> >
+      P_map(P ? P : P_out);
+  ukf.ExportState(x_map, P_map);
+  if (initialized) {
+    *initialized = ukf.initialized() ? 1 : 0;
+  }
+  return UKF_OK;
+}
+
+}  // extern "C"
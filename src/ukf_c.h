@@ -0,0 +1,116 @@
+#ifndef UKF_C_H_
+#define UKF_C_H_
+
+/*
+ * C interface to the filter, for embedding it in C code or behind any FFI.
+ *
+ * Everything crossing the interface is plain C: a context is an opaque
+ * handle, and measurements, estimates and states are POD structs and
+ * arrays owned by the caller, read and written in place, so no C++ type
+ * or allocation is visible to the caller. A context holds a fixed number
+ * of independent tracks, each one filter, all with the same settings.
+ *
+ * Functions return UKF_OK or a negative UKF_E* code; none throws. A
+ * context is not thread safe, but separate contexts may be used from
+ * separate threads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UKF_C_API_VERSION 1
+
+enum {
+  UKF_OK = 0,
+  /* a null pointer, an unknown sensor or a track out of range */
+  UKF_EINVAL = -1,
+  /* an unknown setting, or a config file that did not load */
+  UKF_ECONFIG = -2,
+  /* out of memory, or an unexpected failure inside the filter */
+  UKF_EINTERNAL = -3
+};
+
+enum {
+  UKF_LIDAR = 0,
+  UKF_RADAR = 1
+};
+
+/* one measurement: lidar z = (px, py, unused), radar z = (rho, phi,
+ * rho_dot) */
+typedef struct {
+  int64_t timestamp_us;
+  int32_t sensor;
+  double z[3];
+} ukf_meas_t;
+
+/* the estimate after a measurement */
+typedef struct {
+  /* position in m and cartesian velocity in m/s */
+  double px;
+  double py;
+  double vx;
+  double vy;
+  /* variances of px, py, v, yaw and yaw rate */
+  double variance[5];
+  /* NIS of the update */
+  double nis;
+} ukf_est_t;
+
+typedef struct ukf_ctx ukf_ctx;
+
+/* the API version the library was built with, UKF_C_API_VERSION */
+int ukf_api_version(void);
+
+/*
+ * Creates a context of tracks filters with the default settings, or those
+ * of a config file (see UKFConfig; path may be null). Returns null if
+ * tracks is 0, the file does not load or memory runs out; error, if not
+ * null, then gets a message of at most error_size bytes.
+ */
+ukf_ctx *ukf_create(size_t tracks, const char *config_path, char *error,
+                    size_t error_size);
+
+void ukf_destroy(ukf_ctx *ctx);
+
+/* retunes every track, keeping its state; UKF_ECONFIG for unknown keys */
+int ukf_set(ukf_ctx *ctx, const char *key, double value);
+
+/* number of tracks */
+size_t ukf_tracks(const ukf_ctx *ctx);
+
+/* returns a track to its uninitialised state */
+int ukf_reset(ukf_ctx *ctx, size_t track);
+
+/*
+ * Filters n measurements of track 0 in order; out, if not null, gets n
+ * estimates, one after each. Stops with UKF_EINVAL at the first
+ * measurement of an unknown sensor, the ones before it filtered.
+ */
+int ukf_process(ukf_ctx *ctx, const ukf_meas_t *meas, size_t n,
+                ukf_est_t *out);
+
+/*
+ * Filters n measurements of several tracks, meas[i] on track tracks[i],
+ * in order; out, if not null, gets n estimates. All the track ids are
+ * checked before any measurement is filtered.
+ */
+int ukf_process_batch(ukf_ctx *ctx, const uint32_t *tracks,
+                      const ukf_meas_t *meas, size_t n, ukf_est_t *out);
+
+/*
+ * Copies a track's posterior [px, py, v, yaw, yaw rate] and its 5 x 5
+ * covariance (row major; either may be null). initialized, if not null, is
+ * set to 0 before the track's first measurement and 1 after.
+ */
+int ukf_state(const ukf_ctx *ctx, size_t track, double x[5], double P[25],
+              int *initialized);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UKF_C_H_ */
@@ -0,0 +1,150 @@
+#include "ukf_config.h"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "tools.h"
+
+UKFConfig::UKFConfig()
+    : std_a(3.80),
+      std_yawdd(0.3),
+      std_laspx(0.15),
+      std_laspy(0.15),
+      std_radr(0.3),
+      std_radphi(0.03),
+      std_radrd(0.3),
+      alpha(1.0),
+      beta(0.0),
+      kappa(-4.0),
+      use_laser(true),
+      use_radar(true),
+      sqrt(false),
+      joseph(false),
+      fast_atan2(false),
+      motion_model(0),
+      sigma_points(0),
+      max_predict_step(0.0),
+      history_depth(0),
+      gate_lidar(0.0),
+      gate_radar(0.0),
+      gate_warmup(20),
+      adaptive_noise(0.0),
+      adaptive_noise_limit(4.0),
+      ekf_angle(0.0),
+      steady_state(0.0),
+      initial_covariance(0),
+      init_std_v(5.0),
+      init_std_yaw(M_PI),
+      init_std_yawd(1.0) {}
+
+bool UKFConfig::Set(const std::string &key, double value) {
+  if (key == "std_a") std_a = value;
+  else if (key == "std_yawdd") std_yawdd = value;
+  else if (key == "std_laspx") std_laspx = value;
+  else if (key == "std_laspy") std_laspy = value;
+  else if (key == "std_radr") std_radr = value;
+  else if (key == "std_radphi") std_radphi = value;
+  else if (key == "std_radrd") std_radrd = value;
+  else if (key == "alpha") alpha = value;
+  else if (key == "beta") beta = value;
+  else if (key == "kappa") kappa = value;
+  else if (key == "use_laser") use_laser = value != 0.0;
+  else if (key == "use_radar") use_radar = value != 0.0;
+  else if (key == "sqrt") sqrt = value != 0.0;
+  else if (key == "joseph") joseph = value != 0.0;
+  else if (key == "fast_atan2") fast_atan2 = value != 0.0;
+  else if (key == "motion_model") motion_model = static_cast<int>(value);
+  else if (key == "sigma_points") sigma_points = static_cast<int>(value);
+  else if (key == "max_predict_step") max_predict_step = value;
+  else if (key == "history_depth") history_depth = static_cast<int>(value);
+  else if (key == "gate_lidar") gate_lidar = value;
+  else if (key == "gate_radar") gate_radar = value;
+  else if (key == "gate_warmup") gate_warmup = static_cast<int>(value);
+  else if (key == "adaptive_noise") adaptive_noise = value;
+  else if (key == "adaptive_noise_limit") adaptive_noise_limit = value;
+  else if (key == "ekf_angle") ekf_angle = value;
+  else if (key == "steady_state") steady_state = value;
+  else if (key == "initial_covariance") {
+    initial_covariance = static_cast<int>(value);
+  }
+  else if (key == "init_std_v") init_std_v = value;
+  else if (key == "init_std_yaw") init_std_yaw = value;
+  else if (key == "init_std_yawd") init_std_yawd = value;
+  else return false;
+  return true;
+}
+
+bool UKFConfig::Load(const std::string &path, std::string *error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    *error = "cannot open " + path;
+    return false;
+  }
+
+  std::string line;
+  for (int number = 1; std::getline(in, line); number++) {
+    size_t hash = line.find('#');
+    if (hash != std::string::npos) {
+      line.erase(hash);
+    }
+    for (size_t i = 0; i < line.size(); i++) {
+      if (line[i] == '=') line[i] = ' ';
+    }
+
+    std::istringstream fields(line);
+    std::string key, text;
+    if (!(fields >> key)) {
+      continue;
+    }
+
+    //a number, or a boolean word
+    double value = 0.0;
+    bool ok = static_cast<bool>(fields >> text);
+    if (ok && text == "true") {
+      value = 1.0;
+    }
+    else if (ok && text != "false") {
+      //locale-independent, unlike strtod
+      const char *first = text.data() + (text[0] == '+' ? 1 : 0);
+      const char *last = text.data() + text.size();
+      const std::from_chars_result parsed = std::from_chars(first, last, value);
+      ok = parsed.ec == std::errc() && parsed.ptr == last;
+    }
+
+    if (!ok || !Set(key, value)) {
+      std::ostringstream message;
+      message << path << ":" << number << ": bad setting '" << key << "'";
+      *error = message.str();
+      return false;
+    }
+  }
+  return true;
+}
+
+unsigned long long UKFConfig::ModelHash() const {
+  StateDigest digest;
+  const double fields[] = {std_a, std_yawdd, std_laspx, std_laspy, std_radr,
+                           std_radphi, std_radrd, alpha, beta, kappa,
+                           static_cast<double>(motion_model)};
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    digest.Add(fields[i]);
+  }
+  //the sigma-point set, adaptive noise, EKF switching and the steady-state
+  //gain move the posterior too; left out at their defaults so existing
+  //hashes stay what they were
+  if (sigma_points != 0) {
+    digest.Add(static_cast<double>(sigma_points));
+  }
+  if (adaptive_noise > 0.0) {
+    digest.Add(adaptive_noise);
+    digest.Add(adaptive_noise_limit);
+  }
+  if (ekf_angle > 0.0) {
+    digest.Add(ekf_angle);
+  }
+  if (steady_state > 0.0) {
+    digest.Add(steady_state);
+  }
+  return digest.value();
+}
@@ -0,0 +1,127 @@
+#ifndef UKF_CONFIG_H_
+#define UKF_CONFIG_H_
+
+#include <string>
+
+/**
+ * Tunable filter parameters, so a deployment can change noise levels and
+ * modes without rebuilding. Defaults are the values the filter has always
+ * used. A UKF applies a config with Configure, which also rebuilds the
+ * noise and weight tables derived from it.
+ *
+ * Config files hold one "key value" (or "key = value") pair per line, with
+ * the keys named as the fields below; '#' starts a comment. Booleans are
+ * 0/1 or true/false.
+ */
+struct UKFConfig {
+  ///* process noise: longitudinal acceleration in m/s^2, yaw acceleration
+  ///* in rad/s^2
+  double std_a;
+  double std_yawdd;
+
+  ///* lidar noise in m
+  double std_laspx;
+  double std_laspy;
+
+  ///* radar noise: radius in m, angle in rad, radius change in m/s
+  double std_radr;
+  double std_radphi;
+  double std_radrd;
+
+  ///* scaled UKF parameters
+  double alpha;
+  double beta;
+  double kappa;
+
+  ///* sensors fused after initialisation
+  bool use_laser;
+  bool use_radar;
+
+  ///* square-root UKF
+  bool sqrt;
+
+  ///* Joseph-form lidar covariance update
+  bool joseph;
+
+  ///* polynomial atan2 for the radar bearing, within 1.7e-6 rad
+  bool fast_atan2;
+
+  ///* motion model: 0 CTRV, 1 constant velocity (UKF::MotionModel)
+  int motion_model;
+
+  ///* sigma-point set: 0 symmetric (2n + 1 = 15 points), 1 spherical
+  ///* simplex (n + 2 = 9), 2 cubature (2n = 14, all weights positive); see
+  ///* UKF::SigmaPoints. Square-root mode uses the symmetric set instead of
+  ///* the simplex.
+  int sigma_points;
+
+  ///* longest single prediction step in s; 0 for any gap in one step
+  double max_predict_step;
+
+  ///* measurements kept for out-of-sequence fusion; 0 for off
+  int history_depth;
+
+  ///* chi-square NIS gates per sensor, e.g. 13.8 and 16.3 (99.9% for 2 and
+  ///* 3 dof); 0 for off. The first gate_warmup updates are never gated.
+  double gate_lidar;
+  double gate_radar;
+  int gate_warmup;
+
+  ///* adaptive process noise: rate in (0, 1) at which the std_a and
+  ///* std_yawdd variances are rescaled towards NIS / dof = 1 after each
+  ///* fused update, e.g. 0.02; 0 for off (fixed noise). The scale stays
+  ///* within [1 / adaptive_noise_limit, adaptive_noise_limit].
+  double adaptive_noise;
+  double adaptive_noise_limit;
+
+  ///* UKF/EKF switching: spread in rad of the heading, and of the radar
+  ///* bearing to the position, below which a step is taken with the
+  ///* linearised (EKF) models instead of sigma points, e.g. 0.02; 0 for off.
+  ///* Not used in square-root mode.
+  double ekf_angle;
+
+  ///* steady-state lidar gain: relative change of the posterior P between
+  ///* constant-rate lidar updates below which the gain and covariance are
+  ///* cached and reused, e.g. 1e-4; 0 for off. Not used in square-root
+  ///* mode or with adaptive noise.
+  double steady_state;
+
+  ///* initial covariance: 0 zero (the historical behaviour), 1 from the
+  ///* first measurement's sensor noise plus the init_std_* priors below
+  int initial_covariance;
+
+  ///* prior standard deviations of the unobserved state at initialisation:
+  ///* speed in m/s, yaw in rad, yaw rate in rad/s
+  double init_std_v;
+  double init_std_yaw;
+  double init_std_yawd;
+
+  UKFConfig();
+
+  /**
+   * Sets one field by name
+   * @param key Field name
+   * @param value New value; 0 is false for booleans
+   * @return false for an unknown key
+   */
+  bool Set(const std::string &key, double value);
+
+  /**
+   * Reads a config file over the current values
+   * @param path File to read
+   * @param error Set to a description of the first bad line on failure
+   * @return false if the file could not be read or has a bad line
+   */
+  bool Load(const std::string &path, std::string *error);
+
+  /**
+   * Hash of the fields that shape the posterior: the noises, the
+   * sigma-point set and scaling, the motion model, adaptive noise and
+   * UKF/EKF switching.
+   * Gating, history and initialisation settings are left out, so retuning
+   * them keeps saved filter states usable.
+   */
+  unsigned long long ModelHash() const;
+};
+
+#endif /* UKF_CONFIG_H_ */
@@ -0,0 +1,408 @@
+#include "ukf_kernels.h"
+#include <cstdlib>
+#include <cstring>
+#include "angle.h"
+#include "batched_cholesky.h"
+#include "cholesky_update.h"
+
+// x86-64 GCC and Clang can compile a function for a wider ISA than the rest
+// of the build; elsewhere only the baseline versions exist
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define UKF_KERNEL_MULTIVERSION 1
+#define UKF_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define UKF_TARGET_AVX512 \
+  __attribute__((target("avx512f,avx512dq,avx512vl,avx2,fma")))
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UKF_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define UKF_ALWAYS_INLINE inline
+#endif
+
+namespace {
+
+typedef UKF::Scalar Scalar;
+
+// the kernel bodies, inlined into one wrapper per ISA so that each is
+// compiled with that ISA's code generation
+
+UKF_ALWAYS_INLINE void PredictCtrvBody(const UKF::AugSigmaMatrix &Xsig_aug,
+                                       double delta_t,
+                                       UKF::SigmaMatrix *Xsig_out) {
+  typedef Eigen::Array<Scalar, 1, UKF::n_sig_> SigmaRow;
+
+  //structure of arrays over the sigma points
+  const SigmaRow p_x = Xsig_aug.row(0).array();
+  const SigmaRow p_y = Xsig_aug.row(1).array();
+  const SigmaRow v = Xsig_aug.row(2).array();
+  const SigmaRow yaw = Xsig_aug.row(3).array();
+  const SigmaRow yawd = Xsig_aug.row(4).array();
+  const SigmaRow nu_a = Xsig_aug.row(5).array();
+  const SigmaRow nu_yawdd = Xsig_aug.row(6).array();
+
+  const Scalar dt = static_cast<Scalar>(delta_t);
+  const Scalar half_dt2 = Scalar(0.5) * dt * dt;
+
+  //trigonometry once per distinct angle
+  const SigmaRow yaw_p = yaw + yawd * dt;
+  SigmaRow sin_yaw, cos_yaw, sin_yaw_p, cos_yaw_p;
+  SinCosShared(yaw, &sin_yaw, &cos_yaw);
+  SinCosShared(yaw_p, &sin_yaw_p, &cos_yaw_p);
+
+  //blend the turning and straight-line cases; the unused lane divides by one
+  const Eigen::Array<bool, 1, UKF::n_sig_> turning = yawd.abs() > Scalar(0.001);
+  const SigmaRow v_yawd = v / turning.select(yawd, SigmaRow::Ones());
+  const SigmaRow v_dt = v * dt;
+  const SigmaRow dx = turning.select(v_yawd * (sin_yaw_p - sin_yaw),
+                                     v_dt * cos_yaw);
+  const SigmaRow dy = turning.select(v_yawd * (cos_yaw - cos_yaw_p),
+                                     v_dt * sin_yaw);
+
+  Xsig_out->row(0) = (p_x + dx).matrix();
+  Xsig_out->row(1) = (p_y + dy).matrix();
+  Xsig_out->row(2) = v.matrix();
+  Xsig_out->row(3) = yaw_p.matrix();
+  Xsig_out->row(4) = yawd.matrix();
+
+  //add noise, only in the columns where it is non-zero
+  const int nu_a_cols[2] = {UKF::nu_a_col_, UKF::nu_a_col_ + UKF::n_aug_};
+  const int nu_yawdd_cols[2] = {UKF::nu_yawdd_col_,
+                                UKF::nu_yawdd_col_ + UKF::n_aug_};
+  for (int k = 0; k < 2; k++) {
+    const int a = nu_a_cols[k];
+    (*Xsig_out)(0, a) += half_dt2 * nu_a(a) * cos_yaw(a);
+    (*Xsig_out)(1, a) += half_dt2 * nu_a(a) * sin_yaw(a);
+    (*Xsig_out)(2, a) += nu_a(a) * dt;
+    const int y = nu_yawdd_cols[k];
+    (*Xsig_out)(3, y) += half_dt2 * nu_yawdd(y);
+    (*Xsig_out)(4, y) += nu_yawdd(y) * dt;
+  }
+}
+
+// PredictCtrvBody for the first N columns of a reduced sigma-point set,
+// whose noise rows are dense, so the noise is added row-wise
+template <int N>
+UKF_ALWAYS_INLINE void PredictCtrvPointsBody(
+    const UKF::AugSigmaMatrix &Xsig_aug, double delta_t,
+    UKF::SigmaMatrix *Xsig_out) {
+  typedef Eigen::Array<Scalar, 1, N> SigmaRow;
+
+  const SigmaRow p_x = Xsig_aug.row(0).template head<N>().array();
+  const SigmaRow p_y = Xsig_aug.row(1).template head<N>().array();
+  const SigmaRow v = Xsig_aug.row(2).template head<N>().array();
+  const SigmaRow yaw = Xsig_aug.row(3).template head<N>().array();
+  const SigmaRow yawd = Xsig_aug.row(4).template head<N>().array();
+  const SigmaRow nu_a = Xsig_aug.row(5).template head<N>().array();
+  const SigmaRow nu_yawdd = Xsig_aug.row(6).template head<N>().array();
+
+  const Scalar dt = static_cast<Scalar>(delta_t);
+  const Scalar half_dt2 = Scalar(0.5) * dt * dt;
+
+  const SigmaRow yaw_p = yaw + yawd * dt;
+  SigmaRow sin_yaw, cos_yaw, sin_yaw_p, cos_yaw_p;
+  SinCosShared(yaw, &sin_yaw, &cos_yaw);
+  SinCosShared(yaw_p, &sin_yaw_p, &cos_yaw_p);
+
+  const Eigen::Array<bool, 1, N> turning = yawd.abs() > Scalar(0.001);
+  const SigmaRow v_yawd = v / turning.select(yawd, SigmaRow::Ones());
+  const SigmaRow v_dt = v * dt;
+  const SigmaRow dx = turning.select(v_yawd * (sin_yaw_p - sin_yaw),
+                                     v_dt * cos_yaw);
+  const SigmaRow dy = turning.select(v_yawd * (cos_yaw - cos_yaw_p),
+                                     v_dt * sin_yaw);
+  const SigmaRow s_a = half_dt2 * nu_a;
+
+  Xsig_out->row(0).template head<N>() = (p_x + dx + s_a * cos_yaw).matrix();
+  Xsig_out->row(1).template head<N>() = (p_y + dy + s_a * sin_yaw).matrix();
+  Xsig_out->row(2).template head<N>() = (v + nu_a * dt).matrix();
+  Xsig_out->row(3).template head<N>() =
+      (yaw_p + half_dt2 * nu_yawdd).matrix();
+  Xsig_out->row(4).template head<N>() = (yawd + nu_yawdd * dt).matrix();
+  Xsig_out->template rightCols<UKF::n_sig_ - N>().setZero();
+}
+
+// MeanAndCovarianceBody over the first N columns
+template <int N>
+UKF_ALWAYS_INLINE void MeanAndCovariancePointsBody(
+    const UKF::SigmaMatrix &Xsig_pred, const UKF::WeightVector &weights,
+    const UKF::WeightVector &weights_c, UKF::StateVector *x_out,
+    UKF::StateMatrix *P_out) {
+  typedef Eigen::Matrix<Scalar, UKF::n_x_, N> Points;
+  const UKF::StateVector x =
+      Xsig_pred.template leftCols<N>().lazyProduct(weights.template head<N>());
+  Points Xd = Xsig_pred.template leftCols<N>().colwise() - x;
+  NormalizeAngles(Xd.row(3));
+  const Points Xw = Xd * weights_c.template head<N>().asDiagonal();
+  *P_out = WeightedProduct<UKF::Accumulator>(Xw, Xd);
+  *x_out = x;
+}
+
+UKF_ALWAYS_INLINE void MeanAndCovarianceBody(const UKF::SigmaMatrix &Xsig_pred,
+                                             const UKF::WeightVector &weights,
+                                             const UKF::WeightVector &weights_c,
+                                             UKF::StateVector *x_out,
+                                             UKF::StateMatrix *P_out) {
+  //predicted state mean
+  const UKF::StateVector x = Xsig_pred * weights;
+
+  //state differences, yaw wrapped
+  UKF::SigmaMatrix Xd = Xsig_pred.colwise() - x;
+  NormalizeAngles(Xd.row(3));
+
+  //predicted state covariance matrix, summed in Accumulator precision
+  const UKF::SigmaMatrix Xw = Xd * weights_c.asDiagonal();
+  *P_out = WeightedProduct<UKF::Accumulator>(Xw, Xd);
+  *x_out = x;
+}
+
+void PredictCtrvBaseline(const UKF::AugSigmaMatrix &Xsig_aug, double delta_t,
+                         UKF::SigmaMatrix *Xsig_out) {
+  PredictCtrvBody(Xsig_aug, delta_t, Xsig_out);
+}
+
+void MeanAndCovarianceBaseline(const UKF::SigmaMatrix &Xsig_pred,
+                               const UKF::WeightVector &weights,
+                               const UKF::WeightVector &weights_c,
+                               UKF::StateVector *x_out,
+                               UKF::StateMatrix *P_out) {
+  MeanAndCovarianceBody(Xsig_pred, weights, weights_c, x_out, P_out);
+}
+
+void PredictCtrvSimplexBaseline(const UKF::AugSigmaMatrix &Xsig_aug,
+                                double delta_t, UKF::SigmaMatrix *Xsig_out) {
+  PredictCtrvPointsBody<UKF::n_sig_simplex_>(Xsig_aug, delta_t, Xsig_out);
+}
+
+void MeanAndCovarianceSimplexBaseline(const UKF::SigmaMatrix &Xsig_pred,
+                                      const UKF::WeightVector &weights,
+                                      const UKF::WeightVector &weights_c,
+                                      UKF::StateVector *x_out,
+                                      UKF::StateMatrix *P_out) {
+  MeanAndCovariancePointsBody<UKF::n_sig_simplex_>(Xsig_pred, weights,
+                                                   weights_c, x_out, P_out);
+}
+
+void BatchedCholeskyBaseline(const double *P, double *L, int stride,
+                             int begin, int end) {
+  BatchedCholesky<UKF::n_x_>(P, L, stride, begin, end);
+}
+
+#ifdef UKF_KERNEL_MULTIVERSION
+UKF_TARGET_AVX2
+void PredictCtrvAvx2(const UKF::AugSigmaMatrix &Xsig_aug, double delta_t,
+                     UKF::SigmaMatrix *Xsig_out) {
+  PredictCtrvBody(Xsig_aug, delta_t, Xsig_out);
+}
+
+UKF_TARGET_AVX2
+void MeanAndCovarianceAvx2(const UKF::SigmaMatrix &Xsig_pred,
+                           const UKF::WeightVector &weights,
+                           const UKF::WeightVector &weights_c,
+                           UKF::StateVector *x_out, UKF::StateMatrix *P_out) {
+  MeanAndCovarianceBody(Xsig_pred, weights, weights_c, x_out, P_out);
+}
+
+UKF_TARGET_AVX2
+void PredictCtrvSimplexAvx2(const UKF::AugSigmaMatrix &Xsig_aug,
+                            double delta_t, UKF::SigmaMatrix *Xsig_out) {
+  PredictCtrvPointsBody<UKF::n_sig_simplex_>(Xsig_aug, delta_t, Xsig_out);
+}
+
+UKF_TARGET_AVX2
+void MeanAndCovarianceSimplexAvx2(const UKF::SigmaMatrix &Xsig_pred,
+                                  const UKF::WeightVector &weights,
+                                  const UKF::WeightVector &weights_c,
+                                  UKF::StateVector *x_out,
+                                  UKF::StateMatrix *P_out) {
+  MeanAndCovariancePointsBody<UKF::n_sig_simplex_>(Xsig_pred, weights,
+                                                   weights_c, x_out, P_out);
+}
+
+UKF_TARGET_AVX2
+void BatchedCholeskyAvx2(const double *P, double *L, int stride, int begin,
+                         int end) {
+  BatchedCholesky<UKF::n_x_>(P, L, stride, begin, end);
+}
+
+UKF_TARGET_AVX512
+void PredictCtrvAvx512(const UKF::AugSigmaMatrix &Xsig_aug, double delta_t,
+                       UKF::SigmaMatrix *Xsig_out) {
+  PredictCtrvBody(Xsig_aug, delta_t, Xsig_out);
+}
+
+UKF_TARGET_AVX512
+void MeanAndCovarianceAvx512(const UKF::SigmaMatrix &Xsig_pred,
+                             const UKF::WeightVector &weights,
+                             const UKF::WeightVector &weights_c,
+                             UKF::StateVector *x_out, UKF::StateMatrix *P_out) {
+  MeanAndCovarianceBody(Xsig_pred, weights, weights_c, x_out, P_out);
+}
+
+UKF_TARGET_AVX512
+void PredictCtrvSimplexAvx512(const UKF::AugSigmaMatrix &Xsig_aug,
+                              double delta_t, UKF::SigmaMatrix *Xsig_out) {
+  PredictCtrvPointsBody<UKF::n_sig_simplex_>(Xsig_aug, delta_t, Xsig_out);
+}
+
+UKF_TARGET_AVX512
+void MeanAndCovarianceSimplexAvx512(const UKF::SigmaMatrix &Xsig_pred,
+                                    const UKF::WeightVector &weights,
+                                    const UKF::WeightVector &weights_c,
+                                    UKF::StateVector *x_out,
+                                    UKF::StateMatrix *P_out) {
+  MeanAndCovariancePointsBody<UKF::n_sig_simplex_>(Xsig_pred, weights,
+                                                   weights_c, x_out, P_out);
+}
+
+UKF_TARGET_AVX512
+void BatchedCholeskyAvx512(const double *P, double *L, int stride, int begin,
+                           int end) {
+  BatchedCholesky<UKF::n_x_>(P, L, stride, begin, end);
+}
+#endif
+
+const UkfKernels kTables[UkfKernels::ISA_COUNT] = {
+  {UkfKernels::BASELINE, PredictCtrvBaseline, MeanAndCovarianceBaseline,
+   PredictCtrvSimplexBaseline, MeanAndCovarianceSimplexBaseline,
+   BatchedCholeskyBaseline},
+#ifdef UKF_KERNEL_MULTIVERSION
+  {UkfKernels::AVX2, PredictCtrvAvx2, MeanAndCovarianceAvx2,
+   PredictCtrvSimplexAvx2, MeanAndCovarianceSimplexAvx2,
+   BatchedCholeskyAvx2},
+  {UkfKernels::AVX512, PredictCtrvAvx512, MeanAndCovarianceAvx512,
+   PredictCtrvSimplexAvx512, MeanAndCovarianceSimplexAvx512,
+   BatchedCholeskyAvx512},
+#else
+  {UkfKernels::AVX2, nullptr, nullptr, nullptr, nullptr, nullptr},
+  {UkfKernels::AVX512, nullptr, nullptr, nullptr, nullptr, nullptr},
+#endif
+};
+
+const char *const kNames[UkfKernels::ISA_COUNT] = {"baseline", "avx2",
+                                                   "avx512"};
+
+const char *const kKernelNames[UkfKernels::KERNEL_COUNT] = {
+  "predict_ctrv", "mean_and_covariance", "predict_ctrv_simplex",
+  "mean_and_covariance_simplex", "batched_cholesky"
+};
+
+bool CpuSupports(UkfKernels::Isa isa) {
+#ifdef UKF_KERNEL_MULTIVERSION
+  __builtin_cpu_init();
+  switch (isa) {
+    case UkfKernels::AVX2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case UkfKernels::AVX512:
+      return __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512dq") &&
+             __builtin_cpu_supports("avx512vl") && CpuSupports(UkfKernels::AVX2);
+    default:
+      return true;
+  }
+#else
+  return isa == UkfKernels::BASELINE;
+#endif
+}
+
+const UkfKernels *Select() {
+  //the widest supported ISA, capped by UKF_KERNEL_ISA
+  int cap = UkfKernels::ISA_COUNT - 1;
+  const char *requested = getenv("UKF_KERNEL_ISA");
+  if (requested) {
+    for (int i = 0; i < UkfKernels::ISA_COUNT; i++) {
+      if (strcmp(requested, kNames[i]) == 0) {
+        cap = i;
+      }
+    }
+  }
+  for (int i = cap; i > UkfKernels::BASELINE; i--) {
+    const UkfKernels *kernels = UkfKernels::Get(UkfKernels::Isa(i));
+    if (kernels) {
+      return kernels;
+    }
+  }
+  return &kTables[UkfKernels::BASELINE];
+}
+
+// Selected() and the table each of its kernels was copied from
+struct Selection {
+  Selection() : table(*Select()) {
+    for (int k = 0; k < UkfKernels::KERNEL_COUNT; k++) {
+      source[k] = table.isa;
+    }
+  }
+
+  UkfKernels table;
+  UkfKernels::Isa source[UkfKernels::KERNEL_COUNT];
+};
+
+Selection &Current() {
+  static Selection selection;
+  return selection;
+}
+
+}  // namespace
+
+const UkfKernels &UkfKernels::Selected() {
+  return Current().table;
+}
+
+bool UkfKernels::Use(Kernel kernel, Isa isa) {
+  const UkfKernels *from = Get(isa);
+  if (!from || kernel < 0 || kernel >= KERNEL_COUNT) {
+    return false;
+  }
+  UkfKernels &to = Current().table;
+  switch (kernel) {
+    case PREDICT_CTRV:
+      to.predict_ctrv = from->predict_ctrv;
+      break;
+    case MEAN_AND_COVARIANCE:
+      to.mean_and_covariance = from->mean_and_covariance;
+      break;
+    case PREDICT_CTRV_SIMPLEX:
+      to.predict_ctrv_simplex = from->predict_ctrv_simplex;
+      break;
+    case MEAN_AND_COVARIANCE_SIMPLEX:
+      to.mean_and_covariance_simplex = from->mean_and_covariance_simplex;
+      break;
+    default:
+      to.batched_cholesky = from->batched_cholesky;
+      break;
+  }
+  Current().source[kernel] = isa;
+  return true;
+}
+
+UkfKernels::Isa UkfKernels::Source(Kernel kernel) {
+  return Current().source[kernel];
+}
+
+const UkfKernels *UkfKernels::Get(Isa isa) {
+  if (isa < 0 || isa >= ISA_COUNT || !kTables[isa].predict_ctrv ||
+      !CpuSupports(isa)) {
+    return nullptr;
+  }
+  return &kTables[isa];
+}
+
+const char *UkfKernels::Name(Isa isa) {
+  return isa >= 0 && isa < ISA_COUNT ? kNames[isa] : "unknown";
+}
+
+int UkfKernels::Lanes(Isa isa) {
+  switch (isa) {
+  case AVX2:
+    return 4;
+  case AVX512:
+    return 8;
+  default:
+    return 2;
+  }
+}
+
+const char *UkfKernels::Name(Kernel kernel) {
+  return kernel >= 0 && kernel < KERNEL_COUNT ? kKernelNames[kernel]
+                                              : "unknown";
+}
@@ -0,0 +1,113 @@
+#ifndef UKF_KERNELS_H_
+#define UKF_KERNELS_H_
+
+#include "ukf.h"
+
+/**
+ * The UKF's data-parallel kernels, compiled once per instruction set and
+ * picked at run time, so one binary uses the widest ISA each node has.
+ * Every version is the same source built with a target attribute (GCC/Clang
+ * function multiversioning); only the code generation differs. The file is
+ * compiled without FMA contraction, so every version gives bit-identical
+ * results.
+ */
+struct UkfKernels {
+  enum Isa {
+    ///* the build's baseline: SSE2 on x86-64, NEON on AArch64
+    BASELINE,
+    ///* x86-64 AVX2 with FMA
+    AVX2,
+    ///* x86-64 AVX-512 F/DQ/VL
+    AVX512,
+    ISA_COUNT
+  };
+
+  ///* the kernels of Selected(), each of which may come from another ISA's
+  ///* table after Use
+  enum Kernel {
+    PREDICT_CTRV,
+    MEAN_AND_COVARIANCE,
+    PREDICT_CTRV_SIMPLEX,
+    MEAN_AND_COVARIANCE_SIMPLEX,
+    BATCHED_CHOLESKY,
+    KERNEL_COUNT
+  };
+
+  ///* for Selected(), the widest ISA allowed; the ISA of the table otherwise
+  Isa isa;
+
+  /**
+   * Branch-free CTRV prediction of every augmented sigma point, see
+   * UKF::PredictSigmaPointsVectorized
+   */
+  void (*predict_ctrv)(const UKF::AugSigmaMatrix &Xsig_aug, double delta_t,
+                       UKF::SigmaMatrix *Xsig_out);
+
+  /**
+   * Weighted mean and covariance of the predicted sigma points, see
+   * UKF::PredictMeanAndCovariance
+   */
+  void (*mean_and_covariance)(const UKF::SigmaMatrix &Xsig_pred,
+                              const UKF::WeightVector &weights,
+                              const UKF::WeightVector &weights_c,
+                              UKF::StateVector *x_out,
+                              UKF::StateMatrix *P_out);
+
+  /**
+   * predict_ctrv and mean_and_covariance for the spherical simplex set, on
+   * its first UKF::n_sig_simplex_ columns; the prediction zeroes the
+   * padding columns
+   */
+  void (*predict_ctrv_simplex)(const UKF::AugSigmaMatrix &Xsig_aug,
+                               double delta_t, UKF::SigmaMatrix *Xsig_out);
+  void (*mean_and_covariance_simplex)(const UKF::SigmaMatrix &Xsig_pred,
+                                      const UKF::WeightVector &weights,
+                                      const UKF::WeightVector &weights_c,
+                                      UKF::StateVector *x_out,
+                                      UKF::StateMatrix *P_out);
+
+  /**
+   * Cholesky factors of the 5x5 covariances of tracks [begin, end) in
+   * UKFBank's packed rows, see BatchedCholesky
+   */
+  void (*batched_cholesky)(const double *P, double *L, int stride, int begin,
+                           int end);
+
+  /**
+   * The kernels for the best ISA this CPU supports, chosen on first use and
+   * fixed for the life of the process. The environment variable
+   * UKF_KERNEL_ISA (baseline, avx2, avx512) caps the choice, e.g. to compare
+   * versions or to match another node.
+   */
+  static const UkfKernels &Selected();
+
+  /**
+   * The kernels for one ISA
+   * @param isa Instruction set
+   * @return nullptr if this build or CPU lacks them
+   */
+  static const UkfKernels *Get(Isa isa);
+
+  /**
+   * Switches one kernel of Selected() to another ISA's version, e.g. the
+   * one a calibration found fastest on this host (see KernelAutotune).
+   * Filters read the table without synchronisation, so this is for startup,
+   * before any of them runs. Every version gives the same results.
+   * @param kernel Kernel to switch
+   * @param isa Table to take it from
+   * @return false if this build or CPU lacks that ISA
+   */
+  static bool Use(Kernel kernel, Isa isa);
+
+  ///* the ISA whose version of a kernel Selected() holds
+  static Isa Source(Kernel kernel);
+
+  static const char *Name(Isa isa);
+  static const char *Name(Kernel kernel);
+
+  ///* doubles per vector register of an ISA, the tracks one batched
+  ///* kernel step handles
+  static int Lanes(Isa isa);
+};
+
+#endif /* UKF_KERNELS_H_ */
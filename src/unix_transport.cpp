@@ -0,0 +1,213 @@
+#include "unix_transport.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "binary_protocol.h"
+#include "logger.h"
+#include "metrics.h"
+
+const size_t UnixTransport::kMaxPending;
+
+namespace {
+
+// bytes asked for per read
+const size_t kReadSize = 64 * 1024;
+
+bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+}  // namespace
+
+UnixTransport::UnixTransport(const UKF &prototype, size_t history_capacity,
+                             bool evaluate, MeasurementJournal *journal)
+    : prototype_(prototype),
+      history_capacity_(history_capacity),
+      evaluate_(evaluate),
+      journal_(journal),
+      listen_fd_(-1) {
+  wake_[0] = wake_[1] = -1;
+}
+
+UnixTransport::~UnixTransport() {
+  for (size_t i = 0; i < clients_.size(); i++) {
+    close(clients_[i]->fd);
+    delete clients_[i];
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(path_.c_str());
+  }
+  for (int i = 0; i < 2; i++) {
+    if (wake_[i] >= 0) {
+      close(wake_[i]);
+    }
+  }
+}
+
+bool UnixTransport::Listen(const char *path, std::string *error) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    *error = std::string("socket path too long: ") + path;
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+
+  if (pipe(wake_) != 0) {
+    *error = std::string("pipe: ") + strerror(errno);
+    return false;
+  }
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    *error = std::string("socket: ") + strerror(errno);
+    return false;
+  }
+  //a socket file left behind by a previous run would make bind fail
+  unlink(path);
+  if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr),
+           sizeof(addr)) != 0 ||
+      listen(listen_fd_, SOMAXCONN) != 0 || !SetNonBlocking(listen_fd_)) {
+    *error = std::string(path) + ": " + strerror(errno);
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  path_ = path;
+  return true;
+}
+
+void UnixTransport::Run() {
+  std::vector<pollfd> fds;
+  while (true) {
+    //wake pipe, listening socket, then one entry per client, in order
+    fds.resize(2 + clients_.size());
+    fds[0].fd = wake_[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = listen_fd_;
+    fds[1].events = POLLIN;
+    for (size_t i = 0; i < clients_.size(); i++) {
+      const Client *c = clients_[i];
+      size_t pending = c->out.size() - c->sent;
+      fds[2 + i].fd = c->fd;
+      fds[2 + i].events = static_cast<short>(
+          (pending < kMaxPending ? POLLIN : 0) | (pending ? POLLOUT : 0));
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+      fds[i].revents = 0;
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      UKF_LOG_ERROR("poll: %s", strerror(errno));
+      return;
+    }
+    if (fds[0].revents) {
+      return;
+    }
+
+    //clients accepted below are polled from the next round on
+    size_t polled = clients_.size();
+    size_t kept = 0;
+    for (size_t i = 0; i < polled; i++) {
+      Client *c = clients_[i];
+      short revents = fds[2 + i].revents;
+      bool alive = true;
+      if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        alive = Read(c);
+      }
+      if (alive && c->sent < c->out.size()) {
+        alive = Write(c);
+      }
+      if (alive) {
+        clients_[kept++] = c;
+      }
+      else {
+        close(c->fd);
+        delete c;
+        UKF_LOG_INFO("Unix socket client disconnected");
+      }
+    }
+    clients_.resize(kept);
+
+    if (fds[1].revents & POLLIN) {
+      Accept();
+    }
+  }
+}
+
+void UnixTransport::Stop() {
+  char c = 0;
+  if (write(wake_[1], &c, 1) < 0) {
+    UKF_LOG_WARN("Unix transport wake-up failed: %s", strerror(errno));
+  }
+}
+
+void UnixTransport::Accept() {
+  while (true) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        UKF_LOG_WARN("accept: %s", strerror(errno));
+      }
+      return;
+    }
+    if (!SetNonBlocking(fd)) {
+      close(fd);
+      continue;
+    }
+    clients_.push_back(
+        new Client(fd, prototype_, history_capacity_, evaluate_));
+    UKF_LOG_INFO("Unix socket client connected");
+  }
+}
+
+bool UnixTransport::Read(Client *client) {
+  std::vector<char> &in = client->in;
+  size_t old_size = in.size();
+  in.resize(old_size + kReadSize);
+  ssize_t n = read(client->fd, in.data() + old_size, kReadSize);
+  if (n <= 0) {
+    in.resize(old_size);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                     errno == EINTR);
+  }
+  in.resize(old_size + static_cast<size_t>(n));
+  Metrics::Increment(Metrics::MESSAGES_BINARY);
+
+  //whole records are filtered now, a partial one waits for the next read
+  size_t count = in.size() / BinaryProtocol::kMeasurementRecordSize;
+  if (journal_) {
+    journal_->Append(client->session.id_, MeasurementJournal::NowUs(),
+                     in.data(), count);
+  }
+  size_t bytes = client->session.ProcessRecords(in.data(), count);
+  const std::vector<char> &reply = client->session.reply_;
+  client->out.insert(client->out.end(), reply.begin(),
+                     reply.begin() + bytes);
+  in.erase(in.begin(),
+           in.begin() + count * BinaryProtocol::kMeasurementRecordSize);
+  return true;
+}
+
+bool UnixTransport::Write(Client *client) {
+  ssize_t n = send(client->fd, client->out.data() + client->sent,
+                   client->out.size() - client->sent, MSG_NOSIGNAL);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+  client->sent += static_cast<size_t>(n);
+  if (client->sent == client->out.size()) {
+    client->out.clear();
+    client->sent = 0;
+  }
+  return true;
+}
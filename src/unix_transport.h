@@ -0,0 +1,104 @@
+#ifndef UNIX_TRANSPORT_H_
+#define UNIX_TRANSPORT_H_
+
+#include <string>
+#include <vector>
+#include "measurement_journal.h"
+#include "metrics.h"
+#include "session.h"
+#include "ukf.h"
+
+/**
+ * Ingestion over a Unix domain stream socket, for producers on the same
+ * host: no TCP stack, handshake or WebSocket framing. The stream is a plain
+ * sequence of BinaryProtocol measurement records, answered on the same
+ * socket with one estimate record per measurement, exactly as a binary
+ * WebSocket frame would be. Records may be split across reads.
+ *
+ * Every connection gets its own Session, filtered inline on the thread that
+ * calls Run; one poll loop serves all connections. A client that does not
+ * read its estimates is not read from either once kMaxPending bytes of them
+ * are waiting.
+ */
+class UnixTransport {
+public:
+  ///* unsent estimate bytes after which a client's input is left unread
+  static const size_t kMaxPending = 1 << 20;
+
+  /**
+   * Constructor
+   * @param prototype Filter configuration for new tracks; must outlive the
+   * transport
+   * @param history_capacity Estimate/ground-truth pairs kept per session
+   * @param evaluate Whether sessions score against ground truth
+   * @param journal If not null, every record is journaled as it arrives;
+   * must outlive the transport
+   */
+  UnixTransport(const UKF &prototype, size_t history_capacity, bool evaluate,
+                MeasurementJournal *journal = nullptr);
+
+  /**
+   * Destructor; closes every connection and removes the socket file
+   */
+  virtual ~UnixTransport();
+
+  /**
+   * Binds and listens on a socket path, replacing a stale socket file
+   * @param path File system path of the socket
+   * @param error Reason for a failure
+   * @return false if the socket could not be set up
+   */
+  bool Listen(const char *path, std::string *error);
+
+  /**
+   * Serves connections until Stop is called
+   */
+  void Run();
+
+  /**
+   * Makes Run return; may be called from any thread
+   */
+  void Stop();
+
+private:
+  struct Client {
+    Client(int fd, const UKF &prototype, size_t history_capacity,
+           bool evaluate)
+        : fd(fd), session(prototype, history_capacity, evaluate), sent(0) {
+      Metrics::SessionOpened();
+    }
+    ~Client() { Metrics::SessionClosed(); }
+
+    int fd;
+    Session session;
+    ///* the tail of a record split across reads
+    std::vector<char> in;
+    ///* estimate records not yet written, from offset sent
+    std::vector<char> out;
+    size_t sent;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  // accepts every pending connection
+  void Accept();
+
+  // reads and filters what is available; false once the client is gone
+  bool Read(Client *client);
+
+  // writes pending estimates; false once the client is gone
+  bool Write(Client *client);
+
+  const UKF &prototype_;
+  const size_t history_capacity_;
+  const bool evaluate_;
+  MeasurementJournal *const journal_;
+
+  std::string path_;
+  int listen_fd_;
+  ///* self-pipe that wakes poll for Stop
+  int wake_[2];
+  std::vector<Client *> clients_;
+};
+
+#endif /* UNIX_TRANSPORT_H_ */